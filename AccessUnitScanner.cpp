@@ -0,0 +1,95 @@
+//------------------------------------------------------------------------------
+// File: AccessUnitScanner.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Finds where the access units of an Annex B stream end while it
+// arrives in pieces of any size, so that the decoder is only given whole
+// pictures.
+//
+// After a picture, an access unit delimiter, SPS, PPS, SEI or the NAL
+// types 14..18 start the next access unit (7.4.1.2.3), as does a slice
+// with first_mb_in_slice = 0. Slices of redundant pictures or pictures
+// split across several slice groups are not told apart.
+//
+//------------------------------------------------------------------------------
+
+#include "AccessUnitScanner.h"
+#include "H264Headers.h"
+#include <stddef.h>
+
+#define SCAN_DATA			0	// Inside a NAL unit
+#define SCAN_NAL_HEADER		1	// The next byte is a NAL header
+#define SCAN_SLICE_HEADER	2	// The next byte starts a slice header
+
+AccessUnitScanner::AccessUnitScanner()
+{
+	this->Reset();
+}
+
+AccessUnitScanner::~AccessUnitScanner()
+{
+}
+
+void AccessUnitScanner::Reset( void )
+{
+	m_Offset = 0;
+	m_Zeros = 0;
+	m_State = SCAN_DATA;
+	m_NalStart = 0;
+	m_HasPicture = false;
+}
+
+long AccessUnitScanner::Scan( const unsigned char* inData, long inLength,
+							  long long* outBoundaries, int inMaxBoundaries, int* outCount )
+{
+	int count = 0;
+	long i;
+
+	for (i = 0; i < inLength && count < inMaxBoundaries; i++)
+	{
+		unsigned char value = inData[i];
+
+		if (m_State == SCAN_NAL_HEADER)
+		{
+			int type = value & 0x1f;
+			if (type == NAL_TYPE_SLICE || type == NAL_TYPE_IDR)
+			{
+				m_State = SCAN_SLICE_HEADER;
+			}
+			else
+			{
+				if (type == NAL_TYPE_AUD || type == NAL_TYPE_SPS || type == NAL_TYPE_PPS ||
+					type == NAL_TYPE_SEI || (type >= 14 && type <= 18))
+				{
+					if (m_HasPicture)
+						outBoundaries[count++] = m_NalStart;
+					m_HasPicture = false;
+				}
+				m_State = SCAN_DATA;
+			}
+		}
+		else if (m_State == SCAN_SLICE_HEADER)
+		{
+			// first_mb_in_slice = 0 is ue(v) '1'
+			if ((value & 0x80) && m_HasPicture)
+				outBoundaries[count++] = m_NalStart;
+			m_HasPicture = true;
+			m_State = SCAN_DATA;
+		}
+
+		// 00 00 01, with the zero byte of a four byte start code
+		if (value == 1 && m_Zeros >= 2)
+		{
+			m_NalStart = m_Offset + i - (m_Zeros >= 3 ? 3 : 2);
+			m_State = SCAN_NAL_HEADER;
+		}
+		m_Zeros = (value == 0) ? m_Zeros + 1 : 0;
+	}
+
+	m_Offset += i;
+	*outCount = count;
+	return i;
+}
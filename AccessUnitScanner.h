@@ -0,0 +1,45 @@
+//------------------------------------------------------------------------------
+// File: AccessUnitScanner.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Finds where the access units of an Annex B stream end while it
+// arrives in pieces of any size, so that the decoder is only given whole
+// pictures.
+//
+//------------------------------------------------------------------------------
+
+#ifndef ACCESS_UNIT_SCANNER_H_
+#define ACCESS_UNIT_SCANNER_H_
+
+class AccessUnitScanner
+{
+public:
+
+	AccessUnitScanner();
+	virtual ~AccessUnitScanner();
+
+	void	Reset(void);
+
+	// Scans the next data of the stream. The stream offsets where a new
+	// access unit starts (the previous one being complete) go to
+	// outBoundaries. Stops early if inMaxBoundaries are found; returns the
+	// bytes consumed.
+	long	Scan(const unsigned char* inData, long inLength,
+				 long long* outBoundaries, int inMaxBoundaries, int* outCount);
+
+	// Stream bytes scanned so far
+	long long	GetOffset(void) const { return m_Offset; }
+
+private:
+
+	long long	m_Offset;
+	int			m_Zeros;		// Zero bytes before the current one
+	int			m_State;		// Header bytes still to read, see the .cpp
+	long long	m_NalStart;		// Offset of the start code of the current NAL unit
+	bool		m_HasPicture;	// The current access unit has a slice
+};
+
+#endif
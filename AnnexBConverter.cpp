@@ -0,0 +1,228 @@
+//------------------------------------------------------------------------------
+// File: AnnexBConverter.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Turns length-prefixed H.264 samples (AVC1) into the Annex B
+// byte stream the CUDA parser expects. 4-byte prefixes are replaced
+// by start codes in place, other sizes go through a scratch buffer.
+// Also keeps the out-of-band parameter sets for injection.
+//
+//------------------------------------------------------------------------------
+
+#include "AnnexBConverter.h"
+#include <stdio.h>
+#include <string.h>
+
+static const unsigned char startCode[4] = { 0, 0, 0, 1 };
+
+static inline long ReadLength( const unsigned char* inData, int inSize )
+{
+	long length = 0;
+	for (int i=0; i<inSize; i++)
+	{
+		length = (length << 8) | inData[i];
+	}
+	return length;
+}
+
+AnnexBConverter::AnnexBConverter() :	m_NalLengthSize(0),
+										m_ParameterSets(NULL),
+										m_ParameterSetsLength(0),
+										m_ParameterSetsSent(false),
+										m_Scratch(NULL),
+										m_ScratchSize(0)
+{
+
+}
+
+AnnexBConverter::~AnnexBConverter()
+{
+	delete[] m_ParameterSets;
+	delete[] m_Scratch;
+}
+
+bool AnnexBConverter::Init( int inNalLengthSize, const unsigned char* inSequenceHeader, long inHeaderLength )
+{
+	this->Clear();
+
+	if (inNalLengthSize != 0 && inNalLengthSize != 1 && inNalLengthSize != 2 && inNalLengthSize != 4)
+	{
+		printf("Unsupported NAL length size %d\n", inNalLengthSize);
+		return false;
+	}
+	m_NalLengthSize = inNalLengthSize;
+	if (inSequenceHeader == NULL || inHeaderLength <= 0)
+		return true;
+
+	// Each set grows by at most 2 bytes over its 2-byte length prefix
+	m_ParameterSets = new unsigned char[2 * inHeaderLength + 8];
+
+	if (m_NalLengthSize == 0)
+	{
+		memcpy(m_ParameterSets, inSequenceHeader, inHeaderLength);
+		m_ParameterSetsLength = inHeaderLength;
+		return true;
+	}
+
+	// MPEG2VIDEOINFO: parameter sets with 2-byte length prefixes
+	const unsigned char* data = inSequenceHeader;
+	const unsigned char* end  = inSequenceHeader + inHeaderLength;
+	while (end - data >= 2)
+	{
+		long length = ReadLength(data, 2);
+		if (end - data - 2 < length)
+		{
+			printf("Truncated sequence header\n");
+			return false;
+		}
+		AppendParameterSet(data + 2, length);
+		data += 2 + length;
+	}
+	return true;
+}
+
+bool AnnexBConverter::InitAvcC( const unsigned char* inRecord, long inLength )
+{
+	this->Clear();
+
+	// avcC record: version, profile, compatibility, level, length size,
+	// then SPS count and SPSs, PPS count and PPSs
+	if (inRecord == NULL || inLength < 7 || inRecord[0] != 1)
+	{
+		printf("Invalid avcC record\n");
+		return false;
+	}
+	int nalLengthSize = (inRecord[4] & 3) + 1;
+	if (nalLengthSize == 3)
+	{
+		printf("Unsupported NAL length size 3\n");
+		return false;
+	}
+	m_NalLengthSize = nalLengthSize;
+
+	// Each set grows by at most 2 bytes over its 2-byte length prefix
+	m_ParameterSets = new unsigned char[2 * inLength + 8];
+
+	const unsigned char* data = inRecord + 5;
+	const unsigned char* end  = inRecord + inLength;
+	for (int list=0; list<2; list++)
+	{
+		if (data >= end)
+			break;
+		int count = (list == 0) ? (*data & 0x1f) : *data;
+		data++;
+		for (int i=0; i<count; i++)
+		{
+			if (end - data < 2 || end - data - 2 < ReadLength(data, 2))
+			{
+				printf("Truncated avcC record\n");
+				return false;
+			}
+			AppendParameterSet(data + 2, ReadLength(data, 2));
+			data += 2 + ReadLength(data, 2);
+		}
+	}
+	return true;
+}
+
+void AnnexBConverter::Clear( void )
+{
+	delete[] m_ParameterSets;
+	m_ParameterSets       = NULL;
+	m_ParameterSetsLength = 0;
+	m_ParameterSetsSent   = false;
+	m_NalLengthSize       = 0;
+}
+
+void AnnexBConverter::Reset( void )
+{
+	m_ParameterSetsSent = false;
+}
+
+const unsigned char* AnnexBConverter::GetParameterSets( long* outLength ) const
+{
+	*outLength = m_ParameterSetsLength;
+	return m_ParameterSetsLength ? m_ParameterSets : NULL;
+}
+
+const unsigned char* AnnexBConverter::TakeParameterSets( long* outLength )
+{
+	if (m_ParameterSetsSent || m_ParameterSetsLength == 0)
+		return NULL;
+
+	m_ParameterSetsSent = true;
+	*outLength = m_ParameterSetsLength;
+	return m_ParameterSets;
+}
+
+unsigned char* AnnexBConverter::Convert( unsigned char* ioData, long inLength, long* outLength )
+{
+	*outLength = inLength;
+	if (m_NalLengthSize == 0)
+		return ioData;
+
+	// Same size: overwrite the prefixes, no copy at all
+	if (m_NalLengthSize == 4)
+	{
+		for (long pos = 0; pos < inLength; )
+		{
+			if (inLength - pos < 4)
+				return NULL;
+			long length = ReadLength(ioData + pos, 4);
+			if (length < 0 || inLength - pos - 4 < length)
+				return NULL;
+			memcpy(ioData + pos, startCode, 4);
+			pos += 4 + length;
+		}
+		return ioData;
+	}
+
+	// Shorter prefixes grow the sample, measure it first
+	long converted = 0;
+	for (long pos = 0; pos < inLength; )
+	{
+		if (inLength - pos < m_NalLengthSize)
+			return NULL;
+		long length = ReadLength(ioData + pos, m_NalLengthSize);
+		if (inLength - pos - m_NalLengthSize < length)
+			return NULL;
+		converted += 4 + length;
+		pos += m_NalLengthSize + length;
+	}
+	ReserveScratch(converted);
+
+	unsigned char* out = m_Scratch;
+	for (long pos = 0; pos < inLength; )
+	{
+		long length = ReadLength(ioData + pos, m_NalLengthSize);
+		memcpy(out, startCode, 4);
+		memcpy(out + 4, ioData + pos + m_NalLengthSize, length);
+		out += 4 + length;
+		pos += m_NalLengthSize + length;
+	}
+	*outLength = converted;
+	return m_Scratch;
+}
+
+void AnnexBConverter::AppendParameterSet( const unsigned char* inData, long inLength )
+{
+	if (inLength <= 0)
+		return;
+
+	memcpy(m_ParameterSets + m_ParameterSetsLength, startCode, 4);
+	memcpy(m_ParameterSets + m_ParameterSetsLength + 4, inData, inLength);
+	m_ParameterSetsLength += 4 + inLength;
+}
+
+void AnnexBConverter::ReserveScratch( long inSize )
+{
+	if (inSize <= m_ScratchSize)
+		return;
+
+	delete[] m_Scratch;
+	m_ScratchSize = inSize + inSize / 4;
+	m_Scratch = new unsigned char[m_ScratchSize];
+}
@@ -0,0 +1,69 @@
+//------------------------------------------------------------------------------
+// File: AnnexBConverter.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Turns length-prefixed H.264 samples (AVC1) into the Annex B
+// byte stream the CUDA parser expects. 4-byte prefixes are replaced
+// by start codes in place, other sizes go through a scratch buffer.
+// Also keeps the out-of-band parameter sets for injection.
+//
+//------------------------------------------------------------------------------
+
+#ifndef ANNEXB_CONVERTER_H_
+#define ANNEXB_CONVERTER_H_
+
+class AnnexBConverter
+{
+public:
+
+	AnnexBConverter();
+	virtual ~AnnexBConverter();
+
+	// inNalLengthSize is 1, 2 or 4 for length-prefixed samples, whose
+	// sequence header holds parameter sets with 2-byte length prefixes
+	// (MPEG2VIDEOINFO), 0 for samples already in Annex B, whose sequence
+	// header holds start-coded parameter sets.
+	bool	Init(int inNalLengthSize, const unsigned char* inSequenceHeader, long inHeaderLength);
+
+	// Length-prefixed samples described by an avcC record, which gives
+	// the NAL length size and the parameter sets
+	bool	InitAvcC(const unsigned char* inRecord, long inLength);
+
+	// The parameter sets go out again with the next sample
+	void	Reset(void);
+
+	bool	IsLengthPrefixed(void) const { return m_NalLengthSize != 0; }
+
+	// Start-coded parameter sets, NULL if there are none
+	const unsigned char*	GetParameterSets(long* outLength) const;
+
+	// Start-coded parameter sets if not handed out since Init or Reset, NULL otherwise
+	const unsigned char*	TakeParameterSets(long* outLength);
+
+	// Returns the sample in Annex B form: ioData itself when rewritten in
+	// place or nothing had to change, the scratch buffer otherwise. NULL
+	// if a length runs past the end of the sample.
+	unsigned char*	Convert(unsigned char* ioData, long inLength, long* outLength);
+
+private:
+
+	void	Clear(void);
+	void	AppendParameterSet(const unsigned char* inData, long inLength);
+	void	ReserveScratch(long inSize);
+
+private:
+
+	int				m_NalLengthSize;
+
+	unsigned char*	m_ParameterSets;		// Annex B
+	long			m_ParameterSetsLength;
+	bool			m_ParameterSetsSent;
+
+	unsigned char*	m_Scratch;
+	long			m_ScratchSize;
+};
+
+#endif
@@ -0,0 +1,67 @@
+//------------------------------------------------------------------------------
+// File: AtomicOps.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Minimal atomic operations and memory fences for the lock-free
+// structures on the decoding path.
+//
+//------------------------------------------------------------------------------
+
+#ifndef ATOMIC_OPS_H_
+#define ATOMIC_OPS_H_
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#include <intrin.h>
+
+// x86/x64 keep stores and loads in order, only the compiler must not reorder them
+#define WRITE_FENCE()	_ReadWriteBarrier()
+#define READ_FENCE()	_ReadWriteBarrier()
+
+inline long AtomicIncrement(volatile long* ioValue)
+{
+	return InterlockedIncrement(ioValue);
+}
+
+inline long AtomicDecrement(volatile long* ioValue)
+{
+	return InterlockedDecrement(ioValue);
+}
+
+inline long AtomicCompareExchange(volatile long* ioValue, long inNew, long inExpected)
+{
+	return InterlockedCompareExchange(ioValue, inNew, inExpected);
+}
+
+#else
+
+#if defined(__i386__) || defined(__x86_64__)
+#define WRITE_FENCE()	__asm__ __volatile__("" ::: "memory")
+#define READ_FENCE()	__asm__ __volatile__("" ::: "memory")
+#else
+#define WRITE_FENCE()	__sync_synchronize()
+#define READ_FENCE()	__sync_synchronize()
+#endif
+
+inline long AtomicIncrement(volatile long* ioValue)
+{
+	return __sync_add_and_fetch(ioValue, 1);
+}
+
+inline long AtomicDecrement(volatile long* ioValue)
+{
+	return __sync_sub_and_fetch(ioValue, 1);
+}
+
+// Returns the previous value, like InterlockedCompareExchange
+inline long AtomicCompareExchange(volatile long* ioValue, long inNew, long inExpected)
+{
+	return __sync_val_compare_and_swap(ioValue, inExpected, inNew);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,179 @@
+//------------------------------------------------------------------------------
+// File: BitReader.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: MSB-first bit reader over an H.264 RBSP with Exp-Golomb codes.
+// The payload must be unescaped first (RbspBuffer in Rbsp.h).
+//
+// The next bits are cached in a 64-bit word, refilled eight bytes at a
+// time, so a read is a shift and a mask, and an Exp-Golomb code is one
+// count of leading zeros. Reading past the end yields zeros and marks
+// the reader overrun.
+//
+//------------------------------------------------------------------------------
+
+#ifndef BIT_READER_H_
+#define BIT_READER_H_
+
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <stdlib.h>
+#endif
+
+class BitReader
+{
+public:
+
+	BitReader(const unsigned char* inData, long inLength) :	m_Data(inData),
+															m_Length(inLength),
+															m_Position(0),
+															m_Cache(0),
+															m_CacheBits(0),
+															m_Overrun(false)
+	{
+	}
+
+	unsigned int ReadBit(void)
+	{
+		return ReadBits(1);
+	}
+
+	// Up to 32 bits
+	unsigned int ReadBits(int inCount)
+	{
+		if (inCount <= 0)
+			return 0;
+		if (m_CacheBits < inCount)
+			Refill();
+		unsigned int value = (unsigned int)(m_Cache >> (64 - inCount));
+		m_Cache <<= inCount;
+		m_CacheBits -= inCount;
+		return value;
+	}
+
+	// Up to 32 bits, left in the reader
+	unsigned int PeekBits(int inCount)
+	{
+		if (m_CacheBits < inCount)
+			Refill();
+		return (unsigned int)(m_Cache >> (64 - inCount));
+	}
+
+	void SkipBits(long inCount)
+	{
+		if (inCount > m_CacheBits)
+		{
+			// Drop the cache and whole bytes without reading them
+			inCount -= m_CacheBits;
+			m_Cache = 0;
+			m_CacheBits = 0;
+			m_Position += inCount / 8;
+			inCount %= 8;
+		}
+		ReadBits((int)inCount);
+	}
+
+	// ue(v)
+	unsigned int ReadUE(void)
+	{
+		if (m_CacheBits < 32)
+			Refill();
+		unsigned int next = (unsigned int)(m_Cache >> 32);
+		if (next == 0)
+		{
+			// More than 31 leading zeros, invalid or past the end
+			m_Overrun = true;
+			return 0;
+		}
+		int leadingZeros = LeadingZeros(next);
+		if (leadingZeros < 16)
+		{
+			// The whole code is in the 32 bits
+			return ReadBits(2 * leadingZeros + 1) - 1;
+		}
+		m_Cache <<= leadingZeros;
+		m_CacheBits -= leadingZeros;
+		return ReadBits(leadingZeros + 1) - 1;
+	}
+
+	// se(v)
+	int ReadSE(void)
+	{
+		unsigned int code = ReadUE();
+		return (code & 1) ? (int)((code + 1) / 2) : -(int)(code / 2);
+	}
+
+	// Bits read so far
+	long long GetPosition(void) const
+	{
+		return (long long)m_Position * 8 - m_CacheBits;
+	}
+
+	bool IsOverrun(void) const
+	{
+		return m_Overrun || (long long)m_Position * 8 - m_CacheBits > (long long)m_Length * 8;
+	}
+
+private:
+
+	// Tops the cache up to at least 57 bits. Bits below m_CacheBits are
+	// zero or already hold the data that belongs there.
+	void Refill(void)
+	{
+		if (m_Position + 8 <= m_Length)
+		{
+			unsigned long long word;
+			memcpy(&word, m_Data + m_Position, 8);
+			m_Cache |= SwapBytes(word) >> m_CacheBits;
+			int bytes = (63 - m_CacheBits) >> 3;
+			m_Position += bytes;
+			m_CacheBits += bytes * 8;
+			return;
+		}
+		// Near the end, zeros past it
+		while (m_CacheBits <= 56)
+		{
+			unsigned long long byte = (m_Position < m_Length) ? m_Data[m_Position] : 0;
+			m_Cache |= byte << (56 - m_CacheBits);
+			m_Position++;
+			m_CacheBits += 8;
+		}
+	}
+
+	static unsigned long long SwapBytes(unsigned long long inValue)
+	{
+#ifdef _MSC_VER
+		return _byteswap_uint64(inValue);
+#else
+		return __builtin_bswap64(inValue);
+#endif
+	}
+
+	// inValue is not 0
+	static int LeadingZeros(unsigned int inValue)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanReverse(&index, inValue);
+		return 31 - (int)index;
+#else
+		return __builtin_clz(inValue);
+#endif
+	}
+
+private:
+
+	const unsigned char*	m_Data;
+	long			m_Length;
+	long			m_Position;		// Next byte to enter the cache
+	unsigned long long	m_Cache;	// Next bits, MSB first
+	int				m_CacheBits;
+	bool			m_Overrun;
+};
+
+#endif
@@ -12,8 +12,10 @@
 
 #include "CudaDecodeFilter.h"
 #include "CudaDecodeInputPin.h"
-#include "MediaController.h"
+#include "DecodeSession.h"
 #include "DecodedStream.h"
+#include "FrameDecimator.h"
+#include "Trace.h"
 
 const TCHAR* CUDA_DECODE_FILTER_NAME = L"CUDA H.264 Decoder";
 
@@ -26,6 +28,12 @@ const AMOVIESETUP_MEDIATYPE sudPinTypes =
 	&MEDIASUBTYPE_NULL      // Minor type
 };
 
+const AMOVIESETUP_MEDIATYPE sudInputTypes[] =
+{
+	{ &MEDIATYPE_Video,  &MEDIASUBTYPE_NULL },
+	{ &MEDIATYPE_Stream, &MEDIASUBTYPE_MPEG2_TRANSPORT }
+};
+
 const AMOVIESETUP_PIN psudPins[] =
 {
 	{
@@ -36,8 +44,8 @@ const AMOVIESETUP_PIN psudPins[] =
 			FALSE,              // Allowed many
 			&CLSID_NULL,        // Connects to filter
 			L"Output",          // Connects to pin
-			1,                  // Number of types
-			&sudPinTypes		// The pin details
+			2,                  // Number of types
+			sudInputTypes		// The pin details
 	},     
 	{ 
 			L"Output",          // String pin name
@@ -119,12 +127,16 @@ CudaDecodeFilter::CudaDecodeFilter( TCHAR *tszName, LPUNKNOWN punk, HRESULT *phr
 	m_EOSDelivered  = FALSE;
 	m_EOSReceived   = FALSE;
 	m_CudaDecodeInputPin = NULL;
+	m_ConfigChanged = FALSE;
+	m_TransportStream = FALSE;
+
+	LoadDefaultConfig();
 
 	*phr = NOERROR;
 
 	DecodedStream * outStream = new DecodedStream(NAME("Output"), phr, this);
 
-	m_MediaController = new MediaController();
+	m_Session = new DecodeSession();
 
 	if (outStream == NULL)
 	{
@@ -132,7 +144,7 @@ CudaDecodeFilter::CudaDecodeFilter( TCHAR *tszName, LPUNKNOWN punk, HRESULT *phr
 	}
 	else
 	{
-		outStream->SetController(m_MediaController);
+		outStream->SetSession(m_Session);
 	}
 }
 
@@ -144,19 +156,66 @@ CudaDecodeFilter::~CudaDecodeFilter()
 		m_CudaDecodeInputPin = NULL;
 	}
 
-	if(m_MediaController)
+	if(m_Session)
 	{
-		delete m_MediaController;
-		m_MediaController = NULL;
+		delete m_Session;
+		m_Session = NULL;
 	}
 
 	decoderInstances--;
 }
 
+// Config file next to the filter (or named by CUDADEC_CONFIG), then
+// CUDADEC_xxx environment variables on top of it
+void CudaDecodeFilter::LoadDefaultConfig( void )
+{
+	char path[MAX_PATH];
+	const char* configPath = getenv(DECODER_CONFIG_ENV);
+
+	if (configPath == NULL)
+	{
+		DWORD length = GetModuleFileNameA(g_hInst, path, MAX_PATH);
+		char* name = strrchr(path, '\\');
+		if (length > 0 && length < MAX_PATH && name != NULL && 
+			(name + 1 - path) + strlen(DECODER_CONFIG_FILE) < MAX_PATH)
+		{
+			strcpy(name + 1, DECODER_CONFIG_FILE);
+			configPath = path;
+		}
+	}
+
+	if (configPath)
+	{
+		m_Config.LoadFromFile(configPath);
+	}
+	m_Config.LoadFromEnvironment();
+}
+
+REFERENCE_TIME CudaDecodeFilter::OutputDuration( void )
+{
+	const DecoderSettings& settings = m_Config.Settings();
+	FrameDecimator decimator;
+	decimator.Configure(settings.OutputStride, settings.OutputFrameRate);
+	decimator.SetFrameDuration(m_SampleDuration);
+	return decimator.GetOutputDuration();
+}
+
 STDMETHODIMP CudaDecodeFilter::NonDelegatingQueryInterface( REFIID riid, void ** ppv )
 {
 	CheckPointer(ppv, E_POINTER);
 
+	if (riid == IID_ICudaDecoderConfig)
+	{
+		return GetInterface((ICudaDecoderConfig*) this, ppv);
+	}
+	if (riid == IID_ICudaDecoderStats)
+	{
+		return GetInterface((ICudaDecoderStats*) this, ppv);
+	}
+	if (riid == IID_ICudaDecoderTrace)
+	{
+		return GetInterface((ICudaDecoderTrace*) this, ppv);
+	}
 	return CSource::NonDelegatingQueryInterface(riid, ppv);
 }
 
@@ -209,7 +268,7 @@ STDMETHODIMP CudaDecodeFilter::Stop()
 	}
 
 	// Important!!! Refuse to receive any more samples
-	m_MediaController->FlushAllPending();
+	m_Session->FlushAllPending();
 	// decommit the input pin before locking or we can deadlock
 	m_CudaDecodeInputPin->Inactive();	
 
@@ -274,7 +333,7 @@ STDMETHODIMP CudaDecodeFilter::Pause()
 		{
 			// Make sure the receive not blocking
 			// Make sure the out-sending thread not working
-			m_MediaController->FlushAllPending();
+			m_Session->FlushAllPending();
 
 			hr = CBaseFilter::Pause();
 		}
@@ -286,11 +345,29 @@ HRESULT CudaDecodeFilter::StartStreaming()
 {
 	m_IsFlushing  = FALSE;
 	m_EOSReceived = FALSE;
+	m_AnnexB.Reset();
+	m_TsDemuxer.Reset();
+
+	// Settings changed after connecting, rebuild the decoder system
+	if (m_ConfigChanged)
+	{
+		// Left pending on failure, the next start tries again
+		m_Session->Close();
+		if (!m_Session->Open(m_Config.Settings(), this->OutputPin()))
+		{
+			return E_FAIL;
+		}
+		m_Session->SetFrameDuration(m_SampleDuration);
+		m_ConfigChanged = FALSE;
+	}
+	m_Config.Report(stdout);
 	return NOERROR;
 }
 
 HRESULT CudaDecodeFilter::StopStreaming()
 {
+	m_Session->ReportStatistics(stdout);
+
 	m_IsFlushing  = FALSE;
 	m_EOSReceived = FALSE;
 	return NOERROR;
@@ -310,7 +387,36 @@ HRESULT CudaDecodeFilter::Receive( IMediaSample *pSample )
 	long lSourceSize = pSample->GetActualDataLength();
 	BYTE * pSourceBuffer;
 	pSample->GetPointer(&pSourceBuffer);
-	m_MediaController->ReceiveMpeg(pSourceBuffer, lSourceSize);
+
+	// The PTS of the PES packets are the timestamps
+	if (m_TransportStream)
+	{
+		m_TsDemuxer.Push(pSourceBuffer, lSourceSize);
+		return NOERROR;
+	}
+
+	REFERENCE_TIME rtStart, rtStop;
+	long long timestamp = DECODE_NO_TIMESTAMP;
+	if (SUCCEEDED(pSample->GetTime(&rtStart, &rtStop)))
+	{
+		timestamp = rtStart;
+	}
+
+	// Out-of-band parameter sets go ahead of the first sample
+	long lParameterSize = 0;
+	const BYTE * pParameterSets = m_AnnexB.TakeParameterSets(&lParameterSize);
+	if (pParameterSets)
+	{
+		m_Session->Push(pParameterSets, lParameterSize);
+	}
+
+	pSourceBuffer = m_AnnexB.Convert(pSourceBuffer, lSourceSize, &lSourceSize);
+	if (pSourceBuffer == NULL)
+	{
+		printf("Dropping sample with invalid NAL lengths\n");
+		return NOERROR;
+	}
+	m_Session->Push(pSourceBuffer, lSourceSize, timestamp);
 	return NOERROR;
 }
 
@@ -320,7 +426,11 @@ HRESULT CudaDecodeFilter::EndOfStream( void )
 	if (!m_EOSReceived)
 	{
 		m_EOSReceived  = TRUE;
-		m_MediaController->BeginEndOfStream();
+		if (m_TransportStream)
+		{
+			m_TsDemuxer.Finish();
+		}
+		m_Session->BeginEndOfStream();
 		// Wait for all caching data having been fetched out
 		//	while (!mMpegController.IsCacheOutputWaiting() && 
 		//		!mMpegController.IsCacheEmpty())
@@ -350,6 +460,12 @@ HRESULT CudaDecodeFilter::BeginFlush( void )
 
 HRESULT CudaDecodeFilter::EndFlush( void )
 {
+	// The PES packet cut by the flush is given up while the session still flushes
+	if (m_TransportStream)
+	{
+		CAutoLock lck(&m_csReceive);
+		m_TsDemuxer.Reset();
+	}
 	m_EOSReceived = FALSE;
 	OutputPin()->EndFlush();
 	m_IsFlushing = FALSE;
@@ -361,16 +477,92 @@ HRESULT CudaDecodeFilter::CompleteConnect( PIN_DIRECTION inDirection, IPin * inR
 	if (inDirection == PINDIR_INPUT)
 	{
 		CMediaType  mtIn = m_CudaDecodeInputPin->CurrentMediaType();
+		VIDEOINFOHEADER2 * pFormat = NULL;
+		m_TransportStream = (mtIn.majortype == MEDIATYPE_Stream);
+		if (m_TransportStream)
+		{
+			// The picture size only comes with the stream: the output is
+			// connected at the largest the decoder is set up for, and the
+			// frames are scaled to it
+			const DecoderSettings& settings = m_Config.Settings();
+			if (settings.MaxWidth == 0 || settings.MaxHeight == 0)
+			{
+				printf("Transport stream input needs MaxWidth and MaxHeight\n");
+				return E_FAIL;
+			}
+			m_SampleDuration = 0;
+			m_ImageWidth     = settings.MaxWidth;
+			m_ImageHeight    = settings.MaxHeight;
+
+			m_Session->Close();
+			m_ConfigChanged = FALSE;
+			if (!m_Session->Open(settings, this->OutputPin()) || !m_TsDemuxer.Open(m_Session))
+			{
+				return E_FAIL;
+			}
+			return S_OK;
+		}
 		if (mtIn.formattype == FORMAT_VIDEOINFO2)
 		{
-			VIDEOINFOHEADER2 * pFormat = (VIDEOINFOHEADER2 *) mtIn.pbFormat;
+			pFormat = (VIDEOINFOHEADER2 *) mtIn.pbFormat;
+			m_AnnexB.Init(0, NULL, 0);
+		}
+		else if (mtIn.formattype == FORMAT_MPEG2Video)
+		{
+			// dwFlags holds the NAL length size of AVC1 samples, whose parameter
+			// sets then have 2-byte length prefixes. Without it the sequence
+			// header is an avcC record, which carries the size itself.
+			MPEG2VIDEOINFO * pMpeg2Format = (MPEG2VIDEOINFO *) mtIn.pbFormat;
+			pFormat = &pMpeg2Format->hdr;
+			const unsigned char * pHeader = (const unsigned char *) pMpeg2Format->dwSequenceHeader;
+			bool initialized;
+			if (mtIn.subtype != MEDIATYPE_AVC1)
+			{
+				initialized = m_AnnexB.Init(0, pHeader, pMpeg2Format->cbSequenceHeader);
+			}
+			else if (pMpeg2Format->dwFlags)
+			{
+				initialized = m_AnnexB.Init(pMpeg2Format->dwFlags, pHeader, pMpeg2Format->cbSequenceHeader);
+			}
+			else
+			{
+				initialized = m_AnnexB.InitAvcC(pHeader, pMpeg2Format->cbSequenceHeader);
+			}
+			if (!initialized)
+			{
+				return E_FAIL;
+			}
+		}
+		if (pFormat)
+		{
 			m_SampleDuration = pFormat->AvgTimePerFrame;
 			m_ImageWidth     = pFormat->bmiHeader.biWidth;
 			m_ImageHeight    = pFormat->bmiHeader.biHeight;
 
-			// Init the decoder system
-			m_MediaController->Uninitialize();
-			m_MediaController->Initialize(this->OutputPin());
+			// Init the decoder system. Without a decoder the connection
+			// fails, rather than a graph that never shows a frame.
+			m_Session->Close();
+			m_ConfigChanged = FALSE;
+			if (!m_Session->Open(m_Config.Settings(), this->OutputPin()))
+			{
+				return E_FAIL;
+			}
+
+			// An SPS in the format gives the real picture size and lets the
+			// decoder be created before any data arrives
+			long lParameterSize = 0;
+			const BYTE * pParameterSets = m_AnnexB.GetParameterSets(&lParameterSize);
+			SequenceInfo sps;
+			if (pParameterSets && m_Session->PrepareDecoder(pParameterSets, lParameterSize, &sps))
+			{
+				m_ImageWidth  = sps.DisplayWidth;
+				m_ImageHeight = sps.DisplayHeight;
+				if (m_SampleDuration == 0 && GetFrameRate(sps) > 0)
+				{
+					m_SampleDuration = (REFERENCE_TIME) (UNITS / GetFrameRate(sps));
+				}
+			}
+			m_Session->SetFrameDuration(m_SampleDuration);
 			return S_OK;
 		}
 	}
@@ -381,16 +573,83 @@ HRESULT CudaDecodeFilter::CompleteConnect( PIN_DIRECTION inDirection, IPin * inR
 		if (mtOut.subtype == MEDIASUBTYPE_IYUV)
 		{
 			bitcount = 2;
-			m_MediaController->SetOutputType(2);
 		}
 		else if (mtOut.subtype == MEDIASUBTYPE_RGB24)
 		{
 			bitcount = 3;
-			m_MediaController->SetOutputType(1);
 		}
 		m_OutputImageSize = m_ImageWidth * m_ImageHeight * bitcount;
-		m_MediaController->SetOutputImageSize(m_OutputImageSize);
+		// Later sequences of another size are scaled to the connected size
+		m_Session->SetOutputFrameSize(m_ImageWidth, m_ImageHeight);
 		return S_OK;
 	}
 	return E_FAIL;
+}
+
+STDMETHODIMP CudaDecodeFilter::GetSettings( DecoderSettings* outSettings )
+{
+	CheckPointer(outSettings, E_POINTER);
+	CAutoLock lck(&m_cStateLock);
+
+	*outSettings = m_Config.Settings();
+	return S_OK;
+}
+
+STDMETHODIMP CudaDecodeFilter::SetSettings( const DecoderSettings* inSettings )
+{
+	CheckPointer(inSettings, E_POINTER);
+	CAutoLock lck(&m_cStateLock);
+
+	if (m_State != State_Stopped)
+	{
+		return VFW_E_NOT_STOPPED;
+	}
+	if (!m_Config.Apply(*inSettings))
+	{
+		return E_INVALIDARG;
+	}
+	m_ConfigChanged = TRUE;
+	return S_OK;
+}
+
+STDMETHODIMP CudaDecodeFilter::LoadSettings( const char* inPath )
+{
+	CheckPointer(inPath, E_POINTER);
+	CAutoLock lck(&m_cStateLock);
+
+	if (m_State != State_Stopped)
+	{
+		return VFW_E_NOT_STOPPED;
+	}
+	if (!m_Config.LoadFromFile(inPath))
+	{
+		return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+	}
+	m_ConfigChanged = TRUE;
+	return S_OK;
+}
+
+STDMETHODIMP CudaDecodeFilter::GetStatistics( DecoderStatistics* outStats )
+{
+	CheckPointer(outStats, E_POINTER);
+
+	m_Session->GetStatistics(outStats);
+	return S_OK;
+}
+
+STDMETHODIMP CudaDecodeFilter::ResetStatistics( void )
+{
+	m_Session->ResetStatistics();
+	return S_OK;
+}
+
+STDMETHODIMP CudaDecodeFilter::DumpTrace( const char* inPath )
+{
+	CheckPointer(inPath, E_POINTER);
+
+#if USE_TRACING
+	return TraceDumpChromeJson(inPath) ? S_OK : E_FAIL;
+#else
+	return E_NOTIMPL;
+#endif
 }
\ No newline at end of file
@@ -14,16 +14,19 @@
 #define CUDA_DECODE_FILTER_H_
 
 #include "StdHeader.h"
+#include "DecoderInterfaces.h"
+#include "AnnexBConverter.h"
+#include "TsDemuxer.h"
 
 class CudaDecodeInputPin;
 class DecodedStream;
-class MediaController;
+class DecodeSession;
 
-class CudaDecodeFilter : public CSource
+class CudaDecodeFilter : public CSource, public ICudaDecoderConfig, public ICudaDecoderStats,
+						 public ICudaDecoderTrace
 {
 	friend class CudaDecodeInputPin;
 	friend class DecodedStream;
-	friend class CudaH264Decoder;
 
 public:
 
@@ -61,20 +64,44 @@ public:
 	// Output pin's delegating methods
 	HRESULT				CompleteConnect(PIN_DIRECTION inDirection, IPin * inReceivePin);
 
+	// ICudaDecoderConfig
+	STDMETHODIMP		GetSettings(DecoderSettings* outSettings);
+	STDMETHODIMP		SetSettings(const DecoderSettings* inSettings);
+	STDMETHODIMP		LoadSettings(const char* inPath);
+
+	// ICudaDecoderStats
+	STDMETHODIMP		GetStatistics(DecoderStatistics* outStats);
+	STDMETHODIMP		ResetStatistics(void);
+
+	// ICudaDecoderTrace
+	STDMETHODIMP		DumpTrace(const char* inPath);
+
 private:
 
 	DecodedStream *		OutputPin() {return (DecodedStream*) m_paStreams[0];};
 
+	void				LoadDefaultConfig(void);
+
+	// Of the frames delivered, the source's stretched by the decimation
+	REFERENCE_TIME		OutputDuration(void);
+
 private:
 
 	CudaDecodeInputPin*		m_CudaDecodeInputPin;
-	MediaController*		m_MediaController;
+	DecodeSession*			m_Session;
 	CCritSec				m_csReceive;
 	
 	BOOL					m_IsFlushing;
 	BOOL					m_EOSDelivered;
 	BOOL					m_EOSReceived;
 
+	AnnexBConverter			m_AnnexB;		// AVC1 samples to the parser's byte stream
+	TsDemuxer				m_TsDemuxer;	// Transport stream samples into the cache
+	BOOL					m_TransportStream;
+
+	DecoderConfig			m_Config;
+	BOOL					m_ConfigChanged;	// Since the decoder system was initialized
+
 	// Bitmap information
 	LONG					m_ImageWidth;
 	LONG					m_ImageHeight;
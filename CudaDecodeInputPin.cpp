@@ -32,7 +32,22 @@ CudaDecodeInputPin::~CudaDecodeInputPin()
 
 HRESULT CudaDecodeInputPin::CheckMediaType( const CMediaType * mtIn )
 {
-	if (mtIn->majortype == MEDIATYPE_Video && mtIn->subtype == MEDIATYPE_H264)
+	// Demuxed by the filter itself
+	if (mtIn->majortype == MEDIATYPE_Stream && mtIn->subtype == MEDIASUBTYPE_MPEG2_TRANSPORT)
+	{
+		return NOERROR;
+	}
+	if (mtIn->majortype != MEDIATYPE_Video)
+	{
+		return E_FAIL;
+	}
+	if (mtIn->subtype == MEDIATYPE_H264)
+	{
+		return NOERROR;
+	}
+	// The NAL length size and parameter sets come with the format
+	if (mtIn->subtype == MEDIATYPE_AVC1 && mtIn->formattype == FORMAT_MPEG2Video &&
+		mtIn->cbFormat >= sizeof(MPEG2VIDEOINFO) - sizeof(DWORD))
 	{
 		return NOERROR;
 	}
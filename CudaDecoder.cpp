@@ -11,70 +11,71 @@
 //------------------------------------------------------------------------------
 
 #include "CudaDecoder.h"
-#include "MediaController.h"
-#include "CudaDecodeFilter.h"
-#include "DecodedStream.h"
 #include "CudaPostProcessing.h"
-
-BYTE*			CudaH264Decoder::m_InputBuffer = NULL;
-BYTE*			CudaH264Decoder::m_OutputYuv2Buffer = NULL;
-DecodedStream*	CudaH264Decoder::m_DecodedStream = NULL;
-
-CudaH264Decoder::CudaH264Decoder(unsigned int maxFrame) :	m_pD3D(NULL), m_pD3Dev(NULL), 
-															m_cuContext(NULL), m_cuDevice(NULL), 
-															m_cuInstanceCount(0), m_cuCtxLock(NULL)
+#include "FrameConverter.h"
+#include "DecoderStats.h"
+#include "PerfTimer.h"
+#include "Trace.h"
+#include <stdio.h>
+#include <string.h>
+
+CudaH264Decoder::CudaH264Decoder() :
+#ifdef _WIN32
+															m_pD3D(NULL), m_pD3Dev(NULL), 
+#endif
+															m_cuContext(NULL), m_cuDevice(0), 
+															m_cuInstanceCount(0), m_cuCtxLock(NULL),
+															m_SequenceHinted(false), m_SequenceHint(false)
 {
-
+	memset(&m_state, 0, sizeof(m_state));
 }
 
 CudaH264Decoder::~CudaH264Decoder()
 {
-	this->ReleaseCuda();
-
-	if(m_OutputYuv2Buffer)
+	if (m_state.cuCtxLock)
 	{
-		delete [] m_OutputYuv2Buffer;
-		m_OutputYuv2Buffer = NULL;
+		CAutoCtxLock lck(m_state.cuCtxLock);
+		if (m_state.cuParser)
+			cuvidDestroyVideoParser(m_state.cuParser);
+		if (m_state.cuDecoder)
+			cuvidDestroyDecoder(m_state.cuDecoder);
+		if (m_state.pRawNV12)
+			cuMemFreeHost(m_state.pRawNV12);
+		if (m_state.cuStream)
+			cuStreamDestroy(m_state.cuStream);
 	}
 
-	if(m_InputBuffer)
-	{
-		delete [] m_InputBuffer;
-		m_InputBuffer = NULL;
-	}
+	this->ReleaseCuda();
+
+	delete [] m_state.pOutput;
 }
 
-bool CudaH264Decoder::Init(DecodedStream* decodedStream)
+bool CudaH264Decoder::Init(const DecoderSettings& settings, FrameSink* sink, DecoderStats* stats)
 {
 	memset(&m_parserInitParams, 0, sizeof(m_parserInitParams));
 	memset(&m_state, 0, sizeof(m_state));
 
+	m_state.display_delay = settings.DisplayDelay;
+	m_state.num_surfaces = settings.MaxFrameCount;	// Until the SPS is known
+	m_state.max_surfaces = settings.MaxFrameCount;
+	m_state.max_width = settings.MaxWidth;
+	m_state.max_height = settings.MaxHeight;
+	m_state.use_async_copy = settings.UseAsyncCopy;
+	m_state.deinterlace_mode = settings.DeinterlaceMode;
+	m_state.frame_statistics = settings.FrameStatistics;
+	m_state.decimator = &m_Decimator;
+	m_Decimator.Configure(settings.OutputStride, settings.OutputFrameRate);
+	m_SequenceHinted = false;
+	m_SequenceHint = false;
+	m_state.stats = stats;
+	m_state.sink = sink;
+
 	if(!this->InitCuda(&m_state.cuCtxLock))
 		return false;
 
-	// init outputPin
-	m_DecodedStream = decodedStream;
-
-	// init InputBuffer
-	m_InputBuffer = new BYTE[DECODER_BUFFER_SIZE];
-
-	m_parserInitParams.CodecType = cudaVideoCodec_H264;
-	m_parserInitParams.ulMaxNumDecodeSurfaces = MAX_FRM_CNT;
-	m_parserInitParams.pUserData = &m_state;
-	m_parserInitParams.pfnSequenceCallback	=	CudaH264Decoder::HandleVideoSequence;
-	m_parserInitParams.pfnDecodePicture		=	CudaH264Decoder::HandlePictureDecode;
-	m_parserInitParams.pfnDisplayPicture	=	CudaH264Decoder::HandlePictureDisplay;
-
+	// The parser is created once the SPS tells how many surfaces it needs
 	CUresult result;
 
-	result = cuvidCreateVideoParser(&m_state.cuParser, &m_parserInitParams);
-
-	if (result != CUDA_SUCCESS)
-	{
-		printf("Failed to create video parser (%d)\n", result);
-		return false;
-	}
-
 	{
 		CAutoCtxLock lck(m_state.cuCtxLock);
 		result = cuStreamCreate(&m_state.cuStream, 0);
@@ -86,7 +87,7 @@ bool CudaH264Decoder::Init(DecodedStream* decodedStream)
 	}
 
 	// Init display queue
-	for (int i=0; i<DISPLAY_DELAY; i++)
+	for (int i=0; i<m_state.display_delay; i++)
 	{
 		m_state.DisplayQueue[i].picture_index = -1;   // invalid
 	}
@@ -97,10 +98,12 @@ bool CudaH264Decoder::Init(DecodedStream* decodedStream)
 
 bool CudaH264Decoder::InitCuda(CUvideoctxlock *pLock)
 {
+	CUresult err;
+#ifdef _WIN32
 	D3DPRESENT_PARAMETERS d3dpp;
 	HRESULT hr;
-	CUresult err;
 	int lAdapter, lAdapterCount;
+#endif
 
 	if (m_cuInstanceCount != 0)
 	{
@@ -112,12 +115,16 @@ bool CudaH264Decoder::InitCuda(CUvideoctxlock *pLock)
 	err = cuInit(0);
 	if (err != CUDA_SUCCESS)
 	{
+		printf("cuInit failed (%d), no CUDA device\n", err);
 		return false;
 	}
+
+#ifdef _WIN32
 	// Create an instance of Direct3D.
 	m_pD3D = Direct3DCreate9(D3D_SDK_VERSION);
 	if (m_pD3D == NULL)
 	{
+		printf("Direct3DCreate9 failed\n");
 		return false;
 	}
 
@@ -165,7 +172,31 @@ bool CudaH264Decoder::InitCuda(CUvideoctxlock *pLock)
 			m_pD3Dev = NULL;
 		}
 	}
+	printf("No Direct3D device with a CUDA context\n");
 	return false;
+#else
+	// No interop needed without D3D, a plain context on the first device
+	err = cuDeviceGet(&m_cuDevice, 0);
+	if (err == CUDA_SUCCESS)
+		err = cuCtxCreate(&m_cuContext, 0, m_cuDevice);
+	if (err != CUDA_SUCCESS)
+	{
+		printf("cuCtxCreate failed (%d)\n", err);
+		return false;
+	}
+#if USE_FLOATING_CONTEXTS
+	CUcontext curr_ctx = NULL;
+	err = cuCtxPopCurrent(&curr_ctx);
+	if (err != CUDA_SUCCESS)
+		printf("cuCtxPopCurrent: %d (g_cuContext=%p)\n", err, m_cuContext);
+	err = cuvidCtxLockCreate(&m_cuCtxLock, m_cuContext);
+	if (err != CUDA_SUCCESS)
+		printf("cuvidCtxLockCreate: %d (g_cuContext=%p)\n", err, m_cuContext);
+#endif
+	*pLock = m_cuCtxLock;
+	m_cuInstanceCount = 1;
+	return true;
+#endif
 }
 
 bool CudaH264Decoder::ReleaseCuda()
@@ -191,6 +222,7 @@ bool CudaH264Decoder::ReleaseCuda()
 			printf("WARNING: cuCtxDestroy failed (%d)\n", err);
 		m_cuContext = NULL;
 	}
+#ifdef _WIN32
 	if (m_pD3Dev)
 	{
 		m_pD3Dev->Release();
@@ -201,62 +233,400 @@ bool CudaH264Decoder::ReleaseCuda()
 		m_pD3D->Release();
 		m_pD3D = NULL;
 	}
+#endif
 	return true;
 }
 
-int CUDAAPI CudaH264Decoder::HandleVideoSequence(void *pvUserData, CUVIDEOFORMAT *pFormat)
+void CudaH264Decoder::FillCreateInfo(CUVIDDECODECREATEINFO *dci, CuvidState *state, int surfaces,
+									 cudaVideoCodec codec, cudaVideoChromaFormat chroma,
+									 unsigned int width, unsigned int height,
+									 int left, int top, int right, int bottom)
 {
-	DecodeSession *state = (DecodeSession *)pvUserData;
+	memset(dci, 0, sizeof(CUVIDDECODECREATEINFO));
+	dci->ulWidth = width;
+	dci->ulHeight = height;
+#if USE_DECODER_RECONFIGURE
+	// Room for the largest sequence expected, smaller ones reconfigure in place
+	dci->ulMaxWidth = width > (unsigned int)state->max_width ? width : state->max_width;
+	dci->ulMaxHeight = height > (unsigned int)state->max_height ? height : state->max_height;
+#endif
+	dci->ulNumDecodeSurfaces = surfaces;
+	dci->CodecType = codec;
+	dci->ChromaFormat = chroma;
+	// Output (pass through)
+	dci->OutputFormat = cudaVideoSurfaceFormat_NV12;
+	// Always hand out woven frames, the fields are processed on the CPU
+	// while converting to IYUV (see FrameConverter)
+	dci->DeinterlaceMode = cudaVideoDeinterlaceMode_Weave;
+	// Crop to the display area so the output matches the media type
+	if (right <= left || bottom <= top)
+	{
+		left = top = 0;
+		right = width;
+		bottom = height;
+	}
+	dci->display_area.left = (short)left;
+	dci->display_area.top = (short)top;
+	dci->display_area.right = (short)right;
+	dci->display_area.bottom = (short)bottom;
+	// A fixed target keeps the output size across resolution changes
+	dci->ulTargetWidth = state->target_width ? state->target_width : right - left;
+	dci->ulTargetHeight = state->target_height ? state->target_height : bottom - top;
+	dci->ulNumOutputSurfaces = 1;
+	dci->ulCreationFlags = cudaVideoCreate_PreferCUVID;
+}
 
-	if ((pFormat->codec != state->dci.CodecType)
-		|| (pFormat->coded_width != state->dci.ulWidth)
-		|| (pFormat->coded_height != state->dci.ulHeight)
-		|| (pFormat->chroma_format != state->dci.ChromaFormat))
+// Same picture format and output, the allocation limits may differ
+bool CudaH264Decoder::IsSameSequence(const CUVIDDECODECREATEINFO *a, const CUVIDDECODECREATEINFO *b)
+{
+	return a->CodecType == b->CodecType
+		&& a->ChromaFormat == b->ChromaFormat
+		&& a->ulWidth == b->ulWidth
+		&& a->ulHeight == b->ulHeight
+		&& a->ulNumDecodeSurfaces == b->ulNumDecodeSurfaces
+		&& a->ulTargetWidth == b->ulTargetWidth
+		&& a->ulTargetHeight == b->ulTargetHeight
+		&& memcmp(&a->display_area, &b->display_area, sizeof(a->display_area)) == 0;
+}
+
+// Grows the host frame buffers when needed, they are never shrunk so
+// that switching back and forth between sizes does not allocate
+void CudaH264Decoder::EnsureFrameBuffers(CuvidState *state)
+{
+	unsigned int w = state->dci.ulTargetWidth;
+	unsigned int h = state->dci.ulTargetHeight;
+	if (w < (unsigned int)state->max_width)
+		w = state->max_width;
+	if (h < (unsigned int)state->max_height)
+		h = state->max_height;
+
+	int output_size = w * h * 2;
+	if (!state->pOutput || output_size > state->output_buffer_size)
 	{
-		CAutoCtxLock lck(state->cuCtxLock);
-		if (state->cuDecoder)
+		delete [] state->pOutput;
+		state->pOutput = new unsigned char[output_size];
+		state->output_buffer_size = output_size;
+	}
+
+	// Host copy of the NV12 frame, PostProcessing grows it if the real
+	// pitch turns out larger than this guess
+	int nv12_size = ((w + NV12_PITCH_ALIGN - 1) & ~(NV12_PITCH_ALIGN - 1)) * (h + h / 2);
+	if (nv12_size > state->raw_nv12_size)
+	{
+		if (state->pRawNV12)
 		{
-			cuvidDestroyDecoder(state->cuDecoder);
-			state->cuDecoder = NULL;
+			cuMemFreeHost(state->pRawNV12);
+			state->pRawNV12 = NULL;
 		}
-		memset(&state->dci, 0, sizeof(CUVIDDECODECREATEINFO));
-		state->dci.ulWidth = pFormat->coded_width;
-		state->dci.ulHeight = pFormat->coded_height;
-		state->dci.ulNumDecodeSurfaces = MAX_FRM_CNT;
-		state->dci.CodecType = pFormat->codec;
-		state->dci.ChromaFormat = pFormat->chroma_format;
-		// Output (pass through)
-		state->dci.OutputFormat = cudaVideoSurfaceFormat_NV12;
-		state->dci.DeinterlaceMode = cudaVideoDeinterlaceMode_Weave; // No deinterlacing
-		state->dci.ulTargetWidth = state->dci.ulWidth;
-		state->dci.ulTargetHeight = state->dci.ulHeight;
-		state->dci.ulNumOutputSurfaces = 1;
-		state->dci.ulCreationFlags = cudaVideoCreate_PreferCUVID;
-
-		// Create the decoder
-		if (CUDA_SUCCESS != cuvidCreateDecoder(&state->cuDecoder, &state->dci))
+		state->raw_nv12_size = 0;
+		if (cuMemAllocHost((void**)&state->pRawNV12, nv12_size) == CUDA_SUCCESS)
+			state->raw_nv12_size = nv12_size;
+		else
+			state->pRawNV12 = NULL;
+	}
+}
+
+// Called with the context lock held
+bool CudaH264Decoder::CreateDecoder(CuvidState *state, const CUVIDDECODECREATEINFO *dci)
+{
+	TRACE_SCOPE("cuvidCreateDecoder");
+
+	if (state->cuDecoder)
+	{
+		cuvidDestroyDecoder(state->cuDecoder);
+		state->cuDecoder = NULL;
+	}
+	state->dci = *dci;
+
+	// Create the decoder
+	if (CUDA_SUCCESS != cuvidCreateDecoder(&state->cuDecoder, &state->dci))
+	{
+		printf("Failed to create video decoder\n");
+		state->cuDecoder = NULL;
+		return false;
+	}
+	state->decoder_surfaces = dci->ulNumDecodeSurfaces;
+
+	CudaH264Decoder::EnsureFrameBuffers(state);
+	state->has_prev_output = 0;
+	return true;
+}
+
+// Called with the context lock held. Keeps the decoder and its surfaces
+// if the new sequence fits the allocation, false if it has to be recreated.
+bool CudaH264Decoder::ReconfigureDecoder(CuvidState *state, const CUVIDDECODECREATEINFO *dci)
+{
+#if USE_DECODER_RECONFIGURE
+	if (dci->CodecType != state->dci.CodecType
+		|| dci->ChromaFormat != state->dci.ChromaFormat
+		|| dci->ulWidth > state->dci.ulMaxWidth
+		|| dci->ulHeight > state->dci.ulMaxHeight)
+	{
+		return false;
+	}
+	// Surfaces can be given back, but not added
+	if (dci->ulNumDecodeSurfaces > (unsigned long)state->decoder_surfaces)
+	{
+		return false;
+	}
+
+	CUVIDRECONFIGUREDECODERINFO info;
+	memset(&info, 0, sizeof(info));
+	info.ulWidth = dci->ulWidth;
+	info.ulHeight = dci->ulHeight;
+	info.ulTargetWidth = dci->ulTargetWidth;
+	info.ulTargetHeight = dci->ulTargetHeight;
+	info.ulNumDecodeSurfaces = dci->ulNumDecodeSurfaces;
+	info.display_area.left = dci->display_area.left;
+	info.display_area.top = dci->display_area.top;
+	info.display_area.right = dci->display_area.right;
+	info.display_area.bottom = dci->display_area.bottom;
+
+	CUresult result = cuvidReconfigureDecoder(state->cuDecoder, &info);
+	if (result != CUDA_SUCCESS)
+	{
+		printf("cuvidReconfigureDecoder: %d\n", result);
+		return false;
+	}
+
+	unsigned long max_width = state->dci.ulMaxWidth;
+	unsigned long max_height = state->dci.ulMaxHeight;
+	state->dci = *dci;
+	state->dci.ulMaxWidth = max_width;
+	state->dci.ulMaxHeight = max_height;
+
+	CudaH264Decoder::EnsureFrameBuffers(state);
+	state->has_prev_output = 0;
+	return true;
+#else
+	(void)state;
+	(void)dci;
+	return false;
+#endif
+}
+
+int CudaH264Decoder::GetSurfaceCount(const SequenceInfo& inSps) const
+{
+	return GetSurfaceCount(&m_state, GetDpbFrames(inSps) + 1);
+}
+
+// Reference frames and the picture being decoded (inMinimum), the frames
+// waiting in the display queue and those being post-processed. Above
+// MaxFrameCount only the minimum is kept, the display then waits for
+// surfaces to come free.
+int CudaH264Decoder::GetSurfaceCount(const CuvidState *state, int inMinimum)
+{
+	int surfaces = inMinimum + state->display_delay + DECODE_PIPELINE_DEPTH;
+	if (surfaces > state->max_surfaces)
+		surfaces = inMinimum > state->max_surfaces ? inMinimum : state->max_surfaces;
+	return surfaces < MAX_DECODE_SURFACES ? surfaces : MAX_DECODE_SURFACES;
+}
+
+bool CudaH264Decoder::CreateParser(int inSurfaces)
+{
+	PlatformAutoLock lck(&m_ParserLock);
+	if (m_state.cuParser)
+	{
+		return true;
+	}
+
+	m_state.num_surfaces = inSurfaces;
+
+	m_parserInitParams.CodecType = cudaVideoCodec_H264;
+	m_parserInitParams.ulMaxNumDecodeSurfaces = m_state.num_surfaces;
+	m_parserInitParams.pUserData = &m_state;
+	m_parserInitParams.pfnSequenceCallback	=	CudaH264Decoder::HandleVideoSequence;
+	m_parserInitParams.pfnDecodePicture		=	CudaH264Decoder::HandlePictureDecode;
+	m_parserInitParams.pfnDisplayPicture	=	CudaH264Decoder::HandlePictureDisplay;
+
+	CUresult result = cuvidCreateVideoParser(&m_state.cuParser, &m_parserInitParams);
+	if (result != CUDA_SUCCESS)
+	{
+		printf("Failed to create video parser (%d)\n", result);
+		m_state.cuParser = NULL;
+		return false;
+	}
+	return true;
+}
+
+// Hands out the pictures the parser holds, then destroys it
+void CudaH264Decoder::DestroyParser()
+{
+	PlatformAutoLock lck(&m_ParserLock);
+	if (m_state.cuParser == NULL)
+	{
+		return;
+	}
+
+	CUVIDSOURCEDATAPACKET pkt;
+	pkt.flags = CUVID_PKT_ENDOFSTREAM;
+	pkt.payload_size = 0;
+	pkt.payload = NULL;
+	pkt.timestamp = 0;
+	cuvidParseVideoData(m_state.cuParser, &pkt);
+	CudaH264Decoder::FlushDisplayQueue(&m_state);
+
+	cuvidDestroyVideoParser(m_state.cuParser);
+	m_state.cuParser = NULL;
+}
+
+// Start code of the first SPS in the buffer whose DPB needs more surfaces
+// than the parser has, -1 if none
+long CudaH264Decoder::FindGrowingSequence(const unsigned char* inData, long inLength, int* outSurfaces) const
+{
+	long length = 0;
+	for (long offset = FindNalUnit(inData, inLength, 0, &length); offset >= 0;
+		 offset = FindNalUnit(inData, inLength, offset + length, &length))
+	{
+		SequenceInfo sps;
+		if (length > 1 && (inData[offset] & 0x1f) == NAL_TYPE_SPS &&
+			ParseSequenceParameterSet(inData + offset + 1, length - 1, &sps))
 		{
-			printf("Failed to create video decoder\n");
-			return 0;
+			int surfaces = this->GetSurfaceCount(sps);
+			if (surfaces > m_state.num_surfaces)
+			{
+				*outSurfaces = surfaces;
+				return offset - 3;
+			}
 		}
+	}
+	return -1;
+}
 
-		//Init buffer
-		m_OutputYuv2Buffer = new BYTE[pFormat->coded_width * pFormat->coded_height * 2];
+// Creates the parser, the decoder and its buffers ahead of the first
+// picture, unless the parser got there first
+bool CudaH264Decoder::PrepareSequence(const SequenceInfo& inSps)
+{
+	if (!this->CreateParser(this->GetSurfaceCount(inSps)))
+	{
+		return false;
 	}
-	return 1;
+	if (inSps.BitDepthLuma != 8 || inSps.ChromaFormatIdc != 1)
+	{
+		return false;
+	}
+
+	CAutoCtxLock lck(m_state.cuCtxLock);
+	if (m_state.cuDecoder)
+	{
+		return true;
+	}
+
+	CUVIDDECODECREATEINFO dci;
+	FillCreateInfo(&dci, &m_state, m_state.num_surfaces, cudaVideoCodec_H264, cudaVideoChromaFormat_420,
+				   inSps.CodedWidth, inSps.CodedHeight,
+				   inSps.CropLeft, inSps.CropTop,
+				   inSps.CodedWidth - inSps.CropRight, inSps.CodedHeight - inSps.CropBottom);
+	if (!CudaH264Decoder::CreateDecoder(&m_state, &dci))
+	{
+		return false;
+	}
+	return true;
+}
+
+// NV12 decode and output surfaces in device memory
+long long CudaH264Decoder::GetSurfaceBytes(const CUVIDDECODECREATEINFO *dci)
+{
+#if USE_DECODER_RECONFIGURE
+	long long decodeSurface = (long long)dci->ulMaxWidth * dci->ulMaxHeight * 3 / 2;
+#else
+	long long decodeSurface = (long long)dci->ulWidth * dci->ulHeight * 3 / 2;
+#endif
+	long long outputSurface = (long long)dci->ulTargetWidth * dci->ulTargetHeight * 3 / 2;
+	return dci->ulNumDecodeSurfaces * decodeSurface + dci->ulNumOutputSurfaces * outputSurface;
+}
+
+void CudaH264Decoder::GetSurfaceUsage(long* outSurfaces, long long* outDeviceBytes, long long* outHostBytes)
+{
+	CAutoCtxLock lck(m_state.cuCtxLock);
+	*outSurfaces = m_state.cuDecoder ? m_state.dci.ulNumDecodeSurfaces : 0;
+	*outDeviceBytes = m_state.cuDecoder ? GetSurfaceBytes(&m_state.dci) : 0;
+	*outHostBytes = (long long)m_state.raw_nv12_size + m_state.output_buffer_size;
 }
 
+bool CudaH264Decoder::HasDecoder()
+{
+	CAutoCtxLock lck(m_state.cuCtxLock);
+	return m_state.cuDecoder != NULL;
+}
+
+int CUDAAPI CudaH264Decoder::HandleVideoSequence(void *pvUserData, CUVIDEOFORMAT *pFormat)
+{
+	CuvidState *state = (CuvidState *)pvUserData;
+
+	if (pFormat->frame_rate.numerator > 0 && pFormat->frame_rate.denominator > 0)
+	{
+		state->decimator->SetFrameDuration(10000000LL * pFormat->frame_rate.denominator / pFormat->frame_rate.numerator);
+	}
+
+	// Surfaces of this sequence. Never fewer than the parser has, it hands
+	// out picture indices up to its own count.
+	int surfaces = state->num_surfaces;
+#if USE_SEQUENCE_SURFACES
+	// The parser's own count covers an SPS the CPU did not see, it takes
+	// the count returned below
+	int needed = GetSurfaceCount(state, pFormat->min_num_decode_surfaces);
+	if (needed > surfaces)
+		surfaces = state->num_surfaces = needed;
+	int result = surfaces;
+#else
+	int result = 1;
+#endif
+
+	// A sequence that needs more surfaces than the decoder has recreates it
+	CUVIDDECODECREATEINFO dci;
+	FillCreateInfo(&dci, state, surfaces, pFormat->codec, pFormat->chroma_format,
+				   pFormat->coded_width, pFormat->coded_height,
+				   pFormat->display_area.left, pFormat->display_area.top,
+				   pFormat->display_area.right, pFormat->display_area.bottom);
+
+	// Nothing to do if the decoder was already created from the same SPS
+	bool had_decoder;
+	{
+		CAutoCtxLock lck(state->cuCtxLock);
+		if (state->cuDecoder && IsSameSequence(&dci, &state->dci))
+		{
+			return result;
+		}
+		had_decoder = (state->cuDecoder != NULL);
+	}
+
+	// Frames of the previous sequence go out before its surfaces change
+	long long switchStart = PerfTimeUs();
+	if (had_decoder)
+	{
+		CudaH264Decoder::FlushDisplayQueue(state);
+	}
+
+	CAutoCtxLock lck(state->cuCtxLock);
+	if (state->cuDecoder && IsSameSequence(&dci, &state->dci))
+	{
+		return result;
+	}
+	bool in_place = state->cuDecoder && CudaH264Decoder::ReconfigureDecoder(state, &dci);
+	if (!in_place && !CudaH264Decoder::CreateDecoder(state, &dci))
+	{
+		return 0;
+	}
+	if (had_decoder)
+	{
+		state->stats->AddSequenceSwitch(PerfTimeUs() - switchStart, in_place);
+	}
+	return result;
+}
 
 // Called by the video parser to decode a single picture
 // Since the parser will deliver data as fast as it can, we need to make sure that the picture
 // index we're attempting to use for decode is no longer used for display
 int CUDAAPI CudaH264Decoder::HandlePictureDecode(void *pvUserData, CUVIDPICPARAMS *pPicParams)
 {
-	DecodeSession *state = (DecodeSession *)pvUserData;
+	CuvidState *state = (CuvidState *)pvUserData;
 	CAutoCtxLock lck(state->cuCtxLock);
 	CUresult result;
 	int flush_pos;
 
+	state->stats->AddLatency(STAT_PARSE_TO_DECODE, PerfTimeUs() - state->parse_start_us);
+
 	if (pPicParams->CurrPicIdx < 0) // Should never happen
 	{
 		printf("Invalid picture index\n");
@@ -268,7 +638,7 @@ int CUDAAPI CudaH264Decoder::HandlePictureDecode(void *pvUserData, CUVIDPICPARAM
 	for (;;)
 	{
 		bool frame_in_use = false;
-		for (int i=0; i<DISPLAY_DELAY; i++)
+		for (int i=0; i<state->display_delay; i++)
 		{
 			if (state->DisplayQueue[i].picture_index == pPicParams->CurrPicIdx)
 			{
@@ -285,24 +655,31 @@ int CUDAAPI CudaH264Decoder::HandlePictureDecode(void *pvUserData, CUVIDPICPARAM
 		// Flush the oldest entry from the display queue and repeat
 		if (state->DisplayQueue[flush_pos].picture_index >= 0)
 		{
-			//DisplayPicture(state, &state->DisplayQueue[flush_pos]);
-
-			CudaH264Decoder::PostProcessing(state, &state->DisplayQueue[state->display_pos]);
-
-			CudaH264Decoder::SendFrameDownStream();
-
-			state->pic_cnt++;
+			CudaH264Decoder::DisplayPicture(state, &state->DisplayQueue[flush_pos]);
 
 			state->DisplayQueue[flush_pos].picture_index = -1;
 		}
-		flush_pos = (flush_pos + 1) % DISPLAY_DELAY;
+		flush_pos = (flush_pos + 1) % state->display_delay;
+	}
+
+	// Nothing refers to a non-reference frame picture, so when the decimator
+	// wants few frames it is left out; its display call is then a no-op
+	int skip = state->decimator->SkipNonReference() && !pPicParams->ref_pic_flag && !pPicParams->field_pic_flag;
+	state->skipped[pPicParams->CurrPicIdx % MAX_DECODE_SURFACES] = (unsigned char)skip;
+	if (skip)
+	{
+		state->stats->AddPictureSkipped();
+		return 1;
+	}
+	{
+		TRACE_SCOPE("cuvidDecodePicture");
+		result = cuvidDecodePicture(state->cuDecoder, pPicParams);
 	}
-	result = cuvidDecodePicture(state->cuDecoder, pPicParams);
-	
 	if (result != CUDA_SUCCESS)
 	{
 		printf("cuvidDecodePicture: %d\n", result);
 	}
+	state->decode_time_us[pPicParams->CurrPicIdx % MAX_DECODE_SURFACES] = PerfTimeUs();
 
 	return (result == CUDA_SUCCESS);
 }
@@ -311,81 +688,189 @@ int CUDAAPI CudaH264Decoder::HandlePictureDecode(void *pvUserData, CUVIDPICPARAM
 // 2 decode calls per 1 display call, since two fields make up one frame)
 int CUDAAPI CudaH264Decoder::HandlePictureDisplay(void *pvUserData, CUVIDPARSERDISPINFO *pPicParams)
 {
-	DecodeSession *state = (DecodeSession *)pvUserData;
+	CuvidState *state = (CuvidState *)pvUserData;
 
 	if (state->DisplayQueue[state->display_pos].picture_index >= 0)
 	{
+		CudaH264Decoder::DisplayPicture(state, &state->DisplayQueue[state->display_pos]);
 
-		CudaH264Decoder::PostProcessing(state, &state->DisplayQueue[state->display_pos]);
-		
-		CudaH264Decoder::SendFrameDownStream();
-
-		state->pic_cnt++;
-		
 		state->DisplayQueue[state->display_pos].picture_index = -1;
 	}
 
 	state->DisplayQueue[state->display_pos] = *pPicParams;
-	state->display_pos = (state->display_pos + 1) % DISPLAY_DELAY;
+	state->display_pos = (state->display_pos + 1) % state->display_delay;
 	
-	return TRUE;
+	return 1;
+}
+
+// Post-processes and delivers one frame of the display queue. Frames the
+// decimator leaves out are neither mapped nor copied back.
+void CudaH264Decoder::DisplayPicture(CuvidState *state, CUVIDPARSERDISPINFO *pPicParams)
+{
+	bool decoded = !state->skipped[pPicParams->picture_index % MAX_DECODE_SURFACES];
+	if (!state->decimator->Next(decoded))
+	{
+		if (decoded)
+			state->stats->AddFrameDecimated();
+		state->pic_cnt++;
+		return;
+	}
+
+	bool delivered = false;
+	if (CudaH264Decoder::PostProcessing(state, pPicParams))
+	{
+		DecodedFrame frame;
+		frame.Width = state->dci.ulTargetWidth;
+		frame.Height = state->dci.ulTargetHeight;
+		frame.Data = state->pOutput;
+		frame.Size = frame.Width * frame.Height * 3 / 2;
+		frame.Timestamp = pPicParams->timestamp;
+		frame.FrameNumber = state->pic_cnt;
+		frame.Progressive = pPicParams->progressive_frame;
+		frame.Luma = state->frame_statistics ? &state->luma : NULL;
+		delivered = state->sink->OnFrame(frame);
+	}
+	if (delivered)
+	{
+		long long now = PerfTimeUs();
+		state->stats->AddLatency(STAT_CONVERT_TO_DELIVER, now - state->convert_start_us);
+		state->stats->AddFrameDelivered(now);
+	}
+	else
+	{
+		state->stats->AddFrameDropped();
+	}
+	state->pic_cnt++;
 }
 
+// Delivers every frame still waiting in the display queue, oldest first
+void CudaH264Decoder::FlushDisplayQueue(CuvidState *state)
+{
+	for (int i=0; i<state->display_delay; i++)
+	{
+		int pos = (state->display_pos + i) % state->display_delay;
+		if (state->DisplayQueue[pos].picture_index >= 0)
+		{
+			CudaH264Decoder::DisplayPicture(state, &state->DisplayQueue[pos]);
+
+			state->DisplayQueue[pos].picture_index = -1;
+		}
+	}
+}
 
-bool CudaH264Decoder::FetchVideoData( BYTE* ptr, unsigned int size )
+bool CudaH264Decoder::Decode( const unsigned char* inData, long inLength, long long inTimestamp )
 {
 	CUVIDSOURCEDATAPACKET pkt;
 
-	if (size <= 0)
+	if (m_state.cuParser == NULL)
 	{
-		// Flush the decoder
+		// Nothing before the first SPS can be decoded, drop it unless an
+		// SPS starts here (possibly missed on the receiving side)
+		if (inLength <= 0 || !MayContainNalUnit(inData, inLength, NAL_TYPE_SPS))
+			return inLength > 0;
+
+		SequenceInfo sps;
+		int surfaces = m_state.max_surfaces;
+		if (FindSequenceParameterSet(inData, inLength, &sps))
+			surfaces = this->GetSurfaceCount(sps);
+		if (!this->CreateParser(surfaces))
+			return false;
+	}
+
+	if (inLength <= 0)
+	{
+		// Flush the decoder, then the frames it left in the display queue
 		pkt.flags = CUVID_PKT_ENDOFSTREAM;
 		pkt.payload_size = 0;
 		pkt.payload = NULL;
 		pkt.timestamp = 0;
 		cuvidParseVideoData(m_state.cuParser, &pkt);
+		CudaH264Decoder::FlushDisplayQueue(&m_state);
+		m_Decimator.Reset();
 		return false;
 	}
 
+	// A new SPS with a larger DPB than the parser was created for: the
+	// pictures before it leave through the old parser, the new one starts
+	// at the SPS with enough surfaces, and recreates the decoder to match.
+	// Only data the caller saw an SPS start in is searched for it.
+	int surfaces;
+	long split = -1;
+	if (!m_SequenceHinted || m_SequenceHint)
+	{
+		split = this->FindGrowingSequence(inData, inLength, &surfaces);
+	}
+	if (split >= 0)
+	{
+		if (split > 0)
+		{
+			this->ParseData(inData, split, inTimestamp);
+			inTimestamp = DECODE_NO_TIMESTAMP;
+		}
+		this->DestroyParser();
+		if (!this->CreateParser(surfaces))
+			return false;
+		inData += split;
+		inLength -= split;
+	}
+
+	this->ParseData(inData, inLength, inTimestamp);
+	return true;
+}
+
+void CudaH264Decoder::ParseData( const unsigned char* inData, long inLength, long long inTimestamp )
+{
+	CUVIDSOURCEDATAPACKET pkt;
+
+	// The parser attaches the timestamp to the first picture starting in the packet
 	pkt.flags = 0;
-	pkt.payload_size = size;
-	pkt.payload = ptr;
-	pkt.timestamp = 0;  // not using timestamps
+	pkt.payload_size = inLength;
+	pkt.payload = inData;
+	pkt.timestamp = 0;
+	if (inTimestamp != DECODE_NO_TIMESTAMP)
+	{
+		pkt.flags |= CUVID_PKT_TIMESTAMP;
+		pkt.timestamp = inTimestamp;
+	}
+	m_state.parse_start_us = PerfTimeUs();
+	TRACE_SCOPE("cuvidParseVideoData");
 	cuvidParseVideoData(m_state.cuParser, &pkt);
+}
 
-	return true;
+
+void CudaH264Decoder::SetSequenceHint( bool inSequence )
+{
+	m_SequenceHinted = true;
+	m_SequenceHint = inSequence;
 }
 
+void CudaH264Decoder::SetDeinterlaceMode( int inMode )
+{
+	m_state.deinterlace_mode = inMode;
+	m_state.has_prev_output = 0;
+}
 
-BYTE* CudaH264Decoder::GetOutputBufferPtr() const
+void CudaH264Decoder::SetFrameDuration( long long inDuration )
 {
-	return m_OutputYuv2Buffer;
+	CAutoCtxLock lck(m_state.cuCtxLock);
+	m_Decimator.SetFrameDuration(inDuration);
 }
 
-void CudaH264Decoder::SendFrameDownStream()
+void CudaH264Decoder::SetTargetSize( int inWidth, int inHeight )
 {
- 	IMediaSample *pSample;
-  	HRESULT hr = m_DecodedStream->GetDeliveryBuffer(&pSample, NULL, NULL, 0);
-  	if (FAILED(hr)) 
-  	{
-  		Sleep(1);
-		return;
-  	}
-  	hr = m_DecodedStream->DeliverCurrentPicture(pSample);
-  	if (FAILED(hr) && m_DecodedStream->m_DecodeFilter->m_EOSReceived)
-  	{
-  		m_DecodedStream->m_EOS_Flag = TRUE; // testing!
-  		m_DecodedStream->m_MpegController->EndEndOfStream();
-  		if (!m_DecodedStream->m_DecodeFilter->m_EOSDelivered)
-  		{
-  			m_DecodedStream->m_DecodeFilter->m_EOSDelivered = TRUE;
-  			m_DecodedStream->DeliverEndOfStream();	
-  		}
-  	}
+	CAutoCtxLock lck(m_state.cuCtxLock);
+	m_state.target_width = inWidth;
+	m_state.target_height = inHeight;
 }
 
-int CudaH264Decoder::PostProcessing( DecodeSession *state, CUVIDPARSERDISPINFO *pPicParams)
+int CudaH264Decoder::GetFrameCount() const
 {
+	return m_state.pic_cnt;
+}
+
+int CudaH264Decoder::PostProcessing( CuvidState *state, CUVIDPARSERDISPINFO *pPicParams)
+{
+	TRACE_SCOPE("PostProcessing");
 	CAutoCtxLock lck(state->cuCtxLock);
 	CUVIDPROCPARAMS vpp;
 	CUdeviceptr devPtr;
@@ -393,6 +878,10 @@ int CudaH264Decoder::PostProcessing( DecodeSession *state, CUVIDPARSERDISPINFO *
 	unsigned int pitch = 0, w, h;
 	int nv12_size;
 
+	long long mapStart = PerfTimeUs();
+	state->stats->AddLatency(STAT_DECODE_TO_MAP, 
+		mapStart - state->decode_time_us[pPicParams->picture_index % MAX_DECODE_SURFACES]);
+
 	memset(&vpp, 0, sizeof(vpp));
 	vpp.progressive_frame = pPicParams->progressive_frame;
 	vpp.top_field_first = pPicParams->top_field_first;
@@ -420,79 +909,51 @@ int CudaH264Decoder::PostProcessing( DecodeSession *state, CUVIDPARSERDISPINFO *
 	}
 	if (state->pRawNV12)
 	{
-#if USE_ASYNC_COPY
-		result = cuMemcpyDtoHAsync(state->pRawNV12, devPtr, nv12_size, state->cuStream);
-		if (result != CUDA_SUCCESS)
-			printf("cuMemcpyDtoHAsync: %d\n", result);
-		// Gracefully wait for async copy to complete
-		while (CUDA_ERROR_NOT_READY == cuStreamQuery(state->cuStream))
+		if (state->use_async_copy)
 		{
-			Sleep(1);
+			result = cuMemcpyDtoHAsync(state->pRawNV12, devPtr, nv12_size, state->cuStream);
+			if (result != CUDA_SUCCESS)
+				printf("cuMemcpyDtoHAsync: %d\n", result);
+			// Gracefully wait for async copy to complete
+			while (CUDA_ERROR_NOT_READY == cuStreamQuery(state->cuStream))
+			{
+				PlatformSleep(1);
+			}
+		}
+		else
+		{
+			result = cuMemcpyDtoH(state->pRawNV12, devPtr, nv12_size);
 		}
-#else
-		result = cuMemcpyDtoH(state->pRawNV12, devPtr, nv12_size);
-#endif
 	}
 
-	// Convert the output to standard IYUV and dump it to disk (note: very inefficient)
+	state->convert_start_us = PerfTimeUs();
+	state->stats->AddLatency(STAT_MAP_TO_CONVERT, state->convert_start_us - mapStart);
+
+	// Convert the output to standard IYUV, deinterlacing in the same pass
 	if (state->pRawNV12)
 	{
-		unsigned int y;
-
-		const unsigned char *p = state->pRawNV12;
-		unsigned char *iyuv = m_OutputYuv2Buffer;//= new unsigned char [w*h+w*(h>>1)];
-
-		// Copy luma
-		for (y=0; y<h; y++)
+		TRACE_SCOPE("ConvertNV12ToIYUV");
+		ConvertParams cp;
+
+		cp.src = state->pRawNV12;
+		cp.srcPitch = pitch;
+		cp.width = w;
+		cp.height = h;
+		cp.dst = state->pOutput;
+		cp.hasPrevious = state->has_prev_output;
+		cp.deinterlaceMode = state->deinterlace_mode;
+		cp.progressiveFrame = pPicParams->progressive_frame;
+		cp.topFieldFirst = pPicParams->top_field_first;
+		cp.stats = state->frame_statistics ? &state->luma : NULL;
+
+		ConvertNV12ToIYUV(&cp);
+		if (cp.stats)
 		{
-			memcpy(iyuv+y*w, p+y*pitch, w);
+			state->luma.PreviousDistance = cp.hasPrevious ? state->pic_cnt - state->prev_output_cnt : 0;
+			state->stats->AddFrameMeasured(state->luma);
 		}
-		// De-interleave chroma (NV12 stored as U,V,U,V,...)
-		p += h*pitch;
-		for (y=0; y<h/2; y++)
-		{
-			for (unsigned int x=0; x<w/2; x++)
-			{
-				iyuv[w*h+y*w/2+x] = p[y*pitch+x*2];
-				iyuv[w*h+(h/2)*(w/2)+y*w/2+x] = p[y*pitch+x*2+1];
-			}
-		}
-		//////////////////////////////////////////////////////////////////////////
-
-		//FILE* outfile = fopen("outtest.yuv", "a");
-		//fwrite(iyuv, 1, w*h+w*(h/2), outfile);
-		//fclose(outfile);
-
-		//////////////////////////////////////////////////////////////////////////
-
-		//fwrite(iyuv, 1, w*h+w*(h/2), state->fd_yuv);
-		//this->copyToBuffer(iyuv, w*h+w*(h/2));
-		// 		int size = w*h+w*(h/2);
-		// 
-		// 		if(!CudaH264Decoder::copyToBuffer(iyuv, size))
-		// 			return 0;
-
-		//++m_FrameNumInBuffer;
-
-		//delete iyuv;
-
-
-
-		//float hueColorSpaceMat[9];
-
-		// TODO: Stage for handling video post processing
-
-		// Final Stage: NV12toARGB color space conversion
-		//SetColorSpaceMatrix (ITU601, hueColorSpaceMat);
-
-		//UpdateConstantMemory(hueColorSpaceMat);
-		
-		//CUresult eResult;
-
-// 		eResult = CudaNV12ToARGB(	*ppDecodedFrame, nDecodedPitch,
-// 									*ppTextureData,  nTexturePitch,
-// 									w, h, fpCudaKernel, streamID);
-
+		state->has_prev_output = 1;
+		state->prev_output_cnt = state->pic_cnt;
 	}
 
 	cuvidUnmapVideoFrame(state->cuDecoder, devPtr);
@@ -13,7 +13,37 @@
 #ifndef CUDA_DECODER_H_
 #define CUDA_DECODER_H_
 
-#include "StdHeader.h"
+#include "DecoderBackend.h"
+#include "FrameDecimator.h"
+#include "Platform.h"
+#include <cuda.h>
+#include <nvcuvid.h>
+#ifdef _WIN32
+#include <d3d9.h>
+#include <cudad3d9.h>
+#endif
+
+#define USE_FLOATING_CONTEXTS   1  // Use floating contexts
+// cuvidReconfigureDecoder came with the Video Codec SDK 9 headers, which
+// are also the first to define NVDECAPI_MAJOR_VERSION
+#ifndef USE_DECODER_RECONFIGURE
+#if defined(NVDECAPI_MAJOR_VERSION) && NVDECAPI_MAJOR_VERSION >= 9
+#define USE_DECODER_RECONFIGURE 1
+#else
+#define USE_DECODER_RECONFIGURE 0
+#endif
+#endif
+#ifndef USE_SEQUENCE_SURFACES
+#define USE_SEQUENCE_SURFACES USE_DECODER_RECONFIGURE  // CUVIDEOFORMAT::min_num_decode_surfaces, SDK 9 headers
+#endif
+
+// Pitch assumed when allocating the host NV12 copy ahead of the first frame
+#define NV12_PITCH_ALIGN	512
+
+// Frames mapped for post-processing besides the display queue
+#define DECODE_PIPELINE_DEPTH	1
+
+class DecoderStats;
 
 // Auto lock for floating contexts
 class CAutoCtxLock
@@ -36,28 +66,64 @@ typedef struct
 	CUstream cuStream;
 	CUvideoctxlock cuCtxLock;
 	CUVIDDECODECREATEINFO dci;
-	CUVIDPARSERDISPINFO DisplayQueue[DISPLAY_DELAY];
+	CUVIDPARSERDISPINFO DisplayQueue[MAX_DISPLAY_DELAY];
 	unsigned char *pRawNV12;
 	int raw_nv12_size;
 	int pic_cnt;
 	int display_pos;
-} DecodeSession;
-
-class DecodedStream;
-
-class CudaH264Decoder
+	int display_delay;
+	int num_surfaces;			// Of the parser and the decoder, only grows
+	int max_surfaces;			// MaxFrameCount, exceeded only by what the DPB needs
+	int decoder_surfaces;		// Allocated when the decoder was created
+	int use_async_copy;
+	int deinterlace_mode;
+	int has_prev_output;
+	int prev_output_cnt;		// pic_cnt of the frame in pOutput, when has_prev_output
+	int frame_statistics;
+	LumaStatistics luma;		// Of pOutput, with frame_statistics
+	FrameDecimator *decimator;
+	unsigned char skipped[MAX_DECODE_SURFACES];	// Picture left undecoded by the decimator
+	DecoderStats *stats;
+	FrameSink *sink;
+	unsigned char *pOutput;		// Converted IYUV frame
+	long long parse_start_us;
+	long long decode_time_us[MAX_DECODE_SURFACES];
+	long long convert_start_us;
+	int max_width;				// Configured allocation size, 0 for none
+	int max_height;
+	int target_width;			// Output size, 0 to follow the display area
+	int target_height;
+	int output_buffer_size;		// Bytes of pOutput
+} CuvidState;
+
+class CudaH264Decoder : public DecoderBackend
 {
 public:
 
-	CudaH264Decoder(unsigned int maxFrame = MAX_FRM_CNT);
+	CudaH264Decoder();
 
 	virtual ~CudaH264Decoder();
 	
-	bool				Init(DecodedStream* decodedStream);
+	// DecoderBackend
+	bool				Init(const DecoderSettings& settings, FrameSink* sink, DecoderStats* stats);
+
+	bool				Decode(const unsigned char* inData, long inLength, long long inTimestamp);
+
+	void				SetDeinterlaceMode(int inMode);
+
+	void				SetFrameDuration(long long inDuration);
 
-	bool				FetchVideoData(BYTE* ptr, unsigned int size);
+	void				SetTargetSize(int inWidth, int inHeight);
 
-	BYTE*				GetOutputBufferPtr() const;
+	bool				PrepareSequence(const SequenceInfo& inSps);
+
+	bool				HasDecoder();
+
+	void				SetSequenceHint(bool inSequence);
+
+	void				GetSurfaceUsage(long* outSurfaces, long long* outDeviceBytes, long long* outHostBytes);
+
+	int					GetFrameCount() const;
 
 protected:
 
@@ -65,33 +131,51 @@ protected:
 
 	bool				ReleaseCuda();
 
+	int					GetSurfaceCount(const SequenceInfo& inSps) const;
+	static int			GetSurfaceCount(const CuvidState *state, int inMinimum);
+
+	bool				CreateParser(int inSurfaces);
+	void				DestroyParser();
+	long				FindGrowingSequence(const unsigned char* inData, long inLength, int* outSurfaces) const;
+	void				ParseData(const unsigned char* inData, long inLength, long long inTimestamp);
+
+	static long long	GetSurfaceBytes(const CUVIDDECODECREATEINFO *dci);
+
+	static void			FillCreateInfo(CUVIDDECODECREATEINFO *dci, CuvidState *state, int surfaces,
+									   cudaVideoCodec codec, cudaVideoChromaFormat chroma,
+									   unsigned int width, unsigned int height,
+									   int left, int top, int right, int bottom);
+	static bool			IsSameSequence(const CUVIDDECODECREATEINFO *a, const CUVIDDECODECREATEINFO *b);
+	static void			EnsureFrameBuffers(CuvidState *state);
+	static bool			CreateDecoder(CuvidState *state, const CUVIDDECODECREATEINFO *dci);
+	static bool			ReconfigureDecoder(CuvidState *state, const CUVIDDECODECREATEINFO *dci);
+
 	static int CUDAAPI 	HandleVideoSequence(void *pvUserData, CUVIDEOFORMAT *pFormat);
 	static int CUDAAPI 	HandlePictureDecode(void *pvUserData, CUVIDPICPARAMS *pPicParams);
 	static int CUDAAPI 	HandlePictureDisplay(void *pvUserData, CUVIDPARSERDISPINFO *pPicParams);
 
-	static int			PostProcessing(DecodeSession *state, CUVIDPARSERDISPINFO *pPicParams);
-	
-	static void			SendFrameDownStream();
-
-public:
+	static void			DisplayPicture(CuvidState *state, CUVIDPARSERDISPINFO *pPicParams);
+	static void			FlushDisplayQueue(CuvidState *state);
 
-	static BYTE*		m_InputBuffer;
-
-	static BYTE*		m_OutputYuv2Buffer;
+	static int			PostProcessing(CuvidState *state, CUVIDPARSERDISPINFO *pPicParams);
 
 private:
 
+#ifdef _WIN32
 	IDirect3D9*			m_pD3D;
 	IDirect3DDevice9*	m_pD3Dev;
+#endif
 	CUcontext			m_cuContext;
 	CUdevice			m_cuDevice;
 	int					m_cuInstanceCount;
 	CUvideoctxlock		m_cuCtxLock;
 
 	CUVIDPARSERPARAMS	m_parserInitParams;
-	DecodeSession		m_state;
-
-	static DecodedStream* m_DecodedStream;
+	PlatformLock		m_ParserLock;
+	FrameDecimator		m_Decimator;
+	bool				m_SequenceHinted;	// The caller tells which data holds an SPS
+	bool				m_SequenceHint;		// The next data does
+	CuvidState			m_state;
 };
 
 #endif
\ No newline at end of file
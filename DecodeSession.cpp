@@ -0,0 +1,585 @@
+//------------------------------------------------------------------------------
+// File: DecodeSession.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: A decode session coordinates the smart cache (input buffer)
+// and a decoder backend: bitstream is pushed with timestamps on one
+// thread, decoded on another, and the frames handed to a FrameSink.
+// It has no DirectShow dependency, the filter is one of its users.
+//
+//------------------------------------------------------------------------------
+
+#include "DecodeSession.h"
+#include "SmartCache.h"
+#include "PerfTimer.h"
+#include <string.h>
+
+DecodeSession::DecodeSession() :	m_OutputWidth(0),
+									m_OutputHeight(0),
+									m_FaultFlag(0),
+									m_IsEOS(false),
+									m_SmartCache(NULL),
+									m_InputBuffer(NULL),
+									m_PushBuffer(NULL),
+									m_DecoderPrepared(false),
+									m_FrameDuration(0),
+									m_Sink(NULL),
+									m_Backend(NULL)
+{
+	memset(&m_Settings, 0, sizeof(m_Settings));
+	this->ResetTimestamps();
+}
+
+DecodeSession::~DecodeSession()
+{
+	this->Close();
+}
+
+bool DecodeSession::Open( const DecoderSettings& settings, FrameSink* inSink, DecoderBackend* inBackend )
+{
+	// Opening again, as on a change of settings, replaces the cache and backend
+	this->Close();
+
+	m_Settings = settings;
+	m_Sink = inSink;
+
+	m_SmartCache = new SmartCache(settings.SmartCacheSize, settings.MinWorkSize);
+	m_SmartCache->SetStatistics(&m_Stats);
+	m_InputBuffer = new unsigned char[settings.DecoderBufferSize];
+
+	m_DecoderPrepared = false;
+	this->ResetTimestamps();
+	{
+		PlatformAutoLock lck(&m_AnalyzerLock);
+		m_Analyzer.Flush();
+		m_Analyzer.Reset();
+	}
+
+	m_ReadEstimator.Init(settings.DecoderBufferSize, settings.ReadLatencyBudget * 1000,
+						 settings.AdaptiveReadSize != 0);
+
+	// A backend that did not start is not driven: Push and the decoding
+	// thread see no backend. The caller's backend stays the caller's.
+	if (inBackend)
+	{
+		m_Backend = inBackend;
+		if (!m_Backend->Init(settings, this, &m_Stats))
+		{
+			printf("Failed to initialize the decoder backend\n");
+			m_Backend = NULL;
+			return false;
+		}
+	}
+	else if (!this->InitBackend(settings.Backend) && !this->InitFallbackBackend())
+	{
+		return false;
+	}
+	m_Backend->SetTargetSize(m_OutputWidth, m_OutputHeight);
+	if (m_FrameDuration > 0)
+		m_Backend->SetFrameDuration(m_FrameDuration);
+	return true;
+}
+
+// No CUDA device: the stream goes on with the software decoder
+bool DecodeSession::InitFallbackBackend( void )
+{
+	if (m_Settings.Backend == DECODER_BACKEND_FALLBACK ||
+		!this->InitBackend(DECODER_BACKEND_FALLBACK))
+	{
+		return false;
+	}
+	m_Settings.Backend = DECODER_BACKEND_FALLBACK;
+	return true;
+}
+
+// Deletes the backend again if it does not start
+bool DecodeSession::InitBackend( long inBackend )
+{
+	m_Backend = CreateDecoderBackend(inBackend);
+	if (m_Backend == NULL)
+	{
+		printf("Decoder backend %ld is not available\n", inBackend);
+		return false;
+	}
+	if (!m_Backend->Init(m_Settings, this, &m_Stats))
+	{
+		printf("Failed to initialize decoder backend %ld\n", inBackend);
+		delete m_Backend;
+		m_Backend = NULL;
+		return false;
+	}
+	return true;
+}
+
+void DecodeSession::Close( void )
+{
+	if(m_Backend)
+	{
+		delete m_Backend;
+		m_Backend = NULL;
+	}
+
+	if(m_SmartCache)
+	{
+		delete m_SmartCache;
+		m_SmartCache = NULL;
+	}
+
+	delete [] m_InputBuffer;
+	m_InputBuffer = NULL;
+	m_PushBuffer = NULL;
+}
+
+void DecodeSession::SetOutputFrameSize( int inWidth, int inHeight )
+{
+	m_OutputWidth  = inWidth;
+	m_OutputHeight = inHeight;
+	if (m_Backend)
+	{
+		m_Backend->SetTargetSize(inWidth, inHeight);
+	}
+}
+
+void DecodeSession::SetDeinterlaceMode( int inMode )
+{
+	m_Settings.DeinterlaceMode = inMode;
+	if (m_Backend)
+	{
+		m_Backend->SetDeinterlaceMode(inMode);
+	}
+}
+
+void DecodeSession::SetFrameDuration( long long inDuration )
+{
+	m_FrameDuration = inDuration;
+	if (m_Backend)
+	{
+		m_Backend->SetFrameDuration(inDuration);
+	}
+
+	PlatformAutoLock lck(&m_AnalyzerLock);
+	m_Analyzer.SetFrameDuration(inDuration);
+}
+
+void DecodeSession::ResetTimestamps( void )
+{
+	m_TimestampHead  = 0;
+	m_TimestampCount = 0;
+	m_BytesPushed    = 0;
+	m_BytesFetched   = 0;
+	m_SequenceEnd    = 0;
+	m_LastTimestamp  = DECODE_NO_TIMESTAMP;
+	m_LastFrameNumber  = 0;
+	m_FirstFrameNumber = -1;
+}
+
+// Called with the read lock held. Like the parser, only one timestamp goes
+// with each read: the first one pushed with data inside it. The frames that
+// lose theirs are extrapolated from the previous one.
+long long DecodeSession::TakeTimestamp( long inLength )
+{
+	long long timestamp = DECODE_NO_TIMESTAMP;
+	long long end = m_BytesFetched + inLength;
+
+	while (m_TimestampCount > 0 && m_Timestamps[m_TimestampHead].Offset < end)
+	{
+		if (timestamp == DECODE_NO_TIMESTAMP)
+			timestamp = m_Timestamps[m_TimestampHead].Timestamp;
+		m_TimestampHead = (m_TimestampHead + 1) % TIMESTAMP_QUEUE_SIZE;
+		m_TimestampCount--;
+	}
+	m_BytesFetched = end;
+	return timestamp;
+}
+
+void DecodeSession::BeginFlush( void )
+{
+	m_FaultFlag = ERROR_FLUSH;   // Give a chance to exit decoding cycle.
+	m_SmartCache->BeginFlush();
+	{
+		PlatformAutoLock lck(&m_ReadLock);
+		m_ReadEstimator.Flush();
+		this->ResetTimestamps();
+	}
+	{
+		PlatformAutoLock lck(&m_AnalyzerLock);
+		m_Analyzer.Flush();
+	}
+	PlatformSleep(10);
+}
+
+void DecodeSession::EndFlush( void )
+{
+	m_FaultFlag = 0;
+	m_SmartCache->EndFlush();
+}
+
+void DecodeSession::BeginEndOfStream( void )
+{
+	m_IsEOS = true;
+	{
+		PlatformAutoLock lck(&m_AnalyzerLock);
+		m_Analyzer.Finish();
+	}
+	if (m_SmartCache->CheckOutputWaiting())
+	{
+		m_FaultFlag = ERROR_FLUSH;
+		m_SmartCache->BeginFlush();
+		{
+			PlatformAutoLock lck(&m_ReadLock);
+			m_ReadEstimator.Flush();
+			this->ResetTimestamps();
+		}
+		PlatformSleep(10);
+		m_SmartCache->EndFlush();
+	}
+}
+
+void DecodeSession::EndEndOfStream( void )
+{
+	m_IsEOS = false;
+}
+
+void DecodeSession::FlushAllPending( void )
+{
+	m_FaultFlag = ERROR_FLUSH;
+	m_SmartCache->BeginFlush();
+	{
+		PlatformAutoLock lck(&m_ReadLock);
+		m_ReadEstimator.Flush();
+		this->ResetTimestamps();
+	}
+	{
+		PlatformAutoLock lck(&m_AnalyzerLock);
+		m_Analyzer.Flush();
+	}
+	PlatformSleep(10);
+	m_SmartCache->EndFlush();
+	m_FaultFlag = 0;
+}
+
+bool DecodeSession::PrepareDecoder( const unsigned char * inData, long inLength, SequenceInfo * outSps )
+{
+	if (m_Backend == NULL || !FindSequenceParameterSet(inData, inLength, outSps))
+	{
+		return false;
+	}
+	if (m_Backend->PrepareSequence(*outSps))
+	{
+		m_DecoderPrepared = true;
+	}
+	return true;
+}
+
+// Until there is a decoder, try to create it before the data gets to the parser
+void DecodeSession::PrepareFromData( const unsigned char * inData, long inLength )
+{
+	if (!m_DecoderPrepared)
+	{
+		SequenceInfo sps;
+		if (m_Backend->HasDecoder())
+			m_DecoderPrepared = true;
+		else
+			this->PrepareDecoder(inData, inLength, &sps);
+	}
+}
+
+bool DecodeSession::Push( const unsigned char * inData, long inLength, long long inTimestamp )
+{
+	if (m_Backend == NULL)
+	{
+		return false;
+	}
+
+	long long now = PerfTimeUs();
+	this->OnDataPushed(inData, inLength, inTimestamp, now);
+
+	long pass = m_SmartCache->Receive((unsigned char *) inData, inLength);
+	if (pass > 0)
+	{
+		PlatformAutoLock lck(&m_ReadLock);
+		m_ReadEstimator.OnDataReceived(inLength, now);
+	}
+	return pass > 0 ? true : false;
+}
+
+unsigned char * DecodeSession::BeginPush( long inLength )
+{
+	if (m_Backend == NULL)
+	{
+		return NULL;
+	}
+	m_PushBuffer = m_SmartCache->Reserve(inLength);
+	return m_PushBuffer;
+}
+
+// The data is looked at where it was written, before the cache lets the
+// decoding thread have it
+bool DecodeSession::EndPush( long inLength, long long inTimestamp )
+{
+	if (m_PushBuffer == NULL)
+	{
+		return false;
+	}
+
+	long long now = PerfTimeUs();
+	long pass = 0;
+	if (inLength > 0)
+	{
+		this->OnDataPushed(m_PushBuffer, inLength, inTimestamp, now);
+		pass = m_SmartCache->Commit(inLength);
+	}
+	else
+	{
+		m_SmartCache->Commit(0);
+	}
+	m_PushBuffer = NULL;
+
+	if (pass > 0)
+	{
+		PlatformAutoLock lck(&m_ReadLock);
+		m_ReadEstimator.OnDataReceived(inLength, now);
+	}
+	return pass > 0 ? true : false;
+}
+
+// Input thread, for data about to enter the cache
+void DecodeSession::OnDataPushed( const unsigned char * inData, long inLength, long long inTimestamp, long long inNow )
+{
+	m_Stats.AddSampleReceived(inNow);
+	this->PrepareFromData(inData, inLength);
+	bool sequence = this->AnalyzeData(inData, inLength);
+
+	// Queued ahead of the data, so it is there when the data is fetched
+	{
+		PlatformAutoLock lck(&m_ReadLock);
+		if (inTimestamp != DECODE_NO_TIMESTAMP && m_TimestampCount < TIMESTAMP_QUEUE_SIZE)
+		{
+			PendingTimestamp& entry = m_Timestamps[(m_TimestampHead + m_TimestampCount) % TIMESTAMP_QUEUE_SIZE];
+			entry.Offset = m_BytesPushed;
+			entry.Timestamp = inTimestamp;
+			m_TimestampCount++;
+		}
+		m_BytesPushed += inLength;
+		if (sequence)
+			m_SequenceEnd = m_BytesPushed;
+	}
+}
+
+// True if an SPS starts in the data
+bool DecodeSession::AnalyzeData( const unsigned char * inData, long inLength )
+{
+	PlatformAutoLock lck(&m_AnalyzerLock);
+	long sequences = m_Analyzer.GetSequenceHeaders();
+	m_Analyzer.Scan(inData, inLength);
+	return m_Analyzer.GetSequenceHeaders() != sequences;
+}
+
+// The parser reads the caller's memory, nothing is copied on the way
+bool DecodeSession::DecodeBuffer( const unsigned char * inData, long inLength, long long inTimestamp )
+{
+	if (m_Backend == NULL)
+	{
+		return false;
+	}
+
+	m_Stats.AddSampleReceived(PerfTimeUs());
+	this->PrepareFromData(inData, inLength);
+	m_Backend->SetSequenceHint(this->AnalyzeData(inData, inLength));
+
+	return m_Backend->Decode(inData, inLength, inTimestamp);
+}
+
+bool DecodeSession::IsCacheInputWaiting( void )
+{
+	return m_SmartCache->CheckInputWaiting();
+}
+
+bool DecodeSession::IsCacheOutputWaiting( void )
+{
+	return m_SmartCache->CheckOutputWaiting();
+}
+
+bool DecodeSession::IsCacheEmpty( void )
+{
+	return m_SmartCache->GetAvailable() > 0 ? false : true;
+}
+
+void DecodeSession::GetStatistics( DecoderStatistics* outStats )
+{
+	m_Stats.Snapshot(outStats);
+	if (m_SmartCache)
+	{
+		outStats->CacheFillBytes = m_SmartCache->GetAvailable();
+		outStats->CacheSizeBytes = m_SmartCache->GetCacheSize();
+	}
+	if (m_Backend)
+	{
+		m_Backend->GetSurfaceUsage(&outStats->DecodeSurfaces, &outStats->SurfaceBytes, &outStats->HostFrameBytes);
+	}
+	{
+		PlatformAutoLock lck(&m_ReadLock);
+		m_ReadEstimator.GetStatistics(&outStats->Reads);
+	}
+	{
+		PlatformAutoLock lck(&m_AnalyzerLock);
+		m_Analyzer.GetStatistics(&outStats->Stream);
+	}
+	outStats->Settings = m_Settings;
+}
+
+void DecodeSession::ResetStatistics( void )
+{
+	m_Stats.Reset();
+
+	PlatformAutoLock lck(&m_AnalyzerLock);
+	m_Analyzer.Reset();
+}
+
+void DecodeSession::ReportStatistics( FILE* outFile )
+{
+	DecoderStatistics stats;
+	this->GetStatistics(&stats);
+	DecoderStats::Report(stats, outFile);
+}
+
+bool DecodeSession::DecodeOnePicture( void )
+{
+	long available = m_SmartCache->GetAvailable();
+	long readSize;
+	long long timestamp;
+
+	if(available == 0)
+	{
+		m_FaultFlag = ERROR_FLUSH;
+		return false;
+	}
+
+	m_SmartCache->ResetCacheChecking();
+
+	long long fetchTime = PerfTimeUs();
+	{
+		PlatformAutoLock lck(&m_ReadLock);
+		readSize = m_ReadEstimator.GetReadSize(available, m_IsEOS, fetchTime);
+	}
+
+	if(readSize == 0)
+	{
+		PlatformSleep(1);  // The rest of the frame is about to arrive
+		return true;
+	}
+
+	if(m_SmartCache->FetchData(m_InputBuffer, readSize) == 0)
+	{
+		m_FaultFlag = ERROR_FLUSH;//testing !!!
+		return false;
+	}
+
+	bool sequence;
+	{
+		PlatformAutoLock lck(&m_ReadLock);
+		sequence = m_SequenceEnd > m_BytesFetched;
+		timestamp = this->TakeTimestamp(readSize);
+	}
+
+	int framesBefore = m_Backend->GetFrameCount();
+	m_Backend->SetSequenceHint(sequence);
+	bool pass = m_Backend->Decode(m_InputBuffer, readSize, timestamp);
+
+	{
+		PlatformAutoLock lck(&m_ReadLock);
+		long long delay = m_ReadEstimator.OnDataFed(readSize, m_Backend->GetFrameCount() - framesBefore, fetchTime);
+		if (delay >= 0)
+			m_Stats.AddLatency(STAT_RECEIVE_TO_PARSE, delay);
+	}
+
+	return pass;
+}
+
+// The bytes are taken from the cache even if they cannot be decoded, so
+// that the caller's access unit offsets stay in step with it
+bool DecodeSession::DecodeBytes( long inLength )
+{
+	bool pass = true;
+
+	m_SmartCache->ResetCacheChecking();
+
+	while (inLength > 0)
+	{
+		long readSize = inLength < m_Settings.DecoderBufferSize ? inLength : m_Settings.DecoderBufferSize;
+		long long timestamp;
+		bool sequence;
+
+		if (m_SmartCache->FetchData(m_InputBuffer, readSize) == 0)
+		{
+			return false;
+		}
+		{
+			PlatformAutoLock lck(&m_ReadLock);
+			sequence = m_SequenceEnd > m_BytesFetched;
+			timestamp = this->TakeTimestamp(readSize);
+		}
+		if (m_Backend == NULL)
+		{
+			pass = false;
+		}
+		else
+		{
+			m_Backend->SetSequenceHint(sequence);
+			if (!m_Backend->Decode(m_InputBuffer, readSize, timestamp))
+				pass = false;
+		}
+		inLength -= readSize;
+	}
+	return pass;
+}
+
+void DecodeSession::Drain( void )
+{
+	{
+		PlatformAutoLock lck(&m_AnalyzerLock);
+		m_Analyzer.Finish();
+	}
+	if (m_Backend)
+	{
+		m_Backend->Decode(NULL, 0, DECODE_NO_TIMESTAMP);
+	}
+	if (m_Sink)
+	{
+		m_Sink->OnEndOfStream();
+	}
+}
+
+// Frames without a timestamp, or with one not after the previous frame's
+// (the parser reports 0 for pictures without one), continue from the
+// previous frame by the frames in between, those the decimator left out
+// included. The backend's frame numbers count them too, and only start
+// again from 0 here.
+bool DecodeSession::OnFrame( const DecodedFrame& inFrame )
+{
+	DecodedFrame frame = inFrame;
+
+	if (m_FirstFrameNumber < 0)
+		m_FirstFrameNumber = inFrame.FrameNumber;
+	long long frames = inFrame.FrameNumber - m_LastFrameNumber;
+	if (frames < 1)
+		frames = 1;
+
+	if (m_LastTimestamp != DECODE_NO_TIMESTAMP &&
+		(frame.Timestamp == DECODE_NO_TIMESTAMP || frame.Timestamp <= m_LastTimestamp))
+	{
+		frame.Timestamp = m_LastTimestamp + frames * m_FrameDuration;
+	}
+	else if (frame.Timestamp == DECODE_NO_TIMESTAMP)
+	{
+		frame.Timestamp = 0;
+	}
+	m_LastTimestamp = frame.Timestamp;
+	m_LastFrameNumber = inFrame.FrameNumber;
+	frame.FrameNumber = inFrame.FrameNumber - m_FirstFrameNumber;
+
+	return m_Sink ? m_Sink->OnFrame(frame) : true;
+}
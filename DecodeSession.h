@@ -0,0 +1,157 @@
+//------------------------------------------------------------------------------
+// File: DecodeSession.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: A decode session coordinates the smart cache (input buffer)
+// and a decoder backend: bitstream is pushed with timestamps on one
+// thread, decoded on another, and the frames handed to a FrameSink.
+// It has no DirectShow dependency, the filter is one of its users.
+//
+//------------------------------------------------------------------------------
+
+#ifndef DECODE_SESSION_H_
+#define DECODE_SESSION_H_
+
+#include "DecoderBackend.h"
+#include "ReadSizeEstimator.h"
+#include "DecoderStats.h"
+#include "StreamAnalyzer.h"
+#include "Platform.h"
+
+#define ERROR_FLUSH				200
+
+// Timestamps waiting for their data to be handed to the decoder
+#define TIMESTAMP_QUEUE_SIZE	256
+
+class SmartCache;
+
+class DecodeSession : private FrameSink
+{
+public:
+	DecodeSession();
+	virtual ~DecodeSession();
+
+public:
+	// The session takes ownership of inBackend. NULL creates the backend
+	// named by the settings. Returns false if the decoder cannot be set up,
+	// inBackend then stays the caller's.
+	bool Open(const DecoderSettings& settings, FrameSink* inSink, DecoderBackend* inBackend = NULL);
+	void Close(void);
+
+	void SetOutputFrameSize(int inWidth, int inHeight);
+	void SetDeinterlaceMode(int inMode);
+
+	// Timestamp units per frame, used for the frames that come without one
+	void SetFrameDuration(long long inDuration);
+
+	// Looks for an SPS in Annex B data and creates the decoder from it
+	bool PrepareDecoder(const unsigned char * inData, long inLength, SequenceInfo * outSps);
+
+	// Input thread. Copies Annex B data into the cache, blocks while it is full.
+	bool Push(const unsigned char * inData, long inLength, long long inTimestamp = DECODE_NO_TIMESTAMP);
+
+	// Input thread, instead of Push for front ends that assemble the data
+	// themselves: room in the cache for inLength bytes, written in place.
+	// Bytes written after the previous BeginPush are kept but may have
+	// moved. NULL while flushing or if the cache is too small.
+	unsigned char * BeginPush(long inLength);
+
+	// Hands the first inLength bytes of the room to the decoder as Push
+	// would, the rest are dropped
+	bool EndPush(long inLength, long long inTimestamp = DECODE_NO_TIMESTAMP);
+
+	// Instead of Push and DecodeOnePicture, for callers that hold the whole
+	// stream in memory: decodes the data in place, bypassing the cache. The
+	// frames go to the sink from within the call.
+	bool DecodeBuffer(const unsigned char * inData, long inLength, long long inTimestamp = DECODE_NO_TIMESTAMP);
+
+	// Decoding thread, instead of DecodeOnePicture for callers that track the
+	// access units of the pushed data: decodes the next inLength bytes of
+	// the cache, which must have been pushed already.
+	bool DecodeBytes(long inLength);
+
+	// Decoding thread. Hands the next read of the cache to the decoder, the
+	// frames go to the sink from within the call.
+	bool DecodeOnePicture(void);
+
+	// Decoding thread, once the cache is empty after the end of the stream:
+	// delivers the frames still held by the decoder, then ends the stream.
+	void Drain(void);
+
+	void BeginFlush(void);
+	void EndFlush(void);
+	void BeginEndOfStream(void);
+	void EndEndOfStream(void);
+	void FlushAllPending(void);
+
+	bool IsCacheInputWaiting(void);
+	bool IsCacheOutputWaiting(void);
+	bool IsCacheEmpty(void);
+
+	const DecoderSettings& GetSettings(void) const { return m_Settings; }
+
+	void GetStatistics(DecoderStatistics* outStats);
+	void ResetStatistics(void);
+	void ReportStatistics(FILE* outFile);
+
+private:
+
+	// FrameSink, between the backend and the user's sink
+	bool OnFrame(const DecodedFrame& inFrame);
+
+	bool InitBackend(long inBackend);
+	bool InitFallbackBackend(void);
+	bool AnalyzeData(const unsigned char * inData, long inLength);
+	void OnDataPushed(const unsigned char * inData, long inLength, long long inTimestamp, long long inNow);
+	void PrepareFromData(const unsigned char * inData, long inLength);
+	void ResetTimestamps(void);
+	long long TakeTimestamp(long inLength);
+
+private:
+
+	typedef struct
+	{
+		long long	Offset;			// Stream offset of the data it came with
+		long long	Timestamp;
+	} PendingTimestamp;
+
+	int			m_OutputWidth;		// 0 until set by the user
+	int			m_OutputHeight;
+	DecoderSettings	m_Settings;
+
+	int			m_FaultFlag;
+	bool		m_IsEOS;
+
+	SmartCache* m_SmartCache;
+	unsigned char*	m_InputBuffer;	// Read of the cache handed to the decoder
+	unsigned char*	m_PushBuffer;	// Room taken by BeginPush, NULL if none
+
+	bool		m_DecoderPrepared;	// Decoder exists, stop looking for an SPS
+
+	ReadSizeEstimator	m_ReadEstimator;
+	PlatformLock		m_ReadLock;		// Estimator and timestamps
+
+	PendingTimestamp	m_Timestamps[TIMESTAMP_QUEUE_SIZE];
+	int			m_TimestampHead;
+	int			m_TimestampCount;
+	long long	m_BytesPushed;
+	long long	m_BytesFetched;
+	long long	m_SequenceEnd;		// m_BytesPushed after the last data an SPS started in
+
+	long long	m_FrameDuration;
+	long long	m_LastTimestamp;
+	long long	m_LastFrameNumber;	// The backend's, of the last frame delivered
+	long long	m_FirstFrameNumber;	// The backend's, of the first frame after a flush
+
+	DecoderStats		m_Stats;
+	StreamAnalyzer		m_Analyzer;		// Input thread
+	PlatformLock		m_AnalyzerLock;
+
+	FrameSink*			m_Sink;
+	DecoderBackend*		m_Backend;
+};
+
+#endif
@@ -0,0 +1,753 @@
+//------------------------------------------------------------------------------
+// File: DecodeTool.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Command line decoder for regression tests and batch analysis.
+// An Annex B file is mapped and decoded in place as fast as the backend
+// goes, the frames are discarded, written as I420, NV12 or Y4M, or
+// published in a shared-memory ring for other processes. Reports the
+// frame rate, the time of each stage and the peak memory. Further outputs
+// of other sizes are fed from the same decode through a FrameTee. In
+// thumbnail mode only the IDR pictures are decoded, at a small size. With
+// -u the input is an RTP stream received on a local UDP port instead. An
+// MPEG-2 transport stream is demuxed into the session's cache as it goes.
+//
+//------------------------------------------------------------------------------
+
+#include "DecodeSession.h"
+#include "DecoderConfig.h"
+#include "MappedFile.h"
+#include "YuvFileSink.h"
+#include "SharedFrameRing.h"
+#include "MockDecoderBackend.h"
+#include "ParallelDecoder.h"
+#include "FrameCache.h"
+#include "FrameTee.h"
+#include "ThumbnailExtractor.h"
+#include "RtpReceiver.h"
+#include "TsDemuxer.h"
+#include "PerfTimer.h"
+#include "Platform.h"
+#include "Trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OUTPUT_NULL		-1	// Frames are counted and discarded
+#define OUTPUT_RING		-2	// FrameRingWriter, the output name is the ring's
+
+#define RING_SLOTS		8
+#define EXTRA_OUTPUTS	(FRAME_TEE_MAX_OUTPUTS - 1)
+#define RTP_IDLE_TIMEOUT	2000	// ms without packets that end the RTP input
+
+// Counts the frames and the time spent handing them to the file sink,
+// if there is one
+class ToolSink : public FrameSink
+{
+public:
+
+	ToolSink(FrameSink* inOutput) :	m_Output(inOutput),
+									m_Frames(0),
+									m_Failed(0),
+									m_OutputUs(0),
+									m_LastTimestamp(DECODE_NO_TIMESTAMP)
+	{
+	}
+
+	bool OnFrame( const DecodedFrame& inFrame )
+	{
+		m_LastTimestamp = inFrame.Timestamp;
+		if (m_Output == NULL)
+		{
+			m_Frames++;
+			return true;
+		}
+
+		long long start = PerfTimeUs();
+		bool written = m_Output->OnFrame(inFrame);
+		m_OutputUs += PerfTimeUs() - start;
+
+		if (written)
+			m_Frames++;
+		else
+			m_Failed++;
+		return written;
+	}
+
+	void OnEndOfStream( void )
+	{
+		if (m_Output)
+		{
+			long long start = PerfTimeUs();
+			m_Output->OnEndOfStream();
+			m_OutputUs += PerfTimeUs() - start;
+		}
+	}
+
+	FrameSink*	m_Output;
+	long long	m_Frames;
+	long long	m_Failed;
+	long long	m_OutputUs;
+	long long	m_LastTimestamp;
+};
+
+static void PrintUsage( void )
+{
+	printf("Usage: DecodeTool [options] <input.264|input.ts>\n"
+		   "       DecodeTool [options] -u <port>\n"
+		   "  -o <file>        Output file, Y4M if it ends in .y4m, raw I420 otherwise\n"
+		   "  -f null|yuv|nv12|y4m|ring  Output format, overrides the file name (default null)\n"
+		   "  -p overwrite|wait  Ring output: drop frames for slow readers, or wait for them\n"
+		   "  -k <slots>       Ring output: frames in the ring (default %d)\n"
+		   "  -b cuda|mock|software  Decoder backend (default from the settings)\n"
+		   "  -c <file>        Config file, as the filter's %s\n"
+		   "  -s <WxH>         Output frame size (default the display size, %d wide for thumbnails)\n"
+		   "  -i <seconds>     Thumbnails: decode IDR pictures only, one every so many seconds (0 for all)\n"
+		   "  -n <frames>      Stop after this many frames (not with -j)\n"
+		   "  -e <n>           Deliver every nth frame only, the others are decoded but not converted\n"
+		   "  -t <fps>         Deliver this many frames a second only, overrides -e\n"
+		   "  -r <bytes>       Data handed to the decoder at once (default DecoderBufferSize)\n"
+		   "  -d <us>[:<us>]   Time the mock backend spends on each picture, and on creating its decoder\n"
+		   "  -j <sessions>    Decode segments between IDR pictures on this many sessions at once\n"
+		   "  -m <MB>          Keep the last frames in a cache of this size, then step back through them\n"
+		   "  -z 0|1           Compress the cached frames (default 0)\n"
+		   "  -a <WxH>:<file>  Also write the frames scaled to this size, as for -o (up to %d times)\n"
+		   "  -u <port>        Receive RTP on this UDP port, until it is silent for %d ms\n"
+		   "  -w <ms>          RTP: time a packet waits for the ones missing before it (default %d)\n"
+		   "  -g <program>     Transport stream: program number (default the first)\n"
+		   "  -x <file>        Write the trace events as Chrome trace-event JSON (USE_TRACING=1 builds)\n",
+		   RING_SLOTS, DECODER_CONFIG_FILE, THUMBNAIL_WIDTH, EXTRA_OUTPUTS, RTP_IDLE_TIMEOUT, RTP_JITTER_DELAY);
+}
+
+static bool EndsWith( const char* inText, const char* inSuffix )
+{
+	size_t length = strlen(inText);
+	size_t suffix = strlen(inSuffix);
+	return length >= suffix && strcmp(inText + length - suffix, inSuffix) == 0;
+}
+
+// Of the frames the session delivers: thumbnails (inThumbnailInterval not
+// negative), the target rate or every stride-th frame of the stream
+static void SetDeliveredFrameRate( YuvFileSink* ioSink, const DecoderSettings& inSettings,
+								   const SequenceInfo* inSps, double inThumbnailInterval )
+{
+	if (inThumbnailInterval >= 0)
+		ioSink->SetFrameRate(1000, inThumbnailInterval > 0 ? (unsigned int)(inThumbnailInterval * 1000) : 1000);
+	else if (inSettings.OutputFrameRate > 0)
+		ioSink->SetFrameRate(inSettings.OutputFrameRate, 1);
+	else if (inSps && inSps->NumUnitsInTick > 0 && inSps->TimeScale > 0)
+		ioSink->SetFrameRate(inSps->TimeScale, inSps->NumUnitsInTick * 2 * (inSettings.OutputStride > 1 ? inSettings.OutputStride : 1));
+}
+
+static double Seconds( long long inUs )
+{
+	return inUs / 1000000.0;
+}
+
+int main( int argc, char* argv[] )
+{
+	const char*	inputPath = NULL;
+	const char*	outputPath = NULL;
+	const char*	configPath = NULL;
+	int			format = OUTPUT_NULL;
+	bool		formatSet = false;
+	long		backend = -1;
+	int			width = 0;
+	int			height = 0;
+	long long	maxFrames = 0;
+	long		readSize = 0;
+	long		outputStride = -1;
+	long		outputRate = -1;
+	int			mockDecodeUs = 0;
+	int			mockCreateUs = 0;
+	int			ringPolicy = FRAME_RING_OVERWRITE;
+	long		ringSlots = RING_SLOTS;
+	int			sessions = 1;
+	double		thumbnailInterval = -1;
+	long long	cacheBytes = 0;
+	bool		cacheCompress = false;
+	const char*	extraPaths[EXTRA_OUTPUTS];
+	int			extraWidths[EXTRA_OUTPUTS];
+	int			extraHeights[EXTRA_OUTPUTS];
+	int			extraCount = 0;
+	int			rtpPort = 0;
+	int			jitterDelayMs = RTP_JITTER_DELAY;
+	int			program = 0;
+	const char*	tracePath = NULL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+		if (arg[0] != '-' || arg[1] == '\0')
+		{
+			inputPath = arg;
+			continue;
+		}
+		if (value == NULL || arg[2] != '\0')
+		{
+			PrintUsage();
+			return 1;
+		}
+		i++;
+
+		switch (arg[1])
+		{
+		case 'o':
+			outputPath = value;
+			break;
+		case 'f':
+			formatSet = true;
+			if (strcmp(value, "null") == 0)
+				format = OUTPUT_NULL;
+			else if (strcmp(value, "yuv") == 0)
+				format = YUV_FORMAT_I420;
+			else if (strcmp(value, "nv12") == 0)
+				format = YUV_FORMAT_NV12;
+			else if (strcmp(value, "y4m") == 0)
+				format = YUV_FORMAT_Y4M;
+			else if (strcmp(value, "ring") == 0)
+				format = OUTPUT_RING;
+			else
+			{
+				printf("Unknown output format %s\n", value);
+				return 1;
+			}
+			break;
+		case 'b':
+			if (strcmp(value, "cuda") == 0)
+				backend = DECODER_BACKEND_CUDA;
+			else if (strcmp(value, "mock") == 0)
+				backend = DECODER_BACKEND_MOCK;
+			else if (strcmp(value, "software") == 0)
+				backend = DECODER_BACKEND_SOFTWARE;
+			else
+			{
+				printf("Unknown backend %s\n", value);
+				return 1;
+			}
+			break;
+		case 'c':
+			configPath = value;
+			break;
+		case 'p':
+			if (strcmp(value, "overwrite") == 0)
+				ringPolicy = FRAME_RING_OVERWRITE;
+			else if (strcmp(value, "wait") == 0)
+				ringPolicy = FRAME_RING_BACKPRESSURE;
+			else
+			{
+				printf("Unknown ring policy %s\n", value);
+				return 1;
+			}
+			break;
+		case 'k':
+			ringSlots = atol(value);
+			break;
+		case 's':
+			if (sscanf(value, "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0)
+			{
+				printf("Invalid output size %s\n", value);
+				return 1;
+			}
+			break;
+		case 'n':
+			maxFrames = atol(value);
+			break;
+		case 'e':
+			outputStride = atol(value);
+			break;
+		case 't':
+			outputRate = atol(value);
+			break;
+		case 'r':
+			readSize = atol(value);
+			break;
+		case 'd':
+			mockDecodeUs = atoi(value);
+			if (strchr(value, ':') != NULL)
+				mockCreateUs = atoi(strchr(value, ':') + 1);
+			break;
+		case 'j':
+			sessions = atoi(value);
+			if (sessions < 1 || sessions > PARALLEL_MAX_SESSIONS)
+			{
+				printf("Sessions must be 1 to %d\n", PARALLEL_MAX_SESSIONS);
+				return 1;
+			}
+			break;
+		case 'i':
+			thumbnailInterval = atof(value);
+			if (thumbnailInterval < 0)
+			{
+				printf("Invalid thumbnail interval %s\n", value);
+				return 1;
+			}
+			break;
+		case 'm':
+			cacheBytes = atol(value) * 1048576LL;
+			break;
+		case 'z':
+			cacheCompress = atoi(value) != 0;
+			break;
+		case 'a':
+		{
+			int used = 0;
+			if (extraCount == EXTRA_OUTPUTS)
+			{
+				printf("At most %d further outputs\n", EXTRA_OUTPUTS);
+				return 1;
+			}
+			if (sscanf(value, "%dx%d:%n", &extraWidths[extraCount], &extraHeights[extraCount], &used) != 2 ||
+				used == 0 || value[used] == '\0' || extraWidths[extraCount] <= 0 || extraHeights[extraCount] <= 0)
+			{
+				printf("Invalid output %s\n", value);
+				return 1;
+			}
+			extraPaths[extraCount++] = value + used;
+			break;
+		}
+		case 'u':
+			rtpPort = atoi(value);
+			if (rtpPort <= 0 || rtpPort > 65535)
+			{
+				printf("Invalid port %s\n", value);
+				return 1;
+			}
+			break;
+		case 'w':
+			jitterDelayMs = atoi(value);
+			break;
+		case 'g':
+			program = atoi(value);
+			break;
+		case 'x':
+			tracePath = value;
+			break;
+		default:
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	bool rtp = rtpPort > 0;
+	if (inputPath == NULL && !rtp)
+	{
+		PrintUsage();
+		return 1;
+	}
+	if (rtp && (sessions > 1 || thumbnailInterval >= 0))
+	{
+		printf("RTP input is decoded on a single session\n");
+		return 1;
+	}
+	if (cacheBytes > 0 && sessions > 1)
+	{
+		printf("The frame cache needs a single session\n");
+		return 1;
+	}
+	if (tracePath && !USE_TRACING)
+	{
+		printf("Tracing is not built in, build with USE_TRACING=1\n");
+		return 1;
+	}
+	bool thumbnails = thumbnailInterval >= 0;
+	if (thumbnails && (sessions > 1 || cacheBytes > 0))
+	{
+		printf("Thumbnails are made on a single session without a cache\n");
+		return 1;
+	}
+
+	if (outputPath && !formatSet)
+	{
+		format = EndsWith(outputPath, ".y4m") ? YUV_FORMAT_Y4M : YUV_FORMAT_I420;
+	}
+	if (format != OUTPUT_NULL && outputPath == NULL)
+	{
+		printf("The output format needs an output name\n");
+		return 1;
+	}
+
+	// Same lookup as the filter, then the command line
+	DecoderConfig config;
+	DecoderSettings settings;
+	if (configPath)
+	{
+		if (!config.LoadFromFile(configPath))
+		{
+			printf("Cannot read %s\n", configPath);
+			return 1;
+		}
+	}
+	else
+	{
+		configPath = getenv(DECODER_CONFIG_ENV);
+		config.LoadFromFile(configPath ? configPath : DECODER_CONFIG_FILE);
+	}
+	config.LoadFromEnvironment();
+	settings = config.Settings();
+	if (backend >= 0)
+		settings.Backend = backend;
+	if (readSize > 0)
+		settings.DecoderBufferSize = readSize;
+	if (outputStride >= 0)
+		settings.OutputStride = outputStride;
+	if (outputRate >= 0)
+		settings.OutputFrameRate = outputRate;
+	if (!config.Apply(settings))
+	{
+		printf("Invalid settings\n");
+		return 1;
+	}
+	settings = config.Settings();
+	config.Report(stdout);
+
+	long long startTime = PerfTimeUs();
+
+	MappedFile input;
+	char rtpName[32];
+	if (rtp)
+	{
+		sprintf(rtpName, "udp:%d", rtpPort);
+		inputPath = rtpName;
+	}
+	else if (!input.Open(inputPath))
+	{
+		return 1;
+	}
+	bool transport = !rtp && TsDemuxer::IsTransportStream(input.Data(),
+		input.Size() < settings.SmartCacheSize ? (long)input.Size() : settings.SmartCacheSize);
+	if (transport && (sessions > 1 || thumbnails))
+	{
+		printf("A transport stream is decoded on a single session\n");
+		return 1;
+	}
+
+	// Frame rate and aspect ratio of the output from the first SPS; RTP
+	// carries the timestamps instead
+	SequenceInfo sps;
+	bool hasSps = !rtp && FindSequenceParameterSet(input.Data(),
+		input.Size() < settings.SmartCacheSize ? (long)input.Size() : settings.SmartCacheSize, &sps);
+
+	// Thumbnails keep the display aspect ratio in square samples
+	if (thumbnails && hasSps)
+		ThumbnailExtractor::GetThumbnailSize(sps, width, height, &width, &height);
+
+	YuvFileSink fileSink;
+	FrameRingWriter ringSink;
+	FrameSink* output = NULL;
+
+	if (format == OUTPUT_RING)
+	{
+		// Slots for the output size, or the largest sequence the decoder is set up for
+		int slotWidth = width ? width : (hasSps ? sps.DisplayWidth : 0);
+		int slotHeight = height ? height : (hasSps ? sps.DisplayHeight : 0);
+		if (!width && settings.MaxWidth > slotWidth && settings.MaxHeight > slotHeight)
+		{
+			slotWidth = settings.MaxWidth;
+			slotHeight = settings.MaxHeight;
+		}
+		if (slotWidth == 0 || !ringSink.Create(outputPath, ringSlots, (long)slotWidth * slotHeight * 3 / 2, ringPolicy))
+		{
+			printf("Cannot set up the frame ring %s\n", outputPath);
+			return 1;
+		}
+		output = &ringSink;
+	}
+	else if (format != OUTPUT_NULL)
+	{
+		if (!fileSink.Open(outputPath, format))
+		{
+			return 1;
+		}
+		SetDeliveredFrameRate(&fileSink, settings, hasSps ? &sps : NULL, thumbnailInterval);
+		if (hasSps && !thumbnails)
+			fileSink.SetAspectRatio(sps.SarWidth, sps.SarHeight);
+		output = &fileSink;
+	}
+
+	// Further outputs share the decoded frames, each size scaled once
+	FrameTee tee;
+	YuvFileSink extraSinks[EXTRA_OUTPUTS];
+	if (extraCount > 0)
+	{
+		if (output)
+			tee.AddOutput(output);
+		for (int i = 0; i < extraCount; i++)
+		{
+			if (!extraSinks[i].Open(extraPaths[i], EndsWith(extraPaths[i], ".y4m") ? YUV_FORMAT_Y4M : YUV_FORMAT_I420))
+			{
+				return 1;
+			}
+			SetDeliveredFrameRate(&extraSinks[i], settings, hasSps ? &sps : NULL, thumbnailInterval);
+			tee.AddOutput(&extraSinks[i], extraWidths[i], extraHeights[i]);
+		}
+		output = &tee;
+	}
+	ToolSink sink(output);
+
+	// The cache keeps the frames on their way to the output
+	FrameCache cache;
+	FrameSink* sessionSink = &sink;
+	if (cacheBytes > 0)
+	{
+		cache.Open(cacheBytes, cacheCompress, &sink);
+		sessionSink = &cache;
+	}
+
+	long long frameDuration = 0;
+	if (hasSps && GetFrameRate(sps) > 0)
+		frameDuration = (long long)(10000000 / GetFrameRate(sps));
+
+	DecodeSession session;
+	ParallelDecoder parallel;
+	ThumbnailExtractor extractor;
+	DecoderBackend* decoders[PARALLEL_MAX_SESSIONS];
+	for (int i = 0; i < sessions; i++)
+	{
+		decoders[i] = NULL;
+		if (settings.Backend == DECODER_BACKEND_MOCK)
+			decoders[i] = new MockDecoderBackend(mockDecodeUs, mockCreateUs);
+	}
+
+	if (thumbnails)
+	{
+		extractor.SetThumbnailSize(width, height);
+		extractor.SetInterval(thumbnailInterval);
+		extractor.SetFrameDuration(frameDuration);
+		if (!extractor.Open(settings, &sink, decoders[0]))
+		{
+			return 1;
+		}
+	}
+	else if (sessions > 1)
+	{
+		parallel.SetOutputFrameSize(width, height);
+		parallel.SetFrameDuration(frameDuration);
+		if (!parallel.Open(settings, &sink, sessions, decoders))
+		{
+			return 1;
+		}
+	}
+	else
+	{
+		session.SetOutputFrameSize(width, height);
+		if (!session.Open(settings, sessionSink, decoders[0]))
+		{
+			return 1;
+		}
+		if (frameDuration > 0)
+			session.SetFrameDuration(frameDuration);
+	}
+
+	// PES payloads go into the cache and are decoded from there at once
+	TsDemuxer demuxer;
+	if (transport && !demuxer.Open(&session, program, true))
+	{
+		return 1;
+	}
+
+	RtpReceiver receiver;
+	if (rtp)
+	{
+		if (!receiver.Open(&session, (unsigned short)rtpPort, jitterDelayMs, RTP_IDLE_TIMEOUT))
+		{
+			return 1;
+		}
+		printf("Receiving RTP on port %d\n", rtpPort);
+	}
+
+	long long openTime = PerfTimeUs();
+
+	// The mapping goes to the parser directly, in reads of the configured size
+	const unsigned char* data = input.Data();
+	long long remaining = input.Size();
+	long long feedUs = 0;
+	bool stopped = false;
+
+	if (thumbnails)
+	{
+		static const char* reasons[] = { "", ", not open", ", out of memory for the index",
+										 ", no IDR picture in the stream", ", no IDR picture decoded" };
+		if (extractor.Extract(data, remaining))
+			remaining = 0;
+		else
+			printf("No thumbnail made%s\n", reasons[extractor.GetError()]);
+		stopped = true;
+	}
+	else if (sessions > 1)
+	{
+		if (parallel.Decode(data, remaining))
+			remaining = 0;
+		else
+			printf("Decoding failed\n");
+		stopped = true;
+	}
+	else if (rtp)
+	{
+		// The receiving thread writes the access units into the cache
+		long long start = PerfTimeUs();
+		while (receiver.DecodeAccessUnit())
+		{
+			if (maxFrames > 0 && sink.m_Frames >= maxFrames)
+			{
+				stopped = true;
+				break;
+			}
+		}
+		receiver.Close(stopped);
+		feedUs += PerfTimeUs() - start;
+	}
+
+	while (remaining > 0 && !stopped)
+	{
+		long length = remaining < settings.DecoderBufferSize ? (long)remaining : settings.DecoderBufferSize;
+
+		long long start = PerfTimeUs();
+		if (transport)
+		{
+			demuxer.Push(data, length);
+		}
+		else if (!session.DecodeBuffer(data, length))
+		{
+			printf("Decoding failed at byte %lld\n", input.Size() - remaining);
+			break;
+		}
+		feedUs += PerfTimeUs() - start;
+
+		data += length;
+		remaining -= length;
+
+		if (maxFrames > 0 && sink.m_Frames >= maxFrames)
+		{
+			stopped = true;
+			break;
+		}
+	}
+
+	long long drainStart = PerfTimeUs();
+	if (!stopped)
+	{
+		if (transport)
+			demuxer.Finish();
+		session.Drain();
+	}
+	long long endTime = PerfTimeUs();
+	feedUs += endTime - drainStart;
+	if (sessions > 1 || thumbnails)
+		feedUs = endTime - openTime;
+
+	long long decodeUs = endTime - openTime;
+	double fps = decodeUs > 0 ? sink.m_Frames / Seconds(decodeUs) : 0.0;
+
+	RtpReceiverStatistics rtpStats;
+	if (rtp)
+		receiver.GetStatistics(&rtpStats);
+
+	printf("\n%s: %lld bytes, %lld frames", inputPath, rtp ? rtpStats.Rtp.Bytes : input.Size() - remaining, sink.m_Frames);
+	if (sink.m_Failed > 0)
+		printf(" (%lld not written)", sink.m_Failed);
+	printf(" in %.3f s, %.1f fps\n", Seconds(decodeUs), fps);
+
+	printf("  setup    %8.3f s  (mapping, settings, decoder)\n", Seconds(openTime - startTime));
+	printf("  decode   %8.3f s  (parse, decode, copy back and convert)\n", Seconds(feedUs - sink.m_OutputUs));
+	printf("  output   %8.3f s  (copy into the %s)\n\n", Seconds(sink.m_OutputUs),
+		   format == OUTPUT_RING ? "ring" : "write queue");
+
+	if (thumbnails)
+	{
+		ThumbnailStatistics stats;
+		extractor.GetStatistics(&stats);
+		extractor.ReportDecoderStatistics(stdout);
+		ThumbnailExtractor::Report(stats, stdout);
+		extractor.Close();
+	}
+	else if (sessions > 1)
+	{
+		ParallelDecodeStatistics stats;
+		parallel.GetStatistics(&stats);
+		printf("%d sessions, %ld segments, indexed in %.3f s; sessions busy %.0f%%, longest segment %.3f s\n",
+			   stats.Sessions, stats.Segments, Seconds(stats.IndexUs),
+			   stats.DecodeUs > 0 ? 100.0 * stats.BusyUs / stats.DecodeUs / stats.Sessions : 0.0,
+			   Seconds(stats.LongestSegmentUs));
+		printf("%lld frames reordered, at most %.1f MB held\n",
+			   stats.FramesReordered, stats.PeakBufferedBytes / 1048576.0);
+		parallel.Close();
+	}
+	else
+	{
+		if (rtp)
+			RtpReceiver::Report(rtpStats, stdout);
+		if (transport)
+		{
+			TsStatistics stats;
+			demuxer.GetStatistics(&stats);
+			TsDemuxer::Report(stats, stdout);
+			demuxer.Close();
+		}
+		// The I/O thread is done once the file is closed
+		session.ReportStatistics(stdout);
+		session.Close();
+	}
+
+	if (cacheBytes > 0)
+	{
+		// Step back from the last frame as a review tool would, as long as
+		// the frames come from the cache
+		ToolSink steps(NULL);
+		long long timestamp = sink.m_LastTimestamp;
+		long long stepStart = PerfTimeUs();
+		while (cache.ServePrevious(timestamp, &steps, &timestamp))
+		{
+		}
+		long long stepUs = PerfTimeUs() - stepStart;
+
+		FrameCacheStatistics stats;
+		cache.GetStatistics(&stats);
+		printf("Stepped back %lld frames from the cache, %.1f us per frame\n",
+			   steps.m_Frames, steps.m_Frames ? (double)stepUs / steps.m_Frames : 0.0);
+		FrameCache::Report(stats, stdout);
+	}
+	fileSink.Close();
+	for (int i = 0; i < extraCount; i++)
+		extraSinks[i].Close();
+
+	ringSink.Close();
+
+	if (extraCount > 0)
+	{
+		FrameTeeStatistics stats;
+		tee.GetStatistics(&stats);
+		FrameTee::Report(stats, stdout);
+	}
+
+	if (format == OUTPUT_RING)
+	{
+		FrameRingWriterStatistics ring;
+		ringSink.GetStatistics(&ring);
+		printf("Published %lld frames, %lld too large, %lld slots held; %ld stalls on readers for %.3f s, %ld readers dropped\n",
+			   ring.FramesPublished, ring.FramesDropped, ring.SlotsSkipped, ring.Stalls, Seconds(ring.StallUs),
+			   ring.ReadersDropped);
+	}
+	else if (format != OUTPUT_NULL)
+	{
+		YuvWriteStatistics writes;
+		fileSink.GetStatistics(&writes);
+		printf("Written %.1f MB in %ld writes, %.3f s, %.1f MB/s%s; decoding blocked %.3f s on a full queue\n",
+			   writes.BytesWritten / 1048576.0, writes.Writes, Seconds(writes.WriteUs), writes.WriteMBps,
+			   writes.Unbuffered ? " unbuffered" : "", Seconds(writes.BlockedUs));
+	}
+	printf("Peak memory %.1f MB\n", PlatformPeakMemory() / 1048576.0);
+
+	if (tracePath && !TraceDumpChromeJson(tracePath))
+	{
+		printf("Cannot write the trace to %s\n", tracePath);
+		return 1;
+	}
+
+	return sink.m_Frames > 0 ? 0 : 2;
+}
@@ -12,9 +12,8 @@
 #include "DecodedStream.h"
 #include "CudaDecodeInputPin.h"
 #include "CudaDecodeFilter.h"
-#include "SmartCache.h"
-#include "CudaDecoder.h"
-#include "MediaController.h"
+#include "DecodeSession.h"
+#include "Trace.h"
 
 DecodedStream::DecodedStream(TCHAR * inObjectName,
 							 HRESULT * outResult, 
@@ -25,7 +24,7 @@ DecodedStream::DecodedStream(TCHAR * inObjectName,
 	m_Position     = NULL;
 	m_Flushing     = FALSE;
 	m_EOS_Flag	  = FALSE;
-	m_MpegController = NULL;
+	m_Session = NULL;
 	m_SamplesSent    = 0;
 }
 
@@ -38,9 +37,9 @@ DecodedStream::~DecodedStream()
 	}
 }
 
-void DecodedStream::SetController(MediaController* inController)
+void DecodedStream::SetSession(DecodeSession* inSession)
 {
-	m_MpegController = inController;
+	m_Session = inSession;
 }
 
 HRESULT DecodedStream::FillBuffer(IMediaSample *pSample)
@@ -141,7 +140,7 @@ HRESULT DecodedStream::GetMediaType(int iPosition, CMediaType *pMediaType)
 	pMediaType->SetFormatType(&FORMAT_VideoInfo);
 	format.bmiHeader.biSize   = sizeof(BITMAPINFOHEADER);
 	format.bmiHeader.biPlanes = 1;
-	format.AvgTimePerFrame    = m_DecodeFilter->m_SampleDuration;
+	format.AvgTimePerFrame    = m_DecodeFilter->OutputDuration();
 	format.bmiHeader.biWidth  = m_DecodeFilter->m_ImageWidth;
 	format.bmiHeader.biHeight = m_DecodeFilter->m_ImageHeight;
 	format.bmiHeader.biSizeImage = m_DecodeFilter->m_ImageWidth * m_DecodeFilter->m_ImageHeight * format.bmiHeader.biBitCount / 8;
@@ -194,7 +193,7 @@ STDMETHODIMP DecodedStream::Notify(IBaseFilter * pSender, Quality q)
 STDMETHODIMP DecodedStream::BeginFlush(void)
 {
 	m_Flushing = TRUE;
-	m_MpegController->BeginFlush();
+	m_Session->BeginFlush();
 	{
 		CAutoLock   lck(&m_DataAccess);
 		m_SamplesSent   = 0;
@@ -204,7 +203,7 @@ STDMETHODIMP DecodedStream::BeginFlush(void)
 
 STDMETHODIMP DecodedStream::EndFlush(void)
 {
-	m_MpegController->EndFlush();
+	m_Session->EndFlush();
 	m_Flushing = FALSE;
 	return NOERROR;
 }
@@ -225,14 +224,16 @@ HRESULT DecodedStream::DoBufferProcessingLoop(void)
 		while (!CheckRequest(&com)) 
 		{
 			// If no data, never enter blocking reading
-			if (m_Flushing || m_MpegController->IsCacheEmpty() || m_EOS_Flag) 
+			if (m_Flushing || m_Session->IsCacheEmpty() || m_EOS_Flag) 
 			{
 				if (m_DecodeFilter->m_EOSReceived)
 				{
 					m_EOS_Flag = TRUE;
-					m_MpegController->EndEndOfStream();
+					m_Session->EndEndOfStream();
 					if (!m_DecodeFilter->m_EOSDelivered)
 					{
+						// Frames still in the decoder go out ahead of the EOS
+						m_Session->Drain();
 						m_DecodeFilter->m_EOSDelivered = TRUE;
 						DeliverEndOfStream();	
 					}
@@ -242,9 +243,7 @@ HRESULT DecodedStream::DoBufferProcessingLoop(void)
 				continue;
 			}
 
-			m_MpegController->m_SmartCache->ResetCacheChecking();
-
-			BOOL pass = m_MpegController->DecodeOnePicture();
+			m_Session->DecodeOnePicture();
 		}
 
 		// For all commands sent to us there must be a Reply call!
@@ -280,12 +279,47 @@ HRESULT DecodedStream::OnThreadDestroy(void)
 	return NOERROR;
 }
 
-HRESULT DecodedStream::DeliverCurrentPicture(IMediaSample * pSample)
+bool DecodedStream::OnFrame(const DecodedFrame& inFrame)
+{
+	IMediaSample *pSample;
+	HRESULT hr;
+	{
+		TRACE_SCOPE("GetDeliveryBuffer");
+		hr = GetDeliveryBuffer(&pSample, NULL, NULL, 0);
+	}
+	if (FAILED(hr)) 
+	{
+		Sleep(1);
+		return false;
+	}
+	{
+		TRACE_SCOPE("DeliverFrame");
+		hr = DeliverFrame(pSample, inFrame);
+	}
+	if (FAILED(hr) && m_DecodeFilter->m_EOSReceived)
+	{
+		m_EOS_Flag = TRUE; // testing!
+		m_Session->EndEndOfStream();
+		if (!m_DecodeFilter->m_EOSDelivered)
+		{
+			m_DecodeFilter->m_EOSDelivered = TRUE;
+			DeliverEndOfStream();	
+		}
+	}
+	return SUCCEEDED(hr);
+}
+
+HRESULT DecodedStream::DeliverFrame(IMediaSample * pSample, const DecodedFrame& inFrame)
 {
 	PBYTE   pOut;
 
 	pSample->GetPointer(&pOut);
-	m_MpegController->GetDecoded(pOut);
+	long size = m_DecodeFilter->m_OutputImageSize;
+	if (size > inFrame.Size)
+	{
+		size = inFrame.Size;
+	}
+	memcpy(pOut, inFrame.Data, size);
 	pSample->SetActualDataLength(m_DecodeFilter->m_OutputImageSize);
 	ULONG    alreadySent = 0;
 	{
@@ -296,8 +330,9 @@ HRESULT DecodedStream::DeliverCurrentPicture(IMediaSample * pSample)
 	LONGLONG   llStart = alreadySent;
 	LONGLONG   llEnd   = alreadySent + 1;
 	pSample->SetMediaTime(&llStart, &llEnd);
-	REFERENCE_TIME	rtStart = alreadySent * m_DecodeFilter->m_SampleDuration;
-	REFERENCE_TIME	rtEnd   = (alreadySent + 1) * m_DecodeFilter->m_SampleDuration;
+	// Upstream times when it sets them, the session counts from 0 otherwise
+	REFERENCE_TIME	rtStart = inFrame.Timestamp;
+	REFERENCE_TIME	rtEnd   = inFrame.Timestamp + m_DecodeFilter->OutputDuration();
 	pSample->SetTime(&rtStart, &rtEnd);
 	pSample->SetDiscontinuity(FALSE);
 	pSample->SetPreroll(FALSE);
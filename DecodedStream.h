@@ -13,14 +13,14 @@
 #define DECODED_STREAM_H_
 
 #include "StdHeader.h"
+#include "FrameSink.h"
 
 class CudaDecodeFilter;
-class MediaController;
+class DecodeSession;
 
-class DecodedStream : public CSourceStream
+class DecodedStream : public CSourceStream, public FrameSink
 {
 	friend class CudaDecodeFilter;
-	friend class CudaH264Decoder;
 
 public:
 	DecodedStream(TCHAR * inObjectName, 
@@ -29,7 +29,7 @@ public:
 
 	virtual ~DecodedStream();
 
-	void			SetController(MediaController * inController);
+	void			SetSession(DecodeSession * inSession);
 
 	// override to expose IMediaPosition
 	STDMETHODIMP	NonDelegatingQueryInterface(REFIID riid, void **ppv);
@@ -58,7 +58,10 @@ protected:
 	virtual HRESULT OnThreadStartPlay(void);
 	virtual HRESULT OnThreadDestroy(void);
 
-	HRESULT			DeliverCurrentPicture(IMediaSample * pSample);
+	// FrameSink, called on the streaming thread from DecodeOnePicture
+	bool			OnFrame(const DecodedFrame& inFrame);
+
+	HRESULT			DeliverFrame(IMediaSample * pSample, const DecodedFrame& inFrame);
 
 	// Media type
 public:
@@ -66,7 +69,7 @@ public:
 
 private:
 	CudaDecodeFilter*		m_DecodeFilter;
-	MediaController*		m_MpegController;
+	DecodeSession*			m_Session;
 
 	// implement IMediaPosition by passing upstream
 	IUnknown*				m_Position;
@@ -0,0 +1,103 @@
+//------------------------------------------------------------------------------
+// File: DecoderBackend.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Interface of the decoders behind a DecodeSession. A backend
+// takes Annex B data and hands the decoded frames to a FrameSink
+// from within Decode.
+//
+//------------------------------------------------------------------------------
+
+#include "DecoderBackend.h"
+#include "MockDecoderBackend.h"
+#include "SoftwareDecoderBackend.h"
+#if USE_CUDA_BACKEND
+#include "CudaDecoder.h"
+#endif
+#include <stddef.h>
+#include <string.h>
+
+DecoderBackend* CreateDecoderBackend( int inType )
+{
+	switch (inType)
+	{
+#if USE_CUDA_BACKEND
+	case DECODER_BACKEND_CUDA:
+		return new CudaH264Decoder();
+#endif
+	case DECODER_BACKEND_MOCK:
+		return new MockDecoderBackend();
+	case DECODER_BACKEND_SOFTWARE:
+		return new SoftwareDecoderBackend();
+	default:
+		return NULL;
+	}
+}
+
+TimestampQueue::TimestampQueue() : m_Count(0)
+{
+}
+
+void TimestampQueue::Clear( void )
+{
+	m_Count = 0;
+}
+
+void TimestampQueue::Push( long inOffset, long long inTimestamp )
+{
+	if (inTimestamp == DECODE_NO_TIMESTAMP)
+		return;
+	// The previous one has no data left
+	if (m_Count > 0 && m_Offsets[m_Count - 1] == inOffset)
+		m_Count--;
+	if (m_Count == CAPACITY)
+		this->Remove(1);
+	m_Offsets[m_Count] = inOffset;
+	m_Timestamps[m_Count] = inTimestamp;
+	m_Count++;
+}
+
+// Index of the last entry at or before inOffset, -1 for none
+int TimestampQueue::Find( long inOffset ) const
+{
+	int index = m_Count - 1;
+	while (index >= 0 && m_Offsets[index] > inOffset)
+		index--;
+	return index;
+}
+
+long long TimestampQueue::Peek( long inOffset ) const
+{
+	int index = this->Find(inOffset);
+	return index >= 0 ? m_Timestamps[index] : DECODE_NO_TIMESTAMP;
+}
+
+long long TimestampQueue::Take( long inOffset )
+{
+	int index = this->Find(inOffset);
+	if (index < 0)
+		return DECODE_NO_TIMESTAMP;
+	long long timestamp = m_Timestamps[index];
+	this->Remove(index + 1);
+	return timestamp;
+}
+
+void TimestampQueue::Drop( long inCount )
+{
+	// The last entry before the cut still covers the data after it
+	int index = this->Find(inCount);
+	if (index > 0)
+		this->Remove(index);
+	for (int i = 0; i < m_Count; i++)
+		m_Offsets[i] = m_Offsets[i] > inCount ? m_Offsets[i] - inCount : 0;
+}
+
+void TimestampQueue::Remove( int inCount )
+{
+	m_Count -= inCount;
+	memmove(m_Offsets, m_Offsets + inCount, m_Count * sizeof(long));
+	memmove(m_Timestamps, m_Timestamps + inCount, m_Count * sizeof(long long));
+}
@@ -0,0 +1,115 @@
+//------------------------------------------------------------------------------
+// File: DecoderBackend.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Interface of the decoders behind a DecodeSession. A backend
+// takes Annex B data and hands the decoded frames to a FrameSink
+// from within Decode.
+//
+//------------------------------------------------------------------------------
+
+#ifndef DECODER_BACKEND_H_
+#define DECODER_BACKEND_H_
+
+#include "DecoderConfig.h"
+#include "H264Headers.h"
+#include "FrameSink.h"
+
+#define DECODER_BACKEND_CUDA	0	// NVCUVID, see CudaDecoder.h
+#define DECODER_BACKEND_MOCK	1	// Synthetic frames, see MockDecoderBackend.h
+#define DECODER_BACKEND_SOFTWARE	2	// On the CPU, see SoftwareDecoderBackend.h
+
+// Taken when the configured backend cannot start
+#define DECODER_BACKEND_FALLBACK	DECODER_BACKEND_SOFTWARE
+
+// Builds without the CUDA toolkit only have the other backends
+#ifndef USE_CUDA_BACKEND
+#define USE_CUDA_BACKEND		1
+#endif
+
+class DecoderStats;
+
+class DecoderBackend
+{
+public:
+
+	virtual ~DecoderBackend() {}
+
+	virtual bool	Init(const DecoderSettings& settings, FrameSink* sink, DecoderStats* stats) = 0;
+
+	// Annex B data, any split. A zero length ends the stream: the frames
+	// still held by the decoder are delivered.
+	virtual bool	Decode(const unsigned char* inData, long inLength, long long inTimestamp) = 0;
+
+	// Sets up the decoder from an SPS found before the data reaches it
+	virtual bool	PrepareSequence(const SequenceInfo& inSps) = 0;
+
+	virtual bool	HasDecoder(void) = 0;
+
+	// Called before Decode by callers that scan the data themselves: whether
+	// an SPS starts in it. Backends that look for new sequences then skip
+	// the data without one; until the first call they look in all of it.
+	virtual void	SetSequenceHint(bool inSequence) = 0;
+
+	// Frames are scaled to this size whatever the sequence, 0 to follow the
+	// display area. Takes effect with the next sequence.
+	virtual void	SetTargetSize(int inWidth, int inHeight) = 0;
+
+	virtual void	SetDeinterlaceMode(int inMode) = 0;
+
+	// Of the source frames, in 100 ns units, when the SPS does not give it
+	virtual void	SetFrameDuration(long long inDuration) = 0;
+
+	// Frames handed to the sink or dropped since Init
+	virtual int		GetFrameCount(void) const = 0;
+
+	// Decode surfaces, their device memory and the host side frame buffers
+	virtual void	GetSurfaceUsage(long* outSurfaces, long long* outDeviceBytes, long long* outHostBytes) = 0;
+};
+
+// NULL if the type is unknown or not built in
+DecoderBackend*	CreateDecoderBackend(int inType);
+
+// Timestamps of the data a backend holds until its NAL units complete,
+// by the offset in that data where each Decode call started. Like the
+// parser, a timestamp goes to the first picture starting in its data,
+// which runs on through the calls without one.
+class TimestampQueue
+{
+public:
+
+	TimestampQueue();
+
+	void		Clear(void);
+
+	// The data from inOffset on came with inTimestamp. Pushes past the
+	// capacity drop the oldest.
+	void		Push(long inOffset, long long inTimestamp);
+
+	// Of the data a NAL unit starting at inOffset came with,
+	// DECODE_NO_TIMESTAMP when a picture has taken it. Take hands it to a
+	// picture: it and the older ones are gone.
+	long long	Peek(long inOffset) const;
+	long long	Take(long inOffset);
+
+	// The first inCount bytes of the data were dropped
+	void		Drop(long inCount);
+
+private:
+
+	int			Find(long inOffset) const;
+	void		Remove(int inCount);
+
+private:
+
+	enum { CAPACITY = 16 };
+
+	long		m_Offsets[CAPACITY];	// Increasing
+	long long	m_Timestamps[CAPACITY];
+	int			m_Count;
+};
+
+#endif
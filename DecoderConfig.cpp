@@ -0,0 +1,256 @@
+//------------------------------------------------------------------------------
+// File: DecoderConfig.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Runtime settings of the decoder (cache sizes, surface counts,
+// read sizes...). Loaded from a config file and the environment when
+// the filter is created, and settable through ICudaDecoderConfig.
+//
+//------------------------------------------------------------------------------
+
+#include "DecoderConfig.h"
+#include "FrameConverter.h"
+#include "DecoderBackend.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+
+typedef struct
+{
+	const char*	Key;
+	const char*	EnvName;
+	size_t		Offset;
+	long		MinValue;
+	long		MaxValue;
+} SettingInfo;
+
+static const SettingInfo settingInfo[] =
+{
+	{ "SmartCacheSize",		"CUDADEC_SMART_CACHE_SIZE",		offsetof(DecoderSettings, SmartCacheSize),		64*1024,	256*1024*1024 },
+	{ "MinWorkSize",		"CUDADEC_MIN_WORK_SIZE",		offsetof(DecoderSettings, MinWorkSize),			0,			64*1024*1024 },
+	{ "DecoderBufferSize",	"CUDADEC_DECODER_BUFFER_SIZE",	offsetof(DecoderSettings, DecoderBufferSize),	4*1024,		64*1024*1024 },
+	{ "MaxFrameCount",		"CUDADEC_MAX_FRAME_COUNT",		offsetof(DecoderSettings, MaxFrameCount),		2,			MAX_DECODE_SURFACES },
+	{ "DisplayDelay",		"CUDADEC_DISPLAY_DELAY",		offsetof(DecoderSettings, DisplayDelay),		1,			MAX_DISPLAY_DELAY },
+	{ "UseAsyncCopy",		"CUDADEC_USE_ASYNC_COPY",		offsetof(DecoderSettings, UseAsyncCopy),		0,			1 },
+	{ "DeinterlaceMode",	"CUDADEC_DEINTERLACE_MODE",		offsetof(DecoderSettings, DeinterlaceMode),		DEINTERLACE_WEAVE,	DEINTERLACE_ADAPTIVE },
+	{ "AdaptiveReadSize",	"CUDADEC_ADAPTIVE_READ_SIZE",	offsetof(DecoderSettings, AdaptiveReadSize),	0,			1 },
+	{ "ReadLatencyBudget",	"CUDADEC_READ_LATENCY_BUDGET",	offsetof(DecoderSettings, ReadLatencyBudget),	0,			1000 },
+	{ "MaxWidth",			"CUDADEC_MAX_WIDTH",			offsetof(DecoderSettings, MaxWidth),			0,			MAX_PICTURE_SIZE },
+	{ "MaxHeight",			"CUDADEC_MAX_HEIGHT",			offsetof(DecoderSettings, MaxHeight),			0,			MAX_PICTURE_SIZE },
+	{ "Backend",			"CUDADEC_BACKEND",				offsetof(DecoderSettings, Backend),				DECODER_BACKEND_CUDA,	DECODER_BACKEND_SOFTWARE },
+	{ "FrameStatistics",	"CUDADEC_FRAME_STATISTICS",		offsetof(DecoderSettings, FrameStatistics),		0,			1 },
+	{ "OutputStride",		"CUDADEC_OUTPUT_STRIDE",		offsetof(DecoderSettings, OutputStride),		0,			1000 },
+	{ "OutputFrameRate",	"CUDADEC_OUTPUT_FRAME_RATE",	offsetof(DecoderSettings, OutputFrameRate),		0,			1000 },
+	{ "DecodeThreads",		"CUDADEC_DECODE_THREADS",		offsetof(DecoderSettings, DecodeThreads),		0,			MAX_DECODE_THREADS },
+};
+
+static const int settingCount = sizeof(settingInfo) / sizeof(settingInfo[0]);
+
+static long& SettingValue(DecoderSettings& inSettings, const SettingInfo& inInfo)
+{
+	return *(long*)((char*)&inSettings + inInfo.Offset);
+}
+
+static long SettingValue(const DecoderSettings& inSettings, const SettingInfo& inInfo)
+{
+	return *(const long*)((const char*)&inSettings + inInfo.Offset);
+}
+
+// Decimal or 0x hex, with an optional K or M suffix. Values that do not
+// fit a long, as 4096M where long has 32 bits, are rejected.
+static bool ParseValue(const char* inText, long* outValue)
+{
+	char* end = NULL;
+	errno = 0;
+	long value = strtol(inText, &end, 0);
+	if (end == inText || errno == ERANGE)
+		return false;
+
+	long multiplier = 1;
+	if (*end == 'K' || *end == 'k')
+	{
+		multiplier = 1024;
+		end++;
+	}
+	else if (*end == 'M' || *end == 'm')
+	{
+		multiplier = 1024*1024;
+		end++;
+	}
+	if (value > LONG_MAX / multiplier || value < LONG_MIN / multiplier)
+		return false;
+	value *= multiplier;
+
+	while (isspace((unsigned char)*end))
+		end++;
+	if (*end != '\0')
+		return false;
+
+	*outValue = value;
+	return true;
+}
+
+static char* TrimSpaces(char* inText)
+{
+	while (isspace((unsigned char)*inText))
+		inText++;
+	char* end = inText + strlen(inText);
+	while (end > inText && isspace((unsigned char)end[-1]))
+		*--end = '\0';
+	return inText;
+}
+
+DecoderConfig::DecoderConfig()
+{
+	this->SetDefaults();
+}
+
+DecoderConfig::~DecoderConfig()
+{
+
+}
+
+void DecoderConfig::SetDefaults( void )
+{
+	m_Settings.SmartCacheSize		= SMART_CACHE_SIZE;
+	m_Settings.MinWorkSize			= MIN_WORK_SIZE;
+	m_Settings.DecoderBufferSize	= DECODER_BUFFER_SIZE;
+	m_Settings.MaxFrameCount		= MAX_FRM_CNT;
+	m_Settings.DisplayDelay			= DISPLAY_DELAY;
+	m_Settings.UseAsyncCopy			= USE_ASYNC_COPY;
+	m_Settings.DeinterlaceMode		= DEINTERLACE_WEAVE;
+	m_Settings.AdaptiveReadSize		= ADAPTIVE_READ_SIZE;
+	m_Settings.ReadLatencyBudget	= READ_LATENCY_BUDGET;
+	m_Settings.MaxWidth				= MAX_DECODE_WIDTH;
+	m_Settings.MaxHeight			= MAX_DECODE_HEIGHT;
+	m_Settings.Backend				= DECODE_BACKEND;
+	m_Settings.FrameStatistics		= FRAME_STATISTICS;
+	m_Settings.OutputStride			= OUTPUT_STRIDE;
+	m_Settings.OutputFrameRate		= OUTPUT_FRAME_RATE;
+	m_Settings.DecodeThreads		= DECODE_THREADS;
+}
+
+bool DecoderConfig::SetValue( DecoderSettings& ioSettings, const char* inKey, const char* inValue, const char* inSource )
+{
+	for (int i=0; i<settingCount; i++)
+	{
+		const SettingInfo& info = settingInfo[i];
+		if (strcmp(inKey, info.Key) != 0 && strcmp(inKey, info.EnvName) != 0)
+			continue;
+
+		long value;
+		if (!ParseValue(inValue, &value) || value < info.MinValue || value > info.MaxValue)
+		{
+			printf("%s: ignoring %s = %s (expected %ld..%ld)\n", inSource, info.Key, inValue, info.MinValue, info.MaxValue);
+			return false;
+		}
+		SettingValue(ioSettings, info) = value;
+		return true;
+	}
+
+	printf("%s: unknown setting %s\n", inSource, inKey);
+	return false;
+}
+
+bool DecoderConfig::LoadFromFile( const char* inPath )
+{
+	FILE* file = fopen(inPath, "r");
+	if (file == NULL)
+		return false;
+
+	DecoderSettings candidate = m_Settings;
+	char line[256];
+
+	while (fgets(line, sizeof(line), file))
+	{
+		char* comment = strpbrk(line, "#;");
+		if (comment)
+			*comment = '\0';
+
+		char* text = TrimSpaces(line);
+		if (*text == '\0' || *text == '[')  // Sections are allowed but not used
+			continue;
+
+		char* separator = strchr(text, '=');
+		if (separator == NULL)
+		{
+			printf("%s: ignoring line \"%s\"\n", inPath, text);
+			continue;
+		}
+		*separator = '\0';
+		SetValue(candidate, TrimSpaces(text), TrimSpaces(separator + 1), inPath);
+	}
+	fclose(file);
+
+	if (!this->Apply(candidate))
+	{
+		printf("%s: inconsistent settings, file ignored\n", inPath);
+	}
+	return true;
+}
+
+void DecoderConfig::LoadFromEnvironment( void )
+{
+	DecoderSettings candidate = m_Settings;
+	bool found = false;
+
+	for (int i=0; i<settingCount; i++)
+	{
+		const char* value = getenv(settingInfo[i].EnvName);
+		if (value)
+		{
+			SetValue(candidate, settingInfo[i].EnvName, value, "environment");
+			found = true;
+		}
+	}
+
+	if (found && !this->Apply(candidate))
+	{
+		printf("environment: inconsistent settings, ignored\n");
+	}
+}
+
+bool DecoderConfig::Apply( const DecoderSettings& inSettings )
+{
+	if (!Validate(inSettings))
+		return false;
+
+	m_Settings = inSettings;
+	return true;
+}
+
+bool DecoderConfig::Validate( const DecoderSettings& inSettings )
+{
+	for (int i=0; i<settingCount; i++)
+	{
+		long value = SettingValue(inSettings, settingInfo[i]);
+		if (value < settingInfo[i].MinValue || value > settingInfo[i].MaxValue)
+			return false;
+	}
+
+	// A full parser read must fit into the cache, with room left to compact
+	return inSettings.DecoderBufferSize <= inSettings.SmartCacheSize
+		&& inSettings.MinWorkSize < inSettings.SmartCacheSize
+		&& inSettings.DisplayDelay < inSettings.MaxFrameCount;
+}
+
+void DecoderConfig::Report( FILE* outFile ) const
+{
+	Report(m_Settings, outFile);
+}
+
+void DecoderConfig::Report( const DecoderSettings& inSettings, FILE* outFile )
+{
+	fprintf(outFile, "Settings:");
+	for (int i=0; i<settingCount; i++)
+	{
+		fprintf(outFile, " %s=%ld", settingInfo[i].Key, SettingValue(inSettings, settingInfo[i]));
+	}
+	fprintf(outFile, "\n");
+}
@@ -0,0 +1,104 @@
+//------------------------------------------------------------------------------
+// File: DecoderConfig.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Runtime settings of the decoder (cache sizes, surface counts,
+// read sizes...). Loaded from a config file and the environment when
+// the filter is created, and settable through ICudaDecoderConfig.
+//
+//------------------------------------------------------------------------------
+
+#ifndef DECODER_CONFIG_H_
+#define DECODER_CONFIG_H_
+
+#include <stdio.h>
+
+// Default values, used when nothing else is configured
+#define SMART_CACHE_SIZE		1024*1024
+#define MIN_WORK_SIZE			10*1024
+#define DECODER_BUFFER_SIZE		256*1024
+#define MAX_FRM_CNT				16
+#define DISPLAY_DELAY			1
+#define USE_ASYNC_COPY			0
+#define ADAPTIVE_READ_SIZE		1
+#define READ_LATENCY_BUDGET		10	// ms
+#define MAX_DECODE_WIDTH		0	// 0 sizes the decoder for the first sequence
+#define MAX_DECODE_HEIGHT		0
+#define DECODE_BACKEND			0	// DECODER_BACKEND_CUDA
+#define FRAME_STATISTICS		0
+#define OUTPUT_STRIDE			0	// Every frame
+#define OUTPUT_FRAME_RATE		0
+#define DECODE_THREADS			0	// One per processor
+
+// Upper bounds of the display delay, the decode surfaces, the picture size
+// and the software decoding threads
+#define MAX_DISPLAY_DELAY		8
+#define MAX_DECODE_SURFACES		32
+#define MAX_PICTURE_SIZE		8192
+#define MAX_DECODE_THREADS		32
+
+// Config file looked up next to the filter, and the variable overriding its path
+#define DECODER_CONFIG_FILE		"CudaDecodeFilter.ini"
+#define DECODER_CONFIG_ENV		"CUDADEC_CONFIG"
+
+typedef struct
+{
+	long	SmartCacheSize;		// Bytes of the input cache
+	long	MinWorkSize;		// Data left in the cache below which it is compacted
+	long	DecoderBufferSize;	// Maximum bytes handed to the parser at once
+	long	MaxFrameCount;		// Upper bound on decode surfaces, the SPS decides below it
+	long	DisplayDelay;		// Frames kept in the display queue
+	long	UseAsyncCopy;		// Copy frames back with cuMemcpyDtoHAsync
+	long	DeinterlaceMode;	// DEINTERLACE_xxx, see FrameConverter.h
+	long	AdaptiveReadSize;	// Size parser reads from the observed bytes per frame
+	long	ReadLatencyBudget;	// ms an adaptive read may wait for the rest of a frame
+	long	MaxWidth;			// Coded size the decoder is allocated for, so that
+	long	MaxHeight;			// smaller sequences reuse it
+	long	Backend;			// DECODER_BACKEND_xxx, see DecoderBackend.h
+	long	FrameStatistics;	// Measure the luma of each frame while converting it
+	long	OutputStride;		// Deliver every Nth frame only, 0 or 1 for all
+	long	OutputFrameRate;	// Deliver this many frames a second, overrides the stride
+	long	DecodeThreads;		// Of the software backend, 0 for one per processor
+} DecoderSettings;
+
+class DecoderConfig
+{
+public:
+
+	DecoderConfig();
+	virtual ~DecoderConfig();
+
+	void	SetDefaults(void);
+
+	// "Key = Value" lines, '#' or ';' start a comment. Values accept a K or M suffix.
+	// Invalid entries are reported and skipped. Returns false if the file cannot be read.
+	bool	LoadFromFile(const char* inPath);
+
+	// CUDADEC_<KEY> variables, e.g. CUDADEC_SMART_CACHE_SIZE=4M
+	void	LoadFromEnvironment(void);
+
+	// Replaces all settings, if they are valid as a whole
+	bool	Apply(const DecoderSettings& inSettings);
+
+	const DecoderSettings&	Settings(void) const { return m_Settings; }
+
+	// Prints the effective settings as one line
+	void	Report(FILE* outFile) const;
+	static void	Report(const DecoderSettings& inSettings, FILE* outFile);
+
+	static bool	Validate(const DecoderSettings& inSettings);
+
+private:
+
+	static bool	SetValue(DecoderSettings& ioSettings, const char* inKey,
+						 const char* inValue, const char* inSource);
+
+private:
+
+	DecoderSettings	m_Settings;
+};
+
+#endif
@@ -0,0 +1,55 @@
+//------------------------------------------------------------------------------
+// File: DecoderInterfaces.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Custom COM interfaces exposed by the CUDA decoder filter.
+//
+//------------------------------------------------------------------------------
+
+#ifndef DECODER_INTERFACES_H_
+#define DECODER_INTERFACES_H_
+
+#include "StdHeader.h"
+#include "DecoderStats.h"
+
+// {96F4249F-DF0D-497B-8399-EB631FE4A4FB}
+DEFINE_GUID(IID_ICudaDecoderConfig, 0x96f4249f, 0xdf0d, 0x497b, 0x83, 0x99, 0xeb, 0x63, 0x1f, 0xe4, 0xa4, 0xfb);
+
+// Runtime settings. Changes are only accepted while the filter is stopped
+// and take effect when streaming starts.
+DECLARE_INTERFACE_(ICudaDecoderConfig, IUnknown)
+{
+	STDMETHOD(GetSettings)(THIS_ DecoderSettings* outSettings) PURE;
+
+	// E_INVALIDARG if a value is out of range, VFW_E_NOT_STOPPED while streaming
+	STDMETHOD(SetSettings)(THIS_ const DecoderSettings* inSettings) PURE;
+
+	// Same file format as the config file read at filter creation
+	STDMETHOD(LoadSettings)(THIS_ const char* inPath) PURE;
+};
+
+// {0980CA52-1057-4056-91DB-282BCDD5481F}
+DEFINE_GUID(IID_ICudaDecoderStats, 0x980ca52, 0x1057, 0x4056, 0x91, 0xdb, 0x28, 0x2b, 0xcd, 0xd5, 0x48, 0x1f);
+
+// Latency histograms and throughput counters, see DecoderStats.h.
+// Reading never blocks the decoding path.
+DECLARE_INTERFACE_(ICudaDecoderStats, IUnknown)
+{
+	STDMETHOD(GetStatistics)(THIS_ DecoderStatistics* outStats) PURE;
+	STDMETHOD(ResetStatistics)(THIS) PURE;
+};
+
+// {ECA25090-6386-4F06-8E94-18664E48C553}
+DEFINE_GUID(IID_ICudaDecoderTrace, 0xeca25090, 0x6386, 0x4f06, 0x8e, 0x94, 0x18, 0x66, 0x4e, 0x48, 0xc5, 0x53);
+
+// Hot path trace events, see Trace.h. Can be called while streaming.
+DECLARE_INTERFACE_(ICudaDecoderTrace, IUnknown)
+{
+	// Writes Chrome trace-event JSON, E_NOTIMPL unless built with USE_TRACING
+	STDMETHOD(DumpTrace)(THIS_ const char* inPath) PURE;
+};
+
+#endif
@@ -0,0 +1,308 @@
+//------------------------------------------------------------------------------
+// File: DecoderStats.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Lock-free per-frame latency and throughput statistics.
+// The input side is only written by the thread delivering samples,
+// the output side only by the decoding thread; each side is a
+// sequence lock so readers on any thread get consistent snapshots
+// without ever blocking the writers.
+//
+//------------------------------------------------------------------------------
+
+#include "DecoderStats.h"
+#include "AtomicOps.h"
+#include <string.h>
+
+static const char* stageNames[STAT_STAGE_COUNT] =
+{
+	"receive->parse",
+	"parse->decode",
+	"decode->map",
+	"map->convert",
+	"convert->deliver"
+};
+
+DecoderStats::DecoderStats() :	m_ResetCount(0),
+								m_InputSequence(0),
+								m_InputResetSeen(0),
+								m_OutputSequence(0),
+								m_OutputResetSeen(0)
+{
+	memset(&m_Input, 0, sizeof(m_Input));
+	memset(&m_Output, 0, sizeof(m_Output));
+}
+
+DecoderStats::~DecoderStats()
+{
+
+}
+
+void DecoderStats::Reset( void )
+{
+	AtomicIncrement(&m_ResetCount);
+}
+
+// An odd sequence number marks a side being written
+void DecoderStats::BeginInput( void )
+{
+	m_InputSequence++;
+	WRITE_FENCE();
+	long resetCount = m_ResetCount;
+	if (m_InputResetSeen != resetCount)
+	{
+		memset(&m_Input, 0, sizeof(m_Input));
+		m_InputResetSeen = resetCount;
+	}
+}
+
+void DecoderStats::EndInput( void )
+{
+	WRITE_FENCE();
+	m_InputSequence++;
+}
+
+void DecoderStats::BeginOutput( void )
+{
+	m_OutputSequence++;
+	WRITE_FENCE();
+	long resetCount = m_ResetCount;
+	if (m_OutputResetSeen != resetCount)
+	{
+		memset(&m_Output, 0, sizeof(m_Output));
+		m_OutputResetSeen = resetCount;
+	}
+}
+
+void DecoderStats::EndOutput( void )
+{
+	WRITE_FENCE();
+	m_OutputSequence++;
+}
+
+void DecoderStats::AddSampleReceived( long long inNowUs )
+{
+	BeginInput();
+	if (m_Input.FirstSampleUs == 0)
+		m_Input.FirstSampleUs = inNowUs;
+	EndInput();
+}
+
+void DecoderStats::AddInputBlocked( long long inUs )
+{
+	BeginInput();
+	m_Input.BlockedUs += inUs;
+	EndInput();
+}
+
+void DecoderStats::AddLatency( int inStage, long long inUs )
+{
+	if (inUs < 0)
+		inUs = 0;
+
+	int bucket = 0;
+	for (long long value = inUs; value != 0 && bucket < STAT_HISTOGRAM_BUCKETS - 1; value >>= 1)
+		bucket++;
+
+	BeginOutput();
+	LatencyHistogram& histogram = m_Output.Latency[inStage];
+	histogram.Buckets[bucket]++;
+	histogram.Count++;
+	histogram.TotalUs += inUs;
+	if (inUs > histogram.MaxUs)
+		histogram.MaxUs = inUs;
+	EndOutput();
+}
+
+void DecoderStats::AddOutputBlocked( long long inUs )
+{
+	BeginOutput();
+	m_Output.BlockedUs += inUs;
+	EndOutput();
+}
+
+void DecoderStats::AddFrameDelivered( long long inNowUs )
+{
+	BeginOutput();
+	m_Output.FramesDelivered++;
+	if (m_Output.FirstFrameUs == 0)
+		m_Output.FirstFrameUs = inNowUs;
+	m_Output.LastFrameUs = inNowUs;
+
+	if (m_Output.WindowStartUs == 0)
+		m_Output.WindowStartUs = inNowUs;
+	m_Output.WindowFrames++;
+	if (inNowUs - m_Output.WindowStartUs >= 1000000)
+	{
+		m_Output.CurrentFps = m_Output.WindowFrames * 1000000.0 / (inNowUs - m_Output.WindowStartUs);
+		m_Output.WindowStartUs = inNowUs;
+		m_Output.WindowFrames = 0;
+	}
+	EndOutput();
+}
+
+void DecoderStats::AddFrameDropped( void )
+{
+	BeginOutput();
+	m_Output.FramesDropped++;
+	EndOutput();
+}
+
+void DecoderStats::AddFrameDecimated( void )
+{
+	BeginOutput();
+	m_Output.FramesDecimated++;
+	EndOutput();
+}
+
+void DecoderStats::AddPictureSkipped( void )
+{
+	BeginOutput();
+	m_Output.PicturesSkipped++;
+	EndOutput();
+}
+
+void DecoderStats::AddSequenceSwitch( long long inUs, bool inInPlace )
+{
+	BeginOutput();
+	m_Output.SequenceSwitches++;
+	if (inInPlace)
+		m_Output.InPlaceSwitches++;
+	m_Output.SwitchTotalUs += inUs;
+	if (inUs > m_Output.SwitchMaxUs)
+		m_Output.SwitchMaxUs = inUs;
+	EndOutput();
+}
+
+void DecoderStats::AddFrameMeasured( const LumaStatistics& inLuma )
+{
+	BeginOutput();
+	m_Output.FramesMeasured++;
+	if (inLuma.SceneCut)
+		m_Output.SceneCuts++;
+	m_Output.MeanLuma = inLuma.Mean;
+	m_Output.MeanAbsDiff = inLuma.MeanAbsDiff;
+	EndOutput();
+}
+
+void DecoderStats::Snapshot( DecoderStatistics* outStats ) const
+{
+	InputSide input;
+	OutputSide output;
+	long sequence, inputSeen, outputSeen;
+
+	do
+	{
+		sequence = m_InputSequence;
+		READ_FENCE();
+		input = m_Input;
+		inputSeen = m_InputResetSeen;
+		READ_FENCE();
+	} while ((sequence & 1) || sequence != m_InputSequence);
+
+	do
+	{
+		sequence = m_OutputSequence;
+		READ_FENCE();
+		output = m_Output;
+		outputSeen = m_OutputResetSeen;
+		READ_FENCE();
+	} while ((sequence & 1) || sequence != m_OutputSequence);
+
+	// A reset the writers have not picked up yet
+	long resetCount = m_ResetCount;
+	if (inputSeen != resetCount)
+		memset(&input, 0, sizeof(input));
+	if (outputSeen != resetCount)
+		memset(&output, 0, sizeof(output));
+
+	memset(outStats, 0, sizeof(*outStats));
+	memcpy(outStats->Latency, output.Latency, sizeof(outStats->Latency));
+	outStats->FramesDelivered = output.FramesDelivered;
+	outStats->FramesDropped   = output.FramesDropped;
+	outStats->FramesDecimated = output.FramesDecimated;
+	outStats->PicturesSkipped = output.PicturesSkipped;
+	outStats->CurrentFps      = output.CurrentFps;
+	if (output.FramesDelivered > 1 && output.LastFrameUs > output.FirstFrameUs)
+	{
+		outStats->AverageFps = (output.FramesDelivered - 1) * 1000000.0 / (output.LastFrameUs - output.FirstFrameUs);
+	}
+	if (input.FirstSampleUs != 0 && output.FirstFrameUs >= input.FirstSampleUs)
+	{
+		outStats->TimeToFirstFrameUs = output.FirstFrameUs - input.FirstSampleUs;
+	}
+	outStats->SequenceSwitches = output.SequenceSwitches;
+	outStats->InPlaceSwitches  = output.InPlaceSwitches;
+	outStats->SwitchTotalUs    = output.SwitchTotalUs;
+	outStats->SwitchMaxUs      = output.SwitchMaxUs;
+	outStats->FramesMeasured   = output.FramesMeasured;
+	outStats->SceneCuts        = output.SceneCuts;
+	outStats->MeanLuma         = output.MeanLuma;
+	outStats->MeanAbsDiff      = output.MeanAbsDiff;
+	outStats->InputBlockedUs  = input.BlockedUs;
+	outStats->OutputBlockedUs = output.BlockedUs;
+}
+
+long long DecoderStats::Percentile( const LatencyHistogram& inHistogram, double inFraction )
+{
+	unsigned long wanted = (unsigned long)(inHistogram.Count * inFraction);
+	unsigned long seen = 0;
+
+	for (int i=0; i<STAT_HISTOGRAM_BUCKETS - 1; i++)
+	{
+		seen += inHistogram.Buckets[i];
+		if (seen > wanted)
+		{
+			long long bound = (long long)1 << i;
+			return bound < inHistogram.MaxUs ? bound : inHistogram.MaxUs;
+		}
+	}
+	return inHistogram.MaxUs;
+}
+
+void DecoderStats::Report( const DecoderStatistics& inStats, FILE* outFile )
+{
+	fprintf(outFile, "Frames: %lld delivered, %lld dropped, %.2f fps (%.2f average)\n",
+			inStats.FramesDelivered, inStats.FramesDropped, inStats.CurrentFps, inStats.AverageFps);
+	if (inStats.FramesDecimated || inStats.PicturesSkipped)
+	{
+		fprintf(outFile, "Decimation: %lld frames decoded and left out, %lld non-reference pictures not decoded\n",
+				inStats.FramesDecimated, inStats.PicturesSkipped);
+	}
+	fprintf(outFile, "First frame %.1f ms after the first sample\n", inStats.TimeToFirstFrameUs / 1000.0);
+	fprintf(outFile, "Cache: %ld of %ld bytes filled, blocked %.1f ms on input, %.1f ms on output\n",
+			inStats.CacheFillBytes, inStats.CacheSizeBytes,
+			inStats.InputBlockedUs / 1000.0, inStats.OutputBlockedUs / 1000.0);
+
+	if (inStats.SequenceSwitches)
+	{
+		fprintf(outFile, "Sequence switches: %ld (%ld in place), avg %.2f ms, max %.2f ms\n",
+				inStats.SequenceSwitches, inStats.InPlaceSwitches,
+				inStats.SwitchTotalUs / 1000.0 / inStats.SequenceSwitches, inStats.SwitchMaxUs / 1000.0);
+	}
+	if (inStats.FramesMeasured)
+	{
+		fprintf(outFile, "Luma: %lld frames measured, %lld scene cuts, last frame mean %.1f, difference %.2f\n",
+				inStats.FramesMeasured, inStats.SceneCuts, inStats.MeanLuma, inStats.MeanAbsDiff);
+	}
+	fprintf(outFile, "Surfaces: %ld decode surfaces, %.1f MB device memory, %.1f MB host frame buffers\n",
+			inStats.DecodeSurfaces, inStats.SurfaceBytes / (1024.0 * 1024.0), inStats.HostFrameBytes / (1024.0 * 1024.0));
+
+	for (int i=0; i<STAT_STAGE_COUNT; i++)
+	{
+		const LatencyHistogram& histogram = inStats.Latency[i];
+		fprintf(outFile, "  %-17s %8lu samples, avg %8.3f ms, p50 < %8.3f ms, p99 < %8.3f ms, max %8.3f ms\n",
+				stageNames[i], histogram.Count,
+				histogram.Count ? histogram.TotalUs / 1000.0 / histogram.Count : 0.0,
+				Percentile(histogram, 0.5) / 1000.0,
+				Percentile(histogram, 0.99) / 1000.0,
+				histogram.MaxUs / 1000.0);
+	}
+
+	ReadSizeEstimator::Report(inStats.Reads, outFile);
+	StreamAnalyzer::Report(inStats.Stream, outFile);
+	DecoderConfig::Report(inStats.Settings, outFile);
+}
@@ -0,0 +1,163 @@
+//------------------------------------------------------------------------------
+// File: DecoderStats.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Lock-free per-frame latency and throughput statistics.
+// The input side is only written by the thread delivering samples,
+// the output side only by the decoding thread; each side is a
+// sequence lock so readers on any thread get consistent snapshots
+// without ever blocking the writers.
+//
+//------------------------------------------------------------------------------
+
+#ifndef DECODER_STATS_H_
+#define DECODER_STATS_H_
+
+#include <stdio.h>
+#include "DecoderConfig.h"
+#include "ReadSizeEstimator.h"
+#include "StreamAnalyzer.h"
+#include "FrameSink.h"
+
+// Pipeline stages timed per frame
+#define STAT_RECEIVE_TO_PARSE		0	// Data received until handed to the parser
+#define STAT_PARSE_TO_DECODE		1	// Parse call until the decode callback
+#define STAT_DECODE_TO_MAP			2	// Decode callback until the frame is mapped for display
+#define STAT_MAP_TO_CONVERT			3	// Map and copy back to the host
+#define STAT_CONVERT_TO_DELIVER		4	// Conversion and delivery downstream
+#define STAT_STAGE_COUNT			5
+
+// Bucket 0 counts latencies below 1 us, bucket i those in [2^(i-1), 2^i) us,
+// the last bucket everything above
+#define STAT_HISTOGRAM_BUCKETS		24
+
+typedef struct
+{
+	unsigned long	Buckets[STAT_HISTOGRAM_BUCKETS];
+	unsigned long	Count;
+	long long		TotalUs;
+	long long		MaxUs;
+} LatencyHistogram;
+
+typedef struct
+{
+	LatencyHistogram	Latency[STAT_STAGE_COUNT];
+
+	long long		FramesDelivered;
+	long long		FramesDropped;
+	long long		FramesDecimated;	// Decoded, left out by OutputStride or OutputFrameRate
+	long long		PicturesSkipped;	// Non-reference pictures not decoded at all
+	double			CurrentFps;			// Over the last second
+	double			AverageFps;			// Since the first frame after a reset
+	long long		TimeToFirstFrameUs;	// First sample received until the first frame delivered
+
+	long			SequenceSwitches;	// Resolution or format changes
+	long			InPlaceSwitches;	// Of those, handled without recreating the decoder
+	long long		SwitchTotalUs;		// Output stalled by the switches
+	long long		SwitchMaxUs;
+
+	long long		InputBlockedUs;		// SmartCache::Receive or Reserve waiting for space
+	long long		OutputBlockedUs;	// SmartCache::FetchData waiting for data
+	long			CacheFillBytes;
+	long			CacheSizeBytes;
+
+	long			DecodeSurfaces;
+	long long		SurfaceBytes;		// Device memory of the decode and output surfaces
+	long long		HostFrameBytes;		// NV12 copy and converted frame
+
+	long long		FramesMeasured;		// With FrameStatistics, see LumaStatistics
+	long long		SceneCuts;
+	double			MeanLuma;			// Of the last frame measured
+	double			MeanAbsDiff;
+
+	ReadStatistics	Reads;
+	StreamStatistics	Stream;			// Of the data received, decoded or not
+	DecoderSettings	Settings;			// Effective settings
+} DecoderStatistics;
+
+class DecoderStats
+{
+public:
+
+	DecoderStats();
+	virtual ~DecoderStats();
+
+	// Any thread. Each writer clears its own side on its next update.
+	void	Reset(void);
+
+	// Input side
+	void	AddSampleReceived(long long inNowUs);
+	void	AddInputBlocked(long long inUs);
+
+	// Output side
+	void	AddLatency(int inStage, long long inUs);
+	void	AddOutputBlocked(long long inUs);
+	void	AddFrameDelivered(long long inNowUs);
+	void	AddFrameDropped(void);
+	void	AddFrameDecimated(void);
+	void	AddPictureSkipped(void);
+	void	AddSequenceSwitch(long long inUs, bool inInPlace);
+	void	AddFrameMeasured(const LumaStatistics& inLuma);
+
+	// Any thread. Only fills the fields maintained here, the owner adds
+	// the cache, read, stream and settings fields.
+	void	Snapshot(DecoderStatistics* outStats) const;
+
+	// Upper bound of the bucket holding the given fraction of the samples
+	static long long	Percentile(const LatencyHistogram& inHistogram, double inFraction);
+
+	static void			Report(const DecoderStatistics& inStats, FILE* outFile);
+
+private:
+
+	typedef struct
+	{
+		long long		FirstSampleUs;
+		long long		BlockedUs;
+	} InputSide;
+
+	typedef struct
+	{
+		LatencyHistogram	Latency[STAT_STAGE_COUNT];
+		long long		BlockedUs;
+		long long		FramesDelivered;
+		long long		FramesDropped;
+		long long		FramesDecimated;
+		long long		PicturesSkipped;
+		long long		FirstFrameUs;
+		long long		LastFrameUs;
+		long long		WindowStartUs;
+		long			WindowFrames;
+		double			CurrentFps;
+		long			SequenceSwitches;
+		long			InPlaceSwitches;
+		long long		SwitchTotalUs;
+		long long		SwitchMaxUs;
+		long long		FramesMeasured;
+		long long		SceneCuts;
+		double			MeanLuma;
+		double			MeanAbsDiff;
+	} OutputSide;
+
+	void	BeginInput(void);
+	void	EndInput(void);
+	void	BeginOutput(void);
+	void	EndOutput(void);
+
+private:
+
+	volatile long	m_ResetCount;
+
+	volatile long	m_InputSequence;
+	long			m_InputResetSeen;
+	InputSide		m_Input;
+
+	volatile long	m_OutputSequence;
+	long			m_OutputResetSeen;
+	OutputSide		m_Output;
+};
+
+#endif
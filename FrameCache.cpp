@@ -0,0 +1,504 @@
+//------------------------------------------------------------------------------
+// File: FrameCache.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Frame sink keeping the last frames delivered within a memory
+// budget.
+//
+// The entries are sorted by timestamp for the lookups; the least recently
+// used is found by a scan, as a cache holds a few hundred frames at most.
+// The buffer of an evicted frame takes the next one. Each frame remembers
+// the timestamp of the frame delivered before it, so a step back is only
+// served when the cache holds the frame that really came before.
+//
+// The lossless coding predicts every sample from the one above (from the
+// left on the first row) and codes the residuals in runs: a byte below
+// 128 is followed by that many plus one literal residuals, a byte from
+// 128 stands for 1 to 128 zero residuals. Flat and static areas, bars
+// and graphics shrink a lot, noisy pictures are kept as they are.
+//
+//------------------------------------------------------------------------------
+
+#include "FrameCache.h"
+#include "PerfTimer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <emmintrin.h>
+
+#define RUN_LENGTH		128		// Longest literal or zero run of a code
+
+FrameCache::FrameCache() :	m_Sink(NULL),
+							m_Budget(0),
+							m_Compress(false),
+							m_Entries(NULL),
+							m_Count(0),
+							m_Capacity(0),
+							m_Bytes(0),
+							m_RawBytes(0),
+							m_UseCounter(0),
+							m_LastTimestamp(DECODE_NO_TIMESTAMP),
+							m_Scratch(NULL),
+							m_ScratchSize(0)
+{
+	memset(&m_Stats, 0, sizeof(m_Stats));
+}
+
+FrameCache::~FrameCache()
+{
+	this->Close();
+}
+
+bool FrameCache::Open( long long inBudgetBytes, bool inCompress, FrameSink* inSink )
+{
+	this->Close();
+
+	PlatformAutoLock lck(&m_Lock);
+	m_Budget = inBudgetBytes;
+	m_Compress = inCompress;
+	m_Sink = inSink;
+	memset(&m_Stats, 0, sizeof(m_Stats));
+	return inBudgetBytes > 0;
+}
+
+void FrameCache::Close( void )
+{
+	PlatformAutoLock lck(&m_Lock);
+	for (long i=0; i<m_Count; i++)
+	{
+		free(m_Entries[i].Data);
+	}
+	free(m_Entries);
+	m_Entries = NULL;
+	m_Count = 0;
+	m_Capacity = 0;
+	m_Bytes = 0;
+	m_RawBytes = 0;
+	m_LastTimestamp = DECODE_NO_TIMESTAMP;
+
+	free(m_Scratch);
+	m_Scratch = NULL;
+	m_ScratchSize = 0;
+}
+
+void FrameCache::Flush( void )
+{
+	PlatformAutoLock lck(&m_Lock);
+	m_LastTimestamp = DECODE_NO_TIMESTAMP;
+}
+
+// Index of the entry with the timestamp, or where it would go
+long FrameCache::Find( long long inTimestamp, bool* outFound ) const
+{
+	long low = 0;
+	long high = m_Count;
+	while (low < high)
+	{
+		long middle = (low + high) / 2;
+		if (m_Entries[middle].Timestamp < inTimestamp)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	*outFound = (low < m_Count && m_Entries[low].Timestamp == inTimestamp);
+	return low;
+}
+
+// The buffer goes to ioSpare for the next frame, the one there is freed
+void FrameCache::RemoveEntry( long inIndex, unsigned char** ioSpare )
+{
+	Entry& entry = m_Entries[inIndex];
+
+	m_Bytes -= entry.StoredSize;
+	m_RawBytes -= entry.Size;
+	free(*ioSpare);
+	*ioSpare = entry.Data;
+
+	memmove(m_Entries + inIndex, m_Entries + inIndex + 1, (m_Count - inIndex - 1) * sizeof(Entry));
+	m_Count--;
+}
+
+bool FrameCache::OnFrame( const DecodedFrame& inFrame )
+{
+	{
+		PlatformAutoLock lck(&m_Lock);
+
+		long scratchSize = inFrame.Size + inFrame.Size / RUN_LENGTH + 16;
+		if (scratchSize > m_ScratchSize)
+		{
+			free(m_Scratch);
+			m_Scratch = (unsigned char*)malloc(scratchSize);
+			m_ScratchSize = m_Scratch ? scratchSize : 0;
+		}
+
+		if (m_Budget > 0 && m_Scratch && inFrame.Timestamp != DECODE_NO_TIMESTAMP)
+		{
+			const unsigned char* stored = inFrame.Data;
+			long storedSize = inFrame.Size;
+			bool compressed = false;
+
+			if (m_Compress)
+			{
+				long long start = PerfTimeUs();
+				long size = Compress(inFrame, m_Scratch);
+				m_Stats.CompressUs += PerfTimeUs() - start;
+				if (size > 0 && size < inFrame.Size)
+				{
+					stored = m_Scratch;
+					storedSize = size;
+					compressed = true;
+				}
+			}
+
+			// A frame decoded again replaces its copy, and keeps its link
+			// to the frame before unless it now follows one
+			unsigned char* spare = NULL;
+			long long previous = m_LastTimestamp;
+			bool found;
+			long index = this->Find(inFrame.Timestamp, &found);
+			if (found)
+			{
+				if (previous == DECODE_NO_TIMESTAMP)
+					previous = m_Entries[index].Previous;
+				this->RemoveEntry(index, &spare);
+			}
+
+			while (storedSize <= m_Budget && m_Count > 0 && m_Bytes + storedSize > m_Budget)
+			{
+				long oldest = 0;
+				for (long i=1; i<m_Count; i++)
+				{
+					if (m_Entries[i].LastUse < m_Entries[oldest].LastUse)
+						oldest = i;
+				}
+				this->RemoveEntry(oldest, &spare);
+				m_Stats.FramesEvicted++;
+			}
+
+			if (storedSize <= m_Budget && m_Count == m_Capacity)
+			{
+				long capacity = m_Capacity ? m_Capacity * 2 : 64;
+				Entry* entries = (Entry*)realloc(m_Entries, capacity * sizeof(Entry));
+				if (entries)
+				{
+					m_Entries = entries;
+					m_Capacity = capacity;
+				}
+			}
+
+			unsigned char* data = NULL;
+			if (storedSize <= m_Budget && m_Count < m_Capacity)
+			{
+				data = (unsigned char*)realloc(spare, storedSize);
+				spare = data ? NULL : spare;
+			}
+			if (data)
+			{
+				memcpy(data, stored, storedSize);
+
+				index = this->Find(inFrame.Timestamp, &found);
+				memmove(m_Entries + index + 1, m_Entries + index, (m_Count - index) * sizeof(Entry));
+				m_Count++;
+
+				Entry& entry = m_Entries[index];
+				entry.Timestamp   = inFrame.Timestamp;
+				entry.Previous    = previous;
+				entry.FrameNumber = inFrame.FrameNumber;
+				entry.Width       = inFrame.Width;
+				entry.Height      = inFrame.Height;
+				entry.Progressive = inFrame.Progressive;
+				entry.Compressed  = compressed;
+				entry.Size        = inFrame.Size;
+				entry.StoredSize  = storedSize;
+				entry.LastUse     = ++m_UseCounter;
+				entry.Data        = data;
+
+				m_Bytes += storedSize;
+				m_RawBytes += inFrame.Size;
+				m_Stats.FramesStored++;
+			}
+			free(spare);
+			m_LastTimestamp = inFrame.Timestamp;
+		}
+	}
+
+	return m_Sink ? m_Sink->OnFrame(inFrame) : true;
+}
+
+void FrameCache::OnEndOfStream( void )
+{
+	if (m_Sink)
+	{
+		m_Sink->OnEndOfStream();
+	}
+}
+
+// Called with the lock held
+bool FrameCache::ServeEntry( long inIndex, FrameSink* inSink )
+{
+	Entry& entry = m_Entries[inIndex];
+	entry.LastUse = ++m_UseCounter;
+
+	DecodedFrame frame;
+	frame.Data        = entry.Data;
+	frame.Size        = entry.Size;
+	frame.Width       = entry.Width;
+	frame.Height      = entry.Height;
+	frame.Timestamp   = entry.Timestamp;
+	frame.FrameNumber = entry.FrameNumber;
+	frame.Progressive = entry.Progressive;
+	frame.Luma        = NULL;
+
+	if (entry.Compressed)
+	{
+		if (entry.Size > m_ScratchSize)
+		{
+			free(m_Scratch);
+			m_Scratch = (unsigned char*)malloc(entry.Size + entry.Size / RUN_LENGTH + 16);
+			m_ScratchSize = m_Scratch ? entry.Size + entry.Size / RUN_LENGTH + 16 : 0;
+			if (m_Scratch == NULL)
+				return false;
+		}
+		long long start = PerfTimeUs();
+		bool decoded = Decompress(entry, m_Scratch);
+		m_Stats.DecompressUs += PerfTimeUs() - start;
+		if (!decoded)
+			return false;
+		frame.Data = m_Scratch;
+	}
+
+	m_Stats.Hits++;
+	if (inSink)
+		inSink->OnFrame(frame);
+	return true;
+}
+
+bool FrameCache::Serve( long long inTimestamp, FrameSink* inSink )
+{
+	PlatformAutoLock lck(&m_Lock);
+	m_Stats.Lookups++;
+
+	bool found;
+	long index = this->Find(inTimestamp, &found);
+	return found && this->ServeEntry(index, inSink);
+}
+
+bool FrameCache::ServePrevious( long long inTimestamp, FrameSink* inSink, long long* outTimestamp )
+{
+	PlatformAutoLock lck(&m_Lock);
+	m_Stats.Lookups++;
+
+	bool found;
+	long index = this->Find(inTimestamp, &found);
+	if (!found || m_Entries[index].Previous == DECODE_NO_TIMESTAMP)
+	{
+		return false;
+	}
+	long long previous = m_Entries[index].Previous;
+	index = this->Find(previous, &found);
+	if (!found || !this->ServeEntry(index, inSink))
+	{
+		return false;
+	}
+	*outTimestamp = previous;
+	return true;
+}
+
+void FrameCache::GetStatistics( FrameCacheStatistics* outStats )
+{
+	PlatformAutoLock lck(&m_Lock);
+	*outStats = m_Stats;
+	outStats->Frames = m_Count;
+	outStats->Bytes = m_Bytes;
+	outStats->RawBytes = m_RawBytes;
+	outStats->BudgetBytes = m_Budget;
+}
+
+void FrameCache::Report( const FrameCacheStatistics& inStats, FILE* outFile )
+{
+	fprintf(outFile, "Frame cache: %lld of %lld lookups hit (%.1f%%), %ld frames held in %.1f of %.1f MB "
+					 "(%.2f:1), %lld stored, %lld evicted, coding %.3f s, decoding %.3f s\n",
+			inStats.Hits, inStats.Lookups, inStats.Lookups ? 100.0 * inStats.Hits / inStats.Lookups : 0.0,
+			inStats.Frames, inStats.Bytes / 1048576.0, inStats.BudgetBytes / 1048576.0,
+			inStats.Bytes ? (double)inStats.RawBytes / inStats.Bytes : 1.0,
+			inStats.FramesStored, inStats.FramesEvicted,
+			inStats.CompressUs / 1000000.0, inStats.DecompressUs / 1000000.0);
+}
+
+// Returns the compressed size, 0 if the frame is not I420 of even size or
+// does not get smaller
+long FrameCache::Compress( const DecodedFrame& inFrame, unsigned char* outData )
+{
+	int width = inFrame.Width;
+	int height = inFrame.Height;
+	long lumaSize = (long)width * height;
+	long chromaSize = (long)(width / 2) * (height / 2);
+	if (((width | height) & 1) || lumaSize + 2 * chromaSize != inFrame.Size)
+	{
+		return 0;
+	}
+
+	long length = 0;
+	const unsigned char* planes[3] = { inFrame.Data, inFrame.Data + lumaSize, inFrame.Data + lumaSize + chromaSize };
+	for (int i=0; i<3; i++)
+	{
+		long used = CompressPlane(planes[i], i ? width / 2 : width, i ? height / 2 : height,
+								  outData + length, inFrame.Size - length);
+		if (used < 0)
+			return 0;
+		length += used;
+	}
+	return length;
+}
+
+// Returns the bytes used, -1 if more than inLimit would be needed
+long FrameCache::CompressPlane( const unsigned char* inPlane, int inWidth, int inHeight, unsigned char* outData,
+								long inLimit )
+{
+	long size = (long)inWidth * inHeight;
+	long length = 0;
+	long literal = -1;		// Offset of the open literal code
+	long zeros = 0;
+
+	for (long i=0; i<size; i++)
+	{
+		// Within a zero run, 16 samples equal to the ones above at once
+		while (zeros > 0 && i >= inWidth && i + 16 <= size &&
+			   _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(inPlane + i)),
+												_mm_loadu_si128((const __m128i*)(inPlane + i - inWidth)))) == 0xffff)
+		{
+			zeros += 16;
+			i += 16;
+			while (zeros >= RUN_LENGTH)
+			{
+				if (length + 1 > inLimit)
+					return -1;
+				outData[length++] = (unsigned char)(128 + RUN_LENGTH - 1);
+				zeros -= RUN_LENGTH;
+			}
+		}
+		// A sample takes two bytes at most
+		if (i >= size)
+		{
+			break;
+		}
+		if (length + 2 > inLimit)
+		{
+			return -1;
+		}
+
+		unsigned char predicted = (i >= inWidth) ? inPlane[i - inWidth] : (i > 0 ? inPlane[i - 1] : 0);
+		unsigned char residual = (unsigned char)(inPlane[i] - predicted);
+
+		if (residual == 0)
+		{
+			literal = -1;
+			if (++zeros == RUN_LENGTH)
+			{
+				outData[length++] = (unsigned char)(128 + RUN_LENGTH - 1);
+				zeros = 0;
+			}
+			continue;
+		}
+		if (zeros > 0)
+		{
+			outData[length++] = (unsigned char)(128 + zeros - 1);
+			zeros = 0;
+		}
+		if (literal < 0 || outData[literal] == RUN_LENGTH - 1)
+		{
+			literal = length;
+			outData[length++] = 0;
+		}
+		else
+		{
+			outData[literal]++;
+		}
+		outData[length++] = residual;
+	}
+	if (zeros > 0)
+	{
+		if (length + 1 > inLimit)
+			return -1;
+		outData[length++] = (unsigned char)(128 + zeros - 1);
+	}
+	return length;
+}
+
+bool FrameCache::Decompress( const Entry& inEntry, unsigned char* outFrame )
+{
+	int width = inEntry.Width;
+	int height = inEntry.Height;
+	long lumaSize = (long)width * height;
+	long chromaSize = (long)(width / 2) * (height / 2);
+	const unsigned char* data = inEntry.Data;
+	long remaining = inEntry.StoredSize;
+
+	long used = DecompressPlane(data, remaining, width, height, outFrame);
+	if (used < 0)
+		return false;
+	data += used;
+	remaining -= used;
+
+	used = DecompressPlane(data, remaining, width / 2, height / 2, outFrame + lumaSize);
+	if (used < 0)
+		return false;
+	data += used;
+	remaining -= used;
+
+	return DecompressPlane(data, remaining, width / 2, height / 2, outFrame + lumaSize + chromaSize) >= 0;
+}
+
+// Returns the bytes used, -1 if the data is short
+long FrameCache::DecompressPlane( const unsigned char* inData, long inLength, int inWidth, int inHeight,
+								  unsigned char* outPlane )
+{
+	long size = (long)inWidth * inHeight;
+	long length = 0;
+	long i = 0;
+
+	while (i < size)
+	{
+		if (length >= inLength)
+			return -1;
+		int code = inData[length++];
+		int count = (code & (RUN_LENGTH - 1)) + 1;
+		if (count > size - i || (code < 128 && count > inLength - length))
+			return -1;
+
+		if (i < inWidth)
+		{
+			// First row, from the left; the run may reach into the second
+			for (int n=0; n<count; n++, i++)
+			{
+				unsigned char predicted = (i >= inWidth) ? outPlane[i - inWidth] : (i > 0 ? outPlane[i - 1] : 0);
+				outPlane[i] = (unsigned char)(predicted + (code < 128 ? inData[length++] : 0));
+			}
+		}
+		else if (code >= 128 && count <= inWidth)
+		{
+			memcpy(outPlane + i, outPlane + i - inWidth, count);
+			i += count;
+		}
+		else
+		{
+			const unsigned char* above = outPlane + i - inWidth;
+			unsigned char* out = outPlane + i;
+			if (code < 128)
+			{
+				for (int n=0; n<count; n++)
+					out[n] = (unsigned char)(above[n] + inData[length + n]);
+				length += count;
+			}
+			else
+			{
+				for (int n=0; n<count; n++)
+					out[n] = above[n];
+			}
+			i += count;
+		}
+	}
+	return length;
+}
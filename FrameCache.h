@@ -0,0 +1,116 @@
+//------------------------------------------------------------------------------
+// File: FrameCache.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Frame sink keeping the last frames delivered, by timestamp and
+// within a memory budget, before passing them on. Stepping back and short
+// scrubs are then served from the cache instead of seeking and decoding
+// a GOP again. The least recently used frames go first. Frames may be
+// kept compressed (lossless) to fit more of them.
+//
+//------------------------------------------------------------------------------
+
+#ifndef FRAME_CACHE_H_
+#define FRAME_CACHE_H_
+
+#include "FrameSink.h"
+#include "Platform.h"
+#include <stdio.h>
+
+typedef struct
+{
+	long long	Lookups;
+	long long	Hits;
+	long long	FramesStored;
+	long long	FramesEvicted;
+	long		Frames;				// Held now
+	long long	Bytes;				// Held now, as stored
+	long long	RawBytes;			// Held now, uncompressed
+	long long	BudgetBytes;
+	long long	CompressUs;
+	long long	DecompressUs;
+} FrameCacheStatistics;
+
+class FrameCache : public FrameSink
+{
+public:
+
+	FrameCache();
+	virtual ~FrameCache();
+
+	// inSink receives the frames passing through, and may be NULL
+	bool	Open(long long inBudgetBytes, bool inCompress, FrameSink* inSink);
+	void	Close(void);
+
+	// Call on a seek: the next frame does not follow the last one
+	void	Flush(void);
+
+	// Any thread. Hands the frame with the timestamp to inSink, from within
+	// the call; false if it is not cached.
+	bool	Serve(long long inTimestamp, FrameSink* inSink);
+
+	// Any thread. Hands the frame delivered before the one with inTimestamp
+	// to inSink and sets outTimestamp to its timestamp; false unless both
+	// are cached.
+	bool	ServePrevious(long long inTimestamp, FrameSink* inSink, long long* outTimestamp);
+
+	void	GetStatistics(FrameCacheStatistics* outStats);
+	static void	Report(const FrameCacheStatistics& inStats, FILE* outFile);
+
+	// FrameSink. OnFrame stores a copy and passes the frame on.
+	bool	OnFrame(const DecodedFrame& inFrame);
+	void	OnEndOfStream(void);
+
+private:
+
+	typedef struct
+	{
+		long long		Timestamp;
+		long long		Previous;		// Timestamp of the frame delivered before, if known
+		long long		FrameNumber;
+		int				Width;
+		int				Height;
+		int				Progressive;
+		bool			Compressed;
+		long			Size;			// Uncompressed
+		long			StoredSize;
+		long long		LastUse;
+		unsigned char*	Data;
+	} Entry;
+
+	long	Find(long long inTimestamp, bool* outFound) const;
+	void	RemoveEntry(long inIndex, unsigned char** ioSpare);
+	bool	ServeEntry(long inIndex, FrameSink* inSink);
+
+	static long	Compress(const DecodedFrame& inFrame, unsigned char* outData);
+	static long	CompressPlane(const unsigned char* inPlane, int inWidth, int inHeight, unsigned char* outData,
+							  long inLimit);
+	static bool	Decompress(const Entry& inEntry, unsigned char* outFrame);
+	static long	DecompressPlane(const unsigned char* inData, long inLength, int inWidth, int inHeight,
+								unsigned char* outPlane);
+
+private:
+
+	PlatformLock	m_Lock;
+	FrameSink*		m_Sink;
+	long long		m_Budget;
+	bool			m_Compress;
+
+	Entry*			m_Entries;			// By timestamp
+	long			m_Count;
+	long			m_Capacity;
+	long long		m_Bytes;
+	long long		m_RawBytes;
+	long long		m_UseCounter;
+	long long		m_LastTimestamp;	// Of the last frame stored, since the last flush
+
+	unsigned char*	m_Scratch;			// Compressed frame being stored, or frame being served
+	long			m_ScratchSize;
+
+	FrameCacheStatistics	m_Stats;
+};
+
+#endif
@@ -0,0 +1,456 @@
+//------------------------------------------------------------------------------
+// File: FrameConverter.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: SSE2 conversion of mapped NV12 frames to planar IYUV with
+// the deinterlacer fused into the same pass, so each frame is
+// read and written only once. The luma statistics of the frame are
+// taken in the same pass. Also scales IYUV frames on the CPU.
+//
+//------------------------------------------------------------------------------
+
+#include "FrameConverter.h"
+#include <stddef.h>
+#include <string.h>
+#include <emmintrin.h>
+
+// A destination row. Luma only uses p0, chroma writes Cb to p0 and Cr to p1.
+// Luma rows of a measured frame also point to the sums of their block row
+// (NULL without a previous frame) and to the histograms.
+typedef struct
+{
+	unsigned char* p0;
+	unsigned char* p1;
+	unsigned int* sad;
+	unsigned int* histogram;
+} DstRow;
+
+// Per frame sums of the luma statistics. Four histograms are counted
+// in turn so that consecutive equal samples do not wait on each other.
+typedef struct
+{
+	unsigned int*	sad;				// Per block, NULL without a previous frame
+	unsigned int	blocksX;
+	unsigned int	blocksY;
+	unsigned int*	histogram;			// 4 * LUMA_HISTOGRAM_BINS
+} LumaMeter;
+
+static inline __m128i AbsDiff(__m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+}
+
+static inline int AbsDiff(int a, int b)
+{
+	return a > b ? a - b : b - a;
+}
+
+// Plane accessors. Positions are always given in source bytes, and every
+// vector holds 16 samples so the row kernels below are shared by both planes.
+struct LumaPlane
+{
+	static __m128i Load(const unsigned char* src, unsigned int x)
+	{
+		return _mm_loadu_si128((const __m128i*)(src + x));
+	}
+	static __m128i LoadDst(const DstRow& dst, unsigned int x)
+	{
+		return _mm_loadu_si128((const __m128i*)(dst.p0 + x));
+	}
+	// The previous frame is read back just before it is overwritten. x is
+	// a multiple of 16 here, so the 16 samples are in the same block.
+	static void Store(const DstRow& dst, unsigned int x, __m128i v)
+	{
+		if (dst.sad)
+		{
+			__m128i sad = _mm_sad_epu8(v, _mm_loadu_si128((const __m128i*)(dst.p0 + x)));
+			dst.sad[x / LUMA_BLOCK_SIZE] += _mm_cvtsi128_si32(sad) + _mm_cvtsi128_si32(_mm_srli_si128(sad, 8));
+		}
+		_mm_storeu_si128((__m128i*)(dst.p0 + x), v);
+		if (dst.histogram)
+		{
+			unsigned int* h = dst.histogram;
+			for (int i=0; i<4; i++)
+			{
+				unsigned int w = (unsigned int)_mm_cvtsi128_si32(v);
+				h[w & 0xff]++;
+				h[LUMA_HISTOGRAM_BINS + ((w >> 8) & 0xff)]++;
+				h[2*LUMA_HISTOGRAM_BINS + ((w >> 16) & 0xff)]++;
+				h[3*LUMA_HISTOGRAM_BINS + (w >> 24)]++;
+				v = _mm_srli_si128(v, 4);
+			}
+		}
+	}
+	static unsigned char GetDst(const DstRow& dst, unsigned int x)
+	{
+		return dst.p0[x];
+	}
+	static void PutDst(const DstRow& dst, unsigned int x, unsigned char v)
+	{
+		if (dst.sad)
+			dst.sad[x / LUMA_BLOCK_SIZE] += AbsDiff(dst.p0[x], v);
+		if (dst.histogram)
+			dst.histogram[v]++;
+		dst.p0[x] = v;
+	}
+};
+
+struct ChromaPlane
+{
+	// De-interleave 16 bytes of CbCrCbCr... into 8 Cb followed by 8 Cr
+	static __m128i Load(const unsigned char* src, unsigned int x)
+	{
+		__m128i uv = _mm_loadu_si128((const __m128i*)(src + x));
+		__m128i cb = _mm_and_si128(uv, _mm_set1_epi16(0x00FF));
+		__m128i cr = _mm_srli_epi16(uv, 8);
+		return _mm_packus_epi16(cb, cr);
+	}
+	static __m128i LoadDst(const DstRow& dst, unsigned int x)
+	{
+		return _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(dst.p0 + x/2)),
+								  _mm_loadl_epi64((const __m128i*)(dst.p1 + x/2)));
+	}
+	static void Store(const DstRow& dst, unsigned int x, __m128i v)
+	{
+		_mm_storel_epi64((__m128i*)(dst.p0 + x/2), v);
+		_mm_storel_epi64((__m128i*)(dst.p1 + x/2), _mm_srli_si128(v, 8));
+	}
+	static unsigned char GetDst(const DstRow& dst, unsigned int x)
+	{
+		return (x & 1) ? dst.p1[x/2] : dst.p0[x/2];
+	}
+	static void PutDst(const DstRow& dst, unsigned int x, unsigned char v)
+	{
+		if (x & 1)
+			dst.p1[x/2] = v;
+		else
+			dst.p0[x/2] = v;
+	}
+};
+
+template <class P>
+static void CopyRow(const unsigned char* src, const DstRow& dst, unsigned int width)
+{
+	unsigned int x = 0;
+	for (; x + 16 <= width; x += 16)
+	{
+		P::Store(dst, x, P::Load(src, x));
+	}
+	for (; x < width; x++)
+	{
+		P::PutDst(dst, x, src[x]);
+	}
+}
+
+// Interpolate a missing line from the two lines of the kept field around it
+template <class P>
+static void BobRow(const unsigned char* above, const unsigned char* below,
+				   const DstRow& dst, unsigned int width)
+{
+	unsigned int x = 0;
+	for (; x + 16 <= width; x += 16)
+	{
+		P::Store(dst, x, _mm_avg_epu8(P::Load(above, x), P::Load(below, x)));
+	}
+	for (; x < width; x++)
+	{
+		P::PutDst(dst, x, (unsigned char)((above[x] + below[x] + 1) >> 1));
+	}
+}
+
+// Motion is measured on the kept field against the previous output frame,
+// whose kept lines are still untouched in the destination at this point.
+// Static pixels keep the woven line, moving pixels are interpolated.
+template <class P>
+static void AdaptiveRow(const unsigned char* woven,
+						const unsigned char* above, const unsigned char* below,
+						const DstRow& oldAbove, const DstRow& oldBelow,
+						const DstRow& dst, unsigned int width)
+{
+	const __m128i threshold = _mm_set1_epi8(DEINTERLACE_MOTION_THRESHOLD);
+	const __m128i zero = _mm_setzero_si128();
+	unsigned int x = 0;
+
+	for (; x + 16 <= width; x += 16)
+	{
+		__m128i a = P::Load(above, x);
+		__m128i b = P::Load(below, x);
+		__m128i motion = _mm_max_epu8(AbsDiff(a, P::LoadDst(oldAbove, x)),
+									  AbsDiff(b, P::LoadDst(oldBelow, x)));
+		__m128i still = _mm_cmpeq_epi8(_mm_subs_epu8(motion, threshold), zero);
+		__m128i out = _mm_or_si128(_mm_and_si128(still, P::Load(woven, x)),
+								   _mm_andnot_si128(still, _mm_avg_epu8(a, b)));
+		P::Store(dst, x, out);
+	}
+	for (; x < width; x++)
+	{
+		int motionAbove = AbsDiff(above[x], P::GetDst(oldAbove, x));
+		int motionBelow = AbsDiff(below[x], P::GetDst(oldBelow, x));
+		if (motionAbove <= DEINTERLACE_MOTION_THRESHOLD && motionBelow <= DEINTERLACE_MOTION_THRESHOLD)
+			P::PutDst(dst, x, woven[x]);
+		else
+			P::PutDst(dst, x, (unsigned char)((above[x] + below[x] + 1) >> 1));
+	}
+}
+
+static inline DstRow MakeRow(unsigned char* dst0, unsigned char* dst1, unsigned int dstPitch,
+							 unsigned int y, const LumaMeter* meter)
+{
+	DstRow row = { dst0 + y*dstPitch, dst1 ? dst1 + y*dstPitch : NULL, NULL, NULL };
+	if (meter)
+	{
+		row.sad = meter->sad ? meter->sad + (y / LUMA_BLOCK_SIZE) * meter->blocksX : NULL;
+		row.histogram = meter->histogram;
+	}
+	return row;
+}
+
+// Converts one plane. Missing lines are produced top-down, and each kept line
+// is written one step behind, right after the last missing line that needs
+// its previous content as motion history. Every line is written once, so
+// a measured plane sees each sample of the previous frame just once.
+template <class P>
+static void ConvertPlane(const unsigned char* src, unsigned int srcPitch,
+						 unsigned char* dst0, unsigned char* dst1, unsigned int dstPitch,
+						 unsigned int width, unsigned int rows, int mode, unsigned int keepParity,
+						 const LumaMeter* meter)
+{
+	unsigned int y;
+
+	if (mode == DEINTERLACE_WEAVE || rows < 2)
+	{
+		for (y=0; y<rows; y++)
+		{
+			CopyRow<P>(src + y*srcPitch, MakeRow(dst0, dst1, dstPitch, y, meter), width);
+		}
+		return;
+	}
+
+	for (y = 1 - keepParity; y < rows; y += 2)
+	{
+		unsigned int a = (y > 0) ? y - 1 : y + 1;
+		unsigned int b = (y + 1 < rows) ? y + 1 : y - 1;
+		DstRow out   = MakeRow(dst0, dst1, dstPitch, y, meter);
+		DstRow prevA = MakeRow(dst0, dst1, dstPitch, a, meter);
+		DstRow prevB = MakeRow(dst0, dst1, dstPitch, b, meter);
+
+		if (mode == DEINTERLACE_BOB)
+		{
+			BobRow<P>(src + a*srcPitch, src + b*srcPitch, out, width);
+		}
+		else
+		{
+			AdaptiveRow<P>(src + y*srcPitch, src + a*srcPitch, src + b*srcPitch,
+						   prevA, prevB, out, width);
+		}
+
+		// The kept line above is not needed as history any more
+		if (y > 0)
+		{
+			CopyRow<P>(src + (y-1)*srcPitch, prevA, width);
+		}
+	}
+
+	// The last kept line has no missing line below it
+	if (((rows - 1) & 1) == keepParity)
+	{
+		CopyRow<P>(src + (rows-1)*srcPitch, MakeRow(dst0, dst1, dstPitch, rows-1, meter), width);
+	}
+}
+
+// NULL if there is nothing to measure
+static LumaMeter* BeginLumaStatistics(LumaMeter* meter, unsigned int width, unsigned int height,
+									  int hasPrevious, LumaStatistics* stats)
+{
+	if (stats == NULL)
+	{
+		return NULL;
+	}
+
+	meter->blocksX = (width + LUMA_BLOCK_SIZE - 1) / LUMA_BLOCK_SIZE;
+	meter->blocksY = (height + LUMA_BLOCK_SIZE - 1) / LUMA_BLOCK_SIZE;
+	meter->histogram = new unsigned int[4 * LUMA_HISTOGRAM_BINS];
+	memset(meter->histogram, 0, 4 * LUMA_HISTOGRAM_BINS * sizeof(unsigned int));
+	meter->sad = NULL;
+	if (hasPrevious)
+	{
+		meter->sad = new unsigned int[meter->blocksX * meter->blocksY];
+		memset(meter->sad, 0, meter->blocksX * meter->blocksY * sizeof(unsigned int));
+	}
+	return meter;
+}
+
+static void EndLumaStatistics(LumaMeter* meter, unsigned int width, unsigned int height,
+							  LumaStatistics* stats)
+{
+	if (meter == NULL)
+	{
+		return;
+	}
+
+	double total = 0;
+	for (int i=0; i<LUMA_HISTOGRAM_BINS; i++)
+	{
+		stats->Histogram[i] = meter->histogram[i] + meter->histogram[LUMA_HISTOGRAM_BINS + i] +
+			meter->histogram[2*LUMA_HISTOGRAM_BINS + i] + meter->histogram[3*LUMA_HISTOGRAM_BINS + i];
+		total += (double)i * stats->Histogram[i];
+	}
+	double samples = (double)width * height;
+	stats->Mean = samples > 0 ? total / samples : 0.0;
+
+	stats->HasPrevious = meter->sad != NULL;
+	stats->PreviousDistance = stats->HasPrevious;	// The caller knows of decimated frames
+	stats->MeanAbsDiff = 0.0;
+	stats->Blocks = meter->blocksX * meter->blocksY;
+	stats->ChangedBlocks = 0;
+	stats->SceneCut = 0;
+	if (meter->sad)
+	{
+		double sad = 0;
+		for (unsigned int by=0; by<meter->blocksY; by++)
+		{
+			unsigned int rows = height - by * LUMA_BLOCK_SIZE;
+			if (rows > LUMA_BLOCK_SIZE)
+				rows = LUMA_BLOCK_SIZE;
+			for (unsigned int bx=0; bx<meter->blocksX; bx++)
+			{
+				unsigned int columns = width - bx * LUMA_BLOCK_SIZE;
+				if (columns > LUMA_BLOCK_SIZE)
+					columns = LUMA_BLOCK_SIZE;
+				unsigned int blockSad = meter->sad[by * meter->blocksX + bx];
+				if (blockSad > SCENE_CUT_BLOCK_DIFF * rows * columns)
+					stats->ChangedBlocks++;
+				sad += blockSad;
+			}
+		}
+		stats->MeanAbsDiff = samples > 0 ? sad / samples : 0.0;
+		stats->SceneCut = stats->ChangedBlocks * 100 > SCENE_CUT_BLOCK_SHARE * stats->Blocks;
+	}
+
+	delete [] meter->sad;
+	delete [] meter->histogram;
+}
+
+void ConvertNV12ToIYUV(const ConvertParams* params)
+{
+	unsigned int w = params->width;
+	unsigned int h = params->height;
+	int mode = params->deinterlaceMode;
+
+	if (params->progressiveFrame)
+		mode = DEINTERLACE_WEAVE;
+	else if (mode == DEINTERLACE_ADAPTIVE && !params->hasPrevious)
+		mode = DEINTERLACE_BOB;  // No history yet
+
+	// Keep the field which comes first in time
+	unsigned int keepParity = params->topFieldFirst ? 0 : 1;
+
+	unsigned char* dstY = params->dst;
+	unsigned char* dstU = dstY + w*h;
+	unsigned char* dstV = dstU + (w/2)*(h/2);
+
+	LumaMeter meter;
+	LumaMeter* measure = BeginLumaStatistics(&meter, w, h, params->hasPrevious, params->stats);
+
+	ConvertPlane<LumaPlane>(params->src, params->srcPitch,
+							dstY, NULL, w, w, h, mode, keepParity, measure);
+	ConvertPlane<ChromaPlane>(params->src + h*params->srcPitch, params->srcPitch,
+							  dstU, dstV, w/2, w & ~1u, h/2, mode, keepParity, NULL);
+
+	EndLumaStatistics(measure, w, h, params->stats);
+}
+
+void CopyLumaPlane(const unsigned char* src, unsigned int srcPitch, unsigned char* dst,
+				   unsigned int width, unsigned int height, int hasPrevious, LumaStatistics* stats)
+{
+	LumaMeter meter;
+	LumaMeter* measure = BeginLumaStatistics(&meter, width, height, hasPrevious, stats);
+
+	ConvertPlane<LumaPlane>(src, srcPitch, dst, NULL, width, width, height, DEINTERLACE_WEAVE, 0, measure);
+
+	EndLumaStatistics(measure, width, height, stats);
+}
+
+// The source rows of an output row are summed per column first, then the
+// columns of each output sample, so every source sample is read once
+static void ScalePlane(const unsigned char* src, unsigned int srcWidth, unsigned int srcHeight,
+					   unsigned char* dst, unsigned int dstWidth, unsigned int dstHeight,
+					   unsigned int* sums)
+{
+	if (srcWidth == dstWidth && srcHeight == dstHeight)
+	{
+		memcpy(dst, src, srcWidth * srcHeight);
+		return;
+	}
+
+	for (unsigned int oy=0; oy<dstHeight; oy++)
+	{
+		unsigned int y0 = oy * srcHeight / dstHeight;
+		unsigned int y1 = (oy + 1) * srcHeight / dstHeight;
+		if (y1 <= y0)
+			y1 = y0 + 1;
+
+		memset(sums, 0, srcWidth * sizeof(unsigned int));
+		for (unsigned int y=y0; y<y1; y++)
+		{
+			const unsigned char* row = src + y * srcWidth;
+			const __m128i zero = _mm_setzero_si128();
+			unsigned int x = 0;
+			for (; x+16<=srcWidth; x+=16)
+			{
+				__m128i v  = _mm_loadu_si128((const __m128i*)(row + x));
+				__m128i lo = _mm_unpacklo_epi8(v, zero);
+				__m128i hi = _mm_unpackhi_epi8(v, zero);
+				__m128i* s = (__m128i*)(sums + x);
+				_mm_storeu_si128(s,   _mm_add_epi32(_mm_loadu_si128(s),   _mm_unpacklo_epi16(lo, zero)));
+				_mm_storeu_si128(s+1, _mm_add_epi32(_mm_loadu_si128(s+1), _mm_unpackhi_epi16(lo, zero)));
+				_mm_storeu_si128(s+2, _mm_add_epi32(_mm_loadu_si128(s+2), _mm_unpacklo_epi16(hi, zero)));
+				_mm_storeu_si128(s+3, _mm_add_epi32(_mm_loadu_si128(s+3), _mm_unpackhi_epi16(hi, zero)));
+			}
+			for (; x<srcWidth; x++)
+			{
+				sums[x] += row[x];
+			}
+		}
+
+		unsigned char* out = dst + oy * dstWidth;
+		for (unsigned int ox=0; ox<dstWidth; ox++)
+		{
+			unsigned int x0 = ox * srcWidth / dstWidth;
+			unsigned int x1 = (ox + 1) * srcWidth / dstWidth;
+			if (x1 <= x0)
+				x1 = x0 + 1;
+
+			unsigned int sum = 0;
+			for (unsigned int x=x0; x<x1; x++)
+			{
+				sum += sums[x];
+			}
+			unsigned int count = (x1 - x0) * (y1 - y0);
+			out[ox] = (unsigned char)((sum + count / 2) / count);
+		}
+	}
+}
+
+void ScaleIYUV(const ScaleParams* params)
+{
+	unsigned int sw = params->srcWidth;
+	unsigned int sh = params->srcHeight;
+	unsigned int dw = params->dstWidth;
+	unsigned int dh = params->dstHeight;
+	unsigned int* sums = new unsigned int[sw];
+
+	const unsigned char* srcU = params->src + sw*sh;
+	const unsigned char* srcV = srcU + (sw/2)*(sh/2);
+	unsigned char* dstU = params->dst + dw*dh;
+	unsigned char* dstV = dstU + (dw/2)*(dh/2);
+
+	ScalePlane(params->src, sw, sh, params->dst, dw, dh, sums);
+	ScalePlane(srcU, sw/2, sh/2, dstU, dw/2, dh/2, sums);
+	ScalePlane(srcV, sw/2, sh/2, dstV, dw/2, dh/2, sums);
+
+	delete [] sums;
+}
@@ -0,0 +1,74 @@
+//------------------------------------------------------------------------------
+// File: FrameConverter.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: SSE2 conversion of mapped NV12 frames to planar IYUV with
+// the deinterlacer fused into the same pass, so each frame is
+// read and written only once. The luma statistics of the frame are
+// taken in the same pass. Also scales IYUV frames on the CPU.
+//
+//------------------------------------------------------------------------------
+
+#ifndef FRAME_CONVERTER_H_
+#define FRAME_CONVERTER_H_
+
+#include "FrameSink.h"
+
+#define DEINTERLACE_WEAVE		0	// Keep both fields (no deinterlacing)
+#define DEINTERLACE_BOB			1	// Keep the first field, interpolate the other one
+#define DEINTERLACE_ADAPTIVE	2	// Weave static areas, bob moving areas
+
+// Per-pixel difference between two frames above which a pixel is treated as moving
+#define DEINTERLACE_MOTION_THRESHOLD	12
+
+// Average difference per sample above which a luma block has changed, and
+// the percentage of changed blocks making a scene cut
+#define SCENE_CUT_BLOCK_DIFF	24
+#define SCENE_CUT_BLOCK_SHARE	60
+
+typedef struct
+{
+	const unsigned char*	src;				// NV12: luma plane followed by interleaved CbCr
+	unsigned int			srcPitch;
+	unsigned int			width;
+	unsigned int			height;
+
+	// IYUV destination, tightly packed. When hasPrevious is set it still
+	// holds the previous output frame, which the adaptive mode uses as history.
+	unsigned char*			dst;
+	int						hasPrevious;
+
+	int						deinterlaceMode;	// DEINTERLACE_xxx
+	int						progressiveFrame;	// From CUVIDPARSERDISPINFO
+	int						topFieldFirst;
+
+	// Measured on the luma as it is written, NULL to skip. The differences
+	// need hasPrevious.
+	LumaStatistics*			stats;
+} ConvertParams;
+
+void ConvertNV12ToIYUV(const ConvertParams* params);
+
+// Copies a luma plane into a tightly packed one, measuring it on the way.
+// When hasPrevious is set dst still holds the previous frame.
+void CopyLumaPlane(const unsigned char* src, unsigned int srcPitch, unsigned char* dst,
+				   unsigned int width, unsigned int height, int hasPrevious, LumaStatistics* stats);
+
+typedef struct
+{
+	const unsigned char*	src;				// IYUV, tightly packed
+	unsigned int			srcWidth;
+	unsigned int			srcHeight;
+	unsigned char*			dst;				// IYUV, tightly packed
+	unsigned int			dstWidth;
+	unsigned int			dstHeight;
+} ScaleParams;
+
+// Each output sample is the average of the source area it covers (a
+// single sample when enlarging), the three planes in one call
+void ScaleIYUV(const ScaleParams* params);
+
+#endif
@@ -0,0 +1,86 @@
+//------------------------------------------------------------------------------
+// File: FrameDecimator.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Picks the frames a backend delivers when only some of them are
+// wanted.
+//
+// The step between delivered frames may be fractional (30 fps down to
+// 4 fps is 7.5), the due position then advances by the step so that the
+// rate is right on average. After a run of frames that could not be
+// delivered the next one is due one step on, rather than catching up.
+//
+//------------------------------------------------------------------------------
+
+#include "FrameDecimator.h"
+
+FrameDecimator::FrameDecimator() :	m_Stride(0),
+									m_FrameRate(0),
+									m_FrameDuration(0),
+									m_Step(1.0),
+									m_Position(0),
+									m_Due(0)
+{
+}
+
+void FrameDecimator::Configure( long inStride, long inFrameRate )
+{
+	m_Stride = inStride;
+	m_FrameRate = inFrameRate;
+	this->UpdateStep();
+	this->Reset();
+}
+
+void FrameDecimator::SetFrameDuration( long long inDuration )
+{
+	if (inDuration > 0)
+	{
+		m_FrameDuration = inDuration;
+		this->UpdateStep();
+	}
+}
+
+void FrameDecimator::Reset( void )
+{
+	m_Position = 0;
+	m_Due = 0;
+}
+
+long long FrameDecimator::GetOutputDuration( void ) const
+{
+	return (long long)(m_FrameDuration * m_Step + 0.5);
+}
+
+void FrameDecimator::UpdateStep( void )
+{
+	m_Step = 1.0;
+	if (m_FrameRate > 0)
+	{
+		long long duration = m_FrameDuration > 0 ? m_FrameDuration : DECIMATE_DEFAULT_DURATION;
+		m_Step = 10000000.0 / duration / m_FrameRate;
+	}
+	else if (m_Stride > 1)
+	{
+		m_Step = (double)m_Stride;
+	}
+	if (m_Step < 1.0)
+		m_Step = 1.0;
+}
+
+bool FrameDecimator::Next( bool inDecoded )
+{
+	double position = m_Position;
+	m_Position += 1;
+	if (position < m_Due || !inDecoded)
+	{
+		return false;
+	}
+
+	m_Due += m_Step;
+	if (m_Due <= position)
+		m_Due = position + m_Step;
+	return true;
+}
@@ -0,0 +1,68 @@
+//------------------------------------------------------------------------------
+// File: FrameDecimator.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Picks the frames a backend delivers when only some of them are
+// wanted: every Nth, or as many as a target frame rate. The others are
+// decoded for reference but never mapped, copied, converted or delivered,
+// and at low rates the non-reference pictures are not decoded at all.
+// Not synchronized, the backend serializes the calls.
+//
+//------------------------------------------------------------------------------
+
+#ifndef FRAME_DECIMATOR_H_
+#define FRAME_DECIMATOR_H_
+
+// Non-reference pictures are left undecoded from this many frames per
+// frame delivered on
+#define DECIMATE_SKIP_STEP				2.0
+
+// Source frame duration assumed until the SPS or the samples give one,
+// in 100 ns units (30 fps)
+#define DECIMATE_DEFAULT_DURATION		333333
+
+class FrameDecimator
+{
+public:
+
+	FrameDecimator();
+
+	// Every inStride-th frame, or inFrameRate frames a second when set; 0
+	// for both delivers every frame
+	void	Configure(long inStride, long inFrameRate);
+
+	// Of the source, in 100 ns units, 0 if unknown
+	void	SetFrameDuration(long long inDuration);
+
+	// The next frame is delivered
+	void	Reset(void);
+
+	bool	IsActive(void) const { return m_Step > 1.0; }
+	bool	SkipNonReference(void) const { return m_Step >= DECIMATE_SKIP_STEP; }
+
+	// Of the frames delivered, in 100 ns units, 0 if the source's is unknown
+	long long	GetOutputDuration(void) const;
+
+	// Called for each frame in display order: true if it is to be
+	// delivered. A frame that is due but was not decoded hands its turn
+	// to the next one.
+	bool	Next(bool inDecoded);
+
+private:
+
+	void	UpdateStep(void);
+
+private:
+
+	long		m_Stride;
+	long		m_FrameRate;
+	long long	m_FrameDuration;
+	double		m_Step;				// Frames per frame delivered
+	double		m_Position;			// Frames seen since the reset
+	double		m_Due;				// Position of the next frame to deliver
+};
+
+#endif
@@ -0,0 +1,64 @@
+//------------------------------------------------------------------------------
+// File: FrameSink.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Receiver of the decoded frames of a DecodeSession.
+//
+//------------------------------------------------------------------------------
+
+#ifndef FRAME_SINK_H_
+#define FRAME_SINK_H_
+
+// Timestamp of data or frames that have none
+#define DECODE_NO_TIMESTAMP		(-1LL)
+
+#define LUMA_HISTOGRAM_BINS		256
+#define LUMA_BLOCK_SIZE			16	// Side of the squares compared with the previous frame
+
+// Measured while the frame is converted, when FrameStatistics is set
+typedef struct
+{
+	unsigned long	Histogram[LUMA_HISTOGRAM_BINS];	// Luma samples of each value
+	double			Mean;				// Average luma
+
+	// Differences with the previous frame delivered, if there is one of the
+	// same size. After frames left out by the decimator it is not the one
+	// just before: PreviousDistance counts the frames from it to this one.
+	int				HasPrevious;
+	long			PreviousDistance;	// 1 without decimation, 0 without a previous frame
+	double			MeanAbsDiff;		// Per luma sample
+	long			Blocks;				// Partial blocks at the edges included
+	long			ChangedBlocks;		// Average difference above SCENE_CUT_BLOCK_DIFF
+	int				SceneCut;			// Changed blocks over SCENE_CUT_BLOCK_SHARE percent
+} LumaStatistics;
+
+typedef struct
+{
+	const unsigned char*	Data;			// Planar IYUV (I420), tightly packed
+	long					Size;
+	int						Width;
+	int						Height;
+	long long				Timestamp;		// In the units of the pushed data
+	long long				FrameNumber;	// Display order, from 0 after a flush
+	int						Progressive;
+	const LumaStatistics*	Luma;			// NULL if not measured, valid as Data
+} DecodedFrame;
+
+class FrameSink
+{
+public:
+
+	virtual ~FrameSink() {}
+
+	// Called on the decoding thread. The data is only valid during the
+	// call. Returns false if the frame could not be taken (counted as dropped).
+	virtual bool	OnFrame(const DecodedFrame& inFrame) = 0;
+
+	// All frames of the stream have been delivered
+	virtual void	OnEndOfStream(void) {}
+};
+
+#endif
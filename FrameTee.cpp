@@ -0,0 +1,319 @@
+//------------------------------------------------------------------------------
+// File: FrameTee.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Frame sink handing every frame of one decode session to several
+// outputs.
+//
+// The outputs are called one after the other on the decoding thread.
+// Outputs of the decoded size get the decoder's frame itself; the others
+// get a buffer scaled for the first output of that size and shared with
+// the next ones. The tee holds a reference on each buffer while it hands
+// the frame out, so a buffer no output kept goes straight back to the
+// free list and the next frame reuses it.
+//
+//------------------------------------------------------------------------------
+
+#include "FrameTee.h"
+#include "FrameConverter.h"
+#include "AtomicOps.h"
+#include "PerfTimer.h"
+#include "Trace.h"
+#include <string.h>
+
+FrameBuffer::FrameBuffer() :	m_Owner(NULL),
+								m_References(0),
+								m_Data(NULL),
+								m_Capacity(0),
+								m_Next(NULL)
+{
+	memset(&m_Frame, 0, sizeof(m_Frame));
+}
+
+FrameBuffer::~FrameBuffer()
+{
+	delete [] m_Data;
+}
+
+void FrameBuffer::SetFrame( const DecodedFrame& inFrame )
+{
+	m_Frame = inFrame;
+	m_Frame.Data = m_Data;
+	if (inFrame.Luma)
+	{
+		m_Luma = *inFrame.Luma;
+		m_Frame.Luma = &m_Luma;
+	}
+}
+
+void FrameBuffer::AddRef( void )
+{
+	AtomicIncrement(&m_References);
+}
+
+void FrameBuffer::Release( void )
+{
+	if (AtomicDecrement(&m_References) == 0)
+	{
+		m_Owner->ReturnBuffer(this);
+	}
+}
+
+FrameTee::FrameTee() :	m_Current(NULL),
+						m_CurrentCopy(NULL),
+						m_Free(NULL),
+						m_Buffers(0),
+						m_FramesIn(0),
+						m_FramesScaled(0),
+						m_FramesKept(0),
+						m_ScaleUs(0)
+{
+	memset(m_Outputs, 0, sizeof(m_Outputs));
+}
+
+FrameTee::~FrameTee()
+{
+	while (m_Free)
+	{
+		FrameBuffer* next = m_Free->m_Next;
+		delete m_Free;
+		m_Free = next;
+	}
+}
+
+int FrameTee::AddOutput( FrameSink* inSink, int inWidth, int inHeight )
+{
+	PlatformAutoLock lck(&m_Lock);
+	for (int i=0; i<FRAME_TEE_MAX_OUTPUTS; i++)
+	{
+		if (m_Outputs[i].Sink == NULL)
+		{
+			memset(&m_Outputs[i], 0, sizeof(Output));
+			m_Outputs[i].Sink   = inSink;
+			m_Outputs[i].Width  = (inWidth > 0 && inHeight > 0) ? inWidth & ~1 : 0;
+			m_Outputs[i].Height = (inWidth > 0 && inHeight > 0) ? inHeight & ~1 : 0;
+			return i;
+		}
+	}
+	return -1;
+}
+
+void FrameTee::RemoveOutput( int inOutput )
+{
+	PlatformAutoLock lck(&m_Lock);
+	if (inOutput >= 0 && inOutput < FRAME_TEE_MAX_OUTPUTS)
+	{
+		m_Outputs[inOutput].Sink = NULL;
+	}
+}
+
+FrameBuffer* FrameTee::GetBuffer( long inSize )
+{
+	FrameBuffer* buffer = NULL;
+	{
+		PlatformAutoLock lck(&m_PoolLock);
+		if (m_Free)
+		{
+			buffer = m_Free;
+			m_Free = buffer->m_Next;
+		}
+		else
+		{
+			m_Buffers++;
+		}
+	}
+
+	if (buffer == NULL)
+	{
+		buffer = new FrameBuffer();
+		buffer->m_Owner = this;
+	}
+	if (buffer->m_Capacity < inSize)
+	{
+		delete [] buffer->m_Data;
+		buffer->m_Data = new unsigned char[inSize];
+		buffer->m_Capacity = inSize;
+	}
+	buffer->m_References = 1;
+	buffer->m_Next = NULL;
+	return buffer;
+}
+
+void FrameTee::ReturnBuffer( FrameBuffer* inBuffer )
+{
+	PlatformAutoLock lck(&m_PoolLock);
+	inBuffer->m_Next = m_Free;
+	m_Free = inBuffer;
+}
+
+FrameBuffer* FrameTee::Keep( const DecodedFrame& inFrame )
+{
+	PlatformAutoLock lck(&m_Lock);
+	if (m_Current == NULL)
+	{
+		return NULL;
+	}
+
+	for (int i=0; i<FRAME_TEE_MAX_OUTPUTS; i++)
+	{
+		FrameBuffer* scaled = m_Outputs[i].Scaled;
+		if (scaled && scaled->m_Frame.Data == inFrame.Data)
+		{
+			scaled->AddRef();
+			return scaled;
+		}
+	}
+
+	if (inFrame.Data != m_Current->Data)
+	{
+		return NULL;
+	}
+	if (m_CurrentCopy == NULL)
+	{
+		m_CurrentCopy = this->GetBuffer(m_Current->Size);
+		memcpy(m_CurrentCopy->m_Data, m_Current->Data, m_Current->Size);
+		m_CurrentCopy->SetFrame(*m_Current);
+		m_FramesKept++;
+	}
+	m_CurrentCopy->AddRef();
+	return m_CurrentCopy;
+}
+
+bool FrameTee::OnFrame( const DecodedFrame& inFrame )
+{
+	PlatformAutoLock lck(&m_Lock);
+	bool taken = false;
+
+	m_FramesIn++;
+	m_Current = &inFrame;
+	m_CurrentCopy = NULL;
+
+	for (int i=0; i<FRAME_TEE_MAX_OUTPUTS; i++)
+	{
+		Output& output = m_Outputs[i];
+		if (output.Sink == NULL)
+		{
+			continue;
+		}
+
+		DecodedFrame frame = inFrame;
+		if (output.Width && (output.Width != inFrame.Width || output.Height != inFrame.Height))
+		{
+			// Scaled for an earlier output of the same size, or now
+			for (int j=0; j<i && output.Scaled == NULL; j++)
+			{
+				if (m_Outputs[j].Scaled && m_Outputs[j].Width == output.Width && m_Outputs[j].Height == output.Height)
+				{
+					output.Scaled = m_Outputs[j].Scaled;
+					output.Scaled->AddRef();
+				}
+			}
+			if (output.Scaled == NULL)
+			{
+				TRACE_SCOPE("ScaleIYUV");
+				long long start = PerfTimeUs();
+				long size = (long)output.Width * output.Height * 3 / 2;
+				FrameBuffer* buffer = this->GetBuffer(size);
+
+				ScaleParams sp;
+				sp.src       = inFrame.Data;
+				sp.srcWidth  = inFrame.Width;
+				sp.srcHeight = inFrame.Height;
+				sp.dst       = buffer->m_Data;
+				sp.dstWidth  = output.Width;
+				sp.dstHeight = output.Height;
+				ScaleIYUV(&sp);
+
+				buffer->SetFrame(inFrame);
+				buffer->m_Frame.Size   = size;
+				buffer->m_Frame.Width  = output.Width;
+				buffer->m_Frame.Height = output.Height;
+				output.Scaled = buffer;
+
+				m_FramesScaled++;
+				m_ScaleUs += PerfTimeUs() - start;
+			}
+			frame = output.Scaled->m_Frame;
+		}
+
+		if (output.Sink->OnFrame(frame))
+		{
+			output.Frames++;
+			taken = true;
+		}
+		else
+		{
+			output.Failed++;
+		}
+	}
+
+	// Buffers no output kept go back to the free list
+	for (int i=0; i<FRAME_TEE_MAX_OUTPUTS; i++)
+	{
+		if (m_Outputs[i].Scaled)
+		{
+			m_Outputs[i].Scaled->Release();
+			m_Outputs[i].Scaled = NULL;
+		}
+	}
+	if (m_CurrentCopy)
+	{
+		m_CurrentCopy->Release();
+		m_CurrentCopy = NULL;
+	}
+	m_Current = NULL;
+	return taken;
+}
+
+void FrameTee::OnEndOfStream( void )
+{
+	PlatformAutoLock lck(&m_Lock);
+	for (int i=0; i<FRAME_TEE_MAX_OUTPUTS; i++)
+	{
+		if (m_Outputs[i].Sink)
+			m_Outputs[i].Sink->OnEndOfStream();
+	}
+}
+
+void FrameTee::GetStatistics( FrameTeeStatistics* outStats )
+{
+	PlatformAutoLock lck(&m_Lock);
+	memset(outStats, 0, sizeof(*outStats));
+	outStats->FramesIn     = m_FramesIn;
+	outStats->FramesScaled = m_FramesScaled;
+	outStats->FramesKept   = m_FramesKept;
+	outStats->ScaleUs      = m_ScaleUs;
+	{
+		PlatformAutoLock poolLck(&m_PoolLock);
+		outStats->Buffers = m_Buffers;
+	}
+	for (int i=0; i<FRAME_TEE_MAX_OUTPUTS; i++)
+	{
+		if (m_Outputs[i].Sink == NULL)
+			continue;
+		FrameTeeOutputStatistics& output = outStats->Output[outStats->Outputs++];
+		output.Frames = m_Outputs[i].Frames;
+		output.Failed = m_Outputs[i].Failed;
+		output.Width  = m_Outputs[i].Width;
+		output.Height = m_Outputs[i].Height;
+	}
+}
+
+void FrameTee::Report( const FrameTeeStatistics& inStats, FILE* outFile )
+{
+	fprintf(outFile, "Tee: %lld frames to %ld outputs, %lld scaled in %.3f s, %lld copied to be kept, %ld buffers\n",
+			inStats.FramesIn, inStats.Outputs, inStats.FramesScaled, inStats.ScaleUs / 1000000.0,
+			inStats.FramesKept, inStats.Buffers);
+	for (long i=0; i<inStats.Outputs; i++)
+	{
+		const FrameTeeOutputStatistics& output = inStats.Output[i];
+		if (output.Width)
+			fprintf(outFile, "  %dx%d: ", output.Width, output.Height);
+		else
+			fprintf(outFile, "  decoded size: ");
+		fprintf(outFile, "%lld frames, %lld refused\n", output.Frames, output.Failed);
+	}
+}
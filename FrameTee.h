@@ -0,0 +1,140 @@
+//------------------------------------------------------------------------------
+// File: FrameTee.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Frame sink handing every frame of one decode session to several
+// outputs, for example the full picture to a recorder and a small one to
+// analytics. Each output has its own size; the frame is scaled once per
+// size, into reference-counted buffers the outputs share and may keep
+// after the call.
+//
+//------------------------------------------------------------------------------
+
+#ifndef FRAME_TEE_H_
+#define FRAME_TEE_H_
+
+#include "FrameSink.h"
+#include "Platform.h"
+#include <stdio.h>
+
+#define FRAME_TEE_MAX_OUTPUTS	8
+
+class FrameTee;
+
+// A frame whose data stays valid until the last reference is released.
+// The buffer then goes back to the tee that gave it out.
+class FrameBuffer
+{
+public:
+
+	void	AddRef(void);
+	void	Release(void);
+
+	const DecodedFrame&	GetFrame(void) const { return m_Frame; }
+
+private:
+
+	friend class FrameTee;
+
+	FrameBuffer();
+	~FrameBuffer();
+	FrameBuffer(const FrameBuffer&);
+	FrameBuffer& operator=(const FrameBuffer&);
+
+	// Takes the fields of inFrame, the data are the buffer's own
+	void	SetFrame(const DecodedFrame& inFrame);
+
+	FrameTee*		m_Owner;
+	volatile long	m_References;
+	DecodedFrame	m_Frame;
+	LumaStatistics	m_Luma;
+	unsigned char*	m_Data;
+	long			m_Capacity;
+	FrameBuffer*	m_Next;			// In the free list
+};
+
+typedef struct
+{
+	long long	Frames;				// Taken by the output
+	long long	Failed;				// Refused by the output
+	int			Width;				// 0 for the decoded size
+	int			Height;
+} FrameTeeOutputStatistics;
+
+typedef struct
+{
+	long long	FramesIn;
+	long long	FramesScaled;		// Once per frame and output size
+	long long	FramesKept;			// Decoded frames copied because an output kept them
+	long long	ScaleUs;
+	long		Buffers;			// Allocated, in use or free
+	long		Outputs;
+	FrameTeeOutputStatistics	Output[FRAME_TEE_MAX_OUTPUTS];
+} FrameTeeStatistics;
+
+class FrameTee : public FrameSink
+{
+public:
+
+	FrameTee();
+
+	// The buffers kept by the outputs must have been released
+	virtual ~FrameTee();
+
+	// Adds an output taking the frames scaled to inWidth x inHeight (even
+	// sizes), or as decoded for 0. Returns its index, -1 if there are
+	// FRAME_TEE_MAX_OUTPUTS already.
+	int		AddOutput(FrameSink* inSink, int inWidth = 0, int inHeight = 0);
+	void	RemoveOutput(int inOutput);
+
+	// From an output's OnFrame: the buffer of the frame handed to it, with
+	// a reference the caller releases when done. Scaled frames are shared
+	// as they are, a decoded frame is copied once however many outputs
+	// keep it. NULL for other frames.
+	FrameBuffer*	Keep(const DecodedFrame& inFrame);
+
+	void	GetStatistics(FrameTeeStatistics* outStats);
+	static void	Report(const FrameTeeStatistics& inStats, FILE* outFile);
+
+	// FrameSink. OnFrame succeeds if an output took the frame.
+	bool	OnFrame(const DecodedFrame& inFrame);
+	void	OnEndOfStream(void);
+
+private:
+
+	friend class FrameBuffer;
+
+	typedef struct
+	{
+		FrameSink*		Sink;
+		int				Width;
+		int				Height;
+		FrameBuffer*	Scaled;		// For the frame being handed out
+		long long		Frames;
+		long long		Failed;
+	} Output;
+
+	FrameBuffer*	GetBuffer(long inSize);
+	void	ReturnBuffer(FrameBuffer* inBuffer);
+
+private:
+
+	PlatformLock	m_Lock;			// Outputs and the frame being handed out
+	Output			m_Outputs[FRAME_TEE_MAX_OUTPUTS];
+	const DecodedFrame*	m_Current;
+	FrameBuffer*	m_CurrentCopy;	// Of the decoded frame, once kept
+
+	PlatformLock	m_PoolLock;		// Buffers come back on any thread
+	FrameBuffer*	m_Free;
+	long			m_Buffers;
+
+	long long		m_FramesIn;
+	long long		m_FramesScaled;
+	long long		m_FramesKept;
+	long long		m_ScaleUs;
+};
+
+#endif
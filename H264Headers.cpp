@@ -0,0 +1,354 @@
+//------------------------------------------------------------------------------
+// File: H264Headers.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: CPU parsing of H.264 sequence and picture parameter sets, so
+// the decoder can be set up before the CUDA parser sees a picture.
+//
+//------------------------------------------------------------------------------
+
+#include "H264Headers.h"
+#include "BitReader.h"
+#include "Rbsp.h"
+#include <string.h>
+
+static void SkipScalingList( BitReader& ioReader, int inSize )
+{
+	int lastScale = 8;
+	int nextScale = 8;
+	for (int i=0; i<inSize; i++)
+	{
+		if (nextScale != 0)
+		{
+			nextScale = (lastScale + ioReader.ReadSE() + 256) % 256;
+		}
+		lastScale = (nextScale == 0) ? lastScale : nextScale;
+	}
+}
+
+static void SkipHrdParameters( BitReader& ioReader )
+{
+	unsigned int cpbCount = ioReader.ReadUE() + 1;
+	if (cpbCount > 32)
+	{
+		ioReader.SkipBits(1 << 20);		// Invalid, run into overrun
+		return;
+	}
+	ioReader.SkipBits(8);				// bit_rate_scale, cpb_size_scale
+	for (unsigned int i=0; i<cpbCount; i++)
+	{
+		ioReader.ReadUE();				// bit_rate_value_minus1
+		ioReader.ReadUE();				// cpb_size_value_minus1
+		ioReader.SkipBits(1);			// cbr_flag
+	}
+	ioReader.SkipBits(20);				// Delay and time offset lengths
+}
+
+static void ParseVui( BitReader& ioReader, SequenceInfo* outInfo )
+{
+	if (ioReader.ReadBit())				// aspect_ratio_info_present_flag
+	{
+		static const int sarTable[17][2] =
+		{
+			{ 0, 0 }, { 1, 1 }, { 12, 11 }, { 10, 11 }, { 16, 11 }, { 40, 33 }, { 24, 11 }, { 20, 11 },
+			{ 32, 11 }, { 80, 33 }, { 18, 11 }, { 15, 11 }, { 64, 33 }, { 160, 99 }, { 4, 3 }, { 3, 2 },
+			{ 2, 1 }
+		};
+		unsigned int aspectRatioIdc = ioReader.ReadBits(8);
+		if (aspectRatioIdc == 255)
+		{
+			outInfo->SarWidth  = ioReader.ReadBits(16);
+			outInfo->SarHeight = ioReader.ReadBits(16);
+		}
+		else if (aspectRatioIdc < 17)
+		{
+			outInfo->SarWidth  = sarTable[aspectRatioIdc][0];
+			outInfo->SarHeight = sarTable[aspectRatioIdc][1];
+		}
+	}
+	if (ioReader.ReadBit())				// overscan_info_present_flag
+	{
+		ioReader.SkipBits(1);
+	}
+	if (ioReader.ReadBit())				// video_signal_type_present_flag
+	{
+		ioReader.SkipBits(4);			// video_format, video_full_range_flag
+		if (ioReader.ReadBit())			// colour_description_present_flag
+			ioReader.SkipBits(24);
+	}
+	if (ioReader.ReadBit())				// chroma_loc_info_present_flag
+	{
+		ioReader.ReadUE();
+		ioReader.ReadUE();
+	}
+	if (ioReader.ReadBit())				// timing_info_present_flag
+	{
+		outInfo->NumUnitsInTick = ioReader.ReadBits(32);
+		outInfo->TimeScale      = ioReader.ReadBits(32);
+		outInfo->FixedFrameRate = ioReader.ReadBit();
+	}
+	int nalHrd = ioReader.ReadBit();
+	if (nalHrd)
+		SkipHrdParameters(ioReader);
+	int vclHrd = ioReader.ReadBit();
+	if (vclHrd)
+		SkipHrdParameters(ioReader);
+	if (nalHrd || vclHrd)
+		ioReader.SkipBits(1);			// low_delay_hrd_flag
+	ioReader.SkipBits(1);				// pic_struct_present_flag
+	if (ioReader.ReadBit())				// bitstream_restriction_flag
+	{
+		ioReader.SkipBits(1);			// motion_vectors_over_pic_boundaries_flag
+		ioReader.ReadUE();				// max_bytes_per_pic_denom
+		ioReader.ReadUE();				// max_bits_per_mb_denom
+		ioReader.ReadUE();				// log2_max_mv_length_horizontal
+		ioReader.ReadUE();				// log2_max_mv_length_vertical
+		outInfo->MaxNumReorderFrames  = ioReader.ReadUE();
+		outInfo->MaxDecFrameBuffering = ioReader.ReadUE();
+	}
+}
+
+bool ParseSequenceParameterSet( const unsigned char* inData, long inLength, SequenceInfo* outInfo )
+{
+	RbspBuffer rbsp(inData, inLength);
+	BitReader reader(rbsp.GetData(), rbsp.GetLength());
+
+	memset(outInfo, 0, sizeof(*outInfo));
+	outInfo->ChromaFormatIdc      = 1;
+	outInfo->BitDepthLuma         = 8;
+	outInfo->MaxNumReorderFrames  = -1;
+	outInfo->MaxDecFrameBuffering = -1;
+
+	outInfo->ProfileIdc = reader.ReadBits(8);
+	reader.SkipBits(8);					// Constraint flags
+	outInfo->LevelIdc   = reader.ReadBits(8);
+	outInfo->SpsId      = reader.ReadUE();
+	if (outInfo->SpsId > 31)
+		return false;
+
+	int separateColourPlane = 0;
+	switch (outInfo->ProfileIdc)
+	{
+	case 100: case 110: case 122: case 244: case 44:
+	case 83: case 86: case 118: case 128: case 138: case 139: case 134: case 135:
+		outInfo->ChromaFormatIdc = reader.ReadUE();
+		if (outInfo->ChromaFormatIdc > 3)
+			return false;
+		if (outInfo->ChromaFormatIdc == 3)
+			separateColourPlane = reader.ReadBit();
+		outInfo->BitDepthLuma = reader.ReadUE() + 8;
+		reader.ReadUE();				// bit_depth_chroma_minus8
+		reader.SkipBits(1);				// qpprime_y_zero_transform_bypass_flag
+		if (reader.ReadBit())			// seq_scaling_matrix_present_flag
+		{
+			int lists = (outInfo->ChromaFormatIdc != 3) ? 8 : 12;
+			for (int i=0; i<lists; i++)
+			{
+				if (reader.ReadBit())
+					SkipScalingList(reader, i < 6 ? 16 : 64);
+			}
+		}
+		break;
+	}
+
+	outInfo->Log2MaxFrameNum = reader.ReadUE() + 4;
+	outInfo->PicOrderCntType = reader.ReadUE();
+	if (outInfo->PicOrderCntType == 0)
+	{
+		outInfo->Log2MaxPocLsb = reader.ReadUE() + 4;
+	}
+	else if (outInfo->PicOrderCntType == 1)
+	{
+		reader.SkipBits(1);				// delta_pic_order_always_zero_flag
+		reader.ReadSE();				// offset_for_non_ref_pic
+		reader.ReadSE();				// offset_for_top_to_bottom_field
+		unsigned int cycle = reader.ReadUE();
+		if (cycle > 255)
+			return false;
+		for (unsigned int i=0; i<cycle; i++)
+		{
+			reader.ReadSE();
+		}
+	}
+	else if (outInfo->PicOrderCntType != 2)
+	{
+		return false;
+	}
+
+	outInfo->MaxNumRefFrames = reader.ReadUE();
+	reader.SkipBits(1);					// gaps_in_frame_num_value_allowed_flag
+	unsigned int widthInMbs      = reader.ReadUE() + 1;
+	unsigned int heightInMapUnits = reader.ReadUE() + 1;
+	outInfo->FrameMbsOnly = reader.ReadBit();
+	if (!outInfo->FrameMbsOnly)
+		reader.SkipBits(1);				// mb_adaptive_frame_field_flag
+	reader.SkipBits(1);					// direct_8x8_inference_flag
+
+	if (widthInMbs > 1024 || heightInMapUnits > 1024)
+		return false;
+	outInfo->CodedWidth  = widthInMbs * 16;
+	outInfo->CodedHeight = heightInMapUnits * 16 * (2 - outInfo->FrameMbsOnly);
+
+	if (reader.ReadBit())				// frame_cropping_flag
+	{
+		int chromaArrayType = separateColourPlane ? 0 : outInfo->ChromaFormatIdc;
+		int cropUnitX = (chromaArrayType == 1 || chromaArrayType == 2) ? 2 : 1;
+		int cropUnitY = (chromaArrayType == 1 ? 2 : 1) * (2 - outInfo->FrameMbsOnly);
+
+		outInfo->CropLeft   = reader.ReadUE() * cropUnitX;
+		outInfo->CropRight  = reader.ReadUE() * cropUnitX;
+		outInfo->CropTop    = reader.ReadUE() * cropUnitY;
+		outInfo->CropBottom = reader.ReadUE() * cropUnitY;
+	}
+	outInfo->DisplayWidth  = outInfo->CodedWidth - outInfo->CropLeft - outInfo->CropRight;
+	outInfo->DisplayHeight = outInfo->CodedHeight - outInfo->CropTop - outInfo->CropBottom;
+	if (outInfo->DisplayWidth <= 0 || outInfo->DisplayHeight <= 0)
+		return false;
+
+	if (reader.ReadBit())				// vui_parameters_present_flag
+		ParseVui(reader, outInfo);
+
+	return !reader.IsOverrun();
+}
+
+bool ParsePictureParameterSet( const unsigned char* inData, long inLength, PictureInfo* outInfo )
+{
+	RbspBuffer rbsp(inData, inLength);
+	BitReader reader(rbsp.GetData(), rbsp.GetLength());
+
+	memset(outInfo, 0, sizeof(*outInfo));
+	outInfo->PpsId = reader.ReadUE();
+	outInfo->SpsId = reader.ReadUE();
+	outInfo->EntropyCodingMode          = reader.ReadBit();
+	outInfo->BottomFieldPicOrderPresent = reader.ReadBit();
+
+	return !reader.IsOverrun() && outInfo->PpsId <= 255 && outInfo->SpsId <= 31;
+}
+
+bool ParseSliceHeader( const unsigned char* inData, long inLength, SliceInfo* outInfo )
+{
+	// Three ue(v) of at most 8 bytes each, escapes beyond are not needed
+	RbspBuffer rbsp(inData, inLength < SLICE_HEADER_PREFIX ? inLength : SLICE_HEADER_PREFIX);
+	BitReader reader(rbsp.GetData(), rbsp.GetLength());
+
+	outInfo->FirstMbInSlice = reader.ReadUE();
+	unsigned int sliceType  = reader.ReadUE();
+	outInfo->PpsId          = reader.ReadUE();
+	if (reader.IsOverrun() || sliceType > 9 || outInfo->PpsId > 255)
+		return false;
+
+	outInfo->SliceType = sliceType % 5;
+	return true;
+}
+
+long FindNalUnit( const unsigned char* inData, long inLength, long inOffset, long* outLength )
+{
+	long start = -1;
+	for (long i = inOffset; i + 2 < inLength; i++)
+	{
+		// Skip ahead until the third byte could end a start code
+		if (inData[i + 2] > 1)
+		{
+			i += 2;
+			continue;
+		}
+		if (inData[i] == 0 && inData[i + 1] == 0 && inData[i + 2] == 1)
+		{
+			if (start >= 0)
+			{
+				// A trailing zero belongs to a four byte start code
+				long end = i;
+				if (end > start && inData[end - 1] == 0)
+					end--;
+				*outLength = end - start;
+				return start;
+			}
+			start = i + 3;
+			i += 2;
+		}
+	}
+	if (start < 0 || start >= inLength)
+		return -1;
+
+	*outLength = inLength - start;
+	return start;
+}
+
+bool FindSequenceParameterSet( const unsigned char* inData, long inLength, SequenceInfo* outInfo )
+{
+	long length = 0;
+	for (long offset = FindNalUnit(inData, inLength, 0, &length); offset >= 0;
+		 offset = FindNalUnit(inData, inLength, offset + length, &length))
+	{
+		if (length > 1 && (inData[offset] & 0x1f) == NAL_TYPE_SPS &&
+			ParseSequenceParameterSet(inData + offset + 1, length - 1, outInfo))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool MayContainNalUnit( const unsigned char* inData, long inLength, int inType )
+{
+	long length = 0;
+	for (long offset = FindNalUnit(inData, inLength, 0, &length); offset >= 0;
+		 offset = FindNalUnit(inData, inLength, offset + length, &length))
+	{
+		if ((inData[offset] & 0x1f) == inType)
+			return true;
+	}
+
+	// 00 00, 00 00 01 or a final 00 could be continued by the next buffer
+	if (inLength >= 3 && inData[inLength - 3] == 0 && inData[inLength - 2] == 0 && inData[inLength - 1] == 1)
+		return true;
+	return inLength >= 1 && inData[inLength - 1] == 0;
+}
+
+int GetDpbFrames( const SequenceInfo& inInfo )
+{
+	// Table A-1, MaxDpbMbs per level_idc
+	static const struct { int Level; int MaxDpbMbs; } levelLimits[] =
+	{
+		{ 9, 396 }, { 10, 396 }, { 11, 900 }, { 12, 2376 }, { 13, 2376 },
+		{ 20, 2376 }, { 21, 4752 }, { 22, 8100 }, { 30, 8100 }, { 31, 18000 },
+		{ 32, 20480 }, { 40, 32768 }, { 41, 32768 }, { 42, 34816 }, { 50, 110400 },
+		{ 51, 184320 }, { 52, 184320 }, { 60, 696320 }, { 61, 696320 }, { 62, 696320 }
+	};
+
+	if (inInfo.MaxDecFrameBuffering >= 0)
+	{
+		int frames = inInfo.MaxDecFrameBuffering;
+		if (frames < inInfo.MaxNumRefFrames)
+			frames = inInfo.MaxNumRefFrames;
+		return frames < 1 ? 1 : (frames > 16 ? 16 : frames);
+	}
+
+	int maxDpbMbs = 0;
+	for (int i=0; i<(int)(sizeof(levelLimits) / sizeof(levelLimits[0])); i++)
+	{
+		if (levelLimits[i].Level == inInfo.LevelIdc)
+			maxDpbMbs = levelLimits[i].MaxDpbMbs;
+	}
+	// Unknown level, assume the worst
+	if (maxDpbMbs == 0)
+		return 16;
+
+	int frameMbs = (inInfo.CodedWidth / 16) * (inInfo.CodedHeight / 16);
+	int frames = maxDpbMbs / frameMbs;
+	if (frames < inInfo.MaxNumRefFrames)
+		frames = inInfo.MaxNumRefFrames;
+	return frames < 1 ? 1 : (frames > 16 ? 16 : frames);
+}
+
+double GetFrameRate( const SequenceInfo& inInfo )
+{
+	if (inInfo.NumUnitsInTick == 0 || inInfo.TimeScale == 0)
+		return 0;
+
+	// Two ticks per frame
+	return inInfo.TimeScale / (2.0 * inInfo.NumUnitsInTick);
+}
@@ -0,0 +1,105 @@
+//------------------------------------------------------------------------------
+// File: H264Headers.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: CPU parsing of H.264 sequence and picture parameter sets, so
+// the decoder can be set up before the CUDA parser sees a picture, and
+// of the start of slice headers.
+//
+//------------------------------------------------------------------------------
+
+#ifndef H264_HEADERS_H_
+#define H264_HEADERS_H_
+
+#define NAL_TYPE_SLICE			1
+#define NAL_TYPE_IDR			5
+#define NAL_TYPE_SEI			6
+#define NAL_TYPE_SPS			7
+#define NAL_TYPE_PPS			8
+#define NAL_TYPE_AUD			9
+
+#define SLICE_TYPE_P			0
+#define SLICE_TYPE_B			1
+#define SLICE_TYPE_I			2
+#define SLICE_TYPE_SP			3
+#define SLICE_TYPE_SI			4
+
+#define SLICE_HEADER_PREFIX		32		// Payload bytes ParseSliceHeader looks at
+
+typedef struct
+{
+	int				ProfileIdc;
+	int				LevelIdc;
+	int				SpsId;
+	int				ChromaFormatIdc;		// 0 monochrome, 1 4:2:0, 2 4:2:2, 3 4:4:4
+	int				BitDepthLuma;
+	int				FrameMbsOnly;
+	int				MaxNumRefFrames;
+	int				Log2MaxFrameNum;
+	int				PicOrderCntType;
+	int				Log2MaxPocLsb;
+
+	int				CodedWidth;				// Whole macroblocks
+	int				CodedHeight;
+	int				CropLeft;				// Luma samples
+	int				CropRight;
+	int				CropTop;
+	int				CropBottom;
+	int				DisplayWidth;
+	int				DisplayHeight;
+
+	int				SarWidth;				// 0 if not signalled
+	int				SarHeight;
+	unsigned int	NumUnitsInTick;			// 0 if not signalled
+	unsigned int	TimeScale;
+	int				FixedFrameRate;
+	int				MaxNumReorderFrames;	// -1 if not signalled
+	int				MaxDecFrameBuffering;	// -1 if not signalled
+} SequenceInfo;
+
+typedef struct
+{
+	int				PpsId;
+	int				SpsId;
+	int				EntropyCodingMode;		// 1 for CABAC
+	int				BottomFieldPicOrderPresent;
+} PictureInfo;
+
+typedef struct
+{
+	unsigned int	FirstMbInSlice;
+	int				SliceType;				// SLICE_TYPE_xxx
+	unsigned int	PpsId;
+} SliceInfo;
+
+// inData is the NAL unit payload after the one-byte header
+bool	ParseSequenceParameterSet(const unsigned char* inData, long inLength, SequenceInfo* outInfo);
+bool	ParsePictureParameterSet(const unsigned char* inData, long inLength, PictureInfo* outInfo);
+
+// The fields of a slice header that need no parameter set, from the
+// payload of a NAL unit of type 1 or 5
+bool	ParseSliceHeader(const unsigned char* inData, long inLength, SliceInfo* outInfo);
+
+// Finds the next NAL unit of an Annex B stream at or after inOffset.
+// Returns its header offset and sets outLength up to the next start code,
+// -1 if there is none.
+long	FindNalUnit(const unsigned char* inData, long inLength, long inOffset, long* outLength);
+
+// First valid SPS of an Annex B buffer
+bool	FindSequenceParameterSet(const unsigned char* inData, long inLength, SequenceInfo* outInfo);
+
+// True if a NAL unit of the type starts in the buffer, or may start right
+// after it because the buffer ends in part of a start code
+bool	MayContainNalUnit(const unsigned char* inData, long inLength, int inType);
+
+// Frames the DPB must hold: max_dec_frame_buffering if signalled, the
+// level limit (MaxDpbMbs) for the picture size otherwise
+int		GetDpbFrames(const SequenceInfo& inInfo);
+
+// Frame rate from the VUI timing, 0 if not signalled
+double	GetFrameRate(const SequenceInfo& inInfo);
+
+#endif
@@ -0,0 +1,151 @@
+//------------------------------------------------------------------------------
+// File: MappedFile.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Read-only memory mapping of a whole file, so that a stream can
+// be handed to the decoder straight from the page cache.
+//
+//------------------------------------------------------------------------------
+
+#include "MappedFile.h"
+#include <stdio.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() :	m_Data(NULL),
+							m_Size(0),
+#ifdef _WIN32
+							m_File(INVALID_HANDLE_VALUE),
+							m_Mapping(NULL)
+#else
+							m_File(-1)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+	this->Close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open( const char* inPath )
+{
+	LARGE_INTEGER size;
+
+	this->Close();
+
+	m_File = CreateFileA(inPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+						 FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (m_File == INVALID_HANDLE_VALUE)
+	{
+		printf("Cannot open %s\n", inPath);
+		return false;
+	}
+
+	if (!GetFileSizeEx(m_File, &size) || size.QuadPart == 0)
+	{
+		printf("%s is empty\n", inPath);
+		this->Close();
+		return false;
+	}
+
+	m_Mapping = CreateFileMapping(m_File, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m_Mapping != NULL)
+	{
+		m_Data = (const unsigned char*)MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0);
+	}
+	if (m_Data == NULL)
+	{
+		printf("Cannot map %s\n", inPath);
+		this->Close();
+		return false;
+	}
+
+	m_Size = size.QuadPart;
+	return true;
+}
+
+void MappedFile::Close( void )
+{
+	if (m_Data)
+	{
+		UnmapViewOfFile(m_Data);
+		m_Data = NULL;
+	}
+	if (m_Mapping)
+	{
+		CloseHandle(m_Mapping);
+		m_Mapping = NULL;
+	}
+	if (m_File != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_File);
+		m_File = INVALID_HANDLE_VALUE;
+	}
+	m_Size = 0;
+}
+
+#else
+
+bool MappedFile::Open( const char* inPath )
+{
+	struct stat info;
+
+	this->Close();
+
+	m_File = open(inPath, O_RDONLY);
+	if (m_File < 0)
+	{
+		printf("Cannot open %s\n", inPath);
+		return false;
+	}
+
+	if (fstat(m_File, &info) != 0 || info.st_size == 0)
+	{
+		printf("%s is empty\n", inPath);
+		this->Close();
+		return false;
+	}
+
+	void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, m_File, 0);
+	if (data == MAP_FAILED)
+	{
+		printf("Cannot map %s\n", inPath);
+		this->Close();
+		return false;
+	}
+
+	// Read ahead aggressively, the pages behind are not needed again
+	madvise(data, info.st_size, MADV_SEQUENTIAL);
+
+	m_Data = (const unsigned char*)data;
+	m_Size = info.st_size;
+	return true;
+}
+
+void MappedFile::Close( void )
+{
+	if (m_Data)
+	{
+		munmap((void*)m_Data, m_Size);
+		m_Data = NULL;
+	}
+	if (m_File >= 0)
+	{
+		close(m_File);
+		m_File = -1;
+	}
+	m_Size = 0;
+}
+
+#endif
@@ -0,0 +1,53 @@
+//------------------------------------------------------------------------------
+// File: MappedFile.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Read-only memory mapping of a whole file, so that a stream can
+// be handed to the decoder straight from the page cache.
+//
+//------------------------------------------------------------------------------
+
+#ifndef MAPPED_FILE_H_
+#define MAPPED_FILE_H_
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+class MappedFile
+{
+public:
+
+	MappedFile();
+	virtual ~MappedFile();
+
+	// Maps the file for sequential reading. Returns false if it cannot be
+	// opened or is empty.
+	bool	Open(const char* inPath);
+	void	Close(void);
+
+	const unsigned char*	Data(void) const { return m_Data; }
+	long long				Size(void) const { return m_Size; }
+
+private:
+
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+private:
+
+	const unsigned char*	m_Data;
+	long long				m_Size;
+
+#ifdef _WIN32
+	HANDLE		m_File;
+	HANDLE		m_Mapping;
+#else
+	int			m_File;
+#endif
+};
+
+#endif
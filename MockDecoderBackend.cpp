@@ -0,0 +1,310 @@
+//------------------------------------------------------------------------------
+// File: MockDecoderBackend.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Decoder backend without a GPU. It follows the NAL units of the
+// stream and hands out one synthetic frame of the SPS size per picture,
+// so the session, the sinks and the filter can be run and measured on
+// any host.
+//
+//------------------------------------------------------------------------------
+
+#include "MockDecoderBackend.h"
+#include "DecoderStats.h"
+#include "PerfTimer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+MockDecoderBackend::MockDecoderBackend( int inDecodeUs, int inCreateUs ) :
+							m_DecodeUs(inDecodeUs),
+							m_CreateUs(inCreateUs),
+							m_Sink(NULL),
+							m_Stats(NULL),
+							m_Pending(NULL),
+							m_PendingSize(0),
+							m_PendingCapacity(0),
+							m_HasSequence(false),
+							m_TargetWidth(0),
+							m_TargetHeight(0),
+							m_Width(0),
+							m_Height(0),
+							m_ConfigMaxWidth(0),
+							m_ConfigMaxHeight(0),
+							m_MaxWidth(0),
+							m_MaxHeight(0),
+							m_Frame(NULL),
+							m_FrameCapacity(0),
+							m_FrameCount(0)
+{
+	memset(&m_Sequence, 0, sizeof(m_Sequence));
+}
+
+MockDecoderBackend::~MockDecoderBackend()
+{
+	free(m_Pending);
+	delete [] m_Frame;
+}
+
+bool MockDecoderBackend::Init( const DecoderSettings& settings, FrameSink* sink, DecoderStats* stats )
+{
+	m_Sink = sink;
+	m_Stats = stats;
+	m_PendingSize = 0;
+	m_Timestamps.Clear();
+	m_HasSequence = false;
+	m_FrameCount = 0;
+	m_ConfigMaxWidth = settings.MaxWidth;
+	m_ConfigMaxHeight = settings.MaxHeight;
+	m_MaxWidth = 0;
+	m_MaxHeight = 0;
+	m_Decimator.Configure(settings.OutputStride, settings.OutputFrameRate);
+
+	// Like the CUDA decoder, the allocation covers the configured maximum
+	if (settings.MaxWidth > 0 && settings.MaxHeight > 0)
+	{
+		m_FrameCapacity = settings.MaxWidth * settings.MaxHeight * 3 / 2;
+		delete [] m_Frame;
+		m_Frame = new unsigned char[m_FrameCapacity];
+	}
+	return true;
+}
+
+bool MockDecoderBackend::Decode( const unsigned char* inData, long inLength, long long inTimestamp )
+{
+	bool flush = (inLength <= 0);
+
+	if (!flush)
+	{
+		if (m_PendingSize + inLength > m_PendingCapacity)
+		{
+			long capacity = (m_PendingSize + inLength) * 2;
+			unsigned char* pending = (unsigned char*)realloc(m_Pending, capacity);
+			if (pending == NULL)
+				return false;
+			m_Pending = pending;
+			m_PendingCapacity = capacity;
+		}
+		m_Timestamps.Push(m_PendingSize, inTimestamp);
+		memcpy(m_Pending + m_PendingSize, inData, inLength);
+		m_PendingSize += inLength;
+	}
+
+	// Only the NAL units followed by a start code are complete, the last
+	// one may go on in the next call
+	long keep = m_PendingSize > 3 ? m_PendingSize - 3 : 0;
+	long length = 0;
+	long offset = FindNalUnit(m_Pending, m_PendingSize, 0, &length);
+	while (offset >= 0)
+	{
+		long nextLength = 0;
+		long next = FindNalUnit(m_Pending, m_PendingSize, offset + length, &nextLength);
+		if (next < 0 && !flush)
+		{
+			keep = offset - 3;
+			break;
+		}
+		this->ProcessNalUnit(offset, length);
+		offset = next;
+		length = nextLength;
+		keep = m_PendingSize;
+	}
+
+	if (flush)
+	{
+		m_PendingSize = 0;
+		m_Timestamps.Clear();
+		m_Decimator.Reset();
+		return false;
+	}
+	memmove(m_Pending, m_Pending + keep, m_PendingSize - keep);
+	m_PendingSize -= keep;
+	m_Timestamps.Drop(keep);
+	return true;
+}
+
+void MockDecoderBackend::ProcessNalUnit( long inOffset, long inLength )
+{
+	const unsigned char* nal = m_Pending + inOffset;
+	if (inLength < 2)
+		return;
+
+	int type = nal[0] & 0x1f;
+	if (type == NAL_TYPE_SPS)
+	{
+		SequenceInfo sps;
+		if (ParseSequenceParameterSet(nal + 1, inLength - 1, &sps))
+			this->SetSequence(sps);
+	}
+	// A new picture starts with first_mb_in_slice = 0, coded as a single 1 bit
+	else if ((type == NAL_TYPE_SLICE || type == NAL_TYPE_IDR) && (nal[1] & 0x80) && m_HasSequence)
+	{
+		this->OutputPicture(m_Timestamps.Take(inOffset), (nal[0] & 0x60) != 0);
+	}
+}
+
+bool MockDecoderBackend::PrepareSequence( const SequenceInfo& inSps )
+{
+	if (m_HasSequence)
+		return true;
+	return this->SetSequence(inSps);
+}
+
+bool MockDecoderBackend::SetSequence( const SequenceInfo& inSps )
+{
+	if (m_HasSequence && inSps.DisplayWidth == m_Sequence.DisplayWidth &&
+		inSps.DisplayHeight == m_Sequence.DisplayHeight)
+	{
+		return true;
+	}
+
+	long long switchStart = PerfTimeUs();
+	bool had_sequence = m_HasSequence;
+
+	m_Sequence = inSps;
+	if (GetFrameRate(inSps) > 0)
+		m_Decimator.SetFrameDuration((long long)(10000000 / GetFrameRate(inSps)));
+	m_Width = m_TargetWidth ? m_TargetWidth : inSps.DisplayWidth;
+	m_Height = m_TargetHeight ? m_TargetHeight : inSps.DisplayHeight;
+
+	// Grown only, as the host buffers of the CUDA decoder
+	long size = (long)m_Width * m_Height * 3 / 2;
+	if (size > m_FrameCapacity)
+	{
+		delete [] m_Frame;
+		m_Frame = new unsigned char[size];
+		m_FrameCapacity = size;
+	}
+
+	// As the CUDA decoder: reconfigured in place within the size it was
+	// created for, recreated for a larger one
+	bool in_place = had_sequence && inSps.DisplayWidth <= m_MaxWidth &&
+					inSps.DisplayHeight <= m_MaxHeight;
+	if (!in_place)
+	{
+		this->CreateDecoder(inSps);
+	}
+	m_HasSequence = true;
+
+	if (had_sequence && m_Stats)
+	{
+		m_Stats->AddSequenceSwitch(PerfTimeUs() - switchStart, in_place);
+	}
+	return true;
+}
+
+// For the configured maximum size, or the sequence's if larger
+void MockDecoderBackend::CreateDecoder( const SequenceInfo& inSps )
+{
+	m_MaxWidth = inSps.DisplayWidth > m_ConfigMaxWidth ? inSps.DisplayWidth : m_ConfigMaxWidth;
+	m_MaxHeight = inSps.DisplayHeight > m_ConfigMaxHeight ? inSps.DisplayHeight : m_ConfigMaxHeight;
+
+	long long start = PerfTimeUs();
+	if (m_CreateUs > 0)
+	{
+		while (PerfTimeUs() - start < m_CreateUs)
+			;
+	}
+}
+
+// A frame that changes over time, so sinks do not see identical data.
+// Pictures left out by the decimator are not filled in, and at low rates
+// the non-reference ones take no decoding time either.
+void MockDecoderBackend::OutputPicture( long long inTimestamp, bool inReference )
+{
+	bool decoded = inReference || !m_Decimator.SkipNonReference();
+
+	long long start = PerfTimeUs();
+	if (m_DecodeUs > 0 && decoded)
+	{
+		while (PerfTimeUs() - start < m_DecodeUs)
+			;
+	}
+
+	if (!m_Decimator.Next(decoded))
+	{
+		if (m_Stats && decoded)
+			m_Stats->AddFrameDecimated();
+		else if (m_Stats)
+			m_Stats->AddPictureSkipped();
+		m_FrameCount++;
+		return;
+	}
+
+	long lumaSize = (long)m_Width * m_Height;
+	unsigned char* luma = m_Frame;
+	for (int y = 0; y < m_Height; y++)
+	{
+		memset(luma, (y + m_FrameCount) & 0xff, m_Width);
+		luma += m_Width;
+	}
+	memset(m_Frame + lumaSize, 128, lumaSize / 2);
+
+	DecodedFrame frame;
+	frame.Data = m_Frame;
+	frame.Size = lumaSize * 3 / 2;
+	frame.Width = m_Width;
+	frame.Height = m_Height;
+	frame.Timestamp = inTimestamp;
+	frame.FrameNumber = m_FrameCount;
+	frame.Progressive = m_Sequence.FrameMbsOnly;
+	frame.Luma = NULL;
+
+	long long convertStart = PerfTimeUs();
+	bool delivered = m_Sink->OnFrame(frame);
+	if (m_Stats)
+	{
+		long long now = PerfTimeUs();
+		if (delivered)
+		{
+			m_Stats->AddLatency(STAT_CONVERT_TO_DELIVER, now - convertStart);
+			m_Stats->AddFrameDelivered(now);
+		}
+		else
+		{
+			m_Stats->AddFrameDropped();
+		}
+	}
+	m_FrameCount++;
+}
+
+bool MockDecoderBackend::HasDecoder( void )
+{
+	return m_HasSequence;
+}
+
+void MockDecoderBackend::SetTargetSize( int inWidth, int inHeight )
+{
+	m_TargetWidth = inWidth;
+	m_TargetHeight = inHeight;
+}
+
+void MockDecoderBackend::SetSequenceHint( bool inSequence )
+{
+	(void)inSequence;
+}
+
+void MockDecoderBackend::SetDeinterlaceMode( int inMode )
+{
+	(void)inMode;
+}
+
+void MockDecoderBackend::SetFrameDuration( long long inDuration )
+{
+	m_Decimator.SetFrameDuration(inDuration);
+}
+
+int MockDecoderBackend::GetFrameCount( void ) const
+{
+	return m_FrameCount;
+}
+
+void MockDecoderBackend::GetSurfaceUsage( long* outSurfaces, long long* outDeviceBytes, long long* outHostBytes )
+{
+	*outSurfaces = 0;
+	*outDeviceBytes = 0;
+	*outHostBytes = m_FrameCapacity + m_PendingCapacity;
+}
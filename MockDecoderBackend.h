@@ -0,0 +1,80 @@
+//------------------------------------------------------------------------------
+// File: MockDecoderBackend.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Decoder backend without a GPU. It follows the NAL units of the
+// stream and hands out one synthetic frame of the SPS size per picture,
+// so the session, the sinks and the filter can be run and measured on
+// any host.
+//
+//------------------------------------------------------------------------------
+
+#ifndef MOCK_DECODER_BACKEND_H_
+#define MOCK_DECODER_BACKEND_H_
+
+#include "DecoderBackend.h"
+#include "FrameDecimator.h"
+
+class MockDecoderBackend : public DecoderBackend
+{
+public:
+
+	// Each picture keeps the decoding thread busy for inDecodeUs, and
+	// creating the decoder for inCreateUs, to model the time a real
+	// decoder takes
+	MockDecoderBackend(int inDecodeUs = 0, int inCreateUs = 0);
+	virtual ~MockDecoderBackend();
+
+	// DecoderBackend
+	bool	Init(const DecoderSettings& settings, FrameSink* sink, DecoderStats* stats);
+	bool	Decode(const unsigned char* inData, long inLength, long long inTimestamp);
+	bool	PrepareSequence(const SequenceInfo& inSps);
+	bool	HasDecoder(void);
+	void	SetTargetSize(int inWidth, int inHeight);
+	void	SetSequenceHint(bool inSequence);
+	void	SetDeinterlaceMode(int inMode);
+	void	SetFrameDuration(long long inDuration);
+	int		GetFrameCount(void) const;
+	void	GetSurfaceUsage(long* outSurfaces, long long* outDeviceBytes, long long* outHostBytes);
+
+private:
+
+	void	ProcessNalUnit(long inOffset, long inLength);
+	bool	SetSequence(const SequenceInfo& inSps);
+	void	CreateDecoder(const SequenceInfo& inSps);
+	void	OutputPicture(long long inTimestamp, bool inReference);
+
+private:
+
+	int				m_DecodeUs;
+	int				m_CreateUs;
+	FrameSink*		m_Sink;
+	DecoderStats*	m_Stats;
+
+	// Data after the last complete NAL unit
+	unsigned char*	m_Pending;
+	long			m_PendingSize;
+	long			m_PendingCapacity;
+	TimestampQueue	m_Timestamps;		// Of m_Pending
+
+	bool			m_HasSequence;
+	SequenceInfo	m_Sequence;
+	int				m_TargetWidth;
+	int				m_TargetHeight;
+	int				m_Width;
+	int				m_Height;
+	int				m_ConfigMaxWidth;	// Of the settings, 0 if not set
+	int				m_ConfigMaxHeight;
+	int				m_MaxWidth;			// The decoder was created for, 0 if none
+	int				m_MaxHeight;
+
+	unsigned char*	m_Frame;
+	long			m_FrameCapacity;
+	int				m_FrameCount;
+	FrameDecimator	m_Decimator;
+};
+
+#endif
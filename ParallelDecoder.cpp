@@ -0,0 +1,537 @@
+//------------------------------------------------------------------------------
+// File: ParallelDecoder.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Decodes a whole elementary stream faster than one parser can, for
+// offline jobs.
+//
+// An IDR picture starts a closed GOP: nothing after it refers to a picture
+// before it, so the stream can be cut in front of its access unit. The cuts
+// are made no closer than a fraction of the stream, so that every session
+// gets several segments of about the same size. Each segment is decoded
+// from the SPS and PPS last seen before it, then its session is drained.
+//
+// The segments are taken in stream order. The frames of the oldest segment
+// not done go to the sink directly, those of later segments are copied
+// until it is their turn. A session may not start a segment more than
+// PARALLEL_WINDOW segments per session ahead of the output, which bounds
+// the copies to that many segments.
+//
+//------------------------------------------------------------------------------
+
+#include "ParallelDecoder.h"
+#include "H264Headers.h"
+#include "AtomicOps.h"
+#include "PerfTimer.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define PARALLEL_INDEX_SIZE		256		// Initial segments and parameter sets, they grow
+
+// Hands the frames of a session to the reorder buffer, tagged with the
+// segment it decodes
+class ParallelWorkerSink : public FrameSink
+{
+public:
+
+	ParallelWorkerSink(ParallelDecoder* inDecoder, ParallelDecoder::Worker* inWorker)
+		:	m_Decoder(inDecoder),
+			m_Worker(inWorker)
+	{
+	}
+
+	bool OnFrame( const DecodedFrame& inFrame )
+	{
+		m_Decoder->OnSegmentFrame(m_Worker->Current, inFrame);
+		return true;
+	}
+
+	// Each segment drains the session, the stream ends after the last one
+	void OnEndOfStream( void )
+	{
+	}
+
+private:
+
+	ParallelDecoder*			m_Decoder;
+	ParallelDecoder::Worker*	m_Worker;
+};
+
+ParallelDecoder::ParallelDecoder()
+	:	m_Sink(NULL),
+		m_SessionCount(0),
+		m_Sessions(NULL),
+		m_Workers(NULL),
+		m_OutputWidth(0),
+		m_OutputHeight(0),
+		m_FrameDuration(0),
+		m_Data(NULL),
+		m_Segments(NULL),
+		m_SegmentCount(0),
+		m_SegmentCapacity(0),
+		m_ParameterSets(NULL),
+		m_ParameterSetCount(0),
+		m_ParameterSetCapacity(0),
+		m_NextSegment(0),
+		m_Window(NULL),
+		m_Head(0),
+		m_FramesOutput(0),
+		m_FramesReordered(0),
+		m_BufferedBytes(0),
+		m_PeakBufferedBytes(0),
+		m_IndexUs(0),
+		m_DecodeUs(0),
+		m_BusyUs(0),
+		m_LongestSegmentUs(0),
+		m_Failed(false)
+{
+	memset(&m_Settings, 0, sizeof(m_Settings));
+}
+
+ParallelDecoder::~ParallelDecoder()
+{
+	this->Close();
+}
+
+void ParallelDecoder::SetOutputFrameSize( int inWidth, int inHeight )
+{
+	m_OutputWidth = inWidth;
+	m_OutputHeight = inHeight;
+}
+
+void ParallelDecoder::SetFrameDuration( long long inDuration )
+{
+	m_FrameDuration = inDuration;
+}
+
+bool ParallelDecoder::Open( const DecoderSettings& settings, FrameSink* inSink, int inSessions,
+							DecoderBackend** inBackends )
+{
+	if (m_Sessions || inSink == NULL || inSessions < 1 || inSessions > PARALLEL_MAX_SESSIONS)
+	{
+		return false;
+	}
+
+	m_Settings = settings;
+	m_Sink = inSink;
+	m_SessionCount = inSessions;
+	m_Sessions = new DecodeSession[inSessions];
+	m_Workers = new Worker[inSessions];
+
+	for (int i = 0; i < inSessions; i++)
+	{
+		m_Workers[i].Decoder = this;
+		m_Workers[i].Index = i;
+		m_Workers[i].Current = -1;
+		m_Workers[i].Sink = new ParallelWorkerSink(this, &m_Workers[i]);
+	}
+
+	for (int i = 0; i < inSessions; i++)
+	{
+		m_Sessions[i].SetOutputFrameSize(m_OutputWidth, m_OutputHeight);
+		if (!m_Sessions[i].Open(settings, m_Workers[i].Sink, inBackends ? inBackends[i] : NULL))
+		{
+			printf("Cannot open decoding session %d\n", i);
+			for (int k = i; inBackends && k < inSessions; k++)
+			{
+				delete inBackends[k];
+			}
+			this->Close();
+			return false;
+		}
+	}
+	return true;
+}
+
+void ParallelDecoder::Close( void )
+{
+	delete [] m_Sessions;
+	m_Sessions = NULL;
+
+	if (m_Workers)
+	{
+		for (int i = 0; i < m_SessionCount; i++)
+		{
+			delete m_Workers[i].Sink;
+		}
+		delete [] m_Workers;
+		m_Workers = NULL;
+	}
+
+	for (long i = 0; i < m_SegmentCount; i++)
+	{
+		this->ReleaseFrames(&m_Segments[i]);
+	}
+	free(m_Segments);
+	free(m_ParameterSets);
+	m_Segments = NULL;
+	m_SegmentCount = 0;
+	m_SegmentCapacity = 0;
+	m_ParameterSets = NULL;
+	m_ParameterSetCount = 0;
+	m_ParameterSetCapacity = 0;
+	m_SessionCount = 0;
+}
+
+bool ParallelDecoder::AddSegment( long long inStart )
+{
+	if (m_SegmentCount == m_SegmentCapacity)
+	{
+		long capacity = m_SegmentCapacity ? m_SegmentCapacity * 2 : PARALLEL_INDEX_SIZE;
+		Segment* segments = (Segment*)realloc(m_Segments, capacity * sizeof(Segment));
+		if (segments == NULL)
+			return false;
+		m_Segments = segments;
+		m_SegmentCapacity = capacity;
+	}
+
+	Segment* segment = &m_Segments[m_SegmentCount++];
+	memset(segment, 0, sizeof(Segment));
+	segment->Start = inStart;
+	segment->Sps = -1;
+	segment->Pps = -1;
+	return true;
+}
+
+bool ParallelDecoder::AddParameterSet( long long inOffset, int inType )
+{
+	if (m_ParameterSetCount == m_ParameterSetCapacity)
+	{
+		long capacity = m_ParameterSetCapacity ? m_ParameterSetCapacity * 2 : PARALLEL_INDEX_SIZE;
+		ParameterSet* sets = (ParameterSet*)realloc(m_ParameterSets, capacity * sizeof(ParameterSet));
+		if (sets == NULL)
+			return false;
+		m_ParameterSets = sets;
+		m_ParameterSetCapacity = capacity;
+	}
+
+	ParameterSet* set = &m_ParameterSets[m_ParameterSetCount++];
+	set->Offset = inOffset;
+	set->Length = 0;
+	set->Type = inType;
+	return true;
+}
+
+// The last parameter set of the type before the offset, -1 if none
+long ParallelDecoder::FindParameterSet( int inType, long long inBefore )
+{
+	for (long i = m_ParameterSetCount - 1; i >= 0; i--)
+	{
+		if (m_ParameterSets[i].Offset < inBefore && m_ParameterSets[i].Type == inType)
+			return i;
+	}
+	return -1;
+}
+
+// A single pass over the start codes, finding the access units as
+// AccessUnitScanner does. Only the last SPS and PPS before a segment are
+// decoded ahead of it: streams using several parameter set ids have to
+// repeat them before each IDR picture.
+bool ParallelDecoder::IndexStream( const unsigned char* inData, long long inSize )
+{
+	long long minSize = inSize / (m_SessionCount * PARALLEL_SEGMENTS);
+	long long unitStart = 0;
+	bool hasPicture = false;
+	long pending = -1;	// Parameter set whose end is the next start code
+
+	m_SegmentCount = 0;
+	m_ParameterSetCount = 0;
+	if (!this->AddSegment(0))
+		return false;
+
+	for (long long i = 0; i + 3 < inSize; i++)
+	{
+		// Skip ahead until the third byte could end a start code
+		if (inData[i + 2] > 1)
+		{
+			i += 2;
+			continue;
+		}
+		if (inData[i] != 0 || inData[i + 1] != 0 || inData[i + 2] != 1)
+			continue;
+
+		long long startCode = (i > 0 && inData[i - 1] == 0) ? i - 1 : i;
+		long long header = i + 3;
+		i += 2;
+
+		if (pending >= 0)
+		{
+			m_ParameterSets[pending].Length = (long)(startCode - m_ParameterSets[pending].Offset);
+			pending = -1;
+		}
+
+		int type = inData[header] & 0x1f;
+		if (type == NAL_TYPE_SLICE || type == NAL_TYPE_IDR)
+		{
+			// first_mb_in_slice = 0 is ue(v) '1'
+			if (header + 1 < inSize && (inData[header + 1] & 0x80))
+			{
+				if (hasPicture)
+					unitStart = startCode;
+				if (type == NAL_TYPE_IDR &&
+					unitStart - m_Segments[m_SegmentCount - 1].Start >= minSize && unitStart > 0)
+				{
+					if (!this->AddSegment(unitStart))
+						return false;
+				}
+			}
+			hasPicture = true;
+		}
+		else if (type == NAL_TYPE_AUD || type == NAL_TYPE_SPS || type == NAL_TYPE_PPS ||
+				 type == NAL_TYPE_SEI || (type >= 14 && type <= 18))
+		{
+			if (hasPicture)
+			{
+				unitStart = startCode;
+				hasPicture = false;
+			}
+			if (type == NAL_TYPE_SPS || type == NAL_TYPE_PPS)
+			{
+				if (!this->AddParameterSet(startCode, type))
+					return false;
+				pending = m_ParameterSetCount - 1;
+			}
+		}
+	}
+	if (pending >= 0)
+	{
+		m_ParameterSets[pending].Length = (long)(inSize - m_ParameterSets[pending].Offset);
+	}
+
+	for (long i = 0; i < m_SegmentCount; i++)
+	{
+		Segment* segment = &m_Segments[i];
+		segment->End = (i + 1 < m_SegmentCount) ? m_Segments[i + 1].Start : inSize;
+		segment->Sps = this->FindParameterSet(NAL_TYPE_SPS, segment->Start);
+		segment->Pps = this->FindParameterSet(NAL_TYPE_PPS, segment->Start);
+	}
+	return true;
+}
+
+bool ParallelDecoder::Decode( const unsigned char* inData, long long inSize )
+{
+	if (m_Sessions == NULL || inData == NULL)
+	{
+		return false;
+	}
+
+	long long start = PerfTimeUs();
+
+	for (long i = 0; i < m_SegmentCount; i++)
+	{
+		this->ReleaseFrames(&m_Segments[i]);
+	}
+	m_Data = inData;
+	if (!this->IndexStream(inData, inSize))
+	{
+		printf("Cannot index the stream\n");
+		return false;
+	}
+
+	long long decodeStart = PerfTimeUs();
+	m_IndexUs = decodeStart - start;
+	m_DecodeUs = 0;
+	m_BusyUs = 0;
+	m_LongestSegmentUs = 0;
+	m_FramesOutput = 0;
+	m_FramesReordered = 0;
+	m_BufferedBytes = 0;
+	m_PeakBufferedBytes = 0;
+	m_Failed = false;
+	m_NextSegment = 0;
+	m_Head = 0;
+	m_Window = new PlatformSemaphore(m_SessionCount * PARALLEL_WINDOW);
+
+	PlatformThread* threads = new PlatformThread[m_SessionCount];
+	int started = 0;
+	for (int i = 0; i < m_SessionCount; i++)
+	{
+		if (threads[i].Start(WorkerThread, &m_Workers[i]))
+			started++;
+		else
+			printf("Cannot start decoding session %d\n", i);
+	}
+	for (int i = 0; i < m_SessionCount; i++)
+	{
+		threads[i].Join();
+	}
+	delete [] threads;
+	delete m_Window;
+	m_Window = NULL;
+
+	m_DecodeUs = PerfTimeUs() - decodeStart;
+	m_Sink->OnEndOfStream();
+	return started > 0 && !m_Failed;
+}
+
+void ParallelDecoder::WorkerThread( void* inArg )
+{
+	Worker* worker = (Worker*)inArg;
+	worker->Decoder->RunWorker(worker);
+}
+
+void ParallelDecoder::RunWorker( Worker* inWorker )
+{
+	DecodeSession* session = &m_Sessions[inWorker->Index];
+
+	for (;;)
+	{
+		m_Window->Wait();
+		long index = AtomicIncrement(&m_NextSegment) - 1;
+		if (index >= m_SegmentCount)
+		{
+			m_Window->Post();
+			break;
+		}
+
+		Segment* segment = &m_Segments[index];
+		long long start = PerfTimeUs();
+		bool pass = true;
+
+		inWorker->Current = index;
+		if (segment->Sps >= 0)
+		{
+			const ParameterSet* sps = &m_ParameterSets[segment->Sps];
+			pass = this->DecodeData(session, m_Data + sps->Offset, sps->Length);
+		}
+		if (segment->Pps >= 0)
+		{
+			const ParameterSet* pps = &m_ParameterSets[segment->Pps];
+			pass = this->DecodeData(session, m_Data + pps->Offset, pps->Length) && pass;
+		}
+		pass = this->DecodeData(session, m_Data + segment->Start, segment->End - segment->Start) && pass;
+		session->Drain();
+
+		long long busy = PerfTimeUs() - start;
+		{
+			PlatformAutoLock lck(&m_StatsLock);
+			m_BusyUs += busy;
+			if (busy > m_LongestSegmentUs)
+				m_LongestSegmentUs = busy;
+			if (!pass)
+			{
+				printf("Decoding failed in segment %ld at byte %lld\n", index, segment->Start);
+				m_Failed = true;
+			}
+		}
+		this->OnSegmentDone(index);
+	}
+}
+
+bool ParallelDecoder::DecodeData( DecodeSession* inSession, const unsigned char* inData, long long inSize )
+{
+	while (inSize > 0)
+	{
+		long length = inSize < m_Settings.DecoderBufferSize ? (long)inSize : m_Settings.DecoderBufferSize;
+		if (!inSession->DecodeBuffer(inData, length))
+			return false;
+		inData += length;
+		inSize -= length;
+	}
+	return true;
+}
+
+void ParallelDecoder::OnSegmentFrame( long inSegment, const DecodedFrame& inFrame )
+{
+	PlatformAutoLock lck(&m_OutputLock);
+
+	if (inSegment == m_Head)
+	{
+		this->OutputFrame(inFrame);
+		return;
+	}
+
+	BufferedFrame* buffered = (BufferedFrame*)malloc(sizeof(BufferedFrame) + inFrame.Size);
+	if (buffered == NULL)
+	{
+		printf("No memory to reorder frame %lld\n", inFrame.FrameNumber);
+		return;
+	}
+	buffered->Frame = inFrame;
+	buffered->Frame.Data = (unsigned char*)(buffered + 1);
+	if (inFrame.Luma)
+	{
+		buffered->Luma = *inFrame.Luma;
+		buffered->Frame.Luma = &buffered->Luma;
+	}
+	buffered->Next = NULL;
+	memcpy(buffered + 1, inFrame.Data, inFrame.Size);
+
+	Segment* segment = &m_Segments[inSegment];
+	if (segment->Last)
+		segment->Last->Next = buffered;
+	else
+		segment->First = buffered;
+	segment->Last = buffered;
+
+	m_FramesReordered++;
+	m_BufferedBytes += inFrame.Size;
+	if (m_BufferedBytes > m_PeakBufferedBytes)
+		m_PeakBufferedBytes = m_BufferedBytes;
+}
+
+// The segments done after the head go out with it, then the frames the
+// new head has so far
+void ParallelDecoder::OnSegmentDone( long inSegment )
+{
+	PlatformAutoLock lck(&m_OutputLock);
+
+	m_Segments[inSegment].Done = true;
+	while (m_Head < m_SegmentCount && m_Segments[m_Head].Done)
+	{
+		m_Head++;
+		m_Window->Post();
+		if (m_Head < m_SegmentCount)
+			this->ReleaseFrames(&m_Segments[m_Head]);
+	}
+}
+
+// Under m_OutputLock
+void ParallelDecoder::OutputFrame( const DecodedFrame& inFrame )
+{
+	DecodedFrame frame = inFrame;
+
+	frame.FrameNumber = m_FramesOutput;
+	if (m_FrameDuration > 0)
+		frame.Timestamp = m_FramesOutput * m_FrameDuration;
+	m_FramesOutput++;
+
+	m_Sink->OnFrame(frame);
+}
+
+// Outputs the frames the segment holds, or only frees them once the
+// decoding is over
+void ParallelDecoder::ReleaseFrames( Segment* inSegment )
+{
+	BufferedFrame* buffered = inSegment->First;
+
+	while (buffered)
+	{
+		BufferedFrame* next = buffered->Next;
+		if (m_Window)
+			this->OutputFrame(buffered->Frame);
+		m_BufferedBytes -= buffered->Frame.Size;
+		free(buffered);
+		buffered = next;
+	}
+	inSegment->First = NULL;
+	inSegment->Last = NULL;
+}
+
+void ParallelDecoder::GetStatistics( ParallelDecodeStatistics* outStats )
+{
+	PlatformAutoLock lck(&m_StatsLock);
+
+	outStats->Sessions = m_SessionCount;
+	outStats->Segments = m_SegmentCount;
+	outStats->IndexUs = m_IndexUs;
+	outStats->DecodeUs = m_DecodeUs;
+	outStats->BusyUs = m_BusyUs;
+	outStats->LongestSegmentUs = m_LongestSegmentUs;
+	outStats->FramesOutput = m_FramesOutput;
+	outStats->FramesReordered = m_FramesReordered;
+	outStats->PeakBufferedBytes = m_PeakBufferedBytes;
+}
@@ -0,0 +1,152 @@
+//------------------------------------------------------------------------------
+// File: ParallelDecoder.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Decodes a whole elementary stream faster than one parser can, for
+// offline jobs. The stream is split at IDR access units into segments
+// that decode independently; several sessions decode them at once and a
+// reorder buffer hands the frames to the sink in stream order.
+//
+//------------------------------------------------------------------------------
+
+#ifndef PARALLEL_DECODER_H_
+#define PARALLEL_DECODER_H_
+
+#include "DecodeSession.h"
+#include "Platform.h"
+
+#define PARALLEL_MAX_SESSIONS		16
+#define PARALLEL_SEGMENTS			4	// Segments per session the stream is cut into at least
+#define PARALLEL_WINDOW				2	// Segments per session decoded ahead of the output
+
+typedef struct
+{
+	int			Sessions;
+	long		Segments;
+	long long	IndexUs;			// Finding the segments
+	long long	DecodeUs;			// From the first segment to the last frame out
+	long long	BusyUs;				// Of all sessions
+	long long	LongestSegmentUs;
+	long long	FramesOutput;
+	long long	FramesReordered;	// Copied to wait for an earlier segment
+	long long	PeakBufferedBytes;
+} ParallelDecodeStatistics;
+
+class ParallelDecoder
+{
+public:
+
+	ParallelDecoder();
+	virtual ~ParallelDecoder();
+
+	// Applied to the sessions when they are opened
+	void	SetOutputFrameSize(int inWidth, int inHeight);
+
+	// Frames are numbered and stamped again in output order, from 0 and in
+	// steps of inDuration. 0 keeps the timestamps of the segment's session.
+	void	SetFrameDuration(long long inDuration);
+
+	// inBackends holds one backend per session, taken over as by
+	// DecodeSession::Open, or is NULL to create them from the settings
+	bool	Open(const DecoderSettings& settings, FrameSink* inSink, int inSessions,
+				 DecoderBackend** inBackends = NULL);
+	void	Close(void);
+
+	// Decodes the whole stream. The frames reach the sink in stream order,
+	// one at a time but from the decoding threads, then OnEndOfStream.
+	bool	Decode(const unsigned char* inData, long long inSize);
+
+	void	GetStatistics(ParallelDecodeStatistics* outStats);
+
+private:
+
+	typedef struct BufferedFrame
+	{
+		DecodedFrame			Frame;
+		LumaStatistics			Luma;
+		struct BufferedFrame*	Next;
+	} BufferedFrame;
+
+	typedef struct
+	{
+		long long		Start;
+		long long		End;
+		long			Sps;			// Parameter sets to decode first, or -1
+		long			Pps;
+		bool			Done;
+		BufferedFrame*	First;			// Frames waiting for the segments before
+		BufferedFrame*	Last;
+	} Segment;
+
+	typedef struct
+	{
+		long long		Offset;			// Of the start code
+		long			Length;
+		int				Type;
+	} ParameterSet;
+
+	typedef struct
+	{
+		ParallelDecoder*	Decoder;
+		int					Index;
+		long				Current;	// Segment being decoded
+		FrameSink*			Sink;
+	} Worker;
+
+	bool	IndexStream(const unsigned char* inData, long long inSize);
+	bool	AddSegment(long long inStart);
+	bool	AddParameterSet(long long inOffset, int inType);
+	long	FindParameterSet(int inType, long long inBefore);
+
+	static void	WorkerThread(void* inArg);
+	void	RunWorker(Worker* inWorker);
+	bool	DecodeData(DecodeSession* inSession, const unsigned char* inData, long long inSize);
+
+	void	OnSegmentFrame(long inSegment, const DecodedFrame& inFrame);
+	void	OnSegmentDone(long inSegment);
+	void	OutputFrame(const DecodedFrame& inFrame);
+	void	ReleaseFrames(Segment* inSegment);
+
+	friend class ParallelWorkerSink;
+
+private:
+
+	FrameSink*		m_Sink;
+	DecoderSettings	m_Settings;
+	int				m_SessionCount;
+	DecodeSession*	m_Sessions;
+	Worker*			m_Workers;
+	int				m_OutputWidth;
+	int				m_OutputHeight;
+	long long		m_FrameDuration;
+
+	const unsigned char*	m_Data;
+	Segment*		m_Segments;
+	long			m_SegmentCount;
+	long			m_SegmentCapacity;
+	ParameterSet*	m_ParameterSets;
+	long			m_ParameterSetCount;
+	long			m_ParameterSetCapacity;
+
+	volatile long	m_NextSegment;		// To be taken by a session
+	PlatformSemaphore*	m_Window;		// Segments that may start ahead of the output
+
+	PlatformLock	m_OutputLock;
+	long			m_Head;				// Segment whose frames go out directly
+	long long		m_FramesOutput;
+	long long		m_FramesReordered;
+	long long		m_BufferedBytes;
+	long long		m_PeakBufferedBytes;
+
+	PlatformLock	m_StatsLock;
+	long long		m_IndexUs;
+	long long		m_DecodeUs;
+	long long		m_BusyUs;
+	long long		m_LongestSegmentUs;
+	bool			m_Failed;
+};
+
+#endif
@@ -0,0 +1,42 @@
+//------------------------------------------------------------------------------
+// File: PerfTimer.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Monotonic high resolution clock in microseconds.
+//
+//------------------------------------------------------------------------------
+
+#ifndef PERF_TIMER_H_
+#define PERF_TIMER_H_
+
+#ifdef _WIN32
+#include <windows.h>
+
+inline long long PerfTimeUs(void)
+{
+	static LARGE_INTEGER frequency = { 0 };
+	LARGE_INTEGER counter;
+
+	if (frequency.QuadPart == 0)
+		QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (long long)(counter.QuadPart / frequency.QuadPart) * 1000000 +
+		   (long long)(counter.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+}
+
+#else
+#include <time.h>
+
+inline long long PerfTimeUs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,272 @@
+//------------------------------------------------------------------------------
+// File: Platform.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: The few OS services the decode engine needs (locks, threads,
+// sleeping, memory), on Win32 or POSIX, so that it does not depend on DirectShow.
+//
+//------------------------------------------------------------------------------
+
+#ifndef PLATFORM_H_
+#define PLATFORM_H_
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#include <malloc.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+class PlatformLock
+{
+public:
+#ifdef _WIN32
+	PlatformLock()	{ InitializeCriticalSection(&m_Lock); }
+	~PlatformLock()	{ DeleteCriticalSection(&m_Lock); }
+	void Lock()		{ EnterCriticalSection(&m_Lock); }
+	void Unlock()	{ LeaveCriticalSection(&m_Lock); }
+#else
+	PlatformLock()
+	{
+		// Recursive like a critical section
+		pthread_mutexattr_t attr;
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&m_Lock, &attr);
+		pthread_mutexattr_destroy(&attr);
+	}
+	~PlatformLock()	{ pthread_mutex_destroy(&m_Lock); }
+	void Lock()		{ pthread_mutex_lock(&m_Lock); }
+	void Unlock()	{ pthread_mutex_unlock(&m_Lock); }
+#endif
+
+private:
+	PlatformLock(const PlatformLock&);
+	PlatformLock& operator=(const PlatformLock&);
+
+#ifdef _WIN32
+	CRITICAL_SECTION	m_Lock;
+#else
+	pthread_mutex_t		m_Lock;
+#endif
+};
+
+class PlatformAutoLock
+{
+public:
+	PlatformAutoLock(PlatformLock* inLock) : m_Lock(inLock) { m_Lock->Lock(); }
+	~PlatformAutoLock() { m_Lock->Unlock(); }
+
+private:
+	PlatformLock*	m_Lock;
+};
+
+// Counting semaphore. CONDITION_VARIABLE needs Vista, so the Win32 one is
+// the kernel object; the POSIX one is built on a condition variable, as
+// unnamed sem_t is missing on some systems.
+class PlatformSemaphore
+{
+public:
+#ifdef _WIN32
+	PlatformSemaphore(long inCount)	{ m_Semaphore = CreateSemaphore(NULL, inCount, 0x7fffffff, NULL); }
+	~PlatformSemaphore()	{ CloseHandle(m_Semaphore); }
+	void Wait()				{ WaitForSingleObject(m_Semaphore, INFINITE); }
+	bool TryWait()			{ return WaitForSingleObject(m_Semaphore, 0) == WAIT_OBJECT_0; }
+	void Post()				{ ReleaseSemaphore(m_Semaphore, 1, NULL); }
+#else
+	PlatformSemaphore(long inCount) : m_Count(inCount)
+	{
+		pthread_mutex_init(&m_Mutex, NULL);
+		pthread_cond_init(&m_Condition, NULL);
+	}
+	~PlatformSemaphore()
+	{
+		pthread_cond_destroy(&m_Condition);
+		pthread_mutex_destroy(&m_Mutex);
+	}
+	void Wait()
+	{
+		pthread_mutex_lock(&m_Mutex);
+		while (m_Count == 0)
+			pthread_cond_wait(&m_Condition, &m_Mutex);
+		m_Count--;
+		pthread_mutex_unlock(&m_Mutex);
+	}
+	bool TryWait()
+	{
+		pthread_mutex_lock(&m_Mutex);
+		bool taken = m_Count > 0;
+		if (taken)
+			m_Count--;
+		pthread_mutex_unlock(&m_Mutex);
+		return taken;
+	}
+	void Post()
+	{
+		pthread_mutex_lock(&m_Mutex);
+		m_Count++;
+		pthread_cond_signal(&m_Condition);
+		pthread_mutex_unlock(&m_Mutex);
+	}
+#endif
+
+private:
+	PlatformSemaphore(const PlatformSemaphore&);
+	PlatformSemaphore& operator=(const PlatformSemaphore&);
+
+#ifdef _WIN32
+	HANDLE				m_Semaphore;
+#else
+	long				m_Count;
+	pthread_mutex_t		m_Mutex;
+	pthread_cond_t		m_Condition;
+#endif
+};
+
+typedef void (*PlatformThreadProc)(void* inArg);
+
+class PlatformThread
+{
+public:
+	PlatformThread() : m_Proc(NULL), m_Arg(NULL), m_Running(false) {}
+	~PlatformThread() { this->Join(); }
+
+	bool Start(PlatformThreadProc inProc, void* inArg)
+	{
+		if (m_Running)
+			return false;
+		m_Proc = inProc;
+		m_Arg = inArg;
+#ifdef _WIN32
+		m_Thread = CreateThread(NULL, 0, ThreadMain, this, 0, NULL);
+		m_Running = (m_Thread != NULL);
+#else
+		m_Running = (pthread_create(&m_Thread, NULL, ThreadMain, this) == 0);
+#endif
+		return m_Running;
+	}
+
+	void Join()
+	{
+		if (!m_Running)
+			return;
+#ifdef _WIN32
+		WaitForSingleObject(m_Thread, INFINITE);
+		CloseHandle(m_Thread);
+#else
+		pthread_join(m_Thread, NULL);
+#endif
+		m_Running = false;
+	}
+
+	bool IsRunning() const { return m_Running; }
+
+private:
+	PlatformThread(const PlatformThread&);
+	PlatformThread& operator=(const PlatformThread&);
+
+#ifdef _WIN32
+	static DWORD WINAPI ThreadMain(LPVOID inThis)
+	{
+		PlatformThread* thread = (PlatformThread*)inThis;
+		thread->m_Proc(thread->m_Arg);
+		return 0;
+	}
+	HANDLE				m_Thread;
+#else
+	static void* ThreadMain(void* inThis)
+	{
+		PlatformThread* thread = (PlatformThread*)inThis;
+		thread->m_Proc(thread->m_Arg);
+		return NULL;
+	}
+	pthread_t			m_Thread;
+#endif
+
+	PlatformThreadProc	m_Proc;
+	void*				m_Arg;
+	bool				m_Running;
+};
+
+inline void PlatformSleep(unsigned int inMs)
+{
+#ifdef _WIN32
+	Sleep(inMs);
+#else
+	struct timespec ts;
+	ts.tv_sec = inMs / 1000;
+	ts.tv_nsec = (long)(inMs % 1000) * 1000000;
+	nanosleep(&ts, NULL);
+#endif
+}
+
+inline long PlatformProcessId(void)
+{
+#ifdef _WIN32
+	return (long)GetCurrentProcessId();
+#else
+	return (long)getpid();
+#endif
+}
+
+inline int PlatformProcessorCount(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (int)count : 1;
+#endif
+}
+
+// Memory aligned for unbuffered I/O, NULL on failure
+inline void* PlatformAlignedAlloc(size_t inSize, size_t inAlignment)
+{
+#ifdef _WIN32
+	return _aligned_malloc(inSize, inAlignment);
+#else
+	void* memory = NULL;
+	return posix_memalign(&memory, inAlignment, inSize) == 0 ? memory : NULL;
+#endif
+}
+
+inline void PlatformAlignedFree(void* inMemory)
+{
+#ifdef _WIN32
+	_aligned_free(inMemory);
+#else
+	free(inMemory);
+#endif
+}
+
+// Peak resident memory of the process in bytes, 0 if unknown
+inline long long PlatformPeakMemory(void)
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return (long long)counters.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#ifdef __APPLE__
+	return (long long)usage.ru_maxrss;
+#else
+	return (long long)usage.ru_maxrss * 1024;	// KB on Linux
+#endif
+#endif
+}
+
+#endif
@@ -0,0 +1,106 @@
+//------------------------------------------------------------------------------
+// File: Rbsp.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Removal of the emulation prevention bytes from NAL unit payloads.
+//
+// Three overlapping loads compare every position of a 16 byte block with
+// 00 00 03 at once; only a hit leaves the vector loop. The bytes between
+// two escapes are moved with memmove, which also makes the unescaping
+// safe in place since the output never gets ahead of the input.
+//
+//------------------------------------------------------------------------------
+
+#include "Rbsp.h"
+#include <string.h>
+#include <emmintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static inline int LowestBit( unsigned int inMask )
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, inMask);
+	return (int)index;
+#else
+	return __builtin_ctz(inMask);
+#endif
+}
+
+long FindEmulationPrevention( const unsigned char* inData, long inLength, long inOffset )
+{
+	const __m128i zero  = _mm_setzero_si128();
+	const __m128i three = _mm_set1_epi8(3);
+	long i = inOffset;
+
+	// The block starting at i reads up to i + 17
+	for (; i + 18 <= inLength; i += 16)
+	{
+		__m128i first  = _mm_loadu_si128((const __m128i*)(inData + i));
+		__m128i second = _mm_loadu_si128((const __m128i*)(inData + i + 1));
+		__m128i third  = _mm_loadu_si128((const __m128i*)(inData + i + 2));
+		__m128i hit = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(first, zero), _mm_cmpeq_epi8(second, zero)),
+									_mm_cmpeq_epi8(third, three));
+		int mask = _mm_movemask_epi8(hit);
+		if (mask != 0)
+			return i + LowestBit(mask) + 2;
+	}
+	for (; i + 2 < inLength; i++)
+	{
+		if (inData[i + 2] == 3 && inData[i] == 0 && inData[i + 1] == 0)
+			return i + 2;
+	}
+	return -1;
+}
+
+long UnescapeRbsp( const unsigned char* inData, long inLength, unsigned char* outData )
+{
+	long start = 0;
+	long length = 0;
+
+	// A match cannot start on the 03 just removed, the search goes on after it
+	for (long escape = FindEmulationPrevention(inData, inLength, 0); escape >= 0;
+		 escape = FindEmulationPrevention(inData, inLength, escape + 1))
+	{
+		memmove(outData + length, inData + start, escape - start);
+		length += escape - start;
+		start = escape + 1;
+	}
+	memmove(outData + length, inData + start, inLength - start);
+	return length + inLength - start;
+}
+
+RbspBuffer::RbspBuffer( const unsigned char* inData, long inLength ) :
+						m_Data(inData),
+						m_Length(inLength),
+						m_Allocated(NULL)
+{
+	long escape = FindEmulationPrevention(inData, inLength, 0);
+	if (escape < 0)
+	{
+		return;
+	}
+
+	unsigned char* buffer = m_Local;
+	if (inLength > RBSP_LOCAL_SIZE)
+	{
+		m_Allocated = new unsigned char[inLength];
+		buffer = m_Allocated;
+	}
+
+	// The part before the first escape is known to be clean
+	memcpy(buffer, inData, escape);
+	m_Length = escape + UnescapeRbsp(inData + escape + 1, inLength - escape - 1, buffer + escape);
+	m_Data = buffer;
+}
+
+RbspBuffer::~RbspBuffer()
+{
+	delete [] m_Allocated;
+}
@@ -0,0 +1,53 @@
+//------------------------------------------------------------------------------
+// File: Rbsp.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Removal of the emulation prevention bytes (00 00 03) from NAL
+// unit payloads, giving the RBSP that BitReader reads. The search runs
+// 16 bytes at a time with SSE2 and the data is copied in whole runs, so
+// a payload without escapes costs one scan and no copy.
+//
+//------------------------------------------------------------------------------
+
+#ifndef RBSP_H_
+#define RBSP_H_
+
+#define RBSP_LOCAL_SIZE		256		// Payloads kept on the stack by RbspBuffer
+
+// Offset of the emulation prevention byte (the 03) of the first 00 00 03
+// starting at or after inOffset, -1 if there is none
+long	FindEmulationPrevention(const unsigned char* inData, long inLength, long inOffset);
+
+// Copies the payload without its emulation prevention bytes and returns
+// the RBSP length. outData holds inLength bytes and may be inData.
+long	UnescapeRbsp(const unsigned char* inData, long inLength, unsigned char* outData);
+
+// RBSP of a payload for parsing: the payload itself if it has no escapes,
+// an unescaped copy otherwise
+class RbspBuffer
+{
+public:
+
+	RbspBuffer(const unsigned char* inData, long inLength);
+	virtual ~RbspBuffer();
+
+	const unsigned char*	GetData(void) const { return m_Data; }
+	long					GetLength(void) const { return m_Length; }
+
+private:
+
+	RbspBuffer(const RbspBuffer&);
+	RbspBuffer& operator=(const RbspBuffer&);
+
+private:
+
+	const unsigned char*	m_Data;
+	long			m_Length;
+	unsigned char*	m_Allocated;
+	unsigned char	m_Local[RBSP_LOCAL_SIZE];
+};
+
+#endif
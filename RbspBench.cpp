@@ -0,0 +1,202 @@
+//------------------------------------------------------------------------------
+// File: RbspBench.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Measures the unescaping of RBSPs (Rbsp.h) in GB/s, with no
+// emulation prevention bytes, one per 4 KB as in a typical slice, and one
+// every 64 bytes, and the bit reader (BitReader.h) in millions of ue(v)
+// codes and fixed-length fields a second. Each figure is given for the
+// byte-at-a-time versions of RbspReference.h too, and is the best of a
+// few runs over the same data.
+//
+//------------------------------------------------------------------------------
+
+#include "BitReader.h"
+#include "Rbsp.h"
+#include "RbspReference.h"
+#include "PerfTimer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_MEGABYTES		64
+#define BENCH_REPEATS		5
+
+static unsigned long gSeed = 1;
+
+static unsigned int Random( void )
+{
+	gSeed = (gSeed * 1103515245 + 12345) & 0xffffffff;
+	return (unsigned int)(gSeed >> 8);
+}
+
+// Random bytes, none of them 0, with a 00 00 03 every inSpacing bytes
+static void FillPayload( unsigned char* outData, long inLength, long inSpacing )
+{
+	for (long i = 0; i < inLength; i++)
+	{
+		outData[i] = (unsigned char)(Random() | 1);
+	}
+	for (long i = inSpacing; inSpacing > 0 && i + 3 <= inLength; i += inSpacing)
+	{
+		outData[i] = 0;
+		outData[i + 1] = 0;
+		outData[i + 2] = 3;
+	}
+}
+
+static double Throughput( long long inAmount, long long inUs )
+{
+	return inUs > 0 ? (double)inAmount / inUs : 0;
+}
+
+static void BenchUnescape( const unsigned char* inData, long inLength, unsigned char* outData,
+						   int inRepeats, const char* inName )
+{
+	long long bestBytewise = 0;
+	long long bestSimd = 0;
+	long length = 0;
+	for (int r = 0; r < inRepeats; r++)
+	{
+		long long start = PerfTimeUs();
+		length = UnescapeRbspBytewise(inData, inLength, outData);
+		long long us = PerfTimeUs() - start;
+		if (bestBytewise == 0 || us < bestBytewise)
+			bestBytewise = us;
+
+		start = PerfTimeUs();
+		length = UnescapeRbsp(inData, inLength, outData);
+		us = PerfTimeUs() - start;
+		if (bestSimd == 0 || us < bestSimd)
+			bestSimd = us;
+	}
+	printf("Unescape, %-16s %6.2f GB/s bytewise, %6.2f GB/s SSE2 (%ld escapes)\n", inName,
+		   Throughput(inLength, bestBytewise) / 1000, Throughput(inLength, bestSimd) / 1000,
+		   inLength - length);
+}
+
+// Reads the whole buffer as ue(v) codes, or as fields of 1 to 16 bits
+template <class Reader>
+static long long ReadAll( const unsigned char* inData, long inLength, bool inCodes,
+						  long* outCount, unsigned int* outSum )
+{
+	Reader reader(inData, inLength);
+	unsigned int sum = 0;
+	long count = 0;
+	long long start = PerfTimeUs();
+	while (!reader.IsOverrun())
+	{
+		sum += inCodes ? reader.ReadUE() : reader.ReadBits((int)(count & 15) + 1);
+		count++;
+	}
+	long long us = PerfTimeUs() - start;
+	*outCount = count;
+	*outSum = sum;
+	return us;
+}
+
+template <class Reader>
+static long long BestReadAll( const unsigned char* inData, long inLength, bool inCodes,
+							  int inRepeats, long* outCount, unsigned int* outSum )
+{
+	long long best = 0;
+	for (int r = 0; r < inRepeats; r++)
+	{
+		long long us = ReadAll<Reader>(inData, inLength, inCodes, outCount, outSum);
+		if (best == 0 || us < best)
+			best = us;
+	}
+	return best;
+}
+
+static bool BenchReader( const unsigned char* inData, long inLength, int inRepeats, bool inCodes )
+{
+	long countBytewise = 0, count = 0;
+	unsigned int sumBytewise = 0, sum = 0;
+	long long bytewise = BestReadAll<BytewiseBitReader>(inData, inLength, inCodes, inRepeats, &countBytewise, &sumBytewise);
+	long long cached = BestReadAll<BitReader>(inData, inLength, inCodes, inRepeats, &count, &sum);
+
+	printf("Read, %-20s %6.1f M/s bytewise, %6.1f M/s cached (%ld reads)\n",
+		   inCodes ? "ue(v)" : "fields of 1-16 bits",
+		   Throughput(countBytewise, bytewise), Throughput(count, cached), count);
+	if (count != countBytewise || sum != sumBytewise)
+	{
+		printf("The readers disagree: %ld reads, sum %u, bytewise %ld reads, sum %u\n",
+			   count, sum, countBytewise, sumBytewise);
+		return false;
+	}
+	return true;
+}
+
+static void PrintUsage( void )
+{
+	printf("Usage: RbspBench [options]\n"
+		   "  -m <MB>          Data per measurement (default %d)\n"
+		   "  -r <runs>        Runs of each, the best counts (default %d)\n",
+		   BENCH_MEGABYTES, BENCH_REPEATS);
+}
+
+int main( int argc, char* argv[] )
+{
+	long	megabytes = BENCH_MEGABYTES;
+	int		repeats = BENCH_REPEATS;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		if (arg[0] != '-' || arg[1] == '\0' || arg[2] != '\0' || i + 1 >= argc)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		int value = atoi(argv[++i]);
+		switch (arg[1])
+		{
+		case 'm':
+			megabytes = value;
+			break;
+		case 'r':
+			repeats = value;
+			break;
+		default:
+			PrintUsage();
+			return 1;
+		}
+	}
+	if (megabytes < 1 || megabytes > 1024 || repeats < 1)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	long length = megabytes * 1024 * 1024;
+	unsigned char* data = new unsigned char[length];
+	unsigned char* output = new unsigned char[length];
+
+	FillPayload(data, length, 0);
+	BenchUnescape(data, length, output, repeats, "no escapes:");
+	FillPayload(data, length, 4096);
+	BenchUnescape(data, length, output, repeats, "one per 4 KB:");
+	FillPayload(data, length, 64);
+	BenchUnescape(data, length, output, repeats, "one per 64 B:");
+
+	// Random bits with no 00 00 03 in them, so that both readers see the same RBSP
+	int zeros = 0;
+	for (long i = 0; i < length; i++)
+	{
+		data[i] = (unsigned char)Random();
+		if (zeros >= 2 && data[i] == 3)
+			data[i] = 4;
+		zeros = (data[i] == 0) ? zeros + 1 : 0;
+	}
+	bool agree = BenchReader(data, length, repeats, true);
+	agree = BenchReader(data, length, repeats, false) && agree;
+
+	delete [] data;
+	delete [] output;
+	return agree ? 0 : 1;
+}
@@ -0,0 +1,261 @@
+//------------------------------------------------------------------------------
+// File: RbspFuzz.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Checks the SSE2 unescaping (Rbsp.h) and the cached bit reader
+// (BitReader.h) against the byte-at-a-time versions in RbspReference.h,
+// on random payloads: random bytes, runs of 00, 01 and 03 that make
+// escapes and near-escapes at every alignment, and escaped random RBSPs.
+// Each payload is unescaped out of place, in place and through
+// RbspBuffer, then read with a random mix of bits, ue(v), se(v) and
+// skips up to and past its end. Stops at the first difference and
+// prints the payload.
+//
+//------------------------------------------------------------------------------
+
+#include "BitReader.h"
+#include "Rbsp.h"
+#include "RbspReference.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FUZZ_ITERATIONS		1000000
+#define FUZZ_MAX_LENGTH		600		// Above RBSP_LOCAL_SIZE, so RbspBuffer allocates too
+#define FUZZ_READS			80		// Reads per payload, at most
+
+static unsigned long gSeed = 1;
+
+static unsigned int Random( unsigned int inRange )
+{
+	gSeed = (gSeed * 1103515245 + 12345) & 0xffffffff;
+	return (unsigned int)(gSeed >> 8) % inRange;
+}
+
+static long FindEmulationPreventionBytewise( const unsigned char* inData, long inLength, long inOffset )
+{
+	for (long i = inOffset; i + 2 < inLength; i++)
+	{
+		if (inData[i] == 0 && inData[i + 1] == 0 && inData[i + 2] == 3)
+			return i + 2;
+	}
+	return -1;
+}
+
+// Escapes inLength random bytes as an encoder would
+static long MakeEscapedRbsp( unsigned char* outData, long inLength, bool inSparse )
+{
+	long size = 0;
+	int zeros = 0;
+	for (long i = 0; i < inLength; i++)
+	{
+		unsigned char byte = (unsigned char)(inSparse && Random(4) ? Random(4) : Random(256));
+		if (zeros >= 2 && byte <= 3)
+		{
+			outData[size++] = 3;
+			zeros = 0;
+		}
+		outData[size++] = byte;
+		zeros = (byte == 0) ? zeros + 1 : 0;
+	}
+	return size;
+}
+
+static long MakePayload( unsigned char* outData, long inMaxLength )
+{
+	long length = (long)Random((unsigned int)inMaxLength / 2 + 1);
+	switch (Random(4))
+	{
+	case 0:
+		for (long i = 0; i < length; i++)
+			outData[i] = (unsigned char)Random(256);
+		return length;
+	case 1:
+		// Mostly 00 and 03, with some 01 and random bytes
+		for (long i = 0; i < length; i++)
+		{
+			unsigned int r = Random(16);
+			outData[i] = (unsigned char)(r < 8 ? 0 : r < 11 ? 3 : r < 13 ? 1 : Random(256));
+		}
+		return length;
+	case 2:
+		return MakeEscapedRbsp(outData, length, false);
+	default:
+		return MakeEscapedRbsp(outData, length, true);
+	}
+}
+
+static void PrintPayload( const unsigned char* inData, long inLength )
+{
+	for (long i = 0; i < inLength; i++)
+	{
+		printf("%02x%s", inData[i], (i % 32) == 31 ? "\n" : " ");
+	}
+	printf("\n");
+}
+
+// Compares the readers step by step until the reference runs out
+static bool CompareReaders( const unsigned char* inPayload, long inLength,
+							const unsigned char* inRbsp, long inRbspLength, long long* ioReads )
+{
+	BytewiseBitReader reference(inPayload, inLength);
+	BitReader reader(inRbsp, inRbspLength);
+
+	for (int step = 0; step < FUZZ_READS; step++)
+	{
+		unsigned int expected = 0;
+		unsigned int value = 0;
+		int count = (int)Random(33);
+		int op = (int)Random(5);
+		switch (op)
+		{
+		case 0:
+			expected = reference.ReadBit();
+			value = reader.ReadBit();
+			break;
+		case 1:
+			expected = reference.ReadBits(count);
+			value = reader.ReadBits(count);
+			break;
+		case 2:
+			expected = reference.ReadUE();
+			value = reader.ReadUE();
+			break;
+		case 3:
+			expected = (unsigned int)reference.ReadSE();
+			value = (unsigned int)reader.ReadSE();
+			break;
+		default:
+			count = (int)Random(200);
+			reference.SkipBits(count);
+			reader.SkipBits(count);
+			break;
+		}
+		(*ioReads)++;
+
+		if (reference.IsOverrun() != reader.IsOverrun())
+		{
+			printf("Overrun differs at read %d (op %d, %d bits): reference %d, reader %d\n",
+				   step, op, count, reference.IsOverrun(), reader.IsOverrun());
+			return false;
+		}
+		// Past the end, or after an invalid code, the values are undefined
+		if (reference.IsOverrun())
+			break;
+		if (value != expected)
+		{
+			printf("Read %d (op %d, %d bits) gives %u, reference %u\n", step, op, count, value, expected);
+			return false;
+		}
+	}
+	return true;
+}
+
+static void PrintUsage( void )
+{
+	printf("Usage: RbspFuzz [options]\n"
+		   "  -n <payloads>    Payloads to check (default %d)\n"
+		   "  -s <seed>        Seed of the payloads and reads (default 1)\n"
+		   "  -l <bytes>       Longest payload (default %d)\n",
+		   FUZZ_ITERATIONS, FUZZ_MAX_LENGTH);
+}
+
+int main( int argc, char* argv[] )
+{
+	long	iterations = FUZZ_ITERATIONS;
+	long	maxLength = FUZZ_MAX_LENGTH;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		if (arg[0] != '-' || arg[1] == '\0' || arg[2] != '\0' || i + 1 >= argc)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		long value = atol(argv[++i]);
+		switch (arg[1])
+		{
+		case 'n':
+			iterations = value;
+			break;
+		case 's':
+			gSeed = (unsigned long)value;
+			break;
+		case 'l':
+			maxLength = value;
+			break;
+		default:
+			PrintUsage();
+			return 1;
+		}
+	}
+	if (iterations < 1 || maxLength < 1)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	// An escaped RBSP grows by half at most
+	long capacity = maxLength * 2;
+	unsigned char* payload = new unsigned char[capacity];
+	unsigned char* expected = new unsigned char[capacity];
+	unsigned char* output = new unsigned char[capacity];
+	long long bytes = 0;
+	long long escapes = 0;
+	long long reads = 0;
+	long checked = 0;
+	bool passed = true;
+
+	for (long n = 0; n < iterations && passed; n++, checked++)
+	{
+		long length = MakePayload(payload, maxLength);
+		long rbspLength = UnescapeRbspBytewise(payload, length, expected);
+		bytes += length;
+		escapes += length - rbspLength;
+
+		const char* failed = NULL;
+		long found = UnescapeRbsp(payload, length, output);
+		if (found != rbspLength || memcmp(output, expected, rbspLength) != 0)
+			failed = "UnescapeRbsp";
+
+		memcpy(output, payload, length);
+		found = UnescapeRbsp(output, length, output);
+		if (!failed && (found != rbspLength || memcmp(output, expected, rbspLength) != 0))
+			failed = "UnescapeRbsp in place";
+
+		RbspBuffer buffer(payload, length);
+		if (!failed && (buffer.GetLength() != rbspLength || memcmp(buffer.GetData(), expected, rbspLength) != 0))
+			failed = "RbspBuffer";
+
+		long offset = (long)Random((unsigned int)length + 1);
+		if (!failed && FindEmulationPrevention(payload, length, offset) !=
+					   FindEmulationPreventionBytewise(payload, length, offset))
+			failed = "FindEmulationPrevention";
+
+		if (failed)
+		{
+			printf("%s differs on payload %ld, %ld bytes:\n", failed, n, length);
+			PrintPayload(payload, length);
+			passed = false;
+		}
+		else if (!CompareReaders(payload, length, expected, rbspLength, &reads))
+		{
+			printf("BitReader differs on payload %ld, %ld bytes:\n", n, length);
+			PrintPayload(payload, length);
+			passed = false;
+		}
+	}
+
+	printf("%s: %ld payloads, %lld bytes, %lld escapes, %lld reads\n",
+		   passed ? "No difference" : "Failed", checked, bytes, escapes, reads);
+
+	delete [] payload;
+	delete [] expected;
+	delete [] output;
+	return passed ? 0 : 1;
+}
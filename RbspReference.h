@@ -0,0 +1,137 @@
+//------------------------------------------------------------------------------
+// File: RbspReference.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Byte-at-a-time versions of UnescapeRbsp (Rbsp.h) and BitReader
+// (BitReader.h), as they were before the SSE2 scan and the 64-bit cache.
+// RbspFuzz checks the fast versions against them and RbspBench measures
+// the difference; the decoder does not use them.
+//
+//------------------------------------------------------------------------------
+
+#ifndef RBSP_REFERENCE_H_
+#define RBSP_REFERENCE_H_
+
+// Returns the RBSP length, outData holds inLength bytes
+inline long UnescapeRbspBytewise(const unsigned char* inData, long inLength, unsigned char* outData)
+{
+	long length = 0;
+	int zeros = 0;
+	for (long i = 0; i < inLength; i++)
+	{
+		if (zeros >= 2 && inData[i] == 3)
+		{
+			zeros = 0;
+			continue;
+		}
+		outData[length++] = inData[i];
+		zeros = (inData[i] == 0) ? zeros + 1 : 0;
+	}
+	return length;
+}
+
+// Reads the escaped payload, skipping the emulation prevention bytes on
+// the fly. Reading past the end yields zeros and marks the reader overrun.
+class BytewiseBitReader
+{
+public:
+
+	BytewiseBitReader(const unsigned char* inData, long inLength) :	m_Data(inData),
+																	m_Length(inLength),
+																	m_Position(0),
+																	m_Zeros(0),
+																	m_Current(0),
+																	m_BitsLeft(0),
+																	m_Overrun(false)
+	{
+	}
+
+	unsigned int ReadBit(void)
+	{
+		if (m_BitsLeft == 0)
+			NextByte();
+		m_BitsLeft--;
+		return (m_Current >> m_BitsLeft) & 1;
+	}
+
+	// Up to 32 bits
+	unsigned int ReadBits(int inCount)
+	{
+		unsigned int value = 0;
+		for (int i=0; i<inCount; i++)
+		{
+			value = (value << 1) | ReadBit();
+		}
+		return value;
+	}
+
+	void SkipBits(long inCount)
+	{
+		for (long i=0; i<inCount; i++)
+		{
+			ReadBit();
+		}
+	}
+
+	// ue(v)
+	unsigned int ReadUE(void)
+	{
+		int leadingZeros = 0;
+		while (ReadBit() == 0)
+		{
+			if (++leadingZeros > 31 || m_Overrun)
+			{
+				m_Overrun = true;
+				return 0;
+			}
+		}
+		if (leadingZeros == 0)
+			return 0;
+		return ((1u << leadingZeros) - 1) + ReadBits(leadingZeros);
+	}
+
+	// se(v)
+	int ReadSE(void)
+	{
+		unsigned int code = ReadUE();
+		return (code & 1) ? (int)((code + 1) / 2) : -(int)(code / 2);
+	}
+
+	bool IsOverrun(void) const { return m_Overrun; }
+
+private:
+
+	void NextByte(void)
+	{
+		m_BitsLeft = 8;
+		// 0x000003 carries an emulation prevention byte
+		if (m_Position < m_Length && m_Zeros >= 2 && m_Data[m_Position] == 3)
+		{
+			m_Position++;
+			m_Zeros = 0;
+		}
+		if (m_Position >= m_Length)
+		{
+			m_Current = 0;
+			m_Overrun = true;
+			return;
+		}
+		m_Current = m_Data[m_Position++];
+		m_Zeros = (m_Current == 0) ? m_Zeros + 1 : 0;
+	}
+
+private:
+
+	const unsigned char*	m_Data;
+	long			m_Length;
+	long			m_Position;
+	int				m_Zeros;
+	unsigned int	m_Current;
+	int				m_BitsLeft;
+	bool			m_Overrun;
+};
+
+#endif
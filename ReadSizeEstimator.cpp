@@ -0,0 +1,180 @@
+//------------------------------------------------------------------------------
+// File: ReadSizeEstimator.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Online estimate of bytes per frame and data arrival rate,
+// used to size the reads handed to the parser so that each parse
+// call carries one to two frames without exceeding a latency budget.
+// Also counts parse calls per frame and the time data waits in the
+// cache. Not synchronized, the owner serializes the calls.
+//
+//------------------------------------------------------------------------------
+
+#include "ReadSizeEstimator.h"
+#include <string.h>
+
+ReadSizeEstimator::ReadSizeEstimator()
+{
+	this->Init(256*1024, 0, false);
+}
+
+ReadSizeEstimator::~ReadSizeEstimator()
+{
+
+}
+
+void ReadSizeEstimator::Init( long inMaxReadSize, long inLatencyBudgetUs, bool inAdaptive )
+{
+	m_MaxReadSize     = inMaxReadSize;
+	m_LatencyBudgetUs = inLatencyBudgetUs;
+	m_Adaptive        = inAdaptive;
+
+	m_BytesPerFrame   = 0;
+	m_BytesPerUs      = 0;
+	m_RateWindowStart = 0;
+	m_RateWindowBytes = 0;
+	m_BytesSinceFrame = 0;
+	m_WaitStart       = 0;
+
+	m_BytesReceived   = 0;
+	m_BytesConsumed   = 0;
+	m_ArrivalHead     = 0;
+	m_ArrivalCount    = 0;
+
+	memset(&m_Stats, 0, sizeof(m_Stats));
+}
+
+void ReadSizeEstimator::Flush( void )
+{
+	m_BytesConsumed   = m_BytesReceived;
+	m_ArrivalCount    = 0;
+	m_BytesSinceFrame = 0;
+	m_WaitStart       = 0;
+}
+
+void ReadSizeEstimator::OnDataReceived( long inLength, long long inNowUs )
+{
+	m_BytesReceived += inLength;
+
+	// Remember when each piece arrived, dropping the oldest when full
+	if (m_ArrivalCount == ARRIVAL_LOG_SIZE)
+	{
+		m_ArrivalHead = (m_ArrivalHead + 1) % ARRIVAL_LOG_SIZE;
+		m_ArrivalCount--;
+	}
+	Arrival& arrival = m_Arrivals[(m_ArrivalHead + m_ArrivalCount) % ARRIVAL_LOG_SIZE];
+	arrival.EndOffset = m_BytesReceived;
+	arrival.TimeUs    = inNowUs;
+	m_ArrivalCount++;
+
+	// Arrival rate, smoothed over windows
+	if (m_RateWindowStart == 0)
+	{
+		m_RateWindowStart = inNowUs;
+		return;
+	}
+	m_RateWindowBytes += inLength;
+	long long elapsed = inNowUs - m_RateWindowStart;
+	if (elapsed >= RATE_WINDOW_US)
+	{
+		double sample = (double)m_RateWindowBytes / elapsed;
+		m_BytesPerUs = (m_BytesPerUs == 0) ? sample : 0.8 * m_BytesPerUs + 0.2 * sample;
+		m_RateWindowStart = inNowUs;
+		m_RateWindowBytes = 0;
+	}
+}
+
+long ReadSizeEstimator::GetReadSize( long inAvailable, bool inEndOfStream, long long inNowUs )
+{
+	if (inAvailable <= 0)
+		return 0;
+
+	long readSize = inAvailable < m_MaxReadSize ? inAvailable : m_MaxReadSize;
+	if (!m_Adaptive || m_BytesPerFrame <= 0)
+		return readSize;
+
+	// Aim at two frames per call, but hand over as soon as one is there
+	long target = (long)(2 * m_BytesPerFrame);
+	if (target < MIN_READ_SIZE)
+		target = MIN_READ_SIZE;
+	if (readSize > target)
+		readSize = target;
+
+	long oneFrame = (long)m_BytesPerFrame;
+	if (inAvailable >= oneFrame || inEndOfStream)
+	{
+		m_WaitStart = 0;
+		return readSize;
+	}
+
+	// Less than a frame: wait only if the rest should arrive within the budget
+	if (m_WaitStart == 0)
+		m_WaitStart = inNowUs;
+
+	if (m_BytesPerUs > 0)
+	{
+		double expectedUs = (oneFrame - inAvailable) / m_BytesPerUs;
+		if ((inNowUs - m_WaitStart) + expectedUs <= m_LatencyBudgetUs)
+			return 0;
+	}
+
+	m_WaitStart = 0;
+	return readSize;
+}
+
+long long ReadSizeEstimator::OnDataFed( long inLength, int inFramesDecoded, long long inNowUs )
+{
+	long long delay = -1;
+
+	m_Stats.ParseCalls++;
+	m_Stats.BytesFed += inLength;
+
+	// The first arrival not consumed yet holds the oldest byte of this read
+	while (m_ArrivalCount > 0 && m_Arrivals[m_ArrivalHead].EndOffset <= m_BytesConsumed)
+	{
+		m_ArrivalHead = (m_ArrivalHead + 1) % ARRIVAL_LOG_SIZE;
+		m_ArrivalCount--;
+	}
+	if (m_ArrivalCount > 0)
+	{
+		delay = inNowUs - m_Arrivals[m_ArrivalHead].TimeUs;
+		m_Stats.QueueDelaySumUs += delay;
+		m_Stats.QueueDelaySamples++;
+		if (delay > m_Stats.QueueDelayMaxUs)
+			m_Stats.QueueDelayMaxUs = delay;
+	}
+	m_BytesConsumed += inLength;
+
+	m_BytesSinceFrame += inLength;
+	if (inFramesDecoded > 0)
+	{
+		double sample = (double)m_BytesSinceFrame / inFramesDecoded;
+		m_BytesPerFrame = (m_BytesPerFrame == 0) ? sample : 0.9 * m_BytesPerFrame + 0.1 * sample;
+		m_BytesSinceFrame = 0;
+		m_Stats.Frames += inFramesDecoded;
+	}
+	return delay;
+}
+
+void ReadSizeEstimator::GetStatistics( ReadStatistics* outStats ) const
+{
+	*outStats = m_Stats;
+	outStats->BytesPerFrame = m_BytesPerFrame;
+	outStats->ArrivalBytesPerSec = m_BytesPerUs * 1000000;
+	outStats->Adaptive = m_Adaptive ? 1 : 0;
+}
+
+void ReadSizeEstimator::Report( const ReadStatistics& inStats, FILE* outFile )
+{
+	fprintf(outFile, "Reads (%s): %lld parse calls, %lld frames, %.2f calls/frame, "
+					 "queue delay avg %.2f ms max %.2f ms, %.0f bytes/frame, %.0f kB/s\n",
+			inStats.Adaptive ? "adaptive" : "fixed",
+			inStats.ParseCalls, inStats.Frames,
+			inStats.Frames ? (double)inStats.ParseCalls / inStats.Frames : 0.0,
+			inStats.QueueDelaySamples ? inStats.QueueDelaySumUs / 1000.0 / inStats.QueueDelaySamples : 0.0,
+			inStats.QueueDelayMaxUs / 1000.0,
+			inStats.BytesPerFrame, inStats.ArrivalBytesPerSec / 1024);
+}
@@ -0,0 +1,92 @@
+//------------------------------------------------------------------------------
+// File: ReadSizeEstimator.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Online estimate of bytes per frame and data arrival rate,
+// used to size the reads handed to the parser so that each parse
+// call carries one to two frames without exceeding a latency budget.
+// Also counts parse calls per frame and the time data waits in the
+// cache. Not synchronized, the owner serializes the calls.
+//
+//------------------------------------------------------------------------------
+
+#ifndef READ_SIZE_ESTIMATOR_H_
+#define READ_SIZE_ESTIMATOR_H_
+
+#include <stdio.h>
+
+#define MIN_READ_SIZE			4*1024
+#define ARRIVAL_LOG_SIZE		256
+#define RATE_WINDOW_US			100000	// Arrival rate is sampled over 100 ms
+
+typedef struct
+{
+	long long	ParseCalls;
+	long long	Frames;
+	long long	BytesFed;
+	long long	QueueDelaySumUs;	// Time the oldest byte of each read waited in the cache
+	long long	QueueDelayMaxUs;
+	long long	QueueDelaySamples;
+	double		BytesPerFrame;		// Current estimates
+	double		ArrivalBytesPerSec;
+	long		Adaptive;
+} ReadStatistics;
+
+class ReadSizeEstimator
+{
+public:
+
+	ReadSizeEstimator();
+	virtual ~ReadSizeEstimator();
+
+	// inAdaptive = false keeps the fixed min(available, inMaxReadSize) reads,
+	// the statistics are collected in both modes
+	void	Init(long inMaxReadSize, long inLatencyBudgetUs, bool inAdaptive);
+
+	// Drops the data bookkeeping (cache flushed), keeps the estimates
+	void	Flush(void);
+
+	void	OnDataReceived(long inLength, long long inNowUs);
+
+	// Bytes to hand to the parser now, 0 to wait for more data
+	long	GetReadSize(long inAvailable, bool inEndOfStream, long long inNowUs);
+
+	// Returns how long the oldest byte of this read waited in the cache, -1 if unknown
+	long long	OnDataFed(long inLength, int inFramesDecoded, long long inNowUs);
+
+	void	GetStatistics(ReadStatistics* outStats) const;
+
+	static void	Report(const ReadStatistics& inStats, FILE* outFile);
+
+private:
+
+	typedef struct
+	{
+		long long	EndOffset;		// Stream offset after this arrival
+		long long	TimeUs;
+	} Arrival;
+
+	long		m_MaxReadSize;
+	long		m_LatencyBudgetUs;
+	bool		m_Adaptive;
+
+	double		m_BytesPerFrame;
+	double		m_BytesPerUs;
+	long long	m_RateWindowStart;
+	long		m_RateWindowBytes;
+	long		m_BytesSinceFrame;
+	long long	m_WaitStart;
+
+	long long	m_BytesReceived;
+	long long	m_BytesConsumed;
+	Arrival		m_Arrivals[ARRIVAL_LOG_SIZE];
+	int			m_ArrivalHead;
+	int			m_ArrivalCount;
+
+	ReadStatistics	m_Stats;
+};
+
+#endif
@@ -0,0 +1,150 @@
+//------------------------------------------------------------------------------
+// File: RingReader.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Reads the frames a decoder publishes in a shared-memory ring
+// (DecodeTool -f ring) and reports the throughput, as an example and a
+// cross-process test of FrameRingReader.
+//
+//------------------------------------------------------------------------------
+
+#include "SharedFrameRing.h"
+#include "PerfTimer.h"
+#include "Platform.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void PrintUsage( void )
+{
+	printf("Usage: RingReader [options] <ring name>\n"
+		   "  -n <frames>  Stop after this many frames\n"
+		   "  -w <ms>      Time to wait for the ring to be created (default 10000)\n"
+		   "  -d <us>      Time spent on each frame, to play a slow consumer\n"
+		   "  -c           Sum the luma of each frame, to read the data\n");
+}
+
+int main( int argc, char* argv[] )
+{
+	const char*	name = NULL;
+	long long	maxFrames = 0;
+	int			waitMs = 10000;
+	int			workUs = 0;
+	bool		checksum = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+
+		if (arg[0] != '-')
+		{
+			name = arg;
+			continue;
+		}
+		if (strcmp(arg, "-c") == 0)
+		{
+			checksum = true;
+			continue;
+		}
+		if (i + 1 >= argc || arg[1] == '\0' || arg[2] != '\0')
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		const char* value = argv[++i];
+		switch (arg[1])
+		{
+		case 'n':
+			maxFrames = atol(value);
+			break;
+		case 'w':
+			waitMs = atoi(value);
+			break;
+		case 'd':
+			workUs = atoi(value);
+			break;
+		default:
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	if (name == NULL)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	FrameRingReader reader;
+	long long start = PerfTimeUs();
+	while (!reader.Attach(name))
+	{
+		if (PerfTimeUs() - start > waitMs * 1000LL)
+		{
+			printf("No frame ring %s\n", name);
+			return 1;
+		}
+		PlatformSleep(10);
+	}
+	printf("Attached to %s\n", name);
+
+	DecodedFrame frame;
+	unsigned long long sum = 0;
+	long long firstFrame = 0;
+	long long lastNumber = -1;
+	long long reordered = 0;
+	int result;
+
+	while ((result = reader.Acquire(&frame, 5000)) == FRAME_RING_OK)
+	{
+		if (firstFrame == 0)
+			firstFrame = PerfTimeUs();
+
+		if (frame.FrameNumber <= lastNumber)
+			reordered++;
+		lastNumber = frame.FrameNumber;
+
+		if (checksum)
+		{
+			long luma = (long)frame.Width * frame.Height;
+			for (long i = 0; i < luma; i++)
+				sum += frame.Data[i];
+		}
+		if (workUs > 0)
+		{
+			long long workStart = PerfTimeUs();
+			while (PerfTimeUs() - workStart < workUs)
+				;
+		}
+		reader.Release();
+
+		FrameRingReaderStatistics stats;
+		reader.GetStatistics(&stats);
+		if (maxFrames > 0 && stats.FramesRead >= maxFrames)
+			break;
+	}
+	if (result == FRAME_RING_TIMEOUT)
+	{
+		printf("No frame for 5 s\n");
+	}
+
+	long long elapsed = PerfTimeUs() - (firstFrame ? firstFrame : start);
+	FrameRingReaderStatistics stats;
+	reader.GetStatistics(&stats);
+	reader.Detach();
+
+	double seconds = elapsed / 1000000.0;
+	printf("%lld frames read, %lld missed, %lld out of order in %.3f s: %.1f fps, %.1f MB/s\n",
+		   stats.FramesRead, stats.FramesMissed, reordered, seconds,
+		   seconds > 0 ? stats.FramesRead / seconds : 0.0,
+		   seconds > 0 ? stats.BytesRead / 1048576.0 / seconds : 0.0);
+	if (checksum)
+	{
+		printf("Luma sum %llu\n", sum);
+	}
+	return stats.FramesRead > 0 ? 0 : 2;
+}
@@ -0,0 +1,653 @@
+//------------------------------------------------------------------------------
+// File: RtpDepacketizer.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Turns RTP packets carrying H.264 back into access units written
+// straight into the input cache of a decode session.
+//
+// A packet is received into a spare buffer that is swapped into its slot
+// of the jitter buffer, so it is copied once: its payload into the cache,
+// behind a start code. Packets leave the buffer in sequence order. A gap
+// is waited for until the packet after it has been held for the jitter
+// delay; the packets still missing then are lost.
+//
+// The NAL units of an access unit are written one after the other into
+// room reserved in the cache, which grows as needed. The unit ends with
+// the marker bit, or when a packet with another timestamp begins the next
+// one; only then is it committed and queued for the decoding thread,
+// which decodes it as a whole. A unit damaged by a loss is never
+// committed. From a loss on, and at the start, the units holding slices
+// are dropped until one holds an IDR picture; units of parameter sets and
+// SEI still go through.
+//
+//------------------------------------------------------------------------------
+
+#include "RtpDepacketizer.h"
+#include "DecodeSession.h"
+#include "H264Headers.h"
+#include "PerfTimer.h"
+#include "Trace.h"
+#include <string.h>
+
+#define RTP_HEADER_SIZE		12
+#define RTP_SLOT_MASK		(RTP_JITTER_SLOTS - 1)
+
+#define NAL_TYPE_STAP_A		24
+#define NAL_TYPE_FU_A		28
+
+static const unsigned char StartCode[4] = { 0, 0, 0, 1 };
+
+RtpDepacketizer::RtpDepacketizer() :	m_Session(NULL),
+										m_JitterDelayUs(0),
+										m_Slots(NULL),
+										m_Spare(NULL),
+										m_Buffered(0),
+										m_Started(false),
+										m_Ssrc(0),
+										m_Next(0),
+										m_Highest(0),
+										m_LastArrivalUs(0),
+										m_HasUnit(false),
+										m_UnitTimestamp(0),
+										m_UnitTime(0),
+										m_UnitLength(0),
+										m_UnitReserved(false),
+										m_UnitBroken(false),
+										m_UnitHasSlice(false),
+										m_UnitHasIdr(false),
+										m_InFragment(false),
+										m_NalStart(0),
+										m_TimestampKnown(false),
+										m_LastTimestamp(0),
+										m_ExtendedTimestamp(0),
+										m_WaitIdr(true),
+										m_WaitSinceUs(0),
+										m_QueueHead(0),
+										m_QueueCount(0),
+										m_Finished(false),
+										m_Aborted(false),
+										m_Queued(NULL),
+										m_QueueFree(NULL)
+{
+	memset(&m_Stats, 0, sizeof(m_Stats));
+	memset(&m_Snapshot, 0, sizeof(m_Snapshot));
+}
+
+RtpDepacketizer::~RtpDepacketizer()
+{
+	this->Close();
+}
+
+bool RtpDepacketizer::Open( DecodeSession* inSession, int inJitterDelayMs )
+{
+	if (m_Slots || inSession == NULL)
+	{
+		return false;
+	}
+
+	m_Session = inSession;
+	m_JitterDelayUs = (long long)inJitterDelayMs * 1000;
+	m_Slots = new Slot[RTP_JITTER_SLOTS];
+	for (int i = 0; i < RTP_JITTER_SLOTS; i++)
+	{
+		m_Slots[i].Data = new unsigned char[RTP_MAX_PACKET];
+		m_Slots[i].Length = 0;
+		m_Slots[i].Released = false;
+	}
+	m_Spare = new unsigned char[RTP_MAX_PACKET];
+	m_Queued = new PlatformSemaphore(0);
+	m_QueueFree = new PlatformSemaphore(RTP_ACCESS_UNIT_QUEUE);
+	m_QueueHead = 0;
+	m_QueueCount = 0;
+	m_Finished = false;
+	m_Aborted = false;
+
+	memset(&m_Stats, 0, sizeof(m_Stats));
+	this->Reset();
+	return true;
+}
+
+void RtpDepacketizer::Close( void )
+{
+	if (m_Slots)
+	{
+		for (int i = 0; i < RTP_JITTER_SLOTS; i++)
+		{
+			delete [] m_Slots[i].Data;
+		}
+		delete [] m_Slots;
+		m_Slots = NULL;
+	}
+	delete [] m_Spare;
+	delete m_Queued;
+	delete m_QueueFree;
+	m_Spare = NULL;
+	m_Queued = NULL;
+	m_QueueFree = NULL;
+	m_Session = NULL;
+}
+
+void RtpDepacketizer::Reset( void )
+{
+	if (m_Slots == NULL)
+	{
+		return;
+	}
+
+	for (int i = 0; i < RTP_JITTER_SLOTS; i++)
+	{
+		m_Slots[i].Length = 0;
+		m_Slots[i].Released = false;
+	}
+	m_Buffered = 0;
+	m_Started = false;
+
+	if (m_UnitReserved)
+	{
+		m_Session->EndPush(0);
+	}
+	m_HasUnit = false;
+	m_UnitReserved = false;
+	m_InFragment = false;
+	m_TimestampKnown = false;
+	m_ExtendedTimestamp = 0;
+	m_WaitIdr = true;
+	m_WaitSinceUs = 0;
+
+	// The queued units were flushed from the cache with the session
+	{
+		PlatformAutoLock lck(&m_QueueLock);
+		while (m_QueueCount > 0 && m_Queued->TryWait())
+		{
+			m_QueueHead = (m_QueueHead + 1) % RTP_ACCESS_UNIT_QUEUE;
+			m_QueueCount--;
+			m_QueueFree->Post();
+		}
+	}
+	m_Stats.WaitingForIdr = true;
+	this->Publish();
+}
+
+unsigned char* RtpDepacketizer::GetPacketBuffer( void )
+{
+	return m_Spare;
+}
+
+void RtpDepacketizer::OnPacket( const unsigned char* inPacket, long inLength, long long inNowUs )
+{
+	if (m_Slots == NULL)
+	{
+		return;
+	}
+	if (inLength > RTP_MAX_PACKET)
+	{
+		inLength = RTP_MAX_PACKET;
+	}
+
+	// Fixed header, CSRCs, extension and padding
+	if (inLength < RTP_HEADER_SIZE || (inPacket[0] >> 6) != 2)
+	{
+		m_Stats.Malformed++;
+		this->Publish();
+		return;
+	}
+	long payload = RTP_HEADER_SIZE + (inPacket[0] & 0x0f) * 4;
+	long end = inLength;
+	if ((inPacket[0] & 0x10) && payload + 4 <= end)
+	{
+		payload += 4 + ((inPacket[payload + 2] << 8) | inPacket[payload + 3]) * 4;
+	}
+	if (inPacket[0] & 0x20)
+	{
+		end -= inPacket[inLength - 1];
+	}
+	if (payload >= end)
+	{
+		m_Stats.Malformed++;
+		this->Publish();
+		return;
+	}
+
+	unsigned short sequence = (unsigned short)((inPacket[2] << 8) | inPacket[3]);
+	unsigned int timestamp = ((unsigned int)inPacket[4] << 24) | (inPacket[5] << 16) | (inPacket[6] << 8) | inPacket[7];
+	unsigned int ssrc = ((unsigned int)inPacket[8] << 24) | (inPacket[9] << 16) | (inPacket[10] << 8) | inPacket[11];
+
+	// Another source takes over once the current one has been silent
+	if (m_Started && ssrc != m_Ssrc)
+	{
+		if (inNowUs - m_LastArrivalUs < RTP_SOURCE_TIMEOUT * 1000LL)
+		{
+			m_Stats.OtherSource++;
+			this->Publish();
+			return;
+		}
+		this->Resync(sequence);
+		m_TimestampKnown = false;
+	}
+	if (!m_Started)
+	{
+		m_Started = true;
+		m_Next = sequence;
+		m_Highest = (unsigned short)(sequence - 1);
+	}
+	m_Ssrc = ssrc;
+	m_LastArrivalUs = inNowUs;
+	m_Stats.Packets++;
+	m_Stats.Bytes += inLength;
+
+	// Behind the window: a copy of a packet handed on, or one given up for
+	// lost. The slots remember what they handed on until they are reused.
+	short ahead = (short)(sequence - m_Next);
+	if (ahead < 0 && ahead > -RTP_JITTER_SLOTS)
+	{
+		const Slot& released = m_Slots[sequence & RTP_SLOT_MASK];
+		if (released.Released && released.Sequence == sequence)
+			m_Stats.Duplicates++;
+		else
+			m_Stats.Late++;
+		this->Publish();
+		return;
+	}
+	// Far from the window: the sender restarted or many packets were lost
+	if (ahead < 0 || ahead >= RTP_JITTER_SLOTS)
+	{
+		this->Resync(sequence);
+	}
+
+	Slot& slot = m_Slots[sequence & RTP_SLOT_MASK];
+	if (slot.Length > 0)
+	{
+		m_Stats.Duplicates++;
+		this->Publish();
+		return;
+	}
+	if ((short)(sequence - m_Highest) < 0)
+		m_Stats.Reordered++;
+	else
+		m_Highest = sequence;
+
+	if (inPacket == m_Spare)
+	{
+		m_Spare = slot.Data;
+		slot.Data = (unsigned char*)inPacket;
+	}
+	else
+	{
+		memcpy(slot.Data, inPacket, inLength);
+	}
+	slot.Length = inLength;
+	slot.Sequence = sequence;
+	slot.Released = false;
+	slot.Timestamp = timestamp;
+	slot.Marker = (inPacket[1] & 0x80) != 0;
+	slot.Payload = payload;
+	slot.PayloadLength = end - payload;
+	slot.ArrivalUs = inNowUs;
+	if (++m_Buffered > m_Stats.PeakBuffered)
+		m_Stats.PeakBuffered = m_Buffered;
+
+	this->Release(inNowUs, false);
+	this->Publish();
+}
+
+void RtpDepacketizer::Poll( long long inNowUs )
+{
+	if (m_Slots)
+	{
+		this->Release(inNowUs, false);
+		this->Publish();
+	}
+}
+
+void RtpDepacketizer::Finish( void )
+{
+	if (m_Slots == NULL)
+	{
+		return;
+	}
+
+	this->Release(0, true);
+	this->EndAccessUnit();
+	{
+		PlatformAutoLock lck(&m_QueueLock);
+		m_Finished = true;
+	}
+	m_Queued->Post();
+	this->Publish();
+}
+
+// The packets in sequence order. A gap ends when the packet after it has
+// waited long enough, or at once when flushing.
+void RtpDepacketizer::Release( long long inNowUs, bool inFlush )
+{
+	while (m_Buffered > 0)
+	{
+		Slot& slot = m_Slots[m_Next & RTP_SLOT_MASK];
+		if (slot.Length > 0 && slot.Sequence == m_Next)
+		{
+			this->Depacketize(slot);
+			slot.Length = 0;
+			slot.Released = true;
+			m_Buffered--;
+			m_Next++;
+			continue;
+		}
+
+		// All packets held are within the window after m_Next
+		unsigned short next = m_Next;
+		long missing = 0;
+		while (m_Slots[next & RTP_SLOT_MASK].Length == 0 || m_Slots[next & RTP_SLOT_MASK].Sequence != next)
+		{
+			next++;
+			missing++;
+		}
+		if (!inFlush && inNowUs - m_Slots[next & RTP_SLOT_MASK].ArrivalUs < m_JitterDelayUs)
+		{
+			break;
+		}
+		this->OnLoss(missing);
+		m_Next = next;
+	}
+}
+
+// Hands on what is held, then starts again at inSequence
+void RtpDepacketizer::Resync( unsigned short inSequence )
+{
+	this->Release(0, true);
+	this->OnLoss(0);
+	for (int i = 0; i < RTP_JITTER_SLOTS; i++)
+	{
+		m_Slots[i].Released = false;
+	}
+	m_Next = inSequence;
+	m_Highest = (unsigned short)(inSequence - 1);
+	m_Stats.Resyncs++;
+}
+
+void RtpDepacketizer::OnLoss( long inPackets )
+{
+	m_Stats.Lost += inPackets;
+
+	if (m_InFragment)
+	{
+		m_UnitLength = m_NalStart;
+		m_InFragment = false;
+	}
+	if (m_HasUnit)
+	{
+		m_UnitBroken = true;
+	}
+	if (!m_WaitIdr)
+	{
+		m_WaitIdr = true;
+		m_WaitSinceUs = PerfTimeUs();
+		m_Stats.IdrWaits++;
+	}
+}
+
+void RtpDepacketizer::Depacketize( const Slot& inSlot )
+{
+	if (m_HasUnit && inSlot.Timestamp != m_UnitTimestamp)
+	{
+		this->EndAccessUnit();
+	}
+	if (!m_HasUnit)
+	{
+		if (m_TimestampKnown)
+			m_ExtendedTimestamp += (int)(inSlot.Timestamp - m_LastTimestamp);
+		m_TimestampKnown = true;
+		m_LastTimestamp = inSlot.Timestamp;
+
+		m_HasUnit = true;
+		m_UnitTimestamp = inSlot.Timestamp;
+		m_UnitTime = m_ExtendedTimestamp * STREAM_TIME_UNITS / RTP_CLOCK_RATE;
+		m_UnitLength = 0;
+		m_UnitBroken = false;
+		m_UnitHasSlice = false;
+		m_UnitHasIdr = false;
+	}
+
+	const unsigned char* payload = inSlot.Data + inSlot.Payload;
+	long length = inSlot.PayloadLength;
+	int type = payload[0] & 0x1f;
+
+	if (type >= 1 && type <= 23)
+	{
+		m_Stats.SingleNalUnits++;
+		this->AppendNalUnit(payload, length);
+	}
+	else if (type == NAL_TYPE_STAP_A)
+	{
+		m_Stats.Aggregates++;
+		long offset = 1;
+		while (offset + 2 <= length)
+		{
+			long size = (payload[offset] << 8) | payload[offset + 1];
+			offset += 2;
+			if (size == 0 || offset + size > length)
+			{
+				m_Stats.Malformed++;
+				break;
+			}
+			this->AppendNalUnit(payload + offset, size);
+			offset += size;
+		}
+	}
+	else if (type == NAL_TYPE_FU_A && length > 2)
+	{
+		m_Stats.Fragments++;
+		bool first = (payload[1] & 0x80) != 0;
+		bool last = (payload[1] & 0x40) != 0;
+
+		if (first)
+		{
+			// A NAL unit that never got its last fragment
+			if (m_InFragment)
+			{
+				m_UnitLength = m_NalStart;
+				m_Stats.Malformed++;
+			}
+			int nalType = payload[1] & 0x1f;
+			m_NalStart = m_UnitLength;
+			unsigned char* out = this->Room(sizeof(StartCode) + 1 + length - 2);
+			if (out)
+			{
+				memcpy(out, StartCode, sizeof(StartCode));
+				out[sizeof(StartCode)] = (unsigned char)((payload[0] & 0xe0) | nalType);
+				memcpy(out + sizeof(StartCode) + 1, payload + 2, length - 2);
+				m_InFragment = true;
+				if (nalType >= NAL_TYPE_SLICE && nalType <= NAL_TYPE_IDR)
+					m_UnitHasSlice = true;
+				if (nalType == NAL_TYPE_IDR)
+					m_UnitHasIdr = true;
+			}
+		}
+		else if (m_InFragment)
+		{
+			unsigned char* out = this->Room(length - 2);
+			if (out)
+				memcpy(out, payload + 2, length - 2);
+			else
+				m_InFragment = false;
+		}
+		if (last)
+		{
+			m_InFragment = false;
+		}
+	}
+	else
+	{
+		m_Stats.Unsupported++;
+	}
+
+	if (inSlot.Marker)
+	{
+		this->EndAccessUnit();
+	}
+}
+
+void RtpDepacketizer::AppendNalUnit( const unsigned char* inData, long inLength )
+{
+	int type = inData[0] & 0x1f;
+	if (type >= NAL_TYPE_SLICE && type <= NAL_TYPE_IDR)
+		m_UnitHasSlice = true;
+	if (type == NAL_TYPE_IDR)
+		m_UnitHasIdr = true;
+
+	unsigned char* out = this->Room(sizeof(StartCode) + inLength);
+	if (out)
+	{
+		memcpy(out, StartCode, sizeof(StartCode));
+		memcpy(out + sizeof(StartCode), inData, inLength);
+	}
+}
+
+// Where the next inLength bytes of the unit go in the cache, NULL if the
+// unit is dropped
+unsigned char* RtpDepacketizer::Room( long inLength )
+{
+	if (m_UnitBroken)
+	{
+		return NULL;
+	}
+
+	unsigned char* unit = m_Session->BeginPush(m_UnitLength + inLength);
+	if (unit == NULL)
+	{
+		m_UnitBroken = true;
+		m_UnitReserved = false;
+		return NULL;
+	}
+	m_UnitReserved = true;
+	m_UnitLength += inLength;
+	return unit + m_UnitLength - inLength;
+}
+
+void RtpDepacketizer::EndAccessUnit( void )
+{
+	if (!m_HasUnit)
+	{
+		return;
+	}
+	m_HasUnit = false;
+
+	if (m_InFragment)
+	{
+		m_UnitLength = m_NalStart;
+		m_InFragment = false;
+		m_Stats.Malformed++;
+	}
+
+	bool keep = !m_UnitBroken && m_UnitLength > 0 && (!m_WaitIdr || m_UnitHasIdr || !m_UnitHasSlice);
+	if (keep)
+	{
+		TRACE_SCOPE("RtpDepacketizer::Commit");
+		if (m_WaitIdr && m_UnitHasIdr)
+		{
+			if (m_WaitSinceUs)
+				m_Stats.IdrWaitUs += PerfTimeUs() - m_WaitSinceUs;
+			m_WaitIdr = false;
+		}
+
+		m_QueueFree->Wait();
+		if (m_Aborted)
+		{
+			// Left signalled for the next units
+			m_QueueFree->Post();
+			m_Session->EndPush(0);
+			m_Stats.UnitsDropped++;
+		}
+		else if (m_Session->EndPush(m_UnitLength, m_UnitTime))
+		{
+			{
+				PlatformAutoLock lck(&m_QueueLock);
+				m_Queue[(m_QueueHead + m_QueueCount) % RTP_ACCESS_UNIT_QUEUE] = m_UnitLength;
+				m_QueueCount++;
+			}
+			m_Queued->Post();
+			m_Stats.AccessUnits++;
+		}
+		else
+		{
+			m_QueueFree->Post();
+			m_Stats.UnitsDropped++;
+		}
+	}
+	else
+	{
+		if (m_UnitReserved)
+			m_Session->EndPush(0);
+		if (m_UnitLength > 0 || m_UnitBroken)
+			m_Stats.UnitsDropped++;
+	}
+	m_UnitReserved = false;
+	m_UnitLength = 0;
+	m_Stats.WaitingForIdr = m_WaitIdr;
+}
+
+bool RtpDepacketizer::DecodeAccessUnit( void )
+{
+	if (m_Queued == NULL)
+	{
+		return false;
+	}
+
+	m_Queued->Wait();
+	long length;
+	{
+		PlatformAutoLock lck(&m_QueueLock);
+		if (m_QueueCount == 0)
+		{
+			// Finished, for the next call too
+			m_Queued->Post();
+			return false;
+		}
+		length = m_Queue[m_QueueHead];
+		m_QueueHead = (m_QueueHead + 1) % RTP_ACCESS_UNIT_QUEUE;
+		m_QueueCount--;
+	}
+	m_QueueFree->Post();
+
+	m_Session->DecodeBytes(length);
+	return true;
+}
+
+void RtpDepacketizer::Abort( void )
+{
+	if (m_QueueFree == NULL)
+	{
+		return;
+	}
+	m_Aborted = true;
+	m_Session->BeginFlush();
+	m_QueueFree->Post();
+}
+
+void RtpDepacketizer::Publish( void )
+{
+	PlatformAutoLock lck(&m_StatsLock);
+	m_Snapshot = m_Stats;
+}
+
+void RtpDepacketizer::GetStatistics( RtpStatistics* outStats )
+{
+	PlatformAutoLock lck(&m_StatsLock);
+	*outStats = m_Snapshot;
+}
+
+void RtpDepacketizer::Report( const RtpStatistics& inStats, FILE* outFile )
+{
+	fprintf(outFile, "RTP: %lld packets, %.1f MB (%lld single, %lld STAP-A, %lld FU-A, %lld unsupported, %lld malformed)\n",
+			inStats.Packets, inStats.Bytes / 1048576.0, inStats.SingleNalUnits, inStats.Aggregates,
+			inStats.Fragments, inStats.Unsupported, inStats.Malformed);
+	fprintf(outFile, "  %lld lost, %lld late, %lld duplicated, %lld reordered, %lld resyncs, %lld from other sources; "
+					 "at most %ld held\n",
+			inStats.Lost, inStats.Late, inStats.Duplicates, inStats.Reordered, inStats.Resyncs,
+			inStats.OtherSource, inStats.PeakBuffered);
+	fprintf(outFile, "  %lld access units decoded, %lld dropped; %lld waits for an IDR picture, %.3f s in all%s\n",
+			inStats.AccessUnits, inStats.UnitsDropped, inStats.IdrWaits, inStats.IdrWaitUs / 1000000.0,
+			inStats.WaitingForIdr ? ", waiting now" : "");
+}
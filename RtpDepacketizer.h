@@ -0,0 +1,170 @@
+//------------------------------------------------------------------------------
+// File: RtpDepacketizer.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Turns RTP packets carrying H.264 (RFC 6184, single NAL unit and
+// non-interleaved mode) back into access units, written as Annex B
+// straight into the input cache of a decode session. Packets are put
+// back in order in a jitter buffer; after a loss the access units are
+// dropped until the next IDR picture, so the decoder never sees a
+// broken reference chain.
+//
+//------------------------------------------------------------------------------
+
+#ifndef RTP_DEPACKETIZER_H_
+#define RTP_DEPACKETIZER_H_
+
+#include "Platform.h"
+#include <stdio.h>
+
+class DecodeSession;
+
+#define RTP_MAX_PACKET			2048	// Longer datagrams are cut
+#define RTP_JITTER_SLOTS		512		// Packets held for reordering, a power of 2
+#define RTP_JITTER_DELAY		40		// Default ms a packet waits for the ones missing before it
+#define RTP_ACCESS_UNIT_QUEUE	64		// Access units in the cache not taken by the decoding thread
+#define RTP_SOURCE_TIMEOUT		1000	// ms of silence after which another SSRC is taken
+#define RTP_CLOCK_RATE			90000
+
+typedef struct
+{
+	long long	Packets;			// Of the source
+	long long	Bytes;
+	long long	SingleNalUnits;		// Packets by type
+	long long	Aggregates;			// STAP-A
+	long long	Fragments;			// FU-A
+	long long	Unsupported;		// Interleaved mode and unknown types
+	long long	Malformed;
+	long long	Lost;				// Never arrived in time
+	long long	Late;				// Arrived after their turn
+	long long	Duplicates;
+	long long	Reordered;			// Arrived after a later one, still in time
+	long long	OtherSource;		// Other SSRCs, ignored
+	long long	Resyncs;			// Sequence number jumps
+	long long	AccessUnits;		// Handed to the session
+	long long	UnitsDropped;		// Damaged, or waiting for an IDR picture
+	long long	IdrWaits;			// Losses that made the stream wait for an IDR picture
+	long long	IdrWaitUs;			// Until the IDR picture came
+	long		PeakBuffered;		// Packets in the jitter buffer
+	bool		WaitingForIdr;
+} RtpStatistics;
+
+class RtpDepacketizer
+{
+public:
+
+	RtpDepacketizer();
+	virtual ~RtpDepacketizer();
+
+	// The access units go to inSession. Packets missing before a later one
+	// are waited for inJitterDelayMs after it arrived.
+	bool	Open(DecodeSession* inSession, int inJitterDelayMs = RTP_JITTER_DELAY);
+	void	Close(void);
+
+	// Input thread. Forgets the packets and the access unit being built,
+	// and waits for an IDR picture; call when the session is flushed.
+	void	Reset(void);
+
+	// Input thread. Room for the next packet: a packet received there is
+	// taken into the jitter buffer without a copy.
+	unsigned char*	GetPacketBuffer(void);
+
+	// Input thread. Takes a packet, in the buffer from GetPacketBuffer or
+	// anywhere else, and hands on the access units now complete. May block
+	// while the cache or the access unit queue is full.
+	void	OnPacket(const unsigned char* inPacket, long inLength, long long inNowUs);
+
+	// Input thread, when no packet came for a while: hands on the packets
+	// whose wait is over
+	void	Poll(long long inNowUs);
+
+	// Input thread. The source has ended: hands on all packets held, then
+	// DecodeAccessUnit returns false once the queue is empty.
+	void	Finish(void);
+
+	// Decoding thread. Waits for the next access unit in the cache and
+	// decodes it; false once the input has finished.
+	bool	DecodeAccessUnit(void);
+
+	// Decoding thread, once it stops calling DecodeAccessUnit: flushes the
+	// session so the input thread drops the access units instead of waiting
+	// for room. The session stays flushing until its EndFlush.
+	void	Abort(void);
+
+	void	GetStatistics(RtpStatistics* outStats);
+	static void	Report(const RtpStatistics& inStats, FILE* outFile);
+
+private:
+
+	typedef struct
+	{
+		unsigned char*	Data;
+		long			Length;			// 0 if free
+		unsigned short	Sequence;
+		bool			Released;		// Free, Sequence was handed on
+		unsigned int	Timestamp;
+		bool			Marker;
+		long			Payload;		// Offset of the payload
+		long			PayloadLength;
+		long long		ArrivalUs;
+	} Slot;
+
+	void	Release(long long inNowUs, bool inFlush);
+	void	Resync(unsigned short inSequence);
+	void	OnLoss(long inPackets);
+	void	Depacketize(const Slot& inSlot);
+	void	AppendNalUnit(const unsigned char* inData, long inLength);
+	unsigned char*	Room(long inLength);
+	void	EndAccessUnit(void);
+	void	Publish(void);
+
+private:
+
+	DecodeSession*	m_Session;
+	long long		m_JitterDelayUs;
+
+	Slot*			m_Slots;
+	unsigned char*	m_Spare;			// Packet buffer not in a slot
+	long			m_Buffered;
+	bool			m_Started;			// A packet of the source arrived
+	unsigned int	m_Ssrc;
+	unsigned short	m_Next;				// Sequence number released next
+	unsigned short	m_Highest;			// Highest received
+	long long		m_LastArrivalUs;
+
+	bool			m_HasUnit;			// Access unit being written into the cache
+	unsigned int	m_UnitTimestamp;
+	long long		m_UnitTime;			// In 100 ns units from the first access unit
+	long			m_UnitLength;
+	bool			m_UnitReserved;		// Room taken in the cache
+	bool			m_UnitBroken;
+	bool			m_UnitHasSlice;
+	bool			m_UnitHasIdr;
+	bool			m_InFragment;		// FU-A NAL unit being written
+	long			m_NalStart;			// Its offset in the unit
+
+	bool			m_TimestampKnown;	// RTP timestamps extended to 64 bits
+	unsigned int	m_LastTimestamp;
+	long long		m_ExtendedTimestamp;
+
+	bool			m_WaitIdr;
+	long long		m_WaitSinceUs;
+
+	PlatformLock	m_QueueLock;		// Access units between the threads
+	long			m_Queue[RTP_ACCESS_UNIT_QUEUE];
+	int				m_QueueHead;
+	int				m_QueueCount;
+	bool			m_Finished;
+	volatile bool	m_Aborted;
+	PlatformSemaphore*	m_Queued;
+	PlatformSemaphore*	m_QueueFree;
+
+	RtpStatistics	m_Stats;			// Input thread
+	PlatformLock	m_StatsLock;
+	RtpStatistics	m_Snapshot;			// Copied after each packet
+};
+
+#endif
@@ -0,0 +1,163 @@
+//------------------------------------------------------------------------------
+// File: RtpReceiver.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Input front end for RTP cameras.
+//
+// The datagrams are received straight into the depacketizer's spare
+// packet buffer. The socket waits RTP_POLL_INTERVAL at most, so the
+// jitter buffer lets go of the packets after a gap while the sender is
+// silent too.
+//
+//------------------------------------------------------------------------------
+
+#include "RtpReceiver.h"
+#include "PerfTimer.h"
+#include "Trace.h"
+
+RtpReceiver::RtpReceiver() :	m_Stopping(false),
+								m_ResetPending(false),
+								m_IdleTimeoutMs(0),
+								m_Datagrams(0),
+								m_Bytes(0),
+								m_ReceiveErrors(0),
+								m_FirstPacketUs(0),
+								m_LastPacketUs(0)
+{
+}
+
+RtpReceiver::~RtpReceiver()
+{
+	this->Close();
+}
+
+bool RtpReceiver::Open( DecodeSession* inSession, unsigned short inPort, int inJitterDelayMs, int inIdleTimeoutMs )
+{
+	if (m_Thread.IsRunning())
+	{
+		return false;
+	}
+
+	m_Depacketizer.Close();
+	if (!m_Depacketizer.Open(inSession, inJitterDelayMs))
+	{
+		return false;
+	}
+	if (!m_Socket.Bind(inPort, RTP_SOCKET_BUFFER))
+	{
+		m_Depacketizer.Close();
+		return false;
+	}
+
+	m_IdleTimeoutMs = inIdleTimeoutMs;
+	m_Stopping = false;
+	m_ResetPending = false;
+	m_Datagrams = 0;
+	m_Bytes = 0;
+	m_ReceiveErrors = 0;
+	m_FirstPacketUs = 0;
+	m_LastPacketUs = 0;
+
+	if (!m_Thread.Start(ReceiveThread, this))
+	{
+		printf("Cannot start the RTP receiving thread\n");
+		m_Socket.Close();
+		m_Depacketizer.Close();
+		return false;
+	}
+	return true;
+}
+
+// The depacketizer stays open for the decoding thread until the next Open
+void RtpReceiver::Close( bool inDiscard )
+{
+	m_Stopping = true;
+	if (inDiscard && m_Thread.IsRunning())
+		m_Depacketizer.Abort();
+	m_Thread.Join();
+	m_Socket.Close();
+}
+
+bool RtpReceiver::DecodeAccessUnit( void )
+{
+	return m_Depacketizer.DecodeAccessUnit();
+}
+
+void RtpReceiver::Reset( void )
+{
+	m_ResetPending = true;
+}
+
+void RtpReceiver::ReceiveThread( void* inArg )
+{
+	((RtpReceiver*)inArg)->Receive();
+}
+
+void RtpReceiver::Receive( void )
+{
+	while (!m_Stopping)
+	{
+		if (m_ResetPending)
+		{
+			m_ResetPending = false;
+			m_Depacketizer.Reset();
+		}
+
+		unsigned char* packet = m_Depacketizer.GetPacketBuffer();
+		long length = m_Socket.Receive(packet, RTP_MAX_PACKET, RTP_POLL_INTERVAL);
+		long long now = PerfTimeUs();
+
+		if (length > 0)
+		{
+			TRACE_SCOPE("RtpReceiver::Packet");
+			{
+				PlatformAutoLock lck(&m_StatsLock);
+				m_Datagrams++;
+				m_Bytes += length;
+				if (m_FirstPacketUs == 0)
+					m_FirstPacketUs = now;
+				m_LastPacketUs = now;
+			}
+			m_Depacketizer.OnPacket(packet, length, now);
+			continue;
+		}
+
+		if (length < 0)
+		{
+			PlatformAutoLock lck(&m_StatsLock);
+			m_ReceiveErrors++;
+		}
+		m_Depacketizer.Poll(now);
+
+		if (m_IdleTimeoutMs > 0 && m_LastPacketUs > 0 && now - m_LastPacketUs > m_IdleTimeoutMs * 1000LL)
+		{
+			break;
+		}
+	}
+	m_Depacketizer.Finish();
+}
+
+void RtpReceiver::GetStatistics( RtpReceiverStatistics* outStats )
+{
+	{
+		PlatformAutoLock lck(&m_StatsLock);
+		outStats->Datagrams = m_Datagrams;
+		outStats->Bytes = m_Bytes;
+		outStats->ReceiveErrors = m_ReceiveErrors;
+		outStats->FirstPacketUs = m_FirstPacketUs;
+		outStats->LastPacketUs = m_LastPacketUs;
+	}
+	m_Depacketizer.GetStatistics(&outStats->Rtp);
+}
+
+void RtpReceiver::Report( const RtpReceiverStatistics& inStats, FILE* outFile )
+{
+	double seconds = (inStats.LastPacketUs - inStats.FirstPacketUs) / 1000000.0;
+	fprintf(outFile, "Received %lld datagrams, %.1f MB in %.3f s (%.1f Mbit/s), %ld errors\n",
+			inStats.Datagrams, inStats.Bytes / 1048576.0, seconds,
+			seconds > 0 ? inStats.Bytes * 8 / seconds / 1000000.0 : 0.0, inStats.ReceiveErrors);
+	RtpDepacketizer::Report(inStats.Rtp, outFile);
+}
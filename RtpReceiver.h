@@ -0,0 +1,83 @@
+//------------------------------------------------------------------------------
+// File: RtpReceiver.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Input front end for RTP cameras: receives the packets sent to a
+// local UDP port on its own thread and hands them to an RtpDepacketizer,
+// which writes the access units into the decode session's cache. The
+// decoding thread calls DecodeAccessUnit.
+//
+//------------------------------------------------------------------------------
+
+#ifndef RTP_RECEIVER_H_
+#define RTP_RECEIVER_H_
+
+#include "UdpSocket.h"
+#include "RtpDepacketizer.h"
+
+#define RTP_SOCKET_BUFFER	(4 * 1048576)	// Rides out a few frames of bursts
+#define RTP_POLL_INTERVAL	5				// ms between jitter buffer checks without packets
+
+typedef struct
+{
+	long long	Datagrams;
+	long long	Bytes;
+	long		ReceiveErrors;
+	long long	FirstPacketUs;		// PerfTimeUs, 0 before the first
+	long long	LastPacketUs;
+	RtpStatistics	Rtp;
+} RtpReceiverStatistics;
+
+class RtpReceiver
+{
+public:
+
+	RtpReceiver();
+	virtual ~RtpReceiver();
+
+	// Starts receiving on inPort into inSession. After inIdleTimeoutMs
+	// without a packet, once one came, the input ends as with Close; 0
+	// waits for ever.
+	bool	Open(DecodeSession* inSession, unsigned short inPort, int inJitterDelayMs = RTP_JITTER_DELAY,
+				 int inIdleTimeoutMs = 0);
+
+	// Stops receiving; the access units received are still decoded, unless
+	// inDiscard, for a decoding thread that stopped early (see
+	// RtpDepacketizer::Abort)
+	void	Close(bool inDiscard = false);
+
+	// Decoding thread, as RtpDepacketizer::DecodeAccessUnit
+	bool	DecodeAccessUnit(void);
+
+	// Call from the decoding thread when the session is flushed
+	void	Reset(void);
+
+	void	GetStatistics(RtpReceiverStatistics* outStats);
+	static void	Report(const RtpReceiverStatistics& inStats, FILE* outFile);
+
+private:
+
+	static void	ReceiveThread(void* inArg);
+	void	Receive(void);
+
+private:
+
+	UdpSocket		m_Socket;
+	RtpDepacketizer	m_Depacketizer;
+	PlatformThread	m_Thread;
+	volatile bool	m_Stopping;
+	volatile bool	m_ResetPending;		// Taken by the receiving thread
+	int				m_IdleTimeoutMs;
+
+	PlatformLock	m_StatsLock;
+	long long		m_Datagrams;
+	long long		m_Bytes;
+	long			m_ReceiveErrors;
+	long long		m_FirstPacketUs;
+	long long		m_LastPacketUs;
+};
+
+#endif
@@ -0,0 +1,426 @@
+//------------------------------------------------------------------------------
+// File: RtpSend.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Sends an Annex B file as RTP (RFC 6184, non-interleaved mode) over
+// UDP in real time, as a camera would, with packets optionally lost,
+// reordered or duplicated. With DecodeTool -u on the same host it tests
+// the RTP input front end.
+//
+// The NAL units of an access unit share its timestamp, the last packet
+// has the marker bit. NAL units that fit are aggregated into STAP-A
+// packets, larger ones are cut into FU-A fragments.
+//
+//------------------------------------------------------------------------------
+
+#include "UdpSocket.h"
+#include "MappedFile.h"
+#include "H264Headers.h"
+#include "PerfTimer.h"
+#include "Platform.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_PORT		5004
+#define DEFAULT_PAYLOAD		1400	// Bytes of payload per packet, below a 1500 byte MTU
+#define MAX_PAYLOAD			1460
+#define MAX_AGGREGATED		64		// NAL units in one STAP-A
+#define RTP_PAYLOAD_TYPE	96
+#define RTP_CLOCK_RATE_HZ	90000
+
+typedef struct
+{
+	long long	Packets;
+	long long	Bytes;
+	long long	Single;
+	long long	Aggregates;
+	long long	Fragments;
+	long long	Dropped;
+	long long	Reordered;
+	long long	Duplicated;
+	long long	AccessUnits;
+} SendStatistics;
+
+// Builds the packets and sends them, losing, swapping and repeating some
+class RtpSender
+{
+public:
+
+	RtpSender(UdpSocket* inSocket, long inPayload, double inLoss, double inReorder, double inDuplicate)
+		:	m_Socket(inSocket),
+			m_Payload(inPayload),
+			m_Loss(inLoss),
+			m_Reorder(inReorder),
+			m_Duplicate(inDuplicate),
+			m_Sequence((unsigned short)rand()),
+			m_Timestamp((unsigned int)rand() << 16 | (unsigned int)rand()),
+			m_Ssrc((unsigned int)rand() << 16 | (unsigned int)rand()),
+			m_HeldLength(0),
+			m_Count(0)
+	{
+		memset(&m_Stats, 0, sizeof(m_Stats));
+	}
+
+	void SetTimestamp( unsigned int inTimestamp )
+	{
+		m_Timestamp = inTimestamp;
+	}
+
+	unsigned int GetTimestamp( void ) const
+	{
+		return m_Timestamp;
+	}
+
+	// The NAL units of one access unit, without start codes
+	void SendAccessUnit( const unsigned char** inNals, const long* inLengths, int inCount )
+	{
+		m_Count = 0;
+		m_Aggregated = 0;
+		for (int i = 0; i < inCount; i++)
+		{
+			bool last = (i + 1 == inCount);
+			if (inLengths[i] > m_Payload)
+			{
+				this->FlushAggregate(false);
+				this->SendFragments(inNals[i], inLengths[i], last);
+				continue;
+			}
+			if (m_Count > 0 && (m_Aggregated + 2 + inLengths[i] > m_Payload || m_Count == MAX_AGGREGATED))
+			{
+				this->FlushAggregate(false);
+			}
+			m_Nals[m_Count] = inNals[i];
+			m_Lengths[m_Count] = inLengths[i];
+			m_Aggregated += (m_Count == 0 ? 1 : 0) + 2 + inLengths[i];
+			m_Count++;
+		}
+		this->FlushAggregate(true);
+		this->FlushHeld();
+		m_Stats.AccessUnits++;
+	}
+
+	const SendStatistics& GetStatistics( void ) const
+	{
+		return m_Stats;
+	}
+
+private:
+
+	void FlushAggregate( bool inLast )
+	{
+		if (m_Count == 1)
+		{
+			this->SendPacket(m_Nals[0], m_Lengths[0], NULL, 0, inLast);
+			m_Stats.Single++;
+		}
+		else if (m_Count > 1)
+		{
+			unsigned char payload[MAX_PAYLOAD + 3];
+			unsigned char header = 0;
+			long length = 1;
+			for (int i = 0; i < m_Count; i++)
+			{
+				// F is set if any is, NRI is the highest
+				header |= m_Nals[i][0] & 0x80;
+				if ((m_Nals[i][0] & 0x60) > (header & 0x60))
+					header = (unsigned char)((header & 0x80) | (m_Nals[i][0] & 0x60));
+				payload[length] = (unsigned char)(m_Lengths[i] >> 8);
+				payload[length + 1] = (unsigned char)m_Lengths[i];
+				memcpy(payload + length + 2, m_Nals[i], m_Lengths[i]);
+				length += 2 + m_Lengths[i];
+			}
+			payload[0] = (unsigned char)(header | 24);
+			this->SendPacket(payload, length, NULL, 0, inLast);
+			m_Stats.Aggregates++;
+		}
+		m_Count = 0;
+		m_Aggregated = 0;
+	}
+
+	void SendFragments( const unsigned char* inNal, long inLength, bool inLast )
+	{
+		unsigned char header[2];
+		const unsigned char* data = inNal + 1;
+		long remaining = inLength - 1;
+
+		header[0] = (unsigned char)((inNal[0] & 0xe0) | 28);
+		header[1] = (unsigned char)(0x80 | (inNal[0] & 0x1f));
+		while (remaining > 0)
+		{
+			long length = remaining < m_Payload - 2 ? remaining : m_Payload - 2;
+			if (length == remaining)
+				header[1] |= 0x40;
+			this->SendPacket(header, 2, data, length, inLast && length == remaining);
+			m_Stats.Fragments++;
+			header[1] &= ~0x80;
+			data += length;
+			remaining -= length;
+		}
+	}
+
+	// The packet is the two parts after the RTP header
+	void SendPacket( const unsigned char* inFirst, long inFirstLength, const unsigned char* inSecond,
+					 long inSecondLength, bool inMarker )
+	{
+		unsigned char packet[12 + MAX_PAYLOAD + 3];
+		packet[0] = 0x80;
+		packet[1] = (unsigned char)((inMarker ? 0x80 : 0) | RTP_PAYLOAD_TYPE);
+		packet[2] = (unsigned char)(m_Sequence >> 8);
+		packet[3] = (unsigned char)m_Sequence;
+		packet[4] = (unsigned char)(m_Timestamp >> 24);
+		packet[5] = (unsigned char)(m_Timestamp >> 16);
+		packet[6] = (unsigned char)(m_Timestamp >> 8);
+		packet[7] = (unsigned char)m_Timestamp;
+		packet[8] = (unsigned char)(m_Ssrc >> 24);
+		packet[9] = (unsigned char)(m_Ssrc >> 16);
+		packet[10] = (unsigned char)(m_Ssrc >> 8);
+		packet[11] = (unsigned char)m_Ssrc;
+		memcpy(packet + 12, inFirst, inFirstLength);
+		if (inSecondLength > 0)
+			memcpy(packet + 12 + inFirstLength, inSecond, inSecondLength);
+		long length = 12 + inFirstLength + inSecondLength;
+		m_Sequence++;
+
+		if (Chance(m_Loss))
+		{
+			m_Stats.Dropped++;
+			return;
+		}
+		if (m_HeldLength == 0 && Chance(m_Reorder))
+		{
+			// Goes out after the next one
+			memcpy(m_Held, packet, length);
+			m_HeldLength = length;
+			return;
+		}
+		this->Send(packet, length);
+		if (Chance(m_Duplicate))
+		{
+			this->Send(packet, length);
+			m_Stats.Duplicated++;
+		}
+		// Held at the end of an access unit, it goes out in order instead
+		if (m_HeldLength > 0)
+			m_Stats.Reordered++;
+		this->FlushHeld();
+	}
+
+	void FlushHeld( void )
+	{
+		if (m_HeldLength > 0)
+		{
+			this->Send(m_Held, m_HeldLength);
+			m_HeldLength = 0;
+		}
+	}
+
+	void Send( const unsigned char* inPacket, long inLength )
+	{
+		if (m_Socket->Send(inPacket, inLength))
+		{
+			m_Stats.Packets++;
+			m_Stats.Bytes += inLength;
+		}
+	}
+
+	static bool Chance( double inPercent )
+	{
+		return inPercent > 0 && rand() < inPercent * (RAND_MAX / 100.0);
+	}
+
+private:
+
+	UdpSocket*		m_Socket;
+	long			m_Payload;
+	double			m_Loss;
+	double			m_Reorder;
+	double			m_Duplicate;
+	unsigned short	m_Sequence;
+	unsigned int	m_Timestamp;
+	unsigned int	m_Ssrc;
+
+	unsigned char	m_Held[12 + MAX_PAYLOAD + 3];
+	long			m_HeldLength;
+
+	const unsigned char*	m_Nals[MAX_AGGREGATED];		// Being aggregated
+	long			m_Lengths[MAX_AGGREGATED];
+	int				m_Count;
+	long			m_Aggregated;
+
+	SendStatistics	m_Stats;
+};
+
+static void PrintUsage( void )
+{
+	printf("Usage: RtpSend [options] <input.264>\n"
+		   "  -a <host>     Destination IPv4 address (default 127.0.0.1)\n"
+		   "  -p <port>     Destination port (default %d)\n"
+		   "  -r <fps>      Access units a second, 0 as fast as possible (default from the SPS, or 25)\n"
+		   "  -m <bytes>    Payload per packet (default %d, at most %d)\n"
+		   "  -l <percent>  Packets lost\n"
+		   "  -x <percent>  Packets sent after the next one\n"
+		   "  -u <percent>  Packets sent twice\n"
+		   "  -s <seed>     Seed of the losses, sequence numbers and SSRC\n",
+		   DEFAULT_PORT, DEFAULT_PAYLOAD, MAX_PAYLOAD);
+}
+
+int main( int argc, char* argv[] )
+{
+	const char*	inputPath = NULL;
+	const char*	host = "127.0.0.1";
+	int			port = DEFAULT_PORT;
+	double		frameRate = -1;
+	long		payload = DEFAULT_PAYLOAD;
+	double		loss = 0;
+	double		reorder = 0;
+	double		duplicate = 0;
+	unsigned int	seed = (unsigned int)PerfTimeUs();
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+
+		if (arg[0] != '-')
+		{
+			inputPath = arg;
+			continue;
+		}
+		if (i + 1 >= argc || arg[1] == '\0' || arg[2] != '\0')
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		const char* value = argv[++i];
+		switch (arg[1])
+		{
+		case 'a':
+			host = value;
+			break;
+		case 'p':
+			port = atoi(value);
+			break;
+		case 'r':
+			frameRate = atof(value);
+			break;
+		case 'm':
+			payload = atol(value);
+			break;
+		case 'l':
+			loss = atof(value);
+			break;
+		case 'x':
+			reorder = atof(value);
+			break;
+		case 'u':
+			duplicate = atof(value);
+			break;
+		case 's':
+			seed = (unsigned int)atol(value);
+			break;
+		default:
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	if (inputPath == NULL || port <= 0 || port > 65535 || payload < 100 || payload > MAX_PAYLOAD)
+	{
+		PrintUsage();
+		return 1;
+	}
+	srand(seed);
+
+	MappedFile input;
+	if (!input.Open(inputPath))
+	{
+		return 1;
+	}
+	const unsigned char* data = input.Data();
+	long size = (long)input.Size();
+
+	SequenceInfo sps;
+	if (frameRate < 0)
+	{
+		frameRate = FindSequenceParameterSet(data, size, &sps) && GetFrameRate(sps) > 0 ? GetFrameRate(sps) : 25.0;
+	}
+
+	UdpSocket socket;
+	if (!socket.Connect(host, (unsigned short)port))
+	{
+		return 1;
+	}
+	RtpSender sender(&socket, payload, loss, reorder, duplicate);
+	printf("Sending %s to %s:%d, %.2f access units a second, %ld bytes per packet\n",
+		   inputPath, host, port, frameRate, payload);
+
+	// Access units are told apart as by AccessUnitScanner
+	const unsigned char*	nals[MAX_AGGREGATED * 4];
+	long		lengths[MAX_AGGREGATED * 4];
+	int			count = 0;
+	bool		hasPicture = false;
+	long long	units = 0;
+	long long	start = PerfTimeUs();
+	unsigned int	firstTimestamp = sender.GetTimestamp();
+
+	long length = 0;
+	for (long offset = FindNalUnit(data, size, 0, &length); ; offset = FindNalUnit(data, size, offset + length, &length))
+	{
+		bool end = offset < 0;
+		bool begins = end;
+		int type = end || length < 1 ? 0 : data[offset] & 0x1f;
+
+		if (type == NAL_TYPE_SLICE || type == NAL_TYPE_IDR)
+		{
+			begins = hasPicture && length > 1 && (data[offset + 1] & 0x80);
+		}
+		else if (type == NAL_TYPE_AUD || type == NAL_TYPE_SPS || type == NAL_TYPE_PPS ||
+				 type == NAL_TYPE_SEI || (type >= 14 && type <= 18))
+		{
+			begins = hasPicture;
+		}
+
+		if ((begins || count == MAX_AGGREGATED * 4) && count > 0)
+		{
+			// Real time from the first access unit
+			if (frameRate > 0)
+			{
+				long long due = start + (long long)(units * 1000000 / frameRate);
+				long long now = PerfTimeUs();
+				if (due > now)
+					PlatformSleep((unsigned int)((due - now) / 1000));
+			}
+			sender.SetTimestamp(firstTimestamp + (unsigned int)(units * RTP_CLOCK_RATE_HZ / (frameRate > 0 ? frameRate : 25.0)));
+			sender.SendAccessUnit(nals, lengths, count);
+			units++;
+			count = 0;
+			hasPicture = false;
+		}
+		if (end)
+		{
+			break;
+		}
+		if (length > 0)
+		{
+			nals[count] = data + offset;
+			lengths[count] = length;
+			count++;
+		}
+		if (type == NAL_TYPE_SLICE || type == NAL_TYPE_IDR)
+		{
+			hasPicture = true;
+		}
+	}
+
+	double seconds = (PerfTimeUs() - start) / 1000000.0;
+	const SendStatistics& stats = sender.GetStatistics();
+	printf("%lld access units, %lld packets (%lld single, %lld STAP-A, %lld FU-A), %.1f MB in %.3f s, %.1f Mbit/s\n",
+		   stats.AccessUnits, stats.Packets, stats.Single, stats.Aggregates, stats.Fragments,
+		   stats.Bytes / 1048576.0, seconds, seconds > 0 ? stats.Bytes * 8 / seconds / 1000000.0 : 0.0);
+	printf("%lld lost, %lld reordered, %lld duplicated\n", stats.Dropped, stats.Reordered, stats.Duplicated);
+	return 0;
+}
@@ -0,0 +1,514 @@
+//------------------------------------------------------------------------------
+// File: SessionBench.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Runs many concurrent streams on the mock backend, either on the
+// threads of a SessionManager or with a decoding thread per session as the
+// filter does, and reports the throughput, the per-session frame rates,
+// the time sessions wait to be decoded and the memory used.
+//
+//------------------------------------------------------------------------------
+
+#include "SessionManager.h"
+#include "MockDecoderBackend.h"
+#include "H264Headers.h"
+#include "PerfTimer.h"
+#include "Platform.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_SESSIONS		256
+#define BENCH_FRAMES		300
+#define BENCH_FEEDERS		4
+#define BENCH_GOP			30
+#define BENCH_WIDTH			352
+#define BENCH_HEIGHT		288
+#define BENCH_FRAME_US		40000	// 25 fps
+#define BENCH_CACHE_SIZE	256*1024
+#define BENCH_READ_SIZE		64*1024
+
+// The stream every session plays: an SPS and PPS before each IDR, an access
+// unit delimiter and one slice of filler per picture
+typedef struct
+{
+	unsigned char*	Data;
+	long			Size;
+	long*			Units;		// Start of each access unit, and the end
+	int				Frames;
+} BenchStream;
+
+typedef struct
+{
+	unsigned char*	Data;
+	long			Size;
+	int				Bit;
+} BitWriter;
+
+static void PutBits( BitWriter* ioWriter, unsigned long inValue, int inBits )
+{
+	for (int i = inBits - 1; i >= 0; i--)
+	{
+		if (ioWriter->Bit == 0)
+			ioWriter->Data[ioWriter->Size] = 0;
+		if ((inValue >> i) & 1)
+			ioWriter->Data[ioWriter->Size] |= 0x80 >> ioWriter->Bit;
+		if (++ioWriter->Bit == 8)
+		{
+			ioWriter->Bit = 0;
+			ioWriter->Size++;
+		}
+	}
+}
+
+static void PutUe( BitWriter* ioWriter, unsigned long inValue )
+{
+	int bits = 0;
+	while ((inValue + 1) >> (bits + 1))
+		bits++;
+	PutBits(ioWriter, 0, bits);
+	PutBits(ioWriter, inValue + 1, bits + 1);
+}
+
+// Appends a NAL unit with a four byte start code, escaping the payload
+static long PutNalUnit( unsigned char* outData, int inHeader, const unsigned char* inPayload, long inLength )
+{
+	long size = 0;
+	int zeros = 0;
+
+	outData[size++] = 0;
+	outData[size++] = 0;
+	outData[size++] = 0;
+	outData[size++] = 1;
+	outData[size++] = (unsigned char)inHeader;
+	for (long i = 0; i < inLength; i++)
+	{
+		if (zeros >= 2 && inPayload[i] <= 3)
+		{
+			outData[size++] = 3;
+			zeros = 0;
+		}
+		outData[size++] = inPayload[i];
+		zeros = inPayload[i] == 0 ? zeros + 1 : 0;
+	}
+	return size;
+}
+
+static bool BuildStream( int inFrames, BenchStream* outStream )
+{
+	unsigned char sps[32];
+	BitWriter writer = { sps, 0, 0 };
+
+	// Baseline, level 3, frame_num and POC type 2, no VUI
+	PutBits(&writer, 66, 8);
+	PutBits(&writer, 0, 8);
+	PutBits(&writer, 30, 8);
+	PutUe(&writer, 0);						// seq_parameter_set_id
+	PutUe(&writer, 0);						// log2_max_frame_num_minus4
+	PutUe(&writer, 2);						// pic_order_cnt_type
+	PutUe(&writer, 1);						// max_num_ref_frames
+	PutBits(&writer, 0, 1);					// gaps_in_frame_num_value_allowed_flag
+	PutUe(&writer, BENCH_WIDTH / 16 - 1);
+	PutUe(&writer, BENCH_HEIGHT / 16 - 1);
+	PutBits(&writer, 1, 1);					// frame_mbs_only_flag
+	PutBits(&writer, 1, 1);					// direct_8x8_inference_flag
+	PutBits(&writer, 0, 1);					// frame_cropping_flag
+	PutBits(&writer, 0, 1);					// vui_parameters_present_flag
+	PutBits(&writer, 1, 1);					// rbsp_stop_one_bit
+	if (writer.Bit)
+		PutBits(&writer, 0, 8 - writer.Bit);
+
+	static const unsigned char pps[] = { 0xce, 0x38, 0x80 };
+	static const unsigned char aud[] = { 0xf0 };
+
+	outStream->Data = new unsigned char[(long)inFrames * 8192];
+	outStream->Units = new long[inFrames + 1];
+	outStream->Frames = inFrames;
+
+	unsigned char slice[4096];
+	unsigned long seed = 1;
+	long size = 0;
+
+	for (int i = 0; i < inFrames; i++)
+	{
+		outStream->Units[i] = size;
+		size += PutNalUnit(outStream->Data + size, NAL_TYPE_AUD | 0x00, aud, sizeof(aud));
+
+		bool idr = (i % BENCH_GOP) == 0;
+		if (idr)
+		{
+			size += PutNalUnit(outStream->Data + size, NAL_TYPE_SPS | 0x60, sps, writer.Size);
+			size += PutNalUnit(outStream->Data + size, NAL_TYPE_PPS | 0x60, pps, sizeof(pps));
+		}
+
+		// first_mb_in_slice 0, then filler of a plausible size
+		long length = idr ? 3500 : 600 + (long)(seed % 1400);
+		slice[0] = 0x88;
+		for (long k = 1; k < length; k++)
+		{
+			seed = seed * 1103515245 + 12345;
+			slice[k] = (unsigned char)(seed >> 16);
+		}
+		size += PutNalUnit(outStream->Data + size,
+						   idr ? (NAL_TYPE_IDR | 0x60) : (NAL_TYPE_SLICE | 0x40), slice, length);
+	}
+	outStream->Units[inFrames] = size;
+	outStream->Size = size;
+	return true;
+}
+
+class BenchSink : public FrameSink
+{
+public:
+
+	BenchSink() :	m_Frames(0),
+					m_Finished(false)
+	{
+	}
+
+	bool OnFrame( const DecodedFrame& )
+	{
+		m_Frames++;
+		return true;
+	}
+
+	void OnEndOfStream( void )
+	{
+		m_Finished = true;
+	}
+
+	volatile long	m_Frames;
+	volatile bool	m_Finished;
+};
+
+typedef struct
+{
+	int				Index;
+	DecodeSession	Session;
+	BenchSink		Sink;
+	ManagedSession*	Managed;
+	PlatformThread	Thread;		// Without the manager
+	volatile bool	InputDone;
+} BenchSession;
+
+typedef struct
+{
+	SessionManager*	Manager;
+	BenchSession*	Sessions;
+	int				SessionCount;
+	int				Feeder;
+	int				FeederCount;
+	const BenchStream*	Stream;
+	int				FrameUs;	// 0 pushes as fast as the sessions take it
+} FeederArg;
+
+// Pushes one access unit of each of its sessions in turn
+static void FeederThread( void* inArg )
+{
+	FeederArg* arg = (FeederArg*)inArg;
+	const BenchStream* stream = arg->Stream;
+	long long start = PerfTimeUs();
+
+	for (int frame = 0; frame < stream->Frames; frame++)
+	{
+		if (arg->FrameUs > 0)
+		{
+			long long due = start + (long long)frame * arg->FrameUs;
+			long long now = PerfTimeUs();
+			if (due > now)
+				PlatformSleep((unsigned int)((due - now) / 1000));
+		}
+
+		const unsigned char* data = stream->Data + stream->Units[frame];
+		long length = stream->Units[frame + 1] - stream->Units[frame];
+		long long timestamp = (long long)frame * BENCH_FRAME_US * 10;
+
+		for (int i = arg->Feeder; i < arg->SessionCount; i += arg->FeederCount)
+		{
+			BenchSession* session = &arg->Sessions[i];
+			if (arg->Manager)
+				arg->Manager->Push(session->Managed, data, length, timestamp);
+			else
+				session->Session.Push(data, length, timestamp);
+		}
+	}
+
+	for (int i = arg->Feeder; i < arg->SessionCount; i += arg->FeederCount)
+	{
+		BenchSession* session = &arg->Sessions[i];
+		if (arg->Manager)
+		{
+			arg->Manager->EndOfStream(session->Managed);
+		}
+		else
+		{
+			session->Session.BeginEndOfStream();
+			session->InputDone = true;
+		}
+	}
+}
+
+// The decoding loop of the filter's output pin, one thread per session
+static void SessionThread( void* inArg )
+{
+	BenchSession* session = (BenchSession*)inArg;
+
+	for (;;)
+	{
+		if (session->Session.IsCacheEmpty())
+		{
+			if (session->InputDone && session->Session.IsCacheEmpty())
+				break;
+			PlatformSleep(1);
+			continue;
+		}
+		session->Session.DecodeOnePicture();
+	}
+	session->Session.Drain();
+}
+
+static void PrintUsage( void )
+{
+	printf("Usage: SessionBench [options]\n"
+		   "  -s <sessions>    Concurrent streams (default %d)\n"
+		   "  -t <threads>     Decoding threads, 0 for one per processor (default 0)\n"
+		   "  -b               A decoding thread per session instead of the manager\n"
+		   "  -n <frames>      Frames per stream (default %d)\n"
+		   "  -d <us>          Time the mock backend spends on each picture (default 200)\n"
+		   "  -r               Push each stream in real time at 25 fps, not as fast as possible\n"
+		   "  -h <sessions>    Sessions of these with a high priority (default 0)\n"
+		   "  -i <threads>     Threads pushing the data (default %d)\n",
+		   BENCH_SESSIONS, BENCH_FRAMES, BENCH_FEEDERS);
+}
+
+int main( int argc, char* argv[] )
+{
+	int		sessionCount = BENCH_SESSIONS;
+	int		threads = 0;
+	bool	threadPerSession = false;
+	int		frames = BENCH_FRAMES;
+	int		decodeUs = 200;
+	bool	realTime = false;
+	int		highCount = 0;
+	int		feederCount = BENCH_FEEDERS;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+
+		if (strcmp(arg, "-b") == 0)
+		{
+			threadPerSession = true;
+			continue;
+		}
+		if (strcmp(arg, "-r") == 0)
+		{
+			realTime = true;
+			continue;
+		}
+		if (arg[0] != '-' || arg[1] == '\0' || arg[2] != '\0' || i + 1 >= argc)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		int value = atoi(argv[++i]);
+		switch (arg[1])
+		{
+		case 's':
+			sessionCount = value;
+			break;
+		case 't':
+			threads = value;
+			break;
+		case 'n':
+			frames = value;
+			break;
+		case 'd':
+			decodeUs = value;
+			break;
+		case 'h':
+			highCount = value;
+			break;
+		case 'i':
+			feederCount = value;
+			break;
+		default:
+			PrintUsage();
+			return 1;
+		}
+	}
+	if (sessionCount < 1 || frames < 1 || feederCount < 1)
+	{
+		PrintUsage();
+		return 1;
+	}
+	if (feederCount > sessionCount)
+		feederCount = sessionCount;
+
+	BenchStream stream;
+	BuildStream(frames, &stream);
+
+	DecoderConfig config;
+	DecoderSettings settings = config.Settings();
+	settings.Backend = DECODER_BACKEND_MOCK;
+	settings.SmartCacheSize = BENCH_CACHE_SIZE;
+	settings.DecoderBufferSize = BENCH_READ_SIZE;
+	settings.MaxWidth = BENCH_WIDTH;
+	settings.MaxHeight = BENCH_HEIGHT;
+	if (!config.Apply(settings))
+	{
+		printf("Invalid settings\n");
+		return 1;
+	}
+
+	long long startTime = PerfTimeUs();
+
+	SessionManager manager;
+	if (!threadPerSession && !manager.Start(threads))
+	{
+		return 1;
+	}
+
+	BenchSession* sessions = new BenchSession[sessionCount];
+	for (int i = 0; i < sessionCount; i++)
+	{
+		BenchSession* session = &sessions[i];
+		session->Index = i;
+		session->InputDone = false;
+		if (!session->Session.Open(settings, &session->Sink, new MockDecoderBackend(decodeUs)))
+		{
+			printf("Cannot open session %d\n", i);
+			return 1;
+		}
+		session->Session.SetFrameDuration(BENCH_FRAME_US * 10);
+
+		if (threadPerSession)
+		{
+			session->Managed = NULL;
+			session->Thread.Start(SessionThread, session);
+		}
+		else
+		{
+			session->Managed = manager.AddSession(&session->Session,
+				i < highCount ? SESSION_PRIORITY_HIGH : SESSION_PRIORITY_NORMAL);
+		}
+	}
+
+	printf("%d sessions of %d frames %dx%d, %s, mock decode %d us\n",
+		   sessionCount, frames, BENCH_WIDTH, BENCH_HEIGHT,
+		   realTime ? "25 fps each" : "unthrottled", decodeUs);
+	if (threadPerSession)
+		printf("A decoding thread per session\n");
+	else
+		printf("%d decoding threads, %d high priority sessions\n", manager.GetThreadCount(), highCount);
+
+	long long decodeStart = PerfTimeUs();
+
+	FeederArg* feederArgs = new FeederArg[feederCount];
+	PlatformThread* feeders = new PlatformThread[feederCount];
+	for (int i = 0; i < feederCount; i++)
+	{
+		FeederArg* arg = &feederArgs[i];
+		arg->Manager = threadPerSession ? NULL : &manager;
+		arg->Sessions = sessions;
+		arg->SessionCount = sessionCount;
+		arg->Feeder = i;
+		arg->FeederCount = feederCount;
+		arg->Stream = &stream;
+		arg->FrameUs = realTime ? BENCH_FRAME_US : 0;
+		feeders[i].Start(FeederThread, arg);
+	}
+
+	// Fairness is taken half way, at the end every session has decoded everything
+	long long totalFrames = (long long)sessionCount * frames;
+	double fairness = -1;
+	long long firstDone = 0;
+	for (;;)
+	{
+		long long decoded = 0;
+		int finished = 0;
+		for (int i = 0; i < sessionCount; i++)
+		{
+			decoded += sessions[i].Sink.m_Frames;
+			if (sessions[i].Sink.m_Finished)
+				finished++;
+		}
+		if (finished > 0 && firstDone == 0)
+			firstDone = PerfTimeUs();
+		if (!threadPerSession && fairness < 0 && decoded * 2 >= totalFrames)
+		{
+			SessionManagerStatistics stats;
+			manager.GetStatistics(&stats);
+			fairness = stats.Fairness;
+		}
+		if (finished == sessionCount)
+			break;
+		PlatformSleep(5);
+	}
+	long long decodeEnd = PerfTimeUs();
+
+	for (int i = 0; i < feederCount; i++)
+	{
+		feeders[i].Join();
+	}
+
+	double seconds = (decodeEnd - decodeStart) / 1000000.0;
+	long long decoded = 0;
+	double minFps = 0;
+	double maxFps = 0;
+	for (int i = 0; i < sessionCount; i++)
+	{
+		double fps = sessions[i].Sink.m_Frames / seconds;
+		decoded += sessions[i].Sink.m_Frames;
+		if (i == 0 || fps < minFps)
+			minFps = fps;
+		if (fps > maxFps)
+			maxFps = fps;
+	}
+
+	printf("Setup %.3f s, decode %.3f s, first stream done after %.3f s\n",
+		   (decodeStart - startTime) / 1000000.0, seconds, (firstDone - decodeStart) / 1000000.0);
+	printf("%lld of %lld frames: %.1f fps, per session min %.1f avg %.1f max %.1f fps\n",
+		   decoded, totalFrames, decoded / seconds, minFps, decoded / seconds / sessionCount, maxFps);
+
+	if (!threadPerSession)
+	{
+		manager.Report(stdout);
+		printf("Fairness half way %.3f\n", fairness);
+
+		if (highCount > 0 && highCount < sessionCount)
+		{
+			SessionStatistics high;
+			SessionStatistics normal;
+			manager.GetSessionStatistics(sessions[0].Managed, &high);
+			manager.GetSessionStatistics(sessions[sessionCount - 1].Managed, &normal);
+			printf("Wait to decode: high priority avg %.0f us, normal avg %.0f us\n",
+				   high.Turns ? (double)high.WaitUs / high.Turns : 0.0,
+				   normal.Turns ? (double)normal.WaitUs / normal.Turns : 0.0);
+		}
+		manager.Stop();
+	}
+	else
+	{
+		for (int i = 0; i < sessionCount; i++)
+		{
+			sessions[i].Thread.Join();
+		}
+	}
+	printf("Peak memory %.1f MB\n", PlatformPeakMemory() / 1048576.0);
+
+	for (int i = 0; i < sessionCount; i++)
+	{
+		sessions[i].Session.Close();
+	}
+	delete [] sessions;
+	delete [] feeders;
+	delete [] feederArgs;
+	delete [] stream.Data;
+	delete [] stream.Units;
+	return decoded == totalFrames ? 0 : 2;
+}
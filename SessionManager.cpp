@@ -0,0 +1,613 @@
+//------------------------------------------------------------------------------
+// File: SessionManager.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Decodes many sessions on a fixed pool of threads instead of a
+// thread per session.
+//
+// Each thread has a queue of the sessions given to it. A session is in at
+// most one queue and decoded by at most one thread at a time, so a
+// session's frames still leave in order. A thread takes from the front of
+// its own queue, or from the back of another's when its own is empty, and
+// sleeps on a semaphore counting the queued sessions when there is
+// nothing to do.
+//
+//------------------------------------------------------------------------------
+
+#include "SessionManager.h"
+#include "AtomicOps.h"
+#include "PerfTimer.h"
+#include <string.h>
+
+#define SESSION_QUEUE_SIZE		64		// Initial entries of a thread's queue, it grows
+#define SESSION_UNIT_SIZE		64		// Initial entries of a session's unit list, it grows
+#define SESSION_SCAN_BATCH		64
+
+class ManagedSession
+{
+public:
+
+	ManagedSession(DecodeSession* inSession, int inPriority, int inHome);
+	virtual ~ManagedSession();
+
+	bool	AppendUnit(long inLength);
+
+	DecodeSession*	Session;
+	int				Home;			// Thread whose queue it goes to
+
+	// Input thread
+	AccessUnitScanner	Scanner;
+	long long		Pushed;			// Bytes pushed into the session
+	long long		UnitEnd;		// Where the last complete access unit ends
+
+	// Under Lock
+	PlatformLock	Lock;
+	long*			Units;			// Lengths of the access units not decoded yet
+	int				UnitHead;
+	int				UnitCount;
+	int				UnitCapacity;
+	bool			Queued;
+	bool			Running;
+	bool			EndOfStream;
+	bool			Finished;
+	bool			Removed;
+	long long		ReadyTime;		// When it was queued
+	SessionStatistics	Stats;
+};
+
+ManagedSession::ManagedSession( DecodeSession* inSession, int inPriority, int inHome )
+	:	Session(inSession),
+		Home(inHome),
+		Pushed(0),
+		UnitEnd(0),
+		Units(NULL),
+		UnitHead(0),
+		UnitCount(0),
+		UnitCapacity(0),
+		Queued(false),
+		Running(false),
+		EndOfStream(false),
+		Finished(false),
+		Removed(false),
+		ReadyTime(0)
+{
+	memset(&Stats, 0, sizeof(Stats));
+	Stats.Priority = inPriority;
+}
+
+ManagedSession::~ManagedSession()
+{
+	delete [] Units;
+}
+
+// Under Lock
+bool ManagedSession::AppendUnit( long inLength )
+{
+	if (UnitCount == UnitCapacity)
+	{
+		int capacity = UnitCapacity ? UnitCapacity * 2 : SESSION_UNIT_SIZE;
+		long* units = new long[capacity];
+		if (units == NULL)
+		{
+			return false;
+		}
+		for (int i = 0; i < UnitCount; i++)
+		{
+			units[i] = Units[(UnitHead + i) % UnitCapacity];
+		}
+		delete [] Units;
+		Units = units;
+		UnitHead = 0;
+		UnitCapacity = capacity;
+	}
+
+	Units[(UnitHead + UnitCount) % UnitCapacity] = inLength;
+	UnitCount++;
+	Stats.UnitsQueued++;
+	return true;
+}
+
+typedef struct
+{
+	SessionManager*	Manager;
+	int				Thread;
+} WorkerArg;
+
+SessionManager::SessionManager()
+	:	m_ThreadCount(0),
+		m_Threads(NULL),
+		m_Queues(NULL),
+		m_Work(NULL),
+		m_Stopping(false),
+		m_Sessions(NULL),
+		m_SessionCount(0),
+		m_SessionCapacity(0),
+		m_NextHome(0),
+		m_Steals(0),
+		m_Turns(0)
+{
+}
+
+SessionManager::~SessionManager()
+{
+	this->Stop();
+}
+
+bool SessionManager::Start( int inThreads )
+{
+	if (m_Threads)
+	{
+		return false;
+	}
+
+	if (inThreads <= 0)
+	{
+		inThreads = PlatformProcessorCount();
+	}
+	if (inThreads > SESSION_MAX_THREADS)
+	{
+		inThreads = SESSION_MAX_THREADS;
+	}
+
+	m_Stopping = false;
+	m_Steals = 0;
+	m_Turns = 0;
+	m_Work = new PlatformSemaphore(0);
+	m_Queues = new WorkQueue[inThreads];
+	for (int i = 0; i < inThreads; i++)
+	{
+		m_Queues[i].Lock = new PlatformLock;
+		m_Queues[i].Items = new ManagedSession*[SESSION_QUEUE_SIZE];
+		m_Queues[i].Head = 0;
+		m_Queues[i].Count = 0;
+		m_Queues[i].Capacity = SESSION_QUEUE_SIZE;
+	}
+
+	m_ThreadCount = inThreads;
+	m_Threads = new PlatformThread[inThreads];
+	for (int i = 0; i < inThreads; i++)
+	{
+		WorkerArg* arg = new WorkerArg;
+		arg->Manager = this;
+		arg->Thread = i;
+		if (!m_Threads[i].Start(WorkerThread, arg))
+		{
+			printf("Cannot start decoding thread %d\n", i);
+			delete arg;
+			m_ThreadCount = i;
+			this->Stop();
+			return false;
+		}
+	}
+	return true;
+}
+
+void SessionManager::Stop( void )
+{
+	if (m_Threads == NULL)
+	{
+		return;
+	}
+
+	while (m_SessionCount > 0)
+	{
+		this->RemoveSession(m_Sessions[m_SessionCount - 1]);
+	}
+
+	m_Stopping = true;
+	for (int i = 0; i < m_ThreadCount; i++)
+	{
+		m_Work->Post();
+	}
+	for (int i = 0; i < m_ThreadCount; i++)
+	{
+		m_Threads[i].Join();
+	}
+
+	for (int i = 0; i < m_ThreadCount; i++)
+	{
+		delete [] m_Queues[i].Items;
+		delete m_Queues[i].Lock;
+	}
+	delete [] m_Threads;
+	delete [] m_Queues;
+	delete m_Work;
+	delete [] m_Sessions;
+	m_Threads = NULL;
+	m_Queues = NULL;
+	m_Work = NULL;
+	m_Sessions = NULL;
+	m_SessionCapacity = 0;
+	m_ThreadCount = 0;
+}
+
+ManagedSession* SessionManager::AddSession( DecodeSession* inSession, int inPriority )
+{
+	if (m_Threads == NULL || inSession == NULL)
+	{
+		return NULL;
+	}
+	if (inPriority < 1)
+	{
+		inPriority = 1;
+	}
+
+	PlatformAutoLock lck(&m_SessionsLock);
+
+	if (m_SessionCount == m_SessionCapacity)
+	{
+		long capacity = m_SessionCapacity ? m_SessionCapacity * 2 : SESSION_QUEUE_SIZE;
+		ManagedSession** sessions = new ManagedSession*[capacity];
+		if (sessions == NULL)
+		{
+			return NULL;
+		}
+		for (long i = 0; i < m_SessionCount; i++)
+		{
+			sessions[i] = m_Sessions[i];
+		}
+		delete [] m_Sessions;
+		m_Sessions = sessions;
+		m_SessionCapacity = capacity;
+	}
+
+	ManagedSession* session = new ManagedSession(inSession, inPriority, m_NextHome);
+	m_NextHome = (m_NextHome + 1) % m_ThreadCount;
+	m_Sessions[m_SessionCount++] = session;
+	return session;
+}
+
+void SessionManager::RemoveSession( ManagedSession* inSession )
+{
+	if (inSession == NULL)
+	{
+		return;
+	}
+
+	// A queued session is taken off by the thread that picks it
+	for (;;)
+	{
+		{
+			PlatformAutoLock lck(&inSession->Lock);
+			inSession->Removed = true;
+			if (!inSession->Queued && !inSession->Running)
+				break;
+		}
+		PlatformSleep(1);
+	}
+
+	{
+		PlatformAutoLock lck(&m_SessionsLock);
+		for (long i = 0; i < m_SessionCount; i++)
+		{
+			if (m_Sessions[i] == inSession)
+			{
+				m_Sessions[i] = m_Sessions[--m_SessionCount];
+				break;
+			}
+		}
+	}
+	delete inSession;
+}
+
+void SessionManager::SetPriority( ManagedSession* inSession, int inPriority )
+{
+	PlatformAutoLock lck(&inSession->Lock);
+	inSession->Stats.Priority = inPriority < 1 ? 1 : inPriority;
+}
+
+bool SessionManager::Push( ManagedSession* inSession, const unsigned char* inData, long inLength,
+						   long long inTimestamp )
+{
+	if (inSession == NULL || inSession->EndOfStream)
+	{
+		return false;
+	}
+
+	if (!inSession->Session->Push(inData, inLength, inTimestamp))
+	{
+		return false;
+	}
+
+	long long boundaries[SESSION_SCAN_BATCH];
+	long scanned = 0;
+	while (scanned < inLength)
+	{
+		int count;
+		scanned += inSession->Scanner.Scan(inData + scanned, inLength - scanned,
+										   boundaries, SESSION_SCAN_BATCH, &count);
+		for (int i = 0; i < count; i++)
+		{
+			this->AddUnits(inSession, boundaries[i], true);
+		}
+	}
+	inSession->Pushed += inLength;
+	this->AddUnits(inSession, inSession->Pushed, false);
+	return true;
+}
+
+// Queues the data up to inEnd as an access unit if inComplete. A unit
+// longer than the decoder buffer is queued in parts of that size as it
+// arrives, so the cache never holds more of a unit than that before it
+// can be decoded; the decoder finds the picture in the next part.
+void SessionManager::AddUnits( ManagedSession* inSession, long long inEnd, bool inComplete )
+{
+	long maxUnit = inSession->Session->GetSettings().DecoderBufferSize;
+	while (inEnd - inSession->UnitEnd > maxUnit)
+	{
+		this->AddUnit(inSession, maxUnit);
+		inSession->UnitEnd += maxUnit;
+	}
+	if (inComplete && inEnd > inSession->UnitEnd)
+	{
+		this->AddUnit(inSession, (long)(inEnd - inSession->UnitEnd));
+		inSession->UnitEnd = inEnd;
+	}
+}
+
+void SessionManager::EndOfStream( ManagedSession* inSession )
+{
+	if (inSession == NULL || inSession->EndOfStream)
+	{
+		return;
+	}
+
+	this->AddUnits(inSession, inSession->Pushed, true);
+
+	bool schedule = false;
+	{
+		PlatformAutoLock lck(&inSession->Lock);
+		inSession->EndOfStream = true;
+		if (!inSession->Queued && !inSession->Running && !inSession->Removed)
+		{
+			inSession->Queued = true;
+			inSession->ReadyTime = PerfTimeUs();
+			schedule = true;
+		}
+	}
+	if (schedule)
+	{
+		this->Schedule(inSession, inSession->Home);
+	}
+}
+
+bool SessionManager::IsFinished( ManagedSession* inSession )
+{
+	PlatformAutoLock lck(&inSession->Lock);
+	return inSession->Finished;
+}
+
+void SessionManager::AddUnit( ManagedSession* inSession, long inLength )
+{
+	bool schedule = false;
+	{
+		PlatformAutoLock lck(&inSession->Lock);
+		if (!inSession->AppendUnit(inLength))
+		{
+			printf("Cannot queue an access unit\n");
+			return;
+		}
+		if (!inSession->Queued && !inSession->Running && !inSession->Removed)
+		{
+			inSession->Queued = true;
+			inSession->ReadyTime = PerfTimeUs();
+			schedule = true;
+		}
+	}
+	if (schedule)
+	{
+		this->Schedule(inSession, inSession->Home);
+	}
+}
+
+void SessionManager::Schedule( ManagedSession* inSession, int inThread )
+{
+	WorkQueue* queue = &m_Queues[inThread];
+	{
+		PlatformAutoLock lck(queue->Lock);
+		if (queue->Count == queue->Capacity)
+		{
+			int capacity = queue->Capacity * 2;
+			ManagedSession** items = new ManagedSession*[capacity];
+			for (int i = 0; i < queue->Count; i++)
+			{
+				items[i] = queue->Items[(queue->Head + i) % queue->Capacity];
+			}
+			delete [] queue->Items;
+			queue->Items = items;
+			queue->Head = 0;
+			queue->Capacity = capacity;
+		}
+		queue->Items[(queue->Head + queue->Count) % queue->Capacity] = inSession;
+		queue->Count++;
+	}
+	m_Work->Post();
+}
+
+// Called after taking a count of m_Work, so some queue holds a session
+ManagedSession* SessionManager::TakeWork( int inThread )
+{
+	for (;;)
+	{
+		{
+			WorkQueue* queue = &m_Queues[inThread];
+			PlatformAutoLock lck(queue->Lock);
+			if (queue->Count > 0)
+			{
+				ManagedSession* session = queue->Items[queue->Head];
+				queue->Head = (queue->Head + 1) % queue->Capacity;
+				queue->Count--;
+				return session;
+			}
+		}
+
+		for (int i = 1; i < m_ThreadCount; i++)
+		{
+			WorkQueue* queue = &m_Queues[(inThread + i) % m_ThreadCount];
+			PlatformAutoLock lck(queue->Lock);
+			if (queue->Count > 0)
+			{
+				queue->Count--;
+				AtomicIncrement(&m_Steals);
+				return queue->Items[(queue->Head + queue->Count) % queue->Capacity];
+			}
+		}
+	}
+}
+
+// Decodes up to the priority's number of access units, drains the session
+// once its end of stream is reached, and queues it again on this thread
+// if there is more to do
+void SessionManager::RunSession( ManagedSession* inSession, int inThread )
+{
+	long long start = PerfTimeUs();
+	long lengths[SESSION_PRIORITY_HIGH * 4];
+	int count = 0;
+	bool drain = false;
+
+	{
+		PlatformAutoLock lck(&inSession->Lock);
+		inSession->Queued = false;
+		if (inSession->Removed)
+		{
+			return;
+		}
+		inSession->Running = true;
+
+		long long wait = start - inSession->ReadyTime;
+		inSession->Stats.Turns++;
+		inSession->Stats.WaitUs += wait;
+		if (wait > inSession->Stats.MaxWaitUs)
+			inSession->Stats.MaxWaitUs = wait;
+
+		int maxCount = inSession->Stats.Priority;
+		if (maxCount > (int)(sizeof(lengths) / sizeof(lengths[0])))
+			maxCount = (int)(sizeof(lengths) / sizeof(lengths[0]));
+		while (count < maxCount && inSession->UnitCount > 0)
+		{
+			lengths[count++] = inSession->Units[inSession->UnitHead];
+			inSession->UnitHead = (inSession->UnitHead + 1) % inSession->UnitCapacity;
+			inSession->UnitCount--;
+		}
+		drain = inSession->UnitCount == 0 && inSession->EndOfStream && !inSession->Finished;
+	}
+	AtomicIncrement(&m_Turns);
+
+	for (int i = 0; i < count; i++)
+	{
+		inSession->Session->DecodeBytes(lengths[i]);
+	}
+	if (drain)
+	{
+		inSession->Session->Drain();
+	}
+
+	bool schedule = false;
+	{
+		PlatformAutoLock lck(&inSession->Lock);
+		inSession->Running = false;
+		inSession->Stats.UnitsDecoded += count;
+		inSession->Stats.BusyUs += PerfTimeUs() - start;
+		if (drain)
+		{
+			inSession->Finished = true;
+		}
+		if (!inSession->Removed &&
+			(inSession->UnitCount > 0 || (inSession->EndOfStream && !inSession->Finished)))
+		{
+			inSession->Queued = true;
+			inSession->ReadyTime = PerfTimeUs();
+			schedule = true;
+		}
+	}
+	if (schedule)
+	{
+		this->Schedule(inSession, inThread);
+	}
+}
+
+void SessionManager::WorkerThread( void* inArg )
+{
+	WorkerArg* arg = (WorkerArg*)inArg;
+	SessionManager* manager = arg->Manager;
+	int thread = arg->Thread;
+	delete arg;
+
+	manager->RunWorker(thread);
+}
+
+void SessionManager::RunWorker( int inThread )
+{
+	for (;;)
+	{
+		m_Work->Wait();
+		if (m_Stopping)
+		{
+			break;
+		}
+		this->RunSession(this->TakeWork(inThread), inThread);
+	}
+}
+
+void SessionManager::GetSessionStatistics( ManagedSession* inSession, SessionStatistics* outStats )
+{
+	PlatformAutoLock lck(&inSession->Lock);
+	*outStats = inSession->Stats;
+}
+
+// Jain's index (sum x)^2 / (n sum x^2) over the sessions that decoded
+// something, x being the units decoded per priority unit
+void SessionManager::GetStatistics( SessionManagerStatistics* outStats )
+{
+	double sum = 0;
+	double squares = 0;
+	long active = 0;
+	long long turns = 0;
+	long long waitUs = 0;
+
+	memset(outStats, 0, sizeof(*outStats));
+	outStats->Threads = m_ThreadCount;
+	outStats->Steals = m_Steals;
+
+	PlatformAutoLock lck(&m_SessionsLock);
+	outStats->Sessions = m_SessionCount;
+	for (long i = 0; i < m_SessionCount; i++)
+	{
+		SessionStatistics stats;
+		this->GetSessionStatistics(m_Sessions[i], &stats);
+
+		turns += stats.Turns;
+		waitUs += stats.WaitUs;
+		outStats->UnitsDecoded += stats.UnitsDecoded;
+		outStats->BusyUs += stats.BusyUs;
+		if (stats.MaxWaitUs > outStats->MaxWaitUs)
+			outStats->MaxWaitUs = stats.MaxWaitUs;
+
+		if (stats.UnitsDecoded > 0)
+		{
+			double share = (double)stats.UnitsDecoded / stats.Priority;
+			sum += share;
+			squares += share * share;
+			active++;
+		}
+	}
+	outStats->Turns = turns;
+	outStats->AverageWaitUs = turns > 0 ? (double)waitUs / turns : 0;
+	outStats->Fairness = squares > 0 ? sum * sum / (active * squares) : 1.0;
+}
+
+void SessionManager::Report( FILE* outFile )
+{
+	SessionManagerStatistics stats;
+	this->GetStatistics(&stats);
+
+	fprintf(outFile, "Session manager: %d threads, %ld sessions\n", stats.Threads, stats.Sessions);
+	fprintf(outFile, "  Turns %lld (%lld stolen), units decoded %lld, busy %.3f s\n",
+			stats.Turns, stats.Steals, stats.UnitsDecoded, stats.BusyUs / 1000000.0);
+	fprintf(outFile, "  Wait to decode: avg %.0f us, max %lld us\n",
+			stats.AverageWaitUs, stats.MaxWaitUs);
+	fprintf(outFile, "  Fairness %.3f\n", stats.Fairness);
+}
@@ -0,0 +1,134 @@
+//------------------------------------------------------------------------------
+// File: SessionManager.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Decodes many sessions on a fixed pool of threads instead of a
+// thread per session. A session is queued when its pushed data holds a
+// complete access unit; idle threads steal queued sessions from the busy
+// ones. Each turn decodes as many access units as the session priority.
+//
+//------------------------------------------------------------------------------
+
+#ifndef SESSION_MANAGER_H_
+#define SESSION_MANAGER_H_
+
+#include "DecodeSession.h"
+#include "AccessUnitScanner.h"
+#include "Platform.h"
+
+// Access units decoded per turn
+#define SESSION_PRIORITY_LOW		1
+#define SESSION_PRIORITY_NORMAL		2
+#define SESSION_PRIORITY_HIGH		8
+
+#define SESSION_MAX_THREADS			64
+
+typedef struct
+{
+	int			Priority;
+	long long	UnitsQueued;		// Complete access units found in the pushed data
+	long long	UnitsDecoded;
+	long long	Turns;				// Times a thread picked the session
+	long long	BusyUs;				// Decoding
+	long long	WaitUs;				// Queued until a thread picked it, in total
+	long long	MaxWaitUs;
+} SessionStatistics;
+
+typedef struct
+{
+	int			Threads;
+	long		Sessions;
+	long long	Turns;
+	long long	Steals;				// Turns taken from another thread's queue
+	long long	UnitsDecoded;
+	long long	BusyUs;				// Of all threads
+	double		AverageWaitUs;		// Per turn
+	long long	MaxWaitUs;
+	double		Fairness;			// Jain's index of the units decoded per priority unit, 1 is fair
+} SessionManagerStatistics;
+
+// A session added to the manager
+class ManagedSession;
+
+class SessionManager
+{
+public:
+
+	SessionManager();
+	virtual ~SessionManager();
+
+	// inThreads 0 starts one thread per processor
+	bool	Start(int inThreads = 0);
+
+	// Removes the sessions left and stops the threads
+	void	Stop(void);
+
+	int		GetThreadCount(void) const { return m_ThreadCount; }
+
+	// The session is opened and owned by the caller, and must not be
+	// decoded by anything else while it is added
+	ManagedSession*	AddSession(DecodeSession* inSession, int inPriority = SESSION_PRIORITY_NORMAL);
+
+	// Waits for the thread decoding it, if any. The session is not drained.
+	void	RemoveSession(ManagedSession* inSession);
+
+	void	SetPriority(ManagedSession* inSession, int inPriority);
+
+	// One input thread per session. Copies the data into the session's cache
+	// (blocking while it is full) and queues the session once an access
+	// unit is complete.
+	bool	Push(ManagedSession* inSession, const unsigned char* inData, long inLength,
+				 long long inTimestamp = DECODE_NO_TIMESTAMP);
+
+	// The rest of the data is decoded, then the session drained
+	void	EndOfStream(ManagedSession* inSession);
+
+	// Drained after EndOfStream
+	bool	IsFinished(ManagedSession* inSession);
+
+	void	GetSessionStatistics(ManagedSession* inSession, SessionStatistics* outStats);
+	void	GetStatistics(SessionManagerStatistics* outStats);
+	void	Report(FILE* outFile);
+
+private:
+
+	typedef struct
+	{
+		PlatformLock*		Lock;
+		ManagedSession**	Items;
+		int					Head;
+		int					Count;
+		int					Capacity;
+	} WorkQueue;
+
+	void	AddUnit(ManagedSession* inSession, long inLength);
+	void	AddUnits(ManagedSession* inSession, long long inEnd, bool inComplete);
+	void	Schedule(ManagedSession* inSession, int inThread);
+	ManagedSession*	TakeWork(int inThread);
+	void	RunSession(ManagedSession* inSession, int inThread);
+
+	static void	WorkerThread(void* inArg);
+	void	RunWorker(int inThread);
+
+private:
+
+	int				m_ThreadCount;
+	PlatformThread*	m_Threads;
+	WorkQueue*		m_Queues;
+	PlatformSemaphore*	m_Work;			// One count per queued session
+	volatile bool	m_Stopping;
+
+	PlatformLock	m_SessionsLock;
+	ManagedSession**	m_Sessions;
+	long			m_SessionCount;
+	long			m_SessionCapacity;
+	long			m_NextHome;
+
+	volatile long	m_Steals;
+	volatile long	m_Turns;
+};
+
+#endif
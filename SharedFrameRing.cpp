@@ -0,0 +1,635 @@
+//------------------------------------------------------------------------------
+// File: SharedFrameRing.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Ring of decoded frames in named shared memory (POSIX shm or a
+// Win32 file mapping), so that other processes read the frames in place.
+//
+// A slot is taken by the writer by setting its sequence to
+// FRAME_RING_WRITING, then waiting for its reader count to drop to 0. A
+// reader pins a slot by incrementing the count, then checks the sequence.
+// Both steps are full barriers, so either the reader sees the slot taken
+// and lets it go, or the writer sees the pin and waits (or, overwriting,
+// moves on to the next slot).
+//
+// The pin is recorded in the reader's entry, so that the writer can take
+// it back when it drops a reader. The reader checks it is still active
+// after pinning, and whoever clears the entry's Holding with a compare and
+// exchange undoes the pin. Holding is the frame's sequence rather than the
+// slot, so a reader dropped from an entry never clears the pin of the
+// reader registered there after it.
+//
+//------------------------------------------------------------------------------
+
+#include "SharedFrameRing.h"
+#include "AtomicOps.h"
+#include "PerfTimer.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static long AlignUp( long inValue, long inAlignment )
+{
+	return (inValue + inAlignment - 1) / inAlignment * inAlignment;
+}
+
+//------------------------------------------------------------------------------
+// SharedSegment
+
+SharedSegment::SharedSegment() :	m_Data(NULL),
+									m_Size(0),
+									m_Owner(false)
+#ifdef _WIN32
+									, m_Mapping(NULL)
+#endif
+{
+	m_Name[0] = '\0';
+}
+
+SharedSegment::~SharedSegment()
+{
+	this->Close();
+}
+
+bool SharedSegment::Create( const char* inName, long inSize )
+{
+	return this->Map(true, inName, inSize);
+}
+
+bool SharedSegment::Open( const char* inName )
+{
+	return this->Map(false, inName, 0);
+}
+
+#ifdef _WIN32
+
+bool SharedSegment::Map( bool inCreate, const char* inName, long inSize )
+{
+	this->Close();
+	_snprintf(m_Name, sizeof(m_Name) - 1, "Local\\%s", inName);
+	m_Name[sizeof(m_Name) - 1] = '\0';
+
+	if (inCreate)
+	{
+		m_Mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, inSize, m_Name);
+		if (m_Mapping != NULL && GetLastError() == ERROR_ALREADY_EXISTS)
+		{
+			printf("Shared memory %s is in use\n", inName);
+			this->Close();
+			return false;
+		}
+	}
+	else
+	{
+		m_Mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, m_Name);
+	}
+	if (m_Mapping == NULL)
+	{
+		return false;
+	}
+
+	m_Data = (unsigned char*)MapViewOfFile(m_Mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	if (m_Data == NULL)
+	{
+		this->Close();
+		return false;
+	}
+
+	MEMORY_BASIC_INFORMATION info;
+	VirtualQuery(m_Data, &info, sizeof(info));
+	m_Size = inCreate ? inSize : (long)info.RegionSize;
+	m_Owner = inCreate;
+	return true;
+}
+
+// The mapping goes away with its last handle
+void SharedSegment::Close( void )
+{
+	if (m_Data)
+	{
+		UnmapViewOfFile(m_Data);
+		m_Data = NULL;
+	}
+	if (m_Mapping)
+	{
+		CloseHandle(m_Mapping);
+		m_Mapping = NULL;
+	}
+	m_Size = 0;
+	m_Owner = false;
+}
+
+#else
+
+bool SharedSegment::Map( bool inCreate, const char* inName, long inSize )
+{
+	int file;
+
+	this->Close();
+	snprintf(m_Name, sizeof(m_Name), "/%s", inName);
+
+	if (inCreate)
+	{
+		// A ring left by a writer that crashed is replaced, its readers keep the old one
+		shm_unlink(m_Name);
+		file = shm_open(m_Name, O_RDWR | O_CREAT | O_EXCL, 0666);
+		if (file >= 0 && ftruncate(file, inSize) != 0)
+		{
+			close(file);
+			shm_unlink(m_Name);
+			file = -1;
+		}
+	}
+	else
+	{
+		struct stat info;
+		file = shm_open(m_Name, O_RDWR, 0);
+		if (file >= 0 && fstat(file, &info) == 0)
+			inSize = (long)info.st_size;
+	}
+	if (file < 0)
+	{
+		return false;
+	}
+
+	void* data = mmap(NULL, inSize, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+	close(file);
+	if (data == MAP_FAILED)
+	{
+		if (inCreate)
+			shm_unlink(m_Name);
+		return false;
+	}
+
+	m_Data = (unsigned char*)data;
+	m_Size = inSize;
+	m_Owner = inCreate;
+	return true;
+}
+
+void SharedSegment::Close( void )
+{
+	if (m_Data)
+	{
+		munmap(m_Data, m_Size);
+		m_Data = NULL;
+	}
+	if (m_Owner)
+	{
+		shm_unlink(m_Name);
+		m_Owner = false;
+	}
+	m_Size = 0;
+}
+
+#endif
+
+//------------------------------------------------------------------------------
+// FrameRingWriter
+
+FrameRingWriter::FrameRingWriter() :	m_Header(NULL),
+										m_Slots(NULL),
+										m_Readers(NULL),
+										m_StallTimeoutMs(FRAME_RING_STALL_TIMEOUT)
+{
+	memset(&m_Stats, 0, sizeof(m_Stats));
+}
+
+FrameRingWriter::~FrameRingWriter()
+{
+	this->Close();
+}
+
+bool FrameRingWriter::Create( const char* inName, long inSlotCount, long inSlotSize, int inPolicy, int inStallTimeoutMs )
+{
+	this->Close();
+
+	if (inSlotCount < 2 || inSlotSize <= 0)
+	{
+		return false;
+	}
+
+	long slotSize = AlignUp(inSlotSize, FRAME_RING_ALIGN);
+	long dataOffset = AlignUp(sizeof(FrameRingHeader) + sizeof(FrameRingReaderEntry) * FRAME_RING_MAX_READERS +
+							  sizeof(FrameRingSlot) * inSlotCount, FRAME_RING_ALIGN);
+
+	if (!m_Segment.Create(inName, dataOffset + slotSize * inSlotCount))
+	{
+		printf("Cannot create the shared memory %s\n", inName);
+		return false;
+	}
+
+	m_Header = (FrameRingHeader*)m_Segment.Data();
+	m_Readers = (FrameRingReaderEntry*)(m_Header + 1);
+	m_Slots = (FrameRingSlot*)(m_Readers + FRAME_RING_MAX_READERS);
+
+	memset(m_Segment.Data(), 0, dataOffset);
+	m_Header->Version = FRAME_RING_VERSION;
+	m_Header->SlotCount = inSlotCount;
+	m_Header->SlotSize = slotSize;
+	m_Header->DataOffset = dataOffset;
+	m_Header->Policy = inPolicy;
+	for (int i = 0; i < FRAME_RING_MAX_READERS; i++)
+	{
+		m_Readers[i].Holding = -1;
+	}
+	for (long i = 0; i < inSlotCount; i++)
+	{
+		m_Slots[i].Sequence = FRAME_RING_WRITING;
+	}
+
+	// Readers check the magic, it goes last
+	WRITE_FENCE();
+	m_Header->Magic = FRAME_RING_MAGIC;
+
+	m_StallTimeoutMs = inStallTimeoutMs;
+	memset(&m_Stats, 0, sizeof(m_Stats));
+	return true;
+}
+
+void FrameRingWriter::Close( void )
+{
+	if (m_Header)
+	{
+		m_Header->Ended = 1;
+		m_Header = NULL;
+	}
+	m_Slots = NULL;
+	m_Readers = NULL;
+	m_Segment.Close();
+}
+
+void FrameRingWriter::GetStatistics( FrameRingWriterStatistics* outStats ) const
+{
+	*outStats = m_Stats;
+}
+
+bool FrameRingWriter::OnFrame( const DecodedFrame& inFrame )
+{
+	if (m_Header == NULL)
+		return false;
+
+	if (inFrame.Size > m_Header->SlotSize)
+	{
+		if (m_Stats.FramesDropped++ == 0)
+			printf("Frames of %ld bytes do not fit the %ld byte ring slots\n", inFrame.Size, m_Header->SlotSize);
+		return false;
+	}
+
+	long sequence = m_Header->Published;
+	long count = m_Header->SlotCount;
+	long index;
+	FrameRingSlot* slot;
+
+	if (m_Header->Policy == FRAME_RING_BACKPRESSURE)
+	{
+		this->WaitForReaders(sequence);
+	}
+
+	for (long tries = 1; ; tries++)
+	{
+		index = sequence % count;
+		slot = &m_Slots[index];
+
+		// Readers pinning the slot from now on see it taken
+		long previous = slot->Sequence;
+		AtomicCompareExchange(&slot->Sequence, FRAME_RING_WRITING, previous);
+		if (slot->Readers <= 0)
+			break;
+
+		// Overwriting, a frame still held is kept and its sequence number
+		// skipped, so that a slow reader does not hold up the decoder
+		if (m_Header->Policy == FRAME_RING_OVERWRITE && tries < count)
+		{
+			slot->Sequence = previous;
+			sequence++;
+			m_Stats.SlotsSkipped++;
+			continue;
+		}
+		this->WaitForSlot(index);
+		break;
+	}
+
+	memcpy(m_Segment.Data() + m_Header->DataOffset + index * m_Header->SlotSize, inFrame.Data, inFrame.Size);
+	slot->Width = inFrame.Width;
+	slot->Height = inFrame.Height;
+	slot->Size = inFrame.Size;
+	slot->Progressive = inFrame.Progressive;
+	slot->Timestamp = inFrame.Timestamp;
+	slot->FrameNumber = inFrame.FrameNumber;
+
+	WRITE_FENCE();
+	slot->Sequence = sequence;
+	WRITE_FENCE();
+	m_Header->Published = sequence + 1;
+
+	m_Stats.FramesPublished++;
+	return true;
+}
+
+void FrameRingWriter::OnEndOfStream( void )
+{
+	if (m_Header)
+	{
+		WRITE_FENCE();
+		m_Header->Ended = 1;
+	}
+}
+
+void FrameRingWriter::WaitForReaders( long inSequence )
+{
+	for (int i = 0; i < FRAME_RING_MAX_READERS; i++)
+	{
+		long token = m_Readers[i].Active;
+		if (token == 0 || inSequence - m_Readers[i].Position < m_Header->SlotCount)
+			continue;
+
+		long long start = PerfTimeUs();
+		m_Stats.Stalls++;
+		while (m_Readers[i].Active == token && inSequence - m_Readers[i].Position >= m_Header->SlotCount)
+		{
+			if (PerfTimeUs() - start > m_StallTimeoutMs * 1000LL)
+			{
+				this->DropReader(i, token);
+				break;
+			}
+			PlatformSleep(1);
+		}
+		m_Stats.StallUs += PerfTimeUs() - start;
+	}
+}
+
+void FrameRingWriter::WaitForSlot( long inIndex )
+{
+	FrameRingSlot* slot = &m_Slots[inIndex];
+	if (slot->Readers <= 0)
+		return;
+
+	long long start = PerfTimeUs();
+	m_Stats.Stalls++;
+	while (slot->Readers > 0)
+	{
+		if (PerfTimeUs() - start > m_StallTimeoutMs * 1000LL)
+		{
+			// Readers holding a frame that long are taken for dead
+			for (int i = 0; i < FRAME_RING_MAX_READERS; i++)
+			{
+				long token = m_Readers[i].Active;
+				long holding = m_Readers[i].Holding;
+				if (token != 0 && holding >= 0 && holding % m_Header->SlotCount == inIndex)
+					this->DropReader(i, token);
+			}
+			break;
+		}
+		PlatformSleep(1);
+	}
+	m_Stats.StallUs += PerfTimeUs() - start;
+}
+
+// The reader's pin is released on its behalf. The reader notices on its
+// next Acquire and registers again.
+void FrameRingWriter::DropReader( int inEntry, long inToken )
+{
+	FrameRingReaderEntry* entry = &m_Readers[inEntry];
+
+	if (AtomicCompareExchange(&entry->Active, 0, inToken) != inToken)
+		return;
+
+	long holding = entry->Holding;
+	if (holding >= 0 && AtomicCompareExchange(&entry->Holding, -1, holding) == holding)
+	{
+		AtomicDecrement(&m_Slots[holding % m_Header->SlotCount].Readers);
+	}
+	m_Stats.ReadersDropped++;
+	printf("Ring reader %d dropped after %d ms\n", inEntry, m_StallTimeoutMs);
+}
+
+//------------------------------------------------------------------------------
+// FrameRingReader
+
+FrameRingReader::FrameRingReader() :	m_Header(NULL),
+										m_Slots(NULL),
+										m_Readers(NULL),
+										m_Entry(-1),
+										m_Token(0),
+										m_Position(0),
+										m_Held(NULL)
+{
+	memset(&m_Stats, 0, sizeof(m_Stats));
+}
+
+FrameRingReader::~FrameRingReader()
+{
+	this->Detach();
+}
+
+bool FrameRingReader::Attach( const char* inName )
+{
+	static long s_Readers = 0;
+
+	this->Detach();
+
+	if (!m_Segment.Open(inName))
+	{
+		return false;
+	}
+
+	FrameRingHeader* header = (FrameRingHeader*)m_Segment.Data();
+	READ_FENCE();
+	if (m_Segment.Size() < (long)sizeof(FrameRingHeader) || header->Magic != FRAME_RING_MAGIC ||
+		header->Version != FRAME_RING_VERSION ||
+		m_Segment.Size() < header->DataOffset + header->SlotSize * header->SlotCount)
+	{
+		printf("%s is not a frame ring\n", inName);
+		m_Segment.Close();
+		return false;
+	}
+
+	m_Header = header;
+	m_Readers = (FrameRingReaderEntry*)(m_Header + 1);
+	m_Slots = (FrameRingSlot*)(m_Readers + FRAME_RING_MAX_READERS);
+
+	// Unique among the processes and the readers of this one, never 0
+	m_Token = ((PlatformProcessId() & 0xffffff) << 7) | (AtomicIncrement(&s_Readers) & 0x7f);
+	if (m_Token == 0)
+		m_Token = 1;
+
+	memset(&m_Stats, 0, sizeof(m_Stats));
+	if (!this->Register())
+	{
+		printf("%s has %d readers already\n", inName, FRAME_RING_MAX_READERS);
+		this->Detach();
+		return false;
+	}
+	return true;
+}
+
+void FrameRingReader::Detach( void )
+{
+	if (m_Header)
+	{
+		this->Release();
+		if (m_Entry >= 0)
+		{
+			AtomicCompareExchange(&m_Readers[m_Entry].Active, 0, m_Token);
+		}
+	}
+	m_Entry = -1;
+	m_Header = NULL;
+	m_Slots = NULL;
+	m_Readers = NULL;
+	m_Segment.Close();
+}
+
+bool FrameRingReader::Register( void )
+{
+	for (int i = 0; i < FRAME_RING_MAX_READERS; i++)
+	{
+		FrameRingReaderEntry* entry = &m_Readers[i];
+		if (entry->Active == 0 && AtomicCompareExchange(&entry->Active, m_Token, 0) == 0)
+		{
+			// Holding is left alone: it is -1 unless the dropped reader
+			// is still taking back its pin
+			m_Position = m_Header->Published;
+			entry->Position = m_Position;
+			m_Entry = i;
+			return true;
+		}
+	}
+	m_Entry = -1;
+	return false;
+}
+
+void FrameRingReader::Unpin( long inSequence )
+{
+	FrameRingReaderEntry* entry = &m_Readers[m_Entry];
+
+	// Lost if the writer dropped this reader, it released the pin then
+	if (AtomicCompareExchange(&entry->Holding, -1, inSequence) == inSequence)
+	{
+		AtomicDecrement(&m_Slots[inSequence % m_Header->SlotCount].Readers);
+	}
+}
+
+int FrameRingReader::Acquire( DecodedFrame* outFrame, int inTimeoutMs )
+{
+	long long start = 0;
+	int spins = 0;
+
+	if (m_Header == NULL)
+		return FRAME_RING_END;
+
+	this->Release();
+
+	for (;;)
+	{
+		// Dropped by the writer: the frames until now are lost
+		if (m_Entry < 0 || m_Readers[m_Entry].Active != m_Token)
+		{
+			long position = m_Position;
+			if (!this->Register())
+				return FRAME_RING_END;
+			m_Stats.FramesMissed += m_Position - position;
+		}
+
+		long published = m_Header->Published;
+		READ_FENCE();
+
+		if (published - m_Position > 0)
+		{
+			long count = m_Header->SlotCount;
+			if (published - m_Position > count)
+			{
+				m_Stats.FramesMissed += published - count - m_Position;
+				m_Position = published - count;
+			}
+
+			long index = m_Position % count;
+			FrameRingSlot* slot = &m_Slots[index];
+			FrameRingReaderEntry* entry = &m_Readers[m_Entry];
+
+			// Taken from -1 only: a reader dropped from this entry may not
+			// have taken back its pin yet, it does so at once
+			if (AtomicCompareExchange(&entry->Holding, m_Position, -1) != -1)
+				continue;
+			AtomicIncrement(&slot->Readers);
+
+			// Dropped before the writer could see the pin: take it back,
+			// and register again
+			if (entry->Active != m_Token)
+			{
+				this->Unpin(m_Position);
+				continue;
+			}
+
+			if (slot->Sequence == m_Position)
+			{
+				READ_FENCE();
+				outFrame->Data = m_Segment.Data() + m_Header->DataOffset + index * m_Header->SlotSize;
+				outFrame->Size = slot->Size;
+				outFrame->Width = slot->Width;
+				outFrame->Height = slot->Height;
+				outFrame->Timestamp = slot->Timestamp;
+				outFrame->FrameNumber = slot->FrameNumber;
+				outFrame->Progressive = slot->Progressive;
+				outFrame->Luma = NULL;
+				m_Held = slot;
+				m_Stats.FramesRead++;
+				m_Stats.BytesRead += slot->Size;
+				return FRAME_RING_OK;
+			}
+
+			// Being overwritten, the frame is lost
+			this->Unpin(m_Position);
+			m_Stats.FramesMissed++;
+			m_Position++;
+			m_Readers[m_Entry].Position = m_Position;
+			continue;
+		}
+
+		if (m_Header->Ended)
+			return FRAME_RING_END;
+
+		if (++spins < FRAME_RING_SPINS)
+			continue;
+
+		if (inTimeoutMs >= 0)
+		{
+			if (start == 0)
+				start = PerfTimeUs();
+			else if (PerfTimeUs() - start > inTimeoutMs * 1000LL)
+				return FRAME_RING_TIMEOUT;
+		}
+		PlatformSleep(1);
+	}
+}
+
+void FrameRingReader::Release( void )
+{
+	if (m_Held == NULL)
+		return;
+
+	// Undone by the writer instead if it dropped this reader meanwhile
+	this->Unpin(m_Position);
+	m_Position++;
+	if (m_Readers[m_Entry].Active == m_Token)
+	{
+		WRITE_FENCE();
+		m_Readers[m_Entry].Position = m_Position;
+	}
+	m_Held = NULL;
+}
+
+void FrameRingReader::GetStatistics( FrameRingReaderStatistics* outStats ) const
+{
+	*outStats = m_Stats;
+}
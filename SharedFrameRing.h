@@ -0,0 +1,202 @@
+//------------------------------------------------------------------------------
+// File: SharedFrameRing.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Ring of decoded frames in named shared memory (POSIX shm or a
+// Win32 file mapping), so that other processes read the frames in place.
+// The writer is a FrameSink, the readers use FrameRingReader. Frames are
+// published with sequence numbers and pinned by per-slot reader counts;
+// readers poll the ring, no system call is made per frame.
+//
+// Writer and readers must be built for the same word size, the layout
+// uses long for the atomic fields.
+//
+//------------------------------------------------------------------------------
+
+#ifndef SHARED_FRAME_RING_H_
+#define SHARED_FRAME_RING_H_
+
+#include "FrameSink.h"
+#include "Platform.h"
+
+#define FRAME_RING_MAGIC		0x47525246	// "FRRG"
+#define FRAME_RING_VERSION		2
+#define FRAME_RING_MAX_READERS	16
+#define FRAME_RING_ALIGN		4096		// Of the slot data
+
+// What the writer does when a reader is a whole ring behind
+#define FRAME_RING_OVERWRITE	0	// The reader loses the oldest frames, held ones are kept
+#define FRAME_RING_BACKPRESSURE	1	// The writer waits, up to the stall timeout
+
+#define FRAME_RING_STALL_TIMEOUT	1000	// ms, then the reader is dropped from the ring
+#define FRAME_RING_SPINS			4000	// Polls of an idle reader before it sleeps
+
+// Slot sequence while the writer fills it
+#define FRAME_RING_WRITING		(-1L)
+
+// FrameRingReader::Acquire
+#define FRAME_RING_OK			0
+#define FRAME_RING_TIMEOUT		1
+#define FRAME_RING_END			2	// The writer ended the stream or went away
+
+// Shared layout: header, slot descriptors, then the slot data
+typedef struct
+{
+	unsigned long	Magic;
+	unsigned long	Version;
+	long			SlotCount;
+	long			SlotSize;		// Bytes of frame data per slot
+	long			DataOffset;		// Of the first slot's data
+	long			Policy;			// FRAME_RING_OVERWRITE or _BACKPRESSURE
+	volatile long	Published;		// Frames published, the next sequence number
+	volatile long	Ended;			// Set by the writer at the end of the stream
+} FrameRingHeader;
+
+typedef struct
+{
+	volatile long	Sequence;		// Of the frame held, FRAME_RING_WRITING while filled
+	volatile long	Readers;		// Readers holding the frame, the writer waits for 0
+	long			Width;
+	long			Height;
+	long			Size;
+	long			Progressive;
+	long long		Timestamp;
+	long long		FrameNumber;
+} FrameRingSlot;
+
+typedef struct
+{
+	volatile long	Active;			// Token of the reader using the entry, 0 if free
+	volatile long	Position;		// Next sequence the reader wants
+	volatile long	Holding;		// Sequence of the frame pinned by the reader, -1 if none
+} FrameRingReaderEntry;
+
+typedef struct
+{
+	long long	FramesPublished;
+	long long	FramesDropped;	// Too large for a slot
+	long long	SlotsSkipped;	// Sequence numbers passed over for a held frame
+	long		Stalls;			// Waits for a slow reader or a held frame
+	long long	StallUs;
+	long		ReadersDropped;	// Past the stall timeout
+} FrameRingWriterStatistics;
+
+typedef struct
+{
+	long long	FramesRead;
+	long long	FramesMissed;	// Overwritten before they were read, or skipped
+	long long	BytesRead;
+} FrameRingReaderStatistics;
+
+// Mapping of a named segment, created by the writer and opened by readers
+class SharedSegment
+{
+public:
+
+	SharedSegment();
+	virtual ~SharedSegment();
+
+	bool	Create(const char* inName, long inSize);
+	bool	Open(const char* inName);
+	void	Close(void);
+
+	unsigned char*	Data(void) const { return m_Data; }
+	long			Size(void) const { return m_Size; }
+
+private:
+
+	SharedSegment(const SharedSegment&);
+	SharedSegment& operator=(const SharedSegment&);
+
+	bool	Map(bool inCreate, const char* inName, long inSize);
+
+private:
+
+	unsigned char*	m_Data;
+	long			m_Size;
+	bool			m_Owner;		// Removes the name on close
+	char			m_Name[128];
+#ifdef _WIN32
+	HANDLE			m_Mapping;
+#endif
+};
+
+class FrameRingWriter : public FrameSink
+{
+public:
+
+	FrameRingWriter();
+	virtual ~FrameRingWriter();
+
+	// inSlotSize is the largest frame published, in bytes
+	bool	Create(const char* inName, long inSlotCount, long inSlotSize,
+				   int inPolicy = FRAME_RING_OVERWRITE, int inStallTimeoutMs = FRAME_RING_STALL_TIMEOUT);
+	void	Close(void);
+
+	void	GetStatistics(FrameRingWriterStatistics* outStats) const;
+
+	// FrameSink. The frame is copied into the next slot.
+	bool	OnFrame(const DecodedFrame& inFrame);
+	void	OnEndOfStream(void);
+
+private:
+
+	// Waits for the readers a whole ring behind, dropping those past the timeout
+	void	WaitForReaders(long inSequence);
+	// Waits until the slot is no longer pinned, dropping the readers holding it past the timeout
+	void	WaitForSlot(long inIndex);
+	void	DropReader(int inEntry, long inToken);
+
+private:
+
+	SharedSegment			m_Segment;
+	FrameRingHeader*		m_Header;
+	FrameRingSlot*			m_Slots;
+	FrameRingReaderEntry*	m_Readers;
+	int						m_StallTimeoutMs;
+	FrameRingWriterStatistics	m_Stats;
+};
+
+class FrameRingReader
+{
+public:
+
+	FrameRingReader();
+	virtual ~FrameRingReader();
+
+	// Attaches to the ring of that name. Reading starts with the next frame
+	// published. Returns false if there is no ring or all reader entries are taken.
+	bool	Attach(const char* inName);
+	void	Detach(void);
+
+	// Next frame, in place in the ring. outFrame stays valid until Release
+	// or the next Acquire; the writer waits for it meanwhile, so hold it
+	// briefly. Polls, sleeping only after spinning for a while without a
+	// frame. inTimeoutMs < 0 waits forever.
+	int		Acquire(DecodedFrame* outFrame, int inTimeoutMs = -1);
+	void	Release(void);
+
+	void	GetStatistics(FrameRingReaderStatistics* outStats) const;
+
+private:
+
+	bool	Register(void);
+	void	Unpin(long inSequence);
+
+private:
+
+	SharedSegment			m_Segment;
+	FrameRingHeader*		m_Header;
+	FrameRingSlot*			m_Slots;
+	FrameRingReaderEntry*	m_Readers;
+	int						m_Entry;	// Index in m_Readers, -1 if not registered
+	long					m_Token;
+	long					m_Position;
+	FrameRingSlot*			m_Held;
+	FrameRingReaderStatistics	m_Stats;
+};
+
+#endif
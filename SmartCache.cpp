@@ -12,23 +12,26 @@
 //------------------------------------------------------------------------------
 
 #include "SmartCache.h"
+#include "DecoderStats.h"
+#include "PerfTimer.h"
+#include "Trace.h"
+#include <stdlib.h>
+#include <string.h>
 
 long SmartCache::Init(void)
 {
 	m_InputCache = (unsigned char *)malloc(m_CacheSize);
 	m_ReadingOffset = 0;
 	m_WritingOffset = 0;
-	m_InputWaiting  = FALSE;
-	m_OutputWaiting = FALSE;
-	m_CacheChecking = TRUE;  // When checking, maybe return to the cache header
-	// Critical section to access smart cache
-	InitializeCriticalSection(&singleAccess); 
+	m_Reserved = 0;
+	m_InputWaiting  = false;
+	m_OutputWaiting = false;
+	m_CacheChecking = true;  // When checking, maybe return to the cache header
 	return (m_InputCache != NULL);
 }
 
 void SmartCache::Release(void)
 {
-	DeleteCriticalSection(&singleAccess);
 	if (m_InputCache)
 	{
 		free(m_InputCache);
@@ -39,49 +42,111 @@ void SmartCache::Release(void)
 // Blocking receive
 long SmartCache::Receive(unsigned char * inData, long inLength)
 {	
+	TRACE_SCOPE("SmartCache::Receive");
+	long long blockedSince = 0;
+	long lastReading = -1;
 	while (!m_IsFlushing && !HasEnoughSpace(inLength))
 	{
-		m_InputWaiting = TRUE;
-		MakeSpace();
-		Sleep(2);
+		if (blockedSince == 0)
+			blockedSince = PerfTimeUs();
+		m_InputWaiting = true;
+		MakeSpace(m_ReadingOffset == lastReading ? inLength : 0);
+		lastReading = m_ReadingOffset;
+		PlatformSleep(2);
 	}
-	m_InputWaiting = FALSE;
+	m_InputWaiting = false;
+	if (blockedSince && m_Stats)
+		m_Stats->AddInputBlocked(PerfTimeUs() - blockedSince);
 
 	if (!m_IsFlushing && HasEnoughSpace(inLength))
 	{
-		EnterCriticalSection(&singleAccess); // Enter
+		singleAccess.Lock(); // Enter
 		memcpy(m_InputCache + m_WritingOffset, inData, inLength);
 		m_WritingOffset += inLength;
-		LeaveCriticalSection(&singleAccess); // Leave
+		singleAccess.Unlock(); // Leave
 		return 1;
 	}
 	return 0;
 }
 
 // Blocking read
-long SmartCache::FetchData(BYTE * outBuffer, ULONG inLength)
+long SmartCache::FetchData(unsigned char * outBuffer, unsigned long inLength)
 {
 	if (inLength <= 0)
 		return 0;
 
+	TRACE_SCOPE("SmartCache::FetchData");
+	long long blockedSince = 0;
 	while (!m_IsFlushing && !HasEnoughData(inLength))
 	{
-		m_OutputWaiting = TRUE;
-		Sleep(1);
+		if (blockedSince == 0)
+			blockedSince = PerfTimeUs();
+		m_OutputWaiting = true;
+		PlatformSleep(1);
 	}
-	m_OutputWaiting = FALSE;
+	m_OutputWaiting = false;
+	if (blockedSince && m_Stats)
+		m_Stats->AddOutputBlocked(PerfTimeUs() - blockedSince);
 
 	if (!m_IsFlushing && HasEnoughData(inLength))
 	{
-		EnterCriticalSection(&singleAccess); // Enter
+		singleAccess.Lock(); // Enter
 		memcpy(outBuffer, m_InputCache + m_ReadingOffset, inLength);
 		m_ReadingOffset += inLength;
-		LeaveCriticalSection(&singleAccess); // Leave
+		singleAccess.Unlock(); // Leave
 		return inLength;
 	}
 	return 0;
 }
 
+unsigned char * SmartCache::Reserve(long inLength)
+{
+	if (inLength > m_CacheSize)
+		return NULL;
+
+	TRACE_SCOPE("SmartCache::Reserve");
+	long long blockedSince = 0;
+	long lastReading = -1;
+	while (!m_IsFlushing && !HasEnoughSpace(inLength))
+	{
+		// Writers in place come back often for a little more: only wait
+		// if moving the data to the front did not make the room
+		MakeSpace(m_ReadingOffset == lastReading ? inLength : 0);
+		lastReading = m_ReadingOffset;
+		if (HasEnoughSpace(inLength))
+			break;
+		if (blockedSince == 0)
+			blockedSince = PerfTimeUs();
+		m_InputWaiting = true;
+		PlatformSleep(2);
+	}
+	m_InputWaiting = false;
+	if (blockedSince && m_Stats)
+		m_Stats->AddInputBlocked(PerfTimeUs() - blockedSince);
+
+	if (!m_IsFlushing && HasEnoughSpace(inLength))
+	{
+		m_Reserved = inLength;
+		return m_InputCache + m_WritingOffset;
+	}
+	m_Reserved = 0;
+	return NULL;
+}
+
+long SmartCache::Commit(long inLength)
+{
+	long pass = 0;
+	singleAccess.Lock(); // Enter
+	if (!m_IsFlushing && inLength <= m_Reserved)
+	{
+		m_WritingOffset += inLength;
+		pass = 1;
+	}
+	m_Reserved = 0;
+	singleAccess.Unlock(); // Leave
+	return pass;
+}
+
 long SmartCache::GetAvailable(void)
 {
 	return (m_WritingOffset - m_ReadingOffset);
@@ -99,53 +164,60 @@ long SmartCache::HasEnoughData(long inNeedSize)
 	return (inNeedSize <= m_WritingOffset - m_ReadingOffset);
 }
 
-void SmartCache::MakeSpace(void)
+// Little data is moved at once. With inStalledNeed, nothing was read
+// while the writer waited, e.g. the reader waits for the end of an access
+// unit still being written: the data is moved however much there is, if
+// that makes room for inStalledNeed bytes.
+void SmartCache::MakeSpace(long inStalledNeed)
 {
 	long workingSize = m_WritingOffset - m_ReadingOffset;
+	bool stalled = inStalledNeed > 0 && m_ReadingOffset > 0 &&
+				   workingSize + inStalledNeed <= m_CacheSize;
 	// When cache checking, don't drop any data
-	if (!m_CacheChecking && workingSize < m_MinWorkSize)
+	if (!m_CacheChecking && (workingSize < m_MinWorkSize || stalled))
 	{
-		EnterCriticalSection(&singleAccess); // Enter
-		memmove(m_InputCache, m_InputCache + m_ReadingOffset, workingSize);
+		singleAccess.Lock(); // Enter
+		memmove(m_InputCache, m_InputCache + m_ReadingOffset, workingSize + m_Reserved);
 		m_ReadingOffset = 0;
 		m_WritingOffset = workingSize;
-		LeaveCriticalSection(&singleAccess); // Leave
+		singleAccess.Unlock(); // Leave
 	}
 }
 
 void SmartCache::BeginFlush(void)
 {
-	m_IsFlushing = TRUE;
+	m_IsFlushing = true;
 	m_WaitingCounter = 0;
 	while (m_InputWaiting && m_WaitingCounter < 15)  // Make sure NOT block in receiving or reading
 	{
 		m_WaitingCounter++;
-		Sleep(1);
+		PlatformSleep(1);
 	}
 	m_WaitingCounter = 0;
 	while (m_OutputWaiting && m_WaitingCounter < 15)
 	{
 		m_WaitingCounter++;
-		Sleep(1);
+		PlatformSleep(1);
 	}
 	//	Sleep(10);
-	EnterCriticalSection(&singleAccess); // Enter
+	singleAccess.Lock(); // Enter
 	m_ReadingOffset = 0;
 	m_WritingOffset = 0;
-	LeaveCriticalSection(&singleAccess); // Leave
+	m_Reserved = 0;
+	singleAccess.Unlock(); // Leave
 }
 
 void SmartCache::EndFlush(void)
 {
-	m_IsFlushing = FALSE;
+	m_IsFlushing = false;
 }
 
-BOOL SmartCache::CheckInputWaiting(void)
+bool SmartCache::CheckInputWaiting(void)
 {
 	return m_InputWaiting;
 }
 
-BOOL SmartCache::CheckOutputWaiting(void)
+bool SmartCache::CheckOutputWaiting(void)
 {
 	return m_OutputWaiting;
 }
@@ -153,27 +225,35 @@ BOOL SmartCache::CheckOutputWaiting(void)
 // We can reuse the data having been read out
 void SmartCache::SetCacheChecking(void)
 {
-	m_CacheChecking = TRUE;
+	m_CacheChecking = true;
+}
+
+void SmartCache::SetStatistics(DecoderStats* inStats)
+{
+	m_Stats = inStats;
 }
 
 void SmartCache::ResetCacheChecking(void)
 {
-	m_CacheChecking = FALSE;
+	m_CacheChecking = false;
 	//EnterCriticalSection(&singleAccess); // Enter
 	//gReadingOffset = 0; // testing!!
 	//LeaveCriticalSection(&singleAccess); // Leave
 }
 
-SmartCache::SmartCache() : 	m_InputCache(NULL), 
-							m_CacheSize(SMART_CACHE_SIZE), 
-							m_MinWorkSize(MIN_WORK_SIZE), 
+SmartCache::SmartCache(long inCacheSize, long inMinWorkSize) : 	
+							m_InputCache(NULL), 
+							m_CacheSize(inCacheSize), 
+							m_MinWorkSize(inMinWorkSize), 
 							m_ReadingOffset(0), 
 							m_WritingOffset(0), 
-							m_IsFlushing(FALSE),
-							m_InputWaiting(FALSE),
-							m_OutputWaiting(FALSE),
-							m_CacheChecking(TRUE),
-							m_WaitingCounter(0)
+							m_Reserved(0),
+							m_IsFlushing(false),
+							m_InputWaiting(false),
+							m_OutputWaiting(false),
+							m_CacheChecking(true),
+							m_WaitingCounter(0),
+							m_Stats(NULL)
 {
 	this->Init();
 }
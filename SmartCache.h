@@ -14,52 +14,71 @@
 #ifndef SMART_CACHE_H_
 #define SMART_CACHE_H_
 
-#include "StdHeader.h"
+#include "DecoderConfig.h"
+#include "Platform.h"
+
+class DecoderStats;
 
 class SmartCache
 {
 public:
 
-	SmartCache();
+	SmartCache(long inCacheSize = SMART_CACHE_SIZE, long inMinWorkSize = MIN_WORK_SIZE);
 	virtual ~SmartCache();
 
 	long Init(void);
 	void Release(void);
 
 	long Receive(unsigned char * inData, long inLength);
-	long FetchData(BYTE * outBuffer, ULONG inLength);
+	long FetchData(unsigned char * outBuffer, unsigned long inLength);
+
+	// Blocking, for writers that build the data in place: room for inLength
+	// bytes at the write position. What was written in the previous
+	// reservation is kept, though it may have moved. NULL while flushing or
+	// if the cache is smaller.
+	unsigned char * Reserve(long inLength);
+
+	// The first inLength bytes of the reservation can be read, the rest are
+	// dropped. Returns 0 if a flush came in between.
+	long Commit(long inLength);
 
 	void BeginFlush(void);
 	void EndFlush(void);
 	long GetAvailable(void);
 
-	BOOL CheckInputWaiting(void);
-	BOOL CheckOutputWaiting(void);
+	bool CheckInputWaiting(void);
+	bool CheckOutputWaiting(void);
 
 	void SetCacheChecking(void);
 	void ResetCacheChecking(void);
 
+	long GetCacheSize(void) const { return m_CacheSize; }
+	void SetStatistics(DecoderStats* inStats);
+
 protected:
 
-	void MakeSpace(void);
+	void MakeSpace(long inStalledNeed);
 	long HasEnoughSpace(long inNeedSize);
 	long HasEnoughData(long inNeedSize);
 
 private:
 
-	CRITICAL_SECTION singleAccess;
+	PlatformLock singleAccess;
 
 	unsigned char* m_InputCache ;
 	long m_CacheSize;
 	long m_MinWorkSize;
 	long m_ReadingOffset;
 	long m_WritingOffset;
-	BOOL m_IsFlushing;
+	long m_Reserved;		// Written in place past m_WritingOffset, not committed
+	volatile bool m_IsFlushing;
 
-	BOOL m_InputWaiting;
-	BOOL m_OutputWaiting;
-	BOOL m_CacheChecking;
+	volatile bool m_InputWaiting;
+	volatile bool m_OutputWaiting;
+	bool m_CacheChecking;
 	int  m_WaitingCounter;
+
+	DecoderStats* m_Stats;
 };
 
 
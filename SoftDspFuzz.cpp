@@ -0,0 +1,333 @@
+//------------------------------------------------------------------------------
+// File: SoftDspFuzz.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Checks the SSE2 kernels of the software decoder (SoftH264Dsp.h)
+// against the ones written from the standard (SoftH264DspReference.h), on
+// random blocks of every size and position, weights and filter strengths.
+// The samples are random, flat with noise, or at 0 and 255, so the
+// filters both skip and filter their edges and the results clip. Each
+// kernel reads from a buffer that holds just the samples it may read, so
+// a build with a bounds checker finds any read past them. Stops at the
+// first difference and prints the case.
+//
+//------------------------------------------------------------------------------
+
+#include "SoftH264Dsp.h"
+#include "SoftH264DspReference.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FUZZ_ITERATIONS		200000
+#define FUZZ_MAX_STRIDE		48
+#define FUZZ_MAX_COEFF		2048	// The transform stays in 16 bits below 2672
+
+static unsigned long gSeed = 1;
+
+static unsigned int Random( unsigned int inRange )
+{
+	gSeed = (gSeed * 1103515245 + 12345) & 0xffffffff;
+	return (unsigned int)(gSeed >> 8) % inRange;
+}
+
+static int RandomRange( int inLow, int inHigh )
+{
+	return inLow + (int)Random((unsigned int)(inHigh - inLow + 1));
+}
+
+// Random samples, flat ones with some noise, or mostly 0 and 255
+static void FillSamples( unsigned char* outData, long inLength )
+{
+	int mode = (int)Random(3);
+	int base = (int)Random(256);
+	int noise = 1 + (int)Random(12);
+	for (long i = 0; i < inLength; i++)
+	{
+		if (mode == 0)
+			outData[i] = (unsigned char)Random(256);
+		else if (mode == 1)
+			outData[i] = (unsigned char)RefClip255(base + (int)Random((unsigned int)noise * 2 + 1) - noise);
+		else
+			outData[i] = (unsigned char)(Random(4) ? (Random(2) ? 255 : 0) : Random(256));
+	}
+	// A step across the middle, as at block edges
+	if (mode == 1 && Random(2))
+	{
+		int step = RandomRange(-40, 40);
+		for (long i = inLength / 2; i < inLength; i++)
+			outData[i] = (unsigned char)RefClip255(outData[i] + step);
+	}
+}
+
+// A block and the buffers of both kernels. Source and destinations are
+// allocated to the samples they hold, no more.
+class FuzzBuffers
+{
+public:
+
+	FuzzBuffers() : Source(NULL), Expected(NULL), Output(NULL) {}
+	~FuzzBuffers() { this->Free(); }
+
+	void	Allocate(long inSourceSize, long inDstSize)
+	{
+		this->Free();
+		Source = new unsigned char[inSourceSize];
+		Expected = new unsigned char[inDstSize];
+		Output = new unsigned char[inDstSize];
+		FillSamples(Source, inSourceSize);
+		FillSamples(Expected, inDstSize);
+		memcpy(Output, Expected, inDstSize);
+		DstSize = inDstSize;
+	}
+
+	void	Free(void)
+	{
+		delete [] Source;
+		delete [] Expected;
+		delete [] Output;
+		Source = Expected = Output = NULL;
+	}
+
+	bool	Same(void) const { return memcmp(Expected, Output, DstSize) == 0; }
+
+	unsigned char*	Source;
+	unsigned char*	Expected;
+	unsigned char*	Output;
+	long			DstSize;
+};
+
+static const int gBlockSizes[][2] = { { 16, 16 }, { 16, 8 }, { 8, 16 }, { 8, 8 }, { 8, 4 }, { 4, 8 }, { 4, 4 } };
+
+static void PickBlock( bool inChroma, int* outWidth, int* outHeight )
+{
+	int size = (int)Random(sizeof(gBlockSizes) / sizeof(gBlockSizes[0]));
+	*outWidth = inChroma ? gBlockSizes[size][0] / 2 : gBlockSizes[size][0];
+	*outHeight = inChroma ? gBlockSizes[size][1] / 2 : gBlockSizes[size][1];
+}
+
+static bool CheckIdct( char* outCase )
+{
+	short expected[16];
+	short block[16];
+	int density = (int)Random(4);
+	for (int i = 0; i < 16; i++)
+		expected[i] = (short)((int)Random(4) < density ? RandomRange(-FUZZ_MAX_COEFF, FUZZ_MAX_COEFF - 1) : 0);
+	memcpy(block, expected, sizeof(block));
+
+	int stride = RandomRange(4, FUZZ_MAX_STRIDE);
+	FuzzBuffers buffers;
+	buffers.Allocate(1, stride * 3 + 4);
+	RefIdctAdd(buffers.Expected, stride, expected);
+	SoftIdctAdd(buffers.Output, stride, block);
+
+	sprintf(outCase, "SoftIdctAdd stride %d", stride);
+	return buffers.Same() && memcmp(block, expected, sizeof(block)) == 0;
+}
+
+static bool CheckLumaMc( char* outCase )
+{
+	int width, height;
+	PickBlock(false, &width, &height);
+	int dx = (int)Random(4);
+	int dy = (int)Random(4);
+	int srcStride = width + 5 + (Random(2) ? 0 : (int)Random(FUZZ_MAX_STRIDE));
+	int dstStride = width + (int)Random(16);
+
+	// 2 samples left and above, 3 right and below: the last row ends the buffer
+	FuzzBuffers buffers;
+	buffers.Allocate((long)srcStride * (height + 4) + width + 5, (long)dstStride * (height - 1) + width);
+	const unsigned char* src = buffers.Source + 2 * srcStride + 2;
+	RefLumaMc(buffers.Expected, dstStride, src, srcStride, width, height, dx, dy);
+	SoftLumaMc(buffers.Output, dstStride, src, srcStride, width, height, dx, dy);
+
+	sprintf(outCase, "SoftLumaMc %dx%d at (%d, %d), strides %d and %d", width, height, dx, dy, srcStride, dstStride);
+	return buffers.Same();
+}
+
+static bool CheckChromaMc( char* outCase )
+{
+	int width, height;
+	PickBlock(true, &width, &height);
+	if (Random(8) == 0)
+		width = height = 2;
+	int dx = (int)Random(8);
+	int dy = (int)Random(8);
+	int srcStride = width + 1 + (Random(2) ? 0 : (int)Random(FUZZ_MAX_STRIDE));
+	int dstStride = width + (int)Random(8);
+
+	FuzzBuffers buffers;
+	buffers.Allocate((long)srcStride * height + width + 1, (long)dstStride * (height - 1) + width);
+	RefChromaMc(buffers.Expected, dstStride, buffers.Source, srcStride, width, height, dx, dy);
+	SoftChromaMc(buffers.Output, dstStride, buffers.Source, srcStride, width, height, dx, dy);
+
+	sprintf(outCase, "SoftChromaMc %dx%d at (%d, %d), strides %d and %d", width, height, dx, dy, srcStride, dstStride);
+	return buffers.Same();
+}
+
+static bool CheckWeight( char* outCase )
+{
+	int width, height;
+	PickBlock(Random(2) != 0, &width, &height);
+	int stride = width + (int)Random(16);
+	int srcStride = width + (int)Random(16);
+	int kind = (int)Random(3);
+
+	FuzzBuffers buffers;
+	buffers.Allocate((long)srcStride * (height - 1) + width, (long)stride * (height - 1) + width);
+	if (kind == 0)
+	{
+		RefAverage(buffers.Expected, stride, buffers.Source, srcStride, width, height);
+		SoftAverage(buffers.Output, stride, buffers.Source, srcStride, width, height);
+		sprintf(outCase, "SoftAverage %dx%d, strides %d and %d", width, height, stride, srcStride);
+	}
+	else if (kind == 1)
+	{
+		int denom = (int)Random(8);
+		int weight = RandomRange(-128, 127);
+		int offset = RandomRange(-128, 127);
+		RefWeight(buffers.Expected, stride, width, height, denom, weight, offset);
+		SoftWeight(buffers.Output, stride, width, height, denom, weight, offset);
+		sprintf(outCase, "SoftWeight %dx%d, stride %d, denominator %d, weight %d, offset %d",
+				width, height, stride, denom, weight, offset);
+	}
+	else
+	{
+		// Implicit weights, or explicit ones
+		int denom, weight0, weight1, offset;
+		if (Random(2))
+		{
+			denom = 5;
+			weight1 = RandomRange(-64, 128);
+			weight0 = 64 - weight1;
+			offset = 0;
+		}
+		else
+		{
+			denom = (int)Random(8);
+			weight0 = RandomRange(-128, 127);
+			weight1 = RandomRange(-128, 127);
+			offset = (RandomRange(-128, 127) + RandomRange(-128, 127) + 1) >> 1;
+		}
+		RefBiWeight(buffers.Expected, stride, buffers.Source, srcStride, width, height, denom, weight0, weight1, offset);
+		SoftBiWeight(buffers.Output, stride, buffers.Source, srcStride, width, height, denom, weight0, weight1, offset);
+		sprintf(outCase, "SoftBiWeight %dx%d, strides %d and %d, denominator %d, weights %d and %d, offset %d",
+				width, height, stride, srcStride, denom, weight0, weight1, offset);
+	}
+	return buffers.Same();
+}
+
+static bool CheckDeblock( char* outCase )
+{
+	bool chroma = Random(2) != 0;
+	bool vertical = Random(2) != 0;
+	bool intra = Random(4) == 0;
+	int alpha = (int)Random(256);
+	int beta = (int)Random(19);
+	int tc0[4];
+	for (int i = 0; i < 4; i++)
+		tc0[i] = intra ? -1 : RandomRange(-1, 25);
+
+	// The samples across the edge, p3 to q3 (p1 to q1 for chroma), and along it
+	int across = chroma ? 4 : 8;
+	int along = chroma ? 8 : 16;
+	int stride = (vertical ? across : along) + (int)Random(FUZZ_MAX_STRIDE);
+	int rows = vertical ? along : across;
+	int columns = vertical ? across : along;
+
+	FuzzBuffers buffers;
+	buffers.Allocate(1, (long)stride * (rows - 1) + columns);
+	long edge = vertical ? across / 2 : (long)(across / 2) * stride;
+	if (chroma)
+	{
+		RefChromaEdge(buffers.Expected + edge, vertical ? 1 : stride, vertical ? stride : 1, alpha, beta, tc0, intra);
+		SoftFilterChromaEdge(buffers.Output + edge, stride, vertical, alpha, beta, tc0, intra);
+	}
+	else
+	{
+		RefLumaEdge(buffers.Expected + edge, vertical ? 1 : stride, vertical ? stride : 1, alpha, beta, tc0, intra);
+		SoftFilterLumaEdge(buffers.Output + edge, stride, vertical, alpha, beta, tc0, intra);
+	}
+
+	sprintf(outCase, "SoftFilter%sEdge %s, stride %d, alpha %d, beta %d, tc0 %d %d %d %d%s",
+			chroma ? "Chroma" : "Luma", vertical ? "vertical" : "horizontal", stride, alpha, beta,
+			tc0[0], tc0[1], tc0[2], tc0[3], intra ? ", intra" : "");
+	return buffers.Same();
+}
+
+static void PrintUsage( void )
+{
+	printf("Usage: SoftDspFuzz [options]\n"
+		   "  -n <blocks>      Blocks to check (default %d)\n"
+		   "  -s <seed>        Seed of the blocks (default 1)\n",
+		   FUZZ_ITERATIONS);
+}
+
+int main( int argc, char* argv[] )
+{
+	long	iterations = FUZZ_ITERATIONS;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		if (arg[0] != '-' || arg[1] == '\0' || arg[2] != '\0' || i + 1 >= argc)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		long value = atol(argv[++i]);
+		switch (arg[1])
+		{
+		case 'n':
+			iterations = value;
+			break;
+		case 's':
+			gSeed = (unsigned long)value;
+			break;
+		default:
+			PrintUsage();
+			return 1;
+		}
+	}
+	if (iterations < 1)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	static const char* names[] = { "transform", "luma", "chroma", "weighted", "deblocking" };
+	long counts[5] = { 0, 0, 0, 0, 0 };
+	long checked = 0;
+	bool passed = true;
+	char description[256];
+
+	for (long n = 0; n < iterations && passed; n++, checked++)
+	{
+		int kind = (int)Random(5);
+		bool same;
+		switch (kind)
+		{
+		case 0:		same = CheckIdct(description); break;
+		case 1:		same = CheckLumaMc(description); break;
+		case 2:		same = CheckChromaMc(description); break;
+		case 3:		same = CheckWeight(description); break;
+		default:	same = CheckDeblock(description); break;
+		}
+		counts[kind]++;
+		if (!same)
+		{
+			printf("Block %ld differs: %s\n", n, description);
+			passed = false;
+		}
+	}
+
+	printf("%s: %ld blocks", passed ? "No difference" : "Failed", checked);
+	for (int i = 0; i < 5; i++)
+		printf(", %ld %s", counts[i], names[i]);
+	printf("\n");
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,129 @@
+//------------------------------------------------------------------------------
+// File: SoftH264Cabac.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: CABAC arithmetic decoding engine (9.3.1.2 and 9.3.3.2) over the
+// cached bit reader. A context is a byte holding pStateIdx << 1 | valMPS.
+//
+//------------------------------------------------------------------------------
+
+#ifndef SOFT_H264_CABAC_H_
+#define SOFT_H264_CABAC_H_
+
+#include "BitReader.h"
+#include "SoftH264Tables.h"
+
+class SoftCabac
+{
+public:
+
+	SoftCabac() : m_Reader(NULL, 0), m_Start(NULL), m_Length(0), m_Range(0), m_Offset(0) {}
+
+	// inData is the first byte of the arithmetic code
+	void Start(const unsigned char* inData, long inLength)
+	{
+		m_Reader = BitReader(inData, inLength);
+		m_Start = inData;
+		m_Length = inLength;
+		m_Range = 510;
+		m_Offset = m_Reader.ReadBits(9);
+	}
+
+	// 9.3.1.1 for SliceQPY
+	static void InitContexts(unsigned char* outContexts, const signed char (*inInit)[2], int inQp)
+	{
+		int qp = inQp < 0 ? 0 : (inQp > 51 ? 51 : inQp);
+		for (int i = 0; i < SOFT_CABAC_CONTEXTS; i++)
+		{
+			int state = ((inInit[i][0] * qp) >> 4) + inInit[i][1];
+			state = state < 1 ? 1 : (state > 126 ? 126 : state);
+			outContexts[i] = (unsigned char)(state <= 63 ? (63 - state) << 1 : ((state - 64) << 1) | 1);
+		}
+	}
+
+	int DecodeDecision(unsigned char* ioContext)
+	{
+		int state = *ioContext;
+		unsigned int lps = SoftCabacRangeLps[state >> 1][(m_Range >> 6) & 3];
+		m_Range -= lps;
+		int bin;
+		if (m_Offset < m_Range)
+		{
+			bin = state & 1;
+			if (state < 124)
+				*ioContext = (unsigned char)(state + 2);
+			if (m_Range < 256)
+			{
+				m_Range <<= 1;
+				m_Offset = (m_Offset << 1) | m_Reader.ReadBit();
+			}
+			return bin;
+		}
+
+		m_Offset -= m_Range;
+		m_Range = lps;
+		bin = !(state & 1);
+		if (state < 2)
+			*ioContext = (unsigned char)(state ^ 1);
+		else
+			*ioContext = (unsigned char)((SoftCabacTransLps[state >> 1] << 1) | (state & 1));
+		// lps is 6 to 240
+		static const unsigned char shifts[32] =
+		{
+			6, 5, 4, 4, 3, 3, 3, 3, 2, 2, 2, 2, 2, 2, 2, 2,
+			1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1
+		};
+		int shift = shifts[m_Range >> 3];
+		m_Range <<= shift;
+		m_Offset = (m_Offset << shift) | m_Reader.ReadBits(shift);
+		return bin;
+	}
+
+	int DecodeBypass(void)
+	{
+		m_Offset = (m_Offset << 1) | m_Reader.ReadBit();
+		if (m_Offset >= m_Range)
+		{
+			m_Offset -= m_Range;
+			return 1;
+		}
+		return 0;
+	}
+
+	int DecodeTerminate(void)
+	{
+		m_Range -= 2;
+		if (m_Offset >= m_Range)
+			return 1;
+		if (m_Range < 256)
+		{
+			m_Range <<= 1;
+			m_Offset = (m_Offset << 1) | m_Reader.ReadBit();
+		}
+		return 0;
+	}
+
+	// After a terminating bin of 1 (I_PCM): the byte aligned data that
+	// follows. Start again after it.
+	const unsigned char* GetAlignedData(void) const
+	{
+		return m_Start + (long)((m_Reader.GetPosition() + 7) >> 3);
+	}
+
+	const unsigned char* GetEnd(void) const { return m_Start + m_Length; }
+
+	bool IsOverrun(void) const { return m_Reader.IsOverrun(); }
+
+private:
+
+	BitReader		m_Reader;
+	const unsigned char*	m_Start;
+	long			m_Length;
+	unsigned int	m_Range;
+	unsigned int	m_Offset;
+};
+
+#endif
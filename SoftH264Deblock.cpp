@@ -0,0 +1,174 @@
+//------------------------------------------------------------------------------
+// File: SoftH264Deblock.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Deblocking filter of the software decoder (8.7), a macroblock row
+// at a time once the rows around it are decoded. The boundary strengths
+// come from the macroblock data of the picture; the filters themselves
+// are the SSE2 kernels.
+//
+//------------------------------------------------------------------------------
+
+#include "SoftH264Picture.h"
+#include "SoftH264Tables.h"
+#include "SoftH264Dsp.h"
+
+static inline int Clip51( int inValue )
+{
+	return inValue < 0 ? 0 : (inValue > 51 ? 51 : inValue);
+}
+
+static inline bool MvDiffers( const short* inA, const short* inB )
+{
+	return inA[0] - inB[0] >= 4 || inB[0] - inA[0] >= 4 || inA[1] - inB[1] >= 4 || inB[1] - inA[1] >= 4;
+}
+
+// 8.7.2.1 for frames, between block inBlockP of inP and inBlockQ of inQ
+static int GetStrength( const SoftPicture* inPicture, const SoftMb* inP, int inBlockP, const SoftMb* inQ, int inBlockQ,
+						bool inMbEdge )
+{
+	if ((inP->Type | inQ->Type) & SOFT_MB_INTRA)
+		return inMbEdge ? 4 : 3;
+	if (inP->NonZero[inBlockP] || inQ->NonZero[inBlockQ])
+		return 2;
+
+	// The reference pictures and the number of motion vectors, by picture
+	// and not by index
+	const SoftSliceInfo* sliceP = inPicture->GetSlice(inP->Slice);
+	const SoftSliceInfo* sliceQ = (inQ->Slice == inP->Slice) ? sliceP : inPicture->GetSlice(inQ->Slice);
+	int partP = (inBlockP >> 3) * 2 + ((inBlockP & 3) >> 1);
+	int partQ = (inBlockQ >> 3) * 2 + ((inBlockQ & 3) >> 1);
+	long refP[2], refQ[2];
+	for (int list = 0; list < 2; list++)
+	{
+		refP[list] = inP->Ref[list][partP] >= 0 ? sliceP->RefId[list][(int)inP->Ref[list][partP]] : -1;
+		refQ[list] = inQ->Ref[list][partQ] >= 0 ? sliceQ->RefId[list][(int)inQ->Ref[list][partQ]] : -1;
+	}
+	int countP = (refP[0] >= 0) + (refP[1] >= 0);
+	int countQ = (refQ[0] >= 0) + (refQ[1] >= 0);
+	if (countP != countQ)
+		return 1;
+
+	const short* mvP0 = inP->Mv[0][inBlockP];
+	const short* mvP1 = inP->Mv[1][inBlockP];
+	const short* mvQ0 = inQ->Mv[0][inBlockQ];
+	const short* mvQ1 = inQ->Mv[1][inBlockQ];
+	if (countP == 1)
+	{
+		int listP = refP[0] >= 0 ? 0 : 1;
+		int listQ = refQ[0] >= 0 ? 0 : 1;
+		return refP[listP] != refQ[listQ] || MvDiffers(inP->Mv[listP][inBlockP], inQ->Mv[listQ][inBlockQ]);
+	}
+
+	if (!((refP[0] == refQ[0] && refP[1] == refQ[1]) || (refP[0] == refQ[1] && refP[1] == refQ[0])))
+		return 1;
+	if (refP[0] != refP[1])
+	{
+		if (refP[0] == refQ[0])
+			return MvDiffers(mvP0, mvQ0) || MvDiffers(mvP1, mvQ1);
+		return MvDiffers(mvP0, mvQ1) || MvDiffers(mvP1, mvQ0);
+	}
+	// Both from the same picture: either pairing may match
+	return (MvDiffers(mvP0, mvQ0) || MvDiffers(mvP1, mvQ1)) && (MvDiffers(mvP0, mvQ1) || MvDiffers(mvP1, mvQ0));
+}
+
+static void FilterEdge( unsigned char* ioLuma, unsigned char* ioCb, unsigned char* ioCr, const SoftPicture* inPicture,
+						const SoftMb* inP, const SoftMb* inQ, const SoftSliceInfo* inSlice, const int* inStrength,
+						int inEdge, bool inVertical )
+{
+	if ((inStrength[0] | inStrength[1] | inStrength[2] | inStrength[3]) == 0)
+		return;
+
+	bool intra = (inStrength[0] == 4);
+	int tc0[4];
+
+	int qp = (inP->Qp + inQ->Qp + 1) >> 1;
+	int indexA = Clip51(qp + inSlice->AlphaOffset);
+	int alpha = SoftDeblockAlpha[indexA];
+	int beta = SoftDeblockBeta[Clip51(qp + inSlice->BetaOffset)];
+	if (alpha == 0 || beta == 0)
+		return;
+	for (int i = 0; i < 4; i++)
+		tc0[i] = (inStrength[i] && inStrength[i] < 4) ? SoftDeblockTc0[indexA][inStrength[i] - 1] : -1;
+
+	int offset = inVertical ? inEdge * 4 : inEdge * 4 * inPicture->LumaStride;
+	SoftFilterLumaEdge(ioLuma + offset, inPicture->LumaStride, inVertical, alpha, beta, tc0, intra);
+
+	// Chroma has edges 0 and 2 of the luma
+	if (inEdge & 1)
+		return;
+	offset = inVertical ? inEdge * 2 : inEdge * 2 * inPicture->ChromaStride;
+	for (int plane = 0; plane < 2; plane++)
+	{
+		qp = (inP->QpC[plane] + inQ->QpC[plane] + 1) >> 1;
+		indexA = Clip51(qp + inSlice->AlphaOffset);
+		alpha = SoftDeblockAlpha[indexA];
+		beta = SoftDeblockBeta[Clip51(qp + inSlice->BetaOffset)];
+		if (alpha == 0 || beta == 0)
+			continue;
+		for (int i = 0; i < 4; i++)
+			tc0[i] = (inStrength[i] && inStrength[i] < 4) ? SoftDeblockTc0[indexA][inStrength[i] - 1] : -1;
+		SoftFilterChromaEdge((plane ? ioCr : ioCb) + offset, inPicture->ChromaStride, inVertical, alpha, beta, tc0, intra);
+	}
+}
+
+void SoftDeblockRow( SoftPicture* ioPicture, int inRow )
+{
+	int mbWidth = ioPicture->MbWidth;
+	for (int x = 0; x < mbWidth; x++)
+	{
+		const SoftMb* mb = &ioPicture->Mbs[inRow * mbWidth + x];
+		if (mb->Type & SOFT_MB_CONCEALED)
+			continue;
+		const SoftSliceInfo* slice = ioPicture->GetSlice(mb->Slice);
+		if (slice->DisableDeblockingFilterIdc == 1)
+			continue;
+
+		const SoftMb* left = (x > 0) ? mb - 1 : NULL;
+		const SoftMb* top = (inRow > 0) ? mb - mbWidth : NULL;
+		if (left && ((left->Type & SOFT_MB_CONCEALED) ||
+					 (slice->DisableDeblockingFilterIdc == 2 && left->Slice != mb->Slice)))
+		{
+			left = NULL;
+		}
+		if (top && ((top->Type & SOFT_MB_CONCEALED) ||
+					(slice->DisableDeblockingFilterIdc == 2 && top->Slice != mb->Slice)))
+		{
+			top = NULL;
+		}
+
+		// Strengths of the 4 vertical then the 4 horizontal edges, per quarter
+		int strength[2][4][4];
+		for (int edge = 0; edge < 4; edge++)
+		{
+			for (int i = 0; i < 4; i++)
+			{
+				if (edge > 0)
+				{
+					strength[0][edge][i] = GetStrength(ioPicture, mb, i * 4 + edge - 1, mb, i * 4 + edge, false);
+					strength[1][edge][i] = GetStrength(ioPicture, mb, (edge - 1) * 4 + i, mb, edge * 4 + i, false);
+					continue;
+				}
+				strength[0][0][i] = left ? GetStrength(ioPicture, left, i * 4 + 3, mb, i * 4, true) : 0;
+				strength[1][0][i] = top ? GetStrength(ioPicture, top, 12 + i, mb, i, true) : 0;
+			}
+		}
+
+		unsigned char* luma = ioPicture->Plane[0] + (long)inRow * 16 * ioPicture->LumaStride + x * 16;
+		unsigned char* cb = ioPicture->Plane[1] + (long)inRow * 8 * ioPicture->ChromaStride + x * 8;
+		unsigned char* cr = ioPicture->Plane[2] + (long)inRow * 8 * ioPicture->ChromaStride + x * 8;
+		for (int dir = 0; dir < 2; dir++)
+		{
+			for (int edge = 0; edge < 4; edge++)
+			{
+				const SoftMb* p = edge ? mb : (dir ? top : left);
+				if (p == NULL)
+					continue;
+				FilterEdge(luma, cb, cr, ioPicture, p, mb, slice, strength[dir][edge], edge, dir == 0);
+			}
+		}
+	}
+}
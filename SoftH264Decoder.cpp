@@ -0,0 +1,1186 @@
+//------------------------------------------------------------------------------
+// File: SoftH264Decoder.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Software H.264 decoder: picture boundaries, picture order counts,
+// reference lists and marking, the DPB and the threads that decode the
+// slices.
+//
+//------------------------------------------------------------------------------
+
+#include "SoftH264Decoder.h"
+#include "Rbsp.h"
+#include "PerfTimer.h"
+#include "AtomicOps.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+	SoftH264Decoder*	Decoder;
+	int					Thread;
+} SoftWorkerArg;
+
+static inline int Clip( int inValue, int inMin, int inMax )
+{
+	return inValue < inMin ? inMin : (inValue > inMax ? inMax : inValue);
+}
+
+// tb and td of 8.4.1.2.3, the DistScaleFactor it gives
+static int GetDistScaleFactor( int inPoc, int inPoc0, int inPoc1 )
+{
+	int tb = Clip(inPoc - inPoc0, -128, 127);
+	int td = Clip(inPoc1 - inPoc0, -128, 127);
+	int tx = (16384 + abs(td / 2)) / td;
+	return Clip((tb * tx + 32) >> 6, -1024, 1023);
+}
+
+SoftH264Decoder::SoftH264Decoder() :	m_Sink(NULL),
+										m_SkipNonReference(false),
+										m_HasSequence(false),
+										m_WaitingForKey(true),
+										m_Unsupported(0),
+										m_Current(NULL),
+										m_InPicture(false),
+										m_LastDecoded(NULL),
+										m_NextId(1),
+										m_PrevPocMsb(0),
+										m_PrevPocLsb(0),
+										m_PrevFrameNumOffset(0),
+										m_PrevFrameNum(0),
+										m_PrevRefFrameNum(0),
+										m_FrameNumOffset(0),
+										m_PocMsb(0),
+										m_TopPoc(0),
+										m_MaxLongTermFrameIdx(-1),
+										m_Pictures(NULL),
+										m_PictureCount(0),
+										m_PictureCapacity(0),
+										m_DpbCount(0),
+										m_DpbSize(1),
+										m_ReorderFrames(0),
+										m_Missing(NULL),
+										m_InFlightCount(0),
+										m_ThreadCount(0),
+										m_Threads(NULL),
+										m_InlineDecoder(NULL),
+										m_MainWake(0),
+										m_Work(NULL),
+										m_QueueHead(NULL),
+										m_QueueTail(NULL),
+										m_FreeTasks(NULL),
+										m_Stopping(false)
+{
+	SoftBuildCavlcTables(&m_Tables);
+	m_SpsTable = new SoftSps[SOFT_MAX_SPS];
+	m_PpsTable = new SoftPps[SOFT_MAX_PPS];
+	memset(m_SpsTable, 0, SOFT_MAX_SPS * sizeof(SoftSps));
+	memset(m_PpsTable, 0, SOFT_MAX_PPS * sizeof(SoftPps));
+	memset(&m_Sps, 0, sizeof(m_Sps));
+	memset(&m_CurrentHeader, 0, sizeof(m_CurrentHeader));
+}
+
+SoftH264Decoder::~SoftH264Decoder()
+{
+	this->Close();
+	delete [] m_SpsTable;
+	delete [] m_PpsTable;
+}
+
+bool SoftH264Decoder::Init( int inThreads, SoftDecoderSink* inSink )
+{
+	if (m_Sink || inSink == NULL)
+		return false;
+
+	if (inThreads <= 0)
+		inThreads = PlatformProcessorCount();
+	if (inThreads > SOFT_MAX_THREADS)
+		inThreads = SOFT_MAX_THREADS;
+
+	m_Sink = inSink;
+	m_Stopping = false;
+	m_ThreadCount = inThreads;
+	this->ResetState();
+	if (inThreads == 1)
+	{
+		m_InlineDecoder = new SoftSliceDecoder(&m_Tables);
+		return true;
+	}
+
+	m_Work = new PlatformSemaphore(0);
+	m_Threads = new PlatformThread[inThreads];
+	for (int i = 0; i < inThreads; i++)
+	{
+		SoftWorkerArg* arg = new SoftWorkerArg;
+		arg->Decoder = this;
+		arg->Thread = i;
+		if (!m_Threads[i].Start(WorkerThread, arg))
+		{
+			printf("Cannot start decoding thread %d\n", i);
+			delete arg;
+			m_ThreadCount = i;
+			this->Close();
+			return false;
+		}
+	}
+	return true;
+}
+
+// Drops what is not output yet: the sink may be going away
+void SoftH264Decoder::Close( void )
+{
+	if (m_Sink == NULL)
+		return;
+
+	if (m_Current && m_Current->Decoded)
+		this->ReleaseDecoding(m_Current, &m_MainWake);
+	m_Current = NULL;
+	m_InPicture = false;
+	this->WaitInFlight(0);
+
+	if (m_Threads)
+	{
+		m_Stopping = true;
+		for (int i = 0; i < m_ThreadCount; i++)
+			m_Work->Post();
+		for (int i = 0; i < m_ThreadCount; i++)
+			m_Threads[i].Join();
+		delete [] m_Threads;
+		delete m_Work;
+		m_Threads = NULL;
+		m_Work = NULL;
+	}
+	delete m_InlineDecoder;
+	m_InlineDecoder = NULL;
+
+	while (m_FreeTasks)
+	{
+		SoftSliceTask* task = m_FreeTasks;
+		m_FreeTasks = task->Next;
+		delete [] task->Data;
+		delete task;
+	}
+
+	for (int i = 0; i < m_PictureCount; i++)
+		delete m_Pictures[i];
+	delete [] m_Pictures;
+	delete m_Missing;
+	m_Pictures = NULL;
+	m_PictureCount = 0;
+	m_PictureCapacity = 0;
+	m_Missing = NULL;
+	m_LastDecoded = NULL;
+	m_DpbCount = 0;
+	m_HasSequence = false;
+	m_ThreadCount = 0;
+	m_Sink = NULL;
+}
+
+void SoftH264Decoder::ResetState( void )
+{
+	m_WaitingForKey = true;
+	m_Unsupported = 0;
+	m_PrevPocMsb = 0;
+	m_PrevPocLsb = 0;
+	m_PrevFrameNumOffset = 0;
+	m_PrevFrameNum = 0;
+	m_PrevRefFrameNum = 0;
+	m_MaxLongTermFrameIdx = -1;
+	this->SetLastDecoded(NULL);
+}
+
+long long SoftH264Decoder::GetPictureBytes( void ) const
+{
+	long long bytes = 0;
+	for (int i = 0; i < m_PictureCount; i++)
+	{
+		const SoftPicture* picture = m_Pictures[i];
+		bytes += (long long)picture->LumaStride * picture->MbHeight * 24 +
+				 (long long)picture->MbWidth * picture->MbHeight * sizeof(SoftMb);
+	}
+	return bytes;
+}
+
+bool SoftH264Decoder::DecodeNalUnit( const unsigned char* inData, long inLength, long long inTimestamp )
+{
+	if (m_Sink == NULL || inLength < 2)
+		return false;
+
+	int type = inData[0] & 0x1f;
+	int refIdc = (inData[0] >> 5) & 3;
+	switch (type)
+	{
+	case NAL_TYPE_SLICE:
+	case NAL_TYPE_IDR:
+		break;
+
+	case NAL_TYPE_SPS:
+		{
+			this->FinishPicture();
+			SoftSps sps;
+			if (SoftParseSps(inData + 1, inLength - 1, &sps) && sps.Info.SpsId >= 0 && sps.Info.SpsId < SOFT_MAX_SPS)
+				m_SpsTable[sps.Info.SpsId] = sps;
+		}
+		return false;
+
+	case NAL_TYPE_PPS:
+		{
+			this->FinishPicture();
+			SoftPps pps;
+			if (SoftParsePps(inData + 1, inLength - 1, &pps))
+				m_PpsTable[pps.PpsId] = pps;
+		}
+		return false;
+
+	default:
+		// SEI, access unit delimiter, end of sequence or stream and the
+		// reserved types that start an access unit (7.4.1.2.3)
+		if ((type >= NAL_TYPE_SEI && type <= 11) || (type >= 14 && type <= 18))
+			this->FinishPicture();
+		return false;
+	}
+
+	SoftSliceTask* task = this->GetFreeTask(inLength);
+	task->Length = UnescapeRbsp(inData + 1, inLength - 1, task->Data);
+	SoftSliceHeader& header = task->Header;
+	if (!SoftParseSliceHeader(task->Data, task->Length, type, refIdc, m_SpsTable, m_PpsTable, &header) ||
+		header.RedundantPicCnt > 0)
+	{
+		if (header.Unsupported && header.Unsupported != m_Unsupported)
+		{
+			m_Unsupported = header.Unsupported;
+			m_Sink->OnUnsupported(m_SpsTable[m_PpsTable[header.PpsId].SpsId], m_Unsupported);
+		}
+		this->RecycleTask(task);
+		return false;
+	}
+	m_Unsupported = 0;
+
+	bool started = false;
+	if (this->IsNewPicture(header))
+	{
+		this->FinishPicture();
+		this->StartPicture(header, inTimestamp);
+		started = true;
+	}
+
+	if (m_Current && m_Current->Decoded && this->SetUpSlice(task))
+		this->QueueTask(task);
+	else
+		this->RecycleTask(task);
+	return started;
+}
+
+void SoftH264Decoder::Flush( void )
+{
+	if (m_Sink == NULL)
+		return;
+	this->FinishPicture();
+	this->FlushDpb();
+	this->ResetState();
+}
+
+//------------------------------------------------------------------------------
+// Pictures
+
+// 7.4.1.2.4
+bool SoftH264Decoder::IsNewPicture( const SoftSliceHeader& inHeader ) const
+{
+	const SoftSliceHeader& current = m_CurrentHeader;
+	if (!m_InPicture || inHeader.FirstMb == 0)
+		return true;
+	if (inHeader.FrameNum != current.FrameNum || inHeader.PpsId != current.PpsId ||
+		(inHeader.NalRefIdc == 0) != (current.NalRefIdc == 0) ||
+		(inHeader.NalType == NAL_TYPE_IDR) != (current.NalType == NAL_TYPE_IDR))
+	{
+		return true;
+	}
+	if (inHeader.NalType == NAL_TYPE_IDR && inHeader.IdrPicId != current.IdrPicId)
+		return true;
+
+	const SoftSps& sps = m_SpsTable[m_PpsTable[inHeader.PpsId].SpsId];
+	if (sps.PocType == 0)
+		return inHeader.PocLsb != current.PocLsb || inHeader.DeltaPocBottom != current.DeltaPocBottom;
+	if (sps.PocType == 1)
+		return inHeader.DeltaPoc[0] != current.DeltaPoc[0] || inHeader.DeltaPoc[1] != current.DeltaPoc[1];
+	return false;
+}
+
+void SoftH264Decoder::StartPicture( const SoftSliceHeader& inHeader, long long inTimestamp )
+{
+	m_CurrentHeader = inHeader;
+	m_InPicture = true;
+	m_Current = NULL;
+
+	const SoftSps& sps = m_SpsTable[m_PpsTable[inHeader.PpsId].SpsId];
+	bool idr = (inHeader.NalType == NAL_TYPE_IDR);
+	bool intra = (inHeader.SliceType == SLICE_TYPE_I);
+	if (m_WaitingForKey && !intra)
+		return;
+
+	// A sequence starts at an IDR picture; after an error, an I picture of
+	// the same size does.
+	if (!m_HasSequence || memcmp(&sps, &m_Sps, sizeof(SoftSps)) != 0)
+	{
+		bool resized = !m_HasSequence || sps.MbWidth != m_Sps.MbWidth || sps.MbHeight != m_Sps.MbHeight;
+		if (resized && !intra)
+		{
+			m_WaitingForKey = true;
+			return;
+		}
+		if ((resized || idr) && !this->ActivateSequence(sps))
+		{
+			m_WaitingForKey = true;
+			return;
+		}
+	}
+
+	// Gaps are not filled when decoding starts again after an error
+	int maxFrameNum = 1 << m_Sps.Log2MaxFrameNum;
+	if (!idr && !m_WaitingForKey && inHeader.FrameNum != m_PrevRefFrameNum &&
+		inHeader.FrameNum != (m_PrevRefFrameNum + 1) % maxFrameNum)
+	{
+		this->FillFrameNumGap(inHeader.FrameNum);
+	}
+	m_WaitingForKey = false;
+
+	this->WaitInFlight(m_ThreadCount);
+	SoftPicture* picture = this->AllocatePicture();
+	if (picture == NULL)
+	{
+		m_WaitingForKey = true;
+		return;
+	}
+
+	bool decode = !(m_SkipNonReference && inHeader.NalRefIdc == 0);
+	if (decode)
+	{
+		picture->Start();
+		picture->Users = 1;
+		picture->PendingTasks = 1;
+		picture->ConcealFrom = m_LastDecoded;
+		if (m_LastDecoded)
+			AtomicIncrement(&m_LastDecoded->Users);
+		m_InFlight[m_InFlightCount++] = picture;
+	}
+	picture->Id = m_NextId++;
+	picture->FrameNum = inHeader.FrameNum;
+	picture->LongTermFrameIdx = 0;
+	picture->Reference = SOFT_REF_NONE;
+	picture->NeededForOutput = true;
+	picture->NonExisting = false;
+	picture->Decoded = decode;
+	picture->Timestamp = inTimestamp;
+	picture->StartTime = PerfTimeUs();
+	this->ComputePoc(inHeader, picture);
+	m_Current = picture;
+}
+
+// The reference marking needs only the slice headers, so the DPB moves
+// on to the next picture while this one is still decoding
+void SoftH264Decoder::FinishPicture( void )
+{
+	if (!m_InPicture)
+		return;
+	m_InPicture = false;
+
+	SoftPicture* picture = m_Current;
+	m_Current = NULL;
+	if (picture == NULL)
+		return;
+
+	if (picture->Decoded)
+	{
+		this->SetLastDecoded(picture);
+		this->ReleaseDecoding(picture, &m_MainWake);
+	}
+
+	this->MarkReferences(picture, m_CurrentHeader);
+	bool flushPrior = (m_CurrentHeader.NalType == NAL_TYPE_IDR);
+	for (int i = 0; i < m_CurrentHeader.MmcoCount; i++)
+		flushPrior = flushPrior || (m_CurrentHeader.Mmco[i].Operation == 5);
+	this->StorePicture(picture, flushPrior);
+}
+
+bool SoftH264Decoder::ActivateSequence( const SoftSps& inSps )
+{
+	this->FlushDpb();
+
+	delete m_Missing;
+	m_Missing = new SoftPicture;
+	if (!m_Missing->Allocate(inSps.MbWidth, inSps.MbHeight))
+	{
+		delete m_Missing;
+		m_Missing = NULL;
+		m_HasSequence = false;
+		return false;
+	}
+	m_Missing->Fill(128);
+	m_Missing->Id = m_NextId++;
+	m_Missing->Reference = SOFT_REF_SHORT;
+	m_Missing->Decoded = true;
+
+	m_Sps = inSps;
+	m_HasSequence = true;
+	m_DpbSize = GetDpbFrames(inSps.Info);
+	if (m_DpbSize < inSps.MaxNumRefFrames)
+		m_DpbSize = inSps.MaxNumRefFrames;
+	m_DpbSize = Clip(m_DpbSize, 1, SOFT_MAX_DPB);
+	m_ReorderFrames = inSps.Info.MaxNumReorderFrames;
+	if (m_ReorderFrames < 0 || m_ReorderFrames > m_DpbSize)
+		m_ReorderFrames = m_DpbSize;
+
+	m_Sink->OnSequence(m_Sps);
+	return true;
+}
+
+// A picture no one holds, of the sequence size
+SoftPicture* SoftH264Decoder::AllocatePicture( void )
+{
+	SoftPicture* picture = NULL;
+	for (int i = 0; i < m_PictureCount && picture == NULL; i++)
+	{
+		if (m_Pictures[i]->Users == 0)
+			picture = m_Pictures[i];
+	}
+
+	if (picture == NULL)
+	{
+		if (m_PictureCount == m_PictureCapacity)
+		{
+			int capacity = m_PictureCapacity ? m_PictureCapacity * 2 : 8;
+			SoftPicture** pictures = new SoftPicture*[capacity];
+			for (int i = 0; i < m_PictureCount; i++)
+				pictures[i] = m_Pictures[i];
+			delete [] m_Pictures;
+			m_Pictures = pictures;
+			m_PictureCapacity = capacity;
+		}
+		picture = new SoftPicture;
+		m_Pictures[m_PictureCount++] = picture;
+	}
+
+	if (picture->MbWidth != m_Sps.MbWidth || picture->MbHeight != m_Sps.MbHeight)
+	{
+		if (!picture->Allocate(m_Sps.MbWidth, m_Sps.MbHeight))
+		{
+			picture->MbWidth = picture->MbHeight = 0;
+			return NULL;
+		}
+	}
+	return picture;
+}
+
+// 8.2.1
+void SoftH264Decoder::ComputePoc( const SoftSliceHeader& inHeader, SoftPicture* ioPicture )
+{
+	bool idr = (inHeader.NalType == NAL_TYPE_IDR);
+	int maxFrameNum = 1 << m_Sps.Log2MaxFrameNum;
+	int top, bottom;
+
+	m_FrameNumOffset = 0;
+	if (!idr)
+	{
+		m_FrameNumOffset = m_PrevFrameNumOffset;
+		if (m_PrevFrameNum > inHeader.FrameNum)
+			m_FrameNumOffset += maxFrameNum;
+	}
+
+	if (m_Sps.PocType == 0)
+	{
+		int prevMsb = idr ? 0 : m_PrevPocMsb;
+		int prevLsb = idr ? 0 : m_PrevPocLsb;
+		int maxLsb = 1 << m_Sps.Log2MaxPocLsb;
+		int lsb = inHeader.PocLsb;
+		if (lsb < prevLsb && prevLsb - lsb >= maxLsb / 2)
+			m_PocMsb = prevMsb + maxLsb;
+		else if (lsb > prevLsb && lsb - prevLsb > maxLsb / 2)
+			m_PocMsb = prevMsb - maxLsb;
+		else
+			m_PocMsb = prevMsb;
+		top = m_PocMsb + lsb;
+		bottom = top + inHeader.DeltaPocBottom;
+	}
+	else if (m_Sps.PocType == 1)
+	{
+		int cycle = m_Sps.NumRefFramesInPocCycle;
+		int absFrameNum = cycle ? m_FrameNumOffset + inHeader.FrameNum : 0;
+		if (inHeader.NalRefIdc == 0 && absFrameNum > 0)
+			absFrameNum--;
+
+		int expected = 0;
+		if (absFrameNum > 0)
+		{
+			int deltaPerCycle = 0;
+			for (int i = 0; i < cycle; i++)
+				deltaPerCycle += m_Sps.OffsetForRefFrame[i];
+			int cycleCount = (absFrameNum - 1) / cycle;
+			int inCycle = (absFrameNum - 1) % cycle;
+			expected = cycleCount * deltaPerCycle;
+			for (int i = 0; i <= inCycle; i++)
+				expected += m_Sps.OffsetForRefFrame[i];
+		}
+		if (inHeader.NalRefIdc == 0)
+			expected += m_Sps.OffsetForNonRefPic;
+		top = expected + inHeader.DeltaPoc[0];
+		bottom = top + m_Sps.OffsetForTopToBottomField + inHeader.DeltaPoc[1];
+	}
+	else
+	{
+		top = 0;
+		if (!idr)
+			top = 2 * (m_FrameNumOffset + inHeader.FrameNum) - (inHeader.NalRefIdc == 0);
+		bottom = top;
+	}
+
+	m_TopPoc = top;
+	ioPicture->Poc = top < bottom ? top : bottom;
+}
+
+// 8.2.5.2: frames inferred for the missing frame_num values, each marked
+// through the sliding window. Only the last max_num_ref_frames of them
+// can stay.
+void SoftH264Decoder::FillFrameNumGap( int inFrameNum )
+{
+	int maxFrameNum = 1 << m_Sps.Log2MaxFrameNum;
+	int maxRefs = m_Sps.MaxNumRefFrames > 1 ? m_Sps.MaxNumRefFrames : 1;
+	int unused = (m_PrevRefFrameNum + 1) % maxFrameNum;
+	int count = (inFrameNum - unused + maxFrameNum) % maxFrameNum;
+	if (count > maxRefs)
+		unused = (unused + count - maxRefs) % maxFrameNum;
+
+	while (unused != inFrameNum)
+	{
+		this->UpdatePicNums(unused);
+		this->SlidingWindow();
+		SoftPicture* picture = this->AllocatePicture();
+		if (picture == NULL)
+			return;
+
+		// Grey, or what was decoded last if a lost picture is predicted from
+		picture->Fill(128);
+		if (m_LastDecoded)
+		{
+			this->WaitPicture(m_LastDecoded);
+			long size = (long)picture->LumaStride * picture->MbHeight * 24;
+			memcpy(picture->Plane[0], m_LastDecoded->Plane[0], size);
+		}
+		picture->Id = m_NextId++;
+		picture->Poc = m_LastDecoded ? m_LastDecoded->Poc : 0;
+		picture->FrameNum = unused;
+		picture->LongTermFrameIdx = 0;
+		picture->Reference = SOFT_REF_SHORT;
+		picture->NeededForOutput = false;
+		picture->NonExisting = true;
+		picture->Decoded = true;
+		this->StorePicture(picture, false);
+
+		if (m_PrevFrameNum > unused)
+			m_PrevFrameNumOffset += maxFrameNum;
+		m_PrevFrameNum = unused;
+		m_PrevRefFrameNum = unused;
+		unused = (unused + 1) % maxFrameNum;
+	}
+}
+
+//------------------------------------------------------------------------------
+// References and output
+
+void SoftH264Decoder::UpdatePicNums( int inFrameNum )
+{
+	int maxFrameNum = 1 << m_Sps.Log2MaxFrameNum;
+	for (int i = 0; i < m_DpbCount; i++)
+	{
+		SoftPicture* picture = m_Dpb[i];
+		if (picture->Reference == SOFT_REF_SHORT)
+			picture->FrameNumWrap = picture->FrameNum > inFrameNum ? picture->FrameNum - maxFrameNum : picture->FrameNum;
+	}
+}
+
+// 8.2.5.3, before the current picture is stored
+void SoftH264Decoder::SlidingWindow( void )
+{
+	int maxRefs = m_Sps.MaxNumRefFrames > 1 ? m_Sps.MaxNumRefFrames : 1;
+	int count = 0;
+	for (int i = 0; i < m_DpbCount; i++)
+		count += (m_Dpb[i]->Reference != SOFT_REF_NONE);
+
+	while (count >= maxRefs)
+	{
+		SoftPicture* oldest = NULL;
+		for (int i = 0; i < m_DpbCount; i++)
+		{
+			SoftPicture* picture = m_Dpb[i];
+			if (picture->Reference == SOFT_REF_SHORT && (oldest == NULL || picture->FrameNumWrap < oldest->FrameNumWrap))
+				oldest = picture;
+		}
+		if (oldest == NULL)
+			break;
+		oldest->Reference = SOFT_REF_NONE;
+		count--;
+	}
+}
+
+// 8.2.5 and the state the next picture order count is derived from
+void SoftH264Decoder::MarkReferences( SoftPicture* ioPicture, const SoftSliceHeader& inHeader )
+{
+	bool mmco5 = false;
+
+	if (inHeader.NalRefIdc == 0)
+	{
+		ioPicture->Reference = SOFT_REF_NONE;
+	}
+	else if (inHeader.NalType == NAL_TYPE_IDR)
+	{
+		for (int i = 0; i < m_DpbCount; i++)
+			m_Dpb[i]->Reference = SOFT_REF_NONE;
+		ioPicture->Reference = inHeader.LongTermReference ? SOFT_REF_LONG : SOFT_REF_SHORT;
+		m_MaxLongTermFrameIdx = inHeader.LongTermReference ? 0 : -1;
+	}
+	else
+	{
+		this->UpdatePicNums(inHeader.FrameNum);
+		ioPicture->Reference = SOFT_REF_SHORT;
+		if (!inHeader.AdaptiveRefPicMarking)
+			this->SlidingWindow();
+
+		for (int i = 0; i < inHeader.MmcoCount; i++)
+		{
+			const SoftMmco& mmco = inHeader.Mmco[i];
+			int picNum = inHeader.FrameNum - mmco.DifferenceOfPicNums;
+			for (int j = 0; j < m_DpbCount; j++)
+			{
+				SoftPicture* picture = m_Dpb[j];
+				bool shortTerm = (picture->Reference == SOFT_REF_SHORT);
+				bool longTerm = (picture->Reference == SOFT_REF_LONG);
+				switch (mmco.Operation)
+				{
+				case 1:
+					if (shortTerm && picture->FrameNumWrap == picNum)
+						picture->Reference = SOFT_REF_NONE;
+					break;
+				case 2:
+					if (longTerm && picture->LongTermFrameIdx == mmco.LongTermPicNum)
+						picture->Reference = SOFT_REF_NONE;
+					break;
+				case 3:
+					// Takes the index from any other picture first
+					if (longTerm && picture->LongTermFrameIdx == mmco.LongTermFrameIdx)
+						picture->Reference = SOFT_REF_NONE;
+					break;
+				case 4:
+					if (longTerm && picture->LongTermFrameIdx > mmco.MaxLongTermFrameIdxPlus1 - 1)
+						picture->Reference = SOFT_REF_NONE;
+					break;
+				case 5:
+					picture->Reference = SOFT_REF_NONE;
+					break;
+				case 6:
+					if (longTerm && picture->LongTermFrameIdx == mmco.LongTermFrameIdx)
+						picture->Reference = SOFT_REF_NONE;
+					break;
+				}
+			}
+
+			switch (mmco.Operation)
+			{
+			case 3:
+				for (int j = 0; j < m_DpbCount; j++)
+				{
+					SoftPicture* picture = m_Dpb[j];
+					if (picture->Reference == SOFT_REF_SHORT && picture->FrameNumWrap == picNum)
+					{
+						picture->Reference = SOFT_REF_LONG;
+						picture->LongTermFrameIdx = mmco.LongTermFrameIdx;
+					}
+				}
+				break;
+			case 4:
+				m_MaxLongTermFrameIdx = mmco.MaxLongTermFrameIdxPlus1 - 1;
+				break;
+			case 5:
+				m_MaxLongTermFrameIdx = -1;
+				mmco5 = true;
+				break;
+			case 6:
+				ioPicture->Reference = SOFT_REF_LONG;
+				ioPicture->LongTermFrameIdx = mmco.LongTermFrameIdx;
+				break;
+			}
+		}
+	}
+
+	m_PrevFrameNum = inHeader.FrameNum;
+	m_PrevFrameNumOffset = m_FrameNumOffset;
+	if (inHeader.NalRefIdc)
+	{
+		m_PrevRefFrameNum = inHeader.FrameNum;
+		m_PrevPocMsb = m_PocMsb;
+		m_PrevPocLsb = inHeader.PocLsb;
+	}
+	if (mmco5)
+	{
+		// The picture is then at frame_num 0 and order count 0 (8.2.1)
+		int tempPoc = ioPicture->Poc;
+		ioPicture->Poc = 0;
+		ioPicture->FrameNum = 0;
+		m_PrevFrameNum = 0;
+		m_PrevFrameNumOffset = 0;
+		m_PrevRefFrameNum = 0;
+		m_PrevPocMsb = 0;
+		m_PrevPocLsb = m_TopPoc - tempPoc;
+	}
+}
+
+// C.4.4 and C.4.5.3: the picture goes in the DPB, which outputs pictures
+// in order count order while it is over its size or holds more pictures
+// waiting than may be reordered
+void SoftH264Decoder::StorePicture( SoftPicture* ioPicture, bool inFlushPrior )
+{
+	if (inFlushPrior)
+	{
+		while (this->OutputPicture())
+			;
+	}
+	this->RemoveUnused();
+
+	AtomicIncrement(&ioPicture->Users);
+	m_Dpb[m_DpbCount++] = ioPicture;
+
+	while (m_DpbCount > m_DpbSize)
+	{
+		if (this->OutputPicture())
+			continue;
+		// Only references, against the stream's limits: drop the oldest
+		SoftPicture* oldest = NULL;
+		for (int i = 0; i < m_DpbCount; i++)
+		{
+			if (m_Dpb[i] != ioPicture && (oldest == NULL || m_Dpb[i]->Id < oldest->Id))
+				oldest = m_Dpb[i];
+		}
+		if (oldest == NULL)
+			break;
+		oldest->Reference = SOFT_REF_NONE;
+		this->RemoveUnused();
+	}
+
+	for (;;)
+	{
+		int waiting = 0;
+		for (int i = 0; i < m_DpbCount; i++)
+			waiting += m_Dpb[i]->NeededForOutput;
+		if (waiting <= m_ReorderFrames || !this->OutputPicture())
+			break;
+	}
+}
+
+// The waiting picture of the lowest order count, false if none waits
+bool SoftH264Decoder::OutputPicture( void )
+{
+	SoftPicture* next = NULL;
+	for (int i = 0; i < m_DpbCount; i++)
+	{
+		SoftPicture* picture = m_Dpb[i];
+		if (picture->NeededForOutput && (next == NULL || picture->Poc < next->Poc))
+			next = picture;
+	}
+	if (next == NULL)
+		return false;
+
+	next->NeededForOutput = false;
+	if (next->Decoded)
+		this->WaitPicture(next);
+	m_Sink->OnPicture(next);
+	this->RemoveUnused();
+	return true;
+}
+
+void SoftH264Decoder::RemoveUnused( void )
+{
+	int kept = 0;
+	for (int i = 0; i < m_DpbCount; i++)
+	{
+		SoftPicture* picture = m_Dpb[i];
+		if (picture->Reference == SOFT_REF_NONE && !picture->NeededForOutput)
+			AtomicDecrement(&picture->Users);
+		else
+			m_Dpb[kept++] = picture;
+	}
+	m_DpbCount = kept;
+}
+
+void SoftH264Decoder::FlushDpb( void )
+{
+	while (this->OutputPicture())
+		;
+	for (int i = 0; i < m_DpbCount; i++)
+		m_Dpb[i]->Reference = SOFT_REF_NONE;
+	this->RemoveUnused();
+	this->WaitInFlight(0);
+}
+
+// 8.2.4.2, the initial list in full
+int SoftH264Decoder::InitRefList( int inSliceType, int inList, SoftPicture** outList )
+{
+	SoftPicture* shortTerm[SOFT_MAX_DPB + 1];
+	SoftPicture* longTerm[SOFT_MAX_DPB + 1];
+	int shortCount = 0;
+	int longCount = 0;
+	for (int i = 0; i < m_DpbCount; i++)
+	{
+		if (m_Dpb[i]->Reference == SOFT_REF_SHORT)
+			shortTerm[shortCount++] = m_Dpb[i];
+		else if (m_Dpb[i]->Reference == SOFT_REF_LONG)
+			longTerm[longCount++] = m_Dpb[i];
+	}
+
+	// Insertion sorts: short-term by descending PicNum for P, by order count
+	// for B; long-term by ascending LongTermPicNum
+	int poc = m_Current->Poc;
+	for (int i = 1; i < shortCount; i++)
+	{
+		SoftPicture* picture = shortTerm[i];
+		int j = i;
+		for (; j > 0; j--)
+		{
+			const SoftPicture* before = shortTerm[j - 1];
+			bool after;
+			if (inSliceType == SLICE_TYPE_P)
+				after = before->FrameNumWrap < picture->FrameNumWrap;
+			else
+			{
+				// List 0: before the current picture descending, then after it
+				// ascending; list 1 the other way round
+				bool pictureBefore = (picture->Poc < poc) == (inList == 0);
+				bool previousBefore = (before->Poc < poc) == (inList == 0);
+				if (pictureBefore != previousBefore)
+					after = pictureBefore;
+				else if (picture->Poc < poc)
+					after = before->Poc < picture->Poc;
+				else
+					after = before->Poc > picture->Poc;
+			}
+			if (!after)
+				break;
+			shortTerm[j] = shortTerm[j - 1];
+		}
+		shortTerm[j] = picture;
+	}
+	for (int i = 1; i < longCount; i++)
+	{
+		SoftPicture* picture = longTerm[i];
+		int j = i;
+		for (; j > 0 && longTerm[j - 1]->LongTermFrameIdx > picture->LongTermFrameIdx; j--)
+			longTerm[j] = longTerm[j - 1];
+		longTerm[j] = picture;
+	}
+
+	int count = 0;
+	for (int i = 0; i < shortCount; i++)
+		outList[count++] = shortTerm[i];
+	for (int i = 0; i < longCount; i++)
+		outList[count++] = longTerm[i];
+	return count;
+}
+
+// 8.2.4.3 on a list of num_ref_idx_active entries and one spare
+void SoftH264Decoder::ModifyRefList( const SoftSliceHeader& inHeader, int inList, SoftPicture** ioList )
+{
+	int maxFrameNum = 1 << m_Sps.Log2MaxFrameNum;
+	int count = inHeader.NumRefIdxActive[inList];
+	int picNumPred = inHeader.FrameNum;
+	int index = 0;
+
+	for (int i = 0; i < inHeader.RefModCount[inList] && index < count; i++)
+	{
+		int idc = inHeader.RefModIdc[inList][i];
+		int value = inHeader.RefModValue[inList][i];
+		SoftPicture* target = NULL;
+		if (idc == 0 || idc == 1)
+		{
+			int picNumNoWrap = picNumPred + (idc ? value + 1 : -(value + 1));
+			if (picNumNoWrap < 0)
+				picNumNoWrap += maxFrameNum;
+			else if (picNumNoWrap >= maxFrameNum)
+				picNumNoWrap -= maxFrameNum;
+			picNumPred = picNumNoWrap;
+			int picNum = picNumNoWrap > inHeader.FrameNum ? picNumNoWrap - maxFrameNum : picNumNoWrap;
+			for (int j = 0; j < m_DpbCount && target == NULL; j++)
+			{
+				if (m_Dpb[j]->Reference == SOFT_REF_SHORT && m_Dpb[j]->FrameNumWrap == picNum)
+					target = m_Dpb[j];
+			}
+		}
+		else if (idc == 2)
+		{
+			for (int j = 0; j < m_DpbCount && target == NULL; j++)
+			{
+				if (m_Dpb[j]->Reference == SOFT_REF_LONG && m_Dpb[j]->LongTermFrameIdx == value)
+					target = m_Dpb[j];
+			}
+		}
+		else
+		{
+			break;
+		}
+
+		for (int j = count; j > index; j--)
+			ioList[j] = ioList[j - 1];
+		ioList[index++] = target;
+		int kept = index;
+		for (int j = index; j <= count; j++)
+		{
+			if (ioList[j] != target)
+				ioList[kept++] = ioList[j];
+		}
+	}
+}
+
+// The reference lists and everything the slice threads need of the DPB
+bool SoftH264Decoder::SetUpSlice( SoftSliceTask* ioTask )
+{
+	SoftPicture* picture = m_Current;
+	const SoftSliceHeader& header = ioTask->Header;
+	int index;
+	SoftSliceInfo* info = picture->AddSlice(&index);
+	if (info == NULL)
+		return false;
+
+	ioTask->Picture = picture;
+	ioTask->SliceIndex = index;
+	ioTask->Pps = m_PpsTable[header.PpsId];
+	ioTask->Direct8x8Inference = m_Sps.Direct8x8Inference;
+	info->DisableDeblockingFilterIdc = header.DisableDeblockingFilterIdc;
+	info->AlphaOffset = header.AlphaOffset;
+	info->BetaOffset = header.BetaOffset;
+
+	int listCount = (header.SliceType == SLICE_TYPE_B) ? 2 : (header.SliceType == SLICE_TYPE_P ? 1 : 0);
+	SoftPicture* lists[2][SOFT_MAX_REFS + 1];
+	int lengths[2] = { 0, 0 };
+	this->UpdatePicNums(header.FrameNum);
+	for (int list = 0; list < listCount; list++)
+		lengths[list] = this->InitRefList(header.SliceType, list, lists[list]);
+	if (listCount == 2 && lengths[1] > 1 && lengths[0] == lengths[1] &&
+		memcmp(lists[0], lists[1], lengths[0] * sizeof(SoftPicture*)) == 0)
+	{
+		SoftPicture* first = lists[1][0];
+		lists[1][0] = lists[1][1];
+		lists[1][1] = first;
+	}
+
+	for (int list = 0; list < listCount; list++)
+	{
+		int count = header.NumRefIdxActive[list];
+		for (int i = lengths[list]; i <= count; i++)
+			lists[list][i] = NULL;
+		if (header.RefModCount[list])
+			this->ModifyRefList(header, list, lists[list]);
+
+		// A reference that is not there: another of the list, grey without one
+		SoftPicture* fallback = m_Missing;
+		for (int i = count - 1; i >= 0; i--)
+		{
+			if (lists[list][i])
+				fallback = lists[list][i];
+		}
+		for (int i = 0; i < count; i++)
+		{
+			SoftPicture* ref = lists[list][i] ? lists[list][i] : fallback;
+			ioTask->RefList[list][i] = ref;
+			info->RefId[list][i] = ref->Id;
+			AtomicIncrement(&ref->Users);
+		}
+	}
+
+	if (header.SliceType == SLICE_TYPE_B)
+	{
+		const SoftPicture* col = ioTask->RefList[1][0];
+		ioTask->ColShortTerm = (col->Reference == SOFT_REF_SHORT);
+		for (int i = 0; i < header.NumRefIdxActive[0]; i++)
+		{
+			const SoftPicture* ref0 = ioTask->RefList[0][i];
+			bool copy = (ref0->Reference == SOFT_REF_LONG || col->Poc == ref0->Poc);
+			ioTask->DistScaleFactor[i] = (short)(copy ? 256 : GetDistScaleFactor(picture->Poc, ref0->Poc, col->Poc));
+		}
+
+		// 8.4.2.3.1
+		if (ioTask->Pps.WeightedBipredIdc == 2)
+		{
+			for (int i = 0; i < header.NumRefIdxActive[0]; i++)
+			{
+				const SoftPicture* ref0 = ioTask->RefList[0][i];
+				for (int j = 0; j < header.NumRefIdxActive[1]; j++)
+				{
+					const SoftPicture* ref1 = ioTask->RefList[1][j];
+					int weight = 32;
+					if (ref1->Poc != ref0->Poc && ref0->Reference != SOFT_REF_LONG && ref1->Reference != SOFT_REF_LONG)
+					{
+						int scale = GetDistScaleFactor(picture->Poc, ref0->Poc, ref1->Poc) >> 2;
+						if (scale >= -64 && scale <= 128)
+							weight = scale;
+					}
+					ioTask->ImplicitWeight[i][j] = (short)weight;
+				}
+			}
+		}
+	}
+
+	AtomicIncrement(&picture->PendingTasks);
+	return true;
+}
+
+//------------------------------------------------------------------------------
+// Slice decoding
+
+SoftSliceTask* SoftH264Decoder::GetFreeTask( long inCapacity )
+{
+	SoftSliceTask* task;
+	{
+		PlatformAutoLock lock(&m_QueueLock);
+		task = m_FreeTasks;
+		if (task)
+			m_FreeTasks = task->Next;
+	}
+	if (task == NULL)
+	{
+		task = new SoftSliceTask;
+		task->Data = NULL;
+		task->Capacity = 0;
+	}
+	if (task->Capacity < inCapacity)
+	{
+		delete [] task->Data;
+		task->Data = new unsigned char[inCapacity];
+		task->Capacity = inCapacity;
+	}
+	task->Length = 0;
+	task->Next = NULL;
+	return task;
+}
+
+void SoftH264Decoder::RecycleTask( SoftSliceTask* inTask )
+{
+	PlatformAutoLock lock(&m_QueueLock);
+	inTask->Next = m_FreeTasks;
+	m_FreeTasks = inTask;
+}
+
+void SoftH264Decoder::QueueTask( SoftSliceTask* inTask )
+{
+	if (m_InlineDecoder)
+	{
+		this->RunTask(inTask, m_InlineDecoder, &m_MainWake);
+		return;
+	}
+
+	{
+		PlatformAutoLock lock(&m_QueueLock);
+		inTask->Next = NULL;
+		if (m_QueueTail)
+			m_QueueTail->Next = inTask;
+		else
+			m_QueueHead = inTask;
+		m_QueueTail = inTask;
+	}
+	m_Work->Post();
+}
+
+void SoftH264Decoder::RunTask( SoftSliceTask* inTask, SoftSliceDecoder* inDecoder, PlatformSemaphore* inWake )
+{
+	// A slice that fails keeps what it decoded; the rest is concealed
+	inDecoder->Decode(inTask, inWake);
+
+	const SoftSliceHeader& header = inTask->Header;
+	int listCount = (header.SliceType == SLICE_TYPE_B) ? 2 : (header.SliceType == SLICE_TYPE_P ? 1 : 0);
+	for (int list = 0; list < listCount; list++)
+	{
+		for (int i = 0; i < header.NumRefIdxActive[list]; i++)
+			AtomicDecrement(&inTask->RefList[list][i]->Users);
+	}
+	this->ReleaseDecoding(inTask->Picture, inWake);
+	this->RecycleTask(inTask);
+}
+
+// The last of the slices and of the parsing completes the picture
+void SoftH264Decoder::ReleaseDecoding( SoftPicture* ioPicture, PlatformSemaphore* inWake )
+{
+	if (AtomicDecrement(&ioPicture->PendingTasks) != 0)
+		return;
+	SoftPicture* concealFrom = ioPicture->ConcealFrom;
+	ioPicture->Finish(concealFrom, inWake);
+	if (concealFrom)
+		AtomicDecrement(&concealFrom->Users);
+	AtomicDecrement(&ioPicture->Users);
+}
+
+void SoftH264Decoder::WaitPicture( SoftPicture* ioPicture )
+{
+	ioPicture->WaitProgress(ioPicture->MbHeight, &m_MainWake);
+}
+
+// Down to inMax pictures being decoded, waiting for the oldest
+void SoftH264Decoder::WaitInFlight( int inMax )
+{
+	int kept = 0;
+	for (int i = 0; i < m_InFlightCount; i++)
+	{
+		if (!m_InFlight[i]->IsFinished())
+			m_InFlight[kept++] = m_InFlight[i];
+	}
+	m_InFlightCount = kept;
+
+	while (m_InFlightCount > inMax)
+	{
+		this->WaitPicture(m_InFlight[0]);
+		m_InFlightCount--;
+		for (int i = 0; i < m_InFlightCount; i++)
+			m_InFlight[i] = m_InFlight[i + 1];
+	}
+}
+
+void SoftH264Decoder::SetLastDecoded( SoftPicture* inPicture )
+{
+	if (inPicture)
+		AtomicIncrement(&inPicture->Users);
+	if (m_LastDecoded)
+		AtomicDecrement(&m_LastDecoded->Users);
+	m_LastDecoded = inPicture;
+}
+
+void SoftH264Decoder::WorkerThread( void* inArg )
+{
+	SoftWorkerArg* arg = (SoftWorkerArg*)inArg;
+	SoftH264Decoder* decoder = arg->Decoder;
+	int thread = arg->Thread;
+	delete arg;
+
+	decoder->RunWorker(thread);
+}
+
+void SoftH264Decoder::RunWorker( int inThread )
+{
+	SoftSliceDecoder decoder(&m_Tables);
+	PlatformSemaphore wake(0);
+	(void)inThread;
+
+	for (;;)
+	{
+		m_Work->Wait();
+		if (m_Stopping)
+			break;
+
+		SoftSliceTask* task;
+		{
+			PlatformAutoLock lock(&m_QueueLock);
+			task = m_QueueHead;
+			m_QueueHead = task->Next;
+			if (m_QueueHead == NULL)
+				m_QueueTail = NULL;
+		}
+		this->RunTask(task, &decoder, &wake);
+	}
+}
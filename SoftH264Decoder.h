@@ -0,0 +1,163 @@
+//------------------------------------------------------------------------------
+// File: SoftH264Decoder.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Software H.264 decoder for Constrained Baseline and Main progressive
+// streams, CAVLC and CABAC. The caller's thread parses the headers and runs
+// the reference and output processes; the slices go to a pool of threads
+// in decoding order, so the slices of a picture decode side by side and a
+// picture starts while the ones it predicts from are still being decoded.
+//
+//------------------------------------------------------------------------------
+
+#ifndef SOFT_H264_DECODER_H_
+#define SOFT_H264_DECODER_H_
+
+#include "SoftH264Slice.h"
+
+#define SOFT_MAX_DPB			16
+
+// Called on the thread that calls SoftH264Decoder
+class SoftDecoderSink
+{
+public:
+	virtual ~SoftDecoderSink() {}
+
+	// A new sequence is active. The pictures of the previous one have all
+	// been output.
+	virtual void	OnSequence(const SoftSps& inSps) = 0;
+
+	// The next picture in output order, final. Its samples are not valid
+	// when Decoded is false.
+	virtual void	OnPicture(const SoftPicture* inPicture) = 0;
+
+	// The slices refer to parameter sets the decoder cannot decode
+	// (SOFT_UNSUPPORTED_xxx) and are left out. Once until a slice decodes.
+	virtual void	OnUnsupported(const SoftSps& inSps, int inReason) = 0;
+};
+
+class SoftH264Decoder
+{
+public:
+
+	SoftH264Decoder();
+	virtual ~SoftH264Decoder();
+
+	// 0 threads for one per processor. One thread decodes on the caller's.
+	bool	Init(int inThreads, SoftDecoderSink* inSink);
+	void	Close(void);
+
+	// A NAL unit without its start code. True if it starts a picture, which
+	// then takes inTimestamp.
+	bool	DecodeNalUnit(const unsigned char* inData, long inLength, long long inTimestamp);
+
+	// Decodes and outputs every picture. The stream then has to start again
+	// with an I picture.
+	void	Flush(void);
+
+	// Non-reference pictures are then output without being decoded
+	void	SetSkipNonReference(bool inSkip) { m_SkipNonReference = inSkip; }
+
+	int		GetThreadCount(void) const { return m_ThreadCount; }
+	int		GetPictureCount(void) const { return m_PictureCount; }
+	long long	GetPictureBytes(void) const;
+
+private:
+
+	// Pictures
+	bool	IsNewPicture(const SoftSliceHeader& inHeader) const;
+	void	StartPicture(const SoftSliceHeader& inHeader, long long inTimestamp);
+	void	FinishPicture(void);
+	bool	ActivateSequence(const SoftSps& inSps);
+	SoftPicture*	AllocatePicture(void);
+	void	ComputePoc(const SoftSliceHeader& inHeader, SoftPicture* ioPicture);
+	void	FillFrameNumGap(int inFrameNum);
+
+	// References and output
+	void	MarkReferences(SoftPicture* ioPicture, const SoftSliceHeader& inHeader);
+	void	SlidingWindow(void);
+	void	StorePicture(SoftPicture* ioPicture, bool inFlushPrior);
+	bool	OutputPicture(void);
+	void	RemoveUnused(void);
+	void	FlushDpb(void);
+	void	UpdatePicNums(int inFrameNum);
+	int		InitRefList(int inSliceType, int inList, SoftPicture** outList);
+	void	ModifyRefList(const SoftSliceHeader& inHeader, int inList, SoftPicture** ioList);
+	void	ResetState(void);
+	bool	SetUpSlice(SoftSliceTask* ioTask);
+
+	// Slice decoding
+	void	QueueTask(SoftSliceTask* inTask);
+	void	RunTask(SoftSliceTask* inTask, SoftSliceDecoder* inDecoder, PlatformSemaphore* inWake);
+	void	ReleaseDecoding(SoftPicture* ioPicture, PlatformSemaphore* inWake);
+	void	WaitPicture(SoftPicture* ioPicture);
+	void	WaitInFlight(int inMax);
+	void	SetLastDecoded(SoftPicture* inPicture);
+	SoftSliceTask*	GetFreeTask(long inCapacity);
+	void	RecycleTask(SoftSliceTask* inTask);
+	static void	WorkerThread(void* inArg);
+	void	RunWorker(int inThread);
+
+private:
+
+	SoftDecoderSink*	m_Sink;
+	SoftCavlcTables		m_Tables;
+	bool				m_SkipNonReference;
+
+	// Parameter sets and the active sequence
+	SoftSps*			m_SpsTable;
+	SoftPps*			m_PpsTable;
+	SoftSps				m_Sps;
+	bool				m_HasSequence;
+	bool				m_WaitingForKey;		// Until an I picture
+	int					m_Unsupported;			// Reported to the sink, 0 once a slice decodes
+
+	// The picture being parsed and its first slice header
+	SoftPicture*		m_Current;
+	SoftSliceHeader		m_CurrentHeader;
+	bool				m_InPicture;			// m_CurrentHeader is valid, m_Current NULL if dropped
+	SoftPicture*		m_LastDecoded;			// Concealment source
+	long				m_NextId;
+
+	// Decoding process state (8.2.1, 8.2.5)
+	int					m_PrevPocMsb;
+	int					m_PrevPocLsb;
+	int					m_PrevFrameNumOffset;
+	int					m_PrevFrameNum;
+	int					m_PrevRefFrameNum;
+	int					m_FrameNumOffset;		// Of the current picture
+	int					m_PocMsb;
+	int					m_TopPoc;
+	int					m_MaxLongTermFrameIdx;	// -1 for no long-term index
+
+	// All the pictures, and those of the DPB
+	SoftPicture**		m_Pictures;
+	int					m_PictureCount;
+	int					m_PictureCapacity;
+	SoftPicture*		m_Dpb[SOFT_MAX_DPB + 1];
+	int					m_DpbCount;
+	int					m_DpbSize;
+	int					m_ReorderFrames;
+	SoftPicture*		m_Missing;				// Grey, for missing references
+
+	// Pictures being decoded, oldest first
+	SoftPicture*		m_InFlight[SOFT_MAX_THREADS + 2];
+	int					m_InFlightCount;
+
+	// Threads: slice tasks in decoding order
+	int					m_ThreadCount;
+	PlatformThread*		m_Threads;
+	SoftSliceDecoder*	m_InlineDecoder;
+	PlatformSemaphore	m_MainWake;
+	PlatformSemaphore*	m_Work;
+	PlatformLock		m_QueueLock;
+	SoftSliceTask*		m_QueueHead;
+	SoftSliceTask*		m_QueueTail;
+	SoftSliceTask*		m_FreeTasks;
+	volatile bool		m_Stopping;
+};
+
+#endif
@@ -0,0 +1,637 @@
+//------------------------------------------------------------------------------
+// File: SoftH264Dsp.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: SSE2 kernels of the software decoder.
+//
+// The pictures have no border, so the kernels read exactly the samples
+// the reference ones read: a block at the right or bottom of the last
+// plane ends the allocation. Blocks are worked on in strips of 8 columns
+// of 16-bit samples; a 4-wide block fills half a strip. The 6-tap
+// filter of the centre samples sums in 32 bits, as its intermediate
+// values do not fit in 16. The inverse transform works in 16 bits, which
+// holds the coefficients of conforming streams.
+//
+//------------------------------------------------------------------------------
+
+#include "SoftH264Dsp.h"
+#include "SoftH264DspReference.h"
+#include <emmintrin.h>
+#include <string.h>
+
+//------------------------------------------------------------------------------
+// Loads and stores of 4 and 8 samples
+
+static inline __m128i Load4( const unsigned char* inSrc )
+{
+	int value;
+	memcpy(&value, inSrc, 4);
+	return _mm_cvtsi32_si128(value);
+}
+
+static inline void Store4( unsigned char* outDst, __m128i inValue )
+{
+	int value = _mm_cvtsi128_si32(inValue);
+	memcpy(outDst, &value, 4);
+}
+
+// The samples of a strip as bytes in the low half
+static inline __m128i LoadStrip( const unsigned char* inSrc, bool inNarrow )
+{
+	return inNarrow ? Load4(inSrc) : _mm_loadl_epi64((const __m128i*)inSrc);
+}
+
+static inline void StoreStrip( unsigned char* outDst, __m128i inValue, bool inNarrow )
+{
+	if (inNarrow)
+		Store4(outDst, inValue);
+	else
+		_mm_storel_epi64((__m128i*)outDst, inValue);
+}
+
+// The samples of a strip widened to 16 bits
+static inline __m128i LoadWide( const unsigned char* inSrc, bool inNarrow )
+{
+	return _mm_unpacklo_epi8(LoadStrip(inSrc, inNarrow), _mm_setzero_si128());
+}
+
+static inline __m128i PackStrip( __m128i inValue )
+{
+	return _mm_packus_epi16(inValue, inValue);
+}
+
+//------------------------------------------------------------------------------
+// Inverse transform
+
+static inline void Transpose4x4( __m128i* ioRows )
+{
+	__m128i a = _mm_unpacklo_epi16(ioRows[0], ioRows[1]);
+	__m128i b = _mm_unpacklo_epi16(ioRows[2], ioRows[3]);
+	__m128i lo = _mm_unpacklo_epi32(a, b);
+	__m128i hi = _mm_unpackhi_epi32(a, b);
+	ioRows[0] = lo;
+	ioRows[1] = _mm_srli_si128(lo, 8);
+	ioRows[2] = hi;
+	ioRows[3] = _mm_srli_si128(hi, 8);
+}
+
+// One pass of 8.5.12.2 on the 4 lanes of each vector
+static inline void Transform4( __m128i* ioRows )
+{
+	__m128i e = _mm_add_epi16(ioRows[0], ioRows[2]);
+	__m128i f = _mm_sub_epi16(ioRows[0], ioRows[2]);
+	__m128i g = _mm_sub_epi16(_mm_srai_epi16(ioRows[1], 1), ioRows[3]);
+	__m128i h = _mm_add_epi16(ioRows[1], _mm_srai_epi16(ioRows[3], 1));
+	ioRows[0] = _mm_add_epi16(e, h);
+	ioRows[1] = _mm_add_epi16(f, g);
+	ioRows[2] = _mm_sub_epi16(f, g);
+	ioRows[3] = _mm_sub_epi16(e, h);
+}
+
+void SoftIdctAdd( unsigned char* ioDst, int inStride, short* ioBlock )
+{
+	__m128i rows[4];
+	for (int i = 0; i < 4; i++)
+		rows[i] = _mm_loadl_epi64((const __m128i*)(ioBlock + i * 4));
+
+	// The lanes are the rows for the horizontal pass, then the columns
+	Transpose4x4(rows);
+	Transform4(rows);
+	Transpose4x4(rows);
+	Transform4(rows);
+
+	__m128i round = _mm_set1_epi16(32);
+	for (int i = 0; i < 4; i++)
+	{
+		unsigned char* dst = ioDst + i * inStride;
+		__m128i residual = _mm_srai_epi16(_mm_add_epi16(rows[i], round), 6);
+		Store4(dst, PackStrip(_mm_add_epi16(LoadWide(dst, true), residual)));
+	}
+	_mm_storeu_si128((__m128i*)ioBlock, _mm_setzero_si128());
+	_mm_storeu_si128((__m128i*)(ioBlock + 8), _mm_setzero_si128());
+}
+
+//------------------------------------------------------------------------------
+// Luma motion compensation
+
+// a - 5b + 20c + 20d - 5e + f, of samples or of 16-bit sums that fit
+static inline __m128i Tap6( __m128i a, __m128i b, __m128i c, __m128i d, __m128i e, __m128i f )
+{
+	__m128i outer = _mm_add_epi16(a, f);
+	__m128i inner = _mm_add_epi16(c, d);
+	__m128i side = _mm_add_epi16(b, e);
+	return _mm_add_epi16(_mm_sub_epi16(outer, _mm_mullo_epi16(side, _mm_set1_epi16(5))),
+						 _mm_mullo_epi16(inner, _mm_set1_epi16(20)));
+}
+
+// Byte i holds inSrc[i - 2], for the 13 samples the horizontal filter of
+// a strip reads (9 when narrow)
+static inline __m128i LoadTaps( const unsigned char* inSrc, bool inNarrow )
+{
+	__m128i lo = _mm_loadl_epi64((const __m128i*)(inSrc - 2));
+	__m128i hi = inNarrow ? Load4(inSrc + 3) : _mm_loadl_epi64((const __m128i*)(inSrc + 3));
+	return _mm_or_si128(lo, _mm_slli_si128(hi, 5));
+}
+
+// The sums of the horizontal half samples (b1 of 8.4.2.2.1)
+static inline __m128i FilterTaps( __m128i inTaps )
+{
+	__m128i zero = _mm_setzero_si128();
+	return Tap6(_mm_unpacklo_epi8(inTaps, zero),
+				_mm_unpacklo_epi8(_mm_srli_si128(inTaps, 1), zero),
+				_mm_unpacklo_epi8(_mm_srli_si128(inTaps, 2), zero),
+				_mm_unpacklo_epi8(_mm_srli_si128(inTaps, 3), zero),
+				_mm_unpacklo_epi8(_mm_srli_si128(inTaps, 4), zero),
+				_mm_unpacklo_epi8(_mm_srli_si128(inTaps, 5), zero));
+}
+
+// A half sample from its sum
+static inline __m128i HalfSample( __m128i inSum )
+{
+	return PackStrip(_mm_srai_epi16(_mm_add_epi16(inSum, _mm_set1_epi16(16)), 5));
+}
+
+// The centre sample j from the horizontal sums of 6 rows
+static inline __m128i CentreSample( const __m128i* inSums )
+{
+	__m128i outer = _mm_setr_epi16(1, -5, 1, -5, 1, -5, 1, -5);
+	__m128i inner = _mm_set1_epi16(20);
+	__m128i last = _mm_setr_epi16(-5, 1, -5, 1, -5, 1, -5, 1);
+	__m128i lo = _mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(inSums[0], inSums[1]), outer),
+											 _mm_madd_epi16(_mm_unpacklo_epi16(inSums[2], inSums[3]), inner)),
+							   _mm_madd_epi16(_mm_unpacklo_epi16(inSums[4], inSums[5]), last));
+	__m128i hi = _mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(inSums[0], inSums[1]), outer),
+											 _mm_madd_epi16(_mm_unpackhi_epi16(inSums[2], inSums[3]), inner)),
+							   _mm_madd_epi16(_mm_unpackhi_epi16(inSums[4], inSums[5]), last));
+	__m128i round = _mm_set1_epi32(512);
+	lo = _mm_srai_epi32(_mm_add_epi32(lo, round), 10);
+	hi = _mm_srai_epi32(_mm_add_epi32(hi, round), 10);
+	return PackStrip(_mm_packs_epi32(lo, hi));
+}
+
+// Full samples, or the horizontal half samples averaged with the full
+// sample left (dx 1) or right (dx 3) of them
+static void LumaMcH( unsigned char* outDst, int inDstStride, const unsigned char* inSrc, int inSrcStride,
+					 bool inNarrow, int inHeight, int inDx )
+{
+	for (int y = 0; y < inHeight; y++)
+	{
+		const unsigned char* src = inSrc + y * inSrcStride;
+		__m128i value;
+		if (inDx == 0)
+			value = LoadStrip(src, inNarrow);
+		else
+		{
+			__m128i taps = LoadTaps(src, inNarrow);
+			value = HalfSample(FilterTaps(taps));
+			if (inDx != 2)
+				value = _mm_avg_epu8(value, inDx == 1 ? _mm_srli_si128(taps, 2) : _mm_srli_si128(taps, 3));
+		}
+		StoreStrip(outDst + y * inDstStride, value, inNarrow);
+	}
+}
+
+// Vertical half samples, averaged with the full sample above (dy 1) or
+// below (dy 3) of them
+static void LumaMcV( unsigned char* outDst, int inDstStride, const unsigned char* inSrc, int inSrcStride,
+					 bool inNarrow, int inHeight, int inDy )
+{
+	__m128i rows[6];
+	for (int i = 0; i < 5; i++)
+		rows[i] = LoadWide(inSrc + (i - 2) * inSrcStride, inNarrow);
+	for (int y = 0; y < inHeight; y++)
+	{
+		rows[5] = LoadWide(inSrc + (y + 3) * inSrcStride, inNarrow);
+		__m128i value = HalfSample(Tap6(rows[0], rows[1], rows[2], rows[3], rows[4], rows[5]));
+		if (inDy != 2)
+			value = _mm_avg_epu8(value, PackStrip(rows[inDy == 1 ? 2 : 3]));
+		StoreStrip(outDst + y * inDstStride, value, inNarrow);
+		for (int i = 0; i < 5; i++)
+			rows[i] = rows[i + 1];
+	}
+}
+
+// The centre samples, alone or averaged with the half sample above or
+// below them (dx 2), left or right of them (dy 2)
+static void LumaMcCentre( unsigned char* outDst, int inDstStride, const unsigned char* inSrc, int inSrcStride,
+						  bool inNarrow, int inHeight, int inDx, int inDy )
+{
+	__m128i sums[6];
+	__m128i rows[6];
+	bool vertical = (inDy == 2 && inDx != 2);
+	const unsigned char* column = inSrc + (inDx == 3 ? 1 : 0);
+	for (int i = 0; i < 5; i++)
+	{
+		sums[i] = FilterTaps(LoadTaps(inSrc + (i - 2) * inSrcStride, inNarrow));
+		if (vertical)
+			rows[i] = LoadWide(column + (i - 2) * inSrcStride, inNarrow);
+	}
+	for (int y = 0; y < inHeight; y++)
+	{
+		sums[5] = FilterTaps(LoadTaps(inSrc + (y + 3) * inSrcStride, inNarrow));
+		__m128i value = CentreSample(sums);
+		if (vertical)
+		{
+			rows[5] = LoadWide(column + (y + 3) * inSrcStride, inNarrow);
+			value = _mm_avg_epu8(value, HalfSample(Tap6(rows[0], rows[1], rows[2], rows[3], rows[4], rows[5])));
+			for (int i = 0; i < 5; i++)
+				rows[i] = rows[i + 1];
+		}
+		else if (inDy != 2)
+			value = _mm_avg_epu8(value, HalfSample(sums[inDy == 1 ? 2 : 3]));
+		StoreStrip(outDst + y * inDstStride, value, inNarrow);
+		for (int i = 0; i < 5; i++)
+			sums[i] = sums[i + 1];
+	}
+}
+
+// The diagonal positions: the horizontal half sample of the row (dy 1)
+// or the one below (dy 3), averaged with the vertical one of the column
+// (dx 1) or the one right (dx 3)
+static void LumaMcDiagonal( unsigned char* outDst, int inDstStride, const unsigned char* inSrc, int inSrcStride,
+							bool inNarrow, int inHeight, int inDx, int inDy )
+{
+	__m128i rows[6];
+	const unsigned char* row = inSrc + (inDy == 3 ? inSrcStride : 0);
+	const unsigned char* column = inSrc + (inDx == 3 ? 1 : 0);
+	for (int i = 0; i < 5; i++)
+		rows[i] = LoadWide(column + (i - 2) * inSrcStride, inNarrow);
+	for (int y = 0; y < inHeight; y++)
+	{
+		rows[5] = LoadWide(column + (y + 3) * inSrcStride, inNarrow);
+		__m128i vertical = HalfSample(Tap6(rows[0], rows[1], rows[2], rows[3], rows[4], rows[5]));
+		__m128i horizontal = HalfSample(FilterTaps(LoadTaps(row + y * inSrcStride, inNarrow)));
+		StoreStrip(outDst + y * inDstStride, _mm_avg_epu8(horizontal, vertical), inNarrow);
+		for (int i = 0; i < 5; i++)
+			rows[i] = rows[i + 1];
+	}
+}
+
+void SoftLumaMc( unsigned char* outDst, int inDstStride, const unsigned char* inSrc, int inSrcStride,
+				 int inWidth, int inHeight, int inDx, int inDy )
+{
+	bool narrow = (inWidth == 4);
+	for (int x = 0; x < inWidth; x += 8)
+	{
+		unsigned char* dst = outDst + x;
+		const unsigned char* src = inSrc + x;
+		if (inDy == 0)
+			LumaMcH(dst, inDstStride, src, inSrcStride, narrow, inHeight, inDx);
+		else if (inDx == 0)
+			LumaMcV(dst, inDstStride, src, inSrcStride, narrow, inHeight, inDy);
+		else if (inDx == 2 || inDy == 2)
+			LumaMcCentre(dst, inDstStride, src, inSrcStride, narrow, inHeight, inDx, inDy);
+		else
+			LumaMcDiagonal(dst, inDstStride, src, inSrcStride, narrow, inHeight, inDx, inDy);
+	}
+}
+
+//------------------------------------------------------------------------------
+// Chroma motion compensation and weighted prediction
+
+void SoftChromaMc( unsigned char* outDst, int inDstStride, const unsigned char* inSrc, int inSrcStride,
+				   int inWidth, int inHeight, int inDx, int inDy )
+{
+	// 2 samples would read past the sample right of the block
+	if (inWidth < 4)
+	{
+		RefChromaMc(outDst, inDstStride, inSrc, inSrcStride, inWidth, inHeight, inDx, inDy);
+		return;
+	}
+
+	bool narrow = (inWidth == 4);
+	__m128i weightA = _mm_set1_epi16((short)((8 - inDx) * (8 - inDy)));
+	__m128i weightB = _mm_set1_epi16((short)(inDx * (8 - inDy)));
+	__m128i weightC = _mm_set1_epi16((short)((8 - inDx) * inDy));
+	__m128i weightD = _mm_set1_epi16((short)(inDx * inDy));
+	__m128i round = _mm_set1_epi16(32);
+
+	__m128i left = LoadWide(inSrc, narrow);
+	__m128i right = LoadWide(inSrc + 1, narrow);
+	for (int y = 0; y < inHeight; y++)
+	{
+		const unsigned char* below = inSrc + (y + 1) * inSrcStride;
+		__m128i belowLeft = LoadWide(below, narrow);
+		__m128i belowRight = LoadWide(below + 1, narrow);
+		__m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(left, weightA), _mm_mullo_epi16(right, weightB)),
+									_mm_add_epi16(_mm_mullo_epi16(belowLeft, weightC), _mm_mullo_epi16(belowRight, weightD)));
+		sum = _mm_srli_epi16(_mm_add_epi16(sum, round), 6);
+		StoreStrip(outDst + y * inDstStride, PackStrip(sum), narrow);
+		left = belowLeft;
+		right = belowRight;
+	}
+}
+
+void SoftAverage( unsigned char* ioDst, int inDstStride, const unsigned char* inSrc, int inSrcStride,
+				  int inWidth, int inHeight )
+{
+	if (inWidth < 4)
+	{
+		RefAverage(ioDst, inDstStride, inSrc, inSrcStride, inWidth, inHeight);
+		return;
+	}
+
+	for (int y = 0; y < inHeight; y++)
+	{
+		unsigned char* dst = ioDst + y * inDstStride;
+		const unsigned char* src = inSrc + y * inSrcStride;
+		if (inWidth == 16)
+			_mm_storeu_si128((__m128i*)dst, _mm_avg_epu8(_mm_loadu_si128((const __m128i*)dst),
+														 _mm_loadu_si128((const __m128i*)src)));
+		else
+		{
+			bool narrow = (inWidth == 4);
+			StoreStrip(dst, _mm_avg_epu8(LoadStrip(dst, narrow), LoadStrip(src, narrow)), narrow);
+		}
+	}
+}
+
+// The products fit in 16 bits: weights are in -128..127
+void SoftWeight( unsigned char* ioDst, int inStride, int inWidth, int inHeight,
+				 int inLog2Denom, int inWeight, int inOffset )
+{
+	if (inWidth < 4)
+	{
+		RefWeight(ioDst, inStride, inWidth, inHeight, inLog2Denom, inWeight, inOffset);
+		return;
+	}
+
+	bool narrow = (inWidth == 4);
+	__m128i weight = _mm_set1_epi16((short)inWeight);
+	__m128i round = _mm_set1_epi16((short)(inLog2Denom >= 1 ? 1 << (inLog2Denom - 1) : 0));
+	__m128i offset = _mm_set1_epi16((short)inOffset);
+	__m128i shift = _mm_cvtsi32_si128(inLog2Denom);
+	for (int y = 0; y < inHeight; y++)
+	{
+		for (int x = 0; x < inWidth; x += 8)
+		{
+			unsigned char* dst = ioDst + y * inStride + x;
+			__m128i p = _mm_mullo_epi16(LoadWide(dst, narrow), weight);
+			p = _mm_add_epi16(_mm_sra_epi16(_mm_add_epi16(p, round), shift), offset);
+			StoreStrip(dst, PackStrip(p), narrow);
+		}
+	}
+}
+
+// In 32 bits: two explicit weights of 127 overflow 16
+void SoftBiWeight( unsigned char* ioDst, int inDstStride, const unsigned char* inSrc, int inSrcStride,
+				   int inWidth, int inHeight, int inLog2Denom, int inWeight0, int inWeight1, int inOffset )
+{
+	if (inWidth < 4)
+	{
+		RefBiWeight(ioDst, inDstStride, inSrc, inSrcStride, inWidth, inHeight, inLog2Denom, inWeight0, inWeight1, inOffset);
+		return;
+	}
+
+	bool narrow = (inWidth == 4);
+	__m128i weights = _mm_setr_epi16((short)inWeight0, (short)inWeight1, (short)inWeight0, (short)inWeight1,
+									 (short)inWeight0, (short)inWeight1, (short)inWeight0, (short)inWeight1);
+	__m128i round = _mm_set1_epi32(1 << inLog2Denom);
+	__m128i offset = _mm_set1_epi16((short)inOffset);
+	__m128i shift = _mm_cvtsi32_si128(inLog2Denom + 1);
+	for (int y = 0; y < inHeight; y++)
+	{
+		for (int x = 0; x < inWidth; x += 8)
+		{
+			unsigned char* dst = ioDst + y * inDstStride + x;
+			__m128i d = LoadWide(dst, narrow);
+			__m128i s = LoadWide(inSrc + y * inSrcStride + x, narrow);
+			__m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(d, s), weights);
+			__m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(d, s), weights);
+			lo = _mm_sra_epi32(_mm_add_epi32(lo, round), shift);
+			hi = _mm_sra_epi32(_mm_add_epi32(hi, round), shift);
+			StoreStrip(dst, PackStrip(_mm_adds_epi16(_mm_packs_epi32(lo, hi), offset)), narrow);
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+// Deblocking: 8 lines of an edge at a time, in 16 bits
+
+static inline __m128i AbsDiff( __m128i a, __m128i b )
+{
+	__m128i d = _mm_sub_epi16(a, b);
+	return _mm_max_epi16(d, _mm_sub_epi16(_mm_setzero_si128(), d));
+}
+
+static inline __m128i Select( __m128i inMask, __m128i inTrue, __m128i inFalse )
+{
+	return _mm_or_si128(_mm_and_si128(inMask, inTrue), _mm_andnot_si128(inMask, inFalse));
+}
+
+static inline __m128i Clip( __m128i inValue, __m128i inLimit )
+{
+	return _mm_max_epi16(_mm_min_epi16(inValue, inLimit), _mm_sub_epi16(_mm_setzero_si128(), inLimit));
+}
+
+// |p0 - q0| < alpha, |p1 - p0| < beta and |q1 - q0| < beta
+static inline __m128i EdgeMask( const __m128i* inPix, int inCenter, __m128i inAlpha, __m128i inBeta )
+{
+	__m128i p1 = inPix[inCenter - 2], p0 = inPix[inCenter - 1];
+	__m128i q0 = inPix[inCenter], q1 = inPix[inCenter + 1];
+	return _mm_and_si128(_mm_cmplt_epi16(AbsDiff(p0, q0), inAlpha),
+						 _mm_and_si128(_mm_cmplt_epi16(AbsDiff(p1, p0), inBeta),
+									   _mm_cmplt_epi16(AbsDiff(q1, q0), inBeta)));
+}
+
+// ioPix holds p3, p2, p1, p0, q0, q1, q2 and q3 of 8 lines, inTc0 the
+// tc0 of each line
+static void FilterLuma8( __m128i* ioPix, int inAlpha, int inBeta, __m128i inTc0, bool inIntra )
+{
+	__m128i alpha = _mm_set1_epi16((short)inAlpha);
+	__m128i beta = _mm_set1_epi16((short)inBeta);
+	__m128i p3 = ioPix[0], p2 = ioPix[1], p1 = ioPix[2], p0 = ioPix[3];
+	__m128i q0 = ioPix[4], q1 = ioPix[5], q2 = ioPix[6], q3 = ioPix[7];
+	__m128i mask = EdgeMask(ioPix, 4, alpha, beta);
+	__m128i ap = _mm_cmplt_epi16(AbsDiff(p2, p0), beta);
+	__m128i aq = _mm_cmplt_epi16(AbsDiff(q2, q0), beta);
+	__m128i two = _mm_set1_epi16(2);
+	__m128i four = _mm_set1_epi16(4);
+
+	if (inIntra)
+	{
+		__m128i strong = _mm_cmplt_epi16(AbsDiff(p0, q0), _mm_set1_epi16((short)((inAlpha >> 2) + 2)));
+		__m128i sum = _mm_add_epi16(_mm_add_epi16(p1, p0), q0);
+		__m128i strongP = _mm_and_si128(_mm_and_si128(ap, strong), mask);
+		__m128i strongQ = _mm_and_si128(_mm_and_si128(aq, strong), mask);
+		__m128i weakP = _mm_andnot_si128(strongP, mask);
+		__m128i weakQ = _mm_andnot_si128(strongQ, mask);
+
+		// p0 = (p2 + 2p1 + 2p0 + 2q0 + q1 + 4) >> 3, p1 = (p2 + p1 + p0 + q0 + 2) >> 2,
+		// p2 = (2p3 + 3p2 + p1 + p0 + q0 + 4) >> 3, and the same for q
+		__m128i p0s = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(sum, sum), _mm_add_epi16(_mm_add_epi16(p2, q1), four)), 3);
+		__m128i p1s = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(sum, p2), two), 2);
+		__m128i p2s = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_add_epi16(p3, p3), _mm_add_epi16(p2, p2)),
+												   _mm_add_epi16(_mm_add_epi16(p2, sum), four)), 3);
+		__m128i p0w = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_add_epi16(p1, p1), p0), _mm_add_epi16(q1, two)), 2);
+
+		sum = _mm_add_epi16(_mm_add_epi16(q1, q0), p0);
+		__m128i q0s = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(sum, sum), _mm_add_epi16(_mm_add_epi16(q2, p1), four)), 3);
+		__m128i q1s = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(sum, q2), two), 2);
+		__m128i q2s = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_add_epi16(q3, q3), _mm_add_epi16(q2, q2)),
+												   _mm_add_epi16(_mm_add_epi16(q2, sum), four)), 3);
+		__m128i q0w = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_add_epi16(q1, q1), q0), _mm_add_epi16(p1, two)), 2);
+
+		ioPix[1] = Select(strongP, p2s, p2);
+		ioPix[2] = Select(strongP, p1s, p1);
+		ioPix[3] = Select(strongP, p0s, Select(weakP, p0w, p0));
+		ioPix[4] = Select(strongQ, q0s, Select(weakQ, q0w, q0));
+		ioPix[5] = Select(strongQ, q1s, q1);
+		ioPix[6] = Select(strongQ, q2s, q2);
+		return;
+	}
+
+	// Lines of bS 0 have a tc0 of -1
+	mask = _mm_and_si128(mask, _mm_cmpgt_epi16(inTc0, _mm_set1_epi16(-1)));
+	__m128i one = _mm_set1_epi16(1);
+	__m128i tc = _mm_add_epi16(inTc0, _mm_add_epi16(_mm_and_si128(ap, one), _mm_and_si128(aq, one)));
+	__m128i delta = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(_mm_slli_epi16(_mm_sub_epi16(q0, p0), 2),
+																_mm_sub_epi16(p1, q1)), four), 3);
+	delta = _mm_and_si128(Clip(delta, tc), mask);
+
+	// (p0 + q0 + 1) >> 1, then p1 + Clip3(-tc0, tc0, (p2 + avg - 2p1) >> 1)
+	__m128i average = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(p0, q0), one), 1);
+	__m128i deltaP = _mm_srai_epi16(_mm_sub_epi16(_mm_add_epi16(p2, average), _mm_add_epi16(p1, p1)), 1);
+	__m128i deltaQ = _mm_srai_epi16(_mm_sub_epi16(_mm_add_epi16(q2, average), _mm_add_epi16(q1, q1)), 1);
+	ioPix[2] = _mm_add_epi16(p1, _mm_and_si128(Clip(deltaP, inTc0), _mm_and_si128(ap, mask)));
+	ioPix[5] = _mm_add_epi16(q1, _mm_and_si128(Clip(deltaQ, inTc0), _mm_and_si128(aq, mask)));
+	ioPix[3] = _mm_add_epi16(p0, delta);
+	ioPix[4] = _mm_sub_epi16(q0, delta);
+}
+
+// ioPix holds p1, p0, q0 and q1 of 8 lines
+static void FilterChroma8( __m128i* ioPix, int inAlpha, int inBeta, __m128i inTc0, bool inIntra )
+{
+	__m128i p1 = ioPix[0], p0 = ioPix[1], q0 = ioPix[2], q1 = ioPix[3];
+	__m128i mask = EdgeMask(ioPix, 2, _mm_set1_epi16((short)inAlpha), _mm_set1_epi16((short)inBeta));
+	__m128i two = _mm_set1_epi16(2);
+
+	if (inIntra)
+	{
+		__m128i p0w = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_add_epi16(p1, p1), p0), _mm_add_epi16(q1, two)), 2);
+		__m128i q0w = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_add_epi16(q1, q1), q0), _mm_add_epi16(p1, two)), 2);
+		ioPix[1] = Select(mask, p0w, p0);
+		ioPix[2] = Select(mask, q0w, q0);
+		return;
+	}
+
+	mask = _mm_and_si128(mask, _mm_cmpgt_epi16(inTc0, _mm_set1_epi16(-1)));
+	__m128i tc = _mm_add_epi16(inTc0, _mm_set1_epi16(1));
+	__m128i delta = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(_mm_slli_epi16(_mm_sub_epi16(q0, p0), 2),
+																_mm_sub_epi16(p1, q1)), _mm_set1_epi16(4)), 3);
+	delta = _mm_and_si128(Clip(delta, tc), mask);
+	ioPix[1] = _mm_add_epi16(p0, delta);
+	ioPix[2] = _mm_sub_epi16(q0, delta);
+}
+
+// Rows of 8 bytes in the low halves into columns, and back
+static void Transpose8x8( __m128i* ioRows )
+{
+	__m128i a0 = _mm_unpacklo_epi8(ioRows[0], ioRows[1]);
+	__m128i a1 = _mm_unpacklo_epi8(ioRows[2], ioRows[3]);
+	__m128i a2 = _mm_unpacklo_epi8(ioRows[4], ioRows[5]);
+	__m128i a3 = _mm_unpacklo_epi8(ioRows[6], ioRows[7]);
+	__m128i b0 = _mm_unpacklo_epi16(a0, a1);
+	__m128i b1 = _mm_unpackhi_epi16(a0, a1);
+	__m128i b2 = _mm_unpacklo_epi16(a2, a3);
+	__m128i b3 = _mm_unpackhi_epi16(a2, a3);
+	__m128i c0 = _mm_unpacklo_epi32(b0, b2);
+	__m128i c1 = _mm_unpackhi_epi32(b0, b2);
+	__m128i c2 = _mm_unpacklo_epi32(b1, b3);
+	__m128i c3 = _mm_unpackhi_epi32(b1, b3);
+	ioRows[0] = c0;
+	ioRows[1] = _mm_srli_si128(c0, 8);
+	ioRows[2] = c1;
+	ioRows[3] = _mm_srli_si128(c1, 8);
+	ioRows[4] = c2;
+	ioRows[5] = _mm_srli_si128(c2, 8);
+	ioRows[6] = c3;
+	ioRows[7] = _mm_srli_si128(c3, 8);
+}
+
+void SoftFilterLumaEdge( unsigned char* ioPix, int inStride, bool inVertical, int inAlpha, int inBeta,
+						 const int* inTc0, bool inIntra )
+{
+	__m128i zero = _mm_setzero_si128();
+	for (int half = 0; half < 2; half++)
+	{
+		int tc0a = inTc0[half * 2], tc0b = inTc0[half * 2 + 1];
+		if (!inIntra && tc0a < 0 && tc0b < 0)
+			continue;
+		__m128i tc0 = _mm_setr_epi16((short)tc0a, (short)tc0a, (short)tc0a, (short)tc0a,
+									 (short)tc0b, (short)tc0b, (short)tc0b, (short)tc0b);
+
+		__m128i pix[8];
+		if (inVertical)
+		{
+			unsigned char* rows = ioPix + half * 8 * inStride - 4;
+			for (int i = 0; i < 8; i++)
+				pix[i] = _mm_loadl_epi64((const __m128i*)(rows + i * inStride));
+			Transpose8x8(pix);
+			for (int i = 0; i < 8; i++)
+				pix[i] = _mm_unpacklo_epi8(pix[i], zero);
+			FilterLuma8(pix, inAlpha, inBeta, tc0, inIntra);
+			for (int i = 0; i < 8; i++)
+				pix[i] = PackStrip(pix[i]);
+			Transpose8x8(pix);
+			for (int i = 0; i < 8; i++)
+				_mm_storel_epi64((__m128i*)(rows + i * inStride), pix[i]);
+		}
+		else
+		{
+			unsigned char* column = ioPix + half * 8;
+			for (int i = 0; i < 8; i++)
+				pix[i] = LoadWide(column + (i - 4) * inStride, false);
+			FilterLuma8(pix, inAlpha, inBeta, tc0, inIntra);
+			for (int i = 1; i < 7; i++)
+				_mm_storel_epi64((__m128i*)(column + (i - 4) * inStride), PackStrip(pix[i]));
+		}
+	}
+}
+
+void SoftFilterChromaEdge( unsigned char* ioPix, int inStride, bool inVertical, int inAlpha, int inBeta,
+						   const int* inTc0, bool inIntra )
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i tc0 = _mm_setr_epi16((short)inTc0[0], (short)inTc0[0], (short)inTc0[1], (short)inTc0[1],
+								 (short)inTc0[2], (short)inTc0[2], (short)inTc0[3], (short)inTc0[3]);
+	__m128i pix[4];
+	if (inVertical)
+	{
+		// p1 p0 q0 q1 of each row, gathered into columns
+		__m128i rows[4];
+		for (int i = 0; i < 4; i++)
+			rows[i] = _mm_unpacklo_epi8(Load4(ioPix + 2 * i * inStride - 2), Load4(ioPix + (2 * i + 1) * inStride - 2));
+		__m128i lo = _mm_unpacklo_epi16(rows[0], rows[1]);
+		__m128i hi = _mm_unpacklo_epi16(rows[2], rows[3]);
+		__m128i first = _mm_unpacklo_epi32(lo, hi);
+		__m128i second = _mm_unpackhi_epi32(lo, hi);
+		pix[0] = _mm_unpacklo_epi8(first, zero);
+		pix[1] = _mm_unpackhi_epi8(first, zero);
+		pix[2] = _mm_unpacklo_epi8(second, zero);
+		pix[3] = _mm_unpackhi_epi8(second, zero);
+		FilterChroma8(pix, inAlpha, inBeta, tc0, inIntra);
+
+		// p0 and q0 of each row side by side
+		__m128i pairs = _mm_unpacklo_epi8(PackStrip(pix[1]), PackStrip(pix[2]));
+		for (int i = 0; i < 8; i++)
+		{
+			int pair = _mm_extract_epi16(pairs, 0);
+			unsigned char* row = ioPix + i * inStride;
+			row[-1] = (unsigned char)pair;
+			row[0] = (unsigned char)(pair >> 8);
+			pairs = _mm_srli_si128(pairs, 2);
+		}
+	}
+	else
+	{
+		for (int i = 0; i < 4; i++)
+			pix[i] = LoadWide(ioPix + (i - 2) * inStride, false);
+		FilterChroma8(pix, inAlpha, inBeta, tc0, inIntra);
+		_mm_storel_epi64((__m128i*)(ioPix - inStride), PackStrip(pix[1]));
+		_mm_storel_epi64((__m128i*)ioPix, PackStrip(pix[2]));
+	}
+}
@@ -0,0 +1,53 @@
+//------------------------------------------------------------------------------
+// File: SoftH264Dsp.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: SSE2 kernels of the software decoder: inverse transform, motion
+// compensation, weighted prediction and the deblocking filter. They give
+// the same samples as SoftH264DspReference.h.
+//
+//------------------------------------------------------------------------------
+
+#ifndef SOFT_H264_DSP_H_
+#define SOFT_H264_DSP_H_
+
+// Adds the inverse transform of a 4x4 block of dequantized coefficients
+// (raster order) and clears the block
+void	SoftIdctAdd(unsigned char* ioDst, int inStride, short* ioBlock);
+
+// Luma prediction at quarter position (inDx, inDy) from inSrc, which must
+// be readable 2 samples left and above and 3 right and below the block.
+// Widths of 4, 8 and 16.
+void	SoftLumaMc(unsigned char* outDst, int inDstStride, const unsigned char* inSrc, int inSrcStride,
+				   int inWidth, int inHeight, int inDx, int inDy);
+
+// Chroma prediction at eighth position (inDx, inDy), reading one more
+// sample right and below. Widths of 2, 4 and 8.
+void	SoftChromaMc(unsigned char* outDst, int inDstStride, const unsigned char* inSrc, int inSrcStride,
+					 int inWidth, int inHeight, int inDx, int inDy);
+
+// Default prediction of both lists: ioDst becomes the rounded average
+void	SoftAverage(unsigned char* ioDst, int inDstStride, const unsigned char* inSrc, int inSrcStride,
+					int inWidth, int inHeight);
+
+// Explicit weighted prediction of one list, in place
+void	SoftWeight(unsigned char* ioDst, int inStride, int inWidth, int inHeight,
+				   int inLog2Denom, int inWeight, int inOffset);
+
+// Weighted prediction of both lists, ioDst holding list 0. inOffset is
+// the rounded average of the two offsets.
+void	SoftBiWeight(unsigned char* ioDst, int inDstStride, const unsigned char* inSrc, int inSrcStride,
+					 int inWidth, int inHeight, int inLog2Denom, int inWeight0, int inWeight1, int inOffset);
+
+// Filters an edge of 16 luma or 8 chroma samples starting at ioPix, the
+// first q0. inTc0 holds tc0 of each quarter of the edge, -1 where bS is 0;
+// inIntra is bS 4 on the whole edge.
+void	SoftFilterLumaEdge(unsigned char* ioPix, int inStride, bool inVertical, int inAlpha, int inBeta,
+						   const int* inTc0, bool inIntra);
+void	SoftFilterChromaEdge(unsigned char* ioPix, int inStride, bool inVertical, int inAlpha, int inBeta,
+							 const int* inTc0, bool inIntra);
+
+#endif
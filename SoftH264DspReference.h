@@ -0,0 +1,254 @@
+//------------------------------------------------------------------------------
+// File: SoftH264DspReference.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: The kernels of SoftH264Dsp.h written as the standard states them,
+// a sample at a time. SoftDspFuzz checks the SSE2 ones against these.
+//
+//------------------------------------------------------------------------------
+
+#ifndef SOFT_H264_DSP_REFERENCE_H_
+#define SOFT_H264_DSP_REFERENCE_H_
+
+#include <string.h>
+
+static inline int RefClip255( int inValue )
+{
+	return inValue < 0 ? 0 : (inValue > 255 ? 255 : inValue);
+}
+
+static inline int RefClip3( int inLow, int inHigh, int inValue )
+{
+	return inValue < inLow ? inLow : (inValue > inHigh ? inHigh : inValue);
+}
+
+static inline int RefAbs( int inValue )
+{
+	return inValue < 0 ? -inValue : inValue;
+}
+
+// 8.5.12.2, then the residual added and the block cleared
+static inline void RefIdctAdd( unsigned char* ioDst, int inStride, short* ioBlock )
+{
+	int temp[16];
+	for (int i = 0; i < 4; i++)
+	{
+		const short* d = ioBlock + i * 4;
+		int e = d[0] + d[2];
+		int f = d[0] - d[2];
+		int g = (d[1] >> 1) - d[3];
+		int h = d[1] + (d[3] >> 1);
+		temp[i * 4 + 0] = e + h;
+		temp[i * 4 + 1] = f + g;
+		temp[i * 4 + 2] = f - g;
+		temp[i * 4 + 3] = e - h;
+	}
+	for (int i = 0; i < 4; i++)
+	{
+		int e = temp[i] + temp[8 + i];
+		int f = temp[i] - temp[8 + i];
+		int g = (temp[4 + i] >> 1) - temp[12 + i];
+		int h = temp[4 + i] + (temp[12 + i] >> 1);
+		ioDst[i] = (unsigned char)RefClip255(ioDst[i] + ((e + h + 32) >> 6));
+		ioDst[inStride + i] = (unsigned char)RefClip255(ioDst[inStride + i] + ((f + g + 32) >> 6));
+		ioDst[2 * inStride + i] = (unsigned char)RefClip255(ioDst[2 * inStride + i] + ((f - g + 32) >> 6));
+		ioDst[3 * inStride + i] = (unsigned char)RefClip255(ioDst[3 * inStride + i] + ((e - h + 32) >> 6));
+	}
+	memset(ioBlock, 0, 16 * sizeof(short));
+}
+
+static inline int RefTap6( const unsigned char* inSrc, int inStep )
+{
+	return inSrc[-2 * inStep] - 5 * inSrc[-inStep] + 20 * inSrc[0] + 20 * inSrc[inStep] -
+		   5 * inSrc[2 * inStep] + inSrc[3 * inStep];
+}
+
+// 8.4.2.2.1: the sample at quarter position (inDx, inDy) right and below inSrc
+static inline int RefLumaSample( const unsigned char* inSrc, int inStride, int inDx, int inDy )
+{
+	int g = inSrc[0];
+	int b = RefClip255((RefTap6(inSrc, 1) + 16) >> 5);
+	int h = RefClip255((RefTap6(inSrc, inStride) + 16) >> 5);
+	int m = RefClip255((RefTap6(inSrc + 1, inStride) + 16) >> 5);
+	int s = RefClip255((RefTap6(inSrc + inStride, 1) + 16) >> 5);
+	int j1 = 0;
+	for (int k = -2; k <= 3; k++)
+	{
+		static const int taps[6] = { 1, -5, 20, 20, -5, 1 };
+		j1 += taps[k + 2] * RefTap6(inSrc + k * inStride, 1);
+	}
+	int j = RefClip255((j1 + 512) >> 10);
+
+	switch (inDy * 4 + inDx)
+	{
+	case 0:		return g;
+	case 1:		return (g + b + 1) >> 1;
+	case 2:		return b;
+	case 3:		return (b + inSrc[1] + 1) >> 1;
+	case 4:		return (g + h + 1) >> 1;
+	case 5:		return (b + h + 1) >> 1;
+	case 6:		return (b + j + 1) >> 1;
+	case 7:		return (b + m + 1) >> 1;
+	case 8:		return h;
+	case 9:		return (h + j + 1) >> 1;
+	case 10:	return j;
+	case 11:	return (j + m + 1) >> 1;
+	case 12:	return (h + inSrc[inStride] + 1) >> 1;
+	case 13:	return (h + s + 1) >> 1;
+	case 14:	return (j + s + 1) >> 1;
+	default:	return (m + s + 1) >> 1;
+	}
+}
+
+static inline void RefLumaMc( unsigned char* outDst, int inDstStride, const unsigned char* inSrc, int inSrcStride,
+							  int inWidth, int inHeight, int inDx, int inDy )
+{
+	for (int y = 0; y < inHeight; y++)
+	{
+		for (int x = 0; x < inWidth; x++)
+			outDst[y * inDstStride + x] = (unsigned char)RefLumaSample(inSrc + y * inSrcStride + x, inSrcStride, inDx, inDy);
+	}
+}
+
+// 8.4.2.2.2, eighth positions
+static inline void RefChromaMc( unsigned char* outDst, int inDstStride, const unsigned char* inSrc, int inSrcStride,
+								int inWidth, int inHeight, int inDx, int inDy )
+{
+	for (int y = 0; y < inHeight; y++)
+	{
+		for (int x = 0; x < inWidth; x++)
+		{
+			const unsigned char* s = inSrc + y * inSrcStride + x;
+			outDst[y * inDstStride + x] = (unsigned char)(((8 - inDx) * (8 - inDy) * s[0] + inDx * (8 - inDy) * s[1] +
+														  (8 - inDx) * inDy * s[inSrcStride] + inDx * inDy * s[inSrcStride + 1] + 32) >> 6);
+		}
+	}
+}
+
+static inline void RefAverage( unsigned char* ioDst, int inDstStride, const unsigned char* inSrc, int inSrcStride,
+							   int inWidth, int inHeight )
+{
+	for (int y = 0; y < inHeight; y++)
+	{
+		for (int x = 0; x < inWidth; x++)
+			ioDst[y * inDstStride + x] = (unsigned char)((ioDst[y * inDstStride + x] + inSrc[y * inSrcStride + x] + 1) >> 1);
+	}
+}
+
+// 8.4.2.3.2, one list
+static inline void RefWeight( unsigned char* ioDst, int inStride, int inWidth, int inHeight,
+							  int inLog2Denom, int inWeight, int inOffset )
+{
+	for (int y = 0; y < inHeight; y++)
+	{
+		for (int x = 0; x < inWidth; x++)
+		{
+			int p = ioDst[y * inStride + x] * inWeight;
+			if (inLog2Denom >= 1)
+				p = (p + (1 << (inLog2Denom - 1))) >> inLog2Denom;
+			ioDst[y * inStride + x] = (unsigned char)RefClip255(p + inOffset);
+		}
+	}
+}
+
+// Both lists, inOffset being (o0 + o1 + 1) >> 1
+static inline void RefBiWeight( unsigned char* ioDst, int inDstStride, const unsigned char* inSrc, int inSrcStride,
+								int inWidth, int inHeight, int inLog2Denom, int inWeight0, int inWeight1, int inOffset )
+{
+	for (int y = 0; y < inHeight; y++)
+	{
+		for (int x = 0; x < inWidth; x++)
+		{
+			int p = ioDst[y * inDstStride + x] * inWeight0 + inSrc[y * inSrcStride + x] * inWeight1;
+			p = ((p + (1 << inLog2Denom)) >> (inLog2Denom + 1)) + inOffset;
+			ioDst[y * inDstStride + x] = (unsigned char)RefClip255(p);
+		}
+	}
+}
+
+// 8.7.2.3 and 8.7.2.4 across one edge of 16 luma samples. inStep goes
+// across the edge, inStride along it. inTc0 is per 4 samples, -1 where
+// bS is 0; bS 4 is the intra filter.
+static inline void RefLumaEdge( unsigned char* ioPix, int inStep, int inStride, int inAlpha, int inBeta,
+								const int* inTc0, bool inIntra )
+{
+	for (int i = 0; i < 16; i++)
+	{
+		int tc0 = inTc0[i >> 2];
+		if (!inIntra && tc0 < 0)
+			continue;
+		unsigned char* pix = ioPix + i * inStride;
+		int p0 = pix[-inStep], p1 = pix[-2 * inStep], p2 = pix[-3 * inStep];
+		int q0 = pix[0], q1 = pix[inStep], q2 = pix[2 * inStep];
+		if (RefAbs(p0 - q0) >= inAlpha || RefAbs(p1 - p0) >= inBeta || RefAbs(q1 - q0) >= inBeta)
+			continue;
+		bool ap = RefAbs(p2 - p0) < inBeta;
+		bool aq = RefAbs(q2 - q0) < inBeta;
+		if (inIntra)
+		{
+			int p3 = pix[-4 * inStep], q3 = pix[3 * inStep];
+			bool strong = RefAbs(p0 - q0) < ((inAlpha >> 2) + 2);
+			if (ap && strong)
+			{
+				pix[-inStep] = (unsigned char)((p2 + 2 * p1 + 2 * p0 + 2 * q0 + q1 + 4) >> 3);
+				pix[-2 * inStep] = (unsigned char)((p2 + p1 + p0 + q0 + 2) >> 2);
+				pix[-3 * inStep] = (unsigned char)((2 * p3 + 3 * p2 + p1 + p0 + q0 + 4) >> 3);
+			}
+			else
+			{
+				pix[-inStep] = (unsigned char)((2 * p1 + p0 + q1 + 2) >> 2);
+			}
+			if (aq && strong)
+			{
+				pix[0] = (unsigned char)((p1 + 2 * p0 + 2 * q0 + 2 * q1 + q2 + 4) >> 3);
+				pix[inStep] = (unsigned char)((p0 + q0 + q1 + q2 + 2) >> 2);
+				pix[2 * inStep] = (unsigned char)((2 * q3 + 3 * q2 + q1 + q0 + p0 + 4) >> 3);
+			}
+			else
+			{
+				pix[0] = (unsigned char)((2 * q1 + q0 + p1 + 2) >> 2);
+			}
+			continue;
+		}
+		int tc = tc0 + (ap ? 1 : 0) + (aq ? 1 : 0);
+		int delta = RefClip3(-tc, tc, (((q0 - p0) << 2) + (p1 - q1) + 4) >> 3);
+		pix[-inStep] = (unsigned char)RefClip255(p0 + delta);
+		pix[0] = (unsigned char)RefClip255(q0 - delta);
+		if (ap)
+			pix[-2 * inStep] = (unsigned char)(p1 + RefClip3(-tc0, tc0, (p2 + ((p0 + q0 + 1) >> 1) - (p1 << 1)) >> 1));
+		if (aq)
+			pix[inStep] = (unsigned char)(q1 + RefClip3(-tc0, tc0, (q2 + ((p0 + q0 + 1) >> 1) - (q1 << 1)) >> 1));
+	}
+}
+
+// The same across 8 chroma samples, inTc0 per 2 of them
+static inline void RefChromaEdge( unsigned char* ioPix, int inStep, int inStride, int inAlpha, int inBeta,
+								  const int* inTc0, bool inIntra )
+{
+	for (int i = 0; i < 8; i++)
+	{
+		int tc0 = inTc0[i >> 1];
+		if (!inIntra && tc0 < 0)
+			continue;
+		unsigned char* pix = ioPix + i * inStride;
+		int p0 = pix[-inStep], p1 = pix[-2 * inStep];
+		int q0 = pix[0], q1 = pix[inStep];
+		if (RefAbs(p0 - q0) >= inAlpha || RefAbs(p1 - p0) >= inBeta || RefAbs(q1 - q0) >= inBeta)
+			continue;
+		if (inIntra)
+		{
+			pix[-inStep] = (unsigned char)((2 * p1 + p0 + q1 + 2) >> 2);
+			pix[0] = (unsigned char)((2 * q1 + q0 + p1 + 2) >> 2);
+			continue;
+		}
+		int tc = tc0 + 1;
+		int delta = RefClip3(-tc, tc, (((q0 - p0) << 2) + (p1 - q1) + 4) >> 3);
+		pix[-inStep] = (unsigned char)RefClip255(p0 + delta);
+		pix[0] = (unsigned char)RefClip255(q0 - delta);
+	}
+}
+
+#endif
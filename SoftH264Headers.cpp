@@ -0,0 +1,382 @@
+//------------------------------------------------------------------------------
+// File: SoftH264Headers.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Complete parsing of the parameter sets and slice headers for
+// the software decoder. Unlike H264Headers.h, which only reads what the
+// CUDA decoder must be set up with, every field the decoding process
+// depends on is kept.
+//
+//------------------------------------------------------------------------------
+
+#include "SoftH264Headers.h"
+#include "BitReader.h"
+#include "Rbsp.h"
+#include <string.h>
+
+// more_rbsp_data(): bits left before the rbsp_stop_one_bit
+static bool MoreRbspData( const BitReader& inReader, const unsigned char* inRbsp, long inLength )
+{
+	long last = inLength - 1;
+	while (last >= 0 && inRbsp[last] == 0)
+		last--;
+	if (last < 0)
+		return false;
+	int trailing = 0;
+	while (!((inRbsp[last] >> trailing) & 1))
+		trailing++;
+	long long stopBit = (long long)last * 8 + 7 - trailing;
+	return inReader.GetPosition() < stopBit;
+}
+
+bool SoftParseSps( const unsigned char* inData, long inLength, SoftSps* outSps )
+{
+	SoftSps sps;
+	memset(&sps, 0, sizeof(sps));
+
+	// Sizes, cropping and VUI as the CUDA path reads them
+	if (!ParseSequenceParameterSet(inData, inLength, &sps.Info))
+		return false;
+
+	RbspBuffer rbsp(inData, inLength);
+	BitReader reader(rbsp.GetData(), rbsp.GetLength());
+
+	sps.ProfileIdc = reader.ReadBits(8);
+	reader.SkipBits(16);				// Constraint flags, level_idc
+	reader.ReadUE();					// seq_parameter_set_id
+
+	switch (sps.ProfileIdc)
+	{
+	case 100: case 110: case 122: case 244: case 44:
+	case 83: case 86: case 118: case 128: case 138: case 139: case 134: case 135:
+		{
+			int chromaFormat = reader.ReadUE();
+			if (chromaFormat == 3)
+				reader.SkipBits(1);		// separate_colour_plane_flag
+			int bitDepthLuma   = reader.ReadUE() + 8;
+			int bitDepthChroma = reader.ReadUE() + 8;
+			int bypass         = reader.ReadBit();
+			if (chromaFormat != 1 || bitDepthLuma != 8 || bitDepthChroma != 8 || bypass)
+				sps.Unsupported = SOFT_UNSUPPORTED_FORMAT;
+			else if (reader.ReadBit())	// seq_scaling_matrix_present_flag
+				sps.Unsupported = SOFT_UNSUPPORTED_SCALING;
+		}
+		break;
+	}
+	if (sps.Unsupported)
+	{
+		sps.Valid = 1;
+		*outSps = sps;
+		return true;
+	}
+
+	sps.Log2MaxFrameNum = reader.ReadUE() + 4;
+	sps.PocType         = reader.ReadUE();
+	if (sps.Log2MaxFrameNum > 16 || sps.PocType > 2)
+		return false;
+	if (sps.PocType == 0)
+	{
+		sps.Log2MaxPocLsb = reader.ReadUE() + 4;
+		if (sps.Log2MaxPocLsb > 16)
+			return false;
+	}
+	else if (sps.PocType == 1)
+	{
+		sps.DeltaPicOrderAlwaysZero   = reader.ReadBit();
+		sps.OffsetForNonRefPic        = reader.ReadSE();
+		sps.OffsetForTopToBottomField = reader.ReadSE();
+		sps.NumRefFramesInPocCycle    = reader.ReadUE();
+		if (sps.NumRefFramesInPocCycle > 255)
+			return false;
+		for (int i=0; i<sps.NumRefFramesInPocCycle; i++)
+		{
+			sps.OffsetForRefFrame[i] = reader.ReadSE();
+		}
+	}
+
+	sps.MaxNumRefFrames       = reader.ReadUE();
+	sps.GapsInFrameNumAllowed = reader.ReadBit();
+	sps.MbWidth               = reader.ReadUE() + 1;
+	sps.MbHeight              = reader.ReadUE() + 1;
+	int frameMbsOnly          = reader.ReadBit();
+	if (!frameMbsOnly)
+		reader.SkipBits(1);				// mb_adaptive_frame_field_flag
+	sps.Direct8x8Inference    = reader.ReadBit();
+
+	if (reader.IsOverrun() || sps.MaxNumRefFrames > 16)
+		return false;
+	if (!frameMbsOnly)
+		sps.Unsupported = SOFT_UNSUPPORTED_FIELDS;
+
+	sps.Valid = 1;
+	*outSps = sps;
+	return true;
+}
+
+bool SoftParsePps( const unsigned char* inData, long inLength, SoftPps* outPps )
+{
+	RbspBuffer rbsp(inData, inLength);
+	BitReader reader(rbsp.GetData(), rbsp.GetLength());
+
+	SoftPps pps;
+	memset(&pps, 0, sizeof(pps));
+	pps.PpsId = reader.ReadUE();
+	pps.SpsId = reader.ReadUE();
+	if (pps.PpsId >= SOFT_MAX_PPS || pps.SpsId >= SOFT_MAX_SPS)
+		return false;
+	pps.EntropyCodingMode          = reader.ReadBit();
+	pps.BottomFieldPicOrderPresent = reader.ReadBit();
+	if (reader.ReadUE() > 0)			// num_slice_groups_minus1
+	{
+		pps.Unsupported = SOFT_UNSUPPORTED_FMO;
+		pps.Valid = 1;
+		*outPps = pps;
+		return !reader.IsOverrun();
+	}
+	pps.NumRefIdxDefault[0]  = reader.ReadUE() + 1;
+	pps.NumRefIdxDefault[1]  = reader.ReadUE() + 1;
+	pps.WeightedPred         = reader.ReadBit();
+	pps.WeightedBipredIdc    = reader.ReadBits(2);
+	pps.PicInitQp            = 26 + reader.ReadSE();
+	reader.ReadSE();					// pic_init_qs_minus26
+	pps.ChromaQpOffset[0]    = reader.ReadSE();
+	pps.ChromaQpOffset[1]    = pps.ChromaQpOffset[0];
+	pps.DeblockingFilterControlPresent = reader.ReadBit();
+	pps.ConstrainedIntraPred           = reader.ReadBit();
+	pps.RedundantPicCntPresent         = reader.ReadBit();
+
+	if (reader.IsOverrun() || pps.NumRefIdxDefault[0] > SOFT_MAX_REFS || pps.NumRefIdxDefault[1] > SOFT_MAX_REFS ||
+		pps.WeightedBipredIdc > 2 || pps.PicInitQp < 0 || pps.PicInitQp > 51 ||
+		pps.ChromaQpOffset[0] < -12 || pps.ChromaQpOffset[0] > 12)
+	{
+		return false;
+	}
+
+	// The High profile extension
+	if (MoreRbspData(reader, rbsp.GetData(), rbsp.GetLength()))
+	{
+		if (reader.ReadBit())			// transform_8x8_mode_flag
+			pps.Unsupported = SOFT_UNSUPPORTED_TRANSFORM;
+		else if (reader.ReadBit())		// pic_scaling_matrix_present_flag
+			pps.Unsupported = SOFT_UNSUPPORTED_SCALING;
+		else
+			pps.ChromaQpOffset[1] = reader.ReadSE();
+		if (reader.IsOverrun() || pps.ChromaQpOffset[1] < -12 || pps.ChromaQpOffset[1] > 12)
+			return false;
+	}
+
+	pps.Valid = 1;
+	*outPps = pps;
+	return true;
+}
+
+static bool ParseRefPicListModification( BitReader& ioReader, int inList, SoftSliceHeader* ioHeader )
+{
+	ioHeader->RefModCount[inList] = 0;
+	if (!ioReader.ReadBit())			// ref_pic_list_modification_flag_lX
+		return true;
+	for (;;)
+	{
+		unsigned int idc = ioReader.ReadUE();
+		if (idc == 3)
+			return true;
+		if (idc > 2 || ioHeader->RefModCount[inList] >= SOFT_MAX_REF_MODS || ioReader.IsOverrun())
+			return false;
+		int n = ioHeader->RefModCount[inList]++;
+		ioHeader->RefModIdc[inList][n]   = idc;
+		ioHeader->RefModValue[inList][n] = ioReader.ReadUE();
+	}
+}
+
+static bool ParsePredWeightTable( BitReader& ioReader, SoftSliceHeader* ioHeader )
+{
+	ioHeader->LumaLog2Denom   = ioReader.ReadUE();
+	ioHeader->ChromaLog2Denom = ioReader.ReadUE();
+	if (ioHeader->LumaLog2Denom > 7 || ioHeader->ChromaLog2Denom > 7)
+		return false;
+
+	int lists = (ioHeader->SliceType == SLICE_TYPE_B) ? 2 : 1;
+	for (int list=0; list<lists; list++)
+	{
+		for (int i=0; i<ioHeader->NumRefIdxActive[list]; i++)
+		{
+			ioHeader->LumaWeight[list][i] = 1 << ioHeader->LumaLog2Denom;
+			ioHeader->LumaOffset[list][i] = 0;
+			ioHeader->HasWeight[list][i]  = 0;
+			if (ioReader.ReadBit())		// luma_weight_lX_flag
+			{
+				ioHeader->LumaWeight[list][i] = ioReader.ReadSE();
+				ioHeader->LumaOffset[list][i] = ioReader.ReadSE();
+				ioHeader->HasWeight[list][i]  = 1;
+			}
+			for (int c=0; c<2; c++)
+			{
+				ioHeader->ChromaWeight[list][i][c] = 1 << ioHeader->ChromaLog2Denom;
+				ioHeader->ChromaOffset[list][i][c] = 0;
+			}
+			if (ioReader.ReadBit())		// chroma_weight_lX_flag
+			{
+				for (int c=0; c<2; c++)
+				{
+					ioHeader->ChromaWeight[list][i][c] = ioReader.ReadSE();
+					ioHeader->ChromaOffset[list][i][c] = ioReader.ReadSE();
+				}
+				ioHeader->HasWeight[list][i] = 1;
+			}
+		}
+	}
+	return !ioReader.IsOverrun();
+}
+
+static bool ParseDecRefPicMarking( BitReader& ioReader, SoftSliceHeader* ioHeader )
+{
+	ioHeader->MmcoCount = 0;
+	if (ioHeader->NalType == NAL_TYPE_IDR)
+	{
+		ioHeader->NoOutputOfPriorPics = ioReader.ReadBit();
+		ioHeader->LongTermReference   = ioReader.ReadBit();
+		return true;
+	}
+	ioHeader->AdaptiveRefPicMarking = ioReader.ReadBit();
+	if (!ioHeader->AdaptiveRefPicMarking)
+		return true;
+	for (;;)
+	{
+		unsigned int operation = ioReader.ReadUE();
+		if (operation == 0)
+			return true;
+		if (operation > 6 || ioHeader->MmcoCount >= SOFT_MAX_MMCO || ioReader.IsOverrun())
+			return false;
+		SoftMmco& mmco = ioHeader->Mmco[ioHeader->MmcoCount++];
+		memset(&mmco, 0, sizeof(mmco));
+		mmco.Operation = operation;
+		if (operation == 1 || operation == 3)
+			mmco.DifferenceOfPicNums = ioReader.ReadUE() + 1;
+		if (operation == 2)
+			mmco.LongTermPicNum = ioReader.ReadUE();
+		if (operation == 3 || operation == 6)
+			mmco.LongTermFrameIdx = ioReader.ReadUE();
+		if (operation == 4)
+			mmco.MaxLongTermFrameIdxPlus1 = ioReader.ReadUE();
+	}
+}
+
+bool SoftParseSliceHeader( const unsigned char* inRbsp, long inLength, int inNalType, int inNalRefIdc,
+						   const SoftSps* inSpsTable, const SoftPps* inPpsTable, SoftSliceHeader* outHeader )
+{
+	BitReader reader(inRbsp, inLength);
+	SoftSliceHeader* header = outHeader;
+
+	header->NalType   = inNalType;
+	header->NalRefIdc = inNalRefIdc;
+	header->Unsupported = 0;
+	header->FirstMb   = reader.ReadUE();
+	unsigned int sliceType = reader.ReadUE();
+	header->PpsId     = reader.ReadUE();
+	if (reader.IsOverrun() || sliceType > 9 || header->PpsId >= SOFT_MAX_PPS)
+		return false;
+	header->SliceType = sliceType % 5;
+	if (header->SliceType == SLICE_TYPE_SP || header->SliceType == SLICE_TYPE_SI)
+		return false;
+
+	const SoftPps& pps = inPpsTable[header->PpsId];
+	if (!pps.Valid)
+		return false;
+	const SoftSps& sps = inSpsTable[pps.SpsId];
+	if (!sps.Valid)
+		return false;
+	if (sps.Unsupported || pps.Unsupported)
+	{
+		header->Unsupported = sps.Unsupported ? sps.Unsupported : pps.Unsupported;
+		return false;
+	}
+	if (header->FirstMb >= sps.MbWidth * sps.MbHeight)
+		return false;
+
+	header->FrameNum = reader.ReadBits(sps.Log2MaxFrameNum);
+	header->IdrPicId = (inNalType == NAL_TYPE_IDR) ? (int)reader.ReadUE() : 0;
+	header->PocLsb = 0;
+	header->DeltaPocBottom = 0;
+	header->DeltaPoc[0] = header->DeltaPoc[1] = 0;
+	if (sps.PocType == 0)
+	{
+		header->PocLsb = reader.ReadBits(sps.Log2MaxPocLsb);
+		if (pps.BottomFieldPicOrderPresent)
+			header->DeltaPocBottom = reader.ReadSE();
+	}
+	else if (sps.PocType == 1 && !sps.DeltaPicOrderAlwaysZero)
+	{
+		header->DeltaPoc[0] = reader.ReadSE();
+		if (pps.BottomFieldPicOrderPresent)
+			header->DeltaPoc[1] = reader.ReadSE();
+	}
+	header->RedundantPicCnt = pps.RedundantPicCntPresent ? (int)reader.ReadUE() : 0;
+
+	bool isB = (header->SliceType == SLICE_TYPE_B);
+	bool isI = (header->SliceType == SLICE_TYPE_I);
+	header->DirectSpatialMvPred = isB ? reader.ReadBit() : 0;
+	header->NumRefIdxActive[0] = isI ? 0 : pps.NumRefIdxDefault[0];
+	header->NumRefIdxActive[1] = isB ? pps.NumRefIdxDefault[1] : 0;
+	if (!isI && reader.ReadBit())		// num_ref_idx_active_override_flag
+	{
+		header->NumRefIdxActive[0] = reader.ReadUE() + 1;
+		if (isB)
+			header->NumRefIdxActive[1] = reader.ReadUE() + 1;
+	}
+	if (header->NumRefIdxActive[0] > SOFT_MAX_REFS || header->NumRefIdxActive[1] > SOFT_MAX_REFS)
+		return false;
+
+	header->RefModCount[0] = header->RefModCount[1] = 0;
+	if (!isI)
+	{
+		if (!ParseRefPicListModification(reader, 0, header))
+			return false;
+		if (isB && !ParseRefPicListModification(reader, 1, header))
+			return false;
+	}
+
+	header->LumaLog2Denom = header->ChromaLog2Denom = 0;
+	memset(header->HasWeight, 0, sizeof(header->HasWeight));
+	if ((pps.WeightedPred && header->SliceType == SLICE_TYPE_P) || (pps.WeightedBipredIdc == 1 && isB))
+	{
+		if (!ParsePredWeightTable(reader, header))
+			return false;
+	}
+
+	header->NoOutputOfPriorPics = 0;
+	header->LongTermReference = 0;
+	header->AdaptiveRefPicMarking = 0;
+	header->MmcoCount = 0;
+	if (inNalRefIdc != 0 && !ParseDecRefPicMarking(reader, header))
+		return false;
+
+	header->CabacInitIdc = (pps.EntropyCodingMode && !isI) ? (int)reader.ReadUE() : 0;
+	header->Qp = pps.PicInitQp + reader.ReadSE();
+	if (header->CabacInitIdc > 2 || header->Qp < 0 || header->Qp > 51)
+		return false;
+
+	header->DisableDeblockingFilterIdc = 0;
+	header->AlphaOffset = header->BetaOffset = 0;
+	if (pps.DeblockingFilterControlPresent)
+	{
+		header->DisableDeblockingFilterIdc = reader.ReadUE();
+		if (header->DisableDeblockingFilterIdc > 2)
+			return false;
+		if (header->DisableDeblockingFilterIdc != 1)
+		{
+			header->AlphaOffset = reader.ReadSE() * 2;
+			header->BetaOffset  = reader.ReadSE() * 2;
+			if (header->AlphaOffset < -12 || header->AlphaOffset > 12 ||
+				header->BetaOffset < -12 || header->BetaOffset > 12)
+			{
+				return false;
+			}
+		}
+	}
+
+	header->DataOffset = (long)reader.GetPosition();
+	return !reader.IsOverrun();
+}
@@ -0,0 +1,138 @@
+//------------------------------------------------------------------------------
+// File: SoftH264Headers.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Complete parsing of the parameter sets and slice headers for
+// the software decoder. Unlike H264Headers.h, which only reads what the
+// CUDA decoder must be set up with, every field the decoding process
+// depends on is kept.
+//
+//------------------------------------------------------------------------------
+
+#ifndef SOFT_H264_HEADERS_H_
+#define SOFT_H264_HEADERS_H_
+
+#include "H264Headers.h"
+
+#define SOFT_MAX_SPS			32
+#define SOFT_MAX_PPS			256
+#define SOFT_MAX_REFS			32		// num_ref_idx_active of a frame
+#define SOFT_MAX_REF_MODS		(SOFT_MAX_REFS + 1)
+#define SOFT_MAX_MMCO			66
+
+// Why a parameter set is valid but cannot be decoded, 0 if it can
+#define SOFT_UNSUPPORTED_FIELDS		1	// frame_mbs_only_flag 0
+#define SOFT_UNSUPPORTED_FORMAT		2	// Not 8-bit 4:2:0
+#define SOFT_UNSUPPORTED_SCALING	3	// Scaling matrices
+#define SOFT_UNSUPPORTED_TRANSFORM	4	// 8x8 transform
+#define SOFT_UNSUPPORTED_FMO		5	// Slice groups
+
+typedef struct
+{
+	int				Valid;
+	int				Unsupported;		// SOFT_UNSUPPORTED_xxx
+	SequenceInfo	Info;				// Sizes, cropping and VUI
+	int				ProfileIdc;
+	int				MbWidth;
+	int				MbHeight;
+	int				Log2MaxFrameNum;
+	int				PocType;
+	int				Log2MaxPocLsb;
+	int				DeltaPicOrderAlwaysZero;
+	int				OffsetForNonRefPic;
+	int				OffsetForTopToBottomField;
+	int				NumRefFramesInPocCycle;
+	int				OffsetForRefFrame[256];
+	int				MaxNumRefFrames;
+	int				GapsInFrameNumAllowed;
+	int				Direct8x8Inference;
+} SoftSps;
+
+typedef struct
+{
+	int				Valid;
+	int				Unsupported;		// SOFT_UNSUPPORTED_xxx
+	int				PpsId;
+	int				SpsId;
+	int				EntropyCodingMode;	// 1 for CABAC
+	int				BottomFieldPicOrderPresent;
+	int				NumRefIdxDefault[2];
+	int				WeightedPred;
+	int				WeightedBipredIdc;
+	int				PicInitQp;
+	int				ChromaQpOffset[2];	// Cb, Cr
+	int				DeblockingFilterControlPresent;
+	int				ConstrainedIntraPred;
+	int				RedundantPicCntPresent;
+} SoftPps;
+
+typedef struct
+{
+	int				Operation;			// memory_management_control_operation
+	int				DifferenceOfPicNums;	// Minus 1 added back
+	int				LongTermPicNum;
+	int				LongTermFrameIdx;
+	int				MaxLongTermFrameIdxPlus1;
+} SoftMmco;
+
+typedef struct
+{
+	int				NalType;
+	int				NalRefIdc;
+	int				FirstMb;
+	int				SliceType;			// SLICE_TYPE_xxx
+	int				PpsId;
+	int				FrameNum;
+	int				IdrPicId;
+	int				PocLsb;
+	int				DeltaPocBottom;
+	int				DeltaPoc[2];
+	int				RedundantPicCnt;
+	int				DirectSpatialMvPred;
+	int				NumRefIdxActive[2];
+
+	// ref_pic_list_modification: modification_of_pic_nums_idc and its value
+	int				RefModCount[2];
+	int				RefModIdc[2][SOFT_MAX_REF_MODS];
+	int				RefModValue[2][SOFT_MAX_REF_MODS];
+
+	// Explicit weights, the defaults where a flag is off
+	int				LumaLog2Denom;
+	int				ChromaLog2Denom;
+	int				LumaWeight[2][SOFT_MAX_REFS];
+	int				LumaOffset[2][SOFT_MAX_REFS];
+	int				ChromaWeight[2][SOFT_MAX_REFS][2];
+	int				ChromaOffset[2][SOFT_MAX_REFS][2];
+	unsigned char	HasWeight[2][SOFT_MAX_REFS];	// Any of the flags set
+
+	int				NoOutputOfPriorPics;
+	int				LongTermReference;
+	int				AdaptiveRefPicMarking;
+	int				MmcoCount;
+	SoftMmco		Mmco[SOFT_MAX_MMCO];
+
+	int				CabacInitIdc;
+	int				Qp;					// SliceQPY
+	int				DisableDeblockingFilterIdc;
+	int				AlphaOffset;		// FilterOffsetA
+	int				BetaOffset;			// FilterOffsetB
+
+	long			DataOffset;			// RBSP bit of slice_data()
+	int				Unsupported;		// Of its parameter sets, when that is why it was refused
+} SoftSliceHeader;
+
+// The NAL unit payloads after the one-byte header. A set that does not
+// parse is left unchanged and false returned.
+bool	SoftParseSps(const unsigned char* inData, long inLength, SoftSps* outSps);
+bool	SoftParsePps(const unsigned char* inData, long inLength, SoftPps* outPps);
+
+// inRbsp is the unescaped payload. False if the header does not parse,
+// its parameter sets are missing or cannot be decoded, or it is an SP or
+// SI slice.
+bool	SoftParseSliceHeader(const unsigned char* inRbsp, long inLength, int inNalType, int inNalRefIdc,
+							 const SoftSps* inSpsTable, const SoftPps* inPpsTable, SoftSliceHeader* outHeader);
+
+#endif
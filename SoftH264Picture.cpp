@@ -0,0 +1,256 @@
+//------------------------------------------------------------------------------
+// File: SoftH264Picture.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: A decoded picture of the software decoder: its samples, what the
+// deblocking filter and later pictures need of each macroblock, and its
+// progress.
+//
+//------------------------------------------------------------------------------
+
+#include "SoftH264Picture.h"
+#include <stdlib.h>
+#include <string.h>
+
+SoftPicture::SoftPicture() :	LumaStride(0),
+								ChromaStride(0),
+								MbWidth(0),
+								MbHeight(0),
+								Mbs(NULL),
+								Id(0),
+								Poc(0),
+								FrameNum(0),
+								FrameNumWrap(0),
+								LongTermFrameIdx(0),
+								Reference(SOFT_REF_NONE),
+								NeededForOutput(false),
+								NonExisting(false),
+								Decoded(false),
+								Timestamp(0),
+								StartTime(0),
+								Users(0),
+								PendingTasks(0),
+								ConcealFrom(NULL),
+								m_SliceChunks(NULL),
+								m_ChunkCount(0),
+								m_SliceCount(0),
+								m_Claims(NULL),
+								m_RowMbs(NULL),
+								m_DeblockedRows(0),
+								m_Deblocking(false),
+								m_Progress(0),
+								m_WaiterCount(0)
+{
+	Plane[0] = Plane[1] = Plane[2] = NULL;
+}
+
+SoftPicture::~SoftPicture()
+{
+	this->Free();
+}
+
+void SoftPicture::Free( void )
+{
+	PlatformAlignedFree(Plane[0]);
+	Plane[0] = Plane[1] = Plane[2] = NULL;
+	delete [] Mbs;
+	Mbs = NULL;
+	for (int i = 0; i < m_ChunkCount; i++)
+		delete [] m_SliceChunks[i];
+	delete [] m_SliceChunks;
+	m_SliceChunks = NULL;
+	m_ChunkCount = 0;
+	delete [] m_Claims;
+	m_Claims = NULL;
+	delete [] m_RowMbs;
+	m_RowMbs = NULL;
+}
+
+bool SoftPicture::Allocate( int inMbWidth, int inMbHeight )
+{
+	this->Free();
+
+	MbWidth = inMbWidth;
+	MbHeight = inMbHeight;
+	LumaStride = inMbWidth * 16;
+	ChromaStride = inMbWidth * 8;
+
+	long lumaSize = (long)LumaStride * inMbHeight * 16;
+	long chromaSize = (long)ChromaStride * inMbHeight * 8;
+	Plane[0] = (unsigned char*)PlatformAlignedAlloc(lumaSize + chromaSize * 2, 16);
+	if (Plane[0] == NULL)
+		return false;
+	Plane[1] = Plane[0] + lumaSize;
+	Plane[2] = Plane[1] + chromaSize;
+
+	int mbCount = inMbWidth * inMbHeight;
+	Mbs = new SoftMb[mbCount];
+	m_ChunkCount = (mbCount + SOFT_SLICE_CHUNK - 1) / SOFT_SLICE_CHUNK;
+	m_SliceChunks = new SoftSliceInfo*[m_ChunkCount];
+	memset(m_SliceChunks, 0, m_ChunkCount * sizeof(SoftSliceInfo*));
+	m_Claims = new long[inMbWidth * inMbHeight];
+	m_RowMbs = new int[inMbHeight];
+	return true;
+}
+
+void SoftPicture::Start( void )
+{
+	int mbCount = MbWidth * MbHeight;
+	for (int i = 0; i < mbCount; i++)
+		Mbs[i].Slice = SOFT_NO_SLICE;
+	memset((void*)m_Claims, 0, mbCount * sizeof(long));
+	memset(m_RowMbs, 0, MbHeight * sizeof(int));
+	m_SliceCount = 0;
+	m_DeblockedRows = 0;
+	m_Deblocking = false;
+	m_Progress = 0;
+	m_WaiterCount = 0;
+	ConcealFrom = NULL;
+}
+
+SoftSliceInfo* SoftPicture::AddSlice( int* outIndex )
+{
+	// Slices are never more than macroblocks, and the table does not move
+	// while other threads read it
+	if (m_SliceCount >= MbWidth * MbHeight || m_SliceCount >= SOFT_NO_SLICE)
+		return NULL;
+	int chunk = m_SliceCount / SOFT_SLICE_CHUNK;
+	if (m_SliceChunks[chunk] == NULL)
+		m_SliceChunks[chunk] = new SoftSliceInfo[SOFT_SLICE_CHUNK];
+	*outIndex = m_SliceCount++;
+	return this->GetSlice(*outIndex);
+}
+
+void SoftPicture::AddDecodedMbs( int inRow, int inCount )
+{
+	PlatformAutoLock lock(&m_Lock);
+	m_RowMbs[inRow] += inCount;
+	this->Deblock();
+}
+
+// Called with the lock held. Row r is filtered once r and r + 1 are
+// decoded: the intra prediction of r + 1 reads r unfiltered, and the
+// filter of r changes the bottom of r - 1, which is then final. A single
+// thread filters at a time, the others only count their macroblocks.
+void SoftPicture::Deblock( void )
+{
+	if (m_Deblocking)
+		return;
+	m_Deblocking = true;
+	while (m_DeblockedRows < MbHeight && m_RowMbs[m_DeblockedRows] == MbWidth &&
+		   (m_DeblockedRows + 1 == MbHeight || m_RowMbs[m_DeblockedRows + 1] == MbWidth))
+	{
+		int row = m_DeblockedRows;
+		m_Lock.Unlock();
+		SoftDeblockRow(this, row);
+		m_Lock.Lock();
+		m_DeblockedRows++;
+		// The rows above are final. All of them only after Finish.
+		if (row > 0)
+			this->SetProgress(row);
+	}
+	m_Deblocking = false;
+}
+
+void SoftPicture::Finish( SoftPicture* inConcealFrom, PlatformSemaphore* inWake )
+{
+	bool conceal = (inConcealFrom != NULL && inConcealFrom->MbWidth == MbWidth &&
+					inConcealFrom->MbHeight == MbHeight);
+
+	for (int y = 0; y < MbHeight; y++)
+	{
+		if (m_RowMbs[y] == MbWidth)
+			continue;
+		if (conceal)
+			inConcealFrom->WaitProgress(MbHeight, inWake);
+		for (int x = 0; x < MbWidth; x++)
+		{
+			SoftMb* mb = &Mbs[y * MbWidth + x];
+			if (mb->Slice != SOFT_NO_SLICE)
+				continue;
+
+			// From the previous picture, grey without one. The filter leaves it out.
+			for (int plane = 0; plane < 3; plane++)
+			{
+				int size = plane ? 8 : 16;
+				int stride = plane ? ChromaStride : LumaStride;
+				long offset = (long)y * size * stride + x * size;
+				for (int i = 0; i < size; i++)
+				{
+					if (conceal)
+						memcpy(Plane[plane] + offset, inConcealFrom->Plane[plane] + offset, size);
+					else
+						memset(Plane[plane] + offset, 128, size);
+					offset += stride;
+				}
+			}
+			memset(mb, 0, sizeof(SoftMb));
+			mb->Type = SOFT_MB_CONCEALED;
+			mb->Slice = SOFT_NO_SLICE;
+			memset(mb->Ref, -1, sizeof(mb->Ref));
+		}
+	}
+
+	PlatformAutoLock lock(&m_Lock);
+	for (int y = 0; y < MbHeight; y++)
+		m_RowMbs[y] = MbWidth;
+	this->Deblock();
+	this->SetProgress(MbHeight);
+}
+
+// Called with the lock held
+void SoftPicture::SetProgress( int inRows )
+{
+	m_Progress = inRows;
+	int kept = 0;
+	for (int i = 0; i < m_WaiterCount; i++)
+	{
+		if (m_Waiters[i].Rows <= inRows)
+			m_Waiters[i].Wake->Post();
+		else
+			m_Waiters[kept++] = m_Waiters[i];
+	}
+	m_WaiterCount = kept;
+}
+
+void SoftPicture::WaitProgress( int inRows, PlatformSemaphore* inWake )
+{
+	if (inRows > MbHeight)
+		inRows = MbHeight;
+	if (m_Progress >= inRows)
+		return;
+
+	m_Lock.Lock();
+	if (m_Progress >= inRows)
+	{
+		m_Lock.Unlock();
+		return;
+	}
+	m_Waiters[m_WaiterCount].Rows = inRows;
+	m_Waiters[m_WaiterCount].Wake = inWake;
+	m_WaiterCount++;
+	m_Lock.Unlock();
+	inWake->Wait();
+}
+
+void SoftPicture::Fill( int inValue )
+{
+	long size = (long)LumaStride * MbHeight * 16 + (long)ChromaStride * MbHeight * 8 * 2;
+	memset(Plane[0], inValue, size);
+
+	int mbCount = MbWidth * MbHeight;
+	for (int i = 0; i < mbCount; i++)
+	{
+		memset(&Mbs[i], 0, sizeof(SoftMb));
+		Mbs[i].Type = SOFT_MB_CONCEALED;
+		Mbs[i].Slice = SOFT_NO_SLICE;
+		memset(Mbs[i].Ref, -1, sizeof(Mbs[i].Ref));
+	}
+	for (int y = 0; y < MbHeight; y++)
+		m_RowMbs[y] = MbWidth;
+	m_DeblockedRows = MbHeight;
+	m_Progress = MbHeight;
+}
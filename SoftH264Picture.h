@@ -0,0 +1,169 @@
+//------------------------------------------------------------------------------
+// File: SoftH264Picture.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: A decoded picture of the software decoder: its samples, what the
+// deblocking filter and later pictures need of each macroblock, and its
+// progress. Several slices of it, and the pictures predicted from it, are
+// decoded at the same time: a reader waits until the rows it reads are
+// final, a row being final once the filter has passed the row below it.
+//
+//------------------------------------------------------------------------------
+
+#ifndef SOFT_H264_PICTURE_H_
+#define SOFT_H264_PICTURE_H_
+
+#include "SoftH264Headers.h"
+#include "Platform.h"
+#include "AtomicOps.h"
+
+#define SOFT_MAX_THREADS		32
+#define SOFT_NO_SLICE			0xffff
+#define SOFT_SLICE_CHUNK		64		// Slice entries allocated at once
+
+// SoftMb.Type
+#define SOFT_MB_INTRA4x4		0x0001
+#define SOFT_MB_INTRA16x16		0x0002
+#define SOFT_MB_PCM				0x0004
+#define SOFT_MB_INTRA			(SOFT_MB_INTRA4x4 | SOFT_MB_INTRA16x16 | SOFT_MB_PCM)
+#define SOFT_MB_SKIP			0x0008
+#define SOFT_MB_DIRECT			0x0010	// B_Skip and B_Direct_16x16
+#define SOFT_MB_16x16			0x0020
+#define SOFT_MB_16x8			0x0040
+#define SOFT_MB_8x16			0x0080
+#define SOFT_MB_8x8				0x0100
+#define SOFT_MB_CONCEALED		0x0200	// Not in any slice that decoded
+
+// SoftPicture.Reference
+#define SOFT_REF_NONE			0
+#define SOFT_REF_SHORT			1
+#define SOFT_REF_LONG			2
+
+// What the deblocking filter, the neighbouring macroblocks and the direct
+// prediction of later pictures need. The 4x4 blocks are in raster order.
+typedef struct
+{
+	unsigned short	Type;				// SOFT_MB_xxx
+	unsigned short	Slice;				// In the picture, SOFT_NO_SLICE until decoded
+	unsigned char	Cbp;				// Luma in bits 0-3, chroma in bits 4-5
+	unsigned char	DcCoded;			// coded_block_flag of the luma, Cb and Cr DC (bits 0-2)
+	unsigned char	ChromaPredMode;
+	unsigned char	DirectMask;			// 8x8 blocks predicted in direct mode
+	unsigned char	Qp;					// QPY as the filter takes it, 0 for I_PCM
+	unsigned char	QpC[2];
+	unsigned char	NonZero[16 + 8];	// Coefficients of each 4x4 block, luma then Cb and Cr
+	signed char		IntraMode[16];
+	signed char		Ref[2][4];			// Per 8x8 block, -1 where the list is not used
+	short			Mv[2][16][2];
+	unsigned char	Mvd[2][16][2];		// Absolute, capped (CABAC contexts)
+} SoftMb;
+
+// The parameters of a slice that outlive its decoding
+typedef struct
+{
+	long			RefId[2][SOFT_MAX_REFS];	// SoftPicture.Id of each reference index
+	int				DisableDeblockingFilterIdc;
+	int				AlphaOffset;
+	int				BetaOffset;
+} SoftSliceInfo;
+
+class SoftPicture
+{
+public:
+
+	SoftPicture();
+	virtual ~SoftPicture();
+
+	bool	Allocate(int inMbWidth, int inMbHeight);
+
+	// Before the first slice. Clears the macroblocks and the progress.
+	void	Start(void);
+
+	// Entry of a new slice, NULL when there are as many as macroblocks
+	SoftSliceInfo*	AddSlice(int* outIndex);
+	SoftSliceInfo*	GetSlice(int inIndex) const { return &m_SliceChunks[inIndex / SOFT_SLICE_CHUNK][inIndex % SOFT_SLICE_CHUNK]; }
+
+	// Reserves a macroblock for the calling slice. False when another slice
+	// of the picture has it, which only a broken stream does.
+	bool	ClaimMb(int inAddress) { return AtomicCompareExchange(&m_Claims[inAddress], 1, 0) == 0; }
+
+	// A slice decoded inCount macroblocks of a row. Filters the rows that
+	// have become complete, on the calling thread.
+	void	AddDecodedMbs(int inRow, int inCount);
+
+	// After the last slice: fills in the macroblocks no slice decoded from
+	// inConcealFrom, waiting for it with inWake, and completes the filtering.
+	// The picture is then final.
+	void	Finish(SoftPicture* inConcealFrom, PlatformSemaphore* inWake);
+
+	// Blocks until the first inRows macroblock rows are final
+	void	WaitProgress(int inRows, PlatformSemaphore* inWake);
+	int		GetProgress(void) const { return (int)m_Progress; }
+	bool	IsFinished(void) const { return m_Progress >= MbHeight; }
+
+	// Every sample inValue and every macroblock concealed, for a missing reference
+	void	Fill(int inValue);
+
+public:
+
+	unsigned char*	Plane[3];
+	int				LumaStride;
+	int				ChromaStride;
+	int				MbWidth;
+	int				MbHeight;
+	SoftMb*			Mbs;
+
+	// Decoding order and references, kept by the decoder thread
+	long			Id;					// Unique to each decoded picture
+	int				Poc;
+	int				FrameNum;
+	int				FrameNumWrap;
+	int				LongTermFrameIdx;
+	int				Reference;			// SOFT_REF_xxx
+	bool			NeededForOutput;
+	bool			NonExisting;		// Inferred for a gap in frame_num
+	bool			Decoded;			// False for a picture left out
+	long long		Timestamp;
+	long long		StartTime;			// PerfTimeUs when its first slice was parsed
+
+	// Held by the DPB, the decoding of the picture and the slices predicted from it
+	volatile long	Users;
+	volatile long	PendingTasks;		// Slices being decoded, plus one until the last is parsed
+	SoftPicture*	ConcealFrom;
+
+private:
+
+	void	Deblock(void);
+	void	SetProgress(int inRows);
+	void	Free(void);
+
+private:
+
+	typedef struct
+	{
+		int					Rows;
+		PlatformSemaphore*	Wake;
+	} Waiter;
+
+	SoftSliceInfo**	m_SliceChunks;
+	int				m_ChunkCount;
+	int				m_SliceCount;
+
+	volatile long*	m_Claims;			// Of each macroblock, 1 once a slice has it
+	int*			m_RowMbs;			// Decoded macroblocks of each row
+	int				m_DeblockedRows;
+	bool			m_Deblocking;		// A thread is filtering
+	volatile long	m_Progress;			// Final rows
+
+	PlatformLock	m_Lock;
+	Waiter			m_Waiters[SOFT_MAX_THREADS + 1];
+	int				m_WaiterCount;
+};
+
+// Filters the edges of the macroblocks of a row (SoftH264Deblock.cpp)
+void	SoftDeblockRow(SoftPicture* ioPicture, int inRow);
+
+#endif
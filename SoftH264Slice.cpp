@@ -0,0 +1,2235 @@
+//------------------------------------------------------------------------------
+// File: SoftH264Slice.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Decoding of the slice data of the software decoder: macroblock
+// parsing with CAVLC or CABAC, motion vector and direct prediction, intra
+// prediction, motion compensation and the residual. Clause numbers refer
+// to the H.264 standard.
+//
+//------------------------------------------------------------------------------
+
+#include "SoftH264Slice.h"
+#include "SoftH264Tables.h"
+#include "SoftH264Dsp.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Position of 4x4 block (x, y) in the motion caches, x and y from -1
+#define CACHE(x, y)			(12 + (x) + 8 * (y))
+
+#define REF_NOT_AVAILABLE	-2		// Outside the slice or not decoded yet
+#define REF_UNUSED			-1		// The list is not used
+
+#define MVD_CAP				64		// Above the largest context threshold
+
+// Zig-zag scan of a 4x4 block to raster positions
+static const unsigned char kZigzag[16] = { 0, 1, 4, 8, 5, 2, 3, 6, 9, 12, 13, 10, 7, 11, 14, 15 };
+
+// luma4x4BlkIdx to the raster index of the block
+static const unsigned char kBlockToRaster[16] = { 0, 1, 4, 5, 2, 3, 6, 7, 8, 9, 12, 13, 10, 11, 14, 15 };
+
+// normAdjust4x4 by qP % 6 for positions with both coordinates even,
+// both odd, and the others
+static const unsigned char kLevelScale[6][3] =
+{
+	{ 10, 16, 13 }, { 11, 18, 14 }, { 13, 20, 16 }, { 14, 23, 18 }, { 16, 25, 20 }, { 18, 29, 23 }
+};
+
+static const unsigned char kScaleClass[16] = { 0, 2, 0, 2, 2, 1, 2, 1, 0, 2, 0, 2, 2, 1, 2, 1 };
+
+// B macroblock types 0 to 21: prediction of each partition, 1 list 0, 2
+// list 1, 3 both
+static const unsigned char kBPartPred[22][2] =
+{
+	{ 0, 0 }, { 1, 0 }, { 2, 0 }, { 3, 0 },
+	{ 1, 1 }, { 1, 1 }, { 2, 2 }, { 2, 2 }, { 1, 2 }, { 1, 2 }, { 2, 1 }, { 2, 1 },
+	{ 1, 3 }, { 1, 3 }, { 2, 3 }, { 2, 3 }, { 3, 1 }, { 3, 1 }, { 3, 2 }, { 3, 2 }, { 3, 3 }, { 3, 3 }
+};
+
+// B sub-macroblock types: prediction, and the partition shape (0 8x8,
+// 1 8x4, 2 4x8, 3 4x4); type 0 is direct
+static const unsigned char kBSubPred[13] = { 0, 1, 2, 3, 1, 1, 2, 2, 3, 3, 1, 2, 3 };
+static const signed char kBSubShape[13] = { -1, 0, 0, 0, 1, 2, 1, 2, 1, 2, 3, 3, 3 };
+
+// Residual block categories (ctxBlockCat)
+#define CAT_LUMA_DC			0
+#define CAT_LUMA_AC			1
+#define CAT_LUMA_4x4		2
+#define CAT_CHROMA_DC		3
+#define CAT_CHROMA_AC		4
+
+static inline int Clip( int inLow, int inHigh, int inValue )
+{
+	return inValue < inLow ? inLow : (inValue > inHigh ? inHigh : inValue);
+}
+
+static inline unsigned char Clip255( int inValue )
+{
+	return (unsigned char)(inValue < 0 ? 0 : (inValue > 255 ? 255 : inValue));
+}
+
+static inline int Median( int inA, int inB, int inC )
+{
+	int low = inA < inB ? inA : inB;
+	int high = inA < inB ? inB : inA;
+	return inC < low ? low : (inC > high ? high : inC);
+}
+
+// MinPositive of 8.4.1.2.2
+static inline int MinPositive( int inA, int inB )
+{
+	if (inA >= 0 && inB >= 0)
+		return inA < inB ? inA : inB;
+	return inA > inB ? inA : inB;
+}
+
+//------------------------------------------------------------------------------
+// SoftVlc
+
+SoftVlc::SoftVlc() : m_Table(NULL), m_Size(0)
+{
+}
+
+SoftVlc::~SoftVlc()
+{
+	delete [] m_Table;
+}
+
+void SoftVlc::Build( const unsigned char* inLengths, const unsigned char* inCodes, int inCount )
+{
+	// A second table for each first byte that starts longer codes
+	int second[256];
+	int tables = 0;
+	for (int i = 0; i < 256; i++)
+		second[i] = -1;
+	for (int i = 0; i < inCount; i++)
+	{
+		int length = inLengths[i];
+		if (length > 8 && second[inCodes[i] >> (length - 8)] < 0)
+			second[inCodes[i] >> (length - 8)] = tables++;
+	}
+
+	delete [] m_Table;
+	m_Size = 256 * (1 + tables);
+	m_Table = new Entry[m_Size];
+	memset(m_Table, 0, m_Size * sizeof(Entry));
+	for (int i = 0; i < 256; i++)
+	{
+		if (second[i] >= 0)
+		{
+			m_Table[i].Symbol = (short)(256 * (1 + second[i]));
+			m_Table[i].Bits = -1;
+		}
+	}
+
+	for (int i = 0; i < inCount; i++)
+	{
+		int length = inLengths[i];
+		int code = inCodes[i];
+		if (length == 0)
+			continue;
+		Entry* table = m_Table;
+		int index, fill;
+		if (length > 8)
+		{
+			table = m_Table + 256 * (1 + second[code >> (length - 8)]);
+			index = (code & ((1 << (length - 8)) - 1)) << (16 - length);
+			fill = 1 << (16 - length);
+		}
+		else
+		{
+			index = code << (8 - length);
+			fill = 1 << (8 - length);
+		}
+		for (int j = 0; j < fill; j++)
+		{
+			table[index + j].Symbol = (short)i;
+			table[index + j].Bits = (short)length;
+		}
+	}
+}
+
+void SoftBuildCavlcTables( SoftCavlcTables* outTables )
+{
+	for (int i = 0; i < 4; i++)
+		outTables->CoeffToken[i].Build(SoftCoeffTokenLength[i], SoftCoeffTokenCode[i], 4 * 17);
+	outTables->ChromaDcCoeffToken.Build(SoftChromaDcCoeffTokenLength, SoftChromaDcCoeffTokenCode, 4 * 5);
+	for (int i = 0; i < 15; i++)
+		outTables->TotalZeros[i].Build(SoftTotalZerosLength[i], SoftTotalZerosCode[i], 16);
+	for (int i = 0; i < 3; i++)
+		outTables->ChromaDcTotalZeros[i].Build(SoftChromaDcTotalZerosLength[i], SoftChromaDcTotalZerosCode[i], 4);
+	for (int i = 0; i < 7; i++)
+		outTables->Run[i].Build(SoftRunLength[i], SoftRunCode[i], 16);
+}
+
+//------------------------------------------------------------------------------
+// Slice data
+
+SoftSliceDecoder::SoftSliceDecoder( const SoftCavlcTables* inTables ) :	m_Tables(inTables),
+																		m_Wake(NULL),
+																		m_Task(NULL),
+																		m_Picture(NULL),
+																		m_Header(NULL),
+																		m_Reader(NULL, 0)
+{
+	memset(m_Coeffs, 0, sizeof(m_Coeffs));
+}
+
+SoftSliceDecoder::~SoftSliceDecoder()
+{
+}
+
+bool SoftSliceDecoder::Decode( SoftSliceTask* ioTask, PlatformSemaphore* inWake )
+{
+	m_Task = ioTask;
+	m_Wake = inWake;
+	m_Picture = ioTask->Picture;
+	m_Header = &ioTask->Header;
+	m_SliceType = m_Header->SliceType;
+	m_ListCount = (m_SliceType == SLICE_TYPE_B) ? 2 : (m_SliceType == SLICE_TYPE_P ? 1 : 0);
+	m_MbWidth = m_Picture->MbWidth;
+	m_MbHeight = m_Picture->MbHeight;
+	m_IsCabac = (ioTask->Pps.EntropyCodingMode != 0);
+	m_Qp = m_Header->Qp;
+	m_LastQpDelta = false;
+
+	m_WeightMode = 0;
+	if (m_SliceType == SLICE_TYPE_P && ioTask->Pps.WeightedPred)
+		m_WeightMode = 1;
+	else if (m_SliceType == SLICE_TYPE_B)
+		m_WeightMode = ioTask->Pps.WeightedBipredIdc;
+
+	// The rbsp_stop_one_bit
+	long last = ioTask->Length - 1;
+	while (last >= 0 && ioTask->Data[last] == 0)
+		last--;
+	m_StopBit = 0;
+	if (last >= 0)
+	{
+		int trailing = 0;
+		while (!((ioTask->Data[last] >> trailing) & 1))
+			trailing++;
+		m_StopBit = (long long)last * 8 + 7 - trailing;
+	}
+
+	if (m_Header->FirstMb >= m_MbWidth * m_MbHeight)
+		return false;
+	m_RowCount = 0;
+
+	bool complete = m_IsCabac ? this->DecodeCabacSlice() : this->DecodeCavlcSlice();
+	if (m_RowCount > 0)
+		m_Picture->AddDecodedMbs(m_MbY, m_RowCount);
+	if (!complete)
+		memset(m_Coeffs, 0, sizeof(m_Coeffs));
+	return complete;
+}
+
+bool SoftSliceDecoder::DecodeCavlcSlice( void )
+{
+	m_Reader = BitReader(m_Task->Data, m_Task->Length);
+	m_Reader.SkipBits(m_Header->DataOffset);
+
+	int mbCount = m_MbWidth * m_MbHeight;
+	int address = m_Header->FirstMb;
+	for (;;)
+	{
+		if (m_SliceType != SLICE_TYPE_I)
+		{
+			unsigned int run = m_Reader.ReadUE();
+			if (m_Reader.IsOverrun())
+				return false;
+			for (; run > 0; run--)
+			{
+				if (address >= mbCount)
+					return false;
+				if (!this->StartMb(address++))
+					return false;
+				this->DecodeSkipMb();
+				this->ReportMb();
+			}
+			if (!this->MoreRbspData())
+				return true;
+		}
+		if (address >= mbCount || !this->StartMb(address++))
+			return false;
+		if (!this->DecodeMb() || m_Reader.IsOverrun())
+		{
+			m_Mb->Slice = SOFT_NO_SLICE;
+			return false;
+		}
+		this->ReportMb();
+		if (!this->MoreRbspData())
+			return true;
+	}
+}
+
+bool SoftSliceDecoder::DecodeCabacSlice( void )
+{
+	const unsigned char* data = m_Task->Data + ((m_Header->DataOffset + 7) >> 3);
+	const unsigned char* end = m_Task->Data + m_Task->Length;
+	if (data >= end)
+		return false;
+	m_Cabac.Start(data, (long)(end - data));
+	if (m_SliceType == SLICE_TYPE_I)
+		SoftCabac::InitContexts(m_Contexts, SoftCabacInitI, m_Header->Qp);
+	else
+		SoftCabac::InitContexts(m_Contexts, SoftCabacInitPB[m_Header->CabacInitIdc], m_Header->Qp);
+
+	int mbCount = m_MbWidth * m_MbHeight;
+	int address = m_Header->FirstMb;
+	for (;;)
+	{
+		if (address >= mbCount || !this->StartMb(address++))
+			return false;
+		if (m_SliceType != SLICE_TYPE_I && this->ReadMbSkip())
+		{
+			this->DecodeSkipMb();
+		}
+		else if (!this->DecodeMb())
+		{
+			m_Mb->Slice = SOFT_NO_SLICE;
+			return false;
+		}
+		if (m_Cabac.IsOverrun())
+		{
+			m_Mb->Slice = SOFT_NO_SLICE;
+			return false;
+		}
+		this->ReportMb();
+		if (m_Cabac.DecodeTerminate())
+			return true;
+	}
+}
+
+bool SoftSliceDecoder::MoreRbspData( void )
+{
+	return m_Reader.GetPosition() < m_StopBit;
+}
+
+// False when the macroblock belongs to another slice already: the slices
+// of a broken stream overlap, and this one ends there
+bool SoftSliceDecoder::StartMb( int inAddress )
+{
+	if (!m_Picture->ClaimMb(inAddress))
+		return false;
+
+	int width = m_MbWidth;
+	unsigned short slice = (unsigned short)m_Task->SliceIndex;
+	SoftMb* mbs = m_Picture->Mbs;
+
+	m_Address = inAddress;
+	m_MbX = inAddress % width;
+	m_MbY = inAddress / width;
+	m_Mb = &mbs[inAddress];
+	m_MbA = (m_MbX > 0 && mbs[inAddress - 1].Slice == slice) ? &mbs[inAddress - 1] : NULL;
+	m_MbB = (m_MbY > 0 && mbs[inAddress - width].Slice == slice) ? &mbs[inAddress - width] : NULL;
+	m_MbC = (m_MbY > 0 && m_MbX + 1 < width && mbs[inAddress - width + 1].Slice == slice) ? &mbs[inAddress - width + 1] : NULL;
+	m_MbD = (m_MbY > 0 && m_MbX > 0 && mbs[inAddress - width - 1].Slice == slice) ? &mbs[inAddress - width - 1] : NULL;
+
+	m_Mb->Slice = slice;
+	m_Mb->Type = 0;
+	m_Mb->Cbp = 0;
+	m_Mb->DcCoded = 0;
+	m_Mb->ChromaPredMode = 0;
+	m_Mb->DirectMask = 0;
+	memset(m_Mb->NonZero, 0, sizeof(m_Mb->NonZero));
+	m_CodedBlocks = 0;
+
+	m_Dst[0] = m_Picture->Plane[0] + (long)m_MbY * 16 * m_Picture->LumaStride + m_MbX * 16;
+	m_Dst[1] = m_Picture->Plane[1] + (long)m_MbY * 8 * m_Picture->ChromaStride + m_MbX * 8;
+	m_Dst[2] = m_Picture->Plane[2] + (long)m_MbY * 8 * m_Picture->ChromaStride + m_MbX * 8;
+	return true;
+}
+
+// Counts a decoded macroblock, the row going to the picture when it ends
+void SoftSliceDecoder::ReportMb( void )
+{
+	m_RowCount++;
+	if (m_MbX == m_MbWidth - 1)
+	{
+		m_Picture->AddDecodedMbs(m_MbY, m_RowCount);
+		m_RowCount = 0;
+	}
+}
+
+void SoftSliceDecoder::SetQp( int inQp )
+{
+	m_Qp = inQp;
+	m_Mb->Qp = (unsigned char)inQp;
+	for (int i = 0; i < 2; i++)
+		m_Mb->QpC[i] = SoftChromaQp[Clip(0, 51, inQp + m_Task->Pps.ChromaQpOffset[i])];
+}
+
+//------------------------------------------------------------------------------
+// Macroblock layer
+
+bool SoftSliceDecoder::DecodeMb( void )
+{
+	int type = this->ReadMbType();
+	if (type < 0)
+		return false;
+	if (m_SliceType == SLICE_TYPE_I)
+		return this->DecodeIntraMb(type);
+	if (m_SliceType == SLICE_TYPE_P)
+		return (type < 5) ? this->DecodeInterMb(type) : this->DecodeIntraMb(type - 5);
+	return (type < 23) ? this->DecodeInterMb(type) : this->DecodeIntraMb(type - 23);
+}
+
+void SoftSliceDecoder::DecodeSkipMb( void )
+{
+	short mv[2];
+
+	this->SetQp(m_Qp);
+	m_LastQpDelta = false;
+	this->FillMotionCache();
+	if (m_SliceType == SLICE_TYPE_P)
+	{
+		m_Mb->Type = SOFT_MB_SKIP | SOFT_MB_16x16;
+		this->PredictSkipMv(mv);
+		this->FillMotion(0, 0, 0, 4, 4, 0, mv);
+	}
+	else
+	{
+		m_Mb->Type = SOFT_MB_SKIP | SOFT_MB_DIRECT;
+		m_Mb->DirectMask = 0xf;
+		this->PredictDirect(0xf);
+	}
+	if (m_IsCabac)
+		memset(m_MvdCache, 0, sizeof(m_MvdCache));
+	this->SaveMotion();
+	this->MotionCompensate();
+}
+
+// Motion of an intra macroblock, as its neighbours see it
+static void ClearMotion( SoftMb* ioMb )
+{
+	memset(ioMb->Ref, -1, sizeof(ioMb->Ref));
+	memset(ioMb->Mv, 0, sizeof(ioMb->Mv));
+	memset(ioMb->Mvd, 0, sizeof(ioMb->Mvd));
+}
+
+bool SoftSliceDecoder::DecodeIntraMb( int inType )
+{
+	if (inType > 25)
+		return false;
+	if (inType == 25)
+		return this->DecodePcmMb();
+
+	ClearMotion(m_Mb);
+	int cbp;
+	int lumaMode = 0;
+	if (inType == 0)
+	{
+		m_Mb->Type = SOFT_MB_INTRA4x4;
+		for (int i = 0; i < 16; i++)
+		{
+			int block = kBlockToRaster[i];
+			int x = block & 3;
+			int y = block >> 2;
+			int code = this->ReadIntraPredMode();
+
+			// 8.3.1.1: DC where a neighbour is missing, 2 for one not Intra_4x4
+			int modeA = -1;
+			int modeB = -1;
+			if (x > 0)
+				modeA = m_Mb->IntraMode[block - 1];
+			else if (this->IntraAvailable(m_MbA))
+				modeA = (m_MbA->Type & SOFT_MB_INTRA4x4) ? m_MbA->IntraMode[block + 3] : 2;
+			if (y > 0)
+				modeB = m_Mb->IntraMode[block - 4];
+			else if (this->IntraAvailable(m_MbB))
+				modeB = (m_MbB->Type & SOFT_MB_INTRA4x4) ? m_MbB->IntraMode[block + 12] : 2;
+			int predicted = (modeA < 0 || modeB < 0) ? 2 : (modeA < modeB ? modeA : modeB);
+			m_Mb->IntraMode[block] = (signed char)(code < 0 ? predicted : (code < predicted ? code : code + 1));
+		}
+		int chroma = this->ReadChromaPredMode();
+		cbp = this->ReadCbp(true);
+		if (chroma < 0 || cbp < 0)
+			return false;
+		m_Mb->ChromaPredMode = (unsigned char)chroma;
+	}
+	else
+	{
+		m_Mb->Type = SOFT_MB_INTRA16x16;
+		lumaMode = (inType - 1) & 3;
+		cbp = (((inType - 1) >> 2) % 3) << 4;
+		if (inType >= 13)
+			cbp |= 0x0f;
+		int chroma = this->ReadChromaPredMode();
+		if (chroma < 0)
+			return false;
+		m_Mb->ChromaPredMode = (unsigned char)chroma;
+		for (int i = 0; i < 16; i++)
+			m_Mb->IntraMode[i] = 2;
+	}
+	m_Mb->Cbp = (unsigned char)cbp;
+
+	if (cbp || (m_Mb->Type & SOFT_MB_INTRA16x16))
+	{
+		int delta = this->ReadQpDelta();
+		if (delta < -26 || delta > 25)
+			return false;
+		this->SetQp((m_Qp + delta + 52) % 52);
+		m_LastQpDelta = (delta != 0);
+	}
+	else
+	{
+		this->SetQp(m_Qp);
+		m_LastQpDelta = false;
+	}
+	if (!this->DecodeResidual((m_Mb->Type & SOFT_MB_INTRA16x16) != 0))
+		return false;
+
+	if (m_Mb->Type & SOFT_MB_INTRA4x4)
+	{
+		// Each block predicts from the reconstruction of the ones before
+		int stride = m_Picture->LumaStride;
+		for (int i = 0; i < 16; i++)
+		{
+			int block = kBlockToRaster[i];
+			this->PredictIntra4x4(block, m_Mb->IntraMode[block]);
+			if (m_CodedBlocks & (1 << block))
+				SoftIdctAdd(m_Dst[0] + (block >> 2) * 4 * stride + (block & 3) * 4, stride, m_Coeffs[block]);
+		}
+	}
+	else
+	{
+		this->PredictIntra16x16(lumaMode);
+		this->AddLumaResidual();
+	}
+	this->PredictIntraChroma(m_Mb->ChromaPredMode);
+	this->AddChromaResidual();
+	return true;
+}
+
+bool SoftSliceDecoder::DecodePcmMb( void )
+{
+	const unsigned char* samples;
+	if (m_IsCabac)
+	{
+		samples = m_Cabac.GetAlignedData();
+		if (m_Cabac.GetEnd() - samples < 384)
+			return false;
+		m_Cabac.Start(samples + 384, (long)(m_Cabac.GetEnd() - samples - 384));
+	}
+	else
+	{
+		long long position = (m_Reader.GetPosition() + 7) & ~7LL;
+		if (position / 8 + 384 > m_Task->Length)
+			return false;
+		samples = m_Task->Data + position / 8;
+		m_Reader.SkipBits((long)(position - m_Reader.GetPosition()) + 384 * 8);
+	}
+
+	for (int y = 0; y < 16; y++)
+		memcpy(m_Dst[0] + y * m_Picture->LumaStride, samples + y * 16, 16);
+	for (int plane = 0; plane < 2; plane++)
+	{
+		for (int y = 0; y < 8; y++)
+			memcpy(m_Dst[1 + plane] + y * m_Picture->ChromaStride, samples + 256 + plane * 64 + y * 8, 8);
+	}
+
+	// QPY stays the prediction of the next macroblock; the filter takes 0
+	m_Mb->Type = SOFT_MB_PCM;
+	m_Mb->Cbp = 0x2f;
+	m_Mb->DcCoded = 7;
+	memset(m_Mb->NonZero, 16, sizeof(m_Mb->NonZero));
+	for (int i = 0; i < 16; i++)
+		m_Mb->IntraMode[i] = 2;
+	ClearMotion(m_Mb);
+	int qp = m_Qp;
+	this->SetQp(0);
+	m_Qp = qp;
+	m_LastQpDelta = false;
+	return true;
+}
+
+bool SoftSliceDecoder::DecodeInterMb( int inType )
+{
+	const int* activeRefs = m_Header->NumRefIdxActive;
+	short mv[2];
+	short mvp[2];
+	int partPred[2] = { 1, 1 };
+
+	this->FillMotionCache();
+	if (m_IsCabac)
+	{
+		memset(m_MvdCache, 0, sizeof(m_MvdCache));
+		for (int list = 0; list < m_ListCount; list++)
+		{
+			for (int i = 0; i < 4; i++)
+			{
+				if (m_MbB)
+				{
+					m_MvdCache[list][CACHE(i, -1)][0] = m_MbB->Mvd[list][12 + i][0];
+					m_MvdCache[list][CACHE(i, -1)][1] = m_MbB->Mvd[list][12 + i][1];
+				}
+				if (m_MbA)
+				{
+					m_MvdCache[list][CACHE(-1, i)][0] = m_MbA->Mvd[list][i * 4 + 3][0];
+					m_MvdCache[list][CACHE(-1, i)][1] = m_MbA->Mvd[list][i * 4 + 3][1];
+				}
+			}
+		}
+		if (m_SliceType == SLICE_TYPE_B)
+		{
+			memset(m_DirectCache, 0, sizeof(m_DirectCache));
+			for (int i = 0; i < 4; i++)
+			{
+				if (m_MbB)
+					m_DirectCache[CACHE(i, -1)] = (m_MbB->DirectMask >> (2 + (i >> 1))) & 1;
+				if (m_MbA)
+					m_DirectCache[CACHE(-1, i)] = (m_MbA->DirectMask >> ((i >> 1) * 2 + 1)) & 1;
+			}
+		}
+	}
+
+	if (m_SliceType == SLICE_TYPE_B && inType == 0)
+	{
+		m_Mb->Type = SOFT_MB_DIRECT;
+		m_Mb->DirectMask = 0xf;
+		this->PredictDirect(0xf);
+	}
+	else if ((m_SliceType == SLICE_TYPE_P && inType >= 3) || (m_SliceType == SLICE_TYPE_B && inType == 22))
+	{
+		// 8x8 partitions: all sub_mb_type, then the references, then the vectors
+		int subPred[4];
+		int refs[2][4];
+		int directMask = 0;
+		m_Mb->Type = SOFT_MB_8x8;
+		for (int i = 0; i < 4; i++)
+		{
+			int subType = this->ReadSubMbType();
+			if (m_SliceType == SLICE_TYPE_P)
+			{
+				if (subType < 0 || subType > 3)
+					return false;
+				subPred[i] = 1;
+				m_SubTypes[i] = subType;
+			}
+			else
+			{
+				if (subType < 0 || subType > 12)
+					return false;
+				subPred[i] = kBSubPred[subType];
+				m_SubTypes[i] = kBSubShape[subType];
+				if (subType == 0)
+					directMask |= 1 << i;
+			}
+		}
+		if (directMask)
+		{
+			m_Mb->DirectMask = (unsigned char)directMask;
+			this->PredictDirect(directMask);
+			for (int i = 0; i < 4; i++)
+			{
+				if (m_IsCabac && (directMask & (1 << i)))
+				{
+					int x = (i & 1) * 2;
+					int y = (i >> 1) * 2;
+					m_DirectCache[CACHE(x, y)] = m_DirectCache[CACHE(x + 1, y)] = 1;
+					m_DirectCache[CACHE(x, y + 1)] = m_DirectCache[CACHE(x + 1, y + 1)] = 1;
+				}
+			}
+			// The blocks to the right are not decoded yet for the vectors that follow
+			for (int list = 0; list < 2; list++)
+			{
+				m_RefCache[list][CACHE(2, 0)] = REF_NOT_AVAILABLE;
+				m_RefCache[list][CACHE(2, 2)] = REF_NOT_AVAILABLE;
+			}
+		}
+
+		for (int list = 0; list < m_ListCount; list++)
+		{
+			for (int i = 0; i < 4; i++)
+			{
+				if (directMask & (1 << i))
+					continue;
+				int x = (i & 1) * 2;
+				int y = (i >> 1) * 2;
+				int ref = REF_UNUSED;
+				if (subPred[i] & (1 << list))
+				{
+					ref = 0;
+					if (activeRefs[list] > 1 && !(m_SliceType == SLICE_TYPE_P && inType == 4))
+					{
+						ref = this->ReadRefIdx(list, x, y);
+						if (ref < 0 || ref >= activeRefs[list])
+							return false;
+					}
+				}
+				refs[list][i] = ref;
+				m_RefCache[list][CACHE(x + 1, y)] = (signed char)ref;
+				m_RefCache[list][CACHE(x, y + 1)] = (signed char)ref;
+				m_RefCache[list][CACHE(x + 1, y + 1)] = (signed char)ref;
+			}
+		}
+
+		for (int list = 0; list < m_ListCount; list++)
+		{
+			for (int i = 0; i < 4; i++)
+			{
+				int x = (i & 1) * 2;
+				int y = (i >> 1) * 2;
+				if (directMask & (1 << i))
+				{
+					m_RefCache[list][CACHE(x, y)] = m_RefCache[list][CACHE(x + 1, y)];
+					continue;
+				}
+				int ref = refs[list][i];
+				m_RefCache[list][CACHE(x, y)] = (signed char)ref;
+				if (!(subPred[i] & (1 << list)))
+				{
+					mv[0] = mv[1] = 0;
+					this->FillMotion(list, x, y, 2, 2, REF_UNUSED, mv);
+					continue;
+				}
+
+				int shape = m_SubTypes[i];
+				int width = (shape & 2) ? 1 : 2;
+				int height = (shape & 1) ? 1 : 2;
+				for (int j = 0; j < 4; j++)
+				{
+					int subX = x + (j & 1) * width;
+					int subY = y + (j >> 1) * height;
+					if (((j & 1) && width == 2) || ((j >> 1) && height == 2))
+						continue;
+					int mvdX = this->ReadMvd(list, 0, subX, subY);
+					int mvdY = this->ReadMvd(list, 1, subX, subY);
+					this->PredictMv(list, ref, subX, subY, width, 0, mvp);
+					mv[0] = (short)(mvp[0] + mvdX);
+					mv[1] = (short)(mvp[1] + mvdY);
+					this->FillMotion(list, subX, subY, width, height, ref, mv);
+					if (m_IsCabac)
+					{
+						for (int k = 0; k < width * height; k++)
+						{
+							int pos = CACHE(subX + (k % width), subY + k / width);
+							m_MvdCache[list][pos][0] = (unsigned char)(abs(mvdX) < MVD_CAP ? abs(mvdX) : MVD_CAP);
+							m_MvdCache[list][pos][1] = (unsigned char)(abs(mvdY) < MVD_CAP ? abs(mvdY) : MVD_CAP);
+						}
+					}
+				}
+			}
+		}
+	}
+	else
+	{
+		// One or two partitions
+		int count = 1;
+		int width = 4;
+		int height = 4;
+		if (m_SliceType == SLICE_TYPE_P)
+		{
+			m_Mb->Type = (inType == 0) ? SOFT_MB_16x16 : (inType == 1 ? SOFT_MB_16x8 : SOFT_MB_8x16);
+		}
+		else
+		{
+			if (inType < 1 || inType > 21)
+				return false;
+			partPred[0] = kBPartPred[inType][0];
+			partPred[1] = kBPartPred[inType][1];
+			m_Mb->Type = (inType < 4) ? SOFT_MB_16x16 : ((inType & 1) ? SOFT_MB_8x16 : SOFT_MB_16x8);
+		}
+		if (m_Mb->Type == SOFT_MB_16x8)
+		{
+			count = 2;
+			height = 2;
+		}
+		else if (m_Mb->Type == SOFT_MB_8x16)
+		{
+			count = 2;
+			width = 2;
+		}
+
+		for (int list = 0; list < m_ListCount; list++)
+		{
+			for (int part = 0; part < count; part++)
+			{
+				int x = (width == 2) ? part * 2 : 0;
+				int y = (height == 2) ? part * 2 : 0;
+				int ref = REF_UNUSED;
+				if (partPred[part] & (1 << list))
+				{
+					ref = 0;
+					if (activeRefs[list] > 1)
+					{
+						ref = this->ReadRefIdx(list, x, y);
+						if (ref < 0 || ref >= activeRefs[list])
+							return false;
+					}
+				}
+				mv[0] = mv[1] = 0;
+				this->FillMotion(list, x, y, width, height, ref, mv);
+			}
+		}
+
+		for (int list = 0; list < m_ListCount; list++)
+		{
+			for (int part = 0; part < count; part++)
+			{
+				int x = (width == 2) ? part * 2 : 0;
+				int y = (height == 2) ? part * 2 : 0;
+				if (!(partPred[part] & (1 << list)))
+					continue;
+				int ref = m_RefCache[list][CACHE(x, y)];
+				int mvdX = this->ReadMvd(list, 0, x, y);
+				int mvdY = this->ReadMvd(list, 1, x, y);
+				int shape = 0;
+				if (count == 2)
+					shape = (height == 2) ? 1 + part : 3 + part;
+				this->PredictMv(list, ref, x, y, width, shape, mvp);
+				mv[0] = (short)(mvp[0] + mvdX);
+				mv[1] = (short)(mvp[1] + mvdY);
+				this->FillMotion(list, x, y, width, height, ref, mv);
+				if (m_IsCabac)
+				{
+					for (int k = 0; k < width * height; k++)
+					{
+						int pos = CACHE(x + (k % width), y + k / width);
+						m_MvdCache[list][pos][0] = (unsigned char)(abs(mvdX) < MVD_CAP ? abs(mvdX) : MVD_CAP);
+						m_MvdCache[list][pos][1] = (unsigned char)(abs(mvdY) < MVD_CAP ? abs(mvdY) : MVD_CAP);
+					}
+				}
+			}
+		}
+	}
+
+	int cbp = this->ReadCbp(false);
+	if (cbp < 0)
+		return false;
+	m_Mb->Cbp = (unsigned char)cbp;
+	if (cbp)
+	{
+		int delta = this->ReadQpDelta();
+		if (delta < -26 || delta > 25)
+			return false;
+		this->SetQp((m_Qp + delta + 52) % 52);
+		m_LastQpDelta = (delta != 0);
+	}
+	else
+	{
+		this->SetQp(m_Qp);
+		m_LastQpDelta = false;
+	}
+	if (!this->DecodeResidual(false))
+		return false;
+
+	this->SaveMotion();
+	this->MotionCompensate();
+	this->AddLumaResidual();
+	this->AddChromaResidual();
+	return true;
+}
+
+//------------------------------------------------------------------------------
+// Syntax elements (7.3.5, 9.2 and 9.3)
+
+int SoftSliceDecoder::ReadMbType( void )
+{
+	if (!m_IsCabac)
+	{
+		unsigned int type = m_Reader.ReadUE();
+		return type > 48 ? -1 : (int)type;
+	}
+
+	unsigned char* ctx = m_Contexts;
+	if (m_SliceType == SLICE_TYPE_I)
+		return this->ReadIntraMbTypeCabac(3, true);
+
+	if (m_SliceType == SLICE_TYPE_P)
+	{
+		if (m_Cabac.DecodeDecision(&ctx[14]))
+			return 5 + this->ReadIntraMbTypeCabac(17, false);
+		// P_L0_16x16, P_L0_L0_16x8, P_L0_L0_8x16, P_8x8
+		if (!m_Cabac.DecodeDecision(&ctx[15]))
+			return m_Cabac.DecodeDecision(&ctx[16]) ? 3 : 0;
+		return m_Cabac.DecodeDecision(&ctx[17]) ? 1 : 2;
+	}
+
+	int inc = (m_MbA && !(m_MbA->Type & SOFT_MB_DIRECT)) + (m_MbB && !(m_MbB->Type & SOFT_MB_DIRECT));
+	if (!m_Cabac.DecodeDecision(&ctx[27 + inc]))
+		return 0;
+	if (!m_Cabac.DecodeDecision(&ctx[27 + 3]))
+		return 1 + m_Cabac.DecodeDecision(&ctx[27 + 5]);
+	int bits = m_Cabac.DecodeDecision(&ctx[27 + 4]) << 3;
+	bits |= m_Cabac.DecodeDecision(&ctx[27 + 5]) << 2;
+	bits |= m_Cabac.DecodeDecision(&ctx[27 + 5]) << 1;
+	bits |= m_Cabac.DecodeDecision(&ctx[27 + 5]);
+	if (bits < 8)
+		return bits + 3;
+	if (bits == 13)
+		return 23 + this->ReadIntraMbTypeCabac(32, false);
+	if (bits == 14)
+		return 11;
+	if (bits == 15)
+		return 22;
+	bits = (bits << 1) | m_Cabac.DecodeDecision(&ctx[27 + 5]);
+	return bits - 4;
+}
+
+// The I macroblock types, from the context of the first bin
+int SoftSliceDecoder::ReadIntraMbTypeCabac( int inBase, bool inIntraSlice )
+{
+	unsigned char* ctx = m_Contexts + inBase;
+	if (inIntraSlice)
+	{
+		int inc = (m_MbA && (m_MbA->Type & (SOFT_MB_INTRA16x16 | SOFT_MB_PCM))) +
+				  (m_MbB && (m_MbB->Type & (SOFT_MB_INTRA16x16 | SOFT_MB_PCM)));
+		if (!m_Cabac.DecodeDecision(&ctx[inc]))
+			return 0;
+		ctx += 2;
+	}
+	else if (!m_Cabac.DecodeDecision(&ctx[0]))
+	{
+		return 0;
+	}
+	if (m_Cabac.DecodeTerminate())
+		return 25;
+
+	int type = 1 + 12 * m_Cabac.DecodeDecision(&ctx[1]);		// Luma coefficients
+	if (m_Cabac.DecodeDecision(&ctx[2]))						// Chroma coefficients
+		type += 4 + 4 * m_Cabac.DecodeDecision(&ctx[2 + inIntraSlice]);
+	type += 2 * m_Cabac.DecodeDecision(&ctx[3 + inIntraSlice]);	// Prediction mode
+	type += m_Cabac.DecodeDecision(&ctx[3 + 2 * inIntraSlice]);
+	return type;
+}
+
+bool SoftSliceDecoder::ReadMbSkip( void )
+{
+	int inc = (m_MbA && !(m_MbA->Type & SOFT_MB_SKIP)) + (m_MbB && !(m_MbB->Type & SOFT_MB_SKIP));
+	int base = (m_SliceType == SLICE_TYPE_B) ? 24 : 11;
+	return m_Cabac.DecodeDecision(&m_Contexts[base + inc]) != 0;
+}
+
+int SoftSliceDecoder::ReadSubMbType( void )
+{
+	if (!m_IsCabac)
+	{
+		unsigned int type = m_Reader.ReadUE();
+		return type > 12 ? -1 : (int)type;
+	}
+
+	unsigned char* ctx = m_Contexts;
+	if (m_SliceType == SLICE_TYPE_P)
+	{
+		if (m_Cabac.DecodeDecision(&ctx[21]))
+			return 0;
+		if (!m_Cabac.DecodeDecision(&ctx[22]))
+			return 1;
+		return m_Cabac.DecodeDecision(&ctx[23]) ? 2 : 3;
+	}
+
+	if (!m_Cabac.DecodeDecision(&ctx[36]))
+		return 0;
+	if (!m_Cabac.DecodeDecision(&ctx[37]))
+		return 1 + m_Cabac.DecodeDecision(&ctx[39]);
+	int type = 3;
+	if (m_Cabac.DecodeDecision(&ctx[38]))
+	{
+		if (m_Cabac.DecodeDecision(&ctx[39]))
+			return 11 + m_Cabac.DecodeDecision(&ctx[39]);
+		type += 4;
+	}
+	type += 2 * m_Cabac.DecodeDecision(&ctx[39]);
+	type += m_Cabac.DecodeDecision(&ctx[39]);
+	return type;
+}
+
+// -1 for the predicted mode, otherwise rem_intra4x4_pred_mode
+int SoftSliceDecoder::ReadIntraPredMode( void )
+{
+	if (!m_IsCabac)
+	{
+		if (m_Reader.ReadBit())
+			return -1;
+		return (int)m_Reader.ReadBits(3);
+	}
+
+	if (m_Cabac.DecodeDecision(&m_Contexts[68]))
+		return -1;
+	int mode = m_Cabac.DecodeDecision(&m_Contexts[69]);
+	mode |= m_Cabac.DecodeDecision(&m_Contexts[69]) << 1;
+	mode |= m_Cabac.DecodeDecision(&m_Contexts[69]) << 2;
+	return mode;
+}
+
+int SoftSliceDecoder::ReadChromaPredMode( void )
+{
+	if (!m_IsCabac)
+	{
+		unsigned int mode = m_Reader.ReadUE();
+		return mode > 3 ? -1 : (int)mode;
+	}
+
+	int inc = (m_MbA && m_MbA->ChromaPredMode != 0) + (m_MbB && m_MbB->ChromaPredMode != 0);
+	if (!m_Cabac.DecodeDecision(&m_Contexts[64 + inc]))
+		return 0;
+	if (!m_Cabac.DecodeDecision(&m_Contexts[64 + 3]))
+		return 1;
+	return m_Cabac.DecodeDecision(&m_Contexts[64 + 3]) ? 3 : 2;
+}
+
+int SoftSliceDecoder::ReadCbp( bool inIntra )
+{
+	if (!m_IsCabac)
+	{
+		unsigned int code = m_Reader.ReadUE();
+		if (code > 47)
+			return -1;
+		return inIntra ? SoftIntraCbp[code] : SoftInterCbp[code];
+	}
+
+	// Neighbours outside the slice count as coded for luma, not for chroma
+	int left = m_MbA ? m_MbA->Cbp : 0x0f;
+	int top = m_MbB ? m_MbB->Cbp : 0x0f;
+	unsigned char* ctx = m_Contexts + 73;
+	int cbp = 0;
+	cbp |= m_Cabac.DecodeDecision(&ctx[!(left & 0x02) + 2 * !(top & 0x04)]);
+	cbp |= m_Cabac.DecodeDecision(&ctx[!(cbp & 0x01) + 2 * !(top & 0x08)]) << 1;
+	cbp |= m_Cabac.DecodeDecision(&ctx[!(left & 0x08) + 2 * !(cbp & 0x01)]) << 2;
+	cbp |= m_Cabac.DecodeDecision(&ctx[!(cbp & 0x04) + 2 * !(cbp & 0x02)]) << 3;
+
+	int chromaA = m_MbA ? (m_MbA->Cbp >> 4) : 0;
+	int chromaB = m_MbB ? (m_MbB->Cbp >> 4) : 0;
+	ctx = m_Contexts + 77;
+	if (!m_Cabac.DecodeDecision(&ctx[(chromaA > 0) + 2 * (chromaB > 0)]))
+		return cbp;
+	if (!m_Cabac.DecodeDecision(&ctx[4 + (chromaA == 2) + 2 * (chromaB == 2)]))
+		return cbp | 0x10;
+	return cbp | 0x20;
+}
+
+int SoftSliceDecoder::ReadQpDelta( void )
+{
+	if (!m_IsCabac)
+		return m_Reader.ReadSE();
+
+	unsigned char* ctx = m_Contexts + 60;
+	if (!m_Cabac.DecodeDecision(&ctx[m_LastQpDelta ? 1 : 0]))
+		return 0;
+	int value = 1;
+	if (m_Cabac.DecodeDecision(&ctx[2]))
+	{
+		value++;
+		while (m_Cabac.DecodeDecision(&ctx[3]))
+		{
+			if (++value > 52)
+				return 100;
+		}
+	}
+	return (value & 1) ? (value + 1) / 2 : -(value / 2);
+}
+
+int SoftSliceDecoder::ReadRefIdx( int inList, int inX, int inY )
+{
+	if (!m_IsCabac)
+	{
+		if (m_Header->NumRefIdxActive[inList] == 2)
+			return !m_Reader.ReadBit();
+		unsigned int ref = m_Reader.ReadUE();
+		return ref >= SOFT_MAX_REFS ? -1 : (int)ref;
+	}
+
+	// Neighbours in direct mode count as reference 0
+	int left = CACHE(inX - 1, inY);
+	int top = CACHE(inX, inY - 1);
+	const signed char* refs = m_RefCache[inList];
+	int inc = 0;
+	if (refs[left] > 0 && !(m_SliceType == SLICE_TYPE_B && m_DirectCache[left]))
+		inc++;
+	if (refs[top] > 0 && !(m_SliceType == SLICE_TYPE_B && m_DirectCache[top]))
+		inc += 2;
+
+	unsigned char* ctx = m_Contexts + 54;
+	int ref = 0;
+	while (m_Cabac.DecodeDecision(&ctx[inc]))
+	{
+		inc = (inc < 4) ? 4 : 5;
+		if (++ref >= SOFT_MAX_REFS)
+			return -1;
+	}
+	return ref;
+}
+
+int SoftSliceDecoder::ReadMvd( int inList, int inComponent, int inX, int inY )
+{
+	if (!m_IsCabac)
+		return m_Reader.ReadSE();
+
+	int sum = m_MvdCache[inList][CACHE(inX - 1, inY)][inComponent] + m_MvdCache[inList][CACHE(inX, inY - 1)][inComponent];
+	unsigned char* ctx = m_Contexts + (inComponent ? 47 : 40);
+	if (!m_Cabac.DecodeDecision(&ctx[sum < 3 ? 0 : (sum > 32 ? 2 : 1)]))
+		return 0;
+
+	// Truncated unary prefix up to 9, then a 3rd order Exp-Golomb suffix
+	int value = 1;
+	int inc = 3;
+	while (value < 9 && m_Cabac.DecodeDecision(&ctx[inc]))
+	{
+		value++;
+		if (inc < 6)
+			inc++;
+	}
+	if (value >= 9)
+	{
+		int k = 3;
+		while (m_Cabac.DecodeBypass())
+		{
+			value += 1 << k;
+			if (++k > 24)
+				return 0;
+		}
+		while (k--)
+			value += m_Cabac.DecodeBypass() << k;
+	}
+	return m_Cabac.DecodeBypass() ? -value : value;
+}
+
+//------------------------------------------------------------------------------
+// Residual
+
+// Coefficients of a neighbouring 4x4 block, -1 outside the slice. inIndex
+// is a luma block in raster order or 16 + 4 * plane + chroma block.
+int SoftSliceDecoder::GetNonZeroNeighbour( int inIndex, bool inLeft )
+{
+	int x, y, base, width;
+	if (inIndex < 16)
+	{
+		x = inIndex & 3;
+		y = inIndex >> 2;
+		base = 0;
+		width = 4;
+	}
+	else
+	{
+		x = (inIndex - 16) & 1;
+		y = ((inIndex - 16) >> 1) & 1;
+		base = inIndex & ~3;
+		width = 2;
+	}
+
+	if (inLeft)
+	{
+		if (x > 0)
+			return m_Mb->NonZero[base + y * width + x - 1];
+		return m_MbA ? m_MbA->NonZero[base + y * width + width - 1] : -1;
+	}
+	if (y > 0)
+		return m_Mb->NonZero[base + (y - 1) * width + x];
+	return m_MbB ? m_MbB->NonZero[base + (width - 1) * width + x] : -1;
+}
+
+// ctxIdx of coded_block_flag (9.3.3.1.1.9)
+int SoftSliceDecoder::GetCodedBlockCtx( int inCat, int inIndex )
+{
+	static const unsigned char catOffset[5] = { 0, 4, 8, 12, 16 };
+	int intra = (m_Mb->Type & SOFT_MB_INTRA) ? 1 : 0;
+	int condA, condB;
+	if (inCat == CAT_LUMA_DC || inCat == CAT_CHROMA_DC)
+	{
+		int bit = (inCat == CAT_LUMA_DC) ? 1 : (2 << inIndex);
+		condA = m_MbA ? ((m_MbA->DcCoded & bit) != 0) : intra;
+		condB = m_MbB ? ((m_MbB->DcCoded & bit) != 0) : intra;
+	}
+	else
+	{
+		int left = this->GetNonZeroNeighbour(inIndex, true);
+		int top = this->GetNonZeroNeighbour(inIndex, false);
+		condA = (left < 0) ? intra : (left > 0);
+		condB = (top < 0) ? intra : (top > 0);
+	}
+	return 85 + catOffset[inCat] + condA + 2 * condB;
+}
+
+// Levels of a block in scan order; the number of them not 0, -1 on error.
+// inIndex is what GetNonZeroNeighbour takes, or the plane for chroma DC.
+int SoftSliceDecoder::ReadResidualBlock( int inCat, int inIndex, short* outLevels, int inMaxCoeff )
+{
+	if (m_IsCabac)
+		return this->ReadCabacBlock(inCat, inIndex, outLevels, inMaxCoeff);
+
+	int nc = -1;
+	if (inCat != CAT_CHROMA_DC)
+	{
+		int left = this->GetNonZeroNeighbour(inIndex, true);
+		int top = this->GetNonZeroNeighbour(inIndex, false);
+		if (left >= 0 && top >= 0)
+			nc = (left + top + 1) >> 1;
+		else
+			nc = (left >= 0) ? left : (top >= 0 ? top : 0);
+	}
+	return this->ReadCavlcBlock(nc, outLevels, inMaxCoeff);
+}
+
+// 9.2, nC of -1 for chroma DC
+int SoftSliceDecoder::ReadCavlcBlock( int inNc, short* outLevels, int inMaxCoeff )
+{
+	const SoftVlc* table;
+	if (inNc < 0)
+		table = &m_Tables->ChromaDcCoeffToken;
+	else
+		table = &m_Tables->CoeffToken[inNc < 2 ? 0 : (inNc < 4 ? 1 : (inNc < 8 ? 2 : 3))];
+	int token = table->Decode(&m_Reader);
+	if (token < 0)
+		return -1;
+	int total = token >> 2;
+	int trailingOnes = token & 3;
+	if (total == 0)
+		return 0;
+	if (total > inMaxCoeff)
+		return -1;
+
+	int levels[16];
+	int suffixLength = (total > 10 && trailingOnes < 3) ? 1 : 0;
+	for (int i = 0; i < total; i++)
+	{
+		if (i < trailingOnes)
+		{
+			levels[i] = m_Reader.ReadBit() ? -1 : 1;
+			continue;
+		}
+
+		int prefix = 0;
+		while (!m_Reader.ReadBit())
+		{
+			if (++prefix > 32)
+				return -1;
+		}
+		int levelCode = (prefix < 15 ? prefix : 15) << suffixLength;
+		int size = suffixLength;
+		if (prefix == 14 && suffixLength == 0)
+			size = 4;
+		else if (prefix >= 15)
+			size = prefix - 3;
+		if (size > 0)
+			levelCode += (int)m_Reader.ReadBits(size);
+		if (prefix >= 15 && suffixLength == 0)
+			levelCode += 15;
+		if (prefix >= 16)
+			levelCode += (1 << (prefix - 3)) - 4096;
+		if (i == trailingOnes && trailingOnes < 3)
+			levelCode += 2;
+		levels[i] = (levelCode & 1) ? (-levelCode - 1) >> 1 : (levelCode + 2) >> 1;
+
+		if (suffixLength == 0)
+			suffixLength = 1;
+		if (abs(levels[i]) > (3 << (suffixLength - 1)) && suffixLength < 6)
+			suffixLength++;
+	}
+
+	int zeros = 0;
+	if (total < inMaxCoeff)
+	{
+		if (inNc < 0)
+			zeros = m_Tables->ChromaDcTotalZeros[total - 1].Decode(&m_Reader);
+		else
+			zeros = m_Tables->TotalZeros[total - 1].Decode(&m_Reader);
+		if (zeros < 0 || total + zeros > inMaxCoeff)
+			return -1;
+	}
+
+	// Highest frequency first
+	int position = total + zeros - 1;
+	for (int i = 0; i < total; i++)
+	{
+		outLevels[position] = (short)levels[i];
+		if (i == total - 1)
+			break;
+		int run = 0;
+		if (zeros > 0)
+		{
+			run = m_Tables->Run[(zeros < 7 ? zeros : 7) - 1].Decode(&m_Reader);
+			if (run < 0 || run > zeros)
+				return -1;
+			zeros -= run;
+		}
+		position -= 1 + run;
+	}
+	return total;
+}
+
+// 7.3.5.3.3 with the contexts of 9.3.3.1.3
+int SoftSliceDecoder::ReadCabacBlock( int inCat, int inIndex, short* outLevels, int inMaxCoeff )
+{
+	static const unsigned char sigOffset[5] = { 0, 15, 29, 44, 47 };
+	static const unsigned char absOffset[5] = { 0, 10, 20, 30, 39 };
+
+	if (!m_Cabac.DecodeDecision(&m_Contexts[this->GetCodedBlockCtx(inCat, inIndex)]))
+		return 0;
+
+	unsigned char* significant = m_Contexts + 105 + sigOffset[inCat];
+	unsigned char* last = m_Contexts + 166 + sigOffset[inCat];
+	int positions[16];
+	int count = 0;
+	int i = 0;
+	for (; i < inMaxCoeff - 1; i++)
+	{
+		int inc = (inCat == CAT_CHROMA_DC) ? (i < 2 ? i : 2) : i;
+		if (m_Cabac.DecodeDecision(&significant[inc]))
+		{
+			positions[count++] = i;
+			if (m_Cabac.DecodeDecision(&last[inc]))
+				break;
+		}
+	}
+	if (i == inMaxCoeff - 1)
+		positions[count++] = i;
+
+	unsigned char* level = m_Contexts + 227 + absOffset[inCat];
+	int greaterMax = (inCat == CAT_CHROMA_DC) ? 3 : 4;
+	int equalOne = 0;
+	int greaterOne = 0;
+	for (int k = count - 1; k >= 0; k--)
+	{
+		int value;
+		if (!m_Cabac.DecodeDecision(&level[greaterOne ? 0 : (equalOne < 3 ? 1 + equalOne : 4)]))
+		{
+			value = 1;
+			equalOne++;
+		}
+		else
+		{
+			unsigned char* ctx = &level[5 + (greaterOne < greaterMax ? greaterOne : greaterMax)];
+			value = 2;
+			while (value < 15 && m_Cabac.DecodeDecision(ctx))
+				value++;
+			if (value >= 15)
+			{
+				int k2 = 0;
+				while (m_Cabac.DecodeBypass())
+				{
+					if (++k2 > 24)
+						return -1;
+				}
+				int suffix = 1;
+				while (k2--)
+					suffix = (suffix << 1) | m_Cabac.DecodeBypass();
+				value = suffix + 14;
+			}
+			greaterOne++;
+		}
+		outLevels[positions[k]] = (short)(m_Cabac.DecodeBypass() ? -value : value);
+	}
+	return count;
+}
+
+// The inverse transform of the luma DC (8.5.10) into the blocks
+void SoftSliceDecoder::DecodeLumaDc( const short* inLevels, int inQp )
+{
+	int c[16];
+	int f[16];
+	for (int i = 0; i < 16; i++)
+		c[kZigzag[i]] = inLevels[i];
+
+	for (int y = 0; y < 4; y++)
+	{
+		int* row = c + y * 4;
+		int a = row[0] + row[1], b = row[0] - row[1];
+		int d = row[2] + row[3], e = row[2] - row[3];
+		f[y * 4 + 0] = a + d;
+		f[y * 4 + 1] = a - d;
+		f[y * 4 + 2] = b - e;
+		f[y * 4 + 3] = b + e;
+	}
+	// The columns, then the scaling
+	int scale = 16 * kLevelScale[inQp % 6][0];
+	int shift = inQp / 6;
+	for (int x = 0; x < 4; x++)
+	{
+		int a = f[x] + f[4 + x], b = f[x] - f[4 + x];
+		int d = f[8 + x] + f[12 + x], e = f[8 + x] - f[12 + x];
+		int column[4] = { a + d, a - d, b - e, b + e };
+		for (int y = 0; y < 4; y++)
+		{
+			int value = column[y] * scale;
+			if (shift >= 6)
+				value *= 1 << (shift - 6);
+			else
+				value = (value + (1 << (5 - shift))) >> (6 - shift);
+			int block = y * 4 + x;
+			m_Coeffs[block][0] = (short)value;
+			if (value)
+				m_CodedBlocks |= 1 << block;
+		}
+	}
+}
+
+// The chroma DC of a plane (8.5.11)
+void SoftSliceDecoder::DecodeChromaDc( const short* inLevels, int inPlane )
+{
+	int qp = m_Mb->QpC[inPlane];
+	int scale = 16 * kLevelScale[qp % 6][0];
+	int c0 = inLevels[0], c1 = inLevels[1], c2 = inLevels[2], c3 = inLevels[3];
+	int f[4] = { c0 + c1 + c2 + c3, c0 - c1 + c2 - c3, c0 + c1 - c2 - c3, c0 - c1 - c2 + c3 };
+	for (int i = 0; i < 4; i++)
+	{
+		int value = (f[i] * scale * (1 << (qp / 6))) >> 5;
+		int block = 16 + inPlane * 4 + i;
+		m_Coeffs[block][0] = (short)value;
+		if (value)
+			m_CodedBlocks |= 1 << block;
+	}
+}
+
+// Scales the AC levels of a block in scan order, from inStart
+void SoftSliceDecoder::ScaleBlock( int inBlock, const short* inLevels, int inStart, int inQp )
+{
+	const unsigned char* scale = kLevelScale[inQp % 6];
+	int shift = inQp / 6;
+	short* coeffs = m_Coeffs[inBlock];
+	for (int i = inStart; i < 16; i++)
+	{
+		int level = inLevels[i - inStart];
+		if (level == 0)
+			continue;
+		int position = kZigzag[i];
+		coeffs[position] = (short)(level * scale[kScaleClass[position]] * (1 << shift));
+	}
+	m_CodedBlocks |= 1 << inBlock;
+}
+
+bool SoftSliceDecoder::DecodeResidual( bool inIntra16x16 )
+{
+	short levels[16];
+	int cbp = m_Mb->Cbp;
+	int qp = m_Qp;
+
+	if (inIntra16x16)
+	{
+		memset(levels, 0, sizeof(levels));
+		int count = this->ReadResidualBlock(CAT_LUMA_DC, 0, levels, 16);
+		if (count < 0)
+			return false;
+		if (count > 0)
+		{
+			m_Mb->DcCoded |= 1;
+			this->DecodeLumaDc(levels, qp);
+		}
+	}
+
+	for (int i = 0; i < 16; i++)
+	{
+		if (!(cbp & (1 << (i >> 2))))
+			continue;
+		int block = kBlockToRaster[i];
+		memset(levels, 0, sizeof(levels));
+		int count = inIntra16x16 ? this->ReadResidualBlock(CAT_LUMA_AC, block, levels, 15)
+								 : this->ReadResidualBlock(CAT_LUMA_4x4, block, levels, 16);
+		if (count < 0)
+			return false;
+		m_Mb->NonZero[block] = (unsigned char)count;
+		if (count > 0)
+			this->ScaleBlock(block, levels, inIntra16x16 ? 1 : 0, qp);
+	}
+
+	if (cbp & 0x30)
+	{
+		for (int plane = 0; plane < 2; plane++)
+		{
+			memset(levels, 0, sizeof(levels));
+			int count = this->ReadResidualBlock(CAT_CHROMA_DC, plane, levels, 4);
+			if (count < 0)
+				return false;
+			if (count > 0)
+			{
+				m_Mb->DcCoded |= 2 << plane;
+				this->DecodeChromaDc(levels, plane);
+			}
+		}
+	}
+	if (cbp & 0x20)
+	{
+		for (int plane = 0; plane < 2; plane++)
+		{
+			for (int i = 0; i < 4; i++)
+			{
+				int block = 16 + plane * 4 + i;
+				memset(levels, 0, sizeof(levels));
+				int count = this->ReadResidualBlock(CAT_CHROMA_AC, block, levels, 15);
+				if (count < 0)
+					return false;
+				m_Mb->NonZero[block] = (unsigned char)count;
+				if (count > 0)
+					this->ScaleBlock(block, levels, 1, m_Mb->QpC[plane]);
+			}
+		}
+	}
+	return !(m_IsCabac ? m_Cabac.IsOverrun() : m_Reader.IsOverrun());
+}
+
+//------------------------------------------------------------------------------
+// Motion vectors (8.4.1)
+
+void SoftSliceDecoder::FillMotionCache( void )
+{
+	for (int list = 0; list < m_ListCount; list++)
+	{
+		signed char* refs = m_RefCache[list];
+		short (*mvs)[2] = m_MvCache[list];
+		memset(refs, REF_NOT_AVAILABLE, sizeof(m_RefCache[0]));
+		memset(mvs, 0, sizeof(m_MvCache[0]));
+		for (int i = 0; i < 4; i++)
+		{
+			if (m_MbB)
+			{
+				refs[CACHE(i, -1)] = m_MbB->Ref[list][2 + (i >> 1)];
+				mvs[CACHE(i, -1)][0] = m_MbB->Mv[list][12 + i][0];
+				mvs[CACHE(i, -1)][1] = m_MbB->Mv[list][12 + i][1];
+			}
+			if (m_MbA)
+			{
+				refs[CACHE(-1, i)] = m_MbA->Ref[list][(i >> 1) * 2 + 1];
+				mvs[CACHE(-1, i)][0] = m_MbA->Mv[list][i * 4 + 3][0];
+				mvs[CACHE(-1, i)][1] = m_MbA->Mv[list][i * 4 + 3][1];
+			}
+		}
+		if (m_MbC)
+		{
+			refs[CACHE(4, -1)] = m_MbC->Ref[list][2];
+			mvs[CACHE(4, -1)][0] = m_MbC->Mv[list][12][0];
+			mvs[CACHE(4, -1)][1] = m_MbC->Mv[list][12][1];
+		}
+		if (m_MbD)
+		{
+			refs[CACHE(-1, -1)] = m_MbD->Ref[list][3];
+			mvs[CACHE(-1, -1)][0] = m_MbD->Mv[list][15][0];
+			mvs[CACHE(-1, -1)][1] = m_MbD->Mv[list][15][1];
+		}
+	}
+}
+
+// 8.4.1.3 for the partition at block (inX, inY) inWidth blocks wide.
+// inShape: 0, the upper and lower 16x8, the left and right 8x16.
+void SoftSliceDecoder::PredictMv( int inList, int inRef, int inX, int inY, int inWidth, int inShape, short* outMv )
+{
+	const signed char* refs = m_RefCache[inList];
+	const short (*mvs)[2] = m_MvCache[inList];
+	int a = CACHE(inX - 1, inY);
+	int b = CACHE(inX, inY - 1);
+	int c = CACHE(inX + inWidth, inY - 1);
+	if (refs[c] == REF_NOT_AVAILABLE)
+		c = CACHE(inX - 1, inY - 1);
+
+	int directional = -1;
+	if (inShape == 1 && refs[b] == inRef)
+		directional = b;
+	else if ((inShape == 2 || inShape == 3) && refs[a] == inRef)
+		directional = a;
+	else if (inShape == 4 && refs[c] == inRef)
+		directional = c;
+	if (directional >= 0)
+	{
+		outMv[0] = mvs[directional][0];
+		outMv[1] = mvs[directional][1];
+		return;
+	}
+
+	if (refs[b] == REF_NOT_AVAILABLE && refs[c] == REF_NOT_AVAILABLE && refs[a] != REF_NOT_AVAILABLE)
+	{
+		outMv[0] = mvs[a][0];
+		outMv[1] = mvs[a][1];
+		return;
+	}
+	int match = (refs[a] == inRef) + (refs[b] == inRef) + (refs[c] == inRef);
+	if (match == 1)
+	{
+		int only = (refs[a] == inRef) ? a : (refs[b] == inRef ? b : c);
+		outMv[0] = mvs[only][0];
+		outMv[1] = mvs[only][1];
+		return;
+	}
+	outMv[0] = (short)Median(mvs[a][0], mvs[b][0], mvs[c][0]);
+	outMv[1] = (short)Median(mvs[a][1], mvs[b][1], mvs[c][1]);
+}
+
+// 8.4.1.1
+void SoftSliceDecoder::PredictSkipMv( short* outMv )
+{
+	const signed char* refs = m_RefCache[0];
+	const short (*mvs)[2] = m_MvCache[0];
+	int a = CACHE(-1, 0);
+	int b = CACHE(0, -1);
+	if (refs[a] == REF_NOT_AVAILABLE || refs[b] == REF_NOT_AVAILABLE ||
+		(refs[a] == 0 && mvs[a][0] == 0 && mvs[a][1] == 0) ||
+		(refs[b] == 0 && mvs[b][0] == 0 && mvs[b][1] == 0))
+	{
+		outMv[0] = outMv[1] = 0;
+		return;
+	}
+	this->PredictMv(0, 0, 0, 0, 4, 0, outMv);
+}
+
+void SoftSliceDecoder::PredictDirect( int inMask )
+{
+	if (m_Header->DirectSpatialMvPred)
+		this->PredictSpatialDirect(inMask);
+	else
+		this->PredictTemporalDirect(inMask);
+}
+
+// The block of the co-located macroblock a 4x4 block takes its motion from
+static inline int ColocatedBlock( int inBlock, bool inDirect8x8Inference )
+{
+	if (!inDirect8x8Inference)
+		return inBlock;
+	// The corner of its 8x8 block
+	return ((inBlock >> 3) * 3) * 4 + ((inBlock & 3) >> 1) * 3;
+}
+
+// 8.4.1.2.2
+void SoftSliceDecoder::PredictSpatialDirect( int inMask )
+{
+	int refs[2];
+	short mvp[2][2];
+	for (int list = 0; list < 2; list++)
+	{
+		const signed char* cache = m_RefCache[list];
+		int c = cache[CACHE(4, -1)];
+		if (c == REF_NOT_AVAILABLE)
+			c = cache[CACHE(-1, -1)];
+		refs[list] = MinPositive(cache[CACHE(-1, 0)], MinPositive(cache[CACHE(0, -1)], c));
+	}
+
+	bool directZero = (refs[0] < 0 && refs[1] < 0);
+	for (int list = 0; list < 2; list++)
+	{
+		mvp[list][0] = mvp[list][1] = 0;
+		if (directZero)
+			refs[list] = 0;
+		else if (refs[list] >= 0)
+			this->PredictMv(list, refs[list], 0, 0, 4, 0, mvp[list]);
+	}
+
+	// colZeroFlag needs the co-located motion
+	const SoftMb* col = NULL;
+	if (!directZero && m_Task->ColShortTerm && (refs[0] == 0 || refs[1] == 0))
+	{
+		SoftPicture* colPicture = m_Task->RefList[1][0];
+		colPicture->WaitProgress(m_MbY + 1, m_Wake);
+		col = &colPicture->Mbs[m_Address];
+		if (col->Type & (SOFT_MB_INTRA | SOFT_MB_CONCEALED))
+			col = NULL;
+	}
+
+	for (int i = 0; i < 16; i++)
+	{
+		int block = kBlockToRaster[i];
+		if (!(inMask & (1 << (i >> 2))))
+			continue;
+
+		bool colZero = false;
+		if (col)
+		{
+			int colBlock = ColocatedBlock(block, m_Task->Direct8x8Inference != 0);
+			int part = (colBlock >> 3) * 2 + ((colBlock & 3) >> 1);
+			int colList = (col->Ref[0][part] >= 0) ? 0 : 1;
+			const short* colMv = col->Mv[colList][colBlock];
+			colZero = (col->Ref[colList][part] == 0 && colMv[0] >= -1 && colMv[0] <= 1 && colMv[1] >= -1 && colMv[1] <= 1);
+		}
+
+		int pos = CACHE(block & 3, block >> 2);
+		for (int list = 0; list < 2; list++)
+		{
+			m_RefCache[list][pos] = (signed char)refs[list];
+			bool zero = refs[list] < 0 || (refs[list] == 0 && colZero);
+			m_MvCache[list][pos][0] = zero ? 0 : mvp[list][0];
+			m_MvCache[list][pos][1] = zero ? 0 : mvp[list][1];
+		}
+	}
+}
+
+// 8.4.1.2.3
+void SoftSliceDecoder::PredictTemporalDirect( int inMask )
+{
+	SoftPicture* colPicture = m_Task->RefList[1][0];
+	colPicture->WaitProgress(m_MbY + 1, m_Wake);
+	const SoftMb* col = &colPicture->Mbs[m_Address];
+	bool colIntra = (col->Type & (SOFT_MB_INTRA | SOFT_MB_CONCEALED)) != 0;
+
+	for (int i = 0; i < 16; i++)
+	{
+		int block = kBlockToRaster[i];
+		if (!(inMask & (1 << (i >> 2))))
+			continue;
+
+		int refL0 = 0;
+		short colMv[2] = { 0, 0 };
+		if (!colIntra)
+		{
+			int colBlock = ColocatedBlock(block, m_Task->Direct8x8Inference != 0);
+			int part = (colBlock >> 3) * 2 + ((colBlock & 3) >> 1);
+			int colList = (col->Ref[0][part] >= 0) ? 0 : 1;
+			int colRef = col->Ref[colList][part];
+			if (colRef >= 0)
+			{
+				colMv[0] = col->Mv[colList][colBlock][0];
+				colMv[1] = col->Mv[colList][colBlock][1];
+
+				// The lowest index of list 0 for the picture the co-located block used
+				long id = colPicture->GetSlice(col->Slice)->RefId[colList][colRef];
+				for (int ref = 0; ref < m_Header->NumRefIdxActive[0]; ref++)
+				{
+					if (m_Task->RefList[0][ref]->Id == id)
+					{
+						refL0 = ref;
+						break;
+					}
+				}
+			}
+		}
+
+		int scale = m_Task->DistScaleFactor[refL0];
+		int pos = CACHE(block & 3, block >> 2);
+		m_RefCache[0][pos] = (signed char)refL0;
+		m_RefCache[1][pos] = 0;
+		for (int c = 0; c < 2; c++)
+		{
+			int mv = (scale * colMv[c] + 128) >> 8;
+			m_MvCache[0][pos][c] = (short)mv;
+			m_MvCache[1][pos][c] = (short)(mv - colMv[c]);
+		}
+	}
+}
+
+void SoftSliceDecoder::FillMotion( int inList, int inX, int inY, int inWidth, int inHeight, int inRef, const short* inMv )
+{
+	for (int y = inY; y < inY + inHeight; y++)
+	{
+		for (int x = inX; x < inX + inWidth; x++)
+		{
+			int pos = CACHE(x, y);
+			m_RefCache[inList][pos] = (signed char)inRef;
+			m_MvCache[inList][pos][0] = inMv[0];
+			m_MvCache[inList][pos][1] = inMv[1];
+		}
+	}
+}
+
+void SoftSliceDecoder::SaveMotion( void )
+{
+	for (int list = 0; list < 2; list++)
+	{
+		if (list >= m_ListCount)
+		{
+			memset(m_Mb->Ref[list], -1, sizeof(m_Mb->Ref[list]));
+			memset(m_Mb->Mv[list], 0, sizeof(m_Mb->Mv[list]));
+			memset(m_Mb->Mvd[list], 0, sizeof(m_Mb->Mvd[list]));
+			continue;
+		}
+		for (int i = 0; i < 4; i++)
+			m_Mb->Ref[list][i] = m_RefCache[list][CACHE((i & 1) * 2, (i >> 1) * 2)];
+		for (int i = 0; i < 16; i++)
+		{
+			int pos = CACHE(i & 3, i >> 2);
+			m_Mb->Mv[list][i][0] = m_MvCache[list][pos][0];
+			m_Mb->Mv[list][i][1] = m_MvCache[list][pos][1];
+			if (m_IsCabac)
+			{
+				m_Mb->Mvd[list][i][0] = m_MvdCache[list][pos][0];
+				m_Mb->Mvd[list][i][1] = m_MvdCache[list][pos][1];
+			}
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+// Inter prediction (8.4.2)
+
+void SoftSliceDecoder::MotionCompensate( void )
+{
+	int type = m_Mb->Type;
+	if (type & SOFT_MB_16x16)
+	{
+		this->PredictBlock(0, 0, 4, 4);
+	}
+	else if (type & SOFT_MB_16x8)
+	{
+		this->PredictBlock(0, 0, 4, 2);
+		this->PredictBlock(0, 2, 4, 2);
+	}
+	else if (type & SOFT_MB_8x16)
+	{
+		this->PredictBlock(0, 0, 2, 4);
+		this->PredictBlock(2, 0, 2, 4);
+	}
+	else
+	{
+		// 8x8 partitions or direct; direct 8x8 blocks with the same motion
+		// predict as one
+		bool inference = (m_Task->Direct8x8Inference != 0);
+		if ((type & SOFT_MB_DIRECT) && inference)
+		{
+			bool same = true;
+			for (int list = 0; list < 2 && same; list++)
+			{
+				for (int i = 1; i < 4 && same; i++)
+				{
+					const short* mv = m_Mb->Mv[list][ColocatedBlock((i >> 1) * 8 + (i & 1) * 2, true)];
+					same = (m_Mb->Ref[list][i] == m_Mb->Ref[list][0] &&
+							mv[0] == m_Mb->Mv[list][0][0] && mv[1] == m_Mb->Mv[list][0][1]);
+				}
+			}
+			if (same)
+			{
+				this->PredictBlock(0, 0, 4, 4);
+				return;
+			}
+		}
+
+		for (int i = 0; i < 4; i++)
+		{
+			int x = (i & 1) * 2;
+			int y = (i >> 1) * 2;
+			int shape = (type & SOFT_MB_DIRECT) ? -1 : m_SubTypes[i];
+			if (shape < 0)
+				shape = inference ? 0 : 3;
+			switch (shape)
+			{
+			case 0:
+				this->PredictBlock(x, y, 2, 2);
+				break;
+			case 1:
+				this->PredictBlock(x, y, 2, 1);
+				this->PredictBlock(x, y + 1, 2, 1);
+				break;
+			case 2:
+				this->PredictBlock(x, y, 1, 2);
+				this->PredictBlock(x + 1, y, 1, 2);
+				break;
+			default:
+				this->PredictBlock(x, y, 1, 1);
+				this->PredictBlock(x + 1, y, 1, 1);
+				this->PredictBlock(x, y + 1, 1, 1);
+				this->PredictBlock(x + 1, y + 1, 1, 1);
+				break;
+			}
+		}
+	}
+}
+
+// The partition of inWidth x inHeight blocks at block (inX, inY), with
+// the weighted prediction of the slice
+void SoftSliceDecoder::PredictBlock( int inX, int inY, int inWidth, int inHeight )
+{
+	int lumaStride = m_Picture->LumaStride;
+	int chromaStride = m_Picture->ChromaStride;
+	unsigned char* luma = m_Dst[0] + inY * 4 * lumaStride + inX * 4;
+	unsigned char* cb = m_Dst[1] + inY * 2 * chromaStride + inX * 2;
+	unsigned char* cr = m_Dst[2] + inY * 2 * chromaStride + inX * 2;
+	int part = (inY >> 1) * 2 + (inX >> 1);
+	int block = inY * 4 + inX;
+	int ref0 = m_Mb->Ref[0][part];
+	int ref1 = m_Mb->Ref[1][part];
+	int width = inWidth * 4;
+	int height = inHeight * 4;
+
+	if (ref0 >= 0)
+		this->PredictFromRef(m_Task->RefList[0][ref0], m_Mb->Mv[0][block], inX * 4, inY * 4, width, height,
+							 luma, cb, cr, lumaStride, chromaStride);
+	if (ref1 >= 0)
+	{
+		if (ref0 < 0)
+			this->PredictFromRef(m_Task->RefList[1][ref1], m_Mb->Mv[1][block], inX * 4, inY * 4, width, height,
+								 luma, cb, cr, lumaStride, chromaStride);
+		else
+			this->PredictFromRef(m_Task->RefList[1][ref1], m_Mb->Mv[1][block], inX * 4, inY * 4, width, height,
+								 m_PredLuma, m_PredChroma[0], m_PredChroma[1], 16, 8);
+	}
+
+	const SoftSliceHeader* header = m_Header;
+	if (ref0 >= 0 && ref1 >= 0)
+	{
+		if (m_WeightMode == 2)
+		{
+			int weight1 = m_Task->ImplicitWeight[ref0][ref1];
+			SoftBiWeight(luma, lumaStride, m_PredLuma, 16, width, height, 5, 64 - weight1, weight1, 0);
+			SoftBiWeight(cb, chromaStride, m_PredChroma[0], 8, width / 2, height / 2, 5, 64 - weight1, weight1, 0);
+			SoftBiWeight(cr, chromaStride, m_PredChroma[1], 8, width / 2, height / 2, 5, 64 - weight1, weight1, 0);
+		}
+		else if (m_WeightMode == 1 && (header->HasWeight[0][ref0] || header->HasWeight[1][ref1]))
+		{
+			SoftBiWeight(luma, lumaStride, m_PredLuma, 16, width, height, header->LumaLog2Denom,
+						 header->LumaWeight[0][ref0], header->LumaWeight[1][ref1],
+						 (header->LumaOffset[0][ref0] + header->LumaOffset[1][ref1] + 1) >> 1);
+			for (int c = 0; c < 2; c++)
+			{
+				SoftBiWeight(c ? cr : cb, chromaStride, m_PredChroma[c], 8, width / 2, height / 2, header->ChromaLog2Denom,
+							 header->ChromaWeight[0][ref0][c], header->ChromaWeight[1][ref1][c],
+							 (header->ChromaOffset[0][ref0][c] + header->ChromaOffset[1][ref1][c] + 1) >> 1);
+			}
+		}
+		else
+		{
+			SoftAverage(luma, lumaStride, m_PredLuma, 16, width, height);
+			SoftAverage(cb, chromaStride, m_PredChroma[0], 8, width / 2, height / 2);
+			SoftAverage(cr, chromaStride, m_PredChroma[1], 8, width / 2, height / 2);
+		}
+		return;
+	}
+
+	int list = (ref0 >= 0) ? 0 : 1;
+	int ref = (ref0 >= 0) ? ref0 : ref1;
+	if (m_WeightMode == 1 && ref >= 0 && header->HasWeight[list][ref])
+	{
+		SoftWeight(luma, lumaStride, width, height, header->LumaLog2Denom,
+				   header->LumaWeight[list][ref], header->LumaOffset[list][ref]);
+		for (int c = 0; c < 2; c++)
+		{
+			SoftWeight(c ? cr : cb, chromaStride, width / 2, height / 2, header->ChromaLog2Denom,
+					   header->ChromaWeight[list][ref][c], header->ChromaOffset[list][ref][c]);
+		}
+	}
+}
+
+// Copies the region of a plane around a block, clamped to the plane
+static void EmulateEdge( unsigned char* outBuffer, int inBufferStride, const unsigned char* inPlane, int inStride,
+						 int inPlaneWidth, int inPlaneHeight, int inX, int inY, int inWidth, int inHeight )
+{
+	for (int y = 0; y < inHeight; y++)
+	{
+		const unsigned char* row = inPlane + (long)Clip(0, inPlaneHeight - 1, inY + y) * inStride;
+		for (int x = 0; x < inWidth; x++)
+			outBuffer[y * inBufferStride + x] = row[Clip(0, inPlaneWidth - 1, inX + x)];
+	}
+}
+
+void SoftSliceDecoder::PredictFromRef( SoftPicture* inRef, const short* inMv, int inX, int inY, int inWidth, int inHeight,
+									   unsigned char* outLuma, unsigned char* outCb, unsigned char* outCr,
+									   int inLumaStride, int inChromaStride )
+{
+	int planeWidth = m_MbWidth * 16;
+	int planeHeight = m_MbHeight * 16;
+	int x = m_MbX * 16 + inX + (inMv[0] >> 2);
+	int y = m_MbY * 16 + inY + (inMv[1] >> 2);
+
+	// The rows read, up to 3 below the block, must be final
+	int bottom = y + inHeight + 3;
+	inRef->WaitProgress(bottom < 0 ? 1 : (bottom >> 4) + 1, m_Wake);
+
+	int stride = inRef->LumaStride;
+	const unsigned char* src;
+	int srcStride;
+	if (x < 2 || y < 2 || x + inWidth + 3 > planeWidth || y + inHeight + 3 > planeHeight)
+	{
+		EmulateEdge(m_Edge, 24, inRef->Plane[0], stride, planeWidth, planeHeight, x - 2, y - 2, inWidth + 5, inHeight + 5);
+		src = m_Edge + 2 * 24 + 2;
+		srcStride = 24;
+	}
+	else
+	{
+		src = inRef->Plane[0] + (long)y * stride + x;
+		srcStride = stride;
+	}
+	SoftLumaMc(outLuma, inLumaStride, src, srcStride, inWidth, inHeight, inMv[0] & 3, inMv[1] & 3);
+
+	planeWidth >>= 1;
+	planeHeight >>= 1;
+	int width = inWidth >> 1;
+	int height = inHeight >> 1;
+	x = m_MbX * 8 + (inX >> 1) + (inMv[0] >> 3);
+	y = m_MbY * 8 + (inY >> 1) + (inMv[1] >> 3);
+	stride = inRef->ChromaStride;
+	bool emulate = (x < 0 || y < 0 || x + width + 1 > planeWidth || y + height + 1 > planeHeight);
+	for (int plane = 0; plane < 2; plane++)
+	{
+		if (emulate)
+		{
+			EmulateEdge(m_Edge, 24, inRef->Plane[1 + plane], stride, planeWidth, planeHeight, x, y, width + 1, height + 1);
+			src = m_Edge;
+			srcStride = 24;
+		}
+		else
+		{
+			src = inRef->Plane[1 + plane] + (long)y * stride + x;
+			srcStride = stride;
+		}
+		SoftChromaMc(plane ? outCr : outCb, inChromaStride, src, srcStride, width, height, inMv[0] & 7, inMv[1] & 7);
+	}
+}
+
+//------------------------------------------------------------------------------
+// Intra prediction (8.3) and the residual
+
+bool SoftSliceDecoder::IntraAvailable( const SoftMb* inMb ) const
+{
+	return inMb != NULL && (!m_Task->Pps.ConstrainedIntraPred || (inMb->Type & SOFT_MB_INTRA));
+}
+
+void SoftSliceDecoder::PredictIntra4x4( int inBlock, int inMode )
+{
+	int stride = m_Picture->LumaStride;
+	int bx = inBlock & 3;
+	int by = inBlock >> 2;
+	unsigned char* dst = m_Dst[0] + by * 4 * stride + bx * 4;
+
+	bool left = bx > 0 || this->IntraAvailable(m_MbA);
+	bool top = by > 0 || this->IntraAvailable(m_MbB);
+	bool topLeft = (bx > 0) ? (by > 0 || this->IntraAvailable(m_MbB))
+							: (by > 0 ? this->IntraAvailable(m_MbA) : this->IntraAvailable(m_MbD));
+	bool topRight;
+	if (by == 0)
+		topRight = (bx < 3) ? this->IntraAvailable(m_MbB) : this->IntraAvailable(m_MbC);
+	else
+		topRight = bx < 3 && !(bx == 1 && (by & 1));
+
+	// p[x, -1] for x from -1 to 7 and p[-1, y] for y from -1 to 3
+	int topRow[9], leftColumn[5];
+	for (int i = 0; i < 9; i++)
+		topRow[i] = 128;
+	for (int i = 0; i < 5; i++)
+		leftColumn[i] = 128;
+	if (top)
+	{
+		for (int i = 0; i < 4; i++)
+			topRow[1 + i] = dst[i - stride];
+		for (int i = 4; i < 8; i++)
+			topRow[1 + i] = topRight ? dst[i - stride] : topRow[4];
+	}
+	if (left)
+	{
+		for (int i = 0; i < 4; i++)
+			leftColumn[1 + i] = dst[i * stride - 1];
+	}
+	if (topLeft)
+		topRow[0] = leftColumn[0] = dst[-stride - 1];
+	const int* t = topRow + 1;
+	const int* l = leftColumn + 1;
+
+	int pred[4][4];
+	for (int y = 0; y < 4; y++)
+	{
+		for (int x = 0; x < 4; x++)
+		{
+			int value;
+			switch (inMode)
+			{
+			case 0:		// Vertical
+				value = t[x];
+				break;
+			case 1:		// Horizontal
+				value = l[y];
+				break;
+			case 3:		// Diagonal down left
+				if (x == 3 && y == 3)
+					value = (t[6] + 3 * t[7] + 2) >> 2;
+				else
+					value = (t[x + y] + 2 * t[x + y + 1] + t[x + y + 2] + 2) >> 2;
+				break;
+			case 4:		// Diagonal down right
+				if (x > y)
+					value = (t[x - y - 2] + 2 * t[x - y - 1] + t[x - y] + 2) >> 2;
+				else if (x < y)
+					value = (l[y - x - 2] + 2 * l[y - x - 1] + l[y - x] + 2) >> 2;
+				else
+					value = (t[0] + 2 * t[-1] + l[0] + 2) >> 2;
+				break;
+			case 5:		// Vertical right
+			{
+				int z = 2 * x - y;
+				int i = x - (y >> 1);
+				if (z >= 0 && !(z & 1))
+					value = (t[i - 1] + t[i] + 1) >> 1;
+				else if (z >= 0)
+					value = (t[i - 2] + 2 * t[i - 1] + t[i] + 2) >> 2;
+				else if (z == -1)
+					value = (l[0] + 2 * l[-1] + t[0] + 2) >> 2;
+				else
+					value = (l[y - 1] + 2 * l[y - 2] + l[y - 3] + 2) >> 2;
+				break;
+			}
+			case 6:		// Horizontal down
+			{
+				int z = 2 * y - x;
+				int i = y - (x >> 1);
+				if (z >= 0 && !(z & 1))
+					value = (l[i - 1] + l[i] + 1) >> 1;
+				else if (z >= 0)
+					value = (l[i - 2] + 2 * l[i - 1] + l[i] + 2) >> 2;
+				else if (z == -1)
+					value = (l[0] + 2 * l[-1] + t[0] + 2) >> 2;
+				else
+					value = (t[x - 1] + 2 * t[x - 2] + t[x - 3] + 2) >> 2;
+				break;
+			}
+			case 7:		// Vertical left
+			{
+				int i = x + (y >> 1);
+				if (y & 1)
+					value = (t[i] + 2 * t[i + 1] + t[i + 2] + 2) >> 2;
+				else
+					value = (t[i] + t[i + 1] + 1) >> 1;
+				break;
+			}
+			case 8:		// Horizontal up
+			{
+				int z = x + 2 * y;
+				int i = y + (x >> 1);
+				if (z > 5)
+					value = l[3];
+				else if (z == 5)
+					value = (l[2] + 3 * l[3] + 2) >> 2;
+				else if (z & 1)
+					value = (l[i] + 2 * l[i + 1] + l[i + 2] + 2) >> 2;
+				else
+					value = (l[i] + l[i + 1] + 1) >> 1;
+				break;
+			}
+			default:	// DC
+				if (top && left)
+					value = (t[0] + t[1] + t[2] + t[3] + l[0] + l[1] + l[2] + l[3] + 4) >> 3;
+				else if (left)
+					value = (l[0] + l[1] + l[2] + l[3] + 2) >> 2;
+				else if (top)
+					value = (t[0] + t[1] + t[2] + t[3] + 2) >> 2;
+				else
+					value = 128;
+				break;
+			}
+			pred[y][x] = value;
+		}
+	}
+	for (int y = 0; y < 4; y++)
+	{
+		for (int x = 0; x < 4; x++)
+			dst[y * stride + x] = (unsigned char)pred[y][x];
+	}
+}
+
+// Intra_16x16 and the chroma: vertical, horizontal, DC and plane of a
+// square of inSize samples. Chroma DC goes by 4x4 block.
+static void PredictSquare( unsigned char* ioDst, int inStride, int inSize, int inMode, bool inLeft, bool inTop )
+{
+	// A mode reading samples that are not there is an error in the stream:
+	// DC instead, which does without them
+	if ((inMode == 0 && !inTop) || (inMode == 1 && !inLeft) || (inMode == 3 && !(inTop && inLeft)))
+		inMode = 2;
+
+	const unsigned char* above = ioDst - inStride;
+	if (inMode == 0)
+	{
+		for (int y = 0; y < inSize; y++)
+			memcpy(ioDst + y * inStride, above, inSize);
+		return;
+	}
+	if (inMode == 1)
+	{
+		for (int y = 0; y < inSize; y++)
+			memset(ioDst + y * inStride, ioDst[y * inStride - 1], inSize);
+		return;
+	}
+	if (inMode == 3)
+	{
+		// Plane, 8.3.3.4 and 8.3.4.4
+		int half = inSize / 2;
+		int h = 0, v = 0;
+		for (int i = 0; i < half; i++)
+		{
+			int before = half - 2 - i;
+			h += (i + 1) * (above[half + i] - (before >= 0 ? above[before] : above[-1]));
+			v += (i + 1) * (ioDst[(half + i) * inStride - 1] - ioDst[(before >= 0 ? before * inStride : -inStride) - 1]);
+		}
+		int a = 16 * (ioDst[(inSize - 1) * inStride - 1] + above[inSize - 1]);
+		int b = (inSize == 16) ? (5 * h + 32) >> 6 : (34 * h + 32) >> 6;
+		int c = (inSize == 16) ? (5 * v + 32) >> 6 : (34 * v + 32) >> 6;
+		for (int y = 0; y < inSize; y++)
+		{
+			for (int x = 0; x < inSize; x++)
+				ioDst[y * inStride + x] = Clip255((a + b * (x - half + 1) + c * (y - half + 1) + 16) >> 5);
+		}
+		return;
+	}
+	if (inSize == 16)
+	{
+		int sum = 0;
+		int value = 128;
+		for (int i = 0; i < 16; i++)
+			sum += (inTop ? above[i] : 0) + (inLeft ? ioDst[i * inStride - 1] : 0);
+		if (inTop && inLeft)
+			value = (sum + 16) >> 5;
+		else if (inTop || inLeft)
+			value = (sum + 8) >> 4;
+		for (int y = 0; y < 16; y++)
+			memset(ioDst + y * inStride, value, 16);
+		return;
+	}
+
+	// Chroma DC: the corner blocks from both edges, the others from the
+	// top (upper right) or the left (lower left) first
+	for (int block = 0; block < 4; block++)
+	{
+		int bx = (block & 1) * 4;
+		int by = (block >> 1) * 4;
+		int sumTop = 0, sumLeft = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			sumTop += inTop ? above[bx + i] : 0;
+			sumLeft += inLeft ? ioDst[(by + i) * inStride - 1] : 0;
+		}
+		int value = 128;
+		if (bx == by)
+		{
+			if (inTop && inLeft)
+				value = (sumTop + sumLeft + 4) >> 3;
+			else if (inTop || inLeft)
+				value = (sumTop + sumLeft + 2) >> 2;
+		}
+		else if (bx > by)
+		{
+			if (inTop)
+				value = (sumTop + 2) >> 2;
+			else if (inLeft)
+				value = (sumLeft + 2) >> 2;
+		}
+		else
+		{
+			if (inLeft)
+				value = (sumLeft + 2) >> 2;
+			else if (inTop)
+				value = (sumTop + 2) >> 2;
+		}
+		for (int y = 0; y < 4; y++)
+			memset(ioDst + (by + y) * inStride + bx, value, 4);
+	}
+}
+
+void SoftSliceDecoder::PredictIntra16x16( int inMode )
+{
+	PredictSquare(m_Dst[0], m_Picture->LumaStride, 16, inMode, this->IntraAvailable(m_MbA), this->IntraAvailable(m_MbB));
+}
+
+// intra_chroma_pred_mode: DC, horizontal, vertical, plane
+void SoftSliceDecoder::PredictIntraChroma( int inMode )
+{
+	static const unsigned char modes[4] = { 2, 1, 0, 3 };
+	for (int plane = 0; plane < 2; plane++)
+	{
+		PredictSquare(m_Dst[1 + plane], m_Picture->ChromaStride, 8, modes[inMode], this->IntraAvailable(m_MbA),
+					  this->IntraAvailable(m_MbB));
+	}
+}
+
+void SoftSliceDecoder::AddLumaResidual( void )
+{
+	int stride = m_Picture->LumaStride;
+	for (int block = 0; block < 16; block++)
+	{
+		if (m_CodedBlocks & (1 << block))
+			SoftIdctAdd(m_Dst[0] + (block >> 2) * 4 * stride + (block & 3) * 4, stride, m_Coeffs[block]);
+	}
+}
+
+void SoftSliceDecoder::AddChromaResidual( void )
+{
+	int stride = m_Picture->ChromaStride;
+	for (int block = 16; block < 24; block++)
+	{
+		int i = block & 3;
+		if (m_CodedBlocks & (1 << block))
+			SoftIdctAdd(m_Dst[1 + ((block - 16) >> 2)] + (i >> 1) * 4 * stride + (i & 1) * 4, stride, m_Coeffs[block]);
+	}
+}
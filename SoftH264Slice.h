@@ -0,0 +1,224 @@
+//------------------------------------------------------------------------------
+// File: SoftH264Slice.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Decoding of the slice data of the software decoder: macroblock
+// parsing with CAVLC or CABAC, motion vector and direct prediction, intra
+// prediction, motion compensation and the residual. A SoftSliceTask is
+// all a slice needs, so slices of one or more pictures decode on as many
+// threads; a slice waits for the rows of its reference pictures it reads.
+//
+//------------------------------------------------------------------------------
+
+#ifndef SOFT_H264_SLICE_H_
+#define SOFT_H264_SLICE_H_
+
+#include "SoftH264Picture.h"
+#include "SoftH264Cabac.h"
+#include "BitReader.h"
+
+// A CAVLC code table, looked up in two steps of 8 bits
+class SoftVlc
+{
+public:
+
+	SoftVlc();
+	virtual ~SoftVlc();
+
+	// Symbol i has the code inCodes[i] of inLengths[i] bits, none if 0
+	void	Build(const unsigned char* inLengths, const unsigned char* inCodes, int inCount);
+
+	// The symbol, -1 if the bits are no code
+	int		Decode(BitReader* ioReader) const
+	{
+		unsigned int bits = ioReader->PeekBits(16);
+		const Entry* entry = &m_Table[bits >> 8];
+		if (entry->Bits < 0)
+			entry = &m_Table[entry->Symbol + (bits & 0xff)];
+		if (entry->Bits == 0)
+			return -1;
+		ioReader->SkipBits(entry->Bits);
+		return entry->Symbol;
+	}
+
+private:
+
+	typedef struct
+	{
+		short	Symbol;		// Or the start of the second table
+		short	Bits;		// Code length, -1 for a second table
+	} Entry;
+
+	Entry*	m_Table;
+	int		m_Size;
+};
+
+// The CAVLC tables, shared by the slice decoders
+typedef struct
+{
+	SoftVlc		CoeffToken[4];
+	SoftVlc		ChromaDcCoeffToken;
+	SoftVlc		TotalZeros[15];
+	SoftVlc		ChromaDcTotalZeros[3];
+	SoftVlc		Run[7];
+} SoftCavlcTables;
+
+void	SoftBuildCavlcTables(SoftCavlcTables* outTables);
+
+typedef struct SoftSliceTask
+{
+	SoftPicture*		Picture;
+	int					SliceIndex;			// In the picture
+	SoftSliceHeader		Header;
+	SoftPps				Pps;
+	int					Direct8x8Inference;
+
+	// The lists after modification, missing pictures replaced
+	SoftPicture*		RefList[2][SOFT_MAX_REFS];
+
+	// Temporal direct: DistScaleFactor of each list 0 index, 256 where the
+	// motion vector is taken as it is. Spatial direct: whether RefPicList1[0]
+	// is a short-term picture.
+	short				DistScaleFactor[SOFT_MAX_REFS];
+	bool				ColShortTerm;
+
+	// Implicit weights of list 1, those of list 0 being 64 minus them
+	short				ImplicitWeight[SOFT_MAX_REFS][SOFT_MAX_REFS];
+
+	// The RBSP after the NAL unit header
+	unsigned char*		Data;
+	long				Length;
+	long				Capacity;
+
+	struct SoftSliceTask*	Next;
+} SoftSliceTask;
+
+class SoftSliceDecoder
+{
+public:
+
+	SoftSliceDecoder(const SoftCavlcTables* inTables);
+	virtual ~SoftSliceDecoder();
+
+	// Decodes the macroblocks of the slice into its picture and reports
+	// each row to it. inWake is the semaphore of the calling thread, for
+	// waiting on reference pictures. False if the data ends or is invalid
+	// before the end of the slice; the macroblocks before stay decoded.
+	bool	Decode(SoftSliceTask* ioTask, PlatformSemaphore* inWake);
+
+private:
+
+	// Slice data
+	bool	DecodeCavlcSlice(void);
+	bool	DecodeCabacSlice(void);
+	bool	StartMb(int inAddress);
+	void	ReportMb(void);
+	bool	MoreRbspData(void);
+
+	// Macroblock layer
+	bool	DecodeMb(void);
+	bool	DecodeIntraMb(int inType);
+	bool	DecodeInterMb(int inType);
+	void	DecodeSkipMb(void);
+	bool	DecodePcmMb(void);
+	bool	DecodeResidual(bool inIntra16x16);
+	void	DecodeLumaDc(const short* inLevels, int inQp);
+	void	DecodeChromaDc(const short* inLevels, int inPlane);
+	void	ScaleBlock(int inBlock, const short* inLevels, int inStart, int inQp);
+	void	SetQp(int inQp);
+
+	// Syntax elements, CAVLC or CABAC
+	int		ReadMbType(void);
+	int		ReadIntraMbTypeCabac(int inBase, bool inIntraSlice);
+	bool	ReadMbSkip(void);
+	int		ReadSubMbType(void);
+	int		ReadIntraPredMode(void);
+	int		ReadChromaPredMode(void);
+	int		ReadCbp(bool inIntra);
+	int		ReadQpDelta(void);
+	int		ReadRefIdx(int inList, int inX, int inY);
+	int		ReadMvd(int inList, int inComponent, int inX, int inY);
+	int		ReadResidualBlock(int inCat, int inIndex, short* outLevels, int inMaxCoeff);
+	int		ReadCavlcBlock(int inNc, short* outLevels, int inMaxCoeff);
+	int		ReadCabacBlock(int inCat, int inIndex, short* outLevels, int inMaxCoeff);
+	int		GetCodedBlockCtx(int inCat, int inIndex);
+	int		GetNonZeroNeighbour(int inIndex, bool inLeft);
+
+	// Motion
+	void	FillMotionCache(void);
+	void	PredictMv(int inList, int inRef, int inX, int inY, int inWidth, int inShape, short* outMv);
+	void	PredictSkipMv(short* outMv);
+	void	PredictDirect(int inMask);
+	void	PredictSpatialDirect(int inMask);
+	void	PredictTemporalDirect(int inMask);
+	void	FillMotion(int inList, int inX, int inY, int inWidth, int inHeight, int inRef, const short* inMv);
+	void	SaveMotion(void);
+
+	// Reconstruction
+	void	MotionCompensate(void);
+	void	PredictBlock(int inX, int inY, int inWidth, int inHeight);
+	void	PredictFromRef(SoftPicture* inRef, const short* inMv, int inX, int inY, int inWidth, int inHeight,
+						   unsigned char* outLuma, unsigned char* outCb, unsigned char* outCr, int inLumaStride, int inChromaStride);
+	void	PredictIntra4x4(int inBlock, int inMode);
+	void	PredictIntra16x16(int inMode);
+	void	PredictIntraChroma(int inMode);
+	void	AddLumaResidual(void);
+	void	AddChromaResidual(void);
+	bool	IntraAvailable(const SoftMb* inMb) const;
+
+private:
+
+	const SoftCavlcTables*	m_Tables;
+	PlatformSemaphore*	m_Wake;
+
+	// Slice
+	SoftSliceTask*	m_Task;
+	SoftPicture*	m_Picture;
+	const SoftSliceHeader*	m_Header;
+	int				m_SliceType;
+	int				m_ListCount;
+	int				m_MbWidth;
+	int				m_MbHeight;
+	BitReader		m_Reader;
+	long long		m_StopBit;			// Of the RBSP, for more_rbsp_data()
+	SoftCabac		m_Cabac;
+	unsigned char	m_Contexts[SOFT_CABAC_CONTEXTS];
+	bool			m_IsCabac;
+	int				m_WeightMode;		// 0 default, 1 explicit, 2 implicit
+	int				m_RowCount;			// Decoded macroblocks of the row not reported yet
+
+	// Macroblock
+	int				m_Address;
+	int				m_MbX;
+	int				m_MbY;
+	SoftMb*			m_Mb;
+	const SoftMb*	m_MbA;				// Left, top, top right and top left, NULL
+	const SoftMb*	m_MbB;				// when not in the slice
+	const SoftMb*	m_MbC;
+	const SoftMb*	m_MbD;
+	int				m_Qp;
+	bool			m_LastQpDelta;		// Of the previous macroblock, not 0 (CABAC)
+	unsigned char*	m_Dst[3];
+	int				m_SubTypes[4];
+
+	// Residual: the 16 luma blocks in raster order, then the 4 of Cb and of Cr
+	short			m_Coeffs[24][16];
+	unsigned int	m_CodedBlocks;		// Blocks of m_Coeffs with coefficients
+
+	// Motion of the current macroblock and its neighbours, at 12 + x + 8y
+	// for x in -1..4 and y in -1..3
+	signed char		m_RefCache[2][48];
+	short			m_MvCache[2][48][2];
+	unsigned char	m_MvdCache[2][48][2];
+	unsigned char	m_DirectCache[48];
+
+	// Second list prediction and edge emulation
+	unsigned char	m_PredLuma[16 * 16];
+	unsigned char	m_PredChroma[2][8 * 8];
+	unsigned char	m_Edge[24 * 24];
+};
+
+#endif
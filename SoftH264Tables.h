@@ -0,0 +1,44 @@
+//------------------------------------------------------------------------------
+// File: SoftH264Tables.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Constant tables of the H.264 standard used by the software
+// decoder: CABAC context initialisation and state transitions, the CAVLC
+// codes, the coded_block_pattern mapping and the deblocking thresholds.
+//
+//------------------------------------------------------------------------------
+
+#ifndef SOFT_H264_TABLES_H_
+#define SOFT_H264_TABLES_H_
+
+// Contexts up to the 8x8 residual ones of frame macroblocks (ctxIdx 459)
+#define SOFT_CABAC_CONTEXTS		460
+
+extern const signed char	SoftCabacInitI[SOFT_CABAC_CONTEXTS][2];
+extern const signed char	SoftCabacInitPB[3][SOFT_CABAC_CONTEXTS][2];
+extern const unsigned char	SoftCabacRangeLps[64][4];
+extern const unsigned char	SoftCabacTransLps[64];
+
+extern const unsigned char	SoftCoeffTokenLength[4][4 * 17];
+extern const unsigned char	SoftCoeffTokenCode[4][4 * 17];
+extern const unsigned char	SoftChromaDcCoeffTokenLength[4 * 5];
+extern const unsigned char	SoftChromaDcCoeffTokenCode[4 * 5];
+extern const unsigned char	SoftTotalZerosLength[15][16];
+extern const unsigned char	SoftTotalZerosCode[15][16];
+extern const unsigned char	SoftChromaDcTotalZerosLength[3][4];
+extern const unsigned char	SoftChromaDcTotalZerosCode[3][4];
+extern const unsigned char	SoftRunLength[7][16];
+extern const unsigned char	SoftRunCode[7][16];
+
+extern const unsigned char	SoftIntraCbp[48];
+extern const unsigned char	SoftInterCbp[48];
+extern const unsigned char	SoftChromaQp[52];
+
+extern const unsigned char	SoftDeblockAlpha[52];
+extern const unsigned char	SoftDeblockBeta[52];
+extern const unsigned char	SoftDeblockTc0[52][3];
+
+#endif
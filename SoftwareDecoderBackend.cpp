@@ -0,0 +1,374 @@
+//------------------------------------------------------------------------------
+// File: SoftwareDecoderBackend.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Decoder backend on the CPU, built on SoftH264Decoder.
+//
+// The data is cut into NAL units as the mock backend does, and each one
+// goes to the decoder as soon as the start code after it arrives. The
+// decoder hands the pictures back in output order, final, from within
+// Decode. They are copied out as tightly packed I420 of the display area,
+// scaled by ScaleIYUV when a target size is set. The luma statistics are
+// taken as the luma plane is copied into the frame, which still holds the
+// previous one delivered. Frames the decimator leaves out are not copied,
+// and the non-reference pictures it does not need are not decoded.
+//
+//------------------------------------------------------------------------------
+
+#include "SoftwareDecoderBackend.h"
+#include "DecoderStats.h"
+#include "FrameConverter.h"
+#include "PerfTimer.h"
+#include "Trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+SoftwareDecoderBackend::SoftwareDecoderBackend() :
+							m_Sink(NULL),
+							m_Stats(NULL),
+							m_Pending(NULL),
+							m_PendingSize(0),
+							m_PendingCapacity(0),
+							m_HasSequence(false),
+							m_Activated(false),
+							m_Unsupported(0),
+							m_TargetWidth(0),
+							m_TargetHeight(0),
+							m_Frame(NULL),
+							m_FrameCapacity(0),
+							m_FrameWidth(0),
+							m_FrameHeight(0),
+							m_FrameCount(0),
+							m_PreviousFrame(0),
+							m_FrameStatistics(false),
+							m_Cropped(NULL),
+							m_CroppedCapacity(0),
+							m_Scaled(NULL),
+							m_ScaledCapacity(0)
+{
+	memset(&m_Sequence, 0, sizeof(m_Sequence));
+	memset(&m_Luma, 0, sizeof(m_Luma));
+}
+
+SoftwareDecoderBackend::~SoftwareDecoderBackend()
+{
+	m_Decoder.Close();
+	free(m_Pending);
+	delete [] m_Frame;
+	delete [] m_Cropped;
+	delete [] m_Scaled;
+}
+
+bool SoftwareDecoderBackend::Init( const DecoderSettings& settings, FrameSink* sink, DecoderStats* stats )
+{
+	m_Decoder.Close();
+
+	m_Sink = sink;
+	m_Stats = stats;
+	m_PendingSize = 0;
+	m_Timestamps.Clear();
+	m_HasSequence = false;
+	m_Activated = false;
+	m_Unsupported = 0;
+	m_FrameCount = 0;
+	m_FrameWidth = 0;
+	m_FrameHeight = 0;
+	m_FrameStatistics = settings.FrameStatistics != 0;
+	m_Decimator.Configure(settings.OutputStride, settings.OutputFrameRate);
+
+	if (!m_Decoder.Init(settings.DecodeThreads, this))
+	{
+		printf("Cannot start the software decoder\n");
+		return false;
+	}
+
+	// Like the CUDA decoder, the allocation covers the configured maximum
+	if (settings.MaxWidth > 0 && settings.MaxHeight > 0 &&
+		settings.MaxWidth * settings.MaxHeight * 3 / 2 > m_FrameCapacity)
+	{
+		m_FrameCapacity = settings.MaxWidth * settings.MaxHeight * 3 / 2;
+		delete [] m_Frame;
+		m_Frame = new unsigned char[m_FrameCapacity];
+	}
+	return true;
+}
+
+bool SoftwareDecoderBackend::Decode( const unsigned char* inData, long inLength, long long inTimestamp )
+{
+	TRACE_SCOPE("SoftwareDecode");
+	bool flush = (inLength <= 0);
+
+	if (!flush)
+	{
+		if (m_PendingSize + inLength > m_PendingCapacity)
+		{
+			long capacity = (m_PendingSize + inLength) * 2;
+			unsigned char* pending = (unsigned char*)realloc(m_Pending, capacity);
+			if (pending == NULL)
+				return false;
+			m_Pending = pending;
+			m_PendingCapacity = capacity;
+		}
+		m_Timestamps.Push(m_PendingSize, inTimestamp);
+		memcpy(m_Pending + m_PendingSize, inData, inLength);
+		m_PendingSize += inLength;
+	}
+
+	// Only the NAL units followed by a start code are complete, the last
+	// one may go on in the next call
+	long keep = m_PendingSize > 3 ? m_PendingSize - 3 : 0;
+	long length = 0;
+	long offset = FindNalUnit(m_Pending, m_PendingSize, 0, &length);
+	while (offset >= 0)
+	{
+		long nextLength = 0;
+		long next = FindNalUnit(m_Pending, m_PendingSize, offset + length, &nextLength);
+		if (next < 0 && !flush)
+		{
+			keep = offset - 3;
+			break;
+		}
+		this->ProcessNalUnit(offset, length);
+		offset = next;
+		length = nextLength;
+		keep = m_PendingSize;
+	}
+
+	if (flush)
+	{
+		m_Decoder.Flush();
+		m_PendingSize = 0;
+		m_Timestamps.Clear();
+		m_Decimator.Reset();
+		return false;
+	}
+	memmove(m_Pending, m_Pending + keep, m_PendingSize - keep);
+	m_PendingSize -= keep;
+	m_Timestamps.Drop(keep);
+	return m_Unsupported == 0;
+}
+
+void SoftwareDecoderBackend::ProcessNalUnit( long inOffset, long inLength )
+{
+	// The decimator decides for the pictures still to come
+	m_Decoder.SetSkipNonReference(m_Decimator.SkipNonReference());
+
+	if (m_Decoder.DecodeNalUnit(m_Pending + inOffset, inLength, m_Timestamps.Peek(inOffset)))
+		m_Timestamps.Take(inOffset);
+}
+
+// The decoder needs no setup, the SPS only stops the session looking
+bool SoftwareDecoderBackend::PrepareSequence( const SequenceInfo& inSps )
+{
+	if (!m_HasSequence)
+	{
+		m_Sequence = inSps;
+		if (GetFrameRate(inSps) > 0)
+			m_Decimator.SetFrameDuration((long long)(10000000 / GetFrameRate(inSps)));
+		m_HasSequence = true;
+	}
+	return true;
+}
+
+void SoftwareDecoderBackend::OnSequence( const SoftSps& inSps )
+{
+	long long switchStart = PerfTimeUs();
+
+	m_Sequence = inSps.Info;
+	if (GetFrameRate(inSps.Info) > 0)
+		m_Decimator.SetFrameDuration((long long)(10000000 / GetFrameRate(inSps.Info)));
+
+	// Grown only, as the host buffers of the CUDA decoder
+	int width = m_TargetWidth ? m_TargetWidth : inSps.Info.DisplayWidth;
+	int height = m_TargetHeight ? m_TargetHeight : inSps.Info.DisplayHeight;
+	this->Reserve(&m_Frame, &m_FrameCapacity, (long)width * height * 3 / 2);
+
+	// The decoder was already flushed and has its new pictures: never in place
+	if (m_Activated && m_Stats)
+		m_Stats->AddSequenceSwitch(PerfTimeUs() - switchStart, false);
+	m_HasSequence = true;
+	m_Activated = true;
+	m_Unsupported = 0;
+}
+
+// The session and the caller see Decode fail from now on
+void SoftwareDecoderBackend::OnUnsupported( const SoftSps& inSps, int inReason )
+{
+	static const char* features[] = { "", "field pictures", "a format other than 8-bit 4:2:0",
+									  "scaling matrices", "the 8x8 transform", "slice groups" };
+	m_Unsupported = inReason;
+	printf("The software decoder cannot decode profile %d with %s\n", inSps.ProfileIdc,
+		   inReason < (int)(sizeof(features) / sizeof(features[0])) ? features[inReason] : "unknown features");
+}
+
+unsigned char* SoftwareDecoderBackend::Reserve( unsigned char** ioBuffer, long* ioCapacity, long inSize )
+{
+	if (inSize > *ioCapacity)
+	{
+		delete [] *ioBuffer;
+		*ioBuffer = new unsigned char[inSize];
+		*ioCapacity = inSize;
+		// The previous frame is gone with the old buffer
+		if (ioBuffer == &m_Frame)
+			m_FrameWidth = 0;
+	}
+	return *ioBuffer;
+}
+
+void SoftwareDecoderBackend::OnPicture( const SoftPicture* inPicture )
+{
+	long long convertStart = PerfTimeUs();
+	bool decoded = inPicture->Decoded;
+	if (m_Stats && decoded)
+		m_Stats->AddLatency(STAT_DECODE_TO_MAP, convertStart - inPicture->StartTime);
+
+	if (!m_Decimator.Next(decoded))
+	{
+		if (m_Stats && decoded)
+			m_Stats->AddFrameDecimated();
+		else if (m_Stats)
+			m_Stats->AddPictureSkipped();
+		m_FrameCount++;
+		return;
+	}
+
+	int width = m_TargetWidth ? m_TargetWidth : m_Sequence.DisplayWidth;
+	int height = m_TargetHeight ? m_TargetHeight : m_Sequence.DisplayHeight;
+	this->ConvertPicture(inPicture, width, height);
+
+	DecodedFrame frame;
+	frame.Data = m_Frame;
+	frame.Size = (long)width * height * 3 / 2;
+	frame.Width = width;
+	frame.Height = height;
+	frame.Timestamp = inPicture->Timestamp;
+	frame.FrameNumber = m_FrameCount;
+	frame.Progressive = 1;
+	frame.Luma = m_FrameStatistics ? &m_Luma : NULL;
+
+	if (m_Stats && frame.Luma)
+		m_Stats->AddFrameMeasured(m_Luma);
+
+	bool delivered = m_Sink->OnFrame(frame);
+	if (m_Stats)
+	{
+		long long now = PerfTimeUs();
+		if (delivered)
+		{
+			m_Stats->AddLatency(STAT_CONVERT_TO_DELIVER, now - convertStart);
+			m_Stats->AddFrameDelivered(now);
+		}
+		else
+		{
+			m_Stats->AddFrameDropped();
+		}
+	}
+	m_FrameCount++;
+}
+
+// The display area of the picture into m_Frame, through the scaler when
+// the output size differs
+void SoftwareDecoderBackend::ConvertPicture( const SoftPicture* inPicture, int inWidth, int inHeight )
+{
+	int cropWidth = m_Sequence.DisplayWidth;
+	int cropHeight = m_Sequence.DisplayHeight;
+	const unsigned char* planes[3];
+	planes[0] = inPicture->Plane[0] + (long)m_Sequence.CropTop * inPicture->LumaStride + m_Sequence.CropLeft;
+	planes[1] = inPicture->Plane[1] + (long)(m_Sequence.CropTop / 2) * inPicture->ChromaStride + m_Sequence.CropLeft / 2;
+	planes[2] = inPicture->Plane[2] + (long)(m_Sequence.CropTop / 2) * inPicture->ChromaStride + m_Sequence.CropLeft / 2;
+
+	unsigned char* frame = this->Reserve(&m_Frame, &m_FrameCapacity, (long)inWidth * inHeight * 3 / 2);
+	LumaStatistics* stats = m_FrameStatistics ? &m_Luma : NULL;
+	int hasPrevious = (inWidth == m_FrameWidth && inHeight == m_FrameHeight);
+	bool scale = (inWidth != cropWidth || inHeight != cropHeight);
+
+	// Unscaled, the planes go straight into the frame; scaled, they are
+	// set aside for the scaler, whose output is measured on its way into
+	// the frame
+	unsigned char* dst = frame;
+	if (scale)
+		dst = this->Reserve(&m_Cropped, &m_CroppedCapacity, (long)cropWidth * cropHeight * 3 / 2);
+	for (int plane = 0; plane < 3; plane++)
+	{
+		int width = plane ? cropWidth / 2 : cropWidth;
+		int height = plane ? cropHeight / 2 : cropHeight;
+		int stride = plane ? inPicture->ChromaStride : inPicture->LumaStride;
+		if (plane == 0 && stats && !scale)
+			CopyLumaPlane(planes[0], stride, dst, width, height, hasPrevious, stats);
+		else
+		{
+			for (int y = 0; y < height; y++)
+				memcpy(dst + (long)y * width, planes[plane] + (long)y * stride, width);
+		}
+		dst += (long)width * height;
+	}
+
+	if (scale)
+	{
+		ScaleParams params;
+		params.src = m_Cropped;
+		params.srcWidth = cropWidth;
+		params.srcHeight = cropHeight;
+		params.dst = stats ? this->Reserve(&m_Scaled, &m_ScaledCapacity, (long)inWidth * inHeight * 3 / 2) : frame;
+		params.dstWidth = inWidth;
+		params.dstHeight = inHeight;
+		ScaleIYUV(&params);
+		if (stats)
+		{
+			long lumaSize = (long)inWidth * inHeight;
+			CopyLumaPlane(m_Scaled, inWidth, frame, inWidth, inHeight, hasPrevious, stats);
+			memcpy(frame + lumaSize, m_Scaled + lumaSize, lumaSize / 2);
+		}
+	}
+
+	if (stats)
+		m_Luma.PreviousDistance = hasPrevious ? m_FrameCount - m_PreviousFrame : 0;
+	m_FrameWidth = inWidth;
+	m_FrameHeight = inHeight;
+	m_PreviousFrame = m_FrameCount;
+}
+
+bool SoftwareDecoderBackend::HasDecoder( void )
+{
+	return m_HasSequence;
+}
+
+void SoftwareDecoderBackend::SetTargetSize( int inWidth, int inHeight )
+{
+	m_TargetWidth = inWidth;
+	m_TargetHeight = inHeight;
+}
+
+// Progressive only: there is nothing to deinterlace
+void SoftwareDecoderBackend::SetSequenceHint( bool inSequence )
+{
+	(void)inSequence;
+}
+
+void SoftwareDecoderBackend::SetDeinterlaceMode( int inMode )
+{
+	(void)inMode;
+}
+
+void SoftwareDecoderBackend::SetFrameDuration( long long inDuration )
+{
+	m_Decimator.SetFrameDuration(inDuration);
+}
+
+int SoftwareDecoderBackend::GetFrameCount( void ) const
+{
+	return m_FrameCount;
+}
+
+// The pictures of the decoder stand for the decode surfaces
+void SoftwareDecoderBackend::GetSurfaceUsage( long* outSurfaces, long long* outDeviceBytes, long long* outHostBytes )
+{
+	*outSurfaces = m_Decoder.GetPictureCount();
+	*outDeviceBytes = 0;
+	*outHostBytes = m_Decoder.GetPictureBytes() + m_FrameCapacity + m_PendingCapacity +
+					m_CroppedCapacity + m_ScaledCapacity;
+}
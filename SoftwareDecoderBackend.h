@@ -0,0 +1,87 @@
+//------------------------------------------------------------------------------
+// File: SoftwareDecoderBackend.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Decoder backend on the CPU, built on SoftH264Decoder. It takes
+// over when there is no CUDA device, and decodes the same streams on hosts
+// without a GPU: Constrained Baseline and Main progressive, CAVLC and
+// CABAC, on several threads.
+//
+//------------------------------------------------------------------------------
+
+#ifndef SOFTWARE_DECODER_BACKEND_H_
+#define SOFTWARE_DECODER_BACKEND_H_
+
+#include "DecoderBackend.h"
+#include "FrameDecimator.h"
+#include "SoftH264Decoder.h"
+
+class SoftwareDecoderBackend : public DecoderBackend, public SoftDecoderSink
+{
+public:
+
+	SoftwareDecoderBackend();
+	virtual ~SoftwareDecoderBackend();
+
+	// DecoderBackend
+	bool	Init(const DecoderSettings& settings, FrameSink* sink, DecoderStats* stats);
+	bool	Decode(const unsigned char* inData, long inLength, long long inTimestamp);
+	bool	PrepareSequence(const SequenceInfo& inSps);
+	bool	HasDecoder(void);
+	void	SetTargetSize(int inWidth, int inHeight);
+	void	SetSequenceHint(bool inSequence);
+	void	SetDeinterlaceMode(int inMode);
+	void	SetFrameDuration(long long inDuration);
+	int		GetFrameCount(void) const;
+	void	GetSurfaceUsage(long* outSurfaces, long long* outDeviceBytes, long long* outHostBytes);
+
+	// SoftDecoderSink
+	void	OnSequence(const SoftSps& inSps);
+	void	OnPicture(const SoftPicture* inPicture);
+	void	OnUnsupported(const SoftSps& inSps, int inReason);
+
+private:
+
+	void	ProcessNalUnit(long inOffset, long inLength);
+	void	ConvertPicture(const SoftPicture* inPicture, int inWidth, int inHeight);
+	unsigned char*	Reserve(unsigned char** ioBuffer, long* ioCapacity, long inSize);
+
+private:
+
+	FrameSink*		m_Sink;
+	DecoderStats*	m_Stats;
+	SoftH264Decoder	m_Decoder;
+
+	// Data after the last complete NAL unit
+	unsigned char*	m_Pending;
+	long			m_PendingSize;
+	long			m_PendingCapacity;
+	TimestampQueue	m_Timestamps;		// Of m_Pending
+
+	bool			m_HasSequence;		// From the stream or PrepareSequence
+	bool			m_Activated;		// The decoder started a sequence
+	int				m_Unsupported;		// SOFT_UNSUPPORTED_xxx until a sequence it can decode
+	SequenceInfo	m_Sequence;
+	int				m_TargetWidth;
+	int				m_TargetHeight;
+
+	unsigned char*	m_Frame;			// I420 of the output size
+	long			m_FrameCapacity;
+	int				m_FrameWidth;		// Of the frame in m_Frame, 0 for none
+	int				m_FrameHeight;
+	int				m_FrameCount;
+	int				m_PreviousFrame;	// m_FrameCount of the frame in m_Frame
+	FrameDecimator	m_Decimator;
+
+	bool			m_FrameStatistics;
+	LumaStatistics	m_Luma;				// Of m_Frame
+	unsigned char*	m_Cropped;			// Scaler input, and output when measured
+	long			m_CroppedCapacity;
+	unsigned char*	m_Scaled;
+	long			m_ScaledCapacity;
+};
+
+#endif
@@ -0,0 +1,319 @@
+//------------------------------------------------------------------------------
+// File: StreamAnalyzer.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Per-stream structure and size figures from the NAL and slice
+// headers.
+//
+// The start codes are searched three bytes at a time as in FindNalUnit;
+// of each NAL unit only the header is copied, with the start of the
+// slice header or the SPS. A NAL unit is counted from its header to the
+// next one, so its size includes the start code that follows it. Access
+// units are told apart as by AccessUnitScanner, and a picture is counted
+// once the next one begins.
+//
+//------------------------------------------------------------------------------
+
+#include "StreamAnalyzer.h"
+#include "H264Headers.h"
+#include <string.h>
+
+StreamAnalyzer::StreamAnalyzer() :	m_SequenceHeaders(0),
+									m_FrameDuration(0),
+									m_SpsFrameRate(0)
+{
+	this->Reset();
+	this->Flush();
+}
+
+StreamAnalyzer::~StreamAnalyzer()
+{
+}
+
+void StreamAnalyzer::Reset( void )
+{
+	memset(&m_Stats, 0, sizeof(m_Stats));
+	memset(m_WindowBytes, 0, sizeof(m_WindowBytes));
+	m_WindowTotal = 0;
+	m_BRun = 0;
+	m_GopFrames = -1;
+}
+
+void StreamAnalyzer::Flush( void )
+{
+	m_Offset = 0;
+	m_Zeros = 0;
+	m_NalStart = -1;
+	m_HeaderLength = 0;
+	m_HeaderWanted = 1;
+	m_HasPicture = false;
+	m_FrameBytes = 0;
+	m_BRun = 0;
+	m_GopFrames = -1;
+}
+
+void StreamAnalyzer::SetFrameDuration( long long inDuration )
+{
+	m_FrameDuration = inDuration;
+}
+
+// Returns the offset after the 01 of the next start code, -1 if there is
+// none. m_Zeros follows the data scanned.
+long StreamAnalyzer::FindStartCode( const unsigned char* inData, long inLength, long inOffset )
+{
+	// Start codes begun in the previous data
+	long i;
+	for (i = inOffset; i < inLength && i < inOffset + 2; i++)
+	{
+		if (inData[i] == 1 && m_Zeros >= 2)
+		{
+			m_Zeros = 0;
+			return i + 1;
+		}
+		m_Zeros = (inData[i] == 0) ? m_Zeros + 1 : 0;
+	}
+	if (i >= inLength)
+	{
+		return -1;
+	}
+
+	// Skip ahead until the third byte could end a start code
+	long j = inOffset;
+	while (j + 2 < inLength)
+	{
+		if (inData[j + 2] > 1)
+		{
+			j += 3;
+		}
+		else if (inData[j + 2] == 1 && inData[j + 1] == 0 && inData[j] == 0)
+		{
+			m_Zeros = 0;
+			return j + 3;
+		}
+		else
+		{
+			j++;
+		}
+	}
+
+	// Zeros at the end may begin the next start code
+	long zeros = 0;
+	while (inLength - zeros > i && inData[inLength - zeros - 1] == 0)
+	{
+		zeros++;
+	}
+	m_Zeros = (inLength - zeros == i) ? m_Zeros + zeros : zeros;
+	return -1;
+}
+
+void StreamAnalyzer::Collect( const unsigned char* inData, long inLength )
+{
+	while (m_NalStart >= 0 && m_HeaderLength < m_HeaderWanted && inLength > 0)
+	{
+		long count = m_HeaderWanted - m_HeaderLength;
+		if (count > inLength)
+			count = inLength;
+		memcpy(m_Header + m_HeaderLength, inData, count);
+		m_HeaderLength += count;
+		inData += count;
+		inLength -= count;
+
+		if (m_HeaderLength == 1)
+		{
+			int type = m_Header[0] & 0x1f;
+			if (type == NAL_TYPE_SLICE || type == NAL_TYPE_IDR)
+				m_HeaderWanted = 1 + SLICE_HEADER_PREFIX;
+			else if (type == NAL_TYPE_SPS)
+			{
+				m_HeaderWanted = STREAM_SPS_BYTES;
+				m_SequenceHeaders++;
+			}
+		}
+	}
+}
+
+void StreamAnalyzer::Scan( const unsigned char* inData, long inLength )
+{
+	long i = 0;
+	while (i < inLength)
+	{
+		long next = this->FindStartCode(inData, inLength, i);
+		if (next < 0)
+		{
+			this->Collect(inData + i, inLength - i);
+			break;
+		}
+		this->Collect(inData + i, next - i);
+		this->EndNalUnit(m_Offset + next);
+
+		m_NalStart = m_Offset + next;
+		m_HeaderLength = 0;
+		m_HeaderWanted = 1;
+		i = next;
+	}
+	m_Offset += inLength;
+}
+
+void StreamAnalyzer::Finish( void )
+{
+	this->EndNalUnit(m_Offset);
+	m_NalStart = -1;
+	if (m_HasPicture)
+		this->EndFrame();
+	m_FrameBytes = 0;
+}
+
+void StreamAnalyzer::EndNalUnit( long long inNextStart )
+{
+	if (m_NalStart < 0)
+	{
+		return;
+	}
+
+	// The collected bytes may run into the next start code
+	long size = (long)(inNextStart - m_NalStart);
+	if (m_HeaderLength > size - 3)
+		m_HeaderLength = size - 3;
+	if (m_HeaderLength < 1)
+	{
+		return;
+	}
+
+	int type = m_Header[0] & 0x1f;
+	m_Stats.NalUnits[type]++;
+	m_Stats.NalBytes[type] += size;
+	m_Stats.TotalBytes += size;
+
+	if (type == NAL_TYPE_SLICE || type == NAL_TYPE_IDR)
+	{
+		SliceInfo slice;
+		bool parsed = ParseSliceHeader(m_Header + 1, m_HeaderLength - 1, &slice);
+		if (parsed && slice.FirstMbInSlice == 0 && m_HasPicture)
+			this->EndFrame();
+
+		if (!m_HasPicture)
+		{
+			memset(&m_Frame, 0, sizeof(m_Frame));
+			m_Frame.Type = SLICE_TYPE_I;
+			m_HasPicture = true;
+		}
+		m_Frame.Slices++;
+		if (type == NAL_TYPE_IDR)
+			m_Frame.Idr = 1;
+		if (m_Header[0] & 0x60)
+			m_Frame.Reference = 1;
+		if (parsed && slice.SliceType == SLICE_TYPE_B)
+			m_Frame.Type = SLICE_TYPE_B;
+		else if (parsed && (slice.SliceType == SLICE_TYPE_P || slice.SliceType == SLICE_TYPE_SP) &&
+				 m_Frame.Type == SLICE_TYPE_I)
+			m_Frame.Type = SLICE_TYPE_P;
+	}
+	else
+	{
+		if ((type == NAL_TYPE_AUD || type == NAL_TYPE_SPS || type == NAL_TYPE_PPS ||
+			 type == NAL_TYPE_SEI || (type >= 14 && type <= 18)) && m_HasPicture)
+		{
+			this->EndFrame();
+		}
+
+		SequenceInfo sps;
+		if (type == NAL_TYPE_SPS && ParseSequenceParameterSet(m_Header + 1, m_HeaderLength - 1, &sps))
+			m_SpsFrameRate = GetFrameRate(sps);
+	}
+	m_FrameBytes += size;
+}
+
+void StreamAnalyzer::EndFrame( void )
+{
+	long long index = m_Stats.Frames++;
+
+	m_Frame.Bytes = m_FrameBytes;
+	m_Stats.Recent[index % STREAM_FRAME_HISTORY] = m_Frame;
+	m_Stats.FramesOfType[(int)m_Frame.Type]++;
+	if (m_Frame.Idr)
+		m_Stats.IdrFrames++;
+	if (m_Frame.Reference)
+		m_Stats.ReferenceFrames++;
+	if (m_FrameBytes > m_Stats.MaxFrameBytes)
+		m_Stats.MaxFrameBytes = m_FrameBytes;
+
+	if (m_Frame.Type == SLICE_TYPE_B)
+	{
+		if (m_Frame.Reference)
+			m_Stats.ReferenceBFrames++;
+		if (++m_BRun > m_Stats.MaxConsecutiveB)
+			m_Stats.MaxConsecutiveB = m_BRun;
+	}
+	else
+	{
+		m_BRun = 0;
+	}
+
+	// A GOP runs from an I picture to the picture before the next one
+	if (m_Frame.Type == SLICE_TYPE_I)
+	{
+		if (m_GopFrames > 0)
+		{
+			m_Stats.GopCount++;
+			m_Stats.LastGopLength = m_GopFrames;
+			if (m_GopFrames > m_Stats.MaxGopLength)
+				m_Stats.MaxGopLength = m_GopFrames;
+		}
+		m_GopFrames = 0;
+	}
+	if (m_GopFrames >= 0)
+		m_GopFrames++;
+
+	int slot = (int)(index % STREAM_RATE_WINDOW);
+	m_WindowTotal += m_FrameBytes - m_WindowBytes[slot];
+	m_WindowBytes[slot] = m_FrameBytes;
+
+	m_HasPicture = false;
+	m_FrameBytes = 0;
+}
+
+void StreamAnalyzer::GetStatistics( StreamStatistics* outStats ) const
+{
+	*outStats = m_Stats;
+
+	// Oldest first
+	long long count = m_Stats.Frames < STREAM_FRAME_HISTORY ? m_Stats.Frames : STREAM_FRAME_HISTORY;
+	long long first = m_Stats.Frames - count;
+	for (long long i=0; i<count; i++)
+	{
+		outStats->Recent[i] = m_Stats.Recent[(first + i) % STREAM_FRAME_HISTORY];
+	}
+	outStats->HistoryCount = (long)count;
+
+	double rate = m_SpsFrameRate;
+	if (rate <= 0 && m_FrameDuration > 0)
+		rate = (double)STREAM_TIME_UNITS / m_FrameDuration;
+	outStats->FrameRate = rate;
+
+	if (m_Stats.Frames > 0)
+	{
+		long long window = m_Stats.Frames < STREAM_RATE_WINDOW ? m_Stats.Frames : STREAM_RATE_WINDOW;
+		outStats->Bitrate = m_WindowTotal * 8.0 * rate / window;
+		outStats->AverageBitrate = m_Stats.TotalBytes * 8.0 * rate / m_Stats.Frames;
+	}
+}
+
+void StreamAnalyzer::Report( const StreamStatistics& inStats, FILE* outFile )
+{
+	fprintf(outFile, "Stream: %lld pictures (%lld I, %lld P, %lld B, %lld IDR, %lld reference, %lld reference B), "
+					 "up to %ld B in a row, GOP %ld (max %ld)\n",
+			inStats.Frames, inStats.FramesOfType[SLICE_TYPE_I], inStats.FramesOfType[SLICE_TYPE_P],
+			inStats.FramesOfType[SLICE_TYPE_B], inStats.IdrFrames, inStats.ReferenceFrames,
+			inStats.ReferenceBFrames, inStats.MaxConsecutiveB, inStats.LastGopLength, inStats.MaxGopLength);
+	fprintf(outFile, "  %.2f fps, %.0f kbit/s (%.0f average), largest picture %ld bytes, NAL units:",
+			inStats.FrameRate, inStats.Bitrate / 1000, inStats.AverageBitrate / 1000, inStats.MaxFrameBytes);
+	for (int i=0; i<STREAM_NAL_TYPES; i++)
+	{
+		if (inStats.NalUnits[i])
+			fprintf(outFile, " %d: %lld (%.0f bytes)", i, inStats.NalUnits[i], (double)inStats.NalBytes[i] / inStats.NalUnits[i]);
+	}
+	fprintf(outFile, "\n");
+}
@@ -0,0 +1,127 @@
+//------------------------------------------------------------------------------
+// File: StreamAnalyzer.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Per-stream structure and size figures taken from the NAL and
+// slice headers as the data arrives: picture types, NAL unit sizes, GOP
+// length, reference structure and bitrate. Nothing is decoded, so the
+// figures keep coming when the decoder falls behind. Not synchronized,
+// the owner serializes the calls.
+//
+//------------------------------------------------------------------------------
+
+#ifndef STREAM_ANALYZER_H_
+#define STREAM_ANALYZER_H_
+
+#include <stdio.h>
+
+#define STREAM_NAL_TYPES		32
+#define STREAM_FRAME_HISTORY	32		// Last pictures kept in the statistics
+#define STREAM_RATE_WINDOW		32		// Pictures the current bitrate is taken over
+#define STREAM_SPS_BYTES		256		// Of an SPS read for the frame rate
+#define STREAM_TIME_UNITS		10000000	// Frame duration units per second (100 ns)
+
+typedef struct
+{
+	long		Bytes;			// Access unit with its start codes
+	short		Slices;
+	char		Type;			// SLICE_TYPE_P, _B or _I: B if any slice is B, else P if any is P
+	char		Reference;		// nal_ref_idc of the slices is not 0
+	char		Idr;
+	char		Reserved[3];
+} StreamFrameInfo;
+
+typedef struct
+{
+	long long	Frames;
+	long long	FramesOfType[3];		// By SLICE_TYPE_P, _B and _I
+	long long	IdrFrames;
+	long long	ReferenceFrames;
+	long long	ReferenceBFrames;		// B pictures other pictures predict from (pyramid)
+	long		MaxConsecutiveB;
+
+	long long	GopCount;				// I picture to I picture
+	long		LastGopLength;
+	long		MaxGopLength;
+
+	long long	NalUnits[STREAM_NAL_TYPES];
+	long long	NalBytes[STREAM_NAL_TYPES];
+	long long	TotalBytes;
+	long		MaxFrameBytes;
+
+	double		FrameRate;				// SPS timing, or the frame duration set by the owner; 0 if unknown
+	double		Bitrate;				// Over the last STREAM_RATE_WINDOW pictures, bits per second
+	double		AverageBitrate;
+
+	long		HistoryCount;			// Valid entries of Recent, the oldest first
+	StreamFrameInfo	Recent[STREAM_FRAME_HISTORY];
+} StreamStatistics;
+
+class StreamAnalyzer
+{
+public:
+
+	StreamAnalyzer();
+	virtual ~StreamAnalyzer();
+
+	// Clears the figures, the scanning goes on
+	void	Reset(void);
+
+	// Drops a partial NAL unit and access unit, the stream restarts
+	void	Flush(void);
+
+	// Used for the bitrate when the SPS has no timing, in STREAM_TIME_UNITS
+	void	SetFrameDuration(long long inDuration);
+
+	// The next data of the Annex B stream, in pieces of any size
+	void	Scan(const unsigned char* inData, long inLength);
+
+	// End of the stream: counts the last access unit
+	void	Finish(void);
+
+	// SPS NAL units so far, counted as their header byte is scanned. Not
+	// cleared by Reset.
+	long	GetSequenceHeaders(void) const { return m_SequenceHeaders; }
+
+	void	GetStatistics(StreamStatistics* outStats) const;
+
+	static void	Report(const StreamStatistics& inStats, FILE* outFile);
+
+private:
+
+	long	FindStartCode(const unsigned char* inData, long inLength, long inOffset);
+	void	Collect(const unsigned char* inData, long inLength);
+	void	EndNalUnit(long long inNextStart);
+	void	EndFrame(void);
+
+private:
+
+	// Scanning
+	long long	m_Offset;				// Stream bytes scanned
+	int			m_Zeros;				// Zero bytes before the current one
+	long long	m_NalStart;				// Offset of the current NAL header, -1 before the first
+	long		m_HeaderLength;			// Bytes of it collected
+	long		m_HeaderWanted;
+	unsigned char	m_Header[STREAM_SPS_BYTES];
+	long		m_SequenceHeaders;
+
+	// Current access unit
+	bool		m_HasPicture;
+	long		m_FrameBytes;
+	StreamFrameInfo	m_Frame;
+
+	long		m_BRun;					// B pictures since the last P or I
+	long		m_GopFrames;			// Pictures since the last I, -1 before the first
+	long long	m_FrameDuration;
+	double		m_SpsFrameRate;
+
+	long		m_WindowBytes[STREAM_RATE_WINDOW];
+	long long	m_WindowTotal;
+
+	StreamStatistics	m_Stats;
+};
+
+#endif
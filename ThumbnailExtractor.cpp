@@ -0,0 +1,448 @@
+//------------------------------------------------------------------------------
+// File: ThumbnailExtractor.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Makes thumbnails of a whole elementary stream for indexing media
+// libraries.
+//
+// The stream is indexed in one pass over the start codes, finding the
+// access units as ParallelDecoder does. An IDR picture needs nothing
+// before it but the parameter sets, so each one selected is decoded from
+// the last SPS and PPS seen before it, then the session is drained and
+// the first frame out is the thumbnail. When the SPS allows field
+// pictures the next access unit is decoded as well, it may hold the
+// second field; the frames after the first one are dropped.
+//
+// The session is set to the thumbnail size, which the backends apply in
+// their own output pass: the CUDA post-processing scales while it maps
+// the surface, the software backend scales with ScaleIYUV and the mock
+// backend draws its frames at that size. The pictures are counted by
+// their first slice, so the times of field-coded streams run twice as
+// fast as the interval.
+//
+//------------------------------------------------------------------------------
+
+#include "ThumbnailExtractor.h"
+#include "H264Headers.h"
+#include "PerfTimer.h"
+#include "Trace.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define THUMBNAIL_INDEX_SIZE	256		// Initial units and parameter sets, they grow
+
+ThumbnailExtractor::ThumbnailExtractor() :	m_Sink(NULL),
+											m_Open(false),
+											m_BufferSize(0),
+											m_Width(0),
+											m_Height(0),
+											m_Interval(0),
+											m_FrameDuration(0),
+											m_Units(NULL),
+											m_UnitCount(0),
+											m_UnitCapacity(0),
+											m_ParameterSets(NULL),
+											m_ParameterSetCount(0),
+											m_ParameterSetCapacity(0),
+											m_Current(NULL),
+											m_Duration(0),
+											m_FramesOut(0),
+											m_Error(THUMBNAIL_ERROR_NONE)
+{
+	memset(&m_Stats, 0, sizeof(m_Stats));
+}
+
+ThumbnailExtractor::~ThumbnailExtractor()
+{
+	this->Close();
+}
+
+void ThumbnailExtractor::SetThumbnailSize( int inWidth, int inHeight )
+{
+	m_Width = inWidth > 0 ? inWidth & ~1 : 0;
+	m_Height = inHeight > 0 ? inHeight & ~1 : 0;
+}
+
+void ThumbnailExtractor::SetInterval( double inSeconds )
+{
+	m_Interval = inSeconds > 0 ? inSeconds : 0;
+}
+
+void ThumbnailExtractor::SetFrameDuration( long long inDuration )
+{
+	m_FrameDuration = inDuration;
+}
+
+void ThumbnailExtractor::GetThumbnailSize( const SequenceInfo& inSps, int inWidth, int inHeight,
+										   int* outWidth, int* outHeight )
+{
+	int width = inWidth > 0 ? inWidth : THUMBNAIL_WIDTH;
+	int height = inHeight;
+
+	if (height <= 0)
+	{
+		// Square samples unless the VUI says otherwise
+		long long sarWidth = inSps.SarWidth > 0 && inSps.SarHeight > 0 ? inSps.SarWidth : 1;
+		long long sarHeight = inSps.SarWidth > 0 && inSps.SarHeight > 0 ? inSps.SarHeight : 1;
+		long long displayWidth = (long long)inSps.DisplayWidth * sarWidth;
+		height = displayWidth > 0 ? (int)((long long)width * inSps.DisplayHeight * sarHeight / displayWidth) : width;
+	}
+	*outWidth = width < 2 ? 2 : width & ~1;
+	*outHeight = height < 2 ? 2 : height & ~1;
+}
+
+bool ThumbnailExtractor::Open( const DecoderSettings& settings, FrameSink* inSink, DecoderBackend* inBackend )
+{
+	if (m_Open || inSink == NULL)
+	{
+		delete inBackend;
+		return false;
+	}
+
+	// Every frame out is a thumbnail
+	DecoderSettings thumbnails = settings;
+	thumbnails.OutputStride = 0;
+	thumbnails.OutputFrameRate = 0;
+
+	if (!m_Session.Open(thumbnails, this, inBackend))
+	{
+		delete inBackend;
+		return false;
+	}
+	m_Sink = inSink;
+	m_BufferSize = thumbnails.DecoderBufferSize;
+	m_Open = true;
+	memset(&m_Stats, 0, sizeof(m_Stats));
+	return true;
+}
+
+void ThumbnailExtractor::Close( void )
+{
+	if (m_Open)
+	{
+		m_Session.Close();
+		m_Open = false;
+	}
+
+	free(m_Units);
+	free(m_ParameterSets);
+	m_Units = NULL;
+	m_UnitCount = 0;
+	m_UnitCapacity = 0;
+	m_ParameterSets = NULL;
+	m_ParameterSetCount = 0;
+	m_ParameterSetCapacity = 0;
+}
+
+bool ThumbnailExtractor::AddUnit( long long inStart, long long inPicture )
+{
+	if (m_UnitCount == m_UnitCapacity)
+	{
+		long capacity = m_UnitCapacity ? m_UnitCapacity * 2 : THUMBNAIL_INDEX_SIZE;
+		IdrUnit* units = (IdrUnit*)realloc(m_Units, capacity * sizeof(IdrUnit));
+		if (units == NULL)
+			return false;
+		m_Units = units;
+		m_UnitCapacity = capacity;
+	}
+
+	IdrUnit* unit = &m_Units[m_UnitCount++];
+	unit->Start = inStart;
+	unit->End = -1;
+	unit->NextEnd = -1;
+	unit->Picture = inPicture;
+	unit->Sps = -1;
+	unit->Pps = -1;
+	return true;
+}
+
+bool ThumbnailExtractor::AddParameterSet( long long inOffset, int inType )
+{
+	if (m_ParameterSetCount == m_ParameterSetCapacity)
+	{
+		long capacity = m_ParameterSetCapacity ? m_ParameterSetCapacity * 2 : THUMBNAIL_INDEX_SIZE;
+		ParameterSet* sets = (ParameterSet*)realloc(m_ParameterSets, capacity * sizeof(ParameterSet));
+		if (sets == NULL)
+			return false;
+		m_ParameterSets = sets;
+		m_ParameterSetCapacity = capacity;
+	}
+
+	ParameterSet* set = &m_ParameterSets[m_ParameterSetCount++];
+	set->Offset = inOffset;
+	set->Length = 0;
+	set->Type = inType;
+	return true;
+}
+
+// The last parameter set of the type before the offset, -1 if none
+long ThumbnailExtractor::FindParameterSet( int inType, long long inBefore )
+{
+	for (long i = m_ParameterSetCount - 1; i >= 0; i--)
+	{
+		if (m_ParameterSets[i].Offset < inBefore && m_ParameterSets[i].Type == inType)
+			return i;
+	}
+	return -1;
+}
+
+// A single pass over the start codes. An access unit starts at the first
+// non-VCL NAL unit after a picture, or at the first slice of a picture
+// following another one directly; its start ends the units before.
+bool ThumbnailExtractor::IndexStream( const unsigned char* inData, long long inSize )
+{
+	long long unitStart = 0;
+	long long pictures = 0;
+	bool hasPicture = false;
+	long open = 0;		// First unit whose ends are not all known
+	long pending = -1;	// Parameter set whose end is the next start code
+
+	m_UnitCount = 0;
+	m_ParameterSetCount = 0;
+
+	for (long long i = 0; i + 3 < inSize; i++)
+	{
+		// Skip ahead until the third byte could end a start code
+		if (inData[i + 2] > 1)
+		{
+			i += 2;
+			continue;
+		}
+		if (inData[i] != 0 || inData[i + 1] != 0 || inData[i + 2] != 1)
+			continue;
+
+		long long startCode = (i > 0 && inData[i - 1] == 0) ? i - 1 : i;
+		long long header = i + 3;
+		bool unitBegins = false;
+		i += 2;
+
+		if (pending >= 0)
+		{
+			m_ParameterSets[pending].Length = (long)(startCode - m_ParameterSets[pending].Offset);
+			pending = -1;
+		}
+
+		int type = inData[header] & 0x1f;
+		bool firstSlice = false;
+		if (type == NAL_TYPE_SLICE || type == NAL_TYPE_IDR)
+		{
+			// first_mb_in_slice = 0 is ue(v) '1'
+			firstSlice = header + 1 < inSize && (inData[header + 1] & 0x80);
+			if (firstSlice && hasPicture)
+			{
+				unitStart = startCode;
+				unitBegins = true;
+			}
+		}
+		else if (type == NAL_TYPE_AUD || type == NAL_TYPE_SPS || type == NAL_TYPE_PPS ||
+				 type == NAL_TYPE_SEI || (type >= 14 && type <= 18))
+		{
+			if (hasPicture)
+			{
+				unitStart = startCode;
+				unitBegins = true;
+				hasPicture = false;
+			}
+			if (type == NAL_TYPE_SPS || type == NAL_TYPE_PPS)
+			{
+				if (!this->AddParameterSet(startCode, type))
+					return false;
+				pending = m_ParameterSetCount - 1;
+			}
+		}
+
+		if (unitBegins)
+		{
+			for (long u = open; u < m_UnitCount; u++)
+			{
+				if (m_Units[u].End < 0)
+					m_Units[u].End = startCode;
+				else if (m_Units[u].NextEnd < 0)
+					m_Units[u].NextEnd = startCode;
+			}
+			while (open < m_UnitCount && m_Units[open].NextEnd >= 0)
+				open++;
+		}
+
+		if (firstSlice)
+		{
+			if (type == NAL_TYPE_IDR && !this->AddUnit(unitStart, pictures))
+				return false;
+			pictures++;
+		}
+		if (type == NAL_TYPE_SLICE || type == NAL_TYPE_IDR)
+			hasPicture = true;
+	}
+	if (pending >= 0)
+	{
+		m_ParameterSets[pending].Length = (long)(inSize - m_ParameterSets[pending].Offset);
+	}
+
+	for (long u = 0; u < m_UnitCount; u++)
+	{
+		IdrUnit* unit = &m_Units[u];
+		if (unit->End < 0)
+			unit->End = inSize;
+		if (unit->NextEnd < 0)
+			unit->NextEnd = inSize;
+		unit->Sps = this->FindParameterSet(NAL_TYPE_SPS, unit->Start);
+		unit->Pps = this->FindParameterSet(NAL_TYPE_PPS, unit->Start);
+	}
+	return true;
+}
+
+bool ThumbnailExtractor::DecodeData( const unsigned char* inData, long long inSize )
+{
+	m_Stats.BytesDecoded += inSize;
+	while (inSize > 0)
+	{
+		long length = inSize < m_BufferSize ? (long)inSize : m_BufferSize;
+		if (!m_Session.DecodeBuffer(inData, length))
+			return false;
+		inData += length;
+		inSize -= length;
+	}
+	return true;
+}
+
+bool ThumbnailExtractor::Extract( const unsigned char* inData, long long inSize )
+{
+	m_Error = THUMBNAIL_ERROR_NOT_OPEN;
+	if (!m_Open || inData == NULL)
+	{
+		return false;
+	}
+
+	long long start = PerfTimeUs();
+	m_Error = THUMBNAIL_ERROR_INDEX;
+	if (!this->IndexStream(inData, inSize))
+	{
+		return false;
+	}
+	long long decodeStart = PerfTimeUs();
+	m_Stats.IndexUs += decodeStart - start;
+	m_Stats.StreamBytes += inSize;
+	m_Stats.IdrPictures += m_UnitCount;
+	m_Error = THUMBNAIL_ERROR_NO_IDR;
+	if (m_UnitCount == 0)
+	{
+		return false;
+	}
+
+	// Size and timing from the first SPS, in front of the first IDR picture
+	// or in its access unit
+	SequenceInfo sps;
+	memset(&sps, 0, sizeof(sps));
+	long first = m_Units[0].Sps >= 0 ? m_Units[0].Sps : this->FindParameterSet(NAL_TYPE_SPS, m_Units[0].End);
+	bool hasSps = first >= 0 &&
+		FindSequenceParameterSet(inData + m_ParameterSets[first].Offset, m_ParameterSets[first].Length, &sps);
+
+	int width = m_Width ? m_Width : THUMBNAIL_WIDTH;
+	int height = m_Height ? m_Height : width * 9 / 16;
+	if (hasSps)
+		GetThumbnailSize(sps, m_Width, m_Height, &width, &height);
+	m_Stats.Width = width & ~1;
+	m_Stats.Height = height & ~1;
+	m_Session.SetOutputFrameSize(m_Stats.Width, m_Stats.Height);
+
+	m_Duration = m_FrameDuration > 0 ? m_FrameDuration : THUMBNAIL_DEFAULT_DURATION;
+	if (hasSps && GetFrameRate(sps) > 0)
+		m_Duration = (long long)(STREAM_TIME_UNITS / GetFrameRate(sps));
+	m_Session.SetFrameDuration(m_Duration);
+	bool fields = hasSps && !sps.FrameMbsOnly;
+
+	long long interval = (long long)(m_Interval * STREAM_TIME_UNITS);
+	long long due = 0;
+	long long thumbnails = m_Stats.Thumbnails;
+
+	for (long u = 0; u < m_UnitCount; u++)
+	{
+		const IdrUnit* unit = &m_Units[u];
+		// Half a frame early is on time, the durations are rounded
+		long long time = unit->Picture * m_Duration;
+		if (time + m_Duration / 2 < due)
+		{
+			continue;
+		}
+		due = time + interval;
+		m_Stats.Selected++;
+
+		TRACE_SCOPE("Thumbnail");
+		m_Current = unit;
+		m_FramesOut = 0;
+
+		bool pass = true;
+		if (unit->Sps >= 0)
+		{
+			const ParameterSet* set = &m_ParameterSets[unit->Sps];
+			pass = this->DecodeData(inData + set->Offset, set->Length);
+		}
+		if (unit->Pps >= 0)
+		{
+			const ParameterSet* set = &m_ParameterSets[unit->Pps];
+			pass = this->DecodeData(inData + set->Offset, set->Length) && pass;
+		}
+		long long end = fields ? unit->NextEnd : unit->End;
+		pass = this->DecodeData(inData + unit->Start, end - unit->Start) && pass;
+		m_Session.Drain();
+
+		if (!pass)
+			m_Stats.Failed++;
+		if (m_FramesOut == 0)
+			m_Stats.Missing++;
+	}
+	m_Current = NULL;
+
+	m_Error = THUMBNAIL_ERROR_DECODE;
+	m_Stats.DecodeUs += PerfTimeUs() - decodeStart;
+	m_Sink->OnEndOfStream();
+	if (m_Stats.Thumbnails == thumbnails)
+		return false;
+	m_Error = THUMBNAIL_ERROR_NONE;
+	return true;
+}
+
+// The first frame of the unit, stamped as its IDR picture
+bool ThumbnailExtractor::OnFrame( const DecodedFrame& inFrame )
+{
+	if (m_Current == NULL || m_FramesOut++ > 0)
+	{
+		return true;
+	}
+
+	DecodedFrame frame = inFrame;
+	frame.FrameNumber = m_Current->Picture;
+	frame.Timestamp = m_Current->Picture * m_Duration;
+	if (m_Sink->OnFrame(frame))
+		m_Stats.Thumbnails++;
+	return true;
+}
+
+// Each unit drains the session, the stream ends after the last one
+void ThumbnailExtractor::OnEndOfStream( void )
+{
+}
+
+void ThumbnailExtractor::GetStatistics( ThumbnailStatistics* outStats )
+{
+	*outStats = m_Stats;
+}
+
+void ThumbnailExtractor::Report( const ThumbnailStatistics& inStats, FILE* outFile )
+{
+	double seconds = (inStats.IndexUs + inStats.DecodeUs) / 1000000.0;
+	fprintf(outFile, "Thumbnails: %lld at %dx%d from %ld of %ld IDR pictures (%lld without a frame, %lld failed to decode), %.1f per second\n",
+			inStats.Thumbnails, inStats.Width, inStats.Height, inStats.Selected, inStats.IdrPictures,
+			inStats.Missing, inStats.Failed, seconds > 0 ? inStats.Thumbnails / seconds : 0.0);
+	fprintf(outFile, "  indexed in %.3f s, decoded in %.3f s, %.1f%% of the stream decoded\n",
+			inStats.IndexUs / 1000000.0, inStats.DecodeUs / 1000000.0,
+			inStats.StreamBytes > 0 ? 100.0 * inStats.BytesDecoded / inStats.StreamBytes : 0.0);
+}
+
+void ThumbnailExtractor::ReportDecoderStatistics( FILE* outFile )
+{
+	m_Session.ReportStatistics(outFile);
+}
@@ -0,0 +1,148 @@
+//------------------------------------------------------------------------------
+// File: ThumbnailExtractor.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Makes thumbnails of a whole elementary stream for indexing media
+// libraries. Only IDR access units are decoded, all of them or one every
+// so many seconds, each on its own; the decoder scales them down to the
+// thumbnail size as it outputs them, so no frame of the full size is
+// ever converted or copied.
+//
+//------------------------------------------------------------------------------
+
+#ifndef THUMBNAIL_EXTRACTOR_H_
+#define THUMBNAIL_EXTRACTOR_H_
+
+#include "DecodeSession.h"
+#include <stdio.h>
+
+#define THUMBNAIL_WIDTH				160		// When no size is set
+
+// Frame duration assumed when neither the SPS nor the caller give one,
+// in 100 ns units (25 fps)
+#define THUMBNAIL_DEFAULT_DURATION	400000
+
+// Why Extract made no thumbnail
+#define THUMBNAIL_ERROR_NONE		0
+#define THUMBNAIL_ERROR_NOT_OPEN	1
+#define THUMBNAIL_ERROR_INDEX		2	// Out of memory for the index
+#define THUMBNAIL_ERROR_NO_IDR		3	// No IDR picture in the stream
+#define THUMBNAIL_ERROR_DECODE		4	// No IDR picture gave a frame
+
+typedef struct
+{
+	long		IdrPictures;		// In the stream
+	long		Selected;			// To be decoded, after the interval
+	long long	Thumbnails;
+	long long	Missing;			// Selected but no frame came out
+	long long	Failed;				// Selected, the decoder refused their data
+	int			Width;
+	int			Height;
+	long long	StreamBytes;
+	long long	BytesDecoded;		// Handed to the decoder, parameter sets included
+	long long	IndexUs;
+	long long	DecodeUs;
+} ThumbnailStatistics;
+
+class ThumbnailExtractor : private FrameSink
+{
+public:
+
+	ThumbnailExtractor();
+	virtual ~ThumbnailExtractor();
+
+	// Even sizes. A height of 0 follows the display aspect ratio of the
+	// stream, a width of 0 uses THUMBNAIL_WIDTH.
+	void	SetThumbnailSize(int inWidth, int inHeight);
+
+	// One thumbnail per IDR picture at least inSeconds after the previous
+	// thumbnail, 0 for every IDR picture
+	void	SetInterval(double inSeconds);
+
+	// Of the source, in 100 ns units, for streams without timing in the SPS
+	void	SetFrameDuration(long long inDuration);
+
+	// The size a thumbnail of the sequence gets for the requested size
+	static void	GetThumbnailSize(const SequenceInfo& inSps, int inWidth, int inHeight,
+								 int* outWidth, int* outHeight);
+
+	// As DecodeSession::Open. The settings are used without decimation.
+	bool	Open(const DecoderSettings& settings, FrameSink* inSink, DecoderBackend* inBackend = NULL);
+	void	Close(void);
+
+	// Makes the thumbnails of a stream held in memory. They reach the sink
+	// from within the call, numbered and stamped as the IDR pictures in
+	// the stream, then OnEndOfStream. May be called for one stream after
+	// the other. False if the stream has no IDR picture or none decoded,
+	// GetError tells which.
+	bool	Extract(const unsigned char* inData, long long inSize);
+
+	// THUMBNAIL_ERROR_xxx, of the last Extract
+	int		GetError(void) const { return m_Error; }
+
+	void	GetStatistics(ThumbnailStatistics* outStats);
+	static void	Report(const ThumbnailStatistics& inStats, FILE* outFile);
+
+	// Of the session decoding the IDR pictures
+	void	ReportDecoderStatistics(FILE* outFile);
+
+private:
+
+	typedef struct
+	{
+		long long	Start;				// Of the access unit
+		long long	End;				// Of the next access unit, which holds the
+		long long	NextEnd;			// second field when the IDR picture is a field
+		long long	Picture;			// Pictures before it in the stream
+		long		Sps;				// Last parameter sets before it, -1 if none
+		long		Pps;
+	} IdrUnit;
+
+	typedef struct
+	{
+		long long	Offset;				// Of the start code
+		long		Length;
+		int			Type;
+	} ParameterSet;
+
+	bool	IndexStream(const unsigned char* inData, long long inSize);
+	bool	AddUnit(long long inStart, long long inPicture);
+	bool	AddParameterSet(long long inOffset, int inType);
+	long	FindParameterSet(int inType, long long inBefore);
+	bool	DecodeData(const unsigned char* inData, long long inSize);
+
+	// FrameSink, between the session and the user's sink
+	bool	OnFrame(const DecodedFrame& inFrame);
+	void	OnEndOfStream(void);
+
+private:
+
+	DecodeSession	m_Session;
+	FrameSink*		m_Sink;
+	bool			m_Open;
+	long			m_BufferSize;
+
+	int				m_Width;			// As requested
+	int				m_Height;
+	double			m_Interval;
+	long long		m_FrameDuration;
+
+	IdrUnit*		m_Units;
+	long			m_UnitCount;
+	long			m_UnitCapacity;
+	ParameterSet*	m_ParameterSets;
+	long			m_ParameterSetCount;
+	long			m_ParameterSetCapacity;
+
+	const IdrUnit*	m_Current;			// Being decoded
+	long long		m_Duration;			// Of the stream being decoded
+	long			m_FramesOut;		// Of the current unit
+	int				m_Error;
+
+	ThumbnailStatistics	m_Stats;
+};
+
+#endif
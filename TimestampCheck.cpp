@@ -0,0 +1,226 @@
+//------------------------------------------------------------------------------
+// File: TimestampCheck.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Checks that the decoder backends keep the timestamps of the data.
+// The access units of an Annex B file are pushed one per Decode call, as
+// TS PES packets, RTP access units and AVC1 samples arrive, each with its
+// own timestamp; optionally cut into pieces, the timestamp on the first.
+// Every timestamp must come out on exactly one frame, in decoding order
+// for the mock backend, in any order for the others.
+//
+//------------------------------------------------------------------------------
+
+#include "AccessUnitScanner.h"
+#include "DecoderBackend.h"
+#include "MappedFile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECK_FRAME_DURATION	400000	// 25 fps, in 100 ns units
+#define CHECK_BOUNDARIES		64
+
+class TimestampSink : public FrameSink
+{
+public:
+
+	TimestampSink(long inCapacity) : Count(0), Untimed(0), Capacity(inCapacity)
+	{
+		Timestamps = new long long[inCapacity];
+	}
+	virtual ~TimestampSink() { delete [] Timestamps; }
+
+	bool OnFrame(const DecodedFrame& inFrame)
+	{
+		if (inFrame.Timestamp == DECODE_NO_TIMESTAMP)
+			Untimed++;
+		else if (Count < Capacity)
+			Timestamps[Count++] = inFrame.Timestamp;
+		return true;
+	}
+
+	long long*	Timestamps;
+	long		Count;
+	long		Untimed;
+	long		Capacity;
+};
+
+static int CompareTimestamps( const void* inA, const void* inB )
+{
+	long long a = *(const long long*)inA;
+	long long b = *(const long long*)inB;
+	return a < b ? -1 : (a > b ? 1 : 0);
+}
+
+// The stream offsets where the access units start, the file size last
+static long SplitAccessUnits( const unsigned char* inData, long inLength, long** outStarts )
+{
+	AccessUnitScanner scanner;
+	long capacity = 1024;
+	long count = 0;
+	long* starts = (long*)malloc(capacity * sizeof(long));
+	starts[count++] = 0;
+
+	long offset = 0;
+	while (offset < inLength)
+	{
+		long long boundaries[CHECK_BOUNDARIES];
+		int found = 0;
+		offset += scanner.Scan(inData + offset, inLength - offset, boundaries, CHECK_BOUNDARIES, &found);
+		for (int i = 0; i < found; i++)
+		{
+			if (count + 1 >= capacity)
+			{
+				capacity *= 2;
+				starts = (long*)realloc(starts, capacity * sizeof(long));
+			}
+			if (boundaries[i] > starts[count - 1])
+				starts[count++] = (long)boundaries[i];
+		}
+	}
+	starts[count] = inLength;
+	*outStarts = starts;
+	return count;
+}
+
+static bool CheckBackend( int inBackend, const char* inName, const unsigned char* inData,
+						  const long* inStarts, long inUnits, long inPiece )
+{
+	DecoderBackend* backend = CreateDecoderBackend(inBackend);
+	if (backend == NULL)
+	{
+		printf("%s: not built in\n", inName);
+		return true;
+	}
+
+	// CUDADEC_DECODE_THREADS and the like apply
+	DecoderConfig config;
+	config.LoadFromEnvironment();
+	TimestampSink sink(inUnits * 2);
+	if (!backend->Init(config.Settings(), &sink, NULL))
+	{
+		// No device for it on this host
+		printf("%s: cannot start, not checked\n", inName);
+		delete backend;
+		return true;
+	}
+
+	for (long i = 0; i < inUnits; i++)
+	{
+		long long timestamp = (long long)(i + 1) * CHECK_FRAME_DURATION;
+		long offset = inStarts[i];
+		while (offset < inStarts[i + 1])
+		{
+			long length = inStarts[i + 1] - offset;
+			if (inPiece > 0 && length > inPiece)
+				length = inPiece;
+			backend->Decode(inData + offset, length, offset == inStarts[i] ? timestamp : DECODE_NO_TIMESTAMP);
+			offset += length;
+		}
+	}
+	backend->Decode(NULL, 0, DECODE_NO_TIMESTAMP);
+	delete backend;
+
+	bool ordered = (inBackend == DECODER_BACKEND_MOCK);
+	if (!ordered)
+		qsort(sink.Timestamps, sink.Count, sizeof(long long), CompareTimestamps);
+
+	long matched = 0;
+	while (matched < sink.Count && matched < inUnits &&
+		   sink.Timestamps[matched] == (long long)(matched + 1) * CHECK_FRAME_DURATION)
+	{
+		matched++;
+	}
+	bool passed = (matched == inUnits && sink.Count == inUnits && sink.Untimed == 0);
+	printf("%s: %s, %ld access units, %ld frames with their timestamp, %ld without\n",
+		   inName, passed ? "OK" : "Failed", inUnits, matched, sink.Untimed);
+	if (!passed && matched < sink.Count)
+	{
+		printf("  frame %ld %s %lld, expected %lld\n", matched, ordered ? "has" : "sorted has",
+			   sink.Timestamps[matched], (long long)(matched + 1) * CHECK_FRAME_DURATION);
+	}
+	return passed;
+}
+
+static void PrintUsage( void )
+{
+	printf("Usage: TimestampCheck [options] <input.264>\n"
+		   "  -b cuda|mock|software  Backend to check (default all built in)\n"
+		   "  -c <bytes>             Cut the access units into pieces (default whole)\n"
+		   "The stream should have one frame per access unit.\n");
+}
+
+int main( int argc, char* argv[] )
+{
+	int			backend = -1;
+	long		piece = 0;
+	const char*	input = NULL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		if (arg[0] != '-')
+		{
+			input = arg;
+			continue;
+		}
+		if (arg[1] == '\0' || arg[2] != '\0' || i + 1 >= argc)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		const char* value = argv[++i];
+		switch (arg[1])
+		{
+		case 'b':
+			if (strcmp(value, "cuda") == 0)
+				backend = DECODER_BACKEND_CUDA;
+			else if (strcmp(value, "mock") == 0)
+				backend = DECODER_BACKEND_MOCK;
+			else if (strcmp(value, "software") == 0)
+				backend = DECODER_BACKEND_SOFTWARE;
+			else
+			{
+				PrintUsage();
+				return 1;
+			}
+			break;
+		case 'c':
+			piece = atol(value);
+			break;
+		default:
+			PrintUsage();
+			return 1;
+		}
+	}
+	if (input == NULL || piece < 0)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	MappedFile file;
+	if (!file.Open(input))
+	{
+		printf("Cannot open %s\n", input);
+		return 1;
+	}
+	long* starts = NULL;
+	long units = SplitAccessUnits(file.Data(), (long)file.Size(), &starts);
+
+	static const char* names[] = { "cuda", "mock", "software" };
+	bool passed = true;
+	for (int type = DECODER_BACKEND_CUDA; type <= DECODER_BACKEND_SOFTWARE; type++)
+	{
+		if (backend < 0 || backend == type)
+			passed = CheckBackend(type, names[type], file.Data(), starts, units, piece) && passed;
+	}
+
+	free(starts);
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,240 @@
+//------------------------------------------------------------------------------
+// File: Trace.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Scoped trace points for the decoding path. Events are kept in
+// per-thread lock-free ring buffers with TSC timestamps and can be
+// dumped as Chrome trace-event JSON (chrome://tracing, Perfetto).
+// Build with USE_TRACING=1 to enable, otherwise trace points compile
+// to nothing.
+//
+//------------------------------------------------------------------------------
+
+#include "Trace.h"
+
+#if USE_TRACING
+
+#include "AtomicOps.h"
+#include "PerfTimer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+typedef struct
+{
+	const char*			Name;
+	unsigned long long	Start;
+	unsigned long long	End;
+} TraceEvent;
+
+// Written by its thread only. Count is published after the event, so a
+// reader sees every event below it unless the ring has overwritten it.
+typedef struct TraceBuffer
+{
+	TraceEvent			Events[TRACE_BUFFER_EVENTS];
+	volatile unsigned long	Count;
+	volatile long		Full;			// The ring has wrapped at least once
+	unsigned long		ThreadId;
+	struct TraceBuffer*	Next;
+} TraceBuffer;
+
+// Buffers are only added, never freed, so a dump can still show threads
+// that have exited. The lock is only taken to register a thread or dump.
+static TraceBuffer*			traceBuffers = NULL;
+static volatile long		traceLock = 0;
+
+// Taken when the module is loaded, before any trace point can start
+static unsigned long long	traceBaseTsc = TraceTimestamp();
+static long long			traceBaseUs = PerfTimeUs();
+
+#ifdef _WIN32
+// TlsAlloc rather than __declspec(thread), which does not work in a DLL
+// loaded with LoadLibrary on Windows XP
+static DWORD				traceTlsIndex = TlsAlloc();
+#else
+static __thread TraceBuffer*	traceThreadBuffer = NULL;
+#endif
+
+static void LockRegistry( void )
+{
+	while (AtomicCompareExchange(&traceLock, 1, 0) != 0)
+	{
+#ifdef _WIN32
+		Sleep(0);
+#else
+		sched_yield();
+#endif
+	}
+}
+
+static void UnlockRegistry( void )
+{
+	WRITE_FENCE();
+	traceLock = 0;
+}
+
+static unsigned long CurrentThreadId( void )
+{
+#if defined(_WIN32)
+	return GetCurrentThreadId();
+#elif defined(__linux__)
+	return (unsigned long)syscall(SYS_gettid);
+#else
+	return (unsigned long)pthread_self();
+#endif
+}
+
+static TraceBuffer* RegisterThread( void )
+{
+	TraceBuffer* buffer = (TraceBuffer*)calloc(1, sizeof(TraceBuffer));
+	if (buffer == NULL)
+		return NULL;
+
+	buffer->ThreadId = CurrentThreadId();
+
+	LockRegistry();
+	buffer->Next = traceBuffers;
+	traceBuffers = buffer;
+	UnlockRegistry();
+
+	return buffer;
+}
+
+static inline TraceBuffer* GetThreadBuffer( void )
+{
+#ifdef _WIN32
+	TraceBuffer* buffer = (TraceBuffer*)TlsGetValue(traceTlsIndex);
+	if (buffer == NULL)
+	{
+		buffer = RegisterThread();
+		TlsSetValue(traceTlsIndex, buffer);
+	}
+	return buffer;
+#else
+	if (traceThreadBuffer == NULL)
+		traceThreadBuffer = RegisterThread();
+	return traceThreadBuffer;
+#endif
+}
+
+void TraceRecord( const char* inName, unsigned long long inStart, unsigned long long inEnd )
+{
+	TraceBuffer* buffer = GetThreadBuffer();
+	if (buffer == NULL)
+		return;
+
+	unsigned long index = buffer->Count;
+	TraceEvent& event = buffer->Events[index & (TRACE_BUFFER_EVENTS - 1)];
+	event.Name  = inName;
+	event.Start = inStart;
+	event.End   = inEnd;
+	if (index == TRACE_BUFFER_EVENTS - 1)
+		buffer->Full = 1;
+
+	WRITE_FENCE();
+	buffer->Count = index + 1;
+}
+
+// Copies the events still valid after the copy, oldest first
+static unsigned long CopyEvents( const TraceBuffer* inBuffer, TraceEvent* outEvents )
+{
+	unsigned long before = inBuffer->Count;
+	READ_FENCE();
+	bool full = (inBuffer->Full != 0);
+	unsigned long available = full ? TRACE_BUFFER_EVENTS : before;
+	unsigned long first = before - available;
+
+	for (unsigned long i=0; i<available; i++)
+	{
+		outEvents[i] = inBuffer->Events[(first + i) & (TRACE_BUFFER_EVENTS - 1)];
+	}
+
+	READ_FENCE();
+	unsigned long overwritten = inBuffer->Count - before;
+	// Once wrapped, the slot at first is the one the next event goes to,
+	// and it may have been half written while Count was still before
+	if (full)
+		overwritten++;
+	if (overwritten >= available)
+		return 0;
+
+	// The oldest events may have been replaced while copying
+	memmove(outEvents, outEvents + overwritten, (available - overwritten) * sizeof(TraceEvent));
+	return available - overwritten;
+}
+
+bool TraceDumpChromeJson( const char* inPath )
+{
+	FILE* file = fopen(inPath, "w");
+	if (file == NULL)
+	{
+		printf("Cannot open trace file %s\n", inPath);
+		return false;
+	}
+
+	TraceEvent* events = (TraceEvent*)malloc(TRACE_BUFFER_EVENTS * sizeof(TraceEvent));
+	if (events == NULL)
+	{
+		fclose(file);
+		return false;
+	}
+
+	LockRegistry();
+
+	// Ticks per microsecond, measured since the module was loaded
+	double ticksPerUs = 0;
+	long long elapsedUs = PerfTimeUs() - traceBaseUs;
+	if (elapsedUs > 0)
+		ticksPerUs = (double)(TraceTimestamp() - traceBaseTsc) / elapsedUs;
+	if (ticksPerUs <= 0)
+		ticksPerUs = 1;
+
+	fprintf(file, "{\"traceEvents\":[\n");
+	bool firstEvent = true;
+	for (TraceBuffer* buffer = traceBuffers; buffer != NULL; buffer = buffer->Next)
+	{
+		unsigned long count = CopyEvents(buffer, events);
+		for (unsigned long i=0; i<count; i++)
+		{
+			const TraceEvent& event = events[i];
+			fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,\"ts\":%.3f,\"dur\":%.3f}",
+					firstEvent ? "" : ",\n", event.Name, buffer->ThreadId,
+					(double)(long long)(event.Start - traceBaseTsc) / ticksPerUs,
+					(double)(event.End - event.Start) / ticksPerUs);
+			firstEvent = false;
+		}
+	}
+	fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+	UnlockRegistry();
+
+	free(events);
+	bool succeeded = (ferror(file) == 0);
+	if (fclose(file) != 0)
+		succeeded = false;
+	return succeeded;
+}
+
+#else
+
+bool TraceDumpChromeJson( const char* inPath )
+{
+	(void)inPath;
+	return false;
+}
+
+#endif
@@ -0,0 +1,75 @@
+//------------------------------------------------------------------------------
+// File: Trace.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Scoped trace points for the decoding path. Events are kept in
+// per-thread lock-free ring buffers with TSC timestamps and can be
+// dumped as Chrome trace-event JSON (chrome://tracing, Perfetto).
+// Build with USE_TRACING=1 to enable, otherwise trace points compile
+// to nothing.
+//
+//------------------------------------------------------------------------------
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#ifndef USE_TRACING
+#define USE_TRACING				0
+#endif
+
+// Events kept per thread, must be a power of two
+#define TRACE_BUFFER_EVENTS		8192
+
+#define TRACE_CONCAT_(a, b)		a##b
+#define TRACE_CONCAT(a, b)		TRACE_CONCAT_(a, b)
+
+#if USE_TRACING
+// inName must be a string literal, only the pointer is recorded
+#define TRACE_SCOPE(inName)		TraceScope TRACE_CONCAT(traceScope, __LINE__)(inName)
+#else
+#define TRACE_SCOPE(inName)
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+// CPU ticks, converted to microseconds against PerfTimeUs when dumping.
+// Assumes an invariant TSC, as on all current x86 processors.
+inline unsigned long long TraceTimestamp(void)
+{
+#if defined(_MSC_VER) || defined(__i386__) || defined(__x86_64__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+void	TraceRecord(const char* inName, unsigned long long inStart, unsigned long long inEnd);
+
+// Writes the events of all threads as Chrome trace-event JSON. Events
+// recorded while dumping may be missing. False if tracing is compiled out
+// or the file cannot be written.
+bool	TraceDumpChromeJson(const char* inPath);
+
+class TraceScope
+{
+public:
+	TraceScope(const char* inName) : m_Name(inName), m_Start(TraceTimestamp()) {}
+	~TraceScope() { TraceRecord(m_Name, m_Start, TraceTimestamp()); }
+
+private:
+	const char*			m_Name;
+	unsigned long long	m_Start;
+};
+
+#endif
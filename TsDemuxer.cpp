@@ -0,0 +1,577 @@
+//------------------------------------------------------------------------------
+// File: TsDemuxer.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: MPEG-2 transport stream input for a decode session.
+//
+// Whole packets are taken where the caller holds them; only a packet cut
+// by the end of a Push is put together in m_Partial. The PAT names the
+// PMT of the program, the PMT the PID of its H.264 stream; both are
+// checked against their CRC and taken again when their version changes.
+//
+// The payload of each PES packet of the video PID is copied once, from
+// the TS packets into room reserved in the cache, which grows packet by
+// packet. The PES packet ends when its PES_packet_length is reached or,
+// for unbounded ones, when the next begins; only then is it committed,
+// with its PTS extended past the 33-bit wrap and counted in 100 ns units
+// from the first. A PES packet missing a TS packet, or with one flagged
+// by the tuner or scrambled, is dropped as a whole.
+//
+//------------------------------------------------------------------------------
+
+#include "TsDemuxer.h"
+#include "DecodeSession.h"
+#include "PerfTimer.h"
+#include "Trace.h"
+#include <string.h>
+
+#define TS_PAT_PID			0x0000
+#define TS_NULL_PID			0x1fff
+#define TS_TABLE_PAT		0x00
+#define TS_TABLE_PMT		0x02
+#define TS_PTS_MASK			((1LL << 33) - 1)
+#define TS_SYNC_CHECK		3		// Packets IsTransportStream looks at
+
+TsDemuxer::TsDemuxer() :	m_Session(NULL),
+							m_Program(0),
+							m_DecodeInline(false),
+							m_PartialLength(0),
+							m_InSync(false),
+							m_ProgramNumber(-1),
+							m_PmtPid(-1),
+							m_PmtVersion(-1),
+							m_VideoPid(-1),
+							m_SectionPid(-1),
+							m_SectionLength(0),
+							m_Continuity(-1),
+							m_InPes(false),
+							m_PesBroken(false),
+							m_PesLength(0),
+							m_PesReserved(false),
+							m_PesRemaining(-1),
+							m_PesTimestamp(DECODE_NO_TIMESTAMP),
+							m_PtsKnown(false),
+							m_LastPts(0),
+							m_ExtendedPts(0)
+{
+	memset(&m_Stats, 0, sizeof(m_Stats));
+	m_Stats.ProgramNumber = -1;
+	m_Stats.VideoPid = -1;
+}
+
+TsDemuxer::~TsDemuxer()
+{
+	this->Close();
+}
+
+bool TsDemuxer::Open( DecodeSession* inSession, int inProgram, bool inDecodeInline )
+{
+	if (inSession == NULL)
+	{
+		return false;
+	}
+
+	m_Session = inSession;
+	m_Program = inProgram;
+	m_DecodeInline = inDecodeInline;
+	m_ProgramNumber = -1;
+	m_PmtPid = -1;
+	m_PmtVersion = -1;
+	m_VideoPid = -1;
+	m_PtsKnown = false;
+	m_ExtendedPts = 0;
+
+	memset(&m_Stats, 0, sizeof(m_Stats));
+	m_Stats.ProgramNumber = -1;
+	m_Stats.VideoPid = -1;
+	this->Reset();
+	return true;
+}
+
+void TsDemuxer::Close( void )
+{
+	this->Reset();
+	m_Session = NULL;
+}
+
+void TsDemuxer::Reset( void )
+{
+	if (m_PesReserved)
+	{
+		m_Session->EndPush(0);
+	}
+	m_InPes = false;
+	m_PesReserved = false;
+	m_PesLength = 0;
+	m_PartialLength = 0;
+	m_InSync = false;
+	m_SectionPid = -1;
+	m_SectionLength = 0;
+	m_Continuity = -1;
+}
+
+void TsDemuxer::Push( const unsigned char* inData, long inLength )
+{
+	if (m_Session == NULL)
+	{
+		return;
+	}
+
+	TRACE_SCOPE("TsDemuxer::Push");
+	long long start = PerfTimeUs();
+	m_Stats.Bytes += inLength;
+
+	// The packet the previous Push ended in
+	if (m_PartialLength > 0)
+	{
+		long length = TS_PACKET_SIZE - m_PartialLength;
+		if (length > inLength)
+			length = inLength;
+		memcpy(m_Partial + m_PartialLength, inData, length);
+		m_PartialLength += length;
+		inData += length;
+		inLength -= length;
+
+		if (m_PartialLength == TS_PACKET_SIZE)
+		{
+			m_PartialLength = 0;
+			if (m_Partial[0] == TS_SYNC_BYTE)
+				this->OnPacket(m_Partial);
+			else
+				m_Stats.SkippedBytes += TS_PACKET_SIZE;
+		}
+	}
+
+	// Out of sync, a packet is only taken if the next one starts with a
+	// sync byte too, as far as it can be seen
+	while (inLength >= TS_PACKET_SIZE)
+	{
+		if (inData[0] != TS_SYNC_BYTE ||
+			(!m_InSync && inLength > TS_PACKET_SIZE && inData[TS_PACKET_SIZE] != TS_SYNC_BYTE))
+		{
+			if (m_InSync)
+			{
+				m_InSync = false;
+				m_Stats.SyncLosses++;
+				m_PesBroken = true;
+				m_Continuity = -1;
+			}
+			m_Stats.SkippedBytes++;
+			inData++;
+			inLength--;
+			continue;
+		}
+		m_InSync = true;
+		this->OnPacket(inData);
+		inData += TS_PACKET_SIZE;
+		inLength -= TS_PACKET_SIZE;
+	}
+
+	if (inLength > 0)
+	{
+		memcpy(m_Partial, inData, inLength);
+		m_PartialLength = inLength;
+	}
+	m_Stats.PushUs += PerfTimeUs() - start;
+}
+
+void TsDemuxer::Finish( void )
+{
+	if (m_Session)
+	{
+		long long start = PerfTimeUs();
+		this->EndPes();
+		m_PartialLength = 0;
+		m_Stats.PushUs += PerfTimeUs() - start;
+	}
+}
+
+void TsDemuxer::OnPacket( const unsigned char* inPacket )
+{
+	m_Stats.Packets++;
+
+	int pid = ((inPacket[1] & 0x1f) << 8) | inPacket[2];
+	bool error = (inPacket[1] & 0x80) != 0;
+	bool unitStart = (inPacket[1] & 0x40) != 0;
+	int scrambling = inPacket[3] >> 6;
+	int adaptation = (inPacket[3] >> 4) & 0x03;
+	int continuity = inPacket[3] & 0x0f;
+
+	if (pid == TS_NULL_PID)
+	{
+		return;
+	}
+
+	long payload = 4;
+	bool discontinuity = false;
+	if (adaptation & 0x02)
+	{
+		payload = 5 + inPacket[4];
+		discontinuity = inPacket[4] > 0 && (inPacket[5] & 0x80);
+	}
+	bool hasPayload = (adaptation & 0x01) && payload < TS_PACKET_SIZE;
+
+	if (pid != m_VideoPid)
+	{
+		if (!error && hasPayload && (pid == TS_PAT_PID || pid == m_PmtPid))
+			this->OnSection(pid, inPacket + payload, TS_PACKET_SIZE - payload, unitStart);
+		return;
+	}
+
+	if (error)
+	{
+		m_Stats.TransportErrors++;
+		m_PesBroken = true;
+		return;
+	}
+
+	// The counter only moves with a payload; a packet may be sent twice
+	if (adaptation & 0x01)
+	{
+		if (m_Continuity >= 0 && !discontinuity)
+		{
+			if (continuity == m_Continuity)
+			{
+				return;
+			}
+			if (continuity != ((m_Continuity + 1) & 0x0f))
+			{
+				m_Stats.ContinuityErrors++;
+				m_PesBroken = true;
+			}
+		}
+		m_Continuity = continuity;
+	}
+
+	if (scrambling)
+	{
+		m_Stats.Scrambled++;
+		m_PesBroken = true;
+		return;
+	}
+	if (!hasPayload)
+	{
+		return;
+	}
+
+	if (unitStart)
+	{
+		this->EndPes();
+		this->StartPes(inPacket + payload, TS_PACKET_SIZE - payload);
+	}
+	else if (m_InPes)
+	{
+		this->AppendPes(inPacket + payload, TS_PACKET_SIZE - payload);
+	}
+}
+
+// Gathers the sections of inPid; one may end and the next begin in the
+// same packet
+void TsDemuxer::OnSection( int inPid, const unsigned char* inPayload, long inLength, bool inUnitStart )
+{
+	if (inUnitStart)
+	{
+		long pointer = inPayload[0];
+		if (1 + pointer > inLength)
+		{
+			m_Stats.SectionErrors++;
+			m_SectionPid = -1;
+			return;
+		}
+
+		// The end of the section before
+		if (m_SectionPid == inPid && pointer > 0 && m_SectionLength + pointer <= TS_MAX_SECTION)
+		{
+			memcpy(m_Section + m_SectionLength, inPayload + 1, pointer);
+			m_SectionLength += pointer;
+			if (m_SectionLength >= 3)
+			{
+				long total = 3 + (((m_Section[1] & 0x0f) << 8) | m_Section[2]);
+				if (total <= m_SectionLength)
+					this->ParseSection(m_Section, total);
+			}
+		}
+		m_SectionPid = inPid;
+		m_SectionLength = 0;
+		inPayload += 1 + pointer;
+		inLength -= 1 + pointer;
+	}
+	else if (m_SectionPid != inPid)
+	{
+		return;
+	}
+
+	if (m_SectionLength + inLength > TS_MAX_SECTION)
+	{
+		inLength = TS_MAX_SECTION - m_SectionLength;
+	}
+	memcpy(m_Section + m_SectionLength, inPayload, inLength);
+	m_SectionLength += inLength;
+
+	while (m_SectionLength >= 3)
+	{
+		// The rest of the packet is stuffing
+		if (m_Section[0] == 0xff)
+		{
+			m_SectionPid = -1;
+			break;
+		}
+		long total = 3 + (((m_Section[1] & 0x0f) << 8) | m_Section[2]);
+		if (total > TS_MAX_SECTION)
+		{
+			m_Stats.SectionErrors++;
+			m_SectionPid = -1;
+			break;
+		}
+		if (total > m_SectionLength)
+		{
+			break;
+		}
+		this->ParseSection(m_Section, total);
+		m_SectionLength -= total;
+		memmove(m_Section, m_Section + total, m_SectionLength);
+	}
+}
+
+// CRC-32 of MPEG-2, over the section with its CRC it is 0. The tables are
+// short and rare, so it goes bit by bit.
+static unsigned int SectionCrc( const unsigned char* inData, long inLength )
+{
+	unsigned int crc = 0xffffffff;
+	for (long i = 0; i < inLength; i++)
+	{
+		crc ^= (unsigned int)inData[i] << 24;
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+	}
+	return crc;
+}
+
+void TsDemuxer::ParseSection( const unsigned char* inSection, long inLength )
+{
+	// Long form, current, with a CRC
+	if (inLength < 12 || !(inSection[1] & 0x80) || !(inSection[5] & 0x01) ||
+		SectionCrc(inSection, inLength) != 0)
+	{
+		m_Stats.SectionErrors++;
+		return;
+	}
+
+	if (inSection[0] == TS_TABLE_PAT && m_SectionPid == TS_PAT_PID)
+		this->ParsePat(inSection, inLength - 4);
+	else if (inSection[0] == TS_TABLE_PMT && m_SectionPid == m_PmtPid)
+		this->ParsePmt(inSection, inLength - 4);
+}
+
+void TsDemuxer::ParsePat( const unsigned char* inSection, long inLength )
+{
+	for (long offset = 8; offset + 4 <= inLength; offset += 4)
+	{
+		int program = (inSection[offset] << 8) | inSection[offset + 1];
+		int pid = ((inSection[offset + 2] & 0x1f) << 8) | inSection[offset + 3];
+
+		// Program 0 is the network information
+		if (program == 0 || (m_Program != 0 && program != m_Program))
+		{
+			continue;
+		}
+		if (pid != m_PmtPid)
+		{
+			m_ProgramNumber = program;
+			m_PmtPid = pid;
+			m_PmtVersion = -1;
+			m_Stats.ProgramNumber = program;
+		}
+		return;
+	}
+}
+
+void TsDemuxer::ParsePmt( const unsigned char* inSection, long inLength )
+{
+	int program = (inSection[3] << 8) | inSection[4];
+	int version = (inSection[5] >> 1) & 0x1f;
+	if (program != m_ProgramNumber || version == m_PmtVersion)
+	{
+		return;
+	}
+	m_PmtVersion = version;
+
+	int videoPid = -1;
+	long offset = 12 + (((inSection[10] & 0x0f) << 8) | inSection[11]);
+	while (offset + 5 <= inLength)
+	{
+		int type = inSection[offset];
+		int pid = ((inSection[offset + 1] & 0x1f) << 8) | inSection[offset + 2];
+		if (type == TS_STREAM_TYPE_H264)
+		{
+			videoPid = pid;
+			break;
+		}
+		offset += 5 + (((inSection[offset + 3] & 0x0f) << 8) | inSection[offset + 4]);
+	}
+
+	m_Stats.ProgramChanges++;
+	if (videoPid != m_VideoPid)
+	{
+		this->EndPes();
+		m_VideoPid = videoPid;
+		m_Continuity = -1;
+		m_Stats.VideoPid = videoPid;
+		if (videoPid < 0)
+			printf("Program %d carries no H.264 stream\n", program);
+	}
+}
+
+void TsDemuxer::StartPes( const unsigned char* inPayload, long inLength )
+{
+	m_PesBroken = false;
+	m_PesLength = 0;
+	m_PesTimestamp = DECODE_NO_TIMESTAMP;
+
+	// The optional header has to be in the first packet, as it always is
+	long header = inLength >= 9 ? 9 + inPayload[8] : 0;
+	if (inLength < 9 || inPayload[0] != 0 || inPayload[1] != 0 || inPayload[2] != 1 ||
+		(inPayload[6] & 0xc0) != 0x80 || header > inLength)
+	{
+		m_Stats.PesDropped++;
+		return;
+	}
+
+	long packetLength = (inPayload[4] << 8) | inPayload[5];
+	m_PesRemaining = packetLength > 0 ? packetLength - (header - 6) : -1;
+	if ((inPayload[7] & 0x80) && header >= 14)
+		m_PesTimestamp = this->TakePts(inPayload + 9);
+	else
+		m_Stats.PesWithoutPts++;
+
+	m_InPes = true;
+	this->AppendPes(inPayload + header, inLength - header);
+}
+
+void TsDemuxer::AppendPes( const unsigned char* inData, long inLength )
+{
+	if (m_PesBroken)
+	{
+		return;
+	}
+	if (m_PesRemaining >= 0 && inLength > m_PesRemaining)
+	{
+		inLength = m_PesRemaining;
+	}
+
+	if (inLength > 0)
+	{
+		unsigned char* room = m_Session->BeginPush(m_PesLength + inLength);
+		if (room == NULL)
+		{
+			m_PesBroken = true;
+			m_PesReserved = false;
+			return;
+		}
+		m_PesReserved = true;
+		memcpy(room + m_PesLength, inData, inLength);
+		m_PesLength += inLength;
+	}
+
+	if (m_PesRemaining >= 0)
+	{
+		m_PesRemaining -= inLength;
+		if (m_PesRemaining == 0)
+			this->EndPes();
+	}
+}
+
+void TsDemuxer::EndPes( void )
+{
+	if (!m_InPes)
+	{
+		return;
+	}
+	m_InPes = false;
+
+	long length = m_PesLength;
+	bool pushed = false;
+	if (!m_PesBroken && length > 0)
+	{
+		pushed = m_Session->EndPush(length, m_PesTimestamp);
+	}
+	else if (m_PesReserved)
+	{
+		m_Session->EndPush(0);
+	}
+	m_PesReserved = false;
+	m_PesLength = 0;
+
+	if (!pushed)
+	{
+		if (length > 0 || m_PesBroken)
+			m_Stats.PesDropped++;
+		return;
+	}
+	m_Stats.PesPackets++;
+	m_Stats.PayloadBytes += length;
+
+	if (m_DecodeInline)
+	{
+		long long start = PerfTimeUs();
+		m_Session->DecodeBytes(length);
+		m_Stats.DecodeUs += PerfTimeUs() - start;
+	}
+}
+
+// PTS in 90 kHz units, to 100 ns units from the first. PES packets come in
+// decoding order, so a PTS may go back; steps of less than half the 33-bit
+// range are taken either way.
+long long TsDemuxer::TakePts( const unsigned char* inPts )
+{
+	long long pts = ((long long)(inPts[0] & 0x0e) << 29) | ((long long)inPts[1] << 22) |
+					((long long)(inPts[2] & 0xfe) << 14) | ((long long)inPts[3] << 7) | (inPts[4] >> 1);
+
+	if (m_PtsKnown)
+	{
+		long long step = (pts - m_LastPts) & TS_PTS_MASK;
+		if (step > TS_PTS_MASK / 2)
+			step -= TS_PTS_MASK + 1;
+		m_ExtendedPts += step;
+	}
+	m_PtsKnown = true;
+	m_LastPts = pts;
+	return m_ExtendedPts * STREAM_TIME_UNITS / TS_PTS_CLOCK_RATE;
+}
+
+void TsDemuxer::GetStatistics( TsStatistics* outStats )
+{
+	*outStats = m_Stats;
+}
+
+void TsDemuxer::Report( const TsStatistics& inStats, FILE* outFile )
+{
+	double demuxSeconds = (inStats.PushUs - inStats.DecodeUs) / 1000000.0;
+	fprintf(outFile, "TS: %lld packets, %.1f MB, demuxed in %.3f s (%.1f MB/s, decoding aside)\n",
+			inStats.Packets, inStats.Bytes / 1048576.0, demuxSeconds,
+			demuxSeconds > 0 ? inStats.Bytes / 1048576.0 / demuxSeconds : 0.0);
+	fprintf(outFile, "  program %d, H.264 on PID %d; %lld PES packets, %.1f MB of payload, %lld dropped, %lld without a PTS\n",
+			inStats.ProgramNumber, inStats.VideoPid, inStats.PesPackets, inStats.PayloadBytes / 1048576.0,
+			inStats.PesDropped, inStats.PesWithoutPts);
+	fprintf(outFile, "  %ld sync losses (%lld bytes skipped), %ld transport errors, %ld continuity errors, "
+					 "%ld scrambled, %ld bad sections, %ld PMT versions\n",
+			inStats.SyncLosses, inStats.SkippedBytes, inStats.TransportErrors, inStats.ContinuityErrors,
+			inStats.Scrambled, inStats.SectionErrors, inStats.ProgramChanges);
+}
+
+bool TsDemuxer::IsTransportStream( const unsigned char* inData, long inLength )
+{
+	if (inLength < TS_PACKET_SIZE * TS_SYNC_CHECK)
+	{
+		return inLength >= TS_PACKET_SIZE && inData[0] == TS_SYNC_BYTE && inLength % TS_PACKET_SIZE == 0;
+	}
+	for (int i = 0; i < TS_SYNC_CHECK; i++)
+	{
+		if (inData[i * TS_PACKET_SIZE] != TS_SYNC_BYTE)
+			return false;
+	}
+	return true;
+}
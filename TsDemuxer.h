@@ -0,0 +1,127 @@
+//------------------------------------------------------------------------------
+// File: TsDemuxer.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: MPEG-2 transport stream input: finds the H.264 stream through the
+// PAT and PMT and writes the payload of its PES packets straight into the
+// input cache of a decode session, each with its PTS as the timestamp.
+//
+//------------------------------------------------------------------------------
+
+#ifndef TS_DEMUXER_H_
+#define TS_DEMUXER_H_
+
+#include <stdio.h>
+
+class DecodeSession;
+
+#define TS_PACKET_SIZE			188
+#define TS_SYNC_BYTE			0x47
+#define TS_MAX_SECTION			1024	// PAT and PMT sections, with their header
+#define TS_STREAM_TYPE_H264		0x1b
+#define TS_PTS_CLOCK_RATE		90000
+
+typedef struct
+{
+	long long	Packets;
+	long long	Bytes;				// Pushed
+	long long	SkippedBytes;		// Out of sync
+	long		SyncLosses;
+	long		TransportErrors;	// Video packets flagged by the tuner
+	long		ContinuityErrors;	// Video packets missing
+	long		Scrambled;
+	long		SectionErrors;		// PAT and PMT failing their CRC, or cut
+	long		ProgramChanges;		// PMT versions taking effect
+	int			ProgramNumber;		// -1 until found
+	int			VideoPid;
+	long long	PesPackets;			// Handed to the session
+	long long	PesDropped;			// Damaged or too large for the cache
+	long long	PesWithoutPts;
+	long long	PayloadBytes;
+	long long	PushUs;				// In Push and Finish
+	long long	DecodeUs;			// Of that, decoding inline
+} TsStatistics;
+
+class TsDemuxer
+{
+public:
+
+	TsDemuxer();
+	virtual ~TsDemuxer();
+
+	// The PES packets go to inSession, of program inProgram, or the first
+	// in the PAT if 0. With inDecodeInline each one is decoded in
+	// Push itself, for callers without a decoding thread.
+	bool	Open(DecodeSession* inSession, int inProgram = 0, bool inDecodeInline = false);
+	void	Close(void);
+
+	// Forgets the PES packet being written and the partial TS packet;
+	// call when the session is flushed. The program stays known.
+	void	Reset(void);
+
+	// Input thread. Takes transport stream data cut anywhere. May block
+	// while the cache is full.
+	void	Push(const unsigned char* inData, long inLength);
+
+	// The stream has ended: hands on the last PES packet
+	void	Finish(void);
+
+	bool	HasVideo(void) const { return m_VideoPid >= 0; }
+
+	// Input thread
+	void	GetStatistics(TsStatistics* outStats);
+	static void	Report(const TsStatistics& inStats, FILE* outFile);
+
+	// True if inData starts with a few packets' worth of sync bytes
+	static bool	IsTransportStream(const unsigned char* inData, long inLength);
+
+private:
+
+	void	OnPacket(const unsigned char* inPacket);
+	void	OnSection(int inPid, const unsigned char* inPayload, long inLength, bool inUnitStart);
+	void	ParseSection(const unsigned char* inSection, long inLength);
+	void	ParsePat(const unsigned char* inSection, long inLength);
+	void	ParsePmt(const unsigned char* inSection, long inLength);
+	void	StartPes(const unsigned char* inPayload, long inLength);
+	void	AppendPes(const unsigned char* inData, long inLength);
+	void	EndPes(void);
+	long long	TakePts(const unsigned char* inPts);
+
+private:
+
+	DecodeSession*	m_Session;
+	int				m_Program;
+	bool			m_DecodeInline;
+
+	unsigned char	m_Partial[TS_PACKET_SIZE];	// Packet cut by the end of a Push
+	long			m_PartialLength;
+	bool			m_InSync;
+
+	int				m_ProgramNumber;	// Taken from the PAT, -1 until then
+	int				m_PmtPid;
+	int				m_PmtVersion;
+	int				m_VideoPid;
+
+	int				m_SectionPid;		// Section being gathered, -1 if none
+	unsigned char	m_Section[TS_MAX_SECTION];
+	long			m_SectionLength;
+
+	int				m_Continuity;		// Of the video PID, -1 after a reset
+	bool			m_InPes;
+	bool			m_PesBroken;
+	long			m_PesLength;		// Written into the cache
+	bool			m_PesReserved;		// Room taken in the cache
+	long			m_PesRemaining;		// From PES_packet_length, -1 if unbounded
+	long long		m_PesTimestamp;
+
+	bool			m_PtsKnown;			// Extended to 64 bits from the first
+	long long		m_LastPts;
+	long long		m_ExtendedPts;
+
+	TsStatistics	m_Stats;
+};
+
+#endif
@@ -0,0 +1,187 @@
+//------------------------------------------------------------------------------
+// File: UdpSocket.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Blocking UDP socket, Winsock or BSD sockets, for receiving and
+// sending datagrams such as RTP packets.
+//
+//------------------------------------------------------------------------------
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#include "UdpSocket.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define INVALID_UDP_SOCKET	INVALID_SOCKET
+#define CloseSocket			closesocket
+#else
+#define INVALID_UDP_SOCKET	-1
+#define CloseSocket			close
+#endif
+
+UdpSocket::UdpSocket() :	m_Socket(INVALID_UDP_SOCKET),
+							m_Open(false)
+{
+}
+
+UdpSocket::~UdpSocket()
+{
+	this->Close();
+}
+
+bool UdpSocket::Create( void )
+{
+	this->Close();
+
+#ifdef _WIN32
+	// Counted by Winsock, undone in Close
+	WSADATA data;
+	if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+	{
+		printf("Winsock is not available\n");
+		return false;
+	}
+#endif
+
+	m_Socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (m_Socket == INVALID_UDP_SOCKET)
+	{
+		printf("Cannot create a UDP socket\n");
+#ifdef _WIN32
+		WSACleanup();
+#endif
+		return false;
+	}
+	m_Open = true;
+	return true;
+}
+
+bool UdpSocket::Bind( unsigned short inPort, long inBufferBytes )
+{
+	if (!this->Create())
+	{
+		return false;
+	}
+
+	if (inBufferBytes > 0)
+	{
+		int size = (int)inBufferBytes;
+		setsockopt(m_Socket, SOL_SOCKET, SO_RCVBUF, (const char*)&size, sizeof(size));
+	}
+
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(inPort);
+	if (bind(m_Socket, (const sockaddr*)&address, sizeof(address)) != 0)
+	{
+		printf("Cannot bind UDP port %u\n", inPort);
+		this->Close();
+		return false;
+	}
+	return true;
+}
+
+bool UdpSocket::Connect( const char* inHost, unsigned short inPort )
+{
+	if (!this->Create())
+	{
+		return false;
+	}
+
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = inet_addr(inHost);
+	address.sin_port = htons(inPort);
+	if (address.sin_addr.s_addr == INADDR_NONE ||
+		connect(m_Socket, (const sockaddr*)&address, sizeof(address)) != 0)
+	{
+		printf("Cannot send to %s:%u\n", inHost, inPort);
+		this->Close();
+		return false;
+	}
+	return true;
+}
+
+void UdpSocket::Close( void )
+{
+	if (m_Open)
+	{
+		CloseSocket(m_Socket);
+		m_Socket = INVALID_UDP_SOCKET;
+		m_Open = false;
+#ifdef _WIN32
+		WSACleanup();
+#endif
+	}
+}
+
+long UdpSocket::Receive( unsigned char* outData, long inCapacity, int inTimeoutMs )
+{
+	if (!m_Open)
+	{
+		return -1;
+	}
+
+	fd_set readable;
+	FD_ZERO(&readable);
+	FD_SET(m_Socket, &readable);
+	timeval timeout;
+	timeout.tv_sec = inTimeoutMs / 1000;
+	timeout.tv_usec = (inTimeoutMs % 1000) * 1000;
+
+	// The first argument is ignored by Winsock
+	int ready = select((int)m_Socket + 1, &readable, NULL, NULL, &timeout);
+	if (ready <= 0)
+	{
+#ifndef _WIN32
+		if (ready < 0 && errno == EINTR)
+			return 0;
+#endif
+		return ready == 0 ? 0 : -1;
+	}
+
+	int length = recv(m_Socket, (char*)outData, (int)inCapacity, 0);
+	if (length < 0)
+	{
+#ifdef _WIN32
+		// A datagram longer than the buffer, cut
+		if (WSAGetLastError() == WSAEMSGSIZE)
+			return inCapacity;
+		// ICMP port unreachable from an earlier send
+		if (WSAGetLastError() == WSAECONNRESET)
+			return 0;
+#else
+		if (errno == EINTR || errno == EAGAIN)
+			return 0;
+#endif
+		return -1;
+	}
+	return length;
+}
+
+bool UdpSocket::Send( const unsigned char* inData, long inLength )
+{
+	if (!m_Open)
+	{
+		return false;
+	}
+	return send(m_Socket, (const char*)inData, (int)inLength, 0) == inLength;
+}
@@ -0,0 +1,61 @@
+//------------------------------------------------------------------------------
+// File: UdpSocket.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Blocking UDP socket, Winsock or BSD sockets, for receiving and
+// sending datagrams such as RTP packets. The header leaves out the
+// socket headers, which on Windows must come before windows.h.
+//
+//------------------------------------------------------------------------------
+
+#ifndef UDP_SOCKET_H_
+#define UDP_SOCKET_H_
+
+#include <stddef.h>
+
+#ifdef _WIN32
+typedef size_t	UdpSocketHandle;		// SOCKET
+#else
+typedef int		UdpSocketHandle;
+#endif
+
+class UdpSocket
+{
+public:
+
+	UdpSocket();
+	virtual ~UdpSocket();
+
+	// Receives the datagrams sent to inPort on any interface. A receive
+	// buffer of inBufferBytes rides out bursts, 0 keeps the system's.
+	bool	Bind(unsigned short inPort, long inBufferBytes = 0);
+
+	// Sends to inHost (dotted IPv4) at inPort
+	bool	Connect(const char* inHost, unsigned short inPort);
+	void	Close(void);
+
+	bool	IsOpen(void) const { return m_Open; }
+
+	// The length of the next datagram copied to outData, 0 if none came
+	// within inTimeoutMs, -1 on errors. Longer datagrams are cut.
+	long	Receive(unsigned char* outData, long inCapacity, int inTimeoutMs);
+
+	bool	Send(const unsigned char* inData, long inLength);
+
+private:
+
+	UdpSocket(const UdpSocket&);
+	UdpSocket& operator=(const UdpSocket&);
+
+	bool	Create(void);
+
+private:
+
+	UdpSocketHandle	m_Socket;
+	bool			m_Open;
+};
+
+#endif
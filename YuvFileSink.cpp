@@ -0,0 +1,477 @@
+//------------------------------------------------------------------------------
+// File: YuvFileSink.cpp
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Frame sink writing the decoded frames to a file, as raw I420,
+// raw NV12 or a YUV4MPEG2 (Y4M) stream. The frames are copied into a
+// bounded queue of large blocks written by an I/O thread, unbuffered
+// where the file system allows, so the decoding thread only waits for
+// the disk when the queue is full.
+//
+//------------------------------------------------------------------------------
+
+#include "YuvFileSink.h"
+#include "PerfTimer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+YuvFileSink::YuvFileSink() :	m_Format(YUV_FORMAT_I420),
+								m_RateNumerator(25),
+								m_RateDenominator(1),
+								m_SarWidth(0),
+								m_SarHeight(0),
+								m_Width(0),
+								m_Height(0),
+								m_Interleaved(NULL),
+								m_InterleavedSize(0),
+								m_Blocks(NULL),
+								m_BlockCount(0),
+								m_FillIndex(0),
+								m_Filling(false),
+								m_WriteIndex(0),
+								m_FreeBlocks(NULL),
+								m_FullBlocks(NULL),
+								m_Submitted(0),
+								m_Completed(0),
+								m_Failed(false),
+#ifdef _WIN32
+								m_File(INVALID_HANDLE_VALUE),
+#else
+								m_File(-1),
+#endif
+								m_Unbuffered(false),
+								m_BlockedUs(0),
+								m_BytesWritten(0),
+								m_Writes(0),
+								m_WriteUs(0)
+{
+}
+
+YuvFileSink::~YuvFileSink()
+{
+	this->Close();
+}
+
+bool YuvFileSink::Open( const char* inPath, int inFormat, int inQueueBlocks )
+{
+	this->Close();
+
+	if (inQueueBlocks < 2)
+		inQueueBlocks = 2;
+
+	if (!this->OpenOutput(inPath))
+	{
+		printf("Cannot create %s\n", inPath);
+		return false;
+	}
+
+	m_Blocks = new WriteBlock[inQueueBlocks];
+	m_BlockCount = inQueueBlocks;
+	memset(m_Blocks, 0, sizeof(WriteBlock) * m_BlockCount);
+	for (int i = 0; i < m_BlockCount; i++)
+	{
+		m_Blocks[i].Data = (unsigned char*)PlatformAlignedAlloc(YUV_WRITE_BLOCK, YUV_WRITE_ALIGN);
+		if (m_Blocks[i].Data == NULL)
+		{
+			printf("Cannot allocate the write queue\n");
+			this->Close();
+			return false;
+		}
+	}
+
+	m_FreeBlocks = new PlatformSemaphore(m_BlockCount);
+	m_FullBlocks = new PlatformSemaphore(0);
+	m_FillIndex = 0;
+	m_WriteIndex = 0;
+	m_Filling = false;
+	m_Submitted = 0;
+	m_Completed = 0;
+	m_Failed = false;
+
+	m_Format = inFormat;
+	m_Width = 0;
+	m_Height = 0;
+	m_BlockedUs = 0;
+	m_BytesWritten = 0;
+	m_Writes = 0;
+	m_WriteUs = 0;
+
+	if (!m_Writer.Start(WriterThread, this))
+	{
+		printf("Cannot start the writer thread\n");
+		this->Close();
+		return false;
+	}
+	return true;
+}
+
+void YuvFileSink::Close( void )
+{
+	// The block being filled goes last, even empty, to stop the I/O thread
+	if (m_Writer.IsRunning())
+	{
+		if (m_Filling || this->AcquireBlock())
+		{
+			this->SubmitBlock(true);
+		}
+		m_Writer.Join();
+	}
+
+	this->CloseOutput();
+
+	if (m_Blocks)
+	{
+		for (int i = 0; i < m_BlockCount; i++)
+			PlatformAlignedFree(m_Blocks[i].Data);
+		delete [] m_Blocks;
+		m_Blocks = NULL;
+	}
+	m_BlockCount = 0;
+
+	delete m_FreeBlocks;
+	m_FreeBlocks = NULL;
+	delete m_FullBlocks;
+	m_FullBlocks = NULL;
+
+	free(m_Interleaved);
+	m_Interleaved = NULL;
+	m_InterleavedSize = 0;
+}
+
+void YuvFileSink::SetFrameRate( unsigned int inNumerator, unsigned int inDenominator )
+{
+	if (inNumerator > 0 && inDenominator > 0)
+	{
+		// 50:2 from the VUI is written as 25:1
+		unsigned int a = inNumerator, b = inDenominator;
+		while (b != 0)
+		{
+			unsigned int r = a % b;
+			a = b;
+			b = r;
+		}
+		m_RateNumerator = inNumerator / a;
+		m_RateDenominator = inDenominator / a;
+	}
+}
+
+void YuvFileSink::SetAspectRatio( int inWidth, int inHeight )
+{
+	m_SarWidth = inWidth;
+	m_SarHeight = inHeight;
+}
+
+void YuvFileSink::GetStatistics( YuvWriteStatistics* outStats ) const
+{
+	outStats->BytesWritten = m_BytesWritten;
+	outStats->Writes = m_Writes;
+	outStats->WriteUs = m_WriteUs;
+	outStats->BlockedUs = m_BlockedUs;
+	outStats->WriteMBps = m_WriteUs > 0 ? m_BytesWritten / 1048576.0 / (m_WriteUs / 1000000.0) : 0.0;
+	outStats->Unbuffered = m_Unbuffered;
+}
+
+bool YuvFileSink::OnFrame( const DecodedFrame& inFrame )
+{
+	if (!m_Writer.IsRunning() || m_Failed)
+		return false;
+
+	if (m_Width == 0)
+	{
+		m_Width = inFrame.Width;
+		m_Height = inFrame.Height;
+
+		if (m_Format == YUV_FORMAT_Y4M)
+		{
+			// Always marked progressive, whatever DeinterlaceMode. 0:0 is an unknown aspect ratio
+			char header[128];
+			int length = sprintf(header, "YUV4MPEG2 W%d H%d F%u:%u Ip A%d:%d C420mpeg2\n",
+								 m_Width, m_Height, m_RateNumerator, m_RateDenominator,
+								 m_SarWidth, m_SarHeight);
+			if (!this->Append((const unsigned char*)header, length))
+				return false;
+		}
+	}
+	else if (inFrame.Width != m_Width || inFrame.Height != m_Height)
+	{
+		if (m_Format == YUV_FORMAT_Y4M)
+		{
+			printf("Frame size changed to %dx%d, Y4M output stays %dx%d: frame dropped\n",
+				   inFrame.Width, inFrame.Height, m_Width, m_Height);
+			return false;
+		}
+		printf("Frame size changed from %dx%d to %dx%d\n", m_Width, m_Height, inFrame.Width, inFrame.Height);
+		m_Width = inFrame.Width;
+		m_Height = inFrame.Height;
+	}
+
+	if (m_Format == YUV_FORMAT_Y4M)
+	{
+		if (!this->Append((const unsigned char*)"FRAME\n", 6))
+			return false;
+	}
+
+	if (m_Format != YUV_FORMAT_NV12)
+	{
+		return this->Append(inFrame.Data, inFrame.Size);
+	}
+
+	// NV12: the planar U and V are interleaved into one plane
+	long lumaSize = (long)inFrame.Width * inFrame.Height;
+	long chromaSize = (inFrame.Size - lumaSize) / 2;
+
+	if (m_InterleavedSize < chromaSize * 2)
+	{
+		free(m_Interleaved);
+		m_Interleaved = (unsigned char*)malloc(chromaSize * 2);
+		m_InterleavedSize = m_Interleaved ? chromaSize * 2 : 0;
+		if (m_Interleaved == NULL)
+			return false;
+	}
+
+	const unsigned char* u = inFrame.Data + lumaSize;
+	const unsigned char* v = u + chromaSize;
+	for (long i = 0; i < chromaSize; i++)
+	{
+		m_Interleaved[2 * i] = u[i];
+		m_Interleaved[2 * i + 1] = v[i];
+	}
+
+	return this->Append(inFrame.Data, lumaSize) &&
+		   this->Append(m_Interleaved, chromaSize * 2);
+}
+
+void YuvFileSink::OnEndOfStream( void )
+{
+	// The partial block stays, unbuffered writes cannot end in the middle of a sector
+	while (m_Completed != m_Submitted)
+	{
+		PlatformSleep(1);
+	}
+}
+
+// Decoding thread. Copies into the blocks, handing each one to the I/O
+// thread when it is full.
+bool YuvFileSink::Append( const unsigned char* inData, long inLength )
+{
+	while (inLength > 0)
+	{
+		if (!m_Filling && !this->AcquireBlock())
+			return false;
+
+		WriteBlock& block = m_Blocks[m_FillIndex];
+		long length = YUV_WRITE_BLOCK - block.Used;
+		if (length > inLength)
+			length = inLength;
+
+		memcpy(block.Data + block.Used, inData, length);
+		block.Used += length;
+		inData += length;
+		inLength -= length;
+
+		if (block.Used == YUV_WRITE_BLOCK)
+			this->SubmitBlock(false);
+	}
+	return !m_Failed;
+}
+
+bool YuvFileSink::AcquireBlock( void )
+{
+	if (!m_FreeBlocks->TryWait())
+	{
+		long long start = PerfTimeUs();
+		m_FreeBlocks->Wait();
+		m_BlockedUs += PerfTimeUs() - start;
+	}
+
+	WriteBlock& block = m_Blocks[m_FillIndex];
+	block.Used = 0;
+	block.Last = false;
+	m_Filling = true;
+	return true;
+}
+
+void YuvFileSink::SubmitBlock( bool inLast )
+{
+	m_Blocks[m_FillIndex].Last = inLast;
+	m_FillIndex = (m_FillIndex + 1) % m_BlockCount;
+	m_Filling = false;
+	m_Submitted++;
+	m_FullBlocks->Post();
+}
+
+void YuvFileSink::WriterThread( void* inThis )
+{
+	((YuvFileSink*)inThis)->WriteBlocks();
+}
+
+// I/O thread. Writes the blocks in order; after a failure they are only
+// handed back, so the decoding thread never waits for good.
+void YuvFileSink::WriteBlocks( void )
+{
+	bool padded = false;
+
+	for (;;)
+	{
+		m_FullBlocks->Wait();
+
+		WriteBlock& block = m_Blocks[m_WriteIndex];
+		bool last = block.Last;
+
+		if (!m_Failed && block.Used > 0)
+		{
+			// Only the last block can be partial. Its padding is cut off below.
+			long length = block.Used;
+			if (m_Unbuffered && (length % YUV_WRITE_ALIGN) != 0)
+			{
+				length = (length + YUV_WRITE_ALIGN - 1) / YUV_WRITE_ALIGN * YUV_WRITE_ALIGN;
+				memset(block.Data + block.Used, 0, length - block.Used);
+				padded = true;
+			}
+
+			long long start = PerfTimeUs();
+			if (this->WriteOutput(block.Data, length))
+			{
+				m_BytesWritten += block.Used;
+				m_Writes++;
+			}
+			else
+			{
+				printf("Write failed after %lld bytes\n", m_BytesWritten);
+				m_Failed = true;
+			}
+			m_WriteUs += PerfTimeUs() - start;
+		}
+
+		m_WriteIndex = (m_WriteIndex + 1) % m_BlockCount;
+		m_Completed++;
+		m_FreeBlocks->Post();
+
+		if (last)
+			break;
+	}
+
+	if (padded && !m_Failed)
+	{
+		this->TruncateOutput(m_BytesWritten);
+	}
+}
+
+#ifdef _WIN32
+
+bool YuvFileSink::OpenOutput( const char* inPath )
+{
+	m_File = CreateFileA(inPath, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+						 FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	m_Unbuffered = (m_File != INVALID_HANDLE_VALUE);
+	if (!m_Unbuffered)
+	{
+		m_File = CreateFileA(inPath, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+							 FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	}
+	return m_File != INVALID_HANDLE_VALUE;
+}
+
+void YuvFileSink::CloseOutput( void )
+{
+	if (m_File != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_File);
+		m_File = INVALID_HANDLE_VALUE;
+	}
+}
+
+bool YuvFileSink::WriteOutput( const unsigned char* inData, long inLength )
+{
+	while (inLength > 0)
+	{
+		DWORD written = 0;
+		if (!::WriteFile(m_File, inData, inLength, &written, NULL) || written == 0)
+			return false;
+		inData += written;
+		inLength -= written;
+	}
+	return true;
+}
+
+void YuvFileSink::TruncateOutput( long long inLength )
+{
+	LARGE_INTEGER position;
+	position.QuadPart = inLength;
+	if (!SetFilePointerEx(m_File, position, NULL, FILE_BEGIN) || !SetEndOfFile(m_File))
+	{
+		printf("Cannot truncate the output to %lld bytes\n", inLength);
+	}
+}
+
+#else
+
+bool YuvFileSink::OpenOutput( const char* inPath )
+{
+	m_File = -1;
+	m_Unbuffered = false;
+#ifdef O_DIRECT
+	m_File = open(inPath, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+	m_Unbuffered = (m_File >= 0);
+#endif
+	if (m_File < 0)
+	{
+		m_File = open(inPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+	return m_File >= 0;
+}
+
+void YuvFileSink::CloseOutput( void )
+{
+	if (m_File >= 0)
+	{
+		close(m_File);
+		m_File = -1;
+	}
+}
+
+bool YuvFileSink::WriteOutput( const unsigned char* inData, long inLength )
+{
+	while (inLength > 0)
+	{
+		ssize_t written = write(m_File, inData, inLength);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+#ifdef O_DIRECT
+			// Some file systems accept O_DIRECT at open time only
+			if (errno == EINVAL && m_Unbuffered)
+			{
+				fcntl(m_File, F_SETFL, fcntl(m_File, F_GETFL) & ~O_DIRECT);
+				m_Unbuffered = false;
+				continue;
+			}
+#endif
+			return false;
+		}
+		inData += written;
+		inLength -= written;
+	}
+	return true;
+}
+
+void YuvFileSink::TruncateOutput( long long inLength )
+{
+	if (ftruncate(m_File, inLength) != 0)
+	{
+		printf("Cannot truncate the output to %lld bytes\n", inLength);
+	}
+}
+
+#endif
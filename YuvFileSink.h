@@ -0,0 +1,129 @@
+//------------------------------------------------------------------------------
+// File: YuvFileSink.h
+//
+// Author: Ren Yifei, Lin Ziya
+//
+// Contact: yfren@cs.hku.hk, zlin@cs.hku.hk
+//
+// Desc: Frame sink writing the decoded frames to a file, as raw I420,
+// raw NV12 or a YUV4MPEG2 (Y4M) stream. The frames are copied into a
+// bounded queue of large blocks written by an I/O thread, unbuffered
+// where the file system allows, so the decoding thread only waits for
+// the disk when the queue is full.
+//
+//------------------------------------------------------------------------------
+
+#ifndef YUV_FILE_SINK_H_
+#define YUV_FILE_SINK_H_
+
+#include "FrameSink.h"
+#include "Platform.h"
+
+#define YUV_FORMAT_I420		0	// Frames back to back, no header
+#define YUV_FORMAT_NV12		1
+#define YUV_FORMAT_Y4M		2	// I420 frames
+
+#define YUV_WRITE_BLOCK		(4*1024*1024)	// Bytes per write
+#define YUV_WRITE_BLOCKS	8				// Default queue length, in blocks
+#define YUV_WRITE_ALIGN		4096			// Unbuffered writes cover whole sectors
+
+typedef struct
+{
+	long long	BytesWritten;
+	long		Writes;
+	long long	WriteUs;		// I/O thread in the write calls
+	long long	BlockedUs;		// Decoding thread waiting for a free block
+	double		WriteMBps;		// BytesWritten over WriteUs
+	bool		Unbuffered;		// O_DIRECT or FILE_FLAG_NO_BUFFERING in effect
+} YuvWriteStatistics;
+
+class YuvFileSink : public FrameSink
+{
+public:
+
+	YuvFileSink();
+	virtual ~YuvFileSink();
+
+	// Creates the file and starts the I/O thread. inQueueBlocks blocks of
+	// YUV_WRITE_BLOCK bytes are allocated up front.
+	bool	Open(const char* inPath, int inFormat, int inQueueBlocks = YUV_WRITE_BLOCKS);
+
+	// Writes what is queued and waits for the I/O thread
+	void	Close(void);
+
+	// Y4M header fields, taken from the SPS by the caller. Set before the
+	// first frame.
+	void	SetFrameRate(unsigned int inNumerator, unsigned int inDenominator);
+	void	SetAspectRatio(int inWidth, int inHeight);
+
+	// Final after Close
+	void	GetStatistics(YuvWriteStatistics* outStats) const;
+
+	// FrameSink. OnFrame only blocks while the queue is full, and fails once
+	// a write has failed. OnEndOfStream waits for the full blocks to be written.
+	bool	OnFrame(const DecodedFrame& inFrame);
+	void	OnEndOfStream(void);
+
+private:
+
+	typedef struct
+	{
+		unsigned char*	Data;
+		long			Used;
+		bool			Last;		// Ends the file, the I/O thread exits after it
+	} WriteBlock;
+
+	bool	OpenOutput(const char* inPath);
+	void	CloseOutput(void);
+	bool	WriteOutput(const unsigned char* inData, long inLength);
+	void	TruncateOutput(long long inLength);
+
+	bool	Append(const unsigned char* inData, long inLength);
+	bool	AcquireBlock(void);
+	void	SubmitBlock(bool inLast);
+
+	static void	WriterThread(void* inThis);
+	void	WriteBlocks(void);
+
+private:
+
+	int			m_Format;
+	unsigned int	m_RateNumerator;
+	unsigned int	m_RateDenominator;
+	int			m_SarWidth;
+	int			m_SarHeight;
+
+	// Size of the first frame, Y4M cannot change it
+	int			m_Width;
+	int			m_Height;
+
+	unsigned char*	m_Interleaved;	// NV12 chroma of one frame
+	long		m_InterleavedSize;
+
+	// Blocks are filled and written in ring order
+	WriteBlock*	m_Blocks;
+	int			m_BlockCount;
+	int			m_FillIndex;
+	bool		m_Filling;			// The decoding thread holds m_Blocks[m_FillIndex]
+	int			m_WriteIndex;
+	PlatformSemaphore*	m_FreeBlocks;
+	PlatformSemaphore*	m_FullBlocks;
+	volatile long	m_Submitted;
+	volatile long	m_Completed;
+	PlatformThread	m_Writer;
+	volatile bool	m_Failed;
+
+#ifdef _WIN32
+	HANDLE		m_File;
+#else
+	int			m_File;
+#endif
+	bool		m_Unbuffered;
+
+	long long	m_BlockedUs;		// Decoding thread
+	long long	m_BytesWritten;		// I/O thread, padding excluded
+	long		m_Writes;
+	long long	m_WriteUs;
+};
+
+#endif